@@ -138,8 +138,11 @@ typedef struct INTNETBUF
     STAMCOUNTER     cStatLost;
     /** Number of bad frames (both rings). */
     STAMCOUNTER     cStatBadFrames;
-    /** Reserved for future use. */
-    STAMCOUNTER     aStatReserved[2];
+    /** Number of receive ring wakeups signalled by the producers. */
+    STAMCOUNTER     cStatWakeups;
+    /** Number of receive ring wakeups skipped because the consumer was still
+     * busy with earlier frames. */
+    STAMCOUNTER     cStatWakeupsSkipped;
     /** Reserved for future send profiling. */
     STAMPROFILE     StatSend1;
     /** Reserved for future send profiling. */
@@ -148,8 +151,9 @@ typedef struct INTNETBUF
     STAMPROFILE     StatRecv1;
     /** Reserved for future receive profiling. */
     STAMPROFILE     StatRecv2;
-    /** Reserved for future profiling. */
-    STAMPROFILE     StatReserved;
+    /** Profiling the unicast switching of frames sent by this interface.
+     * The number of periods is the number of switch decisions. */
+    STAMPROFILE     StatSwitch;
 } INTNETBUF;
 AssertCompileSize(INTNETBUF, 320);
 AssertCompileMemberOffset(INTNETBUF, Recv, 16);
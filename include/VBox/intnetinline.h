@@ -420,9 +420,12 @@ DECLINLINE(int) intnetRingAllocateFrameInternal(PINTNETRINGBUF pRingBuf, uint32_
     if (offRead <= offWriteInt)
     {
         /*
-         * Try fit it all before the end of the buffer.
+         * Try fit it all before the end of the buffer.  If that wraps the
+         * write offset around to the reader the ring would look empty.
          */
-        if (pRingBuf->offEnd - offWriteInt >= cb + sizeof(INTNETHDR))
+        if (   pRingBuf->offEnd - offWriteInt > cb + sizeof(INTNETHDR)
+            || (   pRingBuf->offEnd - offWriteInt == cb + sizeof(INTNETHDR)
+                && offRead != pRingBuf->offStart))
         {
             uint32_t offNew = offWriteInt + cb + sizeof(INTNETHDR);
             if (offNew >= pRingBuf->offEnd)
@@ -565,9 +568,11 @@ DECLINLINE(void) IntNetRingCommitFrame(PINTNETRINGBUF pRingBuf, PINTNETHDR pHdr)
         offWriteCom = pRingBuf->offStart;
     }
     Log2(("IntNetRingCommitFrame:   offWriteCom: %#x -> %#x (R=%#x T=%#x S=%#x)\n", pRingBuf->offWriteCom, offWriteCom, pRingBuf->offReadX, pHdr->u8Type, cbFrame));
-    ASMAtomicWriteU32(&pRingBuf->offWriteCom, offWriteCom);
+    /* Update the statistics before publishing the frame, the next producer in
+       line may commit as soon as offWriteCom has been written. */
     STAM_REL_COUNTER_ADD(&pRingBuf->cbStatWritten, cbFrame);
     STAM_REL_COUNTER_INC(&pRingBuf->cStatFrames);
+    ASMAtomicWriteU32(&pRingBuf->offWriteCom, offWriteCom);
 }
 
 
@@ -657,9 +662,12 @@ DECLINLINE(int) IntNetRingWriteFrame(PINTNETRINGBUF pRingBuf, const void *pvFram
     if (offRead <= offWriteInt)
     {
         /*
-         * Try fit it all before the end of the buffer.
+         * Try fit it all before the end of the buffer.  If that wraps the
+         * write offset around to the reader the ring would look empty.
          */
-        if (pRingBuf->offEnd - offWriteInt >= cb + sizeof(INTNETHDR))
+        if (   pRingBuf->offEnd - offWriteInt > cb + sizeof(INTNETHDR)
+            || (   pRingBuf->offEnd - offWriteInt == cb + sizeof(INTNETHDR)
+                && offRead != pRingBuf->offStart))
         {
             uint32_t offNew = offWriteInt + cb + sizeof(INTNETHDR);
             if (offNew >= pRingBuf->offEnd)
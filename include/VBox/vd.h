@@ -457,6 +457,95 @@ typedef struct VDFILTERINFO
     PCVDCONFIGINFO paConfigInfo;
 } VDFILTERINFO, *PVDFILTERINFO;
 
+/**
+ * How writes to the virtual disk are handled by an attached cache image.
+ */
+typedef enum VDCACHEMODE
+{
+    /** Invalid mode. */
+    VDCACHEMODE_INVALID = 0,
+    /** Writes bypass the cache, the affected cached ranges are dropped. */
+    VDCACHEMODE_WRITE_AROUND,
+    /** Writes go to the image and to the cache. */
+    VDCACHEMODE_WRITE_THROUGH,
+    /** 32bit hack. */
+    VDCACHEMODE_32BIT_HACK = 0x7fffffff
+} VDCACHEMODE;
+
+/**
+ * Cache statistics, updated by the VD layer while a cache is attached.
+ */
+typedef struct VDCACHESTATS
+{
+    /** Number of reads satisfied from the cache. */
+    uint64_t    cReadHits;
+    /** Number of bytes read from the cache. */
+    uint64_t    cbReadHits;
+    /** Number of reads which had to go to the image. */
+    uint64_t    cReadMisses;
+    /** Number of bytes read from the image because they were not cached. */
+    uint64_t    cbReadMisses;
+    /** Number of cache fills after a miss. */
+    uint64_t    cFills;
+    /** Number of bytes written to the cache after a miss. */
+    uint64_t    cbFills;
+    /** Number of misses not admitted to the cache. */
+    uint64_t    cFillsRejected;
+    /** Number of guest writes written through to the cache. */
+    uint64_t    cWriteUpdates;
+    /** Number of bytes written through to the cache. */
+    uint64_t    cbWriteUpdates;
+    /** Number of ranges dropped from the cache. */
+    uint64_t    cInvalidations;
+} VDCACHESTATS;
+/** Pointer to cache statistics. */
+typedef VDCACHESTATS *PVDCACHESTATS;
+
+/**
+ * Cache configuration.
+ */
+typedef struct VDCACHECFG
+{
+    /** How writes are handled. */
+    VDCACHEMODE     enmMode;
+    /** Reads larger than this are never admitted to the cache (to keep
+     * sequential scans from flushing it), 0 for no limit. */
+    size_t          cbAdmitMax;
+    /** Number of misses a 64KB chunk must see before it is admitted
+     * to the cache, 0 or 1 admits on the first miss. */
+    uint32_t        cAdmitMisses;
+    /** Where to store the statistics, optional. The memory must stay valid
+     * until the cache is closed or the configuration is changed. */
+    PVDCACHESTATS   pStats;
+} VDCACHECFG;
+/** Pointer to a cache configuration. */
+typedef VDCACHECFG *PVDCACHECFG;
+/** Pointer to a const cache configuration. */
+typedef const VDCACHECFG *PCVDCACHECFG;
+
+/**
+ * Statistics of the allocation index which remembers which image of the chain
+ * holds the data for a range so reads don't have to query every image.
+ */
+typedef struct VDALLOCINDEXSTATS
+{
+    /** Number of reads looked up in the index. */
+    uint64_t        cLookups;
+    /** Number of lookups which found the owning image in the index. */
+    uint64_t        cHits;
+    /** Number of images queried for the data, the chain walk depth with the index. */
+    uint64_t        cImagesRead;
+    /** Number of images skipped because of the index, cImagesRead + cImagesSkipped
+     * is the chain walk depth without it. */
+    uint64_t        cImagesSkipped;
+    /** Number of writes which invalidated ranges in the index. */
+    uint64_t        cInvalidations;
+    /** Number of times the whole index was dropped because the chain changed. */
+    uint64_t        cResets;
+} VDALLOCINDEXSTATS;
+/** Pointer to allocation index statistics. */
+typedef VDALLOCINDEXSTATS *PVDALLOCINDEXSTATS;
+
 
 /**
  * Request completion callback for the async read/write API.
@@ -954,6 +1043,30 @@ VBOXDDU_DECL(int) VDFilterRemove(PVDISK pDisk, uint32_t fFlags);
  */
 VBOXDDU_DECL(int) VDCacheClose(PVDISK pDisk, bool fDelete);
 
+/**
+ * Changes how the currently opened cache image is used.
+ *
+ * @return  VBox status code.
+ * @return  VERR_VD_NOT_OPENED if no cache is opened in HDD container.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   pCfg            The new configuration.
+ */
+VBOXDDU_DECL(int) VDCacheSetConfig(PVDISK pDisk, PCVDCACHECFG pCfg);
+
+/**
+ * Configures the allocation index of the image chain.
+ *
+ * The index is enabled by default and only used if more than one image is opened.
+ *
+ * @return  VBox status code.
+ * @param   pDisk           Pointer to HDD container.
+ * @param   cRangesMax      Maximum number of ranges to remember, 0 disables the index.
+ * @param   pStats          Where to store the statistics, optional. The memory must
+ *                          stay valid until the disk is destroyed or the
+ *                          configuration is changed.
+ */
+VBOXDDU_DECL(int) VDAllocIndexSetConfig(PVDISK pDisk, uint32_t cRangesMax, PVDALLOCINDEXSTATS pStats);
+
 /**
  * Closes all opened image files in HDD container.
  *
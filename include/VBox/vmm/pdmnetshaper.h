@@ -42,6 +42,7 @@
 
 #define PDM_NETSHAPER_MIN_BUCKET_SIZE UINT32_C(65536) /**< bytes */
 #define PDM_NETSHAPER_MAX_LATENCY     UINT32_C(100)   /**< milliseconds */
+#define PDM_NETSHAPER_MAX_DEPTH       UINT32_C(4)     /**< levels of nested bandwidth groups */
 
 RT_C_DECLS_BEGIN
 
@@ -56,9 +57,20 @@ typedef struct PDMNSFILTER
     /** Set when the filter fails to obtain bandwidth. */
     bool                                fChoked;
     /** Aligment padding. */
-    bool                                afPadding[HC_ARCH_BITS == 32 ? 3 : 7];
+    bool                                afPadding[3];
+    /** The weight of this filter when sharing the group bandwidth with the
+     * other filters of the group.  Set before attaching, 0 is taken as 1. */
+    uint32_t                            uWeight;
     /** The driver this filter is aggregated into (ring-3). */
     R3PTRTYPE(PPDMINETWORKDOWN)         pIDrvNetR3;
+    /** Number of bytes left of the weighted share of the group bandwidth. */
+    uint32_t                            cbShareTokens;
+    /** Aligment padding. */
+    uint32_t                            u32Padding;
+    /** Timestamp of the last share update. */
+    uint64_t                            tsShareUpdated;
+    /** Timestamp of when the filter got choked. */
+    uint64_t                            tsChoked;
 } PDMNSFILTER;
 
 VMMDECL(bool)       PDMNsAllocateBandwidth(PPDMNSFILTER pFilter, size_t cbTransfer);
@@ -111,7 +111,7 @@ typedef struct UVM
 #ifdef VMM_INCLUDED_SRC_include_VMInternal_h
         struct VMINTUSERPERVM   s;
 #endif
-        uint8_t                 padding[512];
+        uint8_t                 padding[640];
     } vm;
 
     /** The MM data. */
@@ -251,6 +251,10 @@ typedef struct VMREQ
     VMREQTYPE               enmType;
     /** Request destination. */
     VMCPUID                 idDstCpu;
+#ifdef VBOX_WITH_STATISTICS
+    /** RTTimeNanoTS when the request was queued, for the latency statistics. */
+    uint64_t                u64QueuedNanoTS;
+#endif
     /** Request specific data. */
     union VMREQ_U
     {
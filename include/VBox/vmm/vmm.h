@@ -72,6 +72,8 @@ typedef enum VMMCALLRING3
     VMMCALLRING3_PGM_ALLOCATE_HANDY_PAGES,
     /** Allocates a large (2MB) page. */
     VMMCALLRING3_PGM_ALLOCATE_LARGE_HANDY_PAGE,
+    /** Restores a guest page pending lazy restore from the saved state file. */
+    VMMCALLRING3_PGM_LAZY_RESTORE_PAGE,
     /** Acquire the MM hypervisor heap lock. */
     VMMCALLRING3_MMHYPER_LOCK,
     /** Flush the GC/R0 logger. */
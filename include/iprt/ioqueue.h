@@ -243,6 +243,22 @@ typedef RTIOQUEUEPROVVTABLE const *PCRTIOQUEUEPROVVTABLE;
 /** @}  */
 
 
+/** @name RTIoQueueCreate() flags.
+ * Providers which don't know about a particular feature ignore the flag, providers
+ * implementing it fail the queue creation if the host doesn't support it.
+ * @{ */
+/** Registers handles with the provider up front when calling RTIoQueueHandleRegister()
+ * to save the per request lookup in the host kernel (fixed files for io_uring). */
+#define RTIOQUEUE_F_FIXED_HANDLES           RT_BIT_32(0)
+/** Let the host poll the submission queue from a dedicated kernel thread so
+ * RTIoQueueCommit() usually doesn't need to do a syscall at all.  Requires elevated
+ * privileges on older Linux hosts. */
+#define RTIOQUEUE_F_SQ_POLL                 RT_BIT_32(1)
+/** Mask of the valid I/O queue creation flags. */
+#define RTIOQUEUE_F_VALID_MASK              UINT32_C(0x00000003)
+/** @}  */
+
+
 /**
  * Tries to return the best I/O queue provider for the given handle type on the called
  * host system.
@@ -270,7 +286,7 @@ RTDECL(PCRTIOQUEUEPROVVTABLE) RTIoQueueProviderGetById(const char *pszId);
  * @returns IPRT status code.
  * @param   phIoQueue           Where to store the handle to the I/O queue on success.
  * @param   pProvVTable         The I/O queue provider vtable which will process the requests.
- * @param   fFlags              Flags for the queue (MBZ for now).
+ * @param   fFlags              Flags for the queue, combination of RTIOQUEUE_F_XXX.
  * @param   cSqEntries          Number of entries for the submission queue.
  * @param   cCqEntries          Number of entries for the completion queue.
  *
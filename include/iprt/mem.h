@@ -542,8 +542,13 @@ RTDECL(void *) RTMemPageAllocExTag(size_t cb, uint32_t fFlags, const char *pszTa
 #define RTMEMPAGEALLOC_F_ADVISE_LOCKED  RT_BIT_32(1)
 /** Try prevent the memory from ending up in a dump/core. */
 #define RTMEMPAGEALLOC_F_ADVISE_NO_DUMP RT_BIT_32(2)
+/** Try back the memory with large pages (failure ignored). Only areas aligned
+ * to the large page size can be backed by large pages, so the caller should
+ * take care of the alignment. Currently only has an effect on Linux hosts with
+ * transparent huge pages. */
+#define RTMEMPAGEALLOC_F_ADVISE_LARGE_PAGES RT_BIT_32(3)
 /** Valid bit mask. */
-#define RTMEMPAGEALLOC_F_VALID_MASK     UINT32_C(0x00000007)
+#define RTMEMPAGEALLOC_F_VALID_MASK     UINT32_C(0x0000000f)
 /** @} */
 
 /**
@@ -3007,9 +3007,10 @@ static DECLCALLBACK(int) virtioNetR3Construct(PPDMDEVINS pDevIns, int iInstance,
     if (RT_FAILURE(rc))
         return PDMDEV_SET_ERROR(pDevIns, rc, N_("Failed to create event semaphore"));
 
-    /* Initialize VirtIO core. (pfnStatusChanged callback when both host VirtIO core & guest driver are ready) */
+    /* Initialize VirtIO core. (pfnStatusChanged callback when both host VirtIO core & guest driver are ready)
+     * Buffers are never re-fetched by head index here, so the packed virtq layout can be offered too. */
     rc = virtioCoreR3Init(pDevIns, &pThis->Virtio, &pThisCC->Virtio, &VirtioPciParams, pThis->szInst,
-                          VIRTIONET_HOST_FEATURES_OFFERED,
+                          VIRTIONET_HOST_FEATURES_OFFERED | VIRTIO_F_RING_PACKED,
                           &pThis->virtioNetConfig /*pvDevSpecificCap*/, sizeof(pThis->virtioNetConfig));
     if (RT_FAILURE(rc))
         return PDMDEV_SET_ERROR(pDevIns, rc, N_("virtio-net: failed to initialize VirtIO"));
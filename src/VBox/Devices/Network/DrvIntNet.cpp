@@ -1226,11 +1226,13 @@ static DECLCALLBACK(void) drvR3IntNetDestruct(PPDMDRVINS pDrvIns)
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatYieldsNok);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatLost);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatBadFrames);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatWakeups);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->cStatWakeupsSkipped);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatSend1);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatSend2);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatRecv1);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatRecv2);
-        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatReserved);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->pBufR3->StatSwitch);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceivedGso);
         PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatSentGso);
 #ifdef VBOX_WITH_STATISTICS
@@ -1624,12 +1626,14 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     AssertRCReturn(rc, rc);
 
 
-    /** @cfgm{ReceiveBufferSize, uint32_t, 318 KB}
-     * The size of the receive buffer.
+    /** @cfgm{ReceiveBufferSize, uint32_t, 318 KB or 1 MB}
+     * The size of the receive buffer.  The default depends on whether the device
+     * above us takes GSO frames: these are up to 64 KB each, so a 318 KB ring
+     * only holds a handful of them when several VMs are blasting at us.
      */
     rc = CFGMR3QueryU32(pCfg, "ReceiveBufferSize", &OpenReq.cbRecv);
     if (rc == VERR_CFGM_VALUE_NOT_FOUND)
-        OpenReq.cbRecv = 318 * _1K ;
+        OpenReq.cbRecv = pThis->pIAboveNet->pfnReceiveGso ? _1M : 318 * _1K;
     else if (RT_FAILURE(rc))
         return PDMDRV_SET_ERROR(pDrvIns, rc,
                                 N_("Configuration error: Failed to get the \"ReceiveBufferSize\" value"));
@@ -1805,11 +1809,13 @@ static DECLCALLBACK(int) drvR3IntNetConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatYieldsNok,     "YieldOk",              "Number of times yielding helped fix an overflow.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatYieldsOk,      "YieldNok",             "Number of times yielding didn't help fix an overflow.");
     PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatBadFrames,     "BadFrames",            "Number of bad frames seed by the consumers.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatWakeups,       "Wakeups",              "Number of receive thread wakeups signalled by the producers.");
+    PDMDrvHlpSTAMRegCounter(pDrvIns, &pThis->pBufR3->cStatWakeupsSkipped, "WakeupsSkipped",      "Number of wakeups skipped because the receive thread was still busy.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatSend1,          "Send1",                "Profiling IntNetR0IfSend.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatSend2,          "Send2",                "Profiling sending to the trunk.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatRecv1,          "Recv1",                "Reserved for future receive profiling.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatRecv2,          "Recv2",                "Reserved for future receive profiling.");
-    PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatReserved,       "Reserved",             "Reserved for future use.");
+    PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->pBufR3->StatSwitch,         "Switch",               "Profiling unicast switch decisions for sent packets.");
 #ifdef VBOX_WITH_STATISTICS
     PDMDrvHlpSTAMRegProfileAdv(pDrvIns, &pThis->StatReceive,             "Receive",              "Profiling packet receive runs.");
     PDMDrvHlpSTAMRegProfile(pDrvIns, &pThis->StatTransmit,               "Transmit",             "Profiling packet transmit runs.");
@@ -459,7 +459,7 @@ static DECLCALLBACK(int) drvR3NetShaperConstruct(PPDMDRVINS pDrvIns, PCFGMNODE p
     /*
      * Validate the config.
      */
-    if (!CFGMR3AreValuesValid(pCfg, "BwGroup\0"))
+    if (!CFGMR3AreValuesValid(pCfg, "BwGroup\0Weight\0"))
         return VERR_PDM_DRVINS_UNKNOWN_CFG_VALUES;
 
     /*
@@ -475,6 +475,17 @@ static DECLCALLBACK(int) drvR3NetShaperConstruct(PPDMDRVINS pDrvIns, PCFGMNODE p
     else
         rc = VINF_SUCCESS;
 
+    /*
+     * Our weight when sharing the group bandwidth with the other filters.
+     */
+    rc = CFGMR3QueryU32Def(pCfg, "Weight", &pThis->Filter.uWeight, 1);
+    if (RT_FAILURE(rc))
+        return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                N_("DrvNetShaper: Configuration error: Querying \"Weight\" as unsigned integer failed"));
+    if (pThis->Filter.uWeight - 1 >= _64K)
+        return PDMDrvHlpVMSetError(pDrvIns, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                                   N_("DrvNetShaper: Configuration error: \"Weight\" must be between 1 and 65536"));
+
     pThis->Filter.pIDrvNetR3 = &pThis->INetworkDown;
     rc = PDMDrvHlpNetShaperAttach(pDrvIns, pThis->pszBwGroup, &pThis->Filter);
     if (RT_FAILURE(rc))
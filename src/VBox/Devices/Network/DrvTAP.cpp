@@ -30,6 +30,7 @@
 #include <iprt/ctype.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/net.h>
 #include <iprt/path.h>
 #include <iprt/pipe.h>
 #include <iprt/semaphore.h>
@@ -61,15 +62,61 @@
 #else
 # include <sys/fcntl.h>
 #endif
+#ifdef RT_OS_LINUX
+# include <sys/uio.h>
+# include <net/if.h>
+# include <linux/if_tun.h>
+#endif
 #include <errno.h>
 #include <unistd.h>
 
 #include "VBoxDD.h"
 
 
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** Size of the receive buffer, big enough for the largest GSO frame the host can hand us. */
+#define DRVTAP_RECV_BUF_SIZE            (_64K + 64)
+/** The maximum number of frames to read after one poll() wakeup. */
+#define DRVTAP_RECV_BATCH_MAX           64
+
+#ifdef RT_OS_LINUX
+/** @name Virtio-net header flags and GSO types (see struct virtio_net_hdr).
+ * @{ */
+#define DRVTAP_VNETHDR_F_NEEDS_CSUM     1
+#define DRVTAP_VNETHDR_GSO_NONE         0
+#define DRVTAP_VNETHDR_GSO_TCPV4        1
+#define DRVTAP_VNETHDR_GSO_TCPV6        4
+#define DRVTAP_VNETHDR_GSO_ECN          0x80
+/** @} */
+#endif
+
+
 /*********************************************************************************************************************************
 *   Structures and Typedefs                                                                                                      *
 *********************************************************************************************************************************/
+#ifdef RT_OS_LINUX
+/**
+ * The virtio-net header the TAP device puts in front of every frame when it was
+ * created with IFF_VNET_HDR (struct virtio_net_hdr, host endian).
+ */
+typedef struct DRVTAPVNETHDR
+{
+    uint8_t                 u8Flags;
+    uint8_t                 u8GsoType;
+    uint16_t                u16HdrLen;
+    uint16_t                u16GsoSize;
+    uint16_t                u16CSumStart;
+    uint16_t                u16CSumOffset;
+} DRVTAPVNETHDR;
+AssertCompileSize(DRVTAPVNETHDR, 10);
+/** Pointer to a virtio-net header. */
+typedef DRVTAPVNETHDR *PDRVTAPVNETHDR;
+/** Pointer to a const virtio-net header. */
+typedef DRVTAPVNETHDR const *PCDRVTAPVNETHDR;
+#endif
+
 /**
  * TAP driver instance data.
  *
@@ -103,6 +150,13 @@ typedef struct DRVTAP
     RTPIPE                  hPipeRead;
     /** Reader thread. */
     PPDMTHREAD              pThread;
+    /** The receive buffer (DRVTAP_RECV_BUF_SIZE). */
+    uint8_t                *pbRecvBuf;
+#ifdef RT_OS_LINUX
+    /** Whether the frames are preceded by a virtio-net header (IFF_VNET_HDR),
+     * allowing GSO frames to be passed through in both directions. */
+    bool                    fVnetHdr;
+#endif
 
     /** @todo The transmit thread. */
     /** Transmit lock used by drvTAPNetworkUp_BeginXmit. */
@@ -117,6 +171,14 @@ typedef struct DRVTAP
     STAMCOUNTER             StatPktRecv;
     /** Number of received bytes. */
     STAMCOUNTER             StatPktRecvBytes;
+    /** Number of GSO frames passed to the host without segmenting them. */
+    STAMCOUNTER             StatPktSentGso;
+    /** Number of GSO frames received from the host. */
+    STAMCOUNTER             StatPktRecvGso;
+    /** Number of GSO frames received which had to be segmented here. */
+    STAMCOUNTER             StatPktRecvGsoCarved;
+    /** Number of poll() wakeups with frames to read (frames per wakeup = StatPktRecv / this). */
+    STAMCOUNTER             StatRecvWakeups;
     /** Profiling packet transmit runs. */
     STAMPROFILE             StatTransmit;
     /** Profiling packet receive runs. */
@@ -144,6 +206,162 @@ static int              SolarisTAPAttach(PDRVTAP pThis);
 #endif
 
 
+#ifdef RT_OS_LINUX
+/**
+ * Sets up the virtio-net header for passing a GSO frame to the host as a whole,
+ * fixing up the IP length and TCP pseudo header checksum the host kernel uses
+ * when segmenting.
+ *
+ * @returns true if the frame can be passed on, false if it must be segmented here.
+ * @param   pGso            The GSO context.
+ * @param   pbFrame         The frame, modified.
+ * @param   cbFrame         The size of the frame.
+ * @param   pHdr            Where to return the virtio-net header.
+ */
+static bool drvTAPVnetHdrFromGso(PCPDMNETWORKGSO pGso, uint8_t *pbFrame, size_t cbFrame, PDRVTAPVNETHDR pHdr)
+{
+    /* UDP fragmentation and tunneled frames are left to PDMNetGsoCarveSegmentQD. */
+    if (   (   pGso->u8Type != PDMNETWORKGSOTYPE_IPV4_TCP
+            && pGso->u8Type != PDMNETWORKGSOTYPE_IPV6_TCP)
+        || !PDMNetGsoIsValid(pGso, sizeof(*pGso), cbFrame)
+        || cbFrame - pGso->offHdr1 > UINT16_MAX)
+        return false;
+
+    uint16_t const cbL4    = (uint16_t)(cbFrame - pGso->offHdr2);
+    PRTNETTCP      pTcpHdr = (PRTNETTCP)&pbFrame[pGso->offHdr2];
+    uint32_t       u32Sum;
+    if (pGso->u8Type == PDMNETWORKGSOTYPE_IPV4_TCP)
+    {
+        PRTNETIPV4 pIpHdr = (PRTNETIPV4)&pbFrame[pGso->offHdr1];
+        pIpHdr->ip_len = RT_H2N_U16((uint16_t)(cbFrame - pGso->offHdr1));
+        pIpHdr->ip_sum = 0;
+        pIpHdr->ip_sum = RTNetIPv4HdrChecksum(pIpHdr);
+        u32Sum = RTNetIPv4PseudoChecksumBits(pIpHdr->ip_src, pIpHdr->ip_dst, RTNETIPV4_PROT_TCP, cbL4);
+        pHdr->u8GsoType = DRVTAP_VNETHDR_GSO_TCPV4;
+    }
+    else
+    {
+        PRTNETIPV6 pIpHdr = (PRTNETIPV6)&pbFrame[pGso->offHdr1];
+        pIpHdr->ip6_plen = RT_H2N_U16((uint16_t)(cbFrame - pGso->offHdr1 - sizeof(RTNETIPV6)));
+        u32Sum = RTNetIPv6PseudoChecksumBits(&pIpHdr->ip6_src, &pIpHdr->ip6_dst, RTNETIPV4_PROT_TCP, cbL4);
+        pHdr->u8GsoType = DRVTAP_VNETHDR_GSO_TCPV6;
+    }
+    /* The host completes the checksum, it expects the uncomplemented pseudo header sum. */
+    pTcpHdr->th_sum = (uint16_t)~RTNetIPv4FinalizeChecksum(u32Sum);
+
+    pHdr->u8Flags       = DRVTAP_VNETHDR_F_NEEDS_CSUM;
+    pHdr->u16HdrLen     = pGso->cbHdrsTotal;
+    pHdr->u16GsoSize    = pGso->cbMaxSeg;
+    pHdr->u16CSumStart  = pGso->offHdr2;
+    pHdr->u16CSumOffset = RT_UOFFSETOF(RTNETTCP, th_sum);
+    return true;
+}
+
+
+/**
+ * Converts the virtio-net header of a received frame into a GSO context.
+ *
+ * @returns pGso if the frame is a valid GSO frame, NULL otherwise.
+ * @param   pHdr            The virtio-net header.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The size of the frame.
+ * @param   pGso            Where to return the GSO context.
+ */
+static PPDMNETWORKGSO drvTAPVnetHdrToGso(PCDRVTAPVNETHDR pHdr, uint8_t const *pbFrame, size_t cbFrame, PPDMNETWORKGSO pGso)
+{
+    switch (pHdr->u8GsoType & ~DRVTAP_VNETHDR_GSO_ECN)
+    {
+        case DRVTAP_VNETHDR_GSO_TCPV4:
+            pGso->u8Type = PDMNETWORKGSOTYPE_IPV4_TCP;
+            break;
+        case DRVTAP_VNETHDR_GSO_TCPV6:
+            pGso->u8Type = PDMNETWORKGSOTYPE_IPV6_TCP;
+            break;
+        default:
+            return NULL;
+    }
+    if (   !(pHdr->u8Flags & DRVTAP_VNETHDR_F_NEEDS_CSUM)
+        || pHdr->u16CSumStart > UINT8_MAX
+        || (size_t)pHdr->u16CSumStart + sizeof(RTNETTCP) > cbFrame)
+        return NULL;
+
+    /* Don't trust u16HdrLen, the host only uses it as a hint. */
+    PCRTNETETHERHDR pEthHdr  = (PCRTNETETHERHDR)pbFrame;
+    PCRTNETTCP      pTcpHdr  = (PCRTNETTCP)&pbFrame[pHdr->u16CSumStart];
+    uint32_t const  cbHdrsTotal = pHdr->u16CSumStart + pTcpHdr->th_off * 4;
+    if (cbHdrsTotal > UINT8_MAX)
+        return NULL;
+
+    pGso->offHdr1     = pEthHdr->EtherType == RT_H2N_U16_C(RTNET_ETHERTYPE_VLAN)
+                      ? sizeof(RTNETETHERHDR) + 4 : sizeof(RTNETETHERHDR);
+    pGso->offHdr2     = (uint8_t)pHdr->u16CSumStart;
+    pGso->cbHdrsTotal = (uint8_t)cbHdrsTotal;
+    pGso->cbHdrsSeg   = (uint8_t)cbHdrsTotal;
+    pGso->cbMaxSeg    = pHdr->u16GsoSize;
+    pGso->u8Unused    = 0;
+    return PDMNetGsoIsValid(pGso, sizeof(*pGso), cbFrame) ? pGso : NULL;
+}
+
+
+/**
+ * Completes the checksum of a received frame the host left to us.
+ *
+ * @param   pHdr            The virtio-net header.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The size of the frame.
+ */
+static void drvTAPVnetHdrCompleteChecksum(PCDRVTAPVNETHDR pHdr, uint8_t *pbFrame, size_t cbFrame)
+{
+    AssertReturnVoid((size_t)pHdr->u16CSumStart + pHdr->u16CSumOffset + sizeof(uint16_t) <= cbFrame);
+
+    /* The checksum field contains the pseudo header sum already. */
+    bool     fOdd   = false;
+    uint32_t u32Sum = RTNetIPv4AddDataChecksum(&pbFrame[pHdr->u16CSumStart], cbFrame - pHdr->u16CSumStart, 0, &fOdd);
+    uint16_t u16Sum = RTNetIPv4FinalizeChecksum(u32Sum);
+    memcpy(&pbFrame[pHdr->u16CSumStart + pHdr->u16CSumOffset], &u16Sum, sizeof(u16Sum));
+}
+#endif /* RT_OS_LINUX */
+
+
+/**
+ * Writes one frame to the TAP device.
+ *
+ * @returns IPRT status code.
+ * @param   pThis           The instance data.
+ * @param   pvFrame         The frame.
+ * @param   cbFrame         The size of the frame.
+ * @param   pvVnetHdr       The virtio-net header to use (PDRVTAPVNETHDR), NULL for
+ *                          a plain frame.  Ignored if the device has no header.
+ */
+static int drvTAPWriteFrame(PDRVTAP pThis, const void *pvFrame, size_t cbFrame, const void *pvVnetHdr)
+{
+#ifdef RT_OS_LINUX
+    if (pThis->fVnetHdr)
+    {
+        /* Gather the header and frame, the device takes one frame per write. */
+        DRVTAPVNETHDR VnetHdrNone;
+        if (!pvVnetHdr)
+        {
+            RT_ZERO(VnetHdrNone);
+            pvVnetHdr = &VnetHdrNone;
+        }
+
+        struct iovec aIov[2];
+        aIov[0].iov_base = (void *)pvVnetHdr;
+        aIov[0].iov_len  = sizeof(DRVTAPVNETHDR);
+        aIov[1].iov_base = (void *)pvFrame;
+        aIov[1].iov_len  = cbFrame;
+        ssize_t cbWritten = writev(RTFileToNative(pThis->hFileDevice), &aIov[0], RT_ELEMENTS(aIov));
+        if (cbWritten < 0)
+            return RTErrConvertFromErrno(errno);
+        return VINF_SUCCESS;
+    }
+#endif
+    RT_NOREF(pvVnetHdr);
+    return RTFileWrite(pThis->hFileDevice, pvFrame, cbFrame, NULL);
+}
+
+
 
 /**
  * @interface_method_impl{PDMINETWORKUP,pfnBeginXmit}
@@ -260,23 +478,36 @@ static DECLCALLBACK(int) drvTAPNetworkUp_SendBuf(PPDMINETWORKUP pInterface, PPDM
               "%.*Rhxd\n",
               pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, pSgBuf->cbUsed, pSgBuf->aSegs[0].pvSeg));
 
-        rc = RTFileWrite(pThis->hFileDevice, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, NULL);
+        rc = drvTAPWriteFrame(pThis, pSgBuf->aSegs[0].pvSeg, pSgBuf->cbUsed, NULL);
     }
     else
     {
-        uint8_t         abHdrScratch[256];
-        uint8_t const  *pbFrame = (uint8_t const *)pSgBuf->aSegs[0].pvSeg;
+        uint8_t        *pbFrame = (uint8_t *)pSgBuf->aSegs[0].pvSeg;
         PCPDMNETWORKGSO pGso    = (PCPDMNETWORKGSO)pSgBuf->pvUser;
-        uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
-        rc = VINF_SUCCESS;
-        for (size_t iSeg = 0; iSeg < cSegs; iSeg++)
+#ifdef RT_OS_LINUX
+        /* Let the host do the segmentation if possible, saving a write per segment. */
+        DRVTAPVNETHDR   VnetHdr;
+        if (   pThis->fVnetHdr
+            && drvTAPVnetHdrFromGso(pGso, pbFrame, pSgBuf->cbUsed, &VnetHdr))
         {
-            uint32_t cbSegFrame;
-            void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, (uint8_t *)pbFrame, pSgBuf->cbUsed, abHdrScratch,
-                                                       iSeg, cSegs, &cbSegFrame);
-            rc = RTFileWrite(pThis->hFileDevice, pvSegFrame, cbSegFrame, NULL);
-            if (RT_FAILURE(rc))
-                break;
+            STAM_COUNTER_INC(&pThis->StatPktSentGso);
+            rc = drvTAPWriteFrame(pThis, pbFrame, pSgBuf->cbUsed, &VnetHdr);
+        }
+        else
+#endif
+        {
+            uint8_t         abHdrScratch[256];
+            uint32_t const  cSegs   = PDMNetGsoCalcSegmentCount(pGso, pSgBuf->cbUsed);  Assert(cSegs > 1);
+            rc = VINF_SUCCESS;
+            for (size_t iSeg = 0; iSeg < cSegs; iSeg++)
+            {
+                uint32_t cbSegFrame;
+                void *pvSegFrame = PDMNetGsoCarveSegmentQD(pGso, pbFrame, pSgBuf->cbUsed, abHdrScratch,
+                                                           iSeg, cSegs, &cbSegFrame);
+                rc = drvTAPWriteFrame(pThis, pvSegFrame, cbSegFrame, NULL);
+                if (RT_FAILURE(rc))
+                    break;
+            }
         }
     }
 
@@ -327,6 +558,131 @@ static DECLCALLBACK(void) drvTAPNetworkUp_NotifyLinkChanged(PPDMINETWORKUP pInte
 }
 
 
+/**
+ * Reads one frame from the TAP device into the receive buffer.
+ *
+ * @returns IPRT status code, VERR_TRY_AGAIN if there is nothing to read.
+ * @param   pThis           The instance data.
+ * @param   pvVnetHdr       Where to return the virtio-net header (PDRVTAPVNETHDR),
+ *                          unused if the device has none.
+ * @param   pcbFrame        Where to return the size of the frame.
+ */
+static int drvTAPReadFrame(PDRVTAP pThis, void *pvVnetHdr, size_t *pcbFrame)
+{
+#ifdef RT_OS_LINUX
+    if (pThis->fVnetHdr)
+    {
+        /* Scatter the header away from the frame so the frame can be passed up as is. */
+        struct iovec aIov[2];
+        aIov[0].iov_base = pvVnetHdr;
+        aIov[0].iov_len  = sizeof(DRVTAPVNETHDR);
+        aIov[1].iov_base = pThis->pbRecvBuf;
+        aIov[1].iov_len  = DRVTAP_RECV_BUF_SIZE;
+        ssize_t cbRead = readv(RTFileToNative(pThis->hFileDevice), &aIov[0], RT_ELEMENTS(aIov));
+        if (cbRead < 0)
+            return RTErrConvertFromErrno(errno);
+        *pcbFrame = (size_t)cbRead > sizeof(DRVTAPVNETHDR) ? (size_t)cbRead - sizeof(DRVTAPVNETHDR) : 0;
+        return VINF_SUCCESS;
+    }
+#endif
+    RT_NOREF(pvVnetHdr);
+    return RTFileRead(pThis->hFileDevice, pThis->pbRecvBuf, DRVTAP_RECV_BUF_SIZE, pcbFrame);
+}
+
+
+/**
+ * Passes a received frame up, segmenting GSO frames the device above can't take.
+ *
+ * @param   pThis           The instance data.
+ * @param   pvVnetHdr       The virtio-net header of the frame (PCDRVTAPVNETHDR),
+ *                          unused if the device has none.
+ * @param   pbFrame         The frame.
+ * @param   cbFrame         The size of the frame.
+ */
+static void drvTAPRecvFrame(PDRVTAP pThis, const void *pvVnetHdr, uint8_t *pbFrame, size_t cbFrame)
+{
+#ifdef RT_OS_LINUX
+    if (pThis->fVnetHdr)
+    {
+        PCDRVTAPVNETHDR pVnetHdr = (PCDRVTAPVNETHDR)pvVnetHdr;
+        PDMNETWORKGSO   Gso;
+        if (   pVnetHdr->u8GsoType != DRVTAP_VNETHDR_GSO_NONE
+            && drvTAPVnetHdrToGso(pVnetHdr, pbFrame, cbFrame, &Gso))
+        {
+            STAM_COUNTER_INC(&pThis->StatPktRecvGso);
+            if (   pThis->pIAboveNet->pfnReceiveGso
+                && RT_SUCCESS(pThis->pIAboveNet->pfnReceiveGso(pThis->pIAboveNet, pbFrame, cbFrame, &Gso)))
+                return;
+
+            /*
+             * The device does not support large receive offload, do the segmentation here.
+             */
+            STAM_COUNTER_INC(&pThis->StatPktRecvGsoCarved);
+            uint8_t         abHdrScratch[256];
+            uint32_t const  cSegs = PDMNetGsoCalcSegmentCount(&Gso, cbFrame);
+            for (uint32_t iSeg = 0; iSeg < cSegs; iSeg++)
+            {
+                uint32_t cbSegFrame;
+                void    *pvSegFrame = PDMNetGsoCarveSegmentQD(&Gso, pbFrame, cbFrame, abHdrScratch, iSeg, cSegs, &cbSegFrame);
+                if (iSeg > 0)
+                {
+                    int rc = pThis->pIAboveNet->pfnWaitReceiveAvail(pThis->pIAboveNet, RT_INDEFINITE_WAIT);
+                    if (RT_FAILURE(rc))
+                        break; /* we drop the rest. */
+                }
+                int rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pvSegFrame, cbSegFrame);
+                AssertRC(rc);
+            }
+            return;
+        }
+
+        if (pVnetHdr->u8Flags & DRVTAP_VNETHDR_F_NEEDS_CSUM)
+            drvTAPVnetHdrCompleteChecksum(pVnetHdr, pbFrame, cbFrame);
+    }
+#else
+    RT_NOREF(pvVnetHdr);
+#endif
+
+    int rc = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, pbFrame, cbFrame);
+    AssertRC(rc);
+}
+
+
+#ifdef RT_OS_LINUX
+/**
+ * Checks whether the TAP device was created with IFF_VNET_HDR and if so asks the
+ * host to hand us frames with checksum and segmentation offloading.
+ *
+ * @param   pThis           The instance data.
+ */
+static void drvTAPLinuxSetupVnetHdr(PDRVTAP pThis)
+{
+    int const fd = RTFileToNative(pThis->hFileDevice);
+
+    struct ifreq IfReq;
+    RT_ZERO(IfReq);
+    if (   ioctl(fd, TUNGETIFF, &IfReq) != 0
+        || !(IfReq.ifr_flags & IFF_VNET_HDR))
+    {
+        LogRel(("TAP#%u: No virtio-net header, offloading disabled\n", pThis->pDrvIns->iInstance));
+        return;
+    }
+
+    /* The default header size is that of struct virtio_net_hdr, so failing to set it is harmless. */
+    int cbVnetHdr = sizeof(DRVTAPVNETHDR);
+    if (ioctl(fd, TUNSETVNETHDRSZ, &cbVnetHdr) != 0)
+        LogRel(("TAP#%u: TUNSETVNETHDRSZ failed, errno=%d\n", pThis->pDrvIns->iInstance, errno));
+    pThis->fVnetHdr = true;
+
+    if (ioctl(fd, TUNSETOFFLOAD, (unsigned long)(TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6)) != 0)
+        LogRel(("TAP#%u: TUNSETOFFLOAD failed, errno=%d\n", pThis->pDrvIns->iInstance, errno));
+
+    LogRel(("TAP#%u: Using virtio-net header for offloading (device above %s GSO frames)\n",
+            pThis->pDrvIns->iInstance, pThis->pIAboveNet->pfnReceiveGso ? "may take" : "can't take"));
+}
+#endif
+
+
 /**
  * Asynchronous I/O thread for handling receive.
  *
@@ -373,16 +729,26 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
             &&  !aFDs[1].revents)
         {
             /*
-             * Read the frame.
+             * Read the frames.  The device queues up several of them when the
+             * traffic is heavy, so keep reading until it runs dry (VERR_TRY_AGAIN)
+             * before going back to poll().
              */
-            char achBuf[16384];
-            size_t cbRead = 0;
-            /** @note At least on Linux we will never receive more than one network packet
-             *        after poll() returned successfully. I don't know why but a second
-             *        RTFileRead() operation will return with VERR_TRY_AGAIN in any case. */
-            rc = RTFileRead(pThis->hFileDevice, achBuf, sizeof(achBuf), &cbRead);
-            if (RT_SUCCESS(rc))
+            STAM_COUNTER_INC(&pThis->StatRecvWakeups);
+            for (unsigned iFrame = 0; iFrame < DRVTAP_RECV_BATCH_MAX; iFrame++)
             {
+#ifdef RT_OS_LINUX
+                DRVTAPVNETHDR VnetHdr;
+                void *pvVnetHdr = &VnetHdr;
+#else
+                void *pvVnetHdr = NULL;
+#endif
+                size_t cbRead = 0;
+                rc = drvTAPReadFrame(pThis, pvVnetHdr, &cbRead);
+                if (RT_FAILURE(rc))
+                    break;
+                if (!cbRead)
+                    continue;
+
                 /*
                  * Wait for the device to have space for this frame.
                  * Most guests use frame-sized receive buffers, hence non-zero cbMax
@@ -405,7 +771,7 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
                  * state transition. Drop the packet and wait for the next one.
                  */
                 if (RT_FAILURE(rc1))
-                    continue;
+                    break;
 
                 /*
                  * Pass the data up.
@@ -416,15 +782,15 @@ static DECLCALLBACK(int) drvTAPAsyncIoThread(PPDMDRVINS pDrvIns, PPDMTHREAD pThr
                          cbRead, u64Now, u64Now - pThis->u64LastReceiveTS, u64Now - pThis->u64LastTransferTS));
                 pThis->u64LastReceiveTS = u64Now;
 #endif
-                Log2(("drvTAPAsyncIoThread: cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, achBuf));
+                Log2(("drvTAPAsyncIoThread: cbRead=%#x\n" "%.*Rhxd\n", cbRead, cbRead, pThis->pbRecvBuf));
                 STAM_COUNTER_INC(&pThis->StatPktRecv);
                 STAM_COUNTER_ADD(&pThis->StatPktRecvBytes, cbRead);
-                rc1 = pThis->pIAboveNet->pfnReceive(pThis->pIAboveNet, achBuf, cbRead);
-                AssertRC(rc1);
+                drvTAPRecvFrame(pThis, pvVnetHdr, pThis->pbRecvBuf, cbRead);
             }
-            else
+
+            if (RT_FAILURE(rc) && rc != VERR_TRY_AGAIN)
             {
-                LogFlow(("drvTAPAsyncIoThread: RTFileRead -> %Rrc\n", rc));
+                LogFlow(("drvTAPAsyncIoThread: drvTAPReadFrame -> %Rrc\n", rc));
                 if (rc == VERR_INVALID_HANDLE)
                     break;
                 RTThreadYield();
@@ -824,6 +1190,12 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     MMR3HeapFree(pThis->pszTerminateApplication);
     pThis->pszTerminateApplication = NULL;
 
+    if (pThis->pbRecvBuf)
+    {
+        RTMemFree(pThis->pbRecvBuf);
+        pThis->pbRecvBuf = NULL;
+    }
+
     /*
      * Kill the xmit lock.
      */
@@ -838,6 +1210,10 @@ static DECLCALLBACK(void) drvTAPDestruct(PPDMDRVINS pDrvIns)
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentBytes);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecv);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvBytes);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktSentGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvGso);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatPktRecvGsoCarved);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatRecvWakeups);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatTransmit);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReceive);
 #endif /* VBOX_WITH_STATISTICS */
@@ -869,6 +1245,7 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
 #endif
     pThis->pszSetupApplication          = NULL;
     pThis->pszTerminateApplication      = NULL;
+    pThis->pbRecvBuf                    = NULL;
 
     /* IBase */
     pDrvIns->IBase.pfnQueryInterface    = drvTAPQueryInterface;
@@ -889,6 +1266,10 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of sent bytes.",            "/Drivers/TAP%d/Bytes/Sent", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecv,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of received packets.",      "/Drivers/TAP%d/Packets/Received", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvBytes,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,             "Number of received bytes.",        "/Drivers/TAP%d/Bytes/Received", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktSentGso,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of GSO packets passed to the host.",    "/Drivers/TAP%d/Packets/SentGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvGso,    STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of GSO packets received.",              "/Drivers/TAP%d/Packets/ReceivedGso", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatPktRecvGsoCarved, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,     "Number of GSO packets segmented on receive.",  "/Drivers/TAP%d/Packets/ReceivedGsoCarved", pDrvIns->iInstance);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatRecvWakeups,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,        "Number of receive wakeups.",                   "/Drivers/TAP%d/ReceiveWakeups", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatTransmit,      STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet transmit runs.",  "/Drivers/TAP%d/Transmit", pDrvIns->iInstance);
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReceive,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_TICKS_PER_CALL,    "Profiling packet receive runs.",   "/Drivers/TAP%d/Receive", pDrvIns->iInstance);
 #endif /* VBOX_WITH_STATISTICS */
@@ -991,6 +1372,17 @@ static DECLCALLBACK(int) drvTAPConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uin
     Log(("drvTAPContruct: %d (from fd)\n", (intptr_t)pThis->hFileDevice));
     rc = VINF_SUCCESS;
 
+#ifdef RT_OS_LINUX
+    drvTAPLinuxSetupVnetHdr(pThis);
+#endif
+
+    /*
+     * Allocate the receive buffer.
+     */
+    pThis->pbRecvBuf = (uint8_t *)RTMemAlloc(DRVTAP_RECV_BUF_SIZE);
+    if (!pThis->pbRecvBuf)
+        return VERR_NO_MEMORY;
+
     /*
      * Create the control pipe.
      */
@@ -62,9 +62,20 @@
 # define INTNET_GROW_DSTTAB_SIZE    1
 #endif
 
+/** The number of index bits in the MAC address hash table. */
+#define INTNET_MACTAB_HASH_SHIFT    11
+/** The size of the MAC address hash table.  This must be larger than
+ * INTNET_MAX_IFS so that there always is a free slot to end the probing. */
+#define INTNET_MACTAB_HASH_SIZE     RT_BIT_32(INTNET_MACTAB_HASH_SHIFT)
+AssertCompile(INTNET_MACTAB_HASH_SIZE > INTNET_MAX_IFS);
+
 /** The wakeup bit in the INTNETIF::cBusy and INTNETRUNKIF::cBusy counters. */
 #define INTNET_BUSY_WAKEUP_MASK     RT_BIT_32(30)
 
+/** The number of times a receive ring reservation is retried after losing the
+ * offWriteInt race against another producer. */
+#define INTNET_RING_RESERVE_RETRIES 64
+
 
 /*********************************************************************************************************************************
 *   Structures and Typedefs                                                                                                      *
@@ -105,6 +116,16 @@ typedef struct INTNETMACTAB
     uint32_t                cEntriesAllocated;
     /** Table entries. */
     PINTNETMACTABENTRY      paEntries;
+    /** Generation number, incremented every time the hash is rebuilt.  Used to
+     * validate the INTNETIF::LastDst caches. */
+    uint32_t                uGeneration;
+    /** The number of entries with dummy MAC addresses.  These are not in the
+     * hash and forces the unicast switching to scan the whole table. */
+    uint32_t                cDummyEntries;
+    /** MAC address hash, linear probing.  Holds entry index + 1 of paEntries
+     * and zero for free slots.  Rebuilt by intnetR0MacTabRehash whenever an
+     * entry is added, removed or changes its address. */
+    uint16_t                au16Hash[INTNET_MACTAB_HASH_SIZE];
 
     /** The number of interface entries currently in promicuous mode. */
     uint32_t                cPromiscuousEntries;
@@ -226,6 +247,19 @@ typedef struct INTNETIF
      * paused or that it simply isn't worth all the delay. It is cleared when a
      * successful send has been done. */
     uint32_t                cYields;
+    /** Last unicast destination lookup (protected by the network address
+     * spinlock).  Only valid while uGeneration equals
+     * INTNETMACTAB::uGeneration, and only filled in when the address matched
+     * exactly one entry. */
+    struct
+    {
+        /** The destination address. */
+        RTMAC               MacAddr;
+        /** The index of the MAC address table entry with that address. */
+        uint32_t            iEntry;
+        /** The MAC address table generation of the lookup. */
+        uint32_t            uGeneration;
+    } LastDst;
     /** Pointer to the current exchange buffer (ring-0). */
     PINTNETBUF              pIntBuf;
     /** Pointer to ring-3 mapping of the current exchange buffer. */
@@ -258,8 +292,6 @@ typedef struct INTNETIF
     /** The network layer address cache. (Indexed by type, 0 entry isn't used.)
      * This is protected by the address spinlock of the network. */
     INTNETADDRCACHE         aAddrCache[kIntNetAddrType_End];
-    /** Spinlock protecting the input (producer) side of the receive ring. */
-    RTSPINLOCK              hRecvInSpinlock;
     /** Busy count for tracking destination table references and active sends.
      * Usually incremented while owning the switch table spinlock.  The 30th bit
      * is used to indicate wakeup. */
@@ -270,6 +302,13 @@ typedef struct INTNETIF
     PINTNETDSTTAB volatile  pDstTab;
     /** Pointer to the trunk's per interface data.  Can be NULL. */
     void                   *pvIfData;
+    /** Bitmap of receive ring frames which have been written but not yet
+     * committed, one bit per INTNETHDR_ALIGNMENT bytes of the ring.  See
+     * intnetR0RingWriteFrame. */
+    uint64_t volatile      *pbmRecvWritten;
+    /** The number of bits in pbmRecvWritten.  This is what bounds the bit
+     * indexes, as the ring offsets can be changed by ring-3. */
+    uint32_t                cRecvWrittenBits;
     /** Header buffer for when we're carving GSO frames. */
     uint8_t                 abGsoHdrs[256];
 } INTNETIF;
@@ -1662,6 +1701,106 @@ DECL_FORCE_INLINE(bool) intnetR0AreMacAddrsEqual(PCRTMAC pDstAddr1, PCRTMAC pDst
 }
 
 
+/**
+ * Calculates the MAC address hash table slot to start probing at.
+ *
+ * @returns Hash table index.
+ * @param   pMacAddr            The address.
+ */
+DECL_FORCE_INLINE(uint32_t) intnetR0MacTabHash(PCRTMAC pMacAddr)
+{
+    /* The first half is usually the same OUI for all interfaces, so let the
+       multiplication spread the last bytes over the upper bits. */
+    uint32_t u = ((uint32_t)pMacAddr->au16[2] << 16 | pMacAddr->au16[1]) ^ pMacAddr->au16[0];
+    return (u * UINT32_C(0x9e3779b1)) >> (32 - INTNET_MACTAB_HASH_SHIFT);
+}
+
+
+/**
+ * Rebuilds the MAC address hash table after entries have been added, removed
+ * or changed their address.
+ *
+ * The caller holds the MAC address table spinlock.
+ *
+ * @param   pTab                The MAC address table.
+ */
+static void intnetR0MacTabRehash(PINTNETMACTAB pTab)
+{
+    RT_ZERO(pTab->au16Hash);
+    pTab->cDummyEntries = 0;
+
+    uint32_t const cEntries = pTab->cEntries;
+    for (uint32_t iEntry = 0; iEntry < cEntries; iEntry++)
+    {
+        PCRTMAC pMacAddr = &pTab->paEntries[iEntry].MacAddr;
+        if (intnetR0IsMacAddrDummy(pMacAddr))
+            pTab->cDummyEntries++;
+        else
+        {
+            uint32_t iHash = intnetR0MacTabHash(pMacAddr);
+            while (pTab->au16Hash[iHash] != 0)
+                iHash = (iHash + 1) & (INTNET_MACTAB_HASH_SIZE - 1);
+            pTab->au16Hash[iHash] = (uint16_t)(iEntry + 1);
+        }
+    }
+
+    if (++pTab->uGeneration == 0)
+        pTab->uGeneration = 1;
+}
+
+
+/**
+ * Looks up the next MAC address table entry with the given address.
+ *
+ * The caller holds the MAC address table spinlock.  Note that inactive entries
+ * are returned too.
+ *
+ * @returns Pointer to the entry, NULL if there are no more.
+ * @param   pTab                The MAC address table.
+ * @param   pMacAddr            The address to look for.
+ * @param   piHash              The hash table slot to continue probing at.
+ *                              Initialize with intnetR0MacTabHash().
+ */
+DECLINLINE(PINTNETMACTABENTRY) intnetR0MacTabLookupNext(PINTNETMACTAB pTab, PCRTMAC pMacAddr, uint32_t *piHash)
+{
+    uint32_t iHash = *piHash;
+    uint32_t iEntryPlus1;
+    while ((iEntryPlus1 = pTab->au16Hash[iHash]) != 0)
+    {
+        iHash = (iHash + 1) & (INTNET_MACTAB_HASH_SIZE - 1);
+        PINTNETMACTABENTRY pEntry = &pTab->paEntries[iEntryPlus1 - 1];
+        if (intnetR0AreMacAddrsEqual(&pEntry->MacAddr, pMacAddr))
+        {
+            *piHash = iHash;
+            return pEntry;
+        }
+    }
+    *piHash = iHash;
+    return NULL;
+}
+
+
+/**
+ * Checks whether any active interface has the given MAC address, using the
+ * hash.
+ *
+ * The caller holds the MAC address table spinlock.
+ *
+ * @returns true if found, false if not.
+ * @param   pTab                The MAC address table.
+ * @param   pMacAddr            The address to look for.
+ */
+DECLINLINE(bool) intnetR0MacTabHasActive(PINTNETMACTAB pTab, PCRTMAC pMacAddr)
+{
+    uint32_t           iHash = intnetR0MacTabHash(pMacAddr);
+    PINTNETMACTABENTRY pEntry;
+    while ((pEntry = intnetR0MacTabLookupNext(pTab, pMacAddr, &iHash)) != NULL)
+        if (pEntry->fActive)
+            return true;
+    return false;
+}
+
+
 /**
  * Switch a unicast frame based on the network layer address (OSI level 3) and
  * return a destination table.
@@ -1794,29 +1933,43 @@ static INTNETSWDECISION intnetR0NetworkPreSwitchUnicast(PINTNETNETWORK pNetwork,
     PINTNETMACTAB       pTab            = &pNetwork->MacTab;
     RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
-    /* Iterate the internal network interfaces and look for matching source and
-       destination addresses. */
-    uint32_t iIfMac = pTab->cEntries;
-    while (iIfMac-- > 0)
+    /* Without any unknown interface addresses the hash can answer this. */
+    if (!pTab->cDummyEntries)
     {
-        if (pTab->paEntries[iIfMac].fActive)
+        /* Paranoia - a source match shouldn't happen, right? */
+        if (   (   !pSrcAddr
+                || !intnetR0MacTabHasActive(pTab, pSrcAddr))
+            && intnetR0MacTabHasActive(pTab, pDstAddr))
+            enmSwDecision = pTab->fHostPromiscuousEff && fSrc == INTNETTRUNKDIR_WIRE
+                          ? INTNETSWDECISION_BROADCAST
+                          : INTNETSWDECISION_INTNET;
+    }
+    else
+    {
+        /* Iterate the internal network interfaces and look for matching source and
+           destination addresses. */
+        uint32_t iIfMac = pTab->cEntries;
+        while (iIfMac-- > 0)
         {
-            /* Unknown interface address? */
-            if (intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr))
-                break;
+            if (pTab->paEntries[iIfMac].fActive)
+            {
+                /* Unknown interface address? */
+                if (intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr))
+                    break;
 
-            /* Paranoia - this shouldn't happen, right? */
-            if (    pSrcAddr
-                &&  intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pSrcAddr))
-                break;
+                /* Paranoia - this shouldn't happen, right? */
+                if (    pSrcAddr
+                    &&  intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pSrcAddr))
+                    break;
 
-            /* Exact match? */
-            if (intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr))
-            {
-                enmSwDecision = pTab->fHostPromiscuousEff && fSrc == INTNETTRUNKDIR_WIRE
-                              ? INTNETSWDECISION_BROADCAST
-                              : INTNETSWDECISION_INTNET;
-                break;
+                /* Exact match? */
+                if (intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr))
+                {
+                    enmSwDecision = pTab->fHostPromiscuousEff && fSrc == INTNETTRUNKDIR_WIRE
+                                  ? INTNETSWDECISION_BROADCAST
+                                  : INTNETSWDECISION_INTNET;
+                    break;
+                }
             }
         }
     }
@@ -1848,6 +2001,7 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
      * Grab the spinlock first and do the switching.
      */
     PINTNETMACTAB   pTab = &pNetwork->MacTab;
+    STAM_REL_PROFILE_START(&pIfSender->pIntBuf->StatSwitch, a); /* Only reads the TSC, pIfSender may be NULL. */
     RTSpinlockAcquire(pNetwork->hAddrSpinlock);
 
     pDstTab->fTrunkDst  = 0;
@@ -1856,30 +2010,90 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
 
     /* Find exactly matching or promiscuous interfaces. */
     uint32_t cExactHits = 0;
-    uint32_t iIfMac     = pTab->cEntries;
-    while (iIfMac-- > 0)
-    {
-        if (pTab->paEntries[iIfMac].fActive)
+    uint32_t iIfMac;
+    if (   !pTab->cDummyEntries
+        && pTab->cPromiscuousEntries == (fSrc ? pTab->cPromiscuousNoTrunkEntries : 0))
+    {
+        /* Nobody wants to see other addresses, so only exact matches count.
+           Try the last destination of the sender before doing the hash lookup. */
+        if (   pIfSender
+            && pIfSender->LastDst.uGeneration == pTab->uGeneration
+            && intnetR0AreMacAddrsEqual(&pIfSender->LastDst.MacAddr, pDstAddr))
         {
-            bool fExact = intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr);
-            if (   fExact
-                || intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr)
-                || (   pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
-                    || (!fSrc && pTab->paEntries[iIfMac].fPromiscuousEff) )
-               )
+            PINTNETMACTABENTRY pEntry = &pTab->paEntries[pIfSender->LastDst.iEntry];
+            if (pEntry->fActive)
             {
-                cExactHits += fExact;
-
-                PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;        AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                cExactHits++;
+                PINTNETIF pIf = pEntry->pIf;                        AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
                 if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
                 {
-                    uint32_t iIfDst = pDstTab->cIfs++;
-                    pDstTab->aIfs[iIfDst].pIf            = pIf;
-                    pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
+                    pDstTab->aIfs[0].pIf            = pIf;
+                    pDstTab->aIfs[0].fReplaceDstMac = false;
+                    pDstTab->cIfs                   = 1;
                     intnetR0BusyIncIf(pIf);
                 }
             }
         }
+        else
+        {
+            uint32_t           cMatches = 0;
+            PINTNETMACTABENTRY pLast    = NULL;
+            uint32_t           iHash    = intnetR0MacTabHash(pDstAddr);
+            PINTNETMACTABENTRY pEntry;
+            while ((pEntry = intnetR0MacTabLookupNext(pTab, pDstAddr, &iHash)) != NULL)
+            {
+                cMatches++;
+                pLast = pEntry;
+                if (pEntry->fActive)
+                {
+                    cExactHits++;
+                    PINTNETIF pIf = pEntry->pIf;                    AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                    if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
+                    {
+                        uint32_t iIfDst = pDstTab->cIfs++;
+                        pDstTab->aIfs[iIfDst].pIf            = pIf;
+                        pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
+                        intnetR0BusyIncIf(pIf);
+                    }
+                }
+            }
+
+            /* Only cache unique addresses, the cache hit path assumes one entry. */
+            if (pIfSender && cMatches == 1)
+            {
+                pIfSender->LastDst.MacAddr     = *pDstAddr;
+                pIfSender->LastDst.iEntry      = (uint32_t)(pLast - pTab->paEntries);
+                pIfSender->LastDst.uGeneration = pTab->uGeneration;
+            }
+        }
+    }
+    else
+    {
+        iIfMac = pTab->cEntries;
+        while (iIfMac-- > 0)
+        {
+            if (pTab->paEntries[iIfMac].fActive)
+            {
+                bool fExact = intnetR0AreMacAddrsEqual(&pTab->paEntries[iIfMac].MacAddr, pDstAddr);
+                if (   fExact
+                    || intnetR0IsMacAddrDummy(&pTab->paEntries[iIfMac].MacAddr)
+                    || (   pTab->paEntries[iIfMac].fPromiscuousSeeTrunk
+                        || (!fSrc && pTab->paEntries[iIfMac].fPromiscuousEff) )
+                   )
+                {
+                    cExactHits += fExact;
+
+                    PINTNETIF pIf = pTab->paEntries[iIfMac].pIf;    AssertPtr(pIf); Assert(pIf->pNetwork == pNetwork);
+                    if (RT_LIKELY(pIf != pIfSender)) /* paranoia */
+                    {
+                        uint32_t iIfDst = pDstTab->cIfs++;
+                        pDstTab->aIfs[iIfDst].pIf            = pIf;
+                        pDstTab->aIfs[iIfDst].fReplaceDstMac = false;
+                        intnetR0BusyIncIf(pIf);
+                    }
+                }
+            }
+        }
     }
 
     /* Network only promicuous mode ifs should see related trunk traffic. */
@@ -1935,6 +2149,8 @@ static INTNETSWDECISION intnetR0NetworkSwitchUnicast(PINTNETNETWORK pNetwork, ui
     }
 
     RTSpinlockRelease(pNetwork->hAddrSpinlock);
+    if (pIfSender)
+        STAM_REL_PROFILE_STOP(&pIfSender->pIntBuf->StatSwitch, a);
     return pDstTab->cIfs
          ? (!pDstTab->fTrunkDst ? INTNETSWDECISION_INTNET : INTNETSWDECISION_BROADCAST)
          : (!pDstTab->fTrunkDst ? INTNETSWDECISION_DROP   : INTNETSWDECISION_TRUNK);
@@ -2795,31 +3011,125 @@ static void intnetR0IfSnoopAddr(PINTNETIF pIf, uint8_t const *pbFrame, uint32_t
 /**
  * Writes a frame packet to the ring buffer.
  *
+ * Any number of producers may call this concurrently on the same ring.  Space
+ * is reserved by the compare-and-exchange on offWriteInt and the frame is
+ * copied without any serialization.  Frames must be committed in reservation
+ * order, so a producer whose frame isn't next in line only marks it as written
+ * in @a pbmWritten and leaves.  Whoever commits the frame ahead of it will
+ * commit it as well, so nobody ever waits for another producer.
+ *
  * @returns VBox status code.
- * @param   pBuf            The buffer.
- * @param   pRingBuf        The ring buffer to read from.
+ * @param   pRingBuf        The ring buffer to write to.
+ * @param   pbmWritten      Bitmap of written but uncommitted frames, one bit per
+ *                          INTNETHDR_ALIGNMENT bytes of the ring.  NULL if the
+ *                          caller is the only producer for the ring.
+ * @param   cWrittenBits    The number of bits in @a pbmWritten.
  * @param   pSG             The gather list.
  * @param   pNewDstMac      Set the destination MAC address to the address if specified.
+ * @param   pfWakeup        Where to return whether the consumer needs waking
+ *                          up, i.e. whether it had caught up with the ring when
+ *                          this call committed one of the frames.  Optional.
  */
-static int intnetR0RingWriteFrame(PINTNETRINGBUF pRingBuf, PCINTNETSG pSG, PCRTMAC pNewDstMac)
+static int intnetR0RingWriteFrame(PINTNETRINGBUF pRingBuf, uint64_t volatile *pbmWritten, uint32_t cWrittenBits,
+                                  PCINTNETSG pSG, PCRTMAC pNewDstMac, bool *pfWakeup)
 {
     PINTNETHDR  pHdr  = NULL; /* shut up gcc*/
     void       *pvDst = NULL; /* ditto */
     int         rc;
-    if (pSG->GsoCtx.u8Type == PDMNETWORKGSOTYPE_INVALID)
-        rc = IntNetRingAllocateFrame(pRingBuf, pSG->cbTotal, &pHdr, &pvDst);
-    else
-        rc = IntNetRingAllocateGsoFrame(pRingBuf, pSG->cbTotal, &pSG->GsoCtx, &pHdr, &pvDst);
-    if (RT_SUCCESS(rc))
+    uint32_t    cRetries = INTNET_RING_RESERVE_RETRIES;
+    do
     {
-        IntNetSgRead(pSG, pvDst);
-        if (pNewDstMac)
-            ((PRTNETETHERHDR)pvDst)->DstMac = *pNewDstMac;
+        if (pSG->GsoCtx.u8Type == PDMNETWORKGSOTYPE_INVALID)
+            rc = IntNetRingAllocateFrame(pRingBuf, pSG->cbTotal, &pHdr, &pvDst);
+        else
+            rc = IntNetRingAllocateGsoFrame(pRingBuf, pSG->cbTotal, &pSG->GsoCtx, &pHdr, &pvDst);
+    } while (rc == VERR_WRONG_ORDER && cRetries-- > 0);
+    if (RT_FAILURE(rc))
+        return rc;
 
-        IntNetRingCommitFrame(pRingBuf, pHdr);
-        return VINF_SUCCESS;
+    IntNetSgRead(pSG, pvDst);
+    if (pNewDstMac)
+        ((PRTNETETHERHDR)pvDst)->DstMac = *pNewDstMac;
+
+    /*
+     * Only the producer whose frame offWriteCom points at may commit.  If that
+     * isn't us, mark the frame as written and check again: either the producer
+     * ahead of us sees the bit after moving offWriteCom, or we see offWriteCom
+     * pointing at us.  Whoever clears the bit does the commit.
+     */
+    uint32_t const offHdr     = (uint32_t)((uintptr_t)pHdr - (uintptr_t)pRingBuf);
+    uint32_t const offStart   = pRingBuf->offStart;
+    if (   pbmWritten
+        && ASMAtomicReadU32(&pRingBuf->offWriteCom) != offHdr)
+    {
+        uint32_t const iBit = (offHdr - offStart) / INTNETHDR_ALIGNMENT;
+        AssertReturn(iBit < cWrittenBits, VERR_INTERNAL_ERROR_3); /* ring-3 may have messed up the offsets */
+        ASMAtomicBitSet(pbmWritten, (int32_t)iBit);
+        if (   ASMAtomicReadU32(&pRingBuf->offWriteCom) != offHdr
+            || !ASMAtomicBitTestAndClear(pbmWritten, (int32_t)iBit))
+        {
+            if (pfWakeup)
+                *pfWakeup = false;
+            return VINF_SUCCESS;
+        }
     }
-    return rc;
+
+    IntNetRingCommitFrame(pRingBuf, pHdr);
+
+    /* The consumer drains the ring before going to sleep, so unless it's
+       still got frames ahead of ours to chew on it may need a wakeup. */
+    if (pfWakeup)
+        *pfWakeup = ASMAtomicReadU32(&pRingBuf->offReadX) == offHdr;
+
+    /* Commit the frames written by the producers behind us.  They didn't get
+       to check whether the consumer needs waking up for them, so we do.
+       Should offWriteCom have moved on since we read it, someone else has
+       committed the frame and the bit we got belongs to a newer frame at the
+       same offset.  Put it back and treat it like a producer would. */
+    if (pbmWritten)
+        for (;;)
+        {
+            uint32_t const offNext = ASMAtomicReadU32(&pRingBuf->offWriteCom);
+            uint32_t const iBit    = (offNext - offStart) / INTNETHDR_ALIGNMENT;
+            AssertBreak(iBit < cWrittenBits); /* ring-3 may have messed it up */
+            if (!ASMAtomicBitTestAndClear(pbmWritten, (int32_t)iBit))
+                break;
+            if (ASMAtomicReadU32(&pRingBuf->offWriteCom) != offNext)
+            {
+                ASMAtomicBitSet(pbmWritten, (int32_t)iBit);
+                if (   ASMAtomicReadU32(&pRingBuf->offWriteCom) != offNext
+                    || !ASMAtomicBitTestAndClear(pbmWritten, (int32_t)iBit))
+                    break;
+            }
+            IntNetRingCommitFrame(pRingBuf, (PINTNETHDR)((uint8_t *)pRingBuf + offNext));
+            if (pfWakeup && ASMAtomicReadU32(&pRingBuf->offReadX) == offNext)
+                *pfWakeup = true;
+        }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Wakes up the receiver of an interface after a frame was written to it.
+ *
+ * The signal is skipped when the consumer is busy with frames ahead of the new
+ * one and nobody is sleeping on the event, it will see the frame before it goes
+ * back to sleep.  This batches the wakeups while the receiver is lagging.
+ *
+ * @param   pIf             The interface.
+ * @param   fWakeup         What intnetR0RingWriteFrame said.
+ */
+DECLINLINE(void) intnetR0IfWakeupReceiver(PINTNETIF pIf, bool fWakeup)
+{
+    PINTNETBUF pIntBuf = pIf->pIntBuf;
+    if (   fWakeup
+        || ASMAtomicReadU32(&pIf->cSleepers) != 0)
+    {
+        STAM_REL_COUNTER_INC(&pIntBuf->cStatWakeups);
+        RTSemEventSignal(pIf->hRecvEvent);
+    }
+    else
+        STAM_REL_COUNTER_INC(&pIntBuf->cStatWakeupsSkipped);
 }
 
 
@@ -2834,19 +3144,19 @@ static int intnetR0RingWriteFrame(PINTNETRINGBUF pRingBuf, PCINTNETSG pSG, PCRTM
 static void intnetR0IfSend(PINTNETIF pIf, PINTNETIF pIfSender, PINTNETSG pSG, PCRTMAC pNewDstMac)
 {
     /*
-     * Grab the receive/producer lock and copy over the frame.
+     * Copy over the frame, no locking needed.
      */
-    RTSpinlockAcquire(pIf->hRecvInSpinlock);
-    int rc = intnetR0RingWriteFrame(&pIf->pIntBuf->Recv, pSG, pNewDstMac);
-    RTSpinlockRelease(pIf->hRecvInSpinlock);
+    bool fWakeup = false;
+    int rc = intnetR0RingWriteFrame(&pIf->pIntBuf->Recv, pIf->pbmRecvWritten, pIf->cRecvWrittenBits,
+                                    pSG, pNewDstMac, &fWakeup);
     if (RT_SUCCESS(rc))
     {
         pIf->cYields = 0;
-        RTSemEventSignal(pIf->hRecvEvent);
+        intnetR0IfWakeupReceiver(pIf, fWakeup);
         return;
     }
 
-    Log(("intnetR0IfSend: overflow cb=%d hIf=%RX32\n", pSG->cbTotal, pIf->hIf));
+    Log(("intnetR0IfSend: overflow cb=%d hIf=%RX32 rc=%Rrc\n", pSG->cbTotal, pIf->hIf, rc));
 
     /*
      * Scheduling hack, for unicore machines primarily.
@@ -2863,9 +3173,8 @@ static void intnetR0IfSend(PINTNETIF pIf, PINTNETIF pIfSender, PINTNETSG pSG, PC
             RTSemEventSignal(pIf->hRecvEvent);
             RTThreadYield();
 
-            RTSpinlockAcquire(pIf->hRecvInSpinlock);
-            rc = intnetR0RingWriteFrame(&pIf->pIntBuf->Recv, pSG, pNewDstMac);
-            RTSpinlockRelease(pIf->hRecvInSpinlock);
+            rc = intnetR0RingWriteFrame(&pIf->pIntBuf->Recv, pIf->pbmRecvWritten, pIf->cRecvWrittenBits,
+                                        pSG, pNewDstMac, &fWakeup);
             if (RT_SUCCESS(rc))
             {
                 STAM_REL_COUNTER_INC(&pIf->pIntBuf->cStatYieldsOk);
@@ -3978,7 +4287,10 @@ static INTNETSWDECISION intnetR0NetworkSend(PINTNETNETWORK pNetwork, PINTNETIF p
 
         PINTNETMACTABENTRY pIfEntry = intnetR0NetworkFindMacAddrEntry(pNetwork, pIfSender);
         if (pIfEntry)
+        {
             pIfEntry->MacAddr = EthHdr.SrcMac;
+            intnetR0MacTabRehash(&pNetwork->MacTab);
+        }
         pIfSender->MacAddr    = EthHdr.SrcMac;
 
         RTSpinlockRelease(pNetwork->hAddrSpinlock);
@@ -4426,7 +4738,10 @@ INTNETR0DECL(int) IntNetR0IfSetMacAddress(INTNETIFHANDLE hIf, PSUPDRVSESSION pSe
             /* Update the two copies. */
             PINTNETMACTABENTRY pEntry = intnetR0NetworkFindMacAddrEntry(pNetwork, pIf); Assert(pEntry);
             if (RT_LIKELY(pEntry))
+            {
                 pEntry->MacAddr = *pMac;
+                intnetR0MacTabRehash(&pNetwork->MacTab);
+            }
             pIf->MacAddr        = *pMac;
             pIf->fMacSet        = true;
 
@@ -4951,6 +5266,7 @@ static DECLCALLBACK(void) intnetR0IfDestruct(void *pvObj, void *pvUser1, void *p
                             &pNetwork->MacTab.paEntries[iIf + 1],
                             (pNetwork->MacTab.cEntries - iIf - 1) * sizeof(pNetwork->MacTab.paEntries[0]));
                 pNetwork->MacTab.cEntries--;
+                intnetR0MacTabRehash(&pNetwork->MacTab);
                 break;
             }
 
@@ -5045,11 +5361,10 @@ static DECLCALLBACK(void) intnetR0IfDestruct(void *pvObj, void *pvUser1, void *p
     /*
      * Free remaining resources
      */
-    RTSpinlockDestroy(pIf->hRecvInSpinlock);
-    pIf->hRecvInSpinlock = NIL_RTSPINLOCK;
-
     RTMemFree(pIf->pDstTab);
     pIf->pDstTab = NULL;
+    RTMemFree((void *)pIf->pbmRecvWritten);
+    pIf->pbmRecvWritten = NULL;
 
     for (int i = kIntNetAddrType_Invalid + 1; i < kIntNetAddrType_End; i++)
         intnetR0IfAddrCacheDestroy(&pIf->aAddrCache[i]);
@@ -5134,10 +5449,11 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
     pIf->pSession           = pSession;
     //pIf->pvObj            = NULL;
     //pIf->aAddrCache       = {0};
-    pIf->hRecvInSpinlock    = NIL_RTSPINLOCK;
     pIf->cBusy              = 0;
     //pIf->pDstTab          = NULL;
     //pIf->pvIfData         = NULL;
+    //pIf->pbmRecvWritten   = NULL;
+    //pIf->cRecvWrittenBits = 0;
 
     for (int i = kIntNetAddrType_Invalid + 1; i < kIntNetAddrType_End && RT_SUCCESS(rc); i++)
         rc = intnetR0IfAddrCacheInit(&pIf->aAddrCache[i], (INTNETADDRTYPE)i,
@@ -5146,8 +5462,6 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
         rc = intnetR0AllocDstTab(pNetwork->MacTab.cEntriesAllocated, (PINTNETDSTTAB *)&pIf->pDstTab);
     if (RT_SUCCESS(rc))
         rc = RTSemEventCreate((PRTSEMEVENT)&pIf->hRecvEvent);
-    if (RT_SUCCESS(rc))
-        rc = RTSpinlockCreate(&pIf->hRecvInSpinlock, RTSPINLOCK_FLAGS_INTERRUPT_SAFE, "hRecvInSpinlock");
     if (RT_SUCCESS(rc))
     {
         /*
@@ -5157,7 +5471,12 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
         cbRecv = RT_ALIGN(RT_MAX(cbRecv, sizeof(INTNETHDR) * 4), INTNETRINGBUF_ALIGNMENT);
         cbSend = RT_ALIGN(RT_MAX(cbSend, sizeof(INTNETHDR) * 4), INTNETRINGBUF_ALIGNMENT);
         const unsigned cbBuf = RT_ALIGN(sizeof(*pIf->pIntBuf), INTNETRINGBUF_ALIGNMENT) + cbRecv + cbSend;
-        rc = SUPR0MemAlloc(pIf->pSession, cbBuf, (PRTR0PTR)&pIf->pIntBufDefault, (PRTR3PTR)&pIf->pIntBufDefaultR3);
+        pIf->cRecvWrittenBits = cbRecv / INTNETHDR_ALIGNMENT;
+        pIf->pbmRecvWritten = (uint64_t volatile *)RTMemAllocZ(RT_ALIGN_Z(pIf->cRecvWrittenBits, 64) / 8);
+        if (pIf->pbmRecvWritten)
+            rc = SUPR0MemAlloc(pIf->pSession, cbBuf, (PRTR0PTR)&pIf->pIntBufDefault, (PRTR3PTR)&pIf->pIntBufDefaultR3);
+        else
+            rc = VERR_NO_MEMORY;
         if (RT_SUCCESS(rc))
         {
             ASMMemZero32(pIf->pIntBufDefault, cbBuf); /** @todo I thought I specified these buggers as clearing the memory... */
@@ -5192,6 +5511,7 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
                     pNetwork->MacTab.paEntries[iIf].pIf                  = pIf;
 
                     pNetwork->MacTab.cEntries = iIf + 1;
+                    intnetR0MacTabRehash(&pNetwork->MacTab);
                     pIf->pNetwork = pNetwork;
 
                     /*
@@ -5236,10 +5556,9 @@ static int intnetR0NetworkCreateIf(PINTNETNETWORK pNetwork, PSUPDRVSESSION pSess
         }
     }
 
-    RTSpinlockDestroy(pIf->hRecvInSpinlock);
-    pIf->hRecvInSpinlock = NIL_RTSPINLOCK;
     RTSemEventDestroy(pIf->hRecvEvent);
     pIf->hRecvEvent = NIL_RTSEMEVENT;
+    RTMemFree((void *)pIf->pbmRecvWritten);
     RTMemFree(pIf->pDstTab);
     for (int i = kIntNetAddrType_Invalid + 1; i < kIntNetAddrType_End; i++)
         intnetR0IfAddrCacheDestroy(&pIf->aAddrCache[i]);
@@ -6089,6 +6408,7 @@ static DECLCALLBACK(void) intnetR0NetworkDestruct(void *pvObj, void *pvUser1, vo
         {
             pIf->pNetwork = NULL;
             pNetwork->MacTab.cEntries--;
+            intnetR0MacTabRehash(&pNetwork->MacTab);
         }
     }
 
@@ -6478,6 +6798,9 @@ static int intnetR0CreateNetwork(PINTNET pIntNet, PSUPDRVSESSION pSession, const
     //pNetwork->MacTab.cPromiscuousEntries  = 0;
     //pNetwork->MacTab.cPromiscuousNoTrunkEntries = 0;
     pNetwork->MacTab.paEntries              = NULL;
+    pNetwork->MacTab.uGeneration            = 1;
+    //pNetwork->MacTab.cDummyEntries        = 0;
+    //pNetwork->MacTab.au16Hash             = {0};
     pNetwork->MacTab.fHostPromiscuousReal   = false;
     pNetwork->MacTab.fHostPromiscuousEff    = false;
     pNetwork->MacTab.fHostActive            = false;
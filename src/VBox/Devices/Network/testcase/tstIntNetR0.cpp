@@ -195,7 +195,7 @@ static int tstIntNetSendBuf(PINTNETRINGBUF pRingBuf, INTNETIFHANDLE hIf,
 {
     INTNETSG Sg;
     IntNetSgInitTemp(&Sg, (void *)pvBuf, (uint32_t)cbBuf);
-    int rc = intnetR0RingWriteFrame(pRingBuf, &Sg, NULL);
+    int rc = intnetR0RingWriteFrame(pRingBuf, NULL, 0, &Sg, NULL, NULL);
     if (RT_SUCCESS(rc))
         rc = IntNetR0IfSend(hIf, pSession);
     return rc;
@@ -258,7 +258,7 @@ static DECLCALLBACK(int) SendThread(RTTHREAD hThreadSelf, void *pvArg)
 
         INTNETSG Sg;
         IntNetSgInitTemp(&Sg, abBuf, cb);
-        RTTEST_CHECK_RC_OK(g_hTest, rc = intnetR0RingWriteFrame(&pArgs->pBuf->Send, &Sg, NULL));
+        RTTEST_CHECK_RC_OK(g_hTest, rc = intnetR0RingWriteFrame(&pArgs->pBuf->Send, NULL, 0, &Sg, NULL, NULL));
         if (RT_SUCCESS(rc))
             RTTEST_CHECK_RC_OK(g_hTest, rc = IntNetR0IfSend(pArgs->hIf, g_pSession));
         cbSent += cb;
@@ -662,6 +662,181 @@ static void doUnicastTest(PTSTSTATE pThis, bool fHeadGuard)
                       cb, pvBuf, sizeof(s_au16Frame), s_au16Frame);
 }
 
+/** The number of producer threads in the multiple producer test. */
+#define TST_MP_PRODUCERS    4
+/** The number of frames each producer writes in the multiple producer test. */
+#define TST_MP_FRAMES       _64K
+
+/**
+ * Frame header used by the multiple producer test.
+ */
+typedef struct MYMPFRAMEHDR
+{
+    uint32_t    iProducer;
+    uint32_t    iFrame;
+    uint32_t    cbFrame;
+    uint32_t    u32Reserved;
+} MYMPFRAMEHDR;
+
+/**
+ * Arguments for the multiple producer test threads.
+ */
+typedef struct MYMPARGS
+{
+    PINTNETRINGBUF          pRingBuf;
+    uint64_t volatile      *pbmWritten;
+    uint32_t                cWrittenBits;
+    uint32_t                iProducer;
+    RTSEMEVENT              hEvtWakeup;
+} MYMPARGS, *PMYMPARGS;
+
+
+/**
+ * Calculates the frame size and fills in the payload for the multiple producer
+ * test.
+ */
+static uint32_t tstMpFrameInit(uint8_t *pbFrame, uint32_t iProducer, uint32_t iFrame)
+{
+    uint32_t const cbFrame = sizeof(MYMPFRAMEHDR) + (iFrame * 7 + iProducer * 13) % 200;
+    MYMPFRAMEHDR *pHdr = (MYMPFRAMEHDR *)pbFrame;
+    pHdr->iProducer   = iProducer;
+    pHdr->iFrame      = iFrame;
+    pHdr->cbFrame     = cbFrame;
+    pHdr->u32Reserved = 0;
+    memset(pHdr + 1, (uint8_t)(iFrame + iProducer), cbFrame - sizeof(*pHdr));
+    return cbFrame;
+}
+
+
+/**
+ * Producer thread for the multiple producer test.
+ *
+ * Writes frames to the shared ring and signals the consumer whenever
+ * intnetR0RingWriteFrame says it needs waking up.
+ */
+static DECLCALLBACK(int) MpProducerThread(RTTHREAD hThreadSelf, void *pvArg)
+{
+    PMYMPARGS pArgs = (PMYMPARGS)pvArg;
+    NOREF(hThreadSelf);
+
+    uint8_t abFrame[256];
+    for (uint32_t iFrame = 0; iFrame < TST_MP_FRAMES; iFrame++)
+    {
+        INTNETSG Sg;
+        IntNetSgInitTemp(&Sg, abFrame, tstMpFrameInit(abFrame, pArgs->iProducer, iFrame));
+
+        bool fWakeup = false;
+        int  rc;
+        while (   (rc = intnetR0RingWriteFrame(pArgs->pRingBuf, pArgs->pbmWritten, pArgs->cWrittenBits,
+                                               &Sg, NULL, &fWakeup)) == VERR_BUFFER_OVERFLOW
+               || rc == VERR_WRONG_ORDER)
+            RTThreadYield();
+        RTTEST_CHECK_RC_OK_RET(g_hTest, rc, rc);
+        if (fWakeup)
+            RTSemEventSignal(pArgs->hEvtWakeup);
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Lets several threads write to one ring using a written frame bitmap, and
+ * checks that all frames are committed in order and that the consumer is woken
+ * up whenever it has caught up with the ring.
+ */
+static void doMultiProducerTest(void)
+{
+    uint32_t const cbRecv = _8K;
+    uint32_t const cbSend = sizeof(INTNETHDR) * 4;
+    uint32_t const cbBuf  = RT_ALIGN_32(sizeof(INTNETBUF), INTNETRINGBUF_ALIGNMENT) + cbRecv + cbSend;
+    PINTNETBUF pBuf = (PINTNETBUF)RTMemAllocZ(cbBuf);
+    RTTESTI_CHECK_RETV(pBuf);
+    IntNetBufInit(pBuf, cbBuf, cbRecv, cbSend);
+
+    uint32_t const     cWrittenBits = cbRecv / INTNETHDR_ALIGNMENT;
+    uint64_t volatile *pbmWritten   = (uint64_t volatile *)RTMemAllocZ(RT_ALIGN_32(cWrittenBits, 64) / 8);
+    RTTESTI_CHECK_RETV(pbmWritten);
+    RTSEMEVENT hEvtWakeup;
+    RTTESTI_CHECK_RC_OK_RETV(RTSemEventCreate(&hEvtWakeup));
+
+    /*
+     * Start the producers.
+     */
+    MYMPARGS aArgs[TST_MP_PRODUCERS];
+    RTTHREAD ahThreads[TST_MP_PRODUCERS];
+    for (uint32_t i = 0; i < TST_MP_PRODUCERS; i++)
+    {
+        aArgs[i].pRingBuf     = &pBuf->Recv;
+        aArgs[i].pbmWritten   = pbmWritten;
+        aArgs[i].cWrittenBits = cWrittenBits;
+        aArgs[i].iProducer    = i;
+        aArgs[i].hEvtWakeup   = hEvtWakeup;
+        ahThreads[i] = NIL_RTTHREAD;
+        RTTESTI_CHECK_RC_OK(RTThreadCreateF(&ahThreads[i], MpProducerThread, &aArgs[i], 0, RTTHREADTYPE_EMULATION,
+                                            RTTHREADFLAGS_WAITABLE, "PROD%u", i));
+    }
+
+    /*
+     * Consume the frames, only waiting when the ring is empty.  Each producer's
+     * frames must show up in the order they were written, and a missed wakeup
+     * shows up as a timeout.
+     */
+    uint8_t  abFrame[256];
+    uint32_t aiNextFrame[TST_MP_PRODUCERS] = {0};
+    uint32_t cLeft  = TST_MP_PRODUCERS * TST_MP_FRAMES;
+    uint32_t cWaits = 0;
+    while (cLeft > 0 && !RTTestIErrorCount())
+    {
+        uint32_t cbFrame;
+        while ((cbFrame = IntNetRingReadAndSkipFrame(&pBuf->Recv, abFrame)) != 0)
+        {
+            MYMPFRAMEHDR const *pHdr = (MYMPFRAMEHDR const *)&abFrame[0];
+            RTTESTI_CHECK_MSG_BREAK(   pHdr->iProducer < TST_MP_PRODUCERS
+                                    && pHdr->iFrame == aiNextFrame[pHdr->iProducer],
+                                    ("iProducer=%u iFrame=%u\n", pHdr->iProducer, pHdr->iFrame));
+            uint8_t        abExpect[256];
+            uint32_t const cbExpect = tstMpFrameInit(abExpect, pHdr->iProducer, pHdr->iFrame);
+            RTTESTI_CHECK_MSG_BREAK(cbFrame == cbExpect && !memcmp(abFrame, abExpect, cbExpect),
+                                    ("iProducer=%u iFrame=%u cbFrame=%u cbExpect=%u\n",
+                                     pHdr->iProducer, pHdr->iFrame, cbFrame, cbExpect));
+            aiNextFrame[pHdr->iProducer]++;
+            cLeft--;
+        }
+        if (!cLeft || RTTestIErrorCount())
+            break;
+
+        int rc = RTSemEventWait(hEvtWakeup, RT_MS_10SEC);
+        if (RT_FAILURE(rc))
+        {
+            RTTestIFailed("RTSemEventWait -> %Rrc with %u frames left and %u readable bytes (missed wakeup)\n",
+                          rc, cLeft, IntNetRingGetReadable(&pBuf->Recv));
+            break;
+        }
+        cWaits++;
+    }
+    RTTestIPrintf(RTTESTLVL_ALWAYS, "%u frames, %u wakeups\n", TST_MP_PRODUCERS * TST_MP_FRAMES - cLeft, cWaits);
+
+    /*
+     * Cleanup, keep draining the ring so producers don't get stuck on it if we
+     * bailed out early.
+     */
+    for (uint32_t i = 0; i < TST_MP_PRODUCERS; i++)
+        if (ahThreads[i] != NIL_RTTHREAD)
+        {
+            int rcThread = VINF_SUCCESS;
+            int rc;
+            while ((rc = RTThreadWait(ahThreads[i], 10, &rcThread)) == VERR_TIMEOUT)
+                while (IntNetRingReadAndSkipFrame(&pBuf->Recv, abFrame) != 0)
+                { /* discard */ }
+            RTTESTI_CHECK_RC_OK(rc);
+            RTTESTI_CHECK_RC_OK(rcThread);
+        }
+    RTSemEventDestroy(hEvtWakeup);
+    RTMemFree((void *)pbmWritten);
+    RTMemFree(pBuf);
+}
+
+
 static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
 {
 
@@ -706,6 +881,12 @@ static void doTest(PTSTSTATE pThis, uint32_t cbRecv, uint32_t cbSend)
     doUnicastTest(pThis, false /*fHeadGuard*/);
     doUnicastTest(pThis, true /*fHeadGuard*/);
 
+    /*
+     * Several producers writing to the same receive ring.
+     */
+    RTTestISub("Multiple producers");
+    doMultiProducerTest();
+
     /*
      * Do the big bi-directional transfer test if the basics worked out.
      */
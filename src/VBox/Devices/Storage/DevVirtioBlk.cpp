@@ -0,0 +1,1839 @@
+/* $Id: DevVirtioBlk.cpp $ */
+/** @file
+ * VBox storage devices - Virtio block device (virtio-blk)
+ *
+ * Requests go straight to the attached driver through PDMIMEDIAEX, without the
+ * CDB parsing and sense data handling the virtio-scsi device needs, which keeps
+ * the per-I/O cost low for guests doing many small transfers.
+ *
+ * Log-levels used:
+ *    - Level 1:   The most important (but usually rare) things to note
+ *    - Level 2:   Request logging
+ *    - Level 3:   Vector and I/O transfer summary
+ *    - Level 6:   Device <-> Guest Driver negotation, traffic, notifications and state handling
+ */
+
+/*
+ * Copyright (C) 2006-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_DEV_VIRTIO
+
+#include <VBox/vmm/pdmdev.h>
+#include <VBox/vmm/pdmstorageifs.h>
+#include <VBox/AssertGuest.h>
+#include <VBox/msi.h>
+#include <VBox/version.h>
+#include <VBox/log.h>
+#include <iprt/errcore.h>
+#include <iprt/assert.h>
+#include <iprt/string.h>
+#include <VBox/sup.h>
+#include "../build/VBoxDD.h"
+#ifdef IN_RING3
+# include <iprt/alloc.h>
+# include <iprt/semaphore.h>
+# include <iprt/sg.h>
+# include <iprt/param.h>
+# include <iprt/uuid.h>
+#endif
+#include "../VirtIO/VirtioCore.h"
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The current saved state version. */
+#define VIRTIOBLK_SAVED_STATE_VERSION               UINT32_C(1)
+
+/** @name VirtIO 1.1 block device feature bits (See VirtIO 1.1 specification, Section 5.2.3)
+ * @{  */
+#define VIRTIO_BLK_F_SIZE_MAX               RT_BIT_64(1)        /**< Max size of any single segment in size_max      */
+#define VIRTIO_BLK_F_SEG_MAX                RT_BIT_64(2)        /**< Max number of segments of a request in seg_max  */
+#define VIRTIO_BLK_F_GEOMETRY               RT_BIT_64(4)        /**< Disk-style geometry specified in geometry       */
+#define VIRTIO_BLK_F_RO                     RT_BIT_64(5)        /**< Device is read-only                             */
+#define VIRTIO_BLK_F_BLK_SIZE               RT_BIT_64(6)        /**< Block size of disk is in blk_size               */
+#define VIRTIO_BLK_F_FLUSH                  RT_BIT_64(9)        /**< Cache flush command support                     */
+#define VIRTIO_BLK_F_TOPOLOGY               RT_BIT_64(10)       /**< Optimal I/O alignment info in topology          */
+#define VIRTIO_BLK_F_CONFIG_WCE             RT_BIT_64(11)       /**< Guest can toggle writeback / writethrough       */
+#define VIRTIO_BLK_F_MQ                     RT_BIT_64(12)       /**< Multiple request queues, count in num_queues    */
+#define VIRTIO_BLK_F_DISCARD                RT_BIT_64(13)       /**< Discard command support                         */
+#define VIRTIO_BLK_F_WRITE_ZEROES           RT_BIT_64(14)       /**< Write zeroes command support                    */
+/** @} */
+
+/** Features offered regardless of the medium (discard and read-only are added per medium). */
+#define VIRTIOBLK_HOST_FEATURES_OFFERED \
+    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_FLUSH | VIRTIO_BLK_F_MQ | VIRTIO_BLK_F_WRITE_ZEROES)
+
+/** @name VirtIO block request types (See VirtIO 1.1 specification, Section 5.2.6)
+ * @{  */
+#define VIRTIO_BLK_T_IN                     0                   /**< Read                                            */
+#define VIRTIO_BLK_T_OUT                    1                   /**< Write                                           */
+#define VIRTIO_BLK_T_FLUSH                  4                   /**< Flush the write cache                           */
+#define VIRTIO_BLK_T_GET_ID                 8                   /**< Get the device ID string                        */
+#define VIRTIO_BLK_T_DISCARD                11                  /**< Discard sector ranges                           */
+#define VIRTIO_BLK_T_WRITE_ZEROES           13                  /**< Write zeroes to sector ranges                   */
+/** @} */
+
+/** @name VirtIO block request status values (See VirtIO 1.1 specification, Section 5.2.6)
+ * @{  */
+#define VIRTIO_BLK_S_OK                     0
+#define VIRTIO_BLK_S_IOERR                  1
+#define VIRTIO_BLK_S_UNSUPP                 2
+/** @} */
+
+/** Write zeroes segment flag: the device may deallocate the range. */
+#define VIRTIO_BLK_WRITE_ZEROES_F_UNMAP     RT_BIT_32(0)
+
+#define VIRTIOBLK_SECTOR_SHIFT              9                   /**< virtio-blk addresses in 512 byte sectors        */
+#define VIRTIOBLK_SECTOR_SIZE               RT_BIT_32(VIRTIOBLK_SECTOR_SHIFT)
+#define VIRTIOBLK_ID_BYTES                  20                  /**< Size of the GET_ID string (not terminated)      */
+
+#define VIRTIOBLK_REQ_VIRTQ_CNT_DEFAULT     4                   /**< Default number of request queues                */
+#define VIRTIOBLK_MAX_VIRTQ_CNT             16                  /**< Max request queues (all queues are req. queues) */
+#define VIRTIOBLK_MAX_SEG_COUNT             254                 /**< Max data segments per request (+ hdr, status)   */
+#define VIRTIOBLK_MAX_DISCARD_SEG           256                 /**< Max ranges in one discard request               */
+#define VIRTIOBLK_MAX_DISCARD_SECTORS       UINT32_C(0x400000)  /**< 2GB per discard range                           */
+#define VIRTIOBLK_MAX_WRITE_ZEROES_SEG      1                   /**< Write zeroes is emulated as one plain write     */
+#define VIRTIOBLK_MAX_WRITE_ZEROES_SECTORS  UINT32_C(0x4000)    /**< 8MB, bounds the driver's bounce buffer          */
+
+#define PCI_DEVICE_ID_VIRTIOBLK_HOST        0x1042              /**< Informs guest driver of type of VirtIO device   */
+#define PCI_CLASS_BASE_MASS_STORAGE         0x01                /**< PCI Mass Storage device class                   */
+#define PCI_CLASS_SUB_MASS_STORAGE_OTHER    0x80                /**< PCI "other" mass storage controller subclass    */
+#define PCI_CLASS_PROG_UNSPECIFIED          0x00                /**< Programming interface. N/A.                     */
+
+#define VIRTQNAME(uVirtqNbr) (pThis->aszVirtqNames[uVirtqNbr])  /**< Macro to get queue name from its index          */
+
+#define IS_VIRTQ_EMPTY(pDevIns, pVirtio, uVirtqNbr) \
+            (virtioCoreVirtqAvailBufCount(pDevIns, pVirtio, uVirtqNbr) == 0)
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * VirtIO block device-specific configuration (see VirtIO 1.1, section 5.2.4).
+ * The geometry and topology sub-structures are flattened so every field can be
+ * matched with VIRTIO_DEV_CONFIG_MATCH_MEMBER.
+ */
+typedef struct virtio_blk_config
+{
+    uint64_t uCapacity;                                         /**< capacity         Size in 512-byte sectors      */
+    uint32_t uSizeMax;                                          /**< size_max         Max size of a single segment  */
+    uint32_t uSegMax;                                           /**< seg_max          Max \# of segs in a request   */
+    uint16_t uCylinders;                                        /**< geometry.cylinders                             */
+    uint8_t  uHeads;                                            /**< geometry.heads                                 */
+    uint8_t  uSectors;                                          /**< geometry.sectors                               */
+    uint32_t uBlkSize;                                          /**< blk_size         Logical block size            */
+    uint8_t  uPhysBlkExp;                                       /**< topology.physical_block_exp                    */
+    uint8_t  uAlignmentOffset;                                  /**< topology.alignment_offset                      */
+    uint16_t uMinIoSize;                                        /**< topology.min_io_size                           */
+    uint32_t uOptIoSize;                                        /**< topology.opt_io_size                           */
+    uint8_t  uWriteback;                                        /**< writeback        Cache mode (CONFIG_WCE)       */
+    uint8_t  uUnused0;                                          /**< unused0                                        */
+    uint16_t uNumVirtqs;                                        /**< num_queues       \# of request queues (MQ)     */
+    uint32_t uMaxDiscardSectors;                                /**< max_discard_sectors                            */
+    uint32_t uMaxDiscardSeg;                                    /**< max_discard_seg                                */
+    uint32_t uDiscardSectorAlignment;                           /**< discard_sector_alignment                       */
+    uint32_t uMaxWriteZeroesSectors;                            /**< max_write_zeroes_sectors                       */
+    uint32_t uMaxWriteZeroesSeg;                                /**< max_write_zeroes_seg                           */
+    uint8_t  uWriteZeroesMayUnmap;                              /**< write_zeroes_may_unmap                         */
+    uint8_t  abUnused1[3];                                      /**< unused1                                        */
+} VIRTIOBLK_CONFIG_T, *PVIRTIOBLK_CONFIG_T;
+AssertCompileMemberOffset(VIRTIOBLK_CONFIG_T, uBlkSize,             20);
+AssertCompileMemberOffset(VIRTIOBLK_CONFIG_T, uNumVirtqs,           34);
+AssertCompileMemberOffset(VIRTIOBLK_CONFIG_T, uWriteZeroesMayUnmap, 56);
+
+/**
+ * Request header, the first (device-readable) part of every request (VirtIO 1.1, section 5.2.6).
+ * The device-writable part ends with a single status byte.
+ */
+typedef struct VIRTIOBLK_REQ_HDR_T
+{
+    uint32_t uType;                                             /**< type             VIRTIO_BLK_T_XXX              */
+    uint32_t uReserved;                                         /**< reserved                                       */
+    uint64_t uSector;                                           /**< sector           Start (512 byte units)        */
+} VIRTIOBLK_REQ_HDR_T;
+AssertCompileSize(VIRTIOBLK_REQ_HDR_T, 16);
+
+/**
+ * Discard and write zeroes range, the data part of those requests.
+ */
+typedef struct VIRTIOBLK_DISCARD_WZ_SEG_T
+{
+    uint64_t uSector;                                           /**< sector           Start (512 byte units)        */
+    uint32_t cSectors;                                          /**< num_sectors                                    */
+    uint32_t fFlags;                                            /**< flags            VIRTIO_BLK_WRITE_ZEROES_F_XXX */
+} VIRTIOBLK_DISCARD_WZ_SEG_T, *PVIRTIOBLK_DISCARD_WZ_SEG_T;
+AssertCompileSize(VIRTIOBLK_DISCARD_WZ_SEG_T, 16);
+
+/**
+ * Worker thread context, shared state.
+ */
+typedef struct VIRTIOBLKWORKER
+{
+    SUPSEMEVENT                     hEvtProcess;                /**< handle of associated sleep/wake-up semaphore      */
+    bool volatile                   fSleeping;                  /**< Flags whether worker thread is sleeping or not    */
+    bool volatile                   fNotified;                  /**< Flags whether worker thread notified              */
+} VIRTIOBLKWORKER;
+/** Pointer to a VirtIO block worker. */
+typedef VIRTIOBLKWORKER *PVIRTIOBLKWORKER;
+
+/**
+ * Worker thread context, ring-3 state.
+ */
+typedef struct VIRTIOBLKWORKERR3
+{
+    R3PTRTYPE(PPDMTHREAD)           pThread;                    /**< pointer to worker thread's handle                 */
+    uint16_t                        auRedoDescs[VIRTQ_MAX_ENTRIES];/**< List of previously suspended reqs to re-submit    */
+    uint16_t                        cRedoDescs;                 /**< Number of redo desc chain head desc idxes in list */
+} VIRTIOBLKWORKERR3;
+/** Pointer to a VirtIO block worker. */
+typedef VIRTIOBLKWORKERR3 *PVIRTIOBLKWORKERR3;
+
+/**
+ * VirtIO block device state, shared edition.
+ *
+ * @extends     VIRTIOCORE
+ */
+typedef struct VIRTIOBLK
+{
+    /** The core virtio state.   */
+    VIRTIOCORE                      Virtio;
+
+    /** VirtIO block device runtime configuration parameters */
+    VIRTIOBLK_CONFIG_T              virtioBlkConfig;
+
+    /** Number of request queues offered to the guest. */
+    uint32_t                        cVirtqs;
+
+    /** Per virtq worker-thread contexts */
+    VIRTIOBLKWORKER                 aWorkers[VIRTIOBLK_MAX_VIRTQ_CNT];
+
+    /** Instance name */
+    char                            szInstance[16];
+
+    /** Device-specific spec-based VirtIO VIRTQNAMEs */
+    char                            aszVirtqNames[VIRTIOBLK_MAX_VIRTQ_CNT][VIRTIO_MAX_VIRTQ_NAME_SIZE];
+
+    /** Track which VirtIO queues we've attached to */
+    bool                            afVirtqAttached[VIRTIOBLK_MAX_VIRTQ_CNT];
+
+    /** Set if the medium is read-only (VIRTIO_BLK_F_RO offered). */
+    bool                            fReadOnly;
+
+    /** Set if the attached driver supports discarding (VIRTIO_BLK_F_DISCARD offered). */
+    bool                            fDiscard;
+
+    /** Explicit alignment padding. */
+    bool                            afPadding0[2];
+
+    /** Total number of requests active */
+    volatile uint32_t               cActiveReqs;
+
+    /** True if the guest/driver and VirtIO framework are in the ready state */
+    uint32_t                        fVirtioReady;
+
+    /** True if in the process of resetting */
+    uint32_t                        fResetting;
+
+} VIRTIOBLK;
+/** Pointer to the shared state of the VirtIO block device. */
+typedef VIRTIOBLK *PVIRTIOBLK;
+
+
+/**
+ * VirtIO block device state, ring-3 edition.
+ *
+ * @extends     VIRTIOCORER3
+ */
+typedef struct VIRTIOBLKR3
+{
+    /** The core virtio ring-3 state. */
+    VIRTIOCORER3                    Virtio;
+
+    /** Per virtq worker-thread contexts */
+    VIRTIOBLKWORKERR3               aWorkers[VIRTIOBLK_MAX_VIRTQ_CNT];
+
+    /** Pointer to the device instance.
+     * @note Only used in interface callbacks. */
+    PPDMDEVINSR3                    pDevIns;
+
+    /** Device base interface (LUN\#0 and status LUN). */
+    PDMIBASE                        IBase;
+
+    /** Media port interface. */
+    PDMIMEDIAPORT                   IMediaPort;
+
+    /** Extended media port interface. */
+    PDMIMEDIAEXPORT                 IMediaExPort;
+
+    /** Status LEDs port interface. */
+    PDMILEDPORTS                    ILeds;
+
+    /** Pointer to attached driver's base interface. */
+    R3PTRTYPE(PPDMIBASE)            pDrvBase;
+
+    /** Pointer to the attached driver's media interface. */
+    R3PTRTYPE(PPDMIMEDIA)           pDrvMedia;
+
+    /** Pointer to the attached driver's extended media interface. */
+    R3PTRTYPE(PPDMIMEDIAEX)         pDrvMediaEx;
+
+    /** IMediaExPort: Media ejection notification */
+    R3PTRTYPE(PPDMIMEDIANOTIFY)     pMediaNotify;
+
+    /** The status LED state for the disk. */
+    PDMLED                          Led;
+
+    /** The GET_ID string (derived from the medium UUID, not terminated). */
+    char                            achId[VIRTIOBLK_ID_BYTES];
+
+    /** True if in the process of quiescing I/O */
+    uint32_t                        fQuiescing;
+
+    /** For which purpose we're quiescing. */
+    VIRTIOVMSTATECHANGED            enmQuiescingFor;
+
+} VIRTIOBLKR3;
+/** Pointer to the ring-3 state of the VirtIO block device. */
+typedef VIRTIOBLKR3 *PVIRTIOBLKR3;
+
+
+/**
+ * VirtIO block device state, ring-0 edition.
+ */
+typedef struct VIRTIOBLKR0
+{
+    /** The core virtio ring-0 state. */
+    VIRTIOCORER0                    Virtio;
+} VIRTIOBLKR0;
+/** Pointer to the ring-0 state of the VirtIO block device. */
+typedef VIRTIOBLKR0 *PVIRTIOBLKR0;
+
+
+/**
+ * VirtIO block device state, raw-mode edition.
+ */
+typedef struct VIRTIOBLKRC
+{
+    /** The core virtio raw-mode state. */
+    VIRTIOCORERC                    Virtio;
+} VIRTIOBLKRC;
+/** Pointer to the raw-mode state of the VirtIO block device. */
+typedef VIRTIOBLKRC *PVIRTIOBLKRC;
+
+
+/** @typedef VIRTIOBLKCC
+ * The instance data for the current context. */
+typedef CTX_SUFF(VIRTIOBLK) VIRTIOBLKCC;
+/** @typedef PVIRTIOBLKCC
+ * Pointer to the instance data for the current context. */
+typedef CTX_SUFF(PVIRTIOBLK) PVIRTIOBLKCC;
+
+
+/**
+ * Request structure for IMediaEx (allocated by the driver along with the I/O request).
+ */
+typedef struct VIRTIOBLKREQ
+{
+    PDMMEDIAEXIOREQ                hIoReq;                      /**< Handle of I/O request                             */
+    PVIRTQBUF                      pVirtqBuf;                   /**< Prepared desc chain pulled from virtq avail ring  */
+    uint16_t                       uVirtqNbr;                   /**< Index of queue this request arrived on            */
+    uint32_t                       uType;                       /**< VIRTIO_BLK_T_XXX                                  */
+    size_t                         cbData;                      /**< Size of the read/write transfer                   */
+    uint32_t                       cRanges;                     /**< Number of entries in paRanges (discard)           */
+    PVIRTIOBLK_DISCARD_WZ_SEG_T    paRanges;                    /**< Ranges read from the guest (discard), heap        */
+} VIRTIOBLKREQ;
+typedef VIRTIOBLKREQ *PVIRTIOBLKREQ;
+
+
+/**
+ * callback_method_impl{VIRTIOCORER0,pfnVirtqNotified}
+ */
+static DECLCALLBACK(void) virtioBlkNotified(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16_t uVirtqNbr)
+{
+    RT_NOREF(pVirtio);
+    PVIRTIOBLK pThis = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+
+    if (uVirtqNbr < pThis->cVirtqs)
+    {
+        PVIRTIOBLKWORKER pWorker = &pThis->aWorkers[uVirtqNbr];
+        Log6Func(("%s has available data\n", VIRTQNAME(uVirtqNbr)));
+        /* Wake queue's worker thread up if sleeping */
+        if (!ASMAtomicXchgBool(&pWorker->fNotified, true))
+        {
+            if (ASMAtomicReadBool(&pWorker->fSleeping))
+            {
+                Log6Func(("waking %s worker.\n", VIRTQNAME(uVirtqNbr)));
+                int rc = PDMDevHlpSUPSemEventSignal(pDevIns, pWorker->hEvtProcess);
+                AssertRC(rc);
+            }
+        }
+    }
+    else
+        LogFunc(("Unexpected queue idx (ignoring): %d\n", uVirtqNbr));
+}
+
+
+#ifdef IN_RING3 /* spans most of the file, at the moment. */
+
+
+DECLINLINE(void) virtioBlkSetVirtqNames(PVIRTIOBLK pThis)
+{
+    for (uint16_t uVirtqNbr = 0; uVirtqNbr < VIRTIOBLK_MAX_VIRTQ_CNT; uVirtqNbr++)
+        RTStrPrintf(pThis->aszVirtqNames[uVirtqNbr], VIRTIO_MAX_VIRTQ_NAME_SIZE, "requestq<%d>", uVirtqNbr);
+}
+
+/**
+ * Reads from the device-readable part of a request, starting @a off bytes in.
+ */
+static void virtioBlkR3PhysReadSend(PPDMDEVINS pDevIns, PVIRTQBUF pVirtqBuf, size_t off, void *pv, size_t cb)
+{
+    PVIRTIOSGBUF pSgPhysSend = pVirtqBuf->pSgPhysSend;
+    virtioCoreGCPhysChainReset(pSgPhysSend);
+    virtioCoreGCPhysChainAdvance(pSgPhysSend, off);
+
+    uint8_t *pb = (uint8_t *)pv;
+    while (cb)
+    {
+        size_t cbSeg = cb;
+        RTGCPHYS GCPhys = virtioCoreGCPhysChainGetNextSeg(pSgPhysSend, &cbSeg);
+        AssertBreak(cbSeg);
+        PDMDevHlpPCIPhysRead(pDevIns, GCPhys, pb, cbSeg);
+        pb += cbSeg;
+        cb -= cbSeg;
+    }
+}
+
+/**
+ * Writes to the device-writable part of a request, starting @a off bytes in.
+ */
+static void virtioBlkR3PhysWriteReturn(PPDMDEVINS pDevIns, PVIRTQBUF pVirtqBuf, size_t off, const void *pv, size_t cb)
+{
+    PVIRTIOSGBUF pSgPhysReturn = pVirtqBuf->pSgPhysReturn;
+    virtioCoreGCPhysChainReset(pSgPhysReturn);
+    virtioCoreGCPhysChainAdvance(pSgPhysReturn, off);
+
+    uint8_t const *pb = (uint8_t const *)pv;
+    while (cb)
+    {
+        size_t cbSeg = cb;
+        RTGCPHYS GCPhys = virtioCoreGCPhysChainGetNextSeg(pSgPhysReturn, &cbSeg);
+        AssertBreak(cbSeg);
+        PDMDevHlpPCIPhysWrite(pDevIns, GCPhys, pb, cbSeg);
+        pb += cbSeg;
+        cb -= cbSeg;
+    }
+}
+
+/**
+ * Completes a request: stores the status byte at the end of the device-writable
+ * buffer and hands the buffer back to the guest.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pThis       VirtIO block shared instance data.
+ * @param   pThisCC     VirtIO block ring-3 instance data.
+ * @param   uVirtqNbr   Virtq index
+ * @param   pVirtqBuf   Pointer to pre-processed descriptor chain pulled from virtq
+ * @param   cbData      Number of data bytes written in front of the status byte.
+ * @param   bStatus     VIRTIO_BLK_S_XXX
+ */
+static void virtioBlkR3ReqComplete(PPDMDEVINS pDevIns, PVIRTIOBLK pThis, PVIRTIOBLKCC pThisCC, uint16_t uVirtqNbr,
+                                   PVIRTQBUF pVirtqBuf, size_t cbData, uint8_t bStatus)
+{
+    Log2Func(("%s: status=%u cbData=%zu\n", VIRTQNAME(uVirtqNbr), bStatus, cbData));
+
+    uint32_t cbWritten = 0;
+    if (RT_LIKELY(pVirtqBuf->cbPhysReturn))
+    {
+        Assert(cbData < pVirtqBuf->cbPhysReturn);
+        virtioBlkR3PhysWriteReturn(pDevIns, pVirtqBuf, pVirtqBuf->cbPhysReturn - 1, &bStatus, sizeof(bStatus));
+        RT_UNTRUSTED_NONVOLATILE_COPY_FENCE();
+        cbWritten = (uint32_t)cbData + 1;
+    }
+
+    virtioCoreR3VirtqUsedBufPutLen(pDevIns, &pThis->Virtio, uVirtqNbr, pVirtqBuf, cbWritten);
+    virtioCoreVirtqUsedRingSync(pDevIns, &pThis->Virtio, uVirtqNbr);
+
+    if (!ASMAtomicDecU32(&pThis->cActiveReqs) && pThisCC->fQuiescing)
+        PDMDevHlpAsyncNotificationCompleted(pDevIns);
+}
+
+/** Internal worker. */
+static void virtioBlkR3FreeReq(PVIRTIOBLK pThis, PVIRTIOBLKCC pThisCC, PVIRTIOBLKREQ pReq)
+{
+    RTMemFree(pReq->paRanges);
+    pReq->paRanges = NULL;
+    virtioCoreR3VirtqBufRelease(&pThis->Virtio, pReq->pVirtqBuf);
+    pReq->pVirtqBuf = NULL;
+    pThisCC->pDrvMediaEx->pfnIoReqFree(pThisCC->pDrvMediaEx, pReq->hIoReq);
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqCompleteNotify}
+ */
+static DECLCALLBACK(int) virtioBlkR3IoReqFinish(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                void *pvIoReqAlloc, int rcReq)
+{
+    PVIRTIOBLKCC    pThisCC = RT_FROM_MEMBER(pInterface, VIRTIOBLKCC, IMediaExPort);
+    PPDMDEVINS      pDevIns = pThisCC->pDevIns;
+    PVIRTIOBLK      pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKREQ   pReq    = (PVIRTIOBLKREQ)pvIoReqAlloc;
+    RT_NOREF(hIoReq);
+
+    if (pReq->uType == VIRTIO_BLK_T_IN)
+        pThisCC->Led.Actual.s.fReading = 0;
+    else if (pReq->uType != VIRTIO_BLK_T_FLUSH)
+        pThisCC->Led.Actual.s.fWriting = 0;
+
+    uint8_t bStatus;
+    if (RT_SUCCESS(rcReq) && !pThis->fResetting)
+        bStatus = VIRTIO_BLK_S_OK;
+    else
+    {
+        LogRelMax(10, ("%s: %s request failed: %Rrc\n", pThis->szInstance, VIRTQNAME(pReq->uVirtqNbr), rcReq));
+        bStatus = VIRTIO_BLK_S_IOERR;
+    }
+
+    size_t const cbData = pReq->uType == VIRTIO_BLK_T_IN && bStatus == VIRTIO_BLK_S_OK ? pReq->cbData : 0;
+    virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, pReq->uVirtqNbr, pReq->pVirtqBuf, cbData, bStatus);
+    virtioBlkR3FreeReq(pThis, pThisCC, pReq);
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqCopyFromBuf}
+ *
+ * Copy read data from the driver buffer to guest physical memory.
+ */
+static DECLCALLBACK(int) virtioBlkR3IoReqCopyFromBuf(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                     void *pvIoReqAlloc, uint32_t offDst, PRTSGBUF pSgBuf, size_t cbCopy)
+{
+    PVIRTIOBLKCC    pThisCC = RT_FROM_MEMBER(pInterface, VIRTIOBLKCC, IMediaExPort);
+    PPDMDEVINS      pDevIns = pThisCC->pDevIns;
+    PVIRTIOBLKREQ   pReq    = (PVIRTIOBLKREQ)pvIoReqAlloc;
+    RT_NOREF(hIoReq);
+
+    AssertReturn(pReq->pVirtqBuf, VERR_INVALID_PARAMETER);
+    AssertReturn(offDst + cbCopy <= pReq->cbData, VERR_INVALID_PARAMETER);
+
+    PVIRTIOSGBUF pSgPhysReturn = pReq->pVirtqBuf->pSgPhysReturn;
+    virtioCoreGCPhysChainReset(pSgPhysReturn);
+    virtioCoreGCPhysChainAdvance(pSgPhysReturn, offDst);
+
+    size_t cbRemain = cbCopy;
+    while (cbRemain)
+    {
+        size_t cbCopied = RT_MIN(RT_MIN(pSgBuf->cbSegLeft, pSgPhysReturn->cbSegLeft), cbRemain);
+        AssertBreak(cbCopied > 0);
+        PDMDevHlpPCIPhysWrite(pDevIns, pSgPhysReturn->GCPhysCur, pSgBuf->pvSegCur, cbCopied);
+        RTSgBufAdvance(pSgBuf, cbCopied);
+        virtioCoreGCPhysChainAdvance(pSgPhysReturn, cbCopied);
+        cbRemain -= cbCopied;
+    }
+
+    Log3Func((".... Copied %zu bytes at offset %u of %zu byte read\n", cbCopy, offDst, pReq->cbData));
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqCopyToBuf}
+ *
+ * Copy write data from guest physical memory to the driver buffer; a write
+ * zeroes request has no data of its own, so the buffer is zero filled instead.
+ */
+static DECLCALLBACK(int) virtioBlkR3IoReqCopyToBuf(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                   void *pvIoReqAlloc, uint32_t offSrc, PRTSGBUF pSgBuf, size_t cbCopy)
+{
+    PVIRTIOBLKCC    pThisCC = RT_FROM_MEMBER(pInterface, VIRTIOBLKCC, IMediaExPort);
+    PPDMDEVINS      pDevIns = pThisCC->pDevIns;
+    PVIRTIOBLKREQ   pReq    = (PVIRTIOBLKREQ)pvIoReqAlloc;
+    RT_NOREF(hIoReq);
+
+    AssertReturn(pReq->pVirtqBuf, VERR_INVALID_PARAMETER);
+    AssertReturn(offSrc + cbCopy <= pReq->cbData, VERR_INVALID_PARAMETER);
+
+    if (pReq->uType == VIRTIO_BLK_T_WRITE_ZEROES)
+    {
+        RTSgBufSet(pSgBuf, 0, cbCopy);
+        return VINF_SUCCESS;
+    }
+
+    PVIRTIOSGBUF pSgPhysSend = pReq->pVirtqBuf->pSgPhysSend;
+    virtioCoreGCPhysChainReset(pSgPhysSend);
+    virtioCoreGCPhysChainAdvance(pSgPhysSend, sizeof(VIRTIOBLK_REQ_HDR_T) + offSrc);
+
+    size_t cbRemain = cbCopy;
+    while (cbRemain)
+    {
+        size_t cbCopied = RT_MIN(RT_MIN(pSgBuf->cbSegLeft, pSgPhysSend->cbSegLeft), cbRemain);
+        AssertBreak(cbCopied > 0);
+        PDMDevHlpPCIPhysRead(pDevIns, pSgPhysSend->GCPhysCur, pSgBuf->pvSegCur, cbCopied);
+        RTSgBufAdvance(pSgBuf, cbCopied);
+        virtioCoreGCPhysChainAdvance(pSgPhysSend, cbCopied);
+        cbRemain -= cbCopied;
+    }
+
+    Log3Func((".... Copied %zu bytes at offset %u of %zu byte write\n", cbCopy, offSrc, pReq->cbData));
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqQueryDiscardRanges}
+ */
+static DECLCALLBACK(int) virtioBlkR3IoReqQueryDiscardRanges(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                            void *pvIoReqAlloc, uint32_t idxRangeStart,
+                                                            uint32_t cRanges, PRTRANGE paRanges,
+                                                            uint32_t *pcRanges)
+{
+    PVIRTIOBLKREQ pReq = (PVIRTIOBLKREQ)pvIoReqAlloc;
+    RT_NOREF(pInterface, hIoReq);
+
+    AssertReturn(idxRangeStart <= pReq->cRanges, VERR_INVALID_PARAMETER);
+    uint32_t const cRangesCopy = RT_MIN(cRanges, pReq->cRanges - idxRangeStart);
+    for (uint32_t i = 0; i < cRangesCopy; i++)
+    {
+        PVIRTIOBLK_DISCARD_WZ_SEG_T pSeg = &pReq->paRanges[idxRangeStart + i];
+        paRanges[i].offStart = pSeg->uSector << VIRTIOBLK_SECTOR_SHIFT;
+        paRanges[i].cbRange  = (size_t)pSeg->cSectors << VIRTIOBLK_SECTOR_SHIFT;
+    }
+
+    *pcRanges = cRangesCopy;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Checks that a sector range is inside the medium.
+ */
+DECLINLINE(bool) virtioBlkR3IsRangeValid(PVIRTIOBLK pThis, uint64_t uSector, uint64_t cSectors)
+{
+    uint64_t const cCapacity = pThis->virtioBlkConfig.uCapacity;
+    return uSector <= cCapacity && cSectors <= cCapacity - uSector;
+}
+
+/**
+ * Handles a request pulled from a request queue on its worker thread and submits
+ * it to the driver.
+ *
+ * @returns VBox status code (logged by caller).
+ */
+static int virtioBlkR3ReqSubmit(PPDMDEVINS pDevIns, PVIRTIOBLK pThis, PVIRTIOBLKCC pThisCC,
+                                uint16_t uVirtqNbr, PVIRTQBUF pVirtqBuf)
+{
+    ASMAtomicIncU32(&pThis->cActiveReqs);
+
+    /*
+     * Fetch the header.  A request without room for the status byte can't be
+     * answered properly, so it's just handed back.
+     */
+    if (RT_UNLIKELY(   pVirtqBuf->cbPhysSend < sizeof(VIRTIOBLK_REQ_HDR_T)
+                    || pVirtqBuf->cbPhysReturn < 1))
+    {
+        LogRelMax(10, ("%s: Malformed request on %s (cbPhysSend=%u cbPhysReturn=%u)\n", pThis->szInstance,
+                       VIRTQNAME(uVirtqNbr), pVirtqBuf->cbPhysSend, pVirtqBuf->cbPhysReturn));
+        virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_IOERR);
+        return VINF_SUCCESS;
+    }
+
+    VIRTIOBLK_REQ_HDR_T ReqHdr;
+    virtioBlkR3PhysReadSend(pDevIns, pVirtqBuf, 0, &ReqHdr, sizeof(ReqHdr));
+
+    size_t const cbDataOut = pVirtqBuf->cbPhysSend - sizeof(ReqHdr);
+    size_t const cbDataIn  = pVirtqBuf->cbPhysReturn - 1;
+
+    Log2Func(("%s: type=%u sector=%RU64 cbDataOut=%zu cbDataIn=%zu\n",
+              VIRTQNAME(uVirtqNbr), ReqHdr.uType, ReqHdr.uSector, cbDataOut, cbDataIn));
+
+    if (RT_UNLIKELY(pThis->fResetting || !pThisCC->pDrvMediaEx))
+    {
+        virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_IOERR);
+        return VINF_SUCCESS;
+    }
+
+    /*
+     * Validate the request type specific bits.  Requests which never reach the driver
+     * (GET_ID, malformed or unsupported ones) are completed right here.
+     */
+    size_t   cbData  = 0;
+    uint32_t cRanges = 0;
+    VIRTIOBLK_DISCARD_WZ_SEG_T WzSeg;
+    RT_ZERO(WzSeg);
+    switch (ReqHdr.uType)
+    {
+        case VIRTIO_BLK_T_IN:
+            cbData = cbDataIn;
+            break;
+        case VIRTIO_BLK_T_OUT:
+            if (pThis->fReadOnly)
+            {
+                virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_IOERR);
+                return VINF_SUCCESS;
+            }
+            cbData = cbDataOut;
+            break;
+        case VIRTIO_BLK_T_FLUSH:
+            break;
+        case VIRTIO_BLK_T_GET_ID:
+        {
+            size_t const cbId = RT_MIN(cbDataIn, sizeof(pThisCC->achId));
+            virtioBlkR3PhysWriteReturn(pDevIns, pVirtqBuf, 0, pThisCC->achId, cbId);
+            virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, cbId, VIRTIO_BLK_S_OK);
+            return VINF_SUCCESS;
+        }
+        case VIRTIO_BLK_T_DISCARD:
+        case VIRTIO_BLK_T_WRITE_ZEROES:
+        {
+            uint32_t const cMaxSegs = ReqHdr.uType == VIRTIO_BLK_T_DISCARD
+                                    ? pThis->virtioBlkConfig.uMaxDiscardSeg : pThis->virtioBlkConfig.uMaxWriteZeroesSeg;
+            cRanges = (uint32_t)(cbDataOut / sizeof(VIRTIOBLK_DISCARD_WZ_SEG_T));
+            if (   (ReqHdr.uType == VIRTIO_BLK_T_DISCARD && !pThis->fDiscard)
+                || pThis->fReadOnly)
+            {
+                virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_UNSUPP);
+                return VINF_SUCCESS;
+            }
+            if (   !cRanges
+                || cRanges > cMaxSegs
+                || cbDataOut % sizeof(VIRTIOBLK_DISCARD_WZ_SEG_T))
+            {
+                virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_IOERR);
+                return VINF_SUCCESS;
+            }
+            if (ReqHdr.uType == VIRTIO_BLK_T_WRITE_ZEROES)
+            {
+                AssertCompile(VIRTIOBLK_MAX_WRITE_ZEROES_SEG == 1);
+                virtioBlkR3PhysReadSend(pDevIns, pVirtqBuf, sizeof(ReqHdr), &WzSeg, sizeof(WzSeg));
+                if (   WzSeg.cSectors > pThis->virtioBlkConfig.uMaxWriteZeroesSectors
+                    || (WzSeg.fFlags & ~VIRTIO_BLK_WRITE_ZEROES_F_UNMAP)
+                    || !virtioBlkR3IsRangeValid(pThis, WzSeg.uSector, WzSeg.cSectors))
+                {
+                    virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_IOERR);
+                    return VINF_SUCCESS;
+                }
+                ReqHdr.uSector = WzSeg.uSector;
+                cbData = (size_t)WzSeg.cSectors << VIRTIOBLK_SECTOR_SHIFT;
+                cRanges = 0;
+            }
+            break;
+        }
+        default:
+            Log2Func(("Unsupported request type %u\n", ReqHdr.uType));
+            virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_UNSUPP);
+            return VINF_SUCCESS;
+    }
+
+    if (   (ReqHdr.uType == VIRTIO_BLK_T_IN || ReqHdr.uType == VIRTIO_BLK_T_OUT)
+        && (   (cbData & (VIRTIOBLK_SECTOR_SIZE - 1))
+            || !virtioBlkR3IsRangeValid(pThis, ReqHdr.uSector, cbData >> VIRTIOBLK_SECTOR_SHIFT)))
+    {
+        LogRelMax(10, ("%s: Request beyond the end of the medium or misaligned (sector=%RU64 cb=%zu)\n",
+                       pThis->szInstance, ReqHdr.uSector, cbData));
+        virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_IOERR);
+        return VINF_SUCCESS;
+    }
+
+    /*
+     * Have the driver allocate a request of the size set during attach.
+     */
+    PDMMEDIAEXIOREQ hIoReq    = NULL;
+    PVIRTIOBLKREQ   pReq      = NULL;
+    PPDMIMEDIAEX    pIMediaEx = pThisCC->pDrvMediaEx;
+
+    int rc = pIMediaEx->pfnIoReqAlloc(pIMediaEx, &hIoReq, (void **)&pReq, 0 /* uIoReqId */,
+                                      PDMIMEDIAEX_F_SUSPEND_ON_RECOVERABLE_ERR);
+    if (RT_FAILURE(rc))
+    {
+        LogRelMax(10, ("%s: Failed to allocate I/O request, rc=%Rrc\n", pThis->szInstance, rc));
+        virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_IOERR);
+        return rc;
+    }
+
+    pReq->hIoReq    = hIoReq;
+    pReq->pVirtqBuf = pVirtqBuf;
+    virtioCoreR3VirtqBufRetain(pVirtqBuf); /* (For pReq->pVirtqBuf. Released by virtioBlkR3FreeReq.) */
+    pReq->uVirtqNbr = uVirtqNbr;
+    pReq->uType     = ReqHdr.uType;
+    pReq->cbData    = cbData;
+    pReq->cRanges   = 0;
+    pReq->paRanges  = NULL;
+
+    if (cRanges)
+    {
+        /* Discard: pull in and check the ranges now, the driver asks for them via virtioBlkR3IoReqQueryDiscardRanges. */
+        pReq->paRanges = (PVIRTIOBLK_DISCARD_WZ_SEG_T)RTMemAlloc(cRanges * sizeof(VIRTIOBLK_DISCARD_WZ_SEG_T));
+        if (!pReq->paRanges)
+        {
+            virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, VIRTIO_BLK_S_IOERR);
+            virtioBlkR3FreeReq(pThis, pThisCC, pReq);
+            return VERR_NO_MEMORY;
+        }
+        virtioBlkR3PhysReadSend(pDevIns, pVirtqBuf, sizeof(ReqHdr), pReq->paRanges, cRanges * sizeof(VIRTIOBLK_DISCARD_WZ_SEG_T));
+        pReq->cRanges = cRanges;
+
+        for (uint32_t i = 0; i < cRanges; i++)
+        {
+            PVIRTIOBLK_DISCARD_WZ_SEG_T pSeg = &pReq->paRanges[i];
+            if (   pSeg->fFlags
+                || pSeg->cSectors > pThis->virtioBlkConfig.uMaxDiscardSectors
+                || !virtioBlkR3IsRangeValid(pThis, pSeg->uSector, pSeg->cSectors))
+            {
+                uint8_t const bStatus = pSeg->fFlags ? VIRTIO_BLK_S_UNSUPP : VIRTIO_BLK_S_IOERR;
+                virtioBlkR3ReqComplete(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf, 0, bStatus);
+                virtioBlkR3FreeReq(pThis, pThisCC, pReq);
+                return VINF_SUCCESS;
+            }
+        }
+    }
+
+    uint64_t const offStart = ReqHdr.uSector << VIRTIOBLK_SECTOR_SHIFT;
+    switch (pReq->uType)
+    {
+        case VIRTIO_BLK_T_IN:
+            pThisCC->Led.Asserted.s.fReading = pThisCC->Led.Actual.s.fReading = 1;
+            rc = pIMediaEx->pfnIoReqRead(pIMediaEx, hIoReq, offStart, cbData);
+            break;
+        case VIRTIO_BLK_T_OUT:
+        case VIRTIO_BLK_T_WRITE_ZEROES:
+            pThisCC->Led.Asserted.s.fWriting = pThisCC->Led.Actual.s.fWriting = 1;
+            rc = pIMediaEx->pfnIoReqWrite(pIMediaEx, hIoReq, offStart, cbData);
+            break;
+        case VIRTIO_BLK_T_FLUSH:
+            rc = pIMediaEx->pfnIoReqFlush(pIMediaEx, hIoReq);
+            break;
+        case VIRTIO_BLK_T_DISCARD:
+            pThisCC->Led.Asserted.s.fWriting = pThisCC->Led.Actual.s.fWriting = 1;
+            rc = pIMediaEx->pfnIoReqDiscard(pIMediaEx, hIoReq, pReq->cRanges);
+            break;
+        default:
+            AssertFailed();
+            rc = VERR_INTERNAL_ERROR_3;
+            break;
+    }
+
+    /*
+     * Anything other than "in progress" means the request is done already and there
+     * will be no completion callback for it.
+     */
+    if (rc != VINF_PDM_MEDIAEX_IOREQ_IN_PROGRESS)
+        virtioBlkR3IoReqFinish(&pThisCC->IMediaExPort, hIoReq, pReq, rc);
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * @callback_method_impl{FNPDMTHREADWAKEUPDEV}
+ */
+static DECLCALLBACK(int) virtioBlkR3WorkerWakeUp(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    PVIRTIOBLK pThis = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    return PDMDevHlpSUPSemEventSignal(pDevIns, pThis->aWorkers[(uintptr_t)pThread->pvUser].hEvtProcess);
+}
+
+/**
+ * @callback_method_impl{FNPDMTHREADDEV}
+ */
+static DECLCALLBACK(int) virtioBlkR3WorkerThread(PPDMDEVINS pDevIns, PPDMTHREAD pThread)
+{
+    uint16_t const      uVirtqNbr = (uint16_t)(uintptr_t)pThread->pvUser;
+    PVIRTIOBLK          pThis     = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC        pThisCC   = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+    PVIRTIOBLKWORKER    pWorker   = &pThis->aWorkers[uVirtqNbr];
+    PVIRTIOBLKWORKERR3  pWorkerR3 = &pThisCC->aWorkers[uVirtqNbr];
+
+    if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+        return VINF_SUCCESS;
+
+    while (pThread->enmState == PDMTHREADSTATE_RUNNING)
+    {
+        if (!pWorkerR3->cRedoDescs && IS_VIRTQ_EMPTY(pDevIns, &pThis->Virtio, uVirtqNbr))
+        {
+            /* Atomic interlocks avoid missing alarm while going to sleep & notifier waking the awoken */
+            ASMAtomicWriteBool(&pWorker->fSleeping, true);
+            bool fNotificationSent = ASMAtomicXchgBool(&pWorker->fNotified, false);
+            if (!fNotificationSent)
+            {
+                Log6Func(("%s worker sleeping...\n", VIRTQNAME(uVirtqNbr)));
+                Assert(ASMAtomicReadBool(&pWorker->fSleeping));
+                int rc = PDMDevHlpSUPSemEventWaitNoResume(pDevIns, pWorker->hEvtProcess, RT_INDEFINITE_WAIT);
+                AssertLogRelMsgReturn(RT_SUCCESS(rc) || rc == VERR_INTERRUPTED, ("%Rrc\n", rc), rc);
+                if (RT_UNLIKELY(pThread->enmState != PDMTHREADSTATE_RUNNING))
+                    return VINF_SUCCESS;
+                if (rc == VERR_INTERRUPTED)
+                    continue;
+                Log6Func(("%s worker woken\n", VIRTQNAME(uVirtqNbr)));
+                ASMAtomicWriteBool(&pWorker->fNotified, false);
+            }
+            ASMAtomicWriteBool(&pWorker->fSleeping, false);
+        }
+
+        if (!pThis->afVirtqAttached[uVirtqNbr])
+        {
+            LogFunc(("%s queue not attached, worker aborting...\n", VIRTQNAME(uVirtqNbr)));
+            break;
+        }
+        if (!pThisCC->fQuiescing)
+        {
+            /* Process any reqs that were suspended saved to the redo queue in save exec. */
+            for (int i = 0; i < pWorkerR3->cRedoDescs; i++)
+            {
+                PVIRTQBUF pVirtqBuf;
+                int rc = virtioCoreR3VirtqAvailBufGet(pDevIns, &pThis->Virtio, uVirtqNbr,
+                                                      pWorkerR3->auRedoDescs[i], &pVirtqBuf);
+                if (RT_FAILURE(rc))
+                {
+                    LogRel(("Error fetching desc chain to redo, %Rrc", rc));
+                    continue;
+                }
+
+                rc = virtioBlkR3ReqSubmit(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf);
+                if (RT_FAILURE(rc))
+                    LogRel(("Error submitting req packet, resetting %Rrc", rc));
+
+                virtioCoreR3VirtqBufRelease(&pThis->Virtio, pVirtqBuf);
+            }
+            pWorkerR3->cRedoDescs = 0;
+
+            Log6Func(("fetching next descriptor chain from %s\n", VIRTQNAME(uVirtqNbr)));
+            PVIRTQBUF pVirtqBuf = NULL;
+            int rc = virtioCoreR3VirtqAvailBufGet(pDevIns, &pThis->Virtio, uVirtqNbr, &pVirtqBuf, true);
+            if (rc == VERR_NOT_AVAILABLE)
+            {
+                Log6Func(("Nothing found in %s\n", VIRTQNAME(uVirtqNbr)));
+                continue;
+            }
+            AssertRCBreak(rc);
+
+            rc = virtioBlkR3ReqSubmit(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf);
+            if (RT_FAILURE(rc))
+                LogRel(("Error submitting req packet, resetting %Rrc", rc));
+
+            virtioCoreR3VirtqBufRelease(&pThis->Virtio, pVirtqBuf);
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+/**
+ * @callback_method_impl{VIRTIOCORER3,pfnStatusChanged}
+ */
+static DECLCALLBACK(void) virtioBlkR3StatusChanged(PVIRTIOCORE pVirtio, PVIRTIOCORECC pVirtioCC, uint32_t fVirtioReady)
+{
+    PVIRTIOBLK      pThis   = RT_FROM_MEMBER(pVirtio, VIRTIOBLK, Virtio);
+    PVIRTIOBLKCC    pThisCC = RT_FROM_MEMBER(pVirtioCC, VIRTIOBLKCC, Virtio);
+
+    pThis->fVirtioReady = fVirtioReady;
+
+    if (fVirtioReady)
+    {
+        LogFunc(("VirtIO ready\n-----------------------------------------------------------------------------------------\n"));
+        pThis->fResetting   = false;
+        pThisCC->fQuiescing = false;
+
+        for (unsigned i = 0; i < pThis->cVirtqs; i++)
+            pThis->afVirtqAttached[i] = true;
+    }
+    else
+    {
+        LogFunc(("VirtIO is resetting\n"));
+        for (unsigned i = 0; i < pThis->cVirtqs; i++)
+            pThis->afVirtqAttached[i] = false;
+    }
+}
+
+
+/*********************************************************************************************************************************
+*   LEDs                                                                                                                         *
+*********************************************************************************************************************************/
+
+/**
+ * @interface_method_impl{PDMILEDPORTS,pfnQueryStatusLed}
+ */
+static DECLCALLBACK(int) virtioBlkR3QueryStatusLed(PPDMILEDPORTS pInterface, unsigned iLUN, PPDMLED *ppLed)
+{
+    PVIRTIOBLKCC pThisCC = RT_FROM_MEMBER(pInterface, VIRTIOBLKCC, ILeds);
+    if (iLUN == 0)
+    {
+        *ppLed = &pThisCC->Led;
+        Assert((*ppLed)->u32Magic == PDMLED_MAGIC);
+        return VINF_SUCCESS;
+    }
+    return VERR_PDM_LUN_NOT_FOUND;
+}
+
+
+/*********************************************************************************************************************************
+*   PDMIMEDIAPORT                                                                                                                *
+*********************************************************************************************************************************/
+
+/**
+ * @interface_method_impl{PDMIMEDIAPORT,pfnQueryDeviceLocation}
+ */
+static DECLCALLBACK(int) virtioBlkR3QueryDeviceLocation(PPDMIMEDIAPORT pInterface, const char **ppcszController,
+                                                        uint32_t *piInstance, uint32_t *piLUN)
+{
+    PVIRTIOBLKCC pThisCC = RT_FROM_MEMBER(pInterface, VIRTIOBLKCC, IMediaPort);
+    PPDMDEVINS   pDevIns = pThisCC->pDevIns;
+
+    AssertPtrReturn(ppcszController, VERR_INVALID_POINTER);
+    AssertPtrReturn(piInstance, VERR_INVALID_POINTER);
+    AssertPtrReturn(piLUN, VERR_INVALID_POINTER);
+
+    *ppcszController = pDevIns->pReg->szName;
+    *piInstance = pDevIns->iInstance;
+    *piLUN = 0;
+
+    return VINF_SUCCESS;
+}
+
+
+/*********************************************************************************************************************************
+*   Virtio config.                                                                                                               *
+*********************************************************************************************************************************/
+
+/**
+ * Worker for virtioBlkR3DevCapWrite and virtioBlkR3DevCapRead.
+ *
+ * Everything in virtio_blk_config is read-only for the guest as long as
+ * VIRTIO_BLK_F_CONFIG_WCE isn't offered.
+ */
+static int virtioBlkR3CfgAccessed(PVIRTIOBLK pThis, uint32_t uOffsetOfAccess, void *pv, uint32_t cb, bool fWrite)
+{
+    AssertReturn(pv && cb <= sizeof(uint32_t), fWrite ? VINF_SUCCESS : VINF_IOM_MMIO_UNUSED_00);
+
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uCapacity,               VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uCapacity,               VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uSizeMax,                VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uSizeMax,                VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uSegMax,                 VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uSegMax,                 VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uCylinders,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uCylinders,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uHeads,                  VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uHeads,                  VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uSectors,                VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uSectors,                VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uBlkSize,                VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uBlkSize,                VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uPhysBlkExp,             VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uPhysBlkExp,             VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uAlignmentOffset,        VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uAlignmentOffset,        VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uMinIoSize,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uMinIoSize,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uOptIoSize,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uOptIoSize,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uWriteback,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uWriteback,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uNumVirtqs,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uNumVirtqs,              VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uMaxDiscardSectors,      VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uMaxDiscardSectors,      VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uMaxDiscardSeg,          VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uMaxDiscardSeg,          VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uDiscardSectorAlignment, VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uDiscardSectorAlignment, VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uMaxWriteZeroesSectors,  VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uMaxWriteZeroesSectors,  VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uMaxWriteZeroesSeg,      VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uMaxWriteZeroesSeg,      VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    if (VIRTIO_DEV_CONFIG_MATCH_MEMBER(    uWriteZeroesMayUnmap,    VIRTIOBLK_CONFIG_T, uOffsetOfAccess))
+        VIRTIO_DEV_CONFIG_ACCESS_READONLY( uWriteZeroesMayUnmap,    VIRTIOBLK_CONFIG_T, uOffsetOfAccess, &pThis->virtioBlkConfig);
+    else
+    {
+        LogFunc(("Bad access by guest to virtio_blk_config: off=%u (%#x), cb=%u\n", uOffsetOfAccess, uOffsetOfAccess, cb));
+        return fWrite ? VINF_SUCCESS : VINF_IOM_MMIO_UNUSED_00;
+    }
+    return VINF_SUCCESS;
+}
+
+/**
+ * @callback_method_impl{VIRTIOCORER3,pfnDevCapRead}
+ */
+static DECLCALLBACK(int) virtioBlkR3DevCapRead(PPDMDEVINS pDevIns, uint32_t uOffset, void *pv, uint32_t cb)
+{
+    return virtioBlkR3CfgAccessed(PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK), uOffset, pv, cb, false /*fRead*/);
+}
+
+/**
+ * @callback_method_impl{VIRTIOCORER3,pfnDevCapWrite}
+ */
+static DECLCALLBACK(int) virtioBlkR3DevCapWrite(PPDMDEVINS pDevIns, uint32_t uOffset, const void *pv, uint32_t cb)
+{
+    return virtioBlkR3CfgAccessed(PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK), uOffset, (void *)pv, cb, true /*fWrite*/);
+}
+
+
+/*********************************************************************************************************************************
+*   IBase                                                                                                                        *
+*********************************************************************************************************************************/
+
+/**
+ * @interface_method_impl{PDMIBASE,pfnQueryInterface}
+ */
+static DECLCALLBACK(void *) virtioBlkR3QueryInterface(PPDMIBASE pInterface, const char *pszIID)
+{
+    PVIRTIOBLKCC pThisCC = RT_FROM_MEMBER(pInterface, VIRTIOBLKCC, IBase);
+
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIBASE,         &pThisCC->IBase);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIMEDIAPORT,    &pThisCC->IMediaPort);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMIMEDIAEXPORT,  &pThisCC->IMediaExPort);
+    PDMIBASE_RETURN_INTERFACE(pszIID, PDMILEDPORTS,     &pThisCC->ILeds);
+
+    return NULL;
+}
+
+
+/*********************************************************************************************************************************
+*   Misc                                                                                                                         *
+*********************************************************************************************************************************/
+
+/**
+ * @callback_method_impl{FNDBGFHANDLERDEV, virtio-blk debugger info callback.}
+ */
+static DECLCALLBACK(void) virtioBlkR3Info(PPDMDEVINS pDevIns, PCDBGFINFOHLP pHlp, const char *pszArgs)
+{
+    PVIRTIOBLK pThis = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    RT_NOREF(pszArgs);
+
+    pHlp->pfnPrintf(pHlp, "%s#%d: virtio-blk ", pDevIns->pReg->szName, pDevIns->iInstance);
+    pHlp->pfnPrintf(pHlp, "capacity=%RU64 sectors blk_size=%u queues=%u ro=%RTbool discard=%RTbool active=%u\n",
+                    pThis->virtioBlkConfig.uCapacity, pThis->virtioBlkConfig.uBlkSize, pThis->cVirtqs,
+                    pThis->fReadOnly, pThis->fDiscard, ASMAtomicReadU32(&pThis->cActiveReqs));
+}
+
+
+/*********************************************************************************************************************************
+*   Saved state                                                                                                                  *
+*********************************************************************************************************************************/
+
+/**
+ * @callback_method_impl{FNSSMDEVLOADEXEC}
+ */
+static DECLCALLBACK(int) virtioBlkR3LoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    PVIRTIOBLK      pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC    pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+    PCPDMDEVHLPR3   pHlp    = pDevIns->pHlpR3;
+
+    AssertReturn(uPass == SSM_PASS_FINAL, VERR_SSM_UNEXPECTED_PASS);
+    AssertLogRelMsgReturn(uVersion == VIRTIOBLK_SAVED_STATE_VERSION,
+                          ("uVersion=%u\n", uVersion), VERR_SSM_UNSUPPORTED_DATA_UNIT_VERSION);
+
+    uint32_t cVirtqs;
+    int rc = pHlp->pfnSSMGetU32(pSSM, &cVirtqs);
+    AssertRCReturn(rc, rc);
+    if (cVirtqs != pThis->cVirtqs)
+        return pHlp->pfnSSMSetCfgError(pSSM, RT_SRC_POS, N_("Config mismatch - NumQueues: saved=%u config=%u"),
+                                       cVirtqs, pThis->cVirtqs);
+
+    for (uint32_t uVirtqNbr = 0; uVirtqNbr < VIRTIOBLK_MAX_VIRTQ_CNT; uVirtqNbr++)
+        pHlp->pfnSSMGetBool(pSSM, &pThis->afVirtqAttached[uVirtqNbr]);
+
+    pHlp->pfnSSMGetU32(pSSM, &pThis->fVirtioReady);
+    pHlp->pfnSSMGetU32(pSSM, &pThis->fResetting);
+
+    for (uint16_t uVirtqNbr = 0; uVirtqNbr < VIRTIOBLK_MAX_VIRTQ_CNT; uVirtqNbr++)
+        pThisCC->aWorkers[uVirtqNbr].cRedoDescs = 0;
+
+    uint16_t cReqsRedo;
+    rc = pHlp->pfnSSMGetU16(pSSM, &cReqsRedo);
+    AssertRCReturn(rc, rc);
+    AssertReturn(cReqsRedo < VIRTQ_MAX_ENTRIES,
+                 pHlp->pfnSSMSetLoadError(pSSM, VERR_SSM_DATA_UNIT_FORMAT_CHANGED, RT_SRC_POS,
+                                          N_("Bad count of I/O transactions to re-do in saved state (%#x, max %#x - 1)"),
+                                          cReqsRedo, VIRTQ_MAX_ENTRIES));
+
+    for (uint16_t i = 0; i < cReqsRedo; i++)
+    {
+        uint16_t uVirtqNbr;
+        rc = pHlp->pfnSSMGetU16(pSSM, &uVirtqNbr);
+        AssertRCReturn(rc, rc);
+        AssertReturn(uVirtqNbr < pThis->cVirtqs,
+                     pHlp->pfnSSMSetLoadError(pSSM, VERR_SSM_DATA_UNIT_FORMAT_CHANGED, RT_SRC_POS,
+                                              N_("Bad queue index for re-do in saved state (%#x, max %#x)"),
+                                              uVirtqNbr, pThis->cVirtqs - 1));
+
+        uint16_t idxHead;
+        rc = pHlp->pfnSSMGetU16(pSSM, &idxHead);
+        AssertRCReturn(rc, rc);
+        AssertReturn(idxHead < VIRTQ_MAX_ENTRIES,
+                     pHlp->pfnSSMSetLoadError(pSSM, VERR_SSM_DATA_UNIT_FORMAT_CHANGED, RT_SRC_POS,
+                                              N_("Bad queue element index for re-do in saved state (%#x, max %#x)"),
+                                              idxHead, VIRTQ_MAX_ENTRIES - 1));
+
+        PVIRTIOBLKWORKERR3 pWorkerR3 = &pThisCC->aWorkers[uVirtqNbr];
+        pWorkerR3->auRedoDescs[pWorkerR3->cRedoDescs++] = idxHead;
+        pWorkerR3->cRedoDescs %= VIRTQ_MAX_ENTRIES;
+    }
+
+    /*
+     * Call the virtio core to let it load its state.
+     */
+    rc = virtioCoreR3LoadExec(&pThis->Virtio, pDevIns->pHlpR3, pSSM);
+
+    /*
+     * Nudge request queue workers
+     */
+    for (uint16_t uVirtqNbr = 0; uVirtqNbr < pThis->cVirtqs; uVirtqNbr++)
+    {
+        if (pThis->afVirtqAttached[uVirtqNbr])
+        {
+            LogFunc(("Waking %s worker.\n", VIRTQNAME(uVirtqNbr)));
+            int rc2 = PDMDevHlpSUPSemEventSignal(pDevIns, pThis->aWorkers[uVirtqNbr].hEvtProcess);
+            AssertRCReturn(rc2, rc2);
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * @callback_method_impl{FNSSMDEVSAVEEXEC}
+ */
+static DECLCALLBACK(int) virtioBlkR3SaveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSSM)
+{
+    PVIRTIOBLK      pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC    pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+    PCPDMDEVHLPR3   pHlp    = pDevIns->pHlpR3;
+
+    pHlp->pfnSSMPutU32(pSSM, pThis->cVirtqs);
+    for (uint32_t uVirtqNbr = 0; uVirtqNbr < VIRTIOBLK_MAX_VIRTQ_CNT; uVirtqNbr++)
+        pHlp->pfnSSMPutBool(pSSM, pThis->afVirtqAttached[uVirtqNbr]);
+
+    pHlp->pfnSSMPutU32(pSSM, pThis->fVirtioReady);
+    pHlp->pfnSSMPutU32(pSSM, pThis->fResetting);
+
+    AssertMsg(!pThis->cActiveReqs, ("There are still outstanding requests on this device\n"));
+
+    /*
+     * Query all suspended requests and store their descriptor chain heads so they
+     * can be re-fetched from the (split) ring and re-submitted after the restore.
+     */
+    uint32_t cReqsRedo = pThisCC->pDrvMediaEx ? pThisCC->pDrvMediaEx->pfnIoReqGetSuspendedCount(pThisCC->pDrvMediaEx) : 0;
+    pHlp->pfnSSMPutU16(pSSM, (uint16_t)cReqsRedo);
+    if (cReqsRedo)
+    {
+        PDMMEDIAEXIOREQ hIoReq;
+        PVIRTIOBLKREQ   pReq;
+        int rc = pThisCC->pDrvMediaEx->pfnIoReqQuerySuspendedStart(pThisCC->pDrvMediaEx, &hIoReq, (void **)&pReq);
+        while (RT_SUCCESS(rc))
+        {
+            pHlp->pfnSSMPutU16(pSSM, pReq->uVirtqNbr);
+            pHlp->pfnSSMPutU16(pSSM, pReq->pVirtqBuf->uHeadIdx);
+            if (!--cReqsRedo)
+                break;
+            rc = pThisCC->pDrvMediaEx->pfnIoReqQuerySuspendedNext(pThisCC->pDrvMediaEx, hIoReq, &hIoReq, (void **)&pReq);
+        }
+        AssertRCReturn(rc, rc);
+    }
+
+    /*
+     * Call the virtio core to let it save its state.
+     */
+    return virtioCoreR3SaveExec(&pThis->Virtio, pDevIns->pHlpR3, pSSM);
+}
+
+
+/*********************************************************************************************************************************
+*   Device interface.                                                                                                            *
+*********************************************************************************************************************************/
+
+/**
+ * Queries the interfaces of the freshly attached driver and derives the medium
+ * dependent configuration (capacity, block size, discard, read-only, ID string).
+ *
+ * @returns VBox status code.
+ */
+static int virtioBlkR3ConfigureMedium(PPDMDEVINS pDevIns, PVIRTIOBLK pThis, PVIRTIOBLKCC pThisCC)
+{
+    pThisCC->pDrvMedia = PDMIBASE_QUERY_INTERFACE(pThisCC->pDrvBase, PDMIMEDIA);
+    AssertMsgReturn(VALID_PTR(pThisCC->pDrvMedia),
+                    ("virtio-blk configuration error: LUN#0 missing basic media interface!\n"),
+                    VERR_PDM_MISSING_INTERFACE);
+
+    pThisCC->pDrvMediaEx = PDMIBASE_QUERY_INTERFACE(pThisCC->pDrvBase, PDMIMEDIAEX);
+    AssertMsgReturn(VALID_PTR(pThisCC->pDrvMediaEx),
+                    ("virtio-blk configuration error: LUN#0 missing extended media interface!\n"),
+                    VERR_PDM_MISSING_INTERFACE);
+
+    int rc = pThisCC->pDrvMediaEx->pfnIoReqAllocSizeSet(pThisCC->pDrvMediaEx, sizeof(VIRTIOBLKREQ));
+    AssertMsgRCReturn(rc, ("virtio-blk configuration error: LUN#0: Failed to set I/O request size!\n"), rc);
+
+    uint32_t fFeatures = 0;
+    rc = pThisCC->pDrvMediaEx->pfnQueryFeatures(pThisCC->pDrvMediaEx, &fFeatures);
+    AssertRCReturn(rc, rc);
+
+    uint32_t cbSector = pThisCC->pDrvMedia->pfnGetSectorSize(pThisCC->pDrvMedia);
+    if (cbSector < VIRTIOBLK_SECTOR_SIZE || !RT_IS_POWER_OF_TWO(cbSector))
+        cbSector = VIRTIOBLK_SECTOR_SIZE;
+
+    pThis->fReadOnly = pThisCC->pDrvMedia->pfnIsReadOnly(pThisCC->pDrvMedia);
+    pThis->fDiscard  = RT_BOOL(fFeatures & PDMIMEDIAEX_FEATURE_F_DISCARD);
+
+    pThis->virtioBlkConfig.uCapacity               = pThisCC->pDrvMedia->pfnGetSize(pThisCC->pDrvMedia) >> VIRTIOBLK_SECTOR_SHIFT;
+    pThis->virtioBlkConfig.uBlkSize                = cbSector;
+    pThis->virtioBlkConfig.uDiscardSectorAlignment = cbSector >> VIRTIOBLK_SECTOR_SHIFT;
+
+    RTUUID Uuid;
+    rc = pThisCC->pDrvMedia->pfnGetUuid(pThisCC->pDrvMedia, &Uuid);
+    if (RT_FAILURE(rc))
+        RT_ZERO(Uuid);
+    char szId[VIRTIOBLK_ID_BYTES + 1];
+    RTStrPrintf(szId, sizeof(szId), "VB%08x-%08x", Uuid.au32[0], Uuid.au32[3]);
+    RT_ZERO(pThisCC->achId);
+    memcpy(pThisCC->achId, szId, strlen(szId));
+
+    LogRel(("%s: Capacity=%RU64 sectors BlkSize=%u ReadOnly=%RTbool Discard=%RTbool\n", pThis->szInstance,
+            pThis->virtioBlkConfig.uCapacity, cbSector, pThis->fReadOnly, pThis->fDiscard));
+    RT_NOREF(pDevIns);
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMDEVREGR3,pfnDetach}
+ *
+ * The medium has been unplugged.  The VM is suspended at this point.
+ */
+static DECLCALLBACK(void) virtioBlkR3Detach(PPDMDEVINS pDevIns, unsigned iLUN, uint32_t fFlags)
+{
+    PVIRTIOBLKCC pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+    AssertReturnVoid(iLUN == 0);
+
+    LogFunc((""));
+
+    AssertMsg(fFlags & PDM_TACH_FLAGS_NOT_HOT_PLUG,
+              ("virtio-blk: Device does not support hotplugging\n"));
+    RT_NOREF(fFlags);
+
+    /*
+     * Zero all important members.
+     */
+    pThisCC->pDrvBase    = NULL;
+    pThisCC->pDrvMedia   = NULL;
+    pThisCC->pDrvMediaEx = NULL;
+}
+
+/**
+ * @interface_method_impl{PDMDEVREGR3,pfnAttach}
+ *
+ * This is called when we change block driver.
+ */
+static DECLCALLBACK(int) virtioBlkR3Attach(PPDMDEVINS pDevIns, unsigned iLUN, uint32_t fFlags)
+{
+    PVIRTIOBLK   pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+    AssertReturn(iLUN == 0, VERR_PDM_LUN_NOT_FOUND);
+
+    AssertMsgReturn(fFlags & PDM_TACH_FLAGS_NOT_HOT_PLUG,
+                    ("virtio-blk: Device does not support hotplugging\n"),
+                    VERR_INVALID_PARAMETER);
+
+    AssertRelease(!pThisCC->pDrvBase);
+
+    int rc = PDMDevHlpDriverAttach(pDevIns, 0, &pThisCC->IBase, &pThisCC->pDrvBase, "virtio-blk disk");
+    if (RT_SUCCESS(rc))
+    {
+        rc = virtioBlkR3ConfigureMedium(pDevIns, pThis, pThisCC);
+        if (RT_SUCCESS(rc))
+            virtioCoreNotifyConfigChanged(&pThis->Virtio);
+    }
+    else
+        AssertMsgFailed(("Failed to attach the disk. rc=%Rrc\n", rc));
+
+    if (RT_FAILURE(rc))
+    {
+        pThisCC->pDrvBase    = NULL;
+        pThisCC->pDrvMedia   = NULL;
+        pThisCC->pDrvMediaEx = NULL;
+    }
+    return rc;
+}
+
+/**
+ * @callback_method_impl{FNPDMDEVASYNCNOTIFY}
+ */
+static DECLCALLBACK(bool) virtioBlkR3DeviceQuiesced(PPDMDEVINS pDevIns)
+{
+    PVIRTIOBLK      pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC    pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+
+    if (ASMAtomicReadU32(&pThis->cActiveReqs))
+        return false;
+
+    LogFunc(("Device I/O activity quiesced: %s\n",
+        virtioCoreGetStateChangeText(pThisCC->enmQuiescingFor)));
+
+    virtioCoreR3VmStateChanged(&pThis->Virtio, pThisCC->enmQuiescingFor);
+
+    pThis->fResetting = false;
+    pThisCC->fQuiescing = false;
+
+    return true;
+}
+
+/**
+ * Worker for virtioBlkR3Reset() and virtioBlkR3SuspendOrPowerOff().
+ */
+static void virtioBlkR3QuiesceDevice(PPDMDEVINS pDevIns, VIRTIOVMSTATECHANGED enmQuiscingFor)
+{
+    PVIRTIOBLK      pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC    pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+
+    /* Prevent worker threads from removing/processing elements from virtq's */
+    pThisCC->fQuiescing = true;
+    pThisCC->enmQuiescingFor = enmQuiscingFor;
+
+    PDMDevHlpSetAsyncNotification(pDevIns, virtioBlkR3DeviceQuiesced);
+
+    /* If already quiesced invoke async callback.  */
+    if (!ASMAtomicReadU32(&pThis->cActiveReqs))
+        PDMDevHlpAsyncNotificationCompleted(pDevIns);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREGR3,pfnReset}
+ */
+static DECLCALLBACK(void) virtioBlkR3Reset(PPDMDEVINS pDevIns)
+{
+    LogFunc(("\n"));
+    PVIRTIOBLK pThis = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    pThis->fResetting = true;
+    virtioBlkR3QuiesceDevice(pDevIns, kvirtIoVmStateChangedReset);
+}
+
+/**
+ * Worker for virtioBlkR3PowerOff() and virtioBlkR3Suspend().
+ */
+static void virtioBlkR3SuspendOrPowerOff(PPDMDEVINS pDevIns, VIRTIOVMSTATECHANGED enmType)
+{
+    LogFunc(("\n"));
+
+    PVIRTIOBLKCC pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+
+    /* Have the driver suspend what it has queued, see virtioBlkR3IoReqStateChanged(). */
+    if (pThisCC->pDrvMediaEx)
+        pThisCC->pDrvMediaEx->pfnNotifySuspend(pThisCC->pDrvMediaEx);
+
+    virtioBlkR3QuiesceDevice(pDevIns, enmType);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREGR3,pfnPowerOff}
+ */
+static DECLCALLBACK(void) virtioBlkR3PowerOff(PPDMDEVINS pDevIns)
+{
+    LogFunc(("\n"));
+    virtioBlkR3SuspendOrPowerOff(pDevIns, kvirtIoVmStateChangedPowerOff);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREGR3,pfnSuspend}
+ */
+static DECLCALLBACK(void) virtioBlkR3Suspend(PPDMDEVINS pDevIns)
+{
+    LogFunc(("\n"));
+    virtioBlkR3SuspendOrPowerOff(pDevIns, kvirtIoVmStateChangedSuspend);
+}
+
+/**
+ * @interface_method_impl{PDMDEVREGR3,pfnResume}
+ */
+static DECLCALLBACK(void) virtioBlkR3Resume(PPDMDEVINS pDevIns)
+{
+    PVIRTIOBLK      pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC    pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+    LogFunc(("\n"));
+
+    pThisCC->fQuiescing = false;
+
+    /* Wake worker threads flagged to skip pulling queue entries during quiesce
+     * to ensure they re-check their queues. */
+    for (uint16_t uVirtqNbr = 0; uVirtqNbr < pThis->cVirtqs; uVirtqNbr++)
+    {
+        if (ASMAtomicReadBool(&pThis->aWorkers[uVirtqNbr].fSleeping))
+        {
+            Log6Func(("waking %s worker.\n", VIRTQNAME(uVirtqNbr)));
+            int rc = PDMDevHlpSUPSemEventSignal(pDevIns, pThis->aWorkers[uVirtqNbr].hEvtProcess);
+            AssertRC(rc);
+        }
+    }
+    /* Ensure guest is working the queues too. */
+    virtioCoreR3VmStateChanged(&pThis->Virtio, kvirtIoVmStateChangedResume);
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnMediumEjected}
+ */
+static DECLCALLBACK(void) virtioBlkR3MediumEjected(PPDMIMEDIAEXPORT pInterface)
+{
+    PVIRTIOBLKCC pThisCC = RT_FROM_MEMBER(pInterface, VIRTIOBLKCC, IMediaExPort);
+    PPDMDEVINS   pDevIns = pThisCC->pDevIns;
+
+    if (pThisCC->pMediaNotify)
+    {
+        int rc = VMR3ReqCallNoWait(PDMDevHlpGetVM(pDevIns), VMCPUID_ANY,
+                                   (PFNRT)pThisCC->pMediaNotify->pfnEjected, 2,
+                                   pThisCC->pMediaNotify, 0 /* iLUN */);
+        AssertRC(rc);
+    }
+}
+
+/**
+ * @interface_method_impl{PDMIMEDIAEXPORT,pfnIoReqStateChanged}
+ */
+static DECLCALLBACK(void) virtioBlkR3IoReqStateChanged(PPDMIMEDIAEXPORT pInterface, PDMMEDIAEXIOREQ hIoReq,
+                                                       void *pvIoReqAlloc, PDMMEDIAEXIOREQSTATE enmState)
+{
+    PVIRTIOBLKCC pThisCC = RT_FROM_MEMBER(pInterface, VIRTIOBLKCC, IMediaExPort);
+    PPDMDEVINS   pDevIns = pThisCC->pDevIns;
+    PVIRTIOBLK   pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    RT_NOREF(hIoReq, pvIoReqAlloc);
+
+    switch (enmState)
+    {
+        case PDMMEDIAEXIOREQSTATE_SUSPENDED:
+        {
+            /* Stop considering this request active */
+            if (!ASMAtomicDecU32(&pThis->cActiveReqs) && pThisCC->fQuiescing)
+                PDMDevHlpAsyncNotificationCompleted(pDevIns);
+            break;
+        }
+        case PDMMEDIAEXIOREQSTATE_ACTIVE:
+            ASMAtomicIncU32(&pThis->cActiveReqs);
+            break;
+        default:
+            AssertMsgFailed(("Invalid request state given %u\n", enmState));
+    }
+}
+
+/**
+ * @interface_method_impl{PDMDEVREGR3,pfnDestruct}
+ */
+static DECLCALLBACK(int) virtioBlkR3Destruct(PPDMDEVINS pDevIns)
+{
+    PDMDEV_CHECK_VERSIONS_RETURN_QUIET(pDevIns);
+    PVIRTIOBLK   pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+
+    pThisCC->pMediaNotify = NULL;
+
+    for (unsigned uVirtqNbr = 0; uVirtqNbr < VIRTIOBLK_MAX_VIRTQ_CNT; uVirtqNbr++)
+    {
+        PVIRTIOBLKWORKER pWorker = &pThis->aWorkers[uVirtqNbr];
+        if (pWorker->hEvtProcess != NIL_SUPSEMEVENT)
+        {
+            PDMDevHlpSUPSemEventClose(pDevIns, pWorker->hEvtProcess);
+            pWorker->hEvtProcess = NIL_SUPSEMEVENT;
+        }
+
+        if (pThisCC->aWorkers[uVirtqNbr].pThread)
+        {
+            /* Destroy the thread. */
+            int rcThread;
+            int rc = PDMDevHlpThreadDestroy(pDevIns, pThisCC->aWorkers[uVirtqNbr].pThread, &rcThread);
+            if (RT_FAILURE(rc) || RT_FAILURE(rcThread))
+                AssertMsgFailed(("%s Failed to destroythread rc=%Rrc rcThread=%Rrc\n",
+                                 __FUNCTION__, rc, rcThread));
+            pThisCC->aWorkers[uVirtqNbr].pThread = NULL;
+        }
+    }
+
+    virtioCoreR3Term(pDevIns, &pThis->Virtio, &pThisCC->Virtio);
+    return VINF_SUCCESS;
+}
+
+/**
+ * @interface_method_impl{PDMDEVREGR3,pfnConstruct}
+ */
+static DECLCALLBACK(int) virtioBlkR3Construct(PPDMDEVINS pDevIns, int iInstance, PCFGMNODE pCfg)
+{
+    PDMDEV_CHECK_VERSIONS_RETURN(pDevIns);
+    PVIRTIOBLK    pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC  pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+    PCPDMDEVHLPR3 pHlp    = pDevIns->pHlpR3;
+
+    /*
+     * Quick initialization of the state data, making sure that the destructor always works.
+     */
+    pThisCC->pDevIns = pDevIns;
+    for (unsigned uVirtqNbr = 0; uVirtqNbr < VIRTIOBLK_MAX_VIRTQ_CNT; uVirtqNbr++)
+        pThis->aWorkers[uVirtqNbr].hEvtProcess = NIL_SUPSEMEVENT;
+
+    LogFunc(("PDM device instance: %d\n", iInstance));
+    RTStrPrintf(pThis->szInstance, sizeof(pThis->szInstance), "VIRTIOBLK%d", iInstance);
+
+    pThisCC->IBase.pfnQueryInterface                 = virtioBlkR3QueryInterface;
+    pThisCC->ILeds.pfnQueryStatusLed                 = virtioBlkR3QueryStatusLed;
+    pThisCC->IMediaPort.pfnQueryDeviceLocation       = virtioBlkR3QueryDeviceLocation;
+    pThisCC->IMediaPort.pfnQueryScsiInqStrings       = NULL;
+    pThisCC->IMediaExPort.pfnIoReqCompleteNotify     = virtioBlkR3IoReqFinish;
+    pThisCC->IMediaExPort.pfnIoReqCopyFromBuf        = virtioBlkR3IoReqCopyFromBuf;
+    pThisCC->IMediaExPort.pfnIoReqCopyToBuf          = virtioBlkR3IoReqCopyToBuf;
+    pThisCC->IMediaExPort.pfnIoReqQueryBuf           = NULL;
+    pThisCC->IMediaExPort.pfnIoReqQueryDiscardRanges = virtioBlkR3IoReqQueryDiscardRanges;
+    pThisCC->IMediaExPort.pfnIoReqStateChanged       = virtioBlkR3IoReqStateChanged;
+    pThisCC->IMediaExPort.pfnMediumEjected           = virtioBlkR3MediumEjected;
+    pThisCC->Led.u32Magic                            = PDMLED_MAGIC;
+
+    /*
+     * Validate and read configuration.
+     */
+    PDMDEV_VALIDATE_CONFIG_RETURN(pDevIns, "NumQueues", "");
+
+    int rc = pHlp->pfnCFGMQueryU32Def(pCfg, "NumQueues", &pThis->cVirtqs, VIRTIOBLK_REQ_VIRTQ_CNT_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("virtio-blk configuration error: failed to read NumQueues as integer"));
+    if (pThis->cVirtqs < 1 || pThis->cVirtqs > VIRTIOBLK_MAX_VIRTQ_CNT)
+        return PDMDevHlpVMSetError(pDevIns, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                                   N_("virtio-blk configuration error: NumQueues=%u is out of range (1..%u)"),
+                                   pThis->cVirtqs, VIRTIOBLK_MAX_VIRTQ_CNT);
+
+    LogRel(("%s: NumQueues=%u R0Enabled=%RTbool RCEnabled=%RTbool\n",
+            pThis->szInstance, pThis->cVirtqs, pDevIns->fR0Enabled, pDevIns->fRCEnabled));
+
+    /*
+     * Attach the disk first, the features we offer depend on it.
+     */
+    rc = PDMDevHlpDriverAttach(pDevIns, 0, &pThisCC->IBase, &pThisCC->pDrvBase, "virtio-blk disk");
+    if (RT_SUCCESS(rc))
+    {
+        rc = virtioBlkR3ConfigureMedium(pDevIns, pThis, pThisCC);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    else if (rc == VERR_PDM_NO_ATTACHED_DRIVER)
+    {
+        pThisCC->pDrvBase = NULL;
+        Log(("virtio-blk: no driver attached to LUN#0\n"));
+        rc = VINF_SUCCESS;
+    }
+    else
+    {
+        AssertLogRelMsgFailed(("virtio-blk: Failed to attach LUN#0: %Rrc\n", rc));
+        return rc;
+    }
+
+    /*
+     * Do core virtio initialization.
+     */
+
+    /* Configure virtio_blk_config that transacts via VirtIO implementation's Dev. Specific Cap callbacks */
+    pThis->virtioBlkConfig.uSegMax                = VIRTIOBLK_MAX_SEG_COUNT;
+    pThis->virtioBlkConfig.uNumVirtqs             = (uint16_t)pThis->cVirtqs;
+    pThis->virtioBlkConfig.uMaxDiscardSectors     = VIRTIOBLK_MAX_DISCARD_SECTORS;
+    pThis->virtioBlkConfig.uMaxDiscardSeg         = VIRTIOBLK_MAX_DISCARD_SEG;
+    pThis->virtioBlkConfig.uMaxWriteZeroesSectors = VIRTIOBLK_MAX_WRITE_ZEROES_SECTORS;
+    pThis->virtioBlkConfig.uMaxWriteZeroesSeg     = VIRTIOBLK_MAX_WRITE_ZEROES_SEG;
+    pThis->virtioBlkConfig.uWriteZeroesMayUnmap   = 0;
+    if (!pThis->virtioBlkConfig.uBlkSize)
+        pThis->virtioBlkConfig.uBlkSize           = VIRTIOBLK_SECTOR_SIZE;
+
+    /* Initialize the generic Virtio core: */
+    pThisCC->Virtio.pfnVirtqNotified        = virtioBlkNotified;
+    pThisCC->Virtio.pfnStatusChanged        = virtioBlkR3StatusChanged;
+    pThisCC->Virtio.pfnDevCapRead           = virtioBlkR3DevCapRead;
+    pThisCC->Virtio.pfnDevCapWrite          = virtioBlkR3DevCapWrite;
+
+    VIRTIOPCIPARAMS VirtioPciParams;
+    VirtioPciParams.uDeviceId               = PCI_DEVICE_ID_VIRTIOBLK_HOST;
+    VirtioPciParams.uClassBase              = PCI_CLASS_BASE_MASS_STORAGE;
+    VirtioPciParams.uClassSub               = PCI_CLASS_SUB_MASS_STORAGE_OTHER;
+    VirtioPciParams.uClassProg              = PCI_CLASS_PROG_UNSPECIFIED;
+    VirtioPciParams.uSubsystemId            = PCI_DEVICE_ID_VIRTIOBLK_HOST;  /* VirtIO 1.0 spec allows PCI Device ID here */
+    VirtioPciParams.uInterruptLine          = 0x00;
+    VirtioPciParams.uInterruptPin           = 0x01;
+
+    /* Suspended requests are re-fetched by their head index after a restore, which the
+     * packed layout doesn't support (see virtioCoreR3VirtqAvailBufGet), so it isn't offered. */
+    uint64_t fFeatures = VIRTIOBLK_HOST_FEATURES_OFFERED;
+    if (pThis->fReadOnly)
+        fFeatures |= VIRTIO_BLK_F_RO;
+    if (pThis->fDiscard)
+        fFeatures |= VIRTIO_BLK_F_DISCARD;
+
+    rc = virtioCoreR3Init(pDevIns, &pThis->Virtio, &pThisCC->Virtio, &VirtioPciParams, pThis->szInstance,
+                          fFeatures, &pThis->virtioBlkConfig /*pvDevSpecificCap*/, sizeof(pThis->virtioBlkConfig));
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("virtio-blk: failed to initialize VirtIO"));
+
+    /*
+     * Initialize queues.
+     */
+    virtioBlkSetVirtqNames(pThis);
+
+    /* Attach the queues and create worker threads for them: */
+    for (uint16_t uVirtqNbr = 0; uVirtqNbr < pThis->cVirtqs; uVirtqNbr++)
+    {
+        rc = virtioCoreR3VirtqAttach(&pThis->Virtio, uVirtqNbr, VIRTQNAME(uVirtqNbr));
+        if (RT_FAILURE(rc))
+            continue;
+
+        rc = PDMDevHlpSUPSemEventCreate(pDevIns, &pThis->aWorkers[uVirtqNbr].hEvtProcess);
+        if (RT_FAILURE(rc))
+            return PDMDevHlpVMSetError(pDevIns, rc, RT_SRC_POS,
+                                       N_("DevVirtioBlk: Failed to create SUP event semaphore"));
+
+        rc = PDMDevHlpThreadCreate(pDevIns, &pThisCC->aWorkers[uVirtqNbr].pThread,
+                                   (void *)(uintptr_t)uVirtqNbr, virtioBlkR3WorkerThread,
+                                   virtioBlkR3WorkerWakeUp, 0, RTTHREADTYPE_IO, VIRTQNAME(uVirtqNbr));
+        if (rc != VINF_SUCCESS)
+        {
+            LogRel(("Error creating thread for Virtual Virtq %s: %Rrc\n", VIRTQNAME(uVirtqNbr), rc));
+            return rc;
+        }
+
+        pThis->afVirtqAttached[uVirtqNbr] = true;
+    }
+
+    /*
+     * Status driver (optional).
+     */
+    PPDMIBASE pUpBase = NULL;
+    rc = PDMDevHlpDriverAttach(pDevIns, PDM_STATUS_LUN, &pThisCC->IBase, &pUpBase, "Status Port");
+    if (RT_FAILURE(rc) && rc != VERR_PDM_NO_ATTACHED_DRIVER)
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("Failed to attach the status LUN"));
+    if (RT_SUCCESS(rc) && pUpBase)
+        pThisCC->pMediaNotify = PDMIBASE_QUERY_INTERFACE(pUpBase, PDMIMEDIANOTIFY);
+
+    /*
+     * Register saved state.
+     */
+    rc = PDMDevHlpSSMRegister(pDevIns, VIRTIOBLK_SAVED_STATE_VERSION, sizeof(*pThis),
+                              virtioBlkR3SaveExec, virtioBlkR3LoadExec);
+    AssertRCReturn(rc, rc);
+
+    /*
+     * Register the debugger info callback (ignore errors).
+     */
+    char szTmp[128];
+    RTStrPrintf(szTmp, sizeof(szTmp), "%s%u", pDevIns->pReg->szName, pDevIns->iInstance);
+    PDMDevHlpDBGFInfoRegister(pDevIns, szTmp, "virtio-blk info", virtioBlkR3Info);
+
+    return VINF_SUCCESS;
+}
+
+#else  /* !IN_RING3 */
+
+/**
+ * @callback_method_impl{PDMDEVREGR0,pfnConstruct}
+ */
+static DECLCALLBACK(int) virtioBlkRZConstruct(PPDMDEVINS pDevIns)
+{
+    PDMDEV_CHECK_VERSIONS_RETURN(pDevIns);
+
+    PVIRTIOBLK   pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOBLK);
+    PVIRTIOBLKCC pThisCC = PDMDEVINS_2_DATA_CC(pDevIns, PVIRTIOBLKCC);
+
+    pThisCC->Virtio.pfnVirtqNotified = virtioBlkNotified;
+    return virtioCoreRZInit(pDevIns, &pThis->Virtio);
+}
+
+#endif /* !IN_RING3 */
+
+
+/**
+ * The device registration structure.
+ */
+const PDMDEVREG g_DeviceVirtioBlk =
+{
+    /* .u32Version = */             PDM_DEVREG_VERSION,
+    /* .uReserved0 = */             0,
+    /* .szName = */                 "virtio-blk",
+    /* .fFlags = */                 PDM_DEVREG_FLAGS_DEFAULT_BITS | PDM_DEVREG_FLAGS_RZ | PDM_DEVREG_FLAGS_NEW_STYLE
+                                    | PDM_DEVREG_FLAGS_FIRST_SUSPEND_NOTIFICATION
+                                    | PDM_DEVREG_FLAGS_FIRST_POWEROFF_NOTIFICATION,
+    /* .fClass = */                 PDM_DEVREG_CLASS_STORAGE,
+    /* .cMaxInstances = */          ~0U,
+    /* .uSharedVersion = */         42,
+    /* .cbInstanceShared = */       sizeof(VIRTIOBLK),
+    /* .cbInstanceCC = */           sizeof(VIRTIOBLKCC),
+    /* .cbInstanceRC = */           sizeof(VIRTIOBLKRC),
+    /* .cMaxPciDevices = */         1,
+    /* .cMaxMsixVectors = */        VBOX_MSIX_MAX_ENTRIES,
+    /* .pszDescription = */         "Virtio Block Device.\n",
+#if defined(IN_RING3)
+    /* .pszRCMod = */               "VBoxDDRC.rc",
+    /* .pszR0Mod = */               "VBoxDDR0.r0",
+    /* .pfnConstruct = */           virtioBlkR3Construct,
+    /* .pfnDestruct = */            virtioBlkR3Destruct,
+    /* .pfnRelocate = */            NULL,
+    /* .pfnMemSetup = */            NULL,
+    /* .pfnPowerOn = */             NULL,
+    /* .pfnReset = */               virtioBlkR3Reset,
+    /* .pfnSuspend = */             virtioBlkR3Suspend,
+    /* .pfnResume = */              virtioBlkR3Resume,
+    /* .pfnAttach = */              virtioBlkR3Attach,
+    /* .pfnDetach = */              virtioBlkR3Detach,
+    /* .pfnQueryInterface = */      NULL,
+    /* .pfnInitComplete = */        NULL,
+    /* .pfnPowerOff = */            virtioBlkR3PowerOff,
+    /* .pfnSoftReset = */           NULL,
+    /* .pfnReserved0 = */           NULL,
+    /* .pfnReserved1 = */           NULL,
+    /* .pfnReserved2 = */           NULL,
+    /* .pfnReserved3 = */           NULL,
+    /* .pfnReserved4 = */           NULL,
+    /* .pfnReserved5 = */           NULL,
+    /* .pfnReserved6 = */           NULL,
+    /* .pfnReserved7 = */           NULL,
+#elif defined(IN_RING0)
+    /* .pfnEarlyConstruct = */      NULL,
+    /* .pfnConstruct = */           virtioBlkRZConstruct,
+    /* .pfnDestruct = */            NULL,
+    /* .pfnFinalDestruct = */       NULL,
+    /* .pfnRequest = */             NULL,
+    /* .pfnReserved0 = */           NULL,
+    /* .pfnReserved1 = */           NULL,
+    /* .pfnReserved2 = */           NULL,
+    /* .pfnReserved3 = */           NULL,
+    /* .pfnReserved4 = */           NULL,
+    /* .pfnReserved5 = */           NULL,
+    /* .pfnReserved6 = */           NULL,
+    /* .pfnReserved7 = */           NULL,
+#elif defined(IN_RC)
+    /* .pfnConstruct = */           virtioBlkRZConstruct,
+    /* .pfnReserved0 = */           NULL,
+    /* .pfnReserved1 = */           NULL,
+    /* .pfnReserved2 = */           NULL,
+    /* .pfnReserved3 = */           NULL,
+    /* .pfnReserved4 = */           NULL,
+    /* .pfnReserved5 = */           NULL,
+    /* .pfnReserved6 = */           NULL,
+    /* .pfnReserved7 = */           NULL,
+#else
+# error "Not in IN_RING3, IN_RING0 or IN_RC!"
+#endif
+    /* .u32VersionEnd = */          PDM_DEVREG_VERSION
+};
+
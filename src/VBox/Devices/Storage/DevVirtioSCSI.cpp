@@ -44,7 +44,9 @@
 #include <VBox/scsi.h>
 #ifdef IN_RING3
 # include <iprt/alloc.h>
+# include <iprt/cpuset.h>
 # include <iprt/memcache.h>
+# include <iprt/mp.h>
 # include <iprt/semaphore.h>
 # include <iprt/sg.h>
 # include <iprt/param.h>
@@ -80,8 +82,10 @@
 
 #define VIRTIOSCSI_HOST_SCSI_FEATURES_OFFERED       VIRTIOSCSI_HOST_SCSI_FEATURES_NONE
 
-#define VIRTIOSCSI_REQ_VIRTQ_CNT                    4           /**< T.B.D. Consider increasing                      */
-#define VIRTIOSCSI_VIRTQ_CNT                        (VIRTIOSCSI_REQ_VIRTQ_CNT + 2)
+#define VIRTIOSCSI_REQ_VIRTQ_CNT_DEFAULT            4           /**< Default number of request queues (NumQueues)    */
+#define VIRTIOSCSI_MAX_REQ_VIRTQ_CNT                16          /**< Max request queues, each has its own worker     */
+#define VIRTIOSCSI_MAX_VIRTQ_CNT                    (VIRTIOSCSI_MAX_REQ_VIRTQ_CNT + 2)
+#define VIRTIOSCSI_REQ_BATCH_MAX                    32          /**< Max avail bufs drained per worker pass          */
 #define VIRTIOSCSI_MAX_TARGETS                      256         /**< T.B.D. Figure out a a good value for this.      */
 #define VIRTIOSCSI_MAX_LUN                          256         /**< VirtIO specification, section 5.6.4             */
 #define VIRTIOSCSI_MAX_COMMANDS_PER_LUN             128         /**< T.B.D. What is a good value for this?           */
@@ -114,7 +118,7 @@
 #define VIRTQNAME(uVirtqNbr) (pThis->aszVirtqNames[uVirtqNbr])  /**< Macro to get queue name from its index          */
 #define CBVIRTQNAME(uVirtqNbr) RTStrNLen(VIRTQNAME(uVirtqNbr), sizeof(VIRTQNAME(uVirtqNbr)))
 
-#define IS_REQ_VIRTQ(uVirtqNbr) (uVirtqNbr >= VIRTQ_REQ_BASE && uVirtqNbr < VIRTIOSCSI_VIRTQ_CNT)
+#define IS_REQ_VIRTQ(uVirtqNbr) (uVirtqNbr >= VIRTQ_REQ_BASE && uVirtqNbr < pThis->cVirtqs)
 
 #define VIRTIO_IS_IN_DIRECTION(pMediaExTxDirEnumValue) \
     ((pMediaExTxDirEnumValue) == PDMMEDIAEXIOREQSCSITXDIR_FROM_DEVICE)
@@ -359,6 +363,9 @@ typedef struct VIRTIOSCSIWORKERR3
     R3PTRTYPE(PPDMTHREAD)           pThread;                    /**< pointer to worker thread's handle                 */
     uint16_t                        auRedoDescs[VIRTQ_MAX_ENTRIES];/**< List of previously suspended reqs to re-submit    */
     uint16_t                        cRedoDescs;                 /**< Number of redo desc chain head desc idxes in list */
+    bool                            fBatching;                  /**< Set while the worker drains a batch of requests   */
+    bool                            fSyncPending;               /**< Used ring sync deferred until the batch is done   */
+    RTCPUID                         idCpu;                      /**< Host CPU the worker is pinned to, or NIL_RTCPUID  */
 } VIRTIOSCSIWORKERR3;
 /** Pointer to a VirtIO SCSI worker. */
 typedef VIRTIOSCSIWORKERR3 *PVIRTIOSCSIWORKERR3;
@@ -425,17 +432,20 @@ typedef struct VIRTIOSCSI
     /** Number of targets in paTargetInstances. */
     uint32_t                        cTargets;
 
+    /** Number of virtqs in use (controlq + eventq + NumQueues request queues). */
+    uint32_t                        cVirtqs;
+
     /** Per device-bound virtq worker-thread contexts (eventq slot unused) */
-    VIRTIOSCSIWORKER                aWorkers[VIRTIOSCSI_VIRTQ_CNT];
+    VIRTIOSCSIWORKER                aWorkers[VIRTIOSCSI_MAX_VIRTQ_CNT];
 
     /** Instance name */
     char                            szInstance[16];
 
     /** Device-specific spec-based VirtIO VIRTQNAMEs */
-    char                            aszVirtqNames[VIRTIOSCSI_VIRTQ_CNT][VIRTIO_MAX_VIRTQ_NAME_SIZE];
+    char                            aszVirtqNames[VIRTIOSCSI_MAX_VIRTQ_CNT][VIRTIO_MAX_VIRTQ_NAME_SIZE];
 
     /** Track which VirtIO queues we've attached to */
-    bool                            afVirtqAttached[VIRTIOSCSI_VIRTQ_CNT];
+    bool                            afVirtqAttached[VIRTIOSCSI_MAX_VIRTQ_CNT];
 
     /** Set if events missed due to lack of bufs avail on eventq */
     bool                            fEventsMissed;
@@ -471,6 +481,7 @@ typedef struct VIRTIOSCSI
 } VIRTIOSCSI;
 /** Pointer to the shared state of the VirtIO Host SCSI device. */
 typedef VIRTIOSCSI *PVIRTIOSCSI;
+AssertCompile(VIRTIOSCSI_MAX_VIRTQ_CNT <= VIRTQ_MAX_COUNT);
 
 
 /**
@@ -487,7 +498,7 @@ typedef struct VIRTIOSCSIR3
     R3PTRTYPE(PVIRTIOSCSITARGET)    paTargetInstances;
 
     /** Per device-bound virtq worker-thread contexts (eventq slot unused) */
-    VIRTIOSCSIWORKERR3              aWorkers[VIRTIOSCSI_VIRTQ_CNT];
+    VIRTIOSCSIWORKERR3              aWorkers[VIRTIOSCSI_MAX_VIRTQ_CNT];
 
     /** Device base interface. */
     PDMIBASE                        IBase;
@@ -581,7 +592,7 @@ static DECLCALLBACK(void) virtioScsiNotified(PPDMDEVINS pDevIns, PVIRTIOCORE pVi
     RT_NOREF(pVirtio);
     PVIRTIOSCSI pThis   = PDMDEVINS_2_DATA(pDevIns, PVIRTIOSCSI);
 
-    AssertReturnVoid(uVirtqNbr < VIRTIOSCSI_VIRTQ_CNT);
+    AssertReturnVoid(uVirtqNbr < pThis->cVirtqs);
     PVIRTIOSCSIWORKER pWorker = &pThis->aWorkers[uVirtqNbr];
 
 #if defined (IN_RING3) && defined (LOG_ENABLED)
@@ -620,7 +631,7 @@ DECLINLINE(void) virtioScsiSetVirtqNames(PVIRTIOSCSI pThis)
 {
     RTStrCopy(pThis->aszVirtqNames[CONTROLQ_IDX], VIRTIO_MAX_VIRTQ_NAME_SIZE, "controlq");
     RTStrCopy(pThis->aszVirtqNames[EVENTQ_IDX],   VIRTIO_MAX_VIRTQ_NAME_SIZE, "eventq");
-    for (uint16_t uVirtqNbr = VIRTQ_REQ_BASE; uVirtqNbr < VIRTQ_REQ_BASE + VIRTIOSCSI_REQ_VIRTQ_CNT; uVirtqNbr++)
+    for (uint16_t uVirtqNbr = VIRTQ_REQ_BASE; uVirtqNbr < VIRTQ_REQ_BASE + VIRTIOSCSI_MAX_REQ_VIRTQ_CNT; uVirtqNbr++)
         RTStrPrintf(pThis->aszVirtqNames[uVirtqNbr], VIRTIO_MAX_VIRTQ_NAME_SIZE,
                     "requestq<%d>", uVirtqNbr - VIRTQ_REQ_BASE);
 }
@@ -804,6 +815,30 @@ static void virtioScsiR3FreeReq(PVIRTIOSCSITARGET pTarget, PVIRTIOSCSIREQ pReq)
     pTarget->pDrvMediaEx->pfnIoReqFree(pTarget->pDrvMediaEx, pReq->hIoReq);
 }
 
+/**
+ * Makes the used buffers of a queue visible to the guest.
+ *
+ * While a worker drains a batch of requests, completions on the worker thread
+ * itself only flag the sync as pending and the worker does a single sync (and
+ * guest notification) once the batch is done.  Completions on any other thread
+ * sync right away, which also publishes whatever the worker had put so far.
+ *
+ * @param   pDevIns     The device instance.
+ * @param   pThis       VirtIO SCSI shared instance data.
+ * @param   pThisCC     VirtIO SCSI ring-3 instance data.
+ * @param   uVirtqNbr   Virtq index
+ */
+static void virtioScsiR3VirtqUsedRingSync(PPDMDEVINS pDevIns, PVIRTIOSCSI pThis, PVIRTIOSCSICC pThisCC, uint16_t uVirtqNbr)
+{
+    PVIRTIOSCSIWORKERR3 pWorkerR3 = &pThisCC->aWorkers[uVirtqNbr];
+    if (   pWorkerR3->fBatching
+        && pWorkerR3->pThread
+        && pWorkerR3->pThread->Thread == RTThreadSelf())
+        pWorkerR3->fSyncPending = true;
+    else
+        virtioCoreVirtqUsedRingSync(pDevIns, &pThis->Virtio, uVirtqNbr);
+}
+
 /**
  * This is called to complete a request immediately
  *
@@ -853,7 +888,7 @@ static int virtioScsiR3ReqErr(PPDMDEVINS pDevIns, PVIRTIOSCSI pThis, PVIRTIOSCSI
         pRespHdr->uResponse = VIRTIOSCSI_S_RESET;
 
     virtioCoreR3VirtqUsedBufPut(pDevIns, &pThis->Virtio, uVirtqNbr, &ReqSgBuf, pVirtqBuf, true /* fFence */);
-    virtioCoreVirtqUsedRingSync(pDevIns, &pThis->Virtio, uVirtqNbr);
+    virtioScsiR3VirtqUsedRingSync(pDevIns, pThis, pThisCC, uVirtqNbr);
 
     if (!ASMAtomicDecU32(&pThis->cActiveReqs) && pThisCC->fQuiescing)
         PDMDevHlpAsyncNotificationCompleted(pDevIns);
@@ -1042,7 +1077,7 @@ static DECLCALLBACK(int) virtioScsiR3IoReqFinish(PPDMIMEDIAEXPORT pInterface, PD
                         VERR_BUFFER_OVERFLOW);
 
         virtioCoreR3VirtqUsedBufPut(pDevIns, &pThis->Virtio, pReq->uVirtqNbr, &ReqSgBuf, pReq->pVirtqBuf, true /* fFence TBD */);
-        virtioCoreVirtqUsedRingSync(pDevIns, &pThis->Virtio, pReq->uVirtqNbr);
+        virtioScsiR3VirtqUsedRingSync(pDevIns, pThis, pThisCC, pReq->uVirtqNbr);
 
         Log2(("-----------------------------------------------------------------------------------------\n"));
     }
@@ -1526,7 +1561,7 @@ static int virtioScsiR3Ctrl(PPDMDEVINS pDevIns, PVIRTIOSCSI pThis, PVIRTIOSCSICC
     RTSgBufInit(&ReqSgBuf, aReqSegs, cSegs);
 
     virtioCoreR3VirtqUsedBufPut(pDevIns, &pThis->Virtio, uVirtqNbr, &ReqSgBuf, pVirtqBuf, true /*fFence*/);
-    virtioCoreVirtqUsedRingSync(pDevIns, &pThis->Virtio, uVirtqNbr);
+    virtioScsiR3VirtqUsedRingSync(pDevIns, pThis, pThisCC, uVirtqNbr);
 
     return VINF_SUCCESS;
 }
@@ -1552,7 +1587,19 @@ static DECLCALLBACK(int) virtioScsiR3WorkerThread(PPDMDEVINS pDevIns, PPDMTHREAD
     PVIRTIOSCSIWORKERR3 pWorkerR3 = &pThisCC->aWorkers[uVirtqNbr];
 
     if (pThread->enmState == PDMTHREADSTATE_INITIALIZING)
+    {
+        /* Affinity can only be changed by the thread itself. */
+        if (pWorkerR3->idCpu != NIL_RTCPUID)
+        {
+            int rc = RTThreadSetAffinityToCpu(pWorkerR3->idCpu);
+            if (RT_SUCCESS(rc))
+                LogRel(("%s: %s worker pinned to host CPU %#x\n", pThis->szInstance, VIRTQNAME(uVirtqNbr), pWorkerR3->idCpu));
+            else
+                LogRel(("%s: Failed to pin %s worker to host CPU %#x: %Rrc\n",
+                        pThis->szInstance, VIRTQNAME(uVirtqNbr), pWorkerR3->idCpu, rc));
+        }
         return VINF_SUCCESS;
+    }
 
     while (pThread->enmState == PDMTHREADSTATE_RUNNING)
     {
@@ -1584,43 +1631,67 @@ static DECLCALLBACK(int) virtioScsiR3WorkerThread(PPDMDEVINS pDevIns, PPDMTHREAD
         }
         if (!pThisCC->fQuiescing)
         {
-             /* Process any reqs that were suspended saved to the redo queue in save exec. */
-             for (int i = 0; i < pWorkerR3->cRedoDescs; i++)
-             {
-                  PVIRTQBUF pVirtqBuf;
-                  int rc = virtioCoreR3VirtqAvailBufGet(pDevIns, &pThis->Virtio, uVirtqNbr,
-                                                        pWorkerR3->auRedoDescs[i], &pVirtqBuf);
-                  if (RT_FAILURE(rc))
-                      LogRel(("Error fetching desc chain to redo, %Rrc", rc));
+            /*
+             * Drain a batch of buffers, deferring the used ring sync and guest notification
+             * of requests completing on this thread to the end of the batch.  The batch counts
+             * as an active request so quiescing waits for the deferred sync.
+             */
+            ASMAtomicIncU32(&pThis->cActiveReqs);
+            pWorkerR3->fBatching = true;
 
-                  rc = virtioScsiR3ReqSubmit(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf);
-                  if (RT_FAILURE(rc))
-                      LogRel(("Error submitting req packet, resetting %Rrc", rc));
+            /* Process any reqs that were suspended saved to the redo queue in save exec. */
+            for (int i = 0; i < pWorkerR3->cRedoDescs; i++)
+            {
+                PVIRTQBUF pVirtqBuf;
+                int rc = virtioCoreR3VirtqAvailBufGet(pDevIns, &pThis->Virtio, uVirtqNbr,
+                                                      pWorkerR3->auRedoDescs[i], &pVirtqBuf);
+                if (RT_FAILURE(rc))
+                {
+                    LogRel(("Error fetching desc chain to redo, %Rrc", rc));
+                    continue;
+                }
 
-                  virtioCoreR3VirtqBufRelease(&pThis->Virtio, pVirtqBuf);
-             }
-             pWorkerR3->cRedoDescs = 0;
+                rc = virtioScsiR3ReqSubmit(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf);
+                if (RT_FAILURE(rc))
+                    LogRel(("Error submitting req packet, resetting %Rrc", rc));
 
-             Log6Func(("fetching next descriptor chain from %s\n", VIRTQNAME(uVirtqNbr)));
-             PVIRTQBUF pVirtqBuf = NULL;
-             int rc = virtioCoreR3VirtqAvailBufGet(pDevIns, &pThis->Virtio, uVirtqNbr, &pVirtqBuf, true);
-             if (rc == VERR_NOT_AVAILABLE)
-             {
-                 Log6Func(("Nothing found in %s\n", VIRTQNAME(uVirtqNbr)));
-                 continue;
-             }
+                virtioCoreR3VirtqBufRelease(&pThis->Virtio, pVirtqBuf);
+            }
+            pWorkerR3->cRedoDescs = 0;
 
-             AssertRC(rc);
-             if (uVirtqNbr == CONTROLQ_IDX)
-                 virtioScsiR3Ctrl(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf);
-             else /* request queue index */
-             {
-                 rc = virtioScsiR3ReqSubmit(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf);
-                 if (RT_FAILURE(rc))
-                     LogRel(("Error submitting req packet, resetting %Rrc", rc));
-             }
+            for (uint32_t cBufs = 0; cBufs < VIRTIOSCSI_REQ_BATCH_MAX && !pThisCC->fQuiescing; cBufs++)
+            {
+                Log6Func(("fetching next descriptor chain from %s\n", VIRTQNAME(uVirtqNbr)));
+                PVIRTQBUF pVirtqBuf = NULL;
+                int rc = virtioCoreR3VirtqAvailBufGet(pDevIns, &pThis->Virtio, uVirtqNbr, &pVirtqBuf, true);
+                if (rc == VERR_NOT_AVAILABLE)
+                {
+                    Log6Func(("Nothing found in %s\n", VIRTQNAME(uVirtqNbr)));
+                    break;
+                }
+                AssertRCBreak(rc);
+
+                if (uVirtqNbr == CONTROLQ_IDX)
+                    virtioScsiR3Ctrl(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf);
+                else /* request queue index */
+                {
+                    rc = virtioScsiR3ReqSubmit(pDevIns, pThis, pThisCC, uVirtqNbr, pVirtqBuf);
+                    if (RT_FAILURE(rc))
+                        LogRel(("Error submitting req packet, resetting %Rrc", rc));
+                }
+
+                virtioCoreR3VirtqBufRelease(&pThis->Virtio, pVirtqBuf);
+            }
+
+            pWorkerR3->fBatching = false;
+            if (pWorkerR3->fSyncPending)
+            {
+                pWorkerR3->fSyncPending = false;
+                virtioCoreVirtqUsedRingSync(pDevIns, &pThis->Virtio, uVirtqNbr);
+            }
 
-             virtioCoreR3VirtqBufRelease(&pThis->Virtio, pVirtqBuf);
+            if (!ASMAtomicDecU32(&pThis->cActiveReqs) && pThisCC->fQuiescing)
+                PDMDevHlpAsyncNotificationCompleted(pDevIns);
         }
     }
     return VINF_SUCCESS;
@@ -1701,13 +1772,13 @@ static DECLCALLBACK(void) virtioScsiR3StatusChanged(PVIRTIOCORE pVirtio, PVIRTIO
         pThis->fResetting    = false;
         pThisCC->fQuiescing  = false;
 
-        for (unsigned i = 0; i < VIRTIOSCSI_VIRTQ_CNT; i++)
+        for (unsigned i = 0; i < pThis->cVirtqs; i++)
             pThis->afVirtqAttached[i] = true;
     }
     else
     {
         LogFunc(("VirtIO is resetting\n"));
-        for (unsigned i = 0; i < VIRTIOSCSI_VIRTQ_CNT; i++)
+        for (unsigned i = 0; i < pThis->cVirtqs; i++)
             pThis->afVirtqAttached[i] = false;
     }
 }
@@ -1911,10 +1982,16 @@ static DECLCALLBACK(int) virtioScsiR3LoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSS
                           ("uVersion=%u\n", uVersion), VERR_SSM_UNSUPPORTED_DATA_UNIT_VERSION);
 
     virtioScsiSetVirtqNames(pThis);
-    for (int uVirtqNbr = 0; uVirtqNbr < VIRTIOSCSI_VIRTQ_CNT; uVirtqNbr++)
+    for (uint32_t uVirtqNbr = 0; uVirtqNbr < pThis->cVirtqs; uVirtqNbr++)
         pHlp->pfnSSMGetBool(pSSM, &pThis->afVirtqAttached[uVirtqNbr]);
 
-    pHlp->pfnSSMGetU32(pSSM,  &pThis->virtioScsiConfig.uNumVirtqs);
+    uint32_t cReqVirtqs;
+    int rc = pHlp->pfnSSMGetU32(pSSM, &cReqVirtqs);
+    AssertRCReturn(rc, rc);
+    AssertReturn(cReqVirtqs == pThis->virtioScsiConfig.uNumVirtqs,
+                 pHlp->pfnSSMSetLoadError(pSSM, VERR_SSM_LOAD_CONFIG_MISMATCH, RT_SRC_POS,
+                                          N_("request queue count has changed: %u saved, %u configured now"),
+                                          cReqVirtqs, pThis->virtioScsiConfig.uNumVirtqs));
     pHlp->pfnSSMGetU32(pSSM,  &pThis->virtioScsiConfig.uSegMax);
     pHlp->pfnSSMGetU32(pSSM,  &pThis->virtioScsiConfig.uMaxSectors);
     pHlp->pfnSSMGetU32(pSSM,  &pThis->virtioScsiConfig.uCmdPerLun);
@@ -1934,7 +2011,7 @@ static DECLCALLBACK(int) virtioScsiR3LoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSS
     pHlp->pfnSSMGetU32(pSSM,  &pThis->fResetting);
 
     uint32_t cTargets;
-    int rc = pHlp->pfnSSMGetU32(pSSM, &cTargets);
+    rc = pHlp->pfnSSMGetU32(pSSM, &cTargets);
     AssertRCReturn(rc, rc);
     AssertReturn(cTargets == pThis->cTargets,
                  pHlp->pfnSSMSetLoadError(pSSM, VERR_SSM_LOAD_CONFIG_MISMATCH, RT_SRC_POS,
@@ -1951,7 +2028,7 @@ static DECLCALLBACK(int) virtioScsiR3LoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSS
                                               N_("Bad count of I/O transactions to re-do in saved state (%#x, max %#x - 1)"),
                                               cReqsRedo, VIRTQ_MAX_ENTRIES));
 
-        for (uint16_t uVirtqNbr = VIRTQ_REQ_BASE; uVirtqNbr < VIRTIOSCSI_VIRTQ_CNT; uVirtqNbr++)
+        for (uint16_t uVirtqNbr = VIRTQ_REQ_BASE; uVirtqNbr < pThis->cVirtqs; uVirtqNbr++)
         {
             PVIRTIOSCSIWORKERR3 pWorkerR3 = &pThisCC->aWorkers[uVirtqNbr];
             pWorkerR3->cRedoDescs = 0;
@@ -1962,10 +2039,10 @@ static DECLCALLBACK(int) virtioScsiR3LoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSS
             uint16_t uVirtqNbr;
             rc = pHlp->pfnSSMGetU16(pSSM, &uVirtqNbr);
             AssertRCReturn(rc, rc);
-            AssertReturn(uVirtqNbr < VIRTIOSCSI_VIRTQ_CNT,
+            AssertReturn(uVirtqNbr < pThis->cVirtqs,
                          pHlp->pfnSSMSetLoadError(pSSM, VERR_SSM_DATA_UNIT_FORMAT_CHANGED, RT_SRC_POS,
                                                   N_("Bad queue index for re-do in saved state (%#x, max %#x)"),
-                                                  uVirtqNbr, VIRTIOSCSI_VIRTQ_CNT - 1));
+                                                  uVirtqNbr, pThis->cVirtqs - 1));
 
             uint16_t idxHead;
             rc = pHlp->pfnSSMGetU16(pSSM, &idxHead);
@@ -1989,7 +2066,7 @@ static DECLCALLBACK(int) virtioScsiR3LoadExec(PPDMDEVINS pDevIns, PSSMHANDLE pSS
     /*
      * Nudge request queue workers
      */
-    for (int uVirtqNbr = VIRTQ_REQ_BASE; uVirtqNbr < VIRTIOSCSI_VIRTQ_CNT; uVirtqNbr++)
+    for (uint32_t uVirtqNbr = VIRTQ_REQ_BASE; uVirtqNbr < pThis->cVirtqs; uVirtqNbr++)
     {
         if (pThis->afVirtqAttached[uVirtqNbr])
         {
@@ -2013,7 +2090,7 @@ static DECLCALLBACK(int) virtioScsiR3SaveExec(PPDMDEVINS pDevIns, PSSMHANDLE pSS
 
     LogFunc(("SAVE EXEC!!\n"));
 
-    for (int uVirtqNbr = 0; uVirtqNbr < VIRTIOSCSI_VIRTQ_CNT; uVirtqNbr++)
+    for (uint32_t uVirtqNbr = 0; uVirtqNbr < pThis->cVirtqs; uVirtqNbr++)
         pHlp->pfnSSMPutBool(pSSM, pThis->afVirtqAttached[uVirtqNbr]);
 
     pHlp->pfnSSMPutU32(pSSM,  pThis->virtioScsiConfig.uNumVirtqs);
@@ -2279,7 +2356,7 @@ static DECLCALLBACK(void) virtioScsiR3Resume(PPDMDEVINS pDevIns)
      * to ensure they re-check their queues. Active request queues may already
      * be awake due to new reqs coming in.
      */
-    for (uint16_t uVirtqNbr = 0; uVirtqNbr < VIRTIOSCSI_REQ_VIRTQ_CNT; uVirtqNbr++)
+    for (uint16_t uVirtqNbr = 0; uVirtqNbr < pThis->cVirtqs; uVirtqNbr++)
     {
         if (ASMAtomicReadBool(&pThis->aWorkers[uVirtqNbr].fSleeping))
         {
@@ -2358,7 +2435,7 @@ static DECLCALLBACK(int) virtioScsiR3Destruct(PPDMDEVINS pDevIns)
     pThisCC->paTargetInstances = NULL;
     pThisCC->pMediaNotify = NULL;
 
-    for (unsigned uVirtqNbr = 0; uVirtqNbr < VIRTIOSCSI_VIRTQ_CNT; uVirtqNbr++)
+    for (unsigned uVirtqNbr = 0; uVirtqNbr < VIRTIOSCSI_MAX_VIRTQ_CNT; uVirtqNbr++)
     {
         PVIRTIOSCSIWORKER pWorker = &pThis->aWorkers[uVirtqNbr];
         if (pWorker->hEvtProcess != NIL_SUPSEMEVENT)
@@ -2397,6 +2474,8 @@ static DECLCALLBACK(int) virtioScsiR3Construct(PPDMDEVINS pDevIns, int iInstance
      * Quick initialization of the state data, making sure that the destructor always works.
      */
     pThisCC->pDevIns = pDevIns;
+    for (unsigned uVirtqNbr = 0; uVirtqNbr < VIRTIOSCSI_MAX_VIRTQ_CNT; uVirtqNbr++)
+        pThisCC->aWorkers[uVirtqNbr].idCpu = NIL_RTCPUID;
 
     LogFunc(("PDM device instance: %d\n", iInstance));
     RTStrPrintf(pThis->szInstance, sizeof(pThis->szInstance), "VIRTIOSCSI%d", iInstance);
@@ -2407,7 +2486,7 @@ static DECLCALLBACK(int) virtioScsiR3Construct(PPDMDEVINS pDevIns, int iInstance
     /*
      * Validate and read configuration.
      */
-    PDMDEV_VALIDATE_CONFIG_RETURN(pDevIns, "NumTargets|Bootable", "");
+    PDMDEV_VALIDATE_CONFIG_RETURN(pDevIns, "NumTargets|Bootable|NumQueues|WorkerCpuMask", "");
 
     int rc = pHlp->pfnCFGMQueryU32Def(pCfg, "NumTargets", &pThis->cTargets, 1);
     if (RT_FAILURE(rc))
@@ -2421,8 +2500,50 @@ static DECLCALLBACK(int) virtioScsiR3Construct(PPDMDEVINS pDevIns, int iInstance
     if (RT_FAILURE(rc))
          return PDMDEV_SET_ERROR(pDevIns, rc, N_("virtio-scsi configuration error: failed to read Bootable as boolean"));
 
-    LogRel(("%s: Targets=%u Bootable=%RTbool (unimplemented) R0Enabled=%RTbool RCEnabled=%RTbool\n",
-            pThis->szInstance, pThis->cTargets, pThis->fBootable, pDevIns->fR0Enabled, pDevIns->fRCEnabled));
+    uint32_t cReqVirtqs;
+    rc = pHlp->pfnCFGMQueryU32Def(pCfg, "NumQueues", &cReqVirtqs, VIRTIOSCSI_REQ_VIRTQ_CNT_DEFAULT);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("virtio-scsi configuration error: failed to read NumQueues as integer"));
+    if (cReqVirtqs < 1 || cReqVirtqs > VIRTIOSCSI_MAX_REQ_VIRTQ_CNT)
+        return PDMDevHlpVMSetError(pDevIns, VERR_OUT_OF_RANGE, RT_SRC_POS,
+                                   N_("virtio-scsi configuration error: NumQueues=%u is out of range (1..%u)"),
+                                   cReqVirtqs, VIRTIOSCSI_MAX_REQ_VIRTQ_CNT);
+    pThis->cVirtqs = cReqVirtqs + VIRTQ_REQ_BASE;
+
+    /*
+     * Host CPUs to pin the request queue workers to, one bit per CPU set index.
+     * Request queue N goes to the Nth CPU in the mask (wrapping around), so guests
+     * mapping their queues to vCPUs get a stable I/O thread per vCPU.  Zero (the
+     * default) leaves the workers to the host scheduler.
+     */
+    uint64_t fWorkerCpuMask;
+    rc = pHlp->pfnCFGMQueryU64Def(pCfg, "WorkerCpuMask", &fWorkerCpuMask, 0);
+    if (RT_FAILURE(rc))
+        return PDMDEV_SET_ERROR(pDevIns, rc, N_("virtio-scsi configuration error: failed to read WorkerCpuMask as integer"));
+    if (fWorkerCpuMask)
+    {
+        RTCPUSET WorkerCpuSet, OnlineCpuSet;
+        RTCpuSetFromU64(&WorkerCpuSet, fWorkerCpuMask);
+        RTCpuSetAnd(&WorkerCpuSet, RTMpGetOnlineSet(&OnlineCpuSet));
+        int const cWorkerCpus = RTCpuSetCount(&WorkerCpuSet);
+        if (!cWorkerCpus)
+            return PDMDevHlpVMSetError(pDevIns, VERR_INVALID_PARAMETER, RT_SRC_POS,
+                                       N_("virtio-scsi configuration error: WorkerCpuMask=%#RX64 contains no online host CPU"),
+                                       fWorkerCpuMask);
+
+        int iCpuSet = -1;
+        for (uint32_t uReqVirtq = 0; uReqVirtq < cReqVirtqs; uReqVirtq++)
+        {
+            do
+                iCpuSet = (iCpuSet + 1) % 64;
+            while (!RTCpuSetIsMemberByIndex(&WorkerCpuSet, iCpuSet));
+            pThisCC->aWorkers[VIRTQ_REQ_BASE + uReqVirtq].idCpu = RTMpCpuIdFromSetIndex(iCpuSet);
+        }
+    }
+
+    LogRel(("%s: Targets=%u Bootable=%RTbool (unimplemented) NumQueues=%u WorkerCpuMask=%#RX64 R0Enabled=%RTbool RCEnabled=%RTbool\n",
+            pThis->szInstance, pThis->cTargets, pThis->fBootable, cReqVirtqs, fWorkerCpuMask,
+            pDevIns->fR0Enabled, pDevIns->fRCEnabled));
 
 
     /*
@@ -2430,7 +2551,7 @@ static DECLCALLBACK(int) virtioScsiR3Construct(PPDMDEVINS pDevIns, int iInstance
      */
 
     /* Configure virtio_scsi_config that transacts via VirtIO implementation's Dev. Specific Cap callbacks */
-    pThis->virtioScsiConfig.uNumVirtqs      = VIRTIOSCSI_REQ_VIRTQ_CNT;
+    pThis->virtioScsiConfig.uNumVirtqs      = pThis->cVirtqs - VIRTQ_REQ_BASE;
     pThis->virtioScsiConfig.uSegMax         = VIRTIOSCSI_MAX_SEG_COUNT;
     pThis->virtioScsiConfig.uMaxSectors     = VIRTIOSCSI_MAX_SECTORS_HINT;
     pThis->virtioScsiConfig.uCmdPerLun      = VIRTIOSCSI_MAX_COMMANDS_PER_LUN;
@@ -2469,7 +2590,7 @@ static DECLCALLBACK(int) virtioScsiR3Construct(PPDMDEVINS pDevIns, int iInstance
     virtioScsiSetVirtqNames(pThis);
 
     /* Attach the queues and create worker threads for them: */
-    for (uint16_t uVirtqNbr = 0; uVirtqNbr < VIRTIOSCSI_VIRTQ_CNT; uVirtqNbr++)
+    for (uint16_t uVirtqNbr = 0; uVirtqNbr < pThis->cVirtqs; uVirtqNbr++)
     {
         rc = virtioCoreR3VirtqAttach(&pThis->Virtio, uVirtqNbr, VIRTQNAME(uVirtqNbr));
         if (RT_FAILURE(rc))
@@ -324,6 +324,12 @@ typedef struct VBOXDISK
     VDINTERFACEIO            VDIfIoCache;
     /** Interface list for the cache image. */
     PVDINTERFACE             pVDIfsCache;
+    /** Flag whether a cache image is attached and its statistics are registered. */
+    bool                     fCacheAttached;
+    /** Statistics of the cache image, updated by the VD layer. */
+    VDCACHESTATS             CacheStats;
+    /** Statistics of the allocation index of the image chain, updated by the VD layer. */
+    VDALLOCINDEXSTATS        AllocIdxStats;
 
     /** The block cache handle if configured. */
     PPDMBLKCACHE             pBlkCache;
@@ -392,6 +398,8 @@ typedef struct VBOXDISK
     RTMEMCACHE               hIoReqCache;
     /** I/O buffer manager. */
     IOBUFMGR                 hIoBufMgr;
+    /** Statistics of the I/O buffer manager, updated by the manager. */
+    IOBUFMGRSTATS            IoBufStats;
     /** Active request counter. */
     volatile uint32_t        cIoReqsActive;
     /** Bins for allocated requests. */
@@ -4112,6 +4120,62 @@ static int drvvdStatsRegister(PVBOXDISK pThis)
     PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->StatReqsPerSec,         STAMTYPE_COUNTER, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
                            "Number of processed I/O requests per second.",  "%s/ReqsPerSec", szPrefix);
 
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->AllocIdxStats.cLookups,       STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of reads looked up in the allocation index.",           "%s/AllocIndex/Lookups", szPrefix);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->AllocIdxStats.cHits,          STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of reads which found the owning image in the index.",  "%s/AllocIndex/Hits", szPrefix);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->AllocIdxStats.cImagesRead,    STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of images queried by reads (chain walk depth with the index).",
+                           "%s/AllocIndex/ImagesRead", szPrefix);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->AllocIdxStats.cImagesSkipped, STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of images skipped by reads because of the index.",     "%s/AllocIndex/ImagesSkipped", szPrefix);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->AllocIdxStats.cInvalidations, STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of writes which invalidated index ranges.",            "%s/AllocIndex/Invalidations", szPrefix);
+    PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->AllocIdxStats.cResets,        STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                           "Number of times the index was dropped.",                      "%s/AllocIndex/Resets", szPrefix);
+
+    if (pThis->hIoBufMgr != NIL_IOBUFMGR)
+    {
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->IoBufStats.cAllocs,         STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of I/O buffer allocations.",                            "%s/IoBuf/Allocs", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->IoBufStats.cAllocFailures,  STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of I/O buffer allocations failed for lack of memory.", "%s/IoBuf/AllocFailures", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->IoBufStats.cAllocsPartial,  STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of I/O buffer allocations smaller than requested.",    "%s/IoBuf/AllocsPartial", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->IoBufStats.cAllocsStolen,   STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of I/O buffer allocations served by a foreign arena.", "%s/IoBuf/AllocsStolen", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->IoBufStats.cAllocSuspends,  STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of times an arena waited for defragmentation.",        "%s/IoBuf/AllocSuspends", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->IoBufStats.cbFree,          STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                               "Amount of free I/O buffer memory.",                            "%s/IoBuf/BytesFree", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->IoBufStats.cbLargestFree,   STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                               "Size of the largest free I/O buffer block.",                   "%s/IoBuf/BytesLargestFree", szPrefix);
+    }
+
+    if (pThis->fCacheAttached)
+    {
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cReadHits,      STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of reads satisfied from the cache image.",          "%s/Cache/ReadHits", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cbReadHits,     STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                               "Amount of data read from the cache image.",                "%s/Cache/BytesReadHits", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cReadMisses,    STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of reads not in the cache image.",                  "%s/Cache/ReadMisses", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cbReadMisses,   STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                               "Amount of data not in the cache image.",                   "%s/Cache/BytesReadMisses", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cFills,         STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of misses written to the cache image.",             "%s/Cache/Fills", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cbFills,        STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                               "Amount of data written to the cache image after misses.",  "%s/Cache/BytesFilled", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cFillsRejected, STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of misses not admitted to the cache image.",        "%s/Cache/FillsRejected", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cWriteUpdates,  STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of writes written through to the cache image.",     "%s/Cache/WriteUpdates", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cbWriteUpdates, STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_BYTES,
+                               "Amount of data written through to the cache image.",       "%s/Cache/BytesWriteUpdates", szPrefix);
+        PDMDrvHlpSTAMRegisterF(pDrvIns, &pThis->CacheStats.cInvalidations, STAMTYPE_U64, STAMVISIBILITY_USED, STAMUNIT_OCCURENCES,
+                               "Number of ranges dropped from the cache image.",           "%s/Cache/Invalidations", szPrefix);
+    }
+
     return VINF_SUCCESS;
 }
 
@@ -4138,6 +4202,38 @@ static void drvvdStatsDeregister(PVBOXDISK pThis)
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReqsRead);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReqsDiscard);
     PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->StatReqsPerSec);
+
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->AllocIdxStats.cLookups);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->AllocIdxStats.cHits);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->AllocIdxStats.cImagesRead);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->AllocIdxStats.cImagesSkipped);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->AllocIdxStats.cInvalidations);
+    PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->AllocIdxStats.cResets);
+
+    if (pThis->hIoBufMgr != NIL_IOBUFMGR)
+    {
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->IoBufStats.cAllocs);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->IoBufStats.cAllocFailures);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->IoBufStats.cAllocsPartial);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->IoBufStats.cAllocsStolen);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->IoBufStats.cAllocSuspends);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->IoBufStats.cbFree);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->IoBufStats.cbLargestFree);
+    }
+
+    if (pThis->fCacheAttached)
+    {
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cReadHits);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cbReadHits);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cReadMisses);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cbReadMisses);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cFills);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cbFills);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cFillsRejected);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cWriteUpdates);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cbWriteUpdates);
+        PDMDrvHlpSTAMDeregister(pDrvIns, &pThis->CacheStats.cInvalidations);
+    }
 }
 
 
@@ -4485,6 +4581,10 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
     char *pszFormat = NULL;      /* The format backed to use for this image. */
     char *pszCachePath = NULL;   /* The path to the cache image. */
     char *pszCacheFormat = NULL; /* The format backend to use for the cache image. */
+    char *pszCacheMode = NULL;   /* How writes are handled by the cache image. */
+    uint64_t cbCacheSize = 0;    /* Size of the cache image to create if it doesn't exist. */
+    uint64_t cbCacheAdmitMax = 0; /* Maximum request size admitted to the cache. */
+    uint32_t cCacheAdmitMinMisses = 0; /* Number of misses before data is admitted to the cache. */
     bool fReadOnly = false;      /* True if the media is read-only. */
     bool fMaybeReadOnly = false; /* True if the media may or may not be read-only. */
     bool fHonorZeroWrites = false; /* True if zero blocks should be written. */
@@ -4630,9 +4730,12 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
     bool        fInformAboutZeroBlocks = false;
     bool        fSkipConsistencyChecks = false;
     bool        fEmptyDrive            = false;
+    uint32_t    cAllocIndexRangesMax   = 0;
     unsigned    iLevel = 0;
     PCFGMNODE   pCurNode = pCfg;
     uint32_t    cbIoBufMax = 0;
+    uint32_t    cIoBufArenas = 0;
+    bool        fIoBufLargePages = false;
 
     for (;;)
     {
@@ -4647,10 +4750,11 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                           "ReadOnly\0MaybeReadOnly\0TempReadOnly\0Shareable\0HonorZeroWrites\0"
                                           "HostIPStack\0UseNewIo\0BootAcceleration\0BootAccelerationBuffer\0"
                                           "SetupMerge\0MergeSource\0MergeTarget\0BwGroup\0Type\0BlockCache\0"
-                                          "CachePath\0CacheFormat\0Discard\0InformAboutZeroBlocks\0"
-                                          "SkipConsistencyChecks\0"
+                                          "CachePath\0CacheFormat\0CacheSize\0CacheMode\0CacheAdmitMaxIoSize\0"
+                                          "CacheAdmitMinMisses\0Discard\0InformAboutZeroBlocks\0"
+                                          "SkipConsistencyChecks\0AllocIndexMaxRanges\0"
                                           "Locked\0BIOSVisible\0Cylinders\0Heads\0Sectors\0Mountable\0"
-                                          "EmptyDrive\0IoBufMax\0NonRotationalMedium\0"
+                                          "EmptyDrive\0IoBufMax\0IoBufArenas\0IoBufLargePages\0NonRotationalMedium\0"
 #if defined(VBOX_PERIODIC_FLUSH) || defined(VBOX_IGNORE_FLUSH)
                                           "FlushInterval\0IgnoreFlush\0IgnoreFlushAsync\0"
 #endif /* !(VBOX_PERIODIC_FLUSH || VBOX_IGNORE_FLUSH) */
@@ -4796,6 +4900,13 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                       N_("DrvVD: Configuration error: Querying \"InformAboutZeroBlocks\" as boolean failed"));
                 break;
             }
+            rc = CFGMR3QueryU32Def(pCurNode, "AllocIndexMaxRanges", &cAllocIndexRangesMax, _16K);
+            if (RT_FAILURE(rc))
+            {
+                rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                      N_("DrvVD: Configuration error: Querying \"AllocIndexMaxRanges\" as integer failed"));
+                break;
+            }
             rc = CFGMR3QueryBoolDef(pCurNode, "SkipConsistencyChecks", &fSkipConsistencyChecks, true);
             if (RT_FAILURE(rc))
             {
@@ -4837,6 +4948,48 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                                           N_("DrvVD: Configuration error: Querying \"CacheFormat\" as string failed"));
                     break;
                 }
+
+                rc = CFGMR3QueryU64Def(pCurNode, "CacheSize", &cbCacheSize, 0);
+                if (RT_FAILURE(rc))
+                {
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                          N_("DrvVD: Configuration error: Querying \"CacheSize\" as integer failed"));
+                    break;
+                }
+
+                rc = CFGMR3QueryStringAllocDef(pCurNode, "CacheMode", &pszCacheMode, "WriteAround");
+                if (RT_FAILURE(rc))
+                {
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                          N_("DrvVD: Configuration error: Querying \"CacheMode\" as string failed"));
+                    break;
+                }
+
+                if (   RTStrICmp(pszCacheMode, "WriteAround")
+                    && RTStrICmp(pszCacheMode, "WriteThrough"))
+                {
+                    /* Write back would lose guest data together with the cache device, there is no dirty tracking. */
+                    rc = PDMDrvHlpVMSetError(pDrvIns, VERR_PDM_DRIVER_INVALID_PROPERTIES, RT_SRC_POS,
+                                             N_("DrvVD: Configuration error: \"CacheMode\" must be \"WriteAround\" or \"WriteThrough\", not \"%s\""),
+                                             pszCacheMode);
+                    break;
+                }
+
+                rc = CFGMR3QueryU64Def(pCurNode, "CacheAdmitMaxIoSize", &cbCacheAdmitMax, 0);
+                if (RT_FAILURE(rc))
+                {
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                          N_("DrvVD: Configuration error: Querying \"CacheAdmitMaxIoSize\" as integer failed"));
+                    break;
+                }
+
+                rc = CFGMR3QueryU32Def(pCurNode, "CacheAdmitMinMisses", &cCacheAdmitMinMisses, 0);
+                if (RT_FAILURE(rc))
+                {
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc,
+                                          N_("DrvVD: Configuration error: Querying \"CacheAdmitMinMisses\" as integer failed"));
+                    break;
+                }
             }
 
             /* Mountable */
@@ -4925,6 +5078,16 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
             if (RT_FAILURE(rc))
                 return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Failed to query \"IoBufMax\" from the config"));
 
+            /* 0 selects the number of I/O buffer arenas based on the host CPU count. */
+            rc = CFGMR3QueryU32Def(pCfg, "IoBufArenas", &cIoBufArenas, 0);
+            if (RT_FAILURE(rc))
+                return PDMDRV_SET_ERROR(pDrvIns, rc, N_("Failed to query \"IoBufArenas\" from the config"));
+
+            rc = CFGMR3QueryBoolDef(pCfg, "IoBufLargePages", &fIoBufLargePages, false);
+            if (RT_FAILURE(rc))
+                return PDMDRV_SET_ERROR(pDrvIns, rc,
+                                        N_("DrvVD configuration error: Querying \"IoBufLargePages\" as boolean failed"));
+
             rc = CFGMR3QueryBoolDef(pCfg, "NonRotationalMedium", &pThis->fNonRotational, false);
             if (RT_FAILURE(rc))
                 return PDMDRV_SET_ERROR(pDrvIns, rc,
@@ -4939,7 +5102,12 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
     }
 
     if (pThis->pDrvMediaExPort)
-        rc = IOBUFMgrCreate(&pThis->hIoBufMgr, cbIoBufMax, pThis->pCfgCrypto ? IOBUFMGR_F_REQUIRE_NOT_PAGABLE : IOBUFMGR_F_DEFAULT);
+    {
+        uint32_t fIoBufFlags = pThis->pCfgCrypto ? IOBUFMGR_F_REQUIRE_NOT_PAGABLE : IOBUFMGR_F_DEFAULT;
+        if (fIoBufLargePages)
+            fIoBufFlags |= IOBUFMGR_F_LARGE_PAGES;
+        rc = IOBUFMgrCreateEx(&pThis->hIoBufMgr, cbIoBufMax, cIoBufArenas, fIoBufFlags, &pThis->IoBufStats);
+    }
 
     if (   !fEmptyDrive
         && RT_SUCCESS(rc))
@@ -4991,6 +5159,8 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
             {
                 rc = VDCreate(pThis->pVDIfsDisk, drvvdGetVDFromMediaType(pThis->enmType), &pThis->pDisk);
                 /* Error message is already set correctly. */
+                if (RT_SUCCESS(rc))
+                    rc = VDAllocIndexSetConfig(pThis->pDisk, cAllocIndexRangesMax, &pThis->AllocIdxStats);
             }
         }
 
@@ -5282,15 +5452,59 @@ static DECLCALLBACK(int) drvvdConstruct(PPDMDRVINS pDrvIns, PCFGMNODE pCfg, uint
                 AssertRC(rc);
             }
 
-            rc = VDCacheOpen(pThis->pDisk, pszCacheFormat, pszCachePath, VD_OPEN_FLAGS_NORMAL, pThis->pVDIfsCache);
+            if (RT_SUCCESS(rc))
+                rc = VDCacheOpen(pThis->pDisk, pszCacheFormat, pszCachePath, VD_OPEN_FLAGS_NORMAL, pThis->pVDIfsCache);
+            if (rc == VERR_VD_CACHE_NOT_UP_TO_DATE)
+            {
+                /*
+                 * The cache doesn't match the disk or wasn't closed properly, the content can't
+                 * be trusted. Start over with an empty cache if we know the size or go without.
+                 */
+                if (cbCacheSize)
+                {
+                    LogRel(("VD: Cache image '%s' is outdated, recreating it\n", pszCachePath));
+                    rc = RTFileDelete(pszCachePath);
+                    if (RT_SUCCESS(rc))
+                        rc = VERR_FILE_NOT_FOUND;
+                }
+                else
+                {
+                    LogRel(("VD: Cache image '%s' is outdated, continuing without it\n", pszCachePath));
+                    rc = VWRN_NOT_FOUND;
+                }
+            }
+            if (   cbCacheSize
+                && (   rc == VERR_FILE_NOT_FOUND
+                    || rc == VERR_PATH_NOT_FOUND))
+                rc = VDCreateCache(pThis->pDisk, pszCacheFormat, pszCachePath, cbCacheSize, VD_IMAGE_FLAGS_NONE,
+                                   NULL /* pszComment */, NULL /* pUuid */, VD_OPEN_FLAGS_NORMAL, pThis->pVDIfsCache,
+                                   NULL /* pVDIfsOperation */);
             if (RT_FAILURE(rc))
                 rc = PDMDRV_SET_ERROR(pDrvIns, rc, N_("DrvVD: Could not open cache image"));
+            else if (rc == VWRN_NOT_FOUND)
+                rc = VINF_SUCCESS;
+            else
+            {
+                VDCACHECFG CacheCfg;
+
+                CacheCfg.enmMode      = RTStrICmp(pszCacheMode, "WriteThrough") ? VDCACHEMODE_WRITE_AROUND : VDCACHEMODE_WRITE_THROUGH;
+                CacheCfg.cbAdmitMax   = (size_t)cbCacheAdmitMax;
+                CacheCfg.cAdmitMisses = cCacheAdmitMinMisses;
+                CacheCfg.pStats       = &pThis->CacheStats;
+                rc = VDCacheSetConfig(pThis->pDisk, &CacheCfg);
+                if (RT_SUCCESS(rc))
+                    pThis->fCacheAttached = true;
+                else
+                    rc = PDMDRV_SET_ERROR(pDrvIns, rc, N_("DrvVD: Could not configure cache image"));
+            }
         }
 
         if (RT_VALID_PTR(pszCachePath))
             MMR3HeapFree(pszCachePath);
         if (RT_VALID_PTR(pszCacheFormat))
             MMR3HeapFree(pszCacheFormat);
+        if (RT_VALID_PTR(pszCacheMode))
+            MMR3HeapFree(pszCacheMode);
 
         if (   RT_SUCCESS(rc)
             && pThis->fMergePending
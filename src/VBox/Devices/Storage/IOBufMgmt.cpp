@@ -22,6 +22,7 @@
 #include <iprt/critsect.h>
 #include <iprt/mem.h>
 #include <iprt/memsafer.h>
+#include <iprt/mp.h>
 #include <iprt/sg.h>
 #include <iprt/string.h>
 #include <iprt/asm.h>
@@ -33,9 +34,17 @@
 #define IOBUFMGR_BIN_SIZE_MIN _4K
 /** The maximum bin size to create - power of two!. */
 #define IOBUFMGR_BIN_SIZE_MAX _1M
+/** The minimum arena size when the number of arenas is determined automatically. */
+#define IOBUFMGR_ARENA_SIZE_MIN (4 * IOBUFMGR_BIN_SIZE_MAX)
+/** The maximum number of arenas. */
+#define IOBUFMGR_ARENAS_MAX     64
+/** The large page size the memory is aligned to when large pages are requested. */
+#define IOBUFMGR_LARGE_PAGE_SIZE _2M
 
 /** Pointer to the internal I/O buffer manager data. */
 typedef struct IOBUFMGRINT *PIOBUFMGRINT;
+/** Pointer to an I/O buffer manager arena. */
+typedef struct IOBUFMGRARENA *PIOBUFMGRARENA;
 
 /**
  * Internal I/O buffer descriptor data.
@@ -46,8 +55,8 @@ typedef struct IOBUFDESCINT
     RTSGSEG      aSegs[10];
     /** Data segments used for the current allocation. */
     unsigned     cSegsUsed;
-    /** Pointer to I/O buffer manager. */
-    PIOBUFMGRINT pIoBufMgr;
+    /** Pointer to the arena the segments were allocated from. */
+    PIOBUFMGRARENA pArena;
 } IOBUFDESCINT;
 
 /**
@@ -63,24 +72,30 @@ typedef struct IOBUFMGRBIN
 typedef IOBUFMGRBIN *PIOBUFMGRBIN;
 
 /**
- * Internal I/O buffer manager data.
+ * I/O buffer manager arena, a part of the memory pool with its own bins and lock.
  */
-typedef struct IOBUFMGRINT
+typedef struct IOBUFMGRARENA
 {
     /** Critical section protecting the allocation path. */
     RTCRITSECT          CritSectAlloc;
-    /** Flags the manager was created with. */
-    uint32_t            fFlags;
+    /** The owning I/O buffer manager. */
+    PIOBUFMGRINT        pIoBufMgr;
     /** Maximum size of I/O memory to allocate. */
     size_t              cbMax;
     /** Amount of free memory. */
     size_t              cbFree;
+    /** Size of the biggest free object (a fragmentation indicator). */
+    size_t              cbLargestFree;
     /** The order of smallest bin. */
     uint32_t            u32OrderMin;
     /** The order of largest bin. */
     uint32_t            u32OrderMax;
     /** Pointer to the base memory of the allocation. */
     void               *pvMem;
+    /** Pointer to the memory as allocated (differs from pvMem when aligned for large pages). */
+    void               *pvMemAlloc;
+    /** Size of the memory as allocated. */
+    size_t              cbMemAlloc;
     /** Number of bins for free objects. */
     uint32_t            cBins;
     /** Flag whether allocation is on hold waiting for everything to be free
@@ -94,12 +109,41 @@ typedef struct IOBUFMGRINT
 #endif
     /** Array of pointer entries for the various bins - variable in size. */
     void               *apvObj[1];
+} IOBUFMGRARENA;
+
+/**
+ * Internal I/O buffer manager data.
+ */
+typedef struct IOBUFMGRINT
+{
+    /** Flags the manager was created with. */
+    uint32_t            fFlags;
+    /** Maximum size of I/O memory to allocate. */
+    size_t              cbMax;
+    /** Where to store the statistics, optional. */
+    struct IOBUFMGRSTATS *pStats;
+    /** Number of CPU set indexes for mapping the current CPU to an arena. */
+    uint32_t            cCpus;
+    /** Number of arenas. */
+    uint32_t            cArenas;
+    /** Array of arenas - variable in size. */
+    PIOBUFMGRARENA      apArenas[1];
 } IOBUFMGRINT;
 
 /* Must be included after IOBUFDESCINT was defined. */
 #define IOBUFDESCINT_DECLARED
 #include "IOBufMgmt.h"
 
+/** Increments the given statistics counter if statistics are enabled. */
+#define IOBUFMGR_STAT_INC(a_pThis, a_Member) \
+    do { if ((a_pThis)->pStats) ASMAtomicIncU64(&(a_pThis)->pStats->a_Member); } while (0)
+/** Adds the given value to the statistics counter if statistics are enabled. */
+#define IOBUFMGR_STAT_ADD(a_pThis, a_Member, a_cb) \
+    do { if ((a_pThis)->pStats) ASMAtomicAddU64(&(a_pThis)->pStats->a_Member, (a_cb)); } while (0)
+/** Subtracts the given value from the statistics counter if statistics are enabled. */
+#define IOBUFMGR_STAT_SUB(a_pThis, a_Member, a_cb) \
+    do { if ((a_pThis)->pStats) ASMAtomicSubU64(&(a_pThis)->pStats->a_Member, (a_cb)); } while (0)
+
 /**
  * Gets the number of bins required between the given minimum and maximum size
  * to have a bin for every power of two size inbetween.
@@ -166,26 +210,26 @@ DECLINLINE(void *) iobufMgrBinObjRemove(PIOBUFMGRBIN pBin)
  * Resets the bins to factory default (memory resigin in the largest bin).
  *
  * @returns nothing.
- * @param   pThis       The I/O buffer manager instance.
+ * @param   pArena      The arena.
  */
-static void iobufMgrResetBins(PIOBUFMGRINT pThis)
+static void iobufMgrResetBins(PIOBUFMGRARENA pArena)
 {
     /* Init the bins. */
-    size_t   cbMax = pThis->cbMax;
+    size_t   cbMax = pArena->cbMax;
     size_t   iObj  = 0;
     uint32_t cbBin = IOBUFMGR_BIN_SIZE_MIN;
-    for (unsigned i = 0; i < pThis->cBins; i++)
+    for (unsigned i = 0; i < pArena->cBins; i++)
     {
-        PIOBUFMGRBIN pBin = &pThis->paBins[i];
+        PIOBUFMGRBIN pBin = &pArena->paBins[i];
         pBin->iFree = 0;
-        pBin->papvFree = &pThis->apvObj[iObj];
+        pBin->papvFree = &pArena->apvObj[iObj];
         iObj += cbMax / cbBin;
 
         /* Init the biggest possible bin with the free objects. */
         if (   (cbBin << 1) > cbMax
-            || i == pThis->cBins - 1)
+            || i == pArena->cBins - 1)
         {
-            uint8_t *pbMem = (uint8_t *)pThis->pvMem;
+            uint8_t *pbMem = (uint8_t *)pArena->pvMem;
             while (cbMax)
             {
                 iobufMgrBinObjAdd(pBin, pbMem);
@@ -197,7 +241,7 @@ static void iobufMgrResetBins(PIOBUFMGRINT pThis)
             }
 
             /* Limit the number of available bins. */
-            pThis->cBins = i + 1;
+            pArena->cBins = i + 1;
             break;
         }
 
@@ -206,14 +250,14 @@ static void iobufMgrResetBins(PIOBUFMGRINT pThis)
 }
 
 /**
- * Allocate one segment from the manager.
+ * Allocate one segment from the given arena.
  *
  * @returns Number of bytes allocated, 0 if there is no free memory.
- * @param   pThis       The I/O buffer manager instance.
+ * @param   pArena      The arena.
  * @param   pSeg        The segment to fill in on success.
  * @param   cb          Maximum number of bytes to allocate.
  */
-static size_t iobufMgrAllocSegment(PIOBUFMGRINT pThis, PRTSGSEG pSeg, size_t cb)
+static size_t iobufMgrAllocSegment(PIOBUFMGRARENA pArena, PRTSGSEG pSeg, size_t cb)
 {
     size_t cbAlloc = 0;
 
@@ -222,27 +266,27 @@ static size_t iobufMgrAllocSegment(PIOBUFMGRINT pThis, PRTSGSEG pSeg, size_t cb)
     if (cb & (RT_BIT_32(u32Order) - 1))
         u32Order++;
 
-    u32Order = RT_CLAMP(u32Order, pThis->u32OrderMin, pThis->u32OrderMax);
-    unsigned iBin = u32Order - pThis->u32OrderMin;
+    u32Order = RT_CLAMP(u32Order, pArena->u32OrderMin, pArena->u32OrderMax);
+    unsigned iBin = u32Order - pArena->u32OrderMin;
 
     /*
      * Check whether the bin can satisfy the request. If not try the next bigger
      * bin and so on. If there is nothing to find try the smaller bins.
      */
-    Assert(iBin < pThis->cBins);
+    Assert(iBin < pArena->cBins);
 
-    PIOBUFMGRBIN pBin = &pThis->paBins[iBin];
+    PIOBUFMGRBIN pBin = &pArena->paBins[iBin];
     /* Reset the bins if there is nothing in the current one but all the memory is marked as free. */
-    if (   pThis->cbFree == pThis->cbMax
+    if (   pArena->cbFree == pArena->cbMax
         && pBin->iFree == 0)
-        iobufMgrResetBins(pThis);
+        iobufMgrResetBins(pArena);
 
     if (pBin->iFree == 0)
     {
         unsigned iBinCur = iBin;
-        PIOBUFMGRBIN pBinCur = &pThis->paBins[iBinCur];
+        PIOBUFMGRBIN pBinCur = &pArena->paBins[iBinCur];
 
-        while (iBinCur < pThis->cBins)
+        while (iBinCur < pArena->cBins)
         {
             if (pBinCur->iFree != 0)
             {
@@ -253,8 +297,8 @@ static size_t iobufMgrAllocSegment(PIOBUFMGRINT pThis, PRTSGSEG pSeg, size_t cb)
                 while (iBinCur > iBin)
                 {
                     iBinCur--;
-                    pBinCur = &pThis->paBins[iBinCur];
-                    iobufMgrBinObjAdd(pBinCur, pbMem + (size_t)RT_BIT(iBinCur + pThis->u32OrderMin)); /* (RT_BIT causes weird MSC warning without cast) */
+                    pBinCur = &pArena->paBins[iBinCur];
+                    iobufMgrBinObjAdd(pBinCur, pbMem + (size_t)RT_BIT(iBinCur + pArena->u32OrderMin)); /* (RT_BIT causes weird MSC warning without cast) */
                 }
 
                 /* For the last bin we will get two new memory blocks. */
@@ -275,18 +319,19 @@ static size_t iobufMgrAllocSegment(PIOBUFMGRINT pThis, PRTSGSEG pSeg, size_t cb)
         && iBin > 0)
     {
 #if 1
-        pThis->fAllocSuspended = true;
+        pArena->fAllocSuspended = true;
+        IOBUFMGR_STAT_INC(pArena->pIoBufMgr, cAllocSuspends);
 #else
         do
         {
             iBin--;
-            pBin = &pThis->paBins[iBin];
+            pBin = &pArena->paBins[iBin];
 
             if (pBin->iFree != 0)
             {
                 pBin->iFree--;
                 pSeg->pvSeg = pBin->papvFree[pBin->iFree];
-                pSeg->cbSeg = (size_t)RT_BIT_32(iBin + pThis->u32OrderMin);
+                pSeg->cbSeg = (size_t)RT_BIT_32(iBin + pArena->u32OrderMin);
                 AssertPtr(pSeg->pvSeg);
                 cbAlloc = pSeg->cbSeg;
                 break;
@@ -302,17 +347,17 @@ static size_t iobufMgrAllocSegment(PIOBUFMGRINT pThis, PRTSGSEG pSeg, size_t cb)
         cbAlloc = pSeg->cbSeg;
         AssertPtr(pSeg->pvSeg);
 
-        pThis->cbFree -= cbAlloc;
+        pArena->cbFree -= cbAlloc;
 
 #ifdef IOBUFMGR_VERIFY_ALLOCATIONS
         /* Mark the objects as allocated. */
-        uint32_t iBinStart = ((uintptr_t)pSeg->pvSeg - (uintptr_t)pThis->pvMem) / IOBUFMGR_BIN_SIZE_MIN;
-        Assert(   !(((uintptr_t)pSeg->pvSeg - (uintptr_t)pThis->pvMem) % IOBUFMGR_BIN_SIZE_MIN)
+        uint32_t iBinStart = ((uintptr_t)pSeg->pvSeg - (uintptr_t)pArena->pvMem) / IOBUFMGR_BIN_SIZE_MIN;
+        Assert(   !(((uintptr_t)pSeg->pvSeg - (uintptr_t)pArena->pvMem) % IOBUFMGR_BIN_SIZE_MIN)
                && !(pSeg->cbSeg % IOBUFMGR_BIN_SIZE_MIN));
         uint32_t iBinEnd = iBinStart + (pSeg->cbSeg / IOBUFMGR_BIN_SIZE_MIN);
         while (iBinStart < iBinEnd)
         {
-            bool fState = ASMBitTestAndSet(pThis->pbmObjState, iBinStart);
+            bool fState = ASMBitTestAndSet(pArena->pbmObjState, iBinStart);
             //LogFlowFunc(("iBinStart=%u fState=%RTbool -> true\n", iBinStart, fState));
             AssertMsg(!fState, ("Trying to allocate an already allocated object\n"));
             iBinStart++;
@@ -323,59 +368,119 @@ static size_t iobufMgrAllocSegment(PIOBUFMGRINT pThis, PRTSGSEG pSeg, size_t cb)
     return cbAlloc;
 }
 
-DECLHIDDEN(int) IOBUFMgrCreate(PIOBUFMGR phIoBufMgr, size_t cbMax, uint32_t fFlags)
+/**
+ * Updates the largest free object size of the given arena and the statistics.
+ *
+ * @returns nothing.
+ * @param   pArena      The arena, the allocation lock must be held.
+ */
+static void iobufMgrArenaUpdateLargestFree(PIOBUFMGRARENA pArena)
 {
-    int rc = VINF_SUCCESS;
+    size_t cbLargestFree = 0;
+    for (unsigned i = pArena->cBins; i > 0; i--)
+        if (pArena->paBins[i - 1].iFree)
+        {
+            cbLargestFree = (size_t)RT_BIT_32(i - 1 + pArena->u32OrderMin);
+            break;
+        }
 
-    AssertPtrReturn(phIoBufMgr, VERR_INVALID_POINTER);
-    AssertReturn(cbMax, VERR_NOT_IMPLEMENTED);
+    pArena->cbLargestFree = cbLargestFree;
+
+    PIOBUFMGRINT pThis = pArena->pIoBufMgr;
+    if (pThis->pStats)
+    {
+        /* Racy for multiple arenas but good enough for statistics. */
+        for (uint32_t i = 0; i < pThis->cArenas; i++)
+            cbLargestFree = RT_MAX(cbLargestFree, pThis->apArenas[i]->cbLargestFree);
+        ASMAtomicWriteU64(&pThis->pStats->cbLargestFree, cbLargestFree);
+    }
+}
+
+/**
+ * Creates a new arena.
+ *
+ * @returns VBox status code.
+ * @param   pThis       The I/O buffer manager instance.
+ * @param   cbArena     Size of the arena in bytes.
+ * @param   ppArena     Where to store the pointer to the arena on success.
+ */
+static int iobufMgrArenaCreate(PIOBUFMGRINT pThis, size_t cbArena, PIOBUFMGRARENA *ppArena)
+{
+    int rc = VINF_SUCCESS;
 
     /* Allocate the basic structure in one go. */
     unsigned cBins = iobufMgrGetBinCount(IOBUFMGR_BIN_SIZE_MIN, IOBUFMGR_BIN_SIZE_MAX);
-    uint32_t cObjs = iobufMgrGetObjCount(cbMax, cBins, IOBUFMGR_BIN_SIZE_MIN);
-    PIOBUFMGRINT pThis = (PIOBUFMGRINT)RTMemAllocZ(RT_UOFFSETOF_DYN(IOBUFMGRINT, apvObj[cObjs]) + cBins * sizeof(IOBUFMGRBIN));
-    if (RT_LIKELY(pThis))
+    uint32_t cObjs = iobufMgrGetObjCount(cbArena, cBins, IOBUFMGR_BIN_SIZE_MIN);
+    PIOBUFMGRARENA pArena = (PIOBUFMGRARENA)RTMemAllocZ(RT_UOFFSETOF_DYN(IOBUFMGRARENA, apvObj[cObjs]) + cBins * sizeof(IOBUFMGRBIN));
+    if (RT_LIKELY(pArena))
     {
-        pThis->fFlags          = fFlags;
-        pThis->cbMax           = cbMax;
-        pThis->cbFree          = cbMax;
-        pThis->cBins           = cBins;
-        pThis->fAllocSuspended = false;
-        pThis->u32OrderMin     = ASMBitLastSetU32(IOBUFMGR_BIN_SIZE_MIN) - 1;
-        pThis->u32OrderMax     = ASMBitLastSetU32(IOBUFMGR_BIN_SIZE_MAX) - 1;
-        pThis->paBins = (PIOBUFMGRBIN)((uint8_t *)pThis + RT_UOFFSETOF_DYN(IOBUFMGRINT, apvObj[cObjs]));
+        pArena->pIoBufMgr       = pThis;
+        pArena->cbMax           = cbArena;
+        pArena->cbFree          = cbArena;
+        pArena->cBins           = cBins;
+        pArena->fAllocSuspended = false;
+        pArena->u32OrderMin     = ASMBitLastSetU32(IOBUFMGR_BIN_SIZE_MIN) - 1;
+        pArena->u32OrderMax     = ASMBitLastSetU32(IOBUFMGR_BIN_SIZE_MAX) - 1;
+        pArena->paBins = (PIOBUFMGRBIN)((uint8_t *)pArena + RT_UOFFSETOF_DYN(IOBUFMGRARENA, apvObj[cObjs]));
 
 #ifdef IOBUFMGR_VERIFY_ALLOCATIONS
-        pThis->pbmObjState = RTMemAllocZ((cbMax / IOBUFMGR_BIN_SIZE_MIN / 8) + 1);
-        if (!pThis->pbmObjState)
+        pArena->pbmObjState = RTMemAllocZ((cbArena / IOBUFMGR_BIN_SIZE_MIN / 8) + 1);
+        if (!pArena->pbmObjState)
             rc = VERR_NO_MEMORY;
 #endif
 
         if (RT_SUCCESS(rc))
-            rc = RTCritSectInit(&pThis->CritSectAlloc);
+            rc = RTCritSectInit(&pArena->CritSectAlloc);
         if (RT_SUCCESS(rc))
         {
             if (pThis->fFlags & IOBUFMGR_F_REQUIRE_NOT_PAGABLE)
-                rc = RTMemSaferAllocZEx(&pThis->pvMem, RT_ALIGN_Z(pThis->cbMax, _4K),
+            {
+                pArena->cbMemAlloc = RT_ALIGN_Z(cbArena, _4K);
+                rc = RTMemSaferAllocZEx(&pArena->pvMemAlloc, pArena->cbMemAlloc,
                                         RTMEMSAFER_F_REQUIRE_NOT_PAGABLE);
+                pArena->pvMem = pArena->pvMemAlloc;
+            }
             else
-                pThis->pvMem = RTMemPageAllocZ(RT_ALIGN_Z(pThis->cbMax, _4K));
+            {
+                /*
+                 * With several arenas the memory is not touched here so the pages get
+                 * placed near the CPUs doing the I/O when they are first used.
+                 */
+                uint32_t fPageFlags = pThis->cArenas == 1 ? RTMEMPAGEALLOC_F_ZERO : 0;
+                if (pThis->fFlags & IOBUFMGR_F_LARGE_PAGES)
+                {
+                    /* Over allocate so the usable memory can be aligned to the large page size. */
+                    pArena->cbMemAlloc = RT_ALIGN_Z(cbArena, IOBUFMGR_LARGE_PAGE_SIZE) + IOBUFMGR_LARGE_PAGE_SIZE;
+                    pArena->pvMemAlloc = RTMemPageAllocEx(pArena->cbMemAlloc, fPageFlags | RTMEMPAGEALLOC_F_ADVISE_LARGE_PAGES);
+                    pArena->pvMem      = RT_ALIGN_P(pArena->pvMemAlloc, IOBUFMGR_LARGE_PAGE_SIZE);
+                }
+                else
+                {
+                    pArena->cbMemAlloc = RT_ALIGN_Z(cbArena, _4K);
+                    pArena->pvMemAlloc = RTMemPageAllocEx(pArena->cbMemAlloc, fPageFlags);
+                    pArena->pvMem      = pArena->pvMemAlloc;
+                }
+            }
 
-            if (   RT_LIKELY(pThis->pvMem)
+            if (   RT_LIKELY(pArena->pvMemAlloc)
                 && RT_SUCCESS(rc))
             {
-                iobufMgrResetBins(pThis);
+                iobufMgrResetBins(pArena);
+                iobufMgrArenaUpdateLargestFree(pArena);
 
-                *phIoBufMgr = pThis;
+                *ppArena = pArena;
                 return VINF_SUCCESS;
             }
             else
                 rc = VERR_NO_MEMORY;
 
-            RTCritSectDelete(&pThis->CritSectAlloc);
+            RTCritSectDelete(&pArena->CritSectAlloc);
         }
 
-        RTMemFree(pThis);
+#ifdef IOBUFMGR_VERIFY_ALLOCATIONS
+        RTMemFree(pArena->pbmObjState);
+#endif
+        RTMemFree(pArena);
     }
     else
         rc = VERR_NO_MEMORY;
@@ -383,58 +488,49 @@ DECLHIDDEN(int) IOBUFMgrCreate(PIOBUFMGR phIoBufMgr, size_t cbMax, uint32_t fFla
     return rc;
 }
 
-DECLHIDDEN(int) IOBUFMgrDestroy(IOBUFMGR hIoBufMgr)
+/**
+ * Destroys the given arena, all memory must be free.
+ *
+ * @returns nothing.
+ * @param   pArena      The arena to destroy.
+ */
+static void iobufMgrArenaDestroy(PIOBUFMGRARENA pArena)
 {
-    PIOBUFMGRINT pThis = hIoBufMgr;
-
-    AssertPtrReturn(pThis, VERR_INVALID_HANDLE);
+    Assert(pArena->cbFree == pArena->cbMax);
 
-    int rc = RTCritSectEnter(&pThis->CritSectAlloc);
-    if (RT_SUCCESS(rc))
-    {
-        if (pThis->cbFree == pThis->cbMax)
-        {
-            if (pThis->fFlags & IOBUFMGR_F_REQUIRE_NOT_PAGABLE)
-                RTMemSaferFree(pThis->pvMem, RT_ALIGN_Z(pThis->cbMax, _4K));
-            else
-                RTMemPageFree(pThis->pvMem, RT_ALIGN_Z(pThis->cbMax, _4K));
+    if (pArena->pIoBufMgr->fFlags & IOBUFMGR_F_REQUIRE_NOT_PAGABLE)
+        RTMemSaferFree(pArena->pvMemAlloc, pArena->cbMemAlloc);
+    else
+        RTMemPageFree(pArena->pvMemAlloc, pArena->cbMemAlloc);
 
 #ifdef IOBUFMGR_VERIFY_ALLOCATIONS
-            AssertPtr(pThis->pbmObjState);
-            RTMemFree(pThis->pbmObjState);
-            pThis->pbmObjState = NULL;
+    AssertPtr(pArena->pbmObjState);
+    RTMemFree(pArena->pbmObjState);
+    pArena->pbmObjState = NULL;
 #endif
 
-            RTCritSectLeave(&pThis->CritSectAlloc);
-            RTCritSectDelete(&pThis->CritSectAlloc);
-            RTMemFree(pThis);
-        }
-        else
-        {
-            rc = VERR_INVALID_STATE;
-            RTCritSectLeave(&pThis->CritSectAlloc);
-        }
-    }
-
-    return rc;
+    RTCritSectDelete(&pArena->CritSectAlloc);
+    RTMemFree(pArena);
 }
 
-DECLHIDDEN(int) IOBUFMgrAllocBuf(IOBUFMGR hIoBufMgr, PIOBUFDESC pIoBufDesc, size_t cbIoBuf,
-                                 size_t *pcbIoBufAllocated)
+/**
+ * Allocates as much as possible of the given I/O buffer from the given arena.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NO_MEMORY if nothing could be allocated from the arena.
+ * @param   pArena          The arena to allocate from.
+ * @param   pIoBufDesc      The I/O buffer descriptor to initialize on success.
+ * @param   cbIoBuf         How much to allocate.
+ * @param   pcbIoBufAlloc   Where to store the amount of memory allocated on success.
+ */
+static int iobufMgrArenaAllocBuf(PIOBUFMGRARENA pArena, PIOBUFDESC pIoBufDesc, size_t cbIoBuf,
+                                 size_t *pcbIoBufAlloc)
 {
-    PIOBUFMGRINT pThis = hIoBufMgr;
-
-    LogFlowFunc(("pThis=%#p pIoBufDesc=%#p cbIoBuf=%zu pcbIoBufAllocated=%#p\n",
-                 pThis, pIoBufDesc, cbIoBuf, pcbIoBufAllocated));
-
-    AssertPtrReturn(pThis, VERR_INVALID_HANDLE);
-    AssertReturn(cbIoBuf > 0, VERR_INVALID_PARAMETER);
-
-    if (   !pThis->cbFree
-        || pThis->fAllocSuspended)
+    if (   !pArena->cbFree
+        || pArena->fAllocSuspended)
         return VERR_NO_MEMORY;
 
-    int rc = RTCritSectEnter(&pThis->CritSectAlloc);
+    int rc = RTCritSectEnter(&pArena->CritSectAlloc);
     if (RT_SUCCESS(rc))
     {
         unsigned iSeg = 0;
@@ -445,7 +541,7 @@ DECLHIDDEN(int) IOBUFMgrAllocBuf(IOBUFMGR hIoBufMgr, PIOBUFDESC pIoBufDesc, size
         while (   iSeg < RT_ELEMENTS(pIoBufDesc->Int.aSegs)
                && cbLeft)
         {
-            size_t cbAlloc = iobufMgrAllocSegment(pThis, pSeg, cbLeft);
+            size_t cbAlloc = iobufMgrAllocSegment(pArena, pSeg, cbLeft);
             if (!cbAlloc)
                 break;
 
@@ -456,17 +552,178 @@ DECLHIDDEN(int) IOBUFMgrAllocBuf(IOBUFMGR hIoBufMgr, PIOBUFDESC pIoBufDesc, size
         }
 
         if (iSeg)
+        {
             RTSgBufInit(&pIoBufDesc->SgBuf, &pIoBufDesc->Int.aSegs[0], iSeg);
+            iobufMgrArenaUpdateLargestFree(pArena);
+            IOBUFMGR_STAT_SUB(pArena->pIoBufMgr, cbFree, cbIoBufAlloc);
+        }
         else
             rc = VERR_NO_MEMORY;
 
         pIoBufDesc->Int.cSegsUsed = iSeg;
-        pIoBufDesc->Int.pIoBufMgr = pThis;
-        *pcbIoBufAllocated = cbIoBufAlloc;
-        Assert(   (RT_SUCCESS(rc) && *pcbIoBufAllocated > 0)
-               || RT_FAILURE(rc));
+        pIoBufDesc->Int.pArena    = pArena;
+        *pcbIoBufAlloc = cbIoBufAlloc;
+
+        RTCritSectLeave(&pArena->CritSectAlloc);
+    }
+
+    return rc;
+}
+
+/**
+ * Returns the arena the calling thread should allocate from first.
+ *
+ * @returns Index of the arena.
+ * @param   pThis       The I/O buffer manager instance.
+ */
+DECLINLINE(uint32_t) iobufMgrArenaGetHome(PIOBUFMGRINT pThis)
+{
+    if (pThis->cArenas == 1)
+        return 0;
+
+    /* Neighbouring CPUs share an arena. */
+    int iCpu = RTMpCurSetIndex();
+    if (RT_UNLIKELY(iCpu < 0))
+        return 0;
+
+    return (uint32_t)(((uint64_t)iCpu * pThis->cArenas / pThis->cCpus) % pThis->cArenas);
+}
+
+DECLHIDDEN(int) IOBUFMgrCreate(PIOBUFMGR phIoBufMgr, size_t cbMax, uint32_t fFlags)
+{
+    return IOBUFMgrCreateEx(phIoBufMgr, cbMax, 1 /*cArenas*/, fFlags, NULL /*pStats*/);
+}
+
+DECLHIDDEN(int) IOBUFMgrCreateEx(PIOBUFMGR phIoBufMgr, size_t cbMax, uint32_t cArenas, uint32_t fFlags,
+                                 PIOBUFMGRSTATS pStats)
+{
+    int rc = VINF_SUCCESS;
+
+    AssertPtrReturn(phIoBufMgr, VERR_INVALID_POINTER);
+    AssertReturn(cbMax, VERR_NOT_IMPLEMENTED);
+    AssertReturn(!(fFlags & ~IOBUFMGR_F_VALID_MASK), VERR_INVALID_FLAGS);
+    AssertPtrNullReturn(pStats, VERR_INVALID_POINTER);
+
+    /* Large pages are not supported for the non pageable memory. */
+    if (fFlags & IOBUFMGR_F_REQUIRE_NOT_PAGABLE)
+        fFlags &= ~IOBUFMGR_F_LARGE_PAGES;
+
+    uint32_t cCpus = RT_MAX(RTMpGetCount(), 1);
+    if (!cArenas)
+        cArenas = (uint32_t)RT_MIN(RTMpGetOnlineCount(), cbMax / IOBUFMGR_ARENA_SIZE_MIN);
+    cArenas = RT_CLAMP(cArenas, 1, IOBUFMGR_ARENAS_MAX);
+    while (   cArenas > 1
+           && cbMax / cArenas < IOBUFMGR_BIN_SIZE_MAX)
+        cArenas--;
+
+    PIOBUFMGRINT pThis = (PIOBUFMGRINT)RTMemAllocZ(RT_UOFFSETOF_DYN(IOBUFMGRINT, apArenas[cArenas]));
+    if (RT_LIKELY(pThis))
+    {
+        pThis->fFlags  = fFlags;
+        pThis->cbMax   = cbMax;
+        pThis->pStats  = pStats;
+        pThis->cCpus   = cCpus;
+        pThis->cArenas = cArenas;
+
+        if (pStats)
+        {
+            RT_ZERO(*pStats);
+            pStats->cbFree = cbMax;
+        }
+
+        /* The memory is distributed evenly across the arenas. */
+        size_t cbArena = cArenas == 1 ? cbMax : (cbMax / cArenas) & ~(size_t)(IOBUFMGR_BIN_SIZE_MIN - 1);
+        uint32_t i;
+        for (i = 0; i < cArenas && RT_SUCCESS(rc); i++)
+        {
+            size_t cbThisArena = i == cArenas - 1 ? cbMax - i * cbArena : cbArena;
+            rc = iobufMgrArenaCreate(pThis, cbThisArena, &pThis->apArenas[i]);
+        }
+
+        if (RT_SUCCESS(rc))
+        {
+            LogRel(("IOBUFMgr: Created %zu bytes pool with %u arena(s) (fFlags=%#x)\n",
+                    cbMax, cArenas, fFlags));
+            *phIoBufMgr = pThis;
+            return VINF_SUCCESS;
+        }
+
+        while (i-- > 0)
+            if (pThis->apArenas[i])
+                iobufMgrArenaDestroy(pThis->apArenas[i]);
+
+        RTMemFree(pThis);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    return rc;
+}
+
+DECLHIDDEN(int) IOBUFMgrDestroy(IOBUFMGR hIoBufMgr)
+{
+    PIOBUFMGRINT pThis = hIoBufMgr;
+
+    AssertPtrReturn(pThis, VERR_INVALID_HANDLE);
+
+    /* Check that everything was freed before tearing down anything. */
+    for (uint32_t i = 0; i < pThis->cArenas; i++)
+    {
+        PIOBUFMGRARENA pArena = pThis->apArenas[i];
+        int rc = RTCritSectEnter(&pArena->CritSectAlloc);
+        if (RT_FAILURE(rc))
+            return rc;
+
+        bool fFree = pArena->cbFree == pArena->cbMax;
+        RTCritSectLeave(&pArena->CritSectAlloc);
+        if (!fFree)
+            return VERR_INVALID_STATE;
+    }
+
+    for (uint32_t i = 0; i < pThis->cArenas; i++)
+        iobufMgrArenaDestroy(pThis->apArenas[i]);
+
+    RTMemFree(pThis);
+    return VINF_SUCCESS;
+}
+
+DECLHIDDEN(int) IOBUFMgrAllocBuf(IOBUFMGR hIoBufMgr, PIOBUFDESC pIoBufDesc, size_t cbIoBuf,
+                                 size_t *pcbIoBufAllocated)
+{
+    PIOBUFMGRINT pThis = hIoBufMgr;
+
+    LogFlowFunc(("pThis=%#p pIoBufDesc=%#p cbIoBuf=%zu pcbIoBufAllocated=%#p\n",
+                 pThis, pIoBufDesc, cbIoBuf, pcbIoBufAllocated));
 
-        RTCritSectLeave(&pThis->CritSectAlloc);
+    AssertPtrReturn(pThis, VERR_INVALID_HANDLE);
+    AssertReturn(cbIoBuf > 0, VERR_INVALID_PARAMETER);
+
+    size_t cbIoBufAlloc = 0;
+    uint32_t iArenaHome = iobufMgrArenaGetHome(pThis);
+    int rc = iobufMgrArenaAllocBuf(pThis->apArenas[iArenaHome], pIoBufDesc, cbIoBuf, &cbIoBufAlloc);
+    if (   rc == VERR_NO_MEMORY
+        && pThis->cArenas > 1)
+    {
+        /* Steal from the other arenas before giving up. */
+        for (uint32_t i = 1; i < pThis->cArenas && rc == VERR_NO_MEMORY; i++)
+            rc = iobufMgrArenaAllocBuf(pThis->apArenas[(iArenaHome + i) % pThis->cArenas],
+                                       pIoBufDesc, cbIoBuf, &cbIoBufAlloc);
+        if (RT_SUCCESS(rc))
+            IOBUFMGR_STAT_INC(pThis, cAllocsStolen);
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        *pcbIoBufAllocated = cbIoBufAlloc;
+        Assert(*pcbIoBufAllocated > 0);
+        IOBUFMGR_STAT_INC(pThis, cAllocs);
+        if (cbIoBufAlloc < cbIoBuf)
+            IOBUFMGR_STAT_INC(pThis, cAllocsPartial);
+    }
+    else if (rc == VERR_NO_MEMORY)
+    {
+        *pcbIoBufAllocated = 0;
+        IOBUFMGR_STAT_INC(pThis, cAllocFailures);
     }
 
     return rc;
@@ -474,38 +731,41 @@ DECLHIDDEN(int) IOBUFMgrAllocBuf(IOBUFMGR hIoBufMgr, PIOBUFDESC pIoBufDesc, size
 
 DECLHIDDEN(void) IOBUFMgrFreeBuf(PIOBUFDESC pIoBufDesc)
 {
-    PIOBUFMGRINT pThis = pIoBufDesc->Int.pIoBufMgr;
+    PIOBUFMGRARENA pArena = pIoBufDesc->Int.pArena;
 
     LogFlowFunc(("pIoBufDesc=%#p{.cSegsUsed=%u}\n", pIoBufDesc, pIoBufDesc->Int.cSegsUsed));
 
-    AssertPtr(pThis);
+    AssertPtr(pArena);
 
-    int rc = RTCritSectEnter(&pThis->CritSectAlloc);
+    int rc = RTCritSectEnter(&pArena->CritSectAlloc);
     AssertRC(rc);
 
     if (RT_SUCCESS(rc))
     {
+        size_t cbFreed = 0;
+
         for (unsigned i = 0; i < pIoBufDesc->Int.cSegsUsed; i++)
         {
             PRTSGSEG pSeg = &pIoBufDesc->Int.aSegs[i];
 
             uint32_t u32Order = ASMBitLastSetU32((uint32_t)pSeg->cbSeg) - 1;
-            unsigned iBin = u32Order - pThis->u32OrderMin;
+            unsigned iBin = u32Order - pArena->u32OrderMin;
 
-            Assert(iBin < pThis->cBins);
-            PIOBUFMGRBIN pBin = &pThis->paBins[iBin];
+            Assert(iBin < pArena->cBins);
+            PIOBUFMGRBIN pBin = &pArena->paBins[iBin];
             iobufMgrBinObjAdd(pBin, pSeg->pvSeg);
-            pThis->cbFree += pSeg->cbSeg;
+            pArena->cbFree += pSeg->cbSeg;
+            cbFreed        += pSeg->cbSeg;
 
 #ifdef IOBUFMGR_VERIFY_ALLOCATIONS
             /* Mark the objects as free. */
-            uint32_t iBinStart = ((uintptr_t)pSeg->pvSeg - (uintptr_t)pThis->pvMem) / IOBUFMGR_BIN_SIZE_MIN;
-            Assert(   !(((uintptr_t)pSeg->pvSeg - (uintptr_t)pThis->pvMem) % IOBUFMGR_BIN_SIZE_MIN)
+            uint32_t iBinStart = ((uintptr_t)pSeg->pvSeg - (uintptr_t)pArena->pvMem) / IOBUFMGR_BIN_SIZE_MIN;
+            Assert(   !(((uintptr_t)pSeg->pvSeg - (uintptr_t)pArena->pvMem) % IOBUFMGR_BIN_SIZE_MIN)
                    && !(pSeg->cbSeg % IOBUFMGR_BIN_SIZE_MIN));
             uint32_t iBinEnd = iBinStart + (pSeg->cbSeg / IOBUFMGR_BIN_SIZE_MIN);
             while (iBinStart < iBinEnd)
             {
-                bool fState = ASMBitTestAndClear(pThis->pbmObjState, iBinStart);
+                bool fState = ASMBitTestAndClear(pArena->pbmObjState, iBinStart);
                 //LogFlowFunc(("iBinStart=%u fState=%RTbool -> false\n", iBinStart, fState));
                 AssertMsg(fState, ("Trying to free a non allocated object\n"));
                 iBinStart++;
@@ -517,14 +777,17 @@ DECLHIDDEN(void) IOBUFMgrFreeBuf(PIOBUFDESC pIoBufDesc)
 #endif
         }
 
-        if (   pThis->cbFree == pThis->cbMax
-            && pThis->fAllocSuspended)
+        if (   pArena->cbFree == pArena->cbMax
+            && pArena->fAllocSuspended)
         {
-            iobufMgrResetBins(pThis);
-            pThis->fAllocSuspended = false;
+            iobufMgrResetBins(pArena);
+            pArena->fAllocSuspended = false;
         }
 
-        RTCritSectLeave(&pThis->CritSectAlloc);
+        iobufMgrArenaUpdateLargestFree(pArena);
+        IOBUFMGR_STAT_ADD(pArena->pIoBufMgr, cbFree, cbFreed);
+
+        RTCritSectLeave(&pArena->CritSectAlloc);
     }
 
     pIoBufDesc->Int.cSegsUsed = 0;
@@ -532,4 +795,3 @@ DECLHIDDEN(void) IOBUFMgrFreeBuf(PIOBUFDESC pIoBufDesc)
     memset(&pIoBufDesc->SgBuf, 0xff, sizeof(pIoBufDesc->SgBuf));
 #endif
 }
-
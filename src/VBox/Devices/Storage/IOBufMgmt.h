@@ -40,6 +40,34 @@ typedef IOBUFMGR *PIOBUFMGR;
 /** I/O buffer memory needs to be non pageable (for example because it contains sensitive data
  * which shouldn't end up in swap unencrypted). */
 #define IOBUFMGR_F_REQUIRE_NOT_PAGABLE RT_BIT(0)
+/** Try to back the I/O buffer memory with large pages (advisory, ignored if not supported
+ * by the host or when combined with IOBUFMGR_F_REQUIRE_NOT_PAGABLE). */
+#define IOBUFMGR_F_LARGE_PAGES         RT_BIT(1)
+/** Mask of valid flags. */
+#define IOBUFMGR_F_VALID_MASK          (IOBUFMGR_F_REQUIRE_NOT_PAGABLE | IOBUFMGR_F_LARGE_PAGES)
+
+/**
+ * I/O buffer manager statistics, updated atomically by the manager.
+ */
+typedef struct IOBUFMGRSTATS
+{
+    /** Number of successful allocations. */
+    uint64_t         cAllocs;
+    /** Number of allocations failed because there was no free memory. */
+    uint64_t         cAllocFailures;
+    /** Number of allocations returning less than requested. */
+    uint64_t         cAllocsPartial;
+    /** Number of allocations satisfied from an arena other than the one of the current CPU. */
+    uint64_t         cAllocsStolen;
+    /** Number of times an arena suspended allocations to defragment its memory. */
+    uint64_t         cAllocSuspends;
+    /** Amount of free memory in bytes. */
+    uint64_t         cbFree;
+    /** Size of the largest free contiguous block in bytes. */
+    uint64_t         cbLargestFree;
+} IOBUFMGRSTATS;
+/** Pointer to I/O buffer manager statistics. */
+typedef IOBUFMGRSTATS *PIOBUFMGRSTATS;
 
 /**
  * I/O buffer descriptor.
@@ -72,6 +100,25 @@ typedef IOBUFDESC *PIOBUFDESC;
  */
 DECLHIDDEN(int) IOBUFMgrCreate(PIOBUFMGR phIoBufMgr, size_t cbMax, uint32_t fFlags);
 
+/**
+ * Creates I/O buffer manager, extended version.
+ *
+ * The memory is split into arenas with their own locks, each serving a group of
+ * neighbouring host CPUs. An allocation falls back to the other arenas if the one
+ * of the current CPU is exhausted.
+ *
+ * @returns VBox status code.
+ * @param   phIoBufMgr    Where to store the handle to the I/O buffer manager on success.
+ * @param   cbMax         The maximum amount of I/O memory to allow.
+ * @param   cArenas       Number of arenas to split the memory into, 0 to choose based on the
+ *                        number of online CPUs and the amount of memory.
+ * @param   fFlags        Combination of IOBUFMGR_F_*
+ * @param   pStats        Where to maintain the statistics, optional. Must stay valid until
+ *                        the manager is destroyed.
+ */
+DECLHIDDEN(int) IOBUFMgrCreateEx(PIOBUFMGR phIoBufMgr, size_t cbMax, uint32_t cArenas, uint32_t fFlags,
+                                 PIOBUFMGRSTATS pStats);
+
 /**
  * Destroys the given I/O buffer manager.
  *
@@ -45,8 +45,9 @@
 #define VIRTQNAME(a_pVirtio, a_uVirtq)      ((a_pVirtio)->aVirtqueues[(a_uVirtq)].szName)
 
 #define IS_DRIVER_OK(a_pVirtio)             ((a_pVirtio)->fDeviceStatus & VIRTIO_STATUS_DRIVER_OK)
+#define IS_VIRTQ_PACKED(a_pVirtio)           RT_BOOL((a_pVirtio)->uDriverFeatures & VIRTIO_F_RING_PACKED)
 #define IS_VIRTQ_EMPTY(pDevIns, pVirtio, pVirtq) \
-            (virtioCoreVirtqAvailBufCount_inline(pDevIns, pVirtio, pVirtq) == 0)
+            virtioCoreVirtqIsEmpty_inline(pDevIns, pVirtio, pVirtq)
 
 /**
  * This macro returns true if the @a a_offAccess and access length (@a
@@ -66,7 +67,9 @@
 /** Marks the start of the virtio saved state (just for sanity). */
 #define VIRTIO_SAVEDSTATE_MARKER                        UINT64_C(0x1133557799bbddff)
 /** The current saved state version for the virtio core. */
-#define VIRTIO_SAVEDSTATE_VERSION                       UINT32_C(1)
+#define VIRTIO_SAVEDSTATE_VERSION                       UINT32_C(2)
+/** The saved state version before packed virtq and event idx state was saved. */
+#define VIRTIO_SAVEDSTATE_VERSION_PRE_PACKED            UINT32_C(1)
 
 
 /*********************************************************************************************************************************
@@ -84,6 +87,20 @@
 #define VIRTQ_AVAIL_F_NO_INTERRUPT                      1        /**< Drv to Dev: Don't notify when buf eaten   */
 /** @} */
 
+/** @name Packed virtq related flags (VirtIO 1.1, section 2.7)
+ * @{ */
+#define VIRTQ_DESC_F_AVAIL                              RT_BIT(7)   /**< Avail flag, matches driver wrap counter */
+#define VIRTQ_DESC_F_USED                               RT_BIT(15)  /**< Used flag, matches device wrap counter  */
+
+#define VIRTQ_EVENT_F_ENABLE                            0        /**< Event suppression: notifications enabled  */
+#define VIRTQ_EVENT_F_DISABLE                           1        /**< Event suppression: notifications disabled */
+#define VIRTQ_EVENT_F_DESC                              2        /**< Event suppression: notify at off/wrap     */
+#define VIRTQ_EVENT_OFF_WRAP_BIT                        RT_BIT(15) /**< Wrap counter bit of off_wrap            */
+/** @} */
+
+/** Max number of indirect descriptors read onto the stack rather than the heap. */
+#define VIRTQ_INDIRECT_STACK_DESCS                      16
+
 /**
  * virtq related structs
  * (struct names follow VirtIO 1.0 spec, typedef use VBox style)
@@ -118,6 +135,21 @@ typedef struct virt_used
     //uint16_t  uAvailEventIdx;                                  /**< avail_event if (VIRTQ_USED_F_EVENT_IDX)   */
 } VIRTQ_USED_T, *PVIRTQ_USED_T;
 
+typedef struct virtq_packed_desc
+{
+    uint64_t  GCPhysBuf;                                         /**< addr       GC Phys. address of buffer     */
+    uint32_t  cb;                                                /**< len        Buffer length                  */
+    uint16_t  uBufId;                                            /**< id         Buffer ID                      */
+    uint16_t  fFlags;                                            /**< flags      Buffer specific flags          */
+} VIRTQ_PACKED_DESC_T, *PVIRTQ_PACKED_DESC_T;
+AssertCompileSize(VIRTQ_PACKED_DESC_T, sizeof(VIRTQ_DESC_T));
+
+typedef struct virtq_event_suppress
+{
+    uint16_t  uOffWrap;                                          /**< desc_event_off_wrap  Offset and wrap bit  */
+    uint16_t  fFlags;                                            /**< desc_event_flags     VIRTQ_EVENT_F_XXX    */
+} VIRTQ_EVENT_SUPPRESS_T;
+
 
 const char *virtioCoreGetStateChangeText(VIRTIOVMSTATECHANGED enmState)
 {
@@ -170,6 +202,7 @@ DECLINLINE(uint16_t) virtioReadAvailDescIdx(PPDMDEVINS pDevIns, PVIRTIOCORE pVir
                          &uDescIdx, sizeof(uDescIdx));
     return uDescIdx;
 }
+#endif
 
 DECLINLINE(uint16_t) virtioReadAvailUsedEvent(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq)
 {
@@ -182,7 +215,6 @@ DECLINLINE(uint16_t) virtioReadAvailUsedEvent(PPDMDEVINS pDevIns, PVIRTIOCORE pV
                          &uUsedEventIdx, sizeof(uUsedEventIdx));
     return uUsedEventIdx;
 }
-#endif
 
 DECLINLINE(uint16_t) virtioReadAvailRingIdx(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq)
 {
@@ -270,7 +302,7 @@ DECLINLINE(uint16_t) virtioReadUsedRingFlags(PPDMDEVINS pDevIns, PVIRTIOCORE pVi
     return fFlags;
 }
 
-DECLINLINE(void) virtioWriteUsedAvailEvent(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq, uint32_t uAvailEventIdx)
+DECLINLINE(void) virtioWriteUsedAvailEvent(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq, uint16_t uAvailEventIdx)
 {
     /** VirtIO 1.0 uAvailEventIdx (avail_event) immediately follows ring */
     AssertMsg(pVirtio->fDeviceStatus & VIRTIO_STATUS_DRIVER_OK, ("Called with guest driver not ready\n"));
@@ -281,17 +313,168 @@ DECLINLINE(void) virtioWriteUsedAvailEvent(PPDMDEVINS pDevIns, PVIRTIOCORE pVirt
                           &uAvailEventIdx, sizeof(uAvailEventIdx));
 }
 #endif
+/** @} */
+
+/** @name Accessors for packed virtqs (VirtIO 1.1, section 2.7)
+ *
+ * For packed virtqs GCPhysVirtqDesc locates the descriptor ring, GCPhysVirtqAvail the driver
+ * event suppression structure and GCPhysVirtqUsed the device event suppression structure.
+ * @{
+ */
+
+#ifdef IN_RING3
+DECLINLINE(void) virtioReadPackedDesc(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq,
+                                      uint16_t idxSlot, PVIRTQ_PACKED_DESC_T pDesc)
+{
+    AssertMsg(pVirtio->fDeviceStatus & VIRTIO_STATUS_DRIVER_OK, ("Called with guest driver not ready\n"));
+    RT_NOREF(pVirtio);
+    uint16_t const cVirtqItems = RT_MAX(pVirtq->uSize, 1); /* Make sure to avoid div-by-zero. */
+    PDMDevHlpPCIPhysRead(pDevIns,
+                         pVirtq->GCPhysVirtqDesc + sizeof(VIRTQ_PACKED_DESC_T) * (idxSlot % cVirtqItems),
+                         pDesc, sizeof(VIRTQ_PACKED_DESC_T));
+}
+
+DECLINLINE(void) virtioWritePackedUsedElem(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq,
+                                           uint16_t idxSlot, uint16_t uBufId, uint32_t cbElem)
+{
+    /* len and id are adjacent, so write them in one go and leave the flags for later. */
+    struct { uint32_t cb; uint16_t uBufId; } Elem = { cbElem, uBufId };
+    AssertMsg(pVirtio->fDeviceStatus & VIRTIO_STATUS_DRIVER_OK, ("Called with guest driver not ready\n"));
+    RT_NOREF(pVirtio);
+    uint16_t const cVirtqItems = RT_MAX(pVirtq->uSize, 1); /* Make sure to avoid div-by-zero. */
+    PDMDevHlpPCIPhysWrite(pDevIns,
+                          pVirtq->GCPhysVirtqDesc + sizeof(VIRTQ_PACKED_DESC_T) * (idxSlot % cVirtqItems)
+                        + RT_UOFFSETOF(VIRTQ_PACKED_DESC_T, cb),
+                          &Elem, sizeof(uint32_t) + sizeof(uint16_t));
+}
+
+DECLINLINE(void) virtioWritePackedDeviceEventFlags(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq, uint16_t fFlags)
+{
+    AssertMsg(pVirtio->fDeviceStatus & VIRTIO_STATUS_DRIVER_OK, ("Called with guest driver not ready\n"));
+    RT_NOREF(pVirtio);
+    PDMDevHlpPCIPhysWrite(pDevIns,
+                          pVirtq->GCPhysVirtqUsed + RT_UOFFSETOF(VIRTQ_EVENT_SUPPRESS_T, fFlags),
+                          &fFlags, sizeof(fFlags));
+}
+#endif
+
+DECLINLINE(uint16_t) virtioReadPackedDescFlags(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq, uint16_t idxSlot)
+{
+    uint16_t fFlags = 0;
+    AssertMsg(pVirtio->fDeviceStatus & VIRTIO_STATUS_DRIVER_OK, ("Called with guest driver not ready\n"));
+    RT_NOREF(pVirtio);
+    uint16_t const cVirtqItems = RT_MAX(pVirtq->uSize, 1); /* Make sure to avoid div-by-zero. */
+    PDMDevHlpPCIPhysRead(pDevIns,
+                         pVirtq->GCPhysVirtqDesc + sizeof(VIRTQ_PACKED_DESC_T) * (idxSlot % cVirtqItems)
+                       + RT_UOFFSETOF(VIRTQ_PACKED_DESC_T, fFlags),
+                         &fFlags, sizeof(fFlags));
+    return fFlags;
+}
+
+DECLINLINE(void) virtioWritePackedDescFlags(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq,
+                                            uint16_t idxSlot, uint16_t fFlags)
+{
+    AssertMsg(pVirtio->fDeviceStatus & VIRTIO_STATUS_DRIVER_OK, ("Called with guest driver not ready\n"));
+    RT_NOREF(pVirtio);
+    uint16_t const cVirtqItems = RT_MAX(pVirtq->uSize, 1); /* Make sure to avoid div-by-zero. */
+    PDMDevHlpPCIPhysWrite(pDevIns,
+                          pVirtq->GCPhysVirtqDesc + sizeof(VIRTQ_PACKED_DESC_T) * (idxSlot % cVirtqItems)
+                        + RT_UOFFSETOF(VIRTQ_PACKED_DESC_T, fFlags),
+                          &fFlags, sizeof(fFlags));
+}
+
+DECLINLINE(void) virtioReadPackedDriverEvent(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq,
+                                             VIRTQ_EVENT_SUPPRESS_T *pEvent)
+{
+    AssertMsg(pVirtio->fDeviceStatus & VIRTIO_STATUS_DRIVER_OK, ("Called with guest driver not ready\n"));
+    RT_NOREF(pVirtio);
+    PDMDevHlpPCIPhysRead(pDevIns, pVirtq->GCPhysVirtqAvail, pEvent, sizeof(*pEvent));
+}
+
+/**
+ * Checks whether a packed virtq descriptor was made available by the driver.
+ *
+ * @returns true if available, false if not.
+ * @param   fFlags          The descriptor flags.
+ * @param   fWrapCounter    The device's driver ring wrap counter.
+ */
+DECLINLINE(bool) virtioPackedDescIsAvail(uint16_t fFlags, bool fWrapCounter)
+{
+    return RT_BOOL(fFlags & VIRTQ_DESC_F_AVAIL) == fWrapCounter
+        && RT_BOOL(fFlags & VIRTQ_DESC_F_USED)  != fWrapCounter;
+}
+
+/**
+ * Advances a packed virtq ring position, flipping the wrap counter when passing
+ * the end of the ring.
+ */
+DECLINLINE(void) virtioPackedAdvance(PVIRTQUEUE pVirtq, uint16_t *pidxSlot, bool *pfWrapCounter, uint16_t cSlots)
+{
+    uint32_t idxSlot = (uint32_t)*pidxSlot + cSlots;
+    if (idxSlot >= pVirtq->uSize)
+    {
+        idxSlot -= pVirtq->uSize;
+        *pfWrapCounter = !*pfWrapCounter;
+    }
+    *pidxSlot = (uint16_t)idxSlot;
+}
+/** @} */
+
+/**
+ * The event index check both ends of a virtq use to decide whether to notify
+ * the other (VirtIO 1.0, section 2.4.7.2, vring_need_event).
+ *
+ * @returns true if @a uEventIdx was passed moving from @a uOldIdx to @a uNewIdx.
+ */
+DECLINLINE(bool) virtioNeedEvent(uint16_t uEventIdx, uint16_t uNewIdx, uint16_t uOldIdx)
+{
+    return (uint16_t)(uNewIdx - uEventIdx - 1) < (uint16_t)(uNewIdx - uOldIdx);
+}
+
+/**
+ * Counts the buffers the driver made available on a packed virtq by walking the
+ * descriptor flags, as there is no avail index to compare against.
+ */
+DECLINLINE(uint16_t) virtioCoreVirtqPackedAvailBufCount(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq)
+{
+    uint16_t idxSlot      = pVirtq->uAvailIdxShadow;
+    bool     fWrapCounter = pVirtq->fAvailWrapCounter;
+    uint16_t cSlots       = 0;
+    uint16_t cBufs        = 0;
+    while (cSlots < pVirtq->uSize)
+    {
+        uint16_t fFlags = virtioReadPackedDescFlags(pDevIns, pVirtio, pVirtq, idxSlot);
+        if (!virtioPackedDescIsAvail(fFlags, fWrapCounter))
+            break;
+        /* Skip the rest of the chain, the driver makes the head available last. */
+        for (;;)
+        {
+            cSlots++;
+            virtioPackedAdvance(pVirtq, &idxSlot, &fWrapCounter, 1);
+            if (!(fFlags & VIRTQ_DESC_F_NEXT) || cSlots >= pVirtq->uSize)
+                break;
+            fFlags = virtioReadPackedDescFlags(pDevIns, pVirtio, pVirtq, idxSlot);
+        }
+        cBufs++;
+    }
+    return cBufs;
+}
 
 DECLINLINE(uint16_t) virtioCoreVirtqAvailBufCount_inline(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq)
 {
+    if (IS_VIRTQ_PACKED(pVirtio))
+    {
+        uint16_t const cBufs = virtioCoreVirtqPackedAvailBufCount(pDevIns, pVirtio, pVirtq);
+        LogFunc(("%s has %u %s (slot=%u wrap=%d)\n", pVirtq->szName, cBufs, cBufs == 1 ? "entry" : "entries",
+                 pVirtq->uAvailIdxShadow, pVirtq->fAvailWrapCounter));
+        return cBufs;
+    }
+
     uint16_t uIdx    = virtioReadAvailRingIdx(pDevIns, pVirtio, pVirtq);
     uint16_t uShadow = pVirtq->uAvailIdxShadow;
 
-    uint16_t uDelta;
-    if (uIdx < uShadow)
-        uDelta = (uIdx + VIRTQ_MAX_ENTRIES) - uShadow;
-    else
-        uDelta = uIdx - uShadow;
+    /* The indexes are free running 16-bit counters, see VirtIO 1.0, section 2.4.6. */
+    uint16_t uDelta = (uint16_t)(uIdx - uShadow);
 
     LogFunc(("%s has %u %s (idx=%u shadow=%u)\n",
         pVirtq->szName, uDelta, uDelta == 1 ? "entry" : "entries",
@@ -299,6 +482,25 @@ DECLINLINE(uint16_t) virtioCoreVirtqAvailBufCount_inline(PPDMDEVINS pDevIns, PVI
 
     return uDelta;
 }
+
+/**
+ * Checks if the avail ring of a virtq is empty.
+ *
+ * For split virtqs the guest's avail index is only re-read once the consumer has
+ * caught up with the last value read, so a burst of buffers costs one index read.
+ * Only the queue's consumer may call this as it updates the cached index.
+ */
+DECLINLINE(bool) virtioCoreVirtqIsEmpty_inline(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq)
+{
+    if (IS_VIRTQ_PACKED(pVirtio))
+        return !virtioPackedDescIsAvail(virtioReadPackedDescFlags(pDevIns, pVirtio, pVirtq, pVirtq->uAvailIdxShadow),
+                                        pVirtq->fAvailWrapCounter);
+
+    if (pVirtq->uAvailIdxCached != pVirtq->uAvailIdxShadow)
+        return false;
+    pVirtq->uAvailIdxCached = virtioReadAvailRingIdx(pDevIns, pVirtio, pVirtq);
+    return pVirtq->uAvailIdxCached == pVirtq->uAvailIdxShadow;
+}
 /**
  * Get count of new (e.g. pending) elements in available ring.
  *
@@ -335,6 +537,7 @@ void virtioCorePrintFeatures(VIRTIOCORE *pVirtio, PCDBGFINFOHLP pHlp)
     {
         { VIRTIO_F_RING_INDIRECT_DESC,      "   RING_INDIRECT_DESC   Driver can use descriptors with VIRTQ_DESC_F_INDIRECT flag set\n" },
         { VIRTIO_F_RING_EVENT_IDX,          "   RING_EVENT_IDX       Enables use_event and avail_event fields described in 2.4.7, 2.4.8\n" },
+        { VIRTIO_F_RING_PACKED,             "   RING_PACKED          Packed virtqueue layout described in VirtIO 1.1, 2.7\n" },
         { VIRTIO_F_VERSION_1,               "   VERSION              Used to detect legacy drivers.\n" },
     };
 
@@ -555,7 +758,12 @@ int virtioCoreR3VirtqAttach(PVIRTIOCORE pVirtio, uint16_t uVirtq, const char *pc
     pVirtq->uVirtq = uVirtq;
     pVirtq->uAvailIdxShadow = 0;
     pVirtq->uUsedIdxShadow  = 0;
-    pVirtq->fUsedRingEvent = false;
+    pVirtq->uAvailIdxCached = 0;
+    pVirtq->uUsedIdxSignalled = 0;
+    pVirtq->fUsedPending    = false;
+    pVirtq->fAvailWrapCounter = true;
+    pVirtq->fUsedWrapCounter  = true;
+    pVirtq->fSuppressNotify = false;
     RTStrCopy(pVirtq->szName, sizeof(pVirtq->szName), pcszName);
     return VINF_SUCCESS;
 }
@@ -570,15 +778,18 @@ void virtioCoreR3VirtqInfo(PPDMDEVINS pDevIns, PCDBGFINFOHLP pHlp, const char *p
     /** @todo add ability to dump physical contents described by any descriptor (using existing VirtIO core API function) */
 //    bool fDump      = pszArgs && (*pszArgs == 'd' || *pszArgs == 'D'); /* "dump" (avail phys descriptor)"
 
-    uint16_t uAvailIdx       = virtioReadAvailRingIdx(pDevIns, pVirtio, pVirtq);
+    bool const fPacked = IS_VIRTQ_PACKED(pVirtio);
+
+    uint16_t uAvailIdx       = fPacked ? pVirtq->uAvailIdxShadow : virtioReadAvailRingIdx(pDevIns, pVirtio, pVirtq);
     uint16_t uAvailIdxShadow = pVirtq->uAvailIdxShadow;
 
-    uint16_t uUsedIdx        = virtioReadUsedRingIdx(pDevIns, pVirtio, pVirtq);
+    uint16_t uUsedIdx        = fPacked ? pVirtq->uUsedIdxShadow : virtioReadUsedRingIdx(pDevIns, pVirtio, pVirtq);
     uint16_t uUsedIdxShadow  = pVirtq->uUsedIdxShadow;
 
     PVIRTQBUF pVirtqBuf = NULL;
 
-    bool fEmpty = IS_VIRTQ_EMPTY(pDevIns, pVirtio, pVirtq);
+    /* Not using IS_VIRTQ_EMPTY here as that updates consumer state. */
+    bool fEmpty = virtioCoreVirtqAvailBufCount_inline(pDevIns, pVirtio, pVirtq) == 0;
 
     LogFunc(("%s, empty = %s\n", pVirtq->szName, fEmpty ? "true" : "false"));
 
@@ -590,13 +801,29 @@ void virtioCoreR3VirtqInfo(PPDMDEVINS pDevIns, PCDBGFINFOHLP pHlp, const char *p
         cReturnSegs = pVirtqBuf->pSgPhysReturn ? pVirtqBuf->pSgPhysReturn->cSegs : 0;
     }
 
-    bool fAvailNoInterrupt   = virtioReadAvailRingFlags(pDevIns, pVirtio, pVirtq) & VIRTQ_AVAIL_F_NO_INTERRUPT;
-    bool fUsedNoNotify       = virtioReadUsedRingFlags(pDevIns, pVirtio, pVirtq) & VIRTQ_USED_F_NO_NOTIFY;
+    bool fAvailNoInterrupt;
+    bool fUsedNoNotify;
+    if (fPacked)
+    {
+        VIRTQ_EVENT_SUPPRESS_T DriverEvent;
+        virtioReadPackedDriverEvent(pDevIns, pVirtio, pVirtq, &DriverEvent);
+        fAvailNoInterrupt = DriverEvent.fFlags == VIRTQ_EVENT_F_DISABLE;
+        fUsedNoNotify     = pVirtq->fSuppressNotify;
+    }
+    else
+    {
+        fAvailNoInterrupt = virtioReadAvailRingFlags(pDevIns, pVirtio, pVirtq) & VIRTQ_AVAIL_F_NO_INTERRUPT;
+        fUsedNoNotify     = virtioReadUsedRingFlags(pDevIns, pVirtio, pVirtq) & VIRTQ_USED_F_NO_NOTIFY;
+    }
 
 
     pHlp->pfnPrintf(pHlp, "       queue enabled: ........... %s\n", pVirtq->uEnable ? "true" : "false");
     pHlp->pfnPrintf(pHlp, "       size: .................... %d\n", pVirtq->uSize);
     pHlp->pfnPrintf(pHlp, "       notify offset: ........... %d\n", pVirtq->uNotifyOffset);
+    pHlp->pfnPrintf(pHlp, "       layout: .................. %s\n", fPacked ? "packed" : "split");
+    if (fPacked)
+        pHlp->pfnPrintf(pHlp, "       wrap counters: ........... avail=%d used=%d\n",
+                        pVirtq->fAvailWrapCounter, pVirtq->fUsedWrapCounter);
     if (pVirtio->fMsiSupport)
         pHlp->pfnPrintf(pHlp, "       MSIX vector: ....... %4.4x\n", pVirtq->uMsix);
     pHlp->pfnPrintf(pHlp, "\n");
@@ -683,6 +910,25 @@ void virtioCoreVirtqEnableNotify(PVIRTIOCORE pVirtio, uint16_t uVirtq, bool fEna
 
     if (pVirtio->fDeviceStatus & VIRTIO_STATUS_DRIVER_OK)
     {
+        pVirtq->fSuppressNotify = !fEnable;
+
+        if (IS_VIRTQ_PACKED(pVirtio))
+        {
+            virtioWritePackedDeviceEventFlags(pVirtio->pDevInsR3, pVirtio, pVirtq,
+                                              fEnable ? VIRTQ_EVENT_F_ENABLE : VIRTQ_EVENT_F_DISABLE);
+            return;
+        }
+
+        if (pVirtio->uDriverFeatures & VIRTIO_F_EVENT_IDX)
+        {
+            /* The driver ignores the flags with event idx.  Disabling just means avail_event stops
+               advancing (see virtioCoreR3VirtqAvailBufGet), enabling asks for a kick on the next
+               buffer made available past our position. */
+            if (fEnable)
+                virtioWriteUsedAvailEvent(pVirtio->pDevInsR3, pVirtio, pVirtq, pVirtq->uAvailIdxShadow);
+            return;
+        }
+
         uint16_t fFlags = virtioReadUsedRingFlags(pVirtio->pDevInsR3, pVirtio, pVirtq);
 
         if (fEnable)
@@ -726,12 +972,178 @@ int virtioCoreR3VirtqAvailBufNext(PVIRTIOCORE pVirtio, uint16_t uVirtq)
         return VERR_NOT_AVAILABLE;
 
     Log6Func(("%s avail shadow idx: %u\n", pVirtq->szName, pVirtq->uAvailIdxShadow));
-    pVirtq->uAvailIdxShadow++;
+    if (IS_VIRTQ_PACKED(pVirtio))
+    {
+        /* Step over all the ring slots taken up by the buffer peeked at. */
+        uint16_t cSlots = 0;
+        uint16_t fFlags;
+        do
+        {
+            fFlags = virtioReadPackedDescFlags(pVirtio->pDevInsR3, pVirtio, pVirtq, pVirtq->uAvailIdxShadow);
+            virtioPackedAdvance(pVirtq, &pVirtq->uAvailIdxShadow, &pVirtq->fAvailWrapCounter, 1);
+        } while ((fFlags & VIRTQ_DESC_F_NEXT) && ++cSlots < pVirtq->uSize);
+    }
+    else
+        pVirtq->uAvailIdxShadow++;
 
     return VINF_SUCCESS;
 }
 
 
+/**
+ * Descriptor chain gathering state.
+ */
+typedef struct VIRTQGATHER
+{
+    uint32_t    cbIn;                   /**< Total size of the IN (device writable) segments. */
+    uint32_t    cbOut;                  /**< Total size of the OUT (device readable) segments. */
+    uint32_t    cSegsIn;                /**< Number of IN segments. */
+    uint32_t    cSegsOut;               /**< Number of OUT segments. */
+} VIRTQGATHER;
+
+/**
+ * Adds the guest buffer described by a descriptor to the IN or OUT segments of
+ * the descriptor chain being gathered.
+ *
+ * Malicious guests may go beyond paSegsIn or paSegsOut boundaries by linking
+ * several descriptors into a loop. Since there is no legitimate way to get a sequences of
+ * linked descriptors exceeding the total number of descriptors in the ring (see @bugref{8620}),
+ * the following aborts I/O if breach and employs a simple log throttling algorithm to notify.
+ *
+ * @returns true if added, false if the chain is too long and gathering must stop.
+ * @param   pDevIns     The device instance.
+ * @param   pVirtq      The virtq the chain belongs to.
+ * @param   pVirtqBuf   The descriptor chain being gathered.
+ * @param   pGather     The gathering state.
+ * @param   GCPhysBuf   The guest buffer address.
+ * @param   cb          The guest buffer size.
+ * @param   fFlags      The descriptor flags (only VIRTQ_DESC_F_WRITE is used).
+ */
+static bool virtioR3VirtqBufAddSeg(PPDMDEVINS pDevIns, PVIRTQUEUE pVirtq, PVIRTQBUF pVirtqBuf, VIRTQGATHER *pGather,
+                                   RTGCPHYS GCPhysBuf, uint32_t cb, uint16_t fFlags)
+{
+    if (pGather->cSegsIn + pGather->cSegsOut >= VIRTQ_MAX_ENTRIES)
+    {
+        static volatile uint32_t s_cMessages  = 0;
+        static volatile uint32_t s_cThreshold = 1;
+        if (ASMAtomicIncU32(&s_cMessages) == ASMAtomicReadU32(&s_cThreshold))
+        {
+            LogRelMax(64, ("Too many linked descriptors; check if the guest arranges descriptors in a loop.\n"));
+            if (ASMAtomicReadU32(&s_cMessages) != 1)
+                LogRelMax(64, ("(the above error has occured %u times so far)\n", ASMAtomicReadU32(&s_cMessages)));
+            ASMAtomicWriteU32(&s_cThreshold, ASMAtomicReadU32(&s_cThreshold) * 10);
+        }
+        return false;
+    }
+    RT_UNTRUSTED_VALIDATED_FENCE();
+
+    PVIRTIOSGSEG pSeg;
+    if (fFlags & VIRTQ_DESC_F_WRITE)
+    {
+        Log6Func(("%s IN  seg=%u addr=%RGp cb=%u\n", pVirtq->szName, pGather->cSegsIn, GCPhysBuf, cb));
+        pGather->cbIn += cb;
+        pSeg = &pVirtqBuf->aSegsIn[pGather->cSegsIn++];
+    }
+    else
+    {
+        Log6Func(("%s OUT seg=%u addr=%RGp cb=%u\n", pVirtq->szName, pGather->cSegsOut, GCPhysBuf, cb));
+        pGather->cbOut += cb;
+        pSeg = &pVirtqBuf->aSegsOut[pGather->cSegsOut++];
+#ifdef DEEP_DEBUG
+        if (LogIs11Enabled())
+        {
+            virtioCoreGCPhysHexDump(pDevIns, GCPhysBuf, cb, 0, NULL);
+            Log(("\n"));
+        }
+#endif
+    }
+
+    pSeg->GCPhys = GCPhysBuf;
+    pSeg->cbSeg  = cb;
+    RT_NOREF(pDevIns, pVirtq);
+    return true;
+}
+
+/**
+ * Adds the descriptors of an indirect descriptor table to the descriptor chain
+ * being gathered (VirtIO 1.0, section 2.4.5.3 and VirtIO 1.1, section 2.7.7).
+ *
+ * The table is fetched with a single guest memory read rather than one read per
+ * descriptor.
+ *
+ * @returns true if gathering may continue, false if the table is bad.
+ * @param   pDevIns     The device instance.
+ * @param   pVirtio     Pointer to the shared virtio state.
+ * @param   pVirtq      The virtq the chain belongs to.
+ * @param   pVirtqBuf   The descriptor chain being gathered.
+ * @param   pGather     The gathering state.
+ * @param   GCPhysTable The guest address of the indirect table.
+ * @param   cbTable     The size of the indirect table.
+ */
+static bool virtioR3VirtqBufAddIndirect(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq, PVIRTQBUF pVirtqBuf,
+                                        VIRTQGATHER *pGather, RTGCPHYS GCPhysTable, uint32_t cbTable)
+{
+    uint32_t const cDescs = cbTable / sizeof(VIRTQ_DESC_T);
+    if (   !(pVirtio->uDriverFeatures & VIRTIO_F_INDIRECT_DESC)
+        || (cbTable % sizeof(VIRTQ_DESC_T))
+        || cDescs == 0
+        || cDescs > VIRTQ_MAX_ENTRIES)
+    {
+        LogRelMax(64, ("%s: Invalid indirect descriptor table %RGp LB %#x on %s\n",
+                       pVirtio->szInstance, GCPhysTable, cbTable, pVirtq->szName));
+        return false;
+    }
+
+    VIRTQ_DESC_T  aDescsStack[VIRTQ_INDIRECT_STACK_DESCS];
+    VIRTQ_DESC_T *paDescs = aDescsStack;
+    if (cDescs > RT_ELEMENTS(aDescsStack))
+    {
+        paDescs = (VIRTQ_DESC_T *)RTMemTmpAlloc(cbTable);
+        AssertReturn(paDescs, false);
+    }
+    PDMDevHlpPCIPhysRead(pDevIns, GCPhysTable, paDescs, cbTable);
+
+    bool fOk = true;
+    if (!IS_VIRTQ_PACKED(pVirtio))
+    {
+        /* Split layout: the table entries are linked by index, just like the descriptor table. */
+        uint32_t idxDesc = 0;
+        for (;;)
+        {
+            VIRTQ_DESC_T const *pDesc = &paDescs[idxDesc];
+            if (pDesc->fFlags & VIRTQ_DESC_F_INDIRECT)
+            {
+                LogRelMax(64, ("%s: Nested indirect descriptor on %s\n", pVirtio->szInstance, pVirtq->szName));
+                fOk = false;
+                break;
+            }
+            fOk = virtioR3VirtqBufAddSeg(pDevIns, pVirtq, pVirtqBuf, pGather, pDesc->GCPhysBuf, pDesc->cb, pDesc->fFlags);
+            if (!fOk || !(pDesc->fFlags & VIRTQ_DESC_F_NEXT))
+                break;
+            idxDesc = pDesc->uDescIdxNext;
+            if (idxDesc >= cDescs)
+            {
+                LogRelMax(64, ("%s: Indirect descriptor index %u out of range on %s\n",
+                               pVirtio->szInstance, idxDesc, pVirtq->szName));
+                fOk = false;
+                break;
+            }
+        }
+    }
+    else
+    {
+        /* Packed layout: the table is used front to back and the next flag is ignored. */
+        PVIRTQ_PACKED_DESC_T paPackedDescs = (PVIRTQ_PACKED_DESC_T)paDescs;
+        for (uint32_t i = 0; i < cDescs && fOk; i++)
+            fOk = virtioR3VirtqBufAddSeg(pDevIns, pVirtq, pVirtqBuf, pGather, paPackedDescs[i].GCPhysBuf,
+                                         paPackedDescs[i].cb, paPackedDescs[i].fFlags);
+    }
+
+    if (paDescs != aDescsStack)
+        RTMemTmpFree(paDescs);
+    return fOk;
+}
+
 /** API Function: See header file */
 int virtioCoreR3VirtqAvailBufGet(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16_t uVirtq,
                              uint16_t uHeadIdx, PPVIRTQBUF ppVirtqBuf)
@@ -747,8 +1159,6 @@ int virtioCoreR3VirtqAvailBufGet(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16
     AssertMsgReturn(IS_DRIVER_OK(pVirtio) && pVirtq->uEnable,
                     ("Guest driver not in ready state.\n"), VERR_INVALID_STATE);
 
-    uint16_t uDescIdx = uHeadIdx;
-
     Log6Func(("%s DESC CHAIN: (head) desc_idx=%u\n", pVirtio->aVirtqueues[uVirtq].szName, uHeadIdx));
 
     /*
@@ -759,97 +1169,82 @@ int virtioCoreR3VirtqAvailBufGet(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16
     pVirtqBuf->u32Magic  = VIRTQBUF_MAGIC;
     pVirtqBuf->cRefs     = 1;
     pVirtqBuf->uHeadIdx  = uHeadIdx;
+    pVirtqBuf->uBufId    = uHeadIdx;
     pVirtqBuf->uVirtq    = uVirtq;
     *ppVirtqBuf = pVirtqBuf;
 
     /*
      * Gather segments.
      */
-    VIRTQ_DESC_T desc;
-
-    uint32_t cbIn     = 0;
-    uint32_t cbOut    = 0;
-    uint32_t cSegsIn  = 0;
-    uint32_t cSegsOut = 0;
+    VIRTQGATHER Gather = { 0, 0, 0, 0 };
 
-    PVIRTIOSGSEG paSegsIn  = pVirtqBuf->aSegsIn;
-    PVIRTIOSGSEG paSegsOut = pVirtqBuf->aSegsOut;
-
-    do
+    if (IS_VIRTQ_PACKED(pVirtio))
     {
-        PVIRTIOSGSEG pSeg;
-
-        /*
-         * Malicious guests may go beyond paSegsIn or paSegsOut boundaries by linking
-         * several descriptors into a loop. Since there is no legitimate way to get a sequences of
-         * linked descriptors exceeding the total number of descriptors in the ring (see @bugref{8620}),
-         * the following aborts I/O if breach and employs a simple log throttling algorithm to notify.
-         */
-        if (cSegsIn + cSegsOut >= VIRTQ_MAX_ENTRIES)
+        /* The chain occupies consecutive ring slots and the buffer ID is in its last descriptor. */
+        VIRTQ_PACKED_DESC_T desc;
+        uint16_t idxSlot = uHeadIdx;
+        uint16_t cDescs  = 0;
+        do
         {
-            static volatile uint32_t s_cMessages  = 0;
-            static volatile uint32_t s_cThreshold = 1;
-            if (ASMAtomicIncU32(&s_cMessages) == ASMAtomicReadU32(&s_cThreshold))
+            virtioReadPackedDesc(pDevIns, pVirtio, pVirtq, idxSlot, &desc);
+            cDescs++;
+            pVirtqBuf->uBufId = desc.uBufId;
+
+            if (desc.fFlags & VIRTQ_DESC_F_INDIRECT)
             {
-                LogRelMax(64, ("Too many linked descriptors; check if the guest arranges descriptors in a loop.\n"));
-                if (ASMAtomicReadU32(&s_cMessages) != 1)
-                    LogRelMax(64, ("(the above error has occured %u times so far)\n", ASMAtomicReadU32(&s_cMessages)));
-                ASMAtomicWriteU32(&s_cThreshold, ASMAtomicReadU32(&s_cThreshold) * 10);
+                virtioR3VirtqBufAddIndirect(pDevIns, pVirtio, pVirtq, pVirtqBuf, &Gather, desc.GCPhysBuf, desc.cb);
+                break;
             }
-            break;
-        }
-        RT_UNTRUSTED_VALIDATED_FENCE();
-
-        virtioReadDesc(pDevIns, pVirtio, pVirtq, uDescIdx, &desc);
+            if (!virtioR3VirtqBufAddSeg(pDevIns, pVirtq, pVirtqBuf, &Gather, desc.GCPhysBuf, desc.cb, desc.fFlags))
+                break;
 
-        if (desc.fFlags & VIRTQ_DESC_F_WRITE)
-        {
-            Log6Func(("%s IN  desc_idx=%u seg=%u addr=%RGp cb=%u\n", pVirtq->szName, uDescIdx, cSegsIn, desc.GCPhysBuf, desc.cb));
-            cbIn += desc.cb;
-            pSeg = &paSegsIn[cSegsIn++];
-        }
-        else
+            idxSlot = idxSlot + 1 < pVirtq->uSize ? idxSlot + 1 : 0;
+        } while ((desc.fFlags & VIRTQ_DESC_F_NEXT) && cDescs < pVirtq->uSize);
+        pVirtqBuf->cDescs = cDescs;
+    }
+    else
+    {
+        VIRTQ_DESC_T desc;
+        uint16_t uDescIdx = uHeadIdx;
+        do
         {
-            Log6Func(("%s OUT desc_idx=%u seg=%u addr=%RGp cb=%u\n", pVirtq->szName, uDescIdx, cSegsOut, desc.GCPhysBuf, desc.cb));
-            cbOut += desc.cb;
-            pSeg = &paSegsOut[cSegsOut++];
-#ifdef DEEP_DEBUG
-            if (LogIs11Enabled())
+            virtioReadDesc(pDevIns, pVirtio, pVirtq, uDescIdx, &desc);
+
+            /* VIRTQ_DESC_F_INDIRECT must not be combined with VIRTQ_DESC_F_NEXT, so this ends the chain. */
+            if (desc.fFlags & VIRTQ_DESC_F_INDIRECT)
             {
-                virtioCoreGCPhysHexDump(pDevIns, desc.GCPhysBuf, desc.cb, 0, NULL);
-                Log(("\n"));
+                virtioR3VirtqBufAddIndirect(pDevIns, pVirtio, pVirtq, pVirtqBuf, &Gather, desc.GCPhysBuf, desc.cb);
+                break;
             }
-#endif
-        }
+            if (!virtioR3VirtqBufAddSeg(pDevIns, pVirtq, pVirtqBuf, &Gather, desc.GCPhysBuf, desc.cb, desc.fFlags))
+                break;
 
-        pSeg->GCPhys = desc.GCPhysBuf;
-        pSeg->cbSeg = desc.cb;
-
-        uDescIdx = desc.uDescIdxNext;
-    } while (desc.fFlags & VIRTQ_DESC_F_NEXT);
+            uDescIdx = desc.uDescIdxNext;
+        } while (desc.fFlags & VIRTQ_DESC_F_NEXT);
+    }
 
     /*
      * Add segments to the descriptor chain structure.
      */
-    if (cSegsIn)
+    if (Gather.cSegsIn)
     {
-        virtioCoreGCPhysChainInit(&pVirtqBuf->SgBufIn, paSegsIn, cSegsIn);
+        virtioCoreGCPhysChainInit(&pVirtqBuf->SgBufIn, pVirtqBuf->aSegsIn, Gather.cSegsIn);
         pVirtqBuf->pSgPhysReturn = &pVirtqBuf->SgBufIn;
-        pVirtqBuf->cbPhysReturn  = cbIn;
-        STAM_REL_COUNTER_ADD(&pVirtio->StatDescChainsSegsIn, cSegsIn);
+        pVirtqBuf->cbPhysReturn  = Gather.cbIn;
+        STAM_REL_COUNTER_ADD(&pVirtio->StatDescChainsSegsIn, Gather.cSegsIn);
     }
 
-    if (cSegsOut)
+    if (Gather.cSegsOut)
     {
-        virtioCoreGCPhysChainInit(&pVirtqBuf->SgBufOut, paSegsOut, cSegsOut);
+        virtioCoreGCPhysChainInit(&pVirtqBuf->SgBufOut, pVirtqBuf->aSegsOut, Gather.cSegsOut);
         pVirtqBuf->pSgPhysSend   = &pVirtqBuf->SgBufOut;
-        pVirtqBuf->cbPhysSend    = cbOut;
-        STAM_REL_COUNTER_ADD(&pVirtio->StatDescChainsSegsOut, cSegsOut);
+        pVirtqBuf->cbPhysSend    = Gather.cbOut;
+        STAM_REL_COUNTER_ADD(&pVirtio->StatDescChainsSegsOut, Gather.cSegsOut);
     }
 
     STAM_REL_COUNTER_INC(&pVirtio->StatDescChainsAllocated);
     Log6Func(("%s -- segs OUT: %u (%u bytes)   IN: %u (%u bytes) --\n",
-        pVirtq->szName, cSegsOut, cbOut, cSegsIn, cbIn));
+        pVirtq->szName, Gather.cSegsOut, Gather.cbOut, Gather.cSegsIn, Gather.cbIn));
 
     return VINF_SUCCESS;
 }
@@ -864,10 +1259,20 @@ int virtioCoreR3VirtqAvailBufGet(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16
     if (IS_VIRTQ_EMPTY(pDevIns, pVirtio, pVirtq))
         return VERR_NOT_AVAILABLE;
 
+    if (IS_VIRTQ_PACKED(pVirtio))
+    {
+        /* The head of a packed virtq buffer is the descriptor at our position in the ring. */
+        int rc = virtioCoreR3VirtqAvailBufGet(pDevIns, pVirtio, uVirtq, pVirtq->uAvailIdxShadow, ppVirtqBuf);
+        if (RT_SUCCESS(rc) && fRemove)
+            virtioPackedAdvance(pVirtq, &pVirtq->uAvailIdxShadow, &pVirtq->fAvailWrapCounter, (*ppVirtqBuf)->cDescs);
+        return rc;
+    }
+
     uint16_t uHeadIdx = virtioReadAvailDescIdx(pDevIns, pVirtio, pVirtq, pVirtq->uAvailIdxShadow);
 
-    if (pVirtio->uDriverFeatures & VIRTIO_F_EVENT_IDX)
-        virtioWriteUsedAvailEvent(pDevIns,pVirtio, pVirtq, pVirtq->uAvailIdxShadow + 1);
+    /* Keep avail_event trailing our position unless the client asked the guest to stop notifying. */
+    if ((pVirtio->uDriverFeatures & VIRTIO_F_EVENT_IDX) && !pVirtq->fSuppressNotify)
+        virtioWriteUsedAvailEvent(pDevIns, pVirtio, pVirtq, pVirtq->uAvailIdxShadow + 1);
 
     if (fRemove)
         pVirtq->uAvailIdxShadow++;
@@ -876,6 +1281,68 @@ int virtioCoreR3VirtqAvailBufGet(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16
     return rc;
 }
 
+/**
+ * Places a used element for the given buffer in the used ring (or the next packed
+ * ring slot) without publishing it; see virtioCoreVirtqUsedRingSync().
+ */
+static void virtioR3VirtqUsedElemPut(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIRTQUEUE pVirtq,
+                                     PVIRTQBUF pVirtqBuf, uint32_t cbTotal)
+{
+    if (IS_VIRTQ_PACKED(pVirtio))
+    {
+        /*
+         * Write the used descriptor into our next used slot, then skip the ring slots the buffer
+         * took up (VirtIO 1.1, section 2.7.8).  The flags of the first descriptor written since the
+         * last virtioCoreVirtqUsedRingSync() call are held back so the whole batch is published at once.
+         */
+        uint16_t fFlags = pVirtq->fUsedWrapCounter ? VIRTQ_DESC_F_AVAIL | VIRTQ_DESC_F_USED : 0;
+        if (cbTotal)
+            fFlags |= VIRTQ_DESC_F_WRITE;
+        virtioWritePackedUsedElem(pDevIns, pVirtio, pVirtq, pVirtq->uUsedIdxShadow, pVirtqBuf->uBufId, cbTotal);
+        if (!pVirtq->fUsedPending)
+        {
+            pVirtq->uUsedPendingIdx   = pVirtq->uUsedIdxShadow;
+            pVirtq->fUsedPendingFlags = fFlags;
+            pVirtq->fUsedPending      = true;
+        }
+        else
+        {
+            ASMWriteFence();
+            virtioWritePackedDescFlags(pDevIns, pVirtio, pVirtq, pVirtq->uUsedIdxShadow, fFlags);
+        }
+        virtioPackedAdvance(pVirtq, &pVirtq->uUsedIdxShadow, &pVirtq->fUsedWrapCounter, RT_MAX(pVirtqBuf->cDescs, 1));
+    }
+    else
+    {
+        /*
+         * Place used buffer's descriptor in used ring but don't update used ring's slot index.
+         * That will be done with a subsequent client call to virtioCoreVirtqUsedRingSync() */
+        virtioWriteUsedElem(pDevIns, pVirtio, pVirtq, pVirtq->uUsedIdxShadow++, pVirtqBuf->uHeadIdx, cbTotal);
+    }
+}
+
+/** API function: See Header file  */
+int virtioCoreR3VirtqUsedBufPutLen(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16_t uVirtq,
+                                   PVIRTQBUF pVirtqBuf, uint32_t cbWritten)
+{
+    Assert(uVirtq < RT_ELEMENTS(pVirtio->aVirtqueues));
+    PVIRTQUEUE pVirtq = &pVirtio->aVirtqueues[uVirtq];
+
+    Assert(pVirtqBuf->u32Magic == VIRTQBUF_MAGIC);
+    Assert(pVirtqBuf->cRefs > 0);
+
+    AssertMsgReturn(IS_DRIVER_OK(pVirtio), ("Guest driver not in ready state.\n"), VERR_INVALID_STATE);
+    AssertMsgReturn(cbWritten <= pVirtqBuf->cbPhysReturn,
+                    ("Used length %u exceeds the %u byte IN buffer\n", cbWritten, pVirtqBuf->cbPhysReturn),
+                    VERR_BUFFER_OVERFLOW);
+
+    virtioR3VirtqUsedElemPut(pDevIns, pVirtio, pVirtq, pVirtqBuf, cbWritten);
+
+    Log6Func(("Write ahead used_idx=%u, %s used_idx=%u (cbWritten=%u)\n", pVirtq->uUsedIdxShadow,
+              VIRTQNAME(pVirtio, uVirtq), virtioReadUsedRingIdx(pDevIns, pVirtio, pVirtq), cbWritten));
+    return VINF_SUCCESS;
+}
+
 /** API function: See Header file  */
 int virtioCoreR3VirtqUsedBufPut(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16_t uVirtq, PRTSGBUF pSgVirtReturn,
                             PVIRTQBUF pVirtqBuf, bool fFence)
@@ -919,15 +1386,7 @@ int virtioCoreR3VirtqUsedBufPut(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16_
         Assert(!(cbCopy >> 32));
     }
 
-    /* If this write-ahead crosses threshold where the driver wants to get an event flag it */
-    if (pVirtio->uDriverFeatures & VIRTIO_F_EVENT_IDX)
-        if (pVirtq->uUsedIdxShadow == virtioReadAvailUsedEvent(pDevIns, pVirtio, pVirtq))
-            pVirtq->fUsedRingEvent = true;
-
-    /*
-     * Place used buffer's descriptor in used ring but don't update used ring's slot index.
-     * That will be done with a subsequent client call to virtioCoreVirtqUsedRingSync() */
-    virtioWriteUsedElem(pDevIns, pVirtio, pVirtq, pVirtq->uUsedIdxShadow++, pVirtqBuf->uHeadIdx, (uint32_t)cbTotal);
+    virtioR3VirtqUsedElemPut(pDevIns, pVirtio, pVirtq, pVirtqBuf, (uint32_t)cbTotal);
 
     if (pSgVirtReturn)
         Log6Func((".... Copied %zu bytes in %d segs to %u byte buffer, residual=%zu\n",
@@ -953,7 +1412,18 @@ int virtioCoreVirtqUsedRingSync(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16_
 
     Log6Func(("Updating %s used_idx to %u\n", pVirtq->szName, pVirtq->uUsedIdxShadow));
 
-    virtioWriteUsedRingIdx(pDevIns, pVirtio, pVirtq, pVirtq->uUsedIdxShadow);
+    if (IS_VIRTQ_PACKED(pVirtio))
+    {
+        /* Publish the used descriptors written ahead by setting the flags of the first one. */
+        if (pVirtq->fUsedPending)
+        {
+            ASMWriteFence();
+            virtioWritePackedDescFlags(pDevIns, pVirtio, pVirtq, pVirtq->uUsedPendingIdx, pVirtq->fUsedPendingFlags);
+            pVirtq->fUsedPending = false;
+        }
+    }
+    else
+        virtioWriteUsedRingIdx(pDevIns, pVirtio, pVirtq, pVirtq->uUsedIdxShadow);
     virtioCoreNotifyGuestDriver(pDevIns, pVirtio, uVirtq);
 
     return VINF_SUCCESS;
@@ -1015,22 +1485,55 @@ static void virtioCoreNotifyGuestDriver(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio,
         return;
     }
 
-    if (pVirtio->uDriverFeatures & VIRTIO_F_EVENT_IDX)
+    if (IS_VIRTQ_PACKED(pVirtio))
     {
-        if (pVirtq->fUsedRingEvent)
+        /* The used descriptors must be visible before looking at the driver event suppression structure. */
+        ASMMemoryFence();
+        VIRTQ_EVENT_SUPPRESS_T DriverEvent;
+        virtioReadPackedDriverEvent(pDevIns, pVirtio, pVirtq, &DriverEvent);
+
+        bool fKick;
+        if (DriverEvent.fFlags == VIRTQ_EVENT_F_DESC && (pVirtio->uDriverFeatures & VIRTIO_F_EVENT_IDX))
+        {
+            /* Express the event offset and the last signalled slot relative to the current lap. */
+            uint16_t const uNew   = pVirtq->uUsedIdxShadow;
+            uint16_t       uOld   = pVirtq->uUsedIdxSignalled;
+            uint16_t       uEvent = DriverEvent.uOffWrap & ~VIRTQ_EVENT_OFF_WRAP_BIT;
+            if (uOld > uNew)
+                uOld = (uint16_t)(uOld - pVirtq->uSize);
+            if (RT_BOOL(DriverEvent.uOffWrap & VIRTQ_EVENT_OFF_WRAP_BIT) != pVirtq->fUsedWrapCounter)
+                uEvent = (uint16_t)(uEvent - pVirtq->uSize);
+            fKick = virtioNeedEvent(uEvent, uNew, uOld);
+        }
+        else
+            fKick = DriverEvent.fFlags != VIRTQ_EVENT_F_DISABLE;
+        pVirtq->uUsedIdxSignalled = pVirtq->uUsedIdxShadow;
+
+        if (fKick)
+        {
+            virtioKick(pDevIns, pVirtio, VIRTIO_ISR_VIRTQ_INTERRUPT, pVirtq->uMsix);
+            return;
+        }
+        Log6Func(("...skipping interrupt for %s (driver event flags %#x off_wrap %#x)\n",
+                  pVirtq->szName, DriverEvent.fFlags, DriverEvent.uOffWrap));
+    }
+    else if (pVirtio->uDriverFeatures & VIRTIO_F_EVENT_IDX)
+    {
+        /* The used idx update must be visible before reading used_event (VirtIO 1.0, section 2.4.7.2). */
+        ASMMemoryFence();
+        uint16_t const uUsedEventIdx = virtioReadAvailUsedEvent(pDevIns, pVirtio, pVirtq);
+        uint16_t const uOldIdx       = pVirtq->uUsedIdxSignalled;
+        pVirtq->uUsedIdxSignalled    = pVirtq->uUsedIdxShadow;
+
+        if (virtioNeedEvent(uUsedEventIdx, pVirtq->uUsedIdxShadow, uOldIdx))
         {
-#ifdef IN_RING3
             Log6Func(("...kicking guest %s, VIRTIO_F_EVENT_IDX set and threshold (%d) reached\n",
-                   pVirtq->szName, (uint16_t)virtioReadAvailUsedEvent(pDevIns, pVirtio, pVirtq)));
-#endif
+                      pVirtq->szName, uUsedEventIdx));
             virtioKick(pDevIns, pVirtio, VIRTIO_ISR_VIRTQ_INTERRUPT, pVirtq->uMsix);
-            pVirtq->fUsedRingEvent = false;
             return;
         }
-#ifdef IN_RING3
         Log6Func(("...skip interrupt %s, VIRTIO_F_EVENT_IDX set but threshold (%d) not reached (%d)\n",
-                   pVirtq->szName,(uint16_t)virtioReadAvailUsedEvent(pDevIns, pVirtio, pVirtq), pVirtq->uUsedIdxShadow));
-#endif
+                  pVirtq->szName, uUsedEventIdx, pVirtq->uUsedIdxShadow));
     }
     else
     {
@@ -1096,7 +1599,12 @@ static void virtioResetVirtq(PVIRTIOCORE pVirtio, uint16_t uVirtq)
     pVirtq->uSize            = VIRTQ_MAX_ENTRIES;
     pVirtq->uNotifyOffset    = uVirtq;
     pVirtq->uMsix            = uVirtq + 2;
-    pVirtq->fUsedRingEvent   = false;
+    pVirtq->uAvailIdxCached  = 0;
+    pVirtq->uUsedIdxSignalled = 0;
+    pVirtq->fUsedPending     = false;
+    pVirtq->fAvailWrapCounter = true;
+    pVirtq->fUsedWrapCounter = true;
+    pVirtq->fSuppressNotify  = false;
 
     if (!pVirtio->fMsiSupport) /* VirtIO 1.0, 4.1.4.3 and 4.1.5.1.2 */
         pVirtq->uMsix = VIRTIO_MSI_NO_VECTOR;
@@ -1254,6 +1762,16 @@ static int virtioCommonCfgAccessed(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, PVIR
             pVirtio->fDeviceStatus = *(uint8_t *)pv;
             bool fDeviceReset = pVirtio->fDeviceStatus == 0;
 
+            /* Refuse FEATURES_OK if the driver accepted features we never offered (VirtIO 1.0, section 3.1.1). */
+            if (   (pVirtio->fDeviceStatus & VIRTIO_STATUS_FEATURES_OK)
+                && !(pVirtio->uPrevDeviceStatus & VIRTIO_STATUS_FEATURES_OK)
+                && (pVirtio->uDriverFeatures & ~pVirtio->uDeviceFeatures))
+            {
+                LogRelMax(16, ("%s: Guest accepted unoffered features %#RX64, refusing FEATURES_OK\n",
+                               pVirtio->szInstance, pVirtio->uDriverFeatures & ~pVirtio->uDeviceFeatures));
+                pVirtio->fDeviceStatus &= ~VIRTIO_STATUS_FEATURES_OK;
+            }
+
             if (LogIs7Enabled())
             {
                 char szOut[80] = { 0 };
@@ -1590,6 +2108,13 @@ int virtioCoreR3SaveExec(PVIRTIOCORE pVirtio, PCPDMDEVHLPR3 pHlp, PSSMHANDLE pSS
         pHlp->pfnSSMPutU16(      pSSM, pVirtq->uSize);
         pHlp->pfnSSMPutU16(      pSSM, pVirtq->uAvailIdxShadow);
         pHlp->pfnSSMPutU16(      pSSM, pVirtq->uUsedIdxShadow);
+        pHlp->pfnSSMPutU16(      pSSM, pVirtq->uUsedIdxSignalled);
+        pHlp->pfnSSMPutU16(      pSSM, pVirtq->uUsedPendingIdx);
+        pHlp->pfnSSMPutU16(      pSSM, pVirtq->fUsedPendingFlags);
+        pHlp->pfnSSMPutBool(     pSSM, pVirtq->fUsedPending);
+        pHlp->pfnSSMPutBool(     pSSM, pVirtq->fAvailWrapCounter);
+        pHlp->pfnSSMPutBool(     pSSM, pVirtq->fUsedWrapCounter);
+        pHlp->pfnSSMPutBool(     pSSM, pVirtq->fSuppressNotify);
         int rc = pHlp->pfnSSMPutMem(pSSM, pVirtq->szName, 32);
         AssertRCReturn(rc, rc);
     }
@@ -1621,7 +2146,8 @@ int virtioCoreR3LoadExec(PVIRTIOCORE pVirtio, PCPDMDEVHLPR3 pHlp, PSSMHANDLE pSS
     uint32_t uVersion = 0;
     rc = pHlp->pfnSSMGetU32(pSSM, &uVersion);
     AssertRCReturn(rc, rc);
-    if (uVersion != VIRTIO_SAVEDSTATE_VERSION)
+    if (   uVersion != VIRTIO_SAVEDSTATE_VERSION
+        && uVersion != VIRTIO_SAVEDSTATE_VERSION_PRE_PACKED)
         return pHlp->pfnSSMSetLoadError(pSSM, VERR_SSM_DATA_UNIT_FORMAT_CHANGED, RT_SRC_POS,
                                         N_("Unsupported virtio version: %u"), uVersion);
     /*
@@ -1650,6 +2176,25 @@ int virtioCoreR3LoadExec(PVIRTIOCORE pVirtio, PCPDMDEVHLPR3 pHlp, PSSMHANDLE pSS
         pHlp->pfnSSMGetU16(      pSSM, &pVirtq->uSize);
         pHlp->pfnSSMGetU16(      pSSM, &pVirtq->uAvailIdxShadow);
         pHlp->pfnSSMGetU16(      pSSM, &pVirtq->uUsedIdxShadow);
+        if (uVersion > VIRTIO_SAVEDSTATE_VERSION_PRE_PACKED)
+        {
+            pHlp->pfnSSMGetU16(  pSSM, &pVirtq->uUsedIdxSignalled);
+            pHlp->pfnSSMGetU16(  pSSM, &pVirtq->uUsedPendingIdx);
+            pHlp->pfnSSMGetU16(  pSSM, &pVirtq->fUsedPendingFlags);
+            pHlp->pfnSSMGetBool( pSSM, &pVirtq->fUsedPending);
+            pHlp->pfnSSMGetBool( pSSM, &pVirtq->fAvailWrapCounter);
+            pHlp->pfnSSMGetBool( pSSM, &pVirtq->fUsedWrapCounter);
+            pHlp->pfnSSMGetBool( pSSM, &pVirtq->fSuppressNotify);
+        }
+        else
+        {
+            pVirtq->uUsedIdxSignalled = pVirtq->uUsedIdxShadow;
+            pVirtq->fUsedPending      = false;
+            pVirtq->fAvailWrapCounter = true;
+            pVirtq->fUsedWrapCounter  = true;
+            pVirtq->fSuppressNotify   = false;
+        }
+        pVirtq->uAvailIdxCached = pVirtq->uAvailIdxShadow; /* Forces a re-read of the guest's avail idx. */
         rc = pHlp->pfnSSMGetMem( pSSM, pVirtq->szName,  sizeof(pVirtq->szName));
         AssertRCReturn(rc, rc);
     }
@@ -97,6 +97,8 @@ typedef struct VIRTQBUF
     uint16_t            pad;
     uint32_t volatile   cRefs;                                   /**< Reference counter.                       */
     uint32_t            uHeadIdx;                                /**< Head idx of associated desc chain        */
+    uint16_t            uBufId;                                  /**< Buffer ID returned in used ring entry    */
+    uint16_t            cDescs;                                  /**< Ring slots consumed (packed virtq only)  */
     size_t              cbPhysSend;                              /**< Total size of src buffer                 */
     PVIRTIOSGBUF        pSgPhysSend;                             /**< Phys S/G buf for data from guest         */
     size_t              cbPhysReturn;                            /**< Total size of dst buffer                 */
@@ -133,8 +135,12 @@ typedef struct VIRTIOPCIPARAMS
 #define VIRTIO_F_EVENT_IDX                  RT_BIT_64(29)        /**< Allow notification disable for n elems    */
 #define VIRTIO_F_RING_INDIRECT_DESC         RT_BIT_64(28)        /**< Doc bug: Goes under two names in spec     */
 #define VIRTIO_F_RING_EVENT_IDX             RT_BIT_64(29)        /**< Doc bug: Goes under two names in spec     */
+#define VIRTIO_F_RING_PACKED                RT_BIT_64(34)        /**< Packed virtq layout (VirtIO 1.1)          */
 
-#define VIRTIO_DEV_INDEPENDENT_FEATURES_OFFERED ( 0 )            /**< TBD: Add VIRTIO_F_INDIRECT_DESC           */
+/** Device independent features always offered by the core. VIRTIO_F_RING_PACKED is only offered
+ *  when the client passes it in fDevSpecificFeatures to virtioCoreR3Init(), because the head index
+ *  of a packed virtq buffer can't be used to re-fetch the buffer once other buffers completed. */
+#define VIRTIO_DEV_INDEPENDENT_FEATURES_OFFERED ( VIRTIO_F_INDIRECT_DESC | VIRTIO_F_EVENT_IDX )
 
 #define VIRTIO_ISR_VIRTQ_INTERRUPT           RT_BIT_32(0)        /**< Virtq interrupt bit of ISR register       */
 #define VIRTIO_ISR_DEVICE_CONFIG             RT_BIT_32(1)        /**< Device configuration changed bit of ISR   */
@@ -252,8 +258,14 @@ typedef struct VIRTQUEUE
     uint16_t                    uUsedIdxShadow;                   /**< Consumer's position in used ring          */
     uint16_t                    uVirtq;                           /**< Index of this queue                       */
     char                        szName[32];                       /**< Dev-specific name of queue                */
-    bool                        fUsedRingEvent;                   /**< Flags if used idx to notify guest reached */
-    uint8_t                     padding[3];
+    uint16_t                    uAvailIdxCached;                  /**< Last avail idx read from guest (split)    */
+    uint16_t                    uUsedIdxSignalled;                /**< Used idx when guest was last interrupted  */
+    uint16_t                    uUsedPendingIdx;                  /**< Packed: slot of unpublished used desc     */
+    uint16_t                    fUsedPendingFlags;                /**< Packed: flags to publish for that slot    */
+    bool                        fUsedPending;                     /**< Packed: used descs written ahead of sync  */
+    bool                        fAvailWrapCounter;                /**< Packed: driver ring wrap counter          */
+    bool                        fUsedWrapCounter;                 /**< Packed: device ring wrap counter          */
+    bool                        fSuppressNotify;                  /**< Device asked guest not to notify          */
 } VIRTQUEUE, *PVIRTQUEUE;
 
 /**
@@ -417,7 +429,7 @@ typedef CTX_SUFF(VIRTIOCORE) VIRTIOCORECC;
  * @param   pPciParams              Values to populate industry standard PCI Configuration Space data structure
  * @param   pcszInstance            Device instance name (format-specifier)
  * @param   fDevSpecificFeatures    VirtIO device-specific features offered by
- *                                  client
+ *                                  client, optionally including VIRTIO_F_RING_PACKED
  * @param   cbDevSpecificCfg        Size of virtio_pci_device_cap device-specific struct
  * @param   pvDevSpecificCfg        Address of client's dev-specific
  *                                  configuration struct.
@@ -470,7 +482,9 @@ void  virtioCoreVirtqEnable(PVIRTIOCORE pVirtio, uint16_t uVirtqNbr, bool fEnabl
  *
  * Note: In the VirtIO world, the device sets flags in the used ring to communicate to the driver how to
  * handle notifications for the avail ring and the drivers sets flags in the avail ring to communicate
- * to the device how to handle sending interrupts for the used ring.
+ * to the device how to handle sending interrupts for the used ring.  When VIRTIO_F_EVENT_IDX was
+ * negotiated the avail_event index is used instead, and for packed virtqs the device event
+ * suppression structure is.
  *
  * @param   pVirtio     Pointer to the shared virtio state.
  * @param   uVirtqNbr   Virtq number
@@ -581,6 +595,10 @@ int  virtioCoreR3VirtqAvailBufGet(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint1
  * The caller is responsible for GCPhys to host virtual memory conversions and *must*
  * return the virtq buffer using virtioCoreR3VirtqUsedBufPut() to complete the roundtrip
  * virtq transaction.
+ *
+ * @note For packed virtqs @a uHeadIdx is the ring slot of the first descriptor, which the
+ *       device overwrites with used descriptors, so buffers can only be re-fetched this way
+ *       with split virtqs.
  * *
  * @param   pDevIns     The device instance.
  * @param   pVirtio     Pointer to the shared virtio state.
@@ -639,6 +657,26 @@ int virtioCoreR3VirtqAvailBufGet(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16
  */
 int virtioCoreR3VirtqUsedBufPut(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16_t uVirtqNbr, PRTSGBUF pSgVirtReturn,
                                  PVIRTQBUF pVirtqBuf, bool fFence);
+
+/**
+ * Variant of virtioCoreR3VirtqUsedBufPut() for devices which have already written
+ * the IN data straight into the buffer's guest physical segments (virtio-blk puts
+ * its status byte after the data, so it cannot be returned as one leading S/G copy).
+ *
+ * @param   pDevIns         The device instance.
+ * @param   pVirtio         Pointer to the shared virtio state.
+ * @param   uVirtqNbr       Virtq number
+ * @param   pVirtqBuf       The buffer originally pulled from the queue.
+ * @param   cbWritten       Number of bytes the device wrote to the IN segments,
+ *                          reported to the guest as the used length.
+ *
+ * @returns VBox status code.
+ * @retval  VINF_SUCCESS         Success
+ * @retval  VERR_INVALID_STATE   VirtIO not in ready state
+ * @retval  VERR_BUFFER_OVERFLOW cbWritten exceeds the IN buffer size.
+ */
+int virtioCoreR3VirtqUsedBufPutLen(PPDMDEVINS pDevIns, PVIRTIOCORE pVirtio, uint16_t uVirtqNbr,
+                                   PVIRTQBUF pVirtqBuf, uint32_t cbWritten);
 /**
  * Advance index of avail ring to next entry in specified virtq (see virtioCoreR3VirtqAvailBufPeek())
  *
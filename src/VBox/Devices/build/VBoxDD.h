@@ -92,6 +92,9 @@ extern const PDMDEVREG g_DeviceNVMe;
 #ifdef VBOX_WITH_VIRTIO_SCSI
 extern const PDMDEVREG g_DeviceVirtioSCSI;
 #endif
+#ifdef VBOX_WITH_VIRTIO_BLK
+extern const PDMDEVREG g_DeviceVirtioBlk;
+#endif
 #ifdef VBOX_WITH_EFI
 extern const PDMDEVREG g_DeviceEFI;
 #endif
@@ -100,6 +100,9 @@ static PCPDMDEVREGR0 g_apVBoxDDR0DevRegs[] =
 #ifdef VBOX_WITH_VIRTIO_SCSI
     &g_DeviceVirtioSCSI,
 #endif
+#ifdef VBOX_WITH_VIRTIO_BLK
+    &g_DeviceVirtioBlk,
+#endif
 #ifdef VBOX_WITH_PCI_PASSTHROUGH_IMPL
     &g_DevicePciRaw,
 #endif
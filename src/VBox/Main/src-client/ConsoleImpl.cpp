@@ -9541,6 +9541,11 @@ HRESULT Console::i_attachToTapInterface(INetworkAdapter *networkAdapter)
             Utf8Str str(tapDeviceName);
             RTStrCopy(IfReq.ifr_name, sizeof(IfReq.ifr_name), str.c_str()); /** @todo bitch about names which are too long... */
             IfReq.ifr_flags = IFF_TAP | IFF_NO_PI;
+            /* Let the TAP driver pass checksum and segmentation offloading through if possible. */
+            unsigned int fTunFeatures = 0;
+            if (   ioctl(RTFileToNative(maTapFD[slot]), TUNGETFEATURES, &fTunFeatures) == 0
+                && (fTunFeatures & IFF_VNET_HDR))
+                IfReq.ifr_flags |= IFF_VNET_HDR;
             vrc = ioctl(RTFileToNative(maTapFD[slot]), TUNSETIFF, &IfReq);
             if (vrc != 0)
             {
@@ -39,7 +39,8 @@
  * even more.
  *
  * The first implementation will only make use of the basic features and more advanced features
- * will be added later.
+ * will be added later. Fixed file sets and kernel side polling of the submission queue can be
+ * enabled with RTIOQUEUE_F_FIXED_HANDLES and RTIOQUEUE_F_SQ_POLL when creating the queue.
  * The adept developer probably noticed that the public IPRT I/O queue API resembles the io_uring
  * interface in many aspects. This is not by accident but to reduce our own overhead as much as possible
  * while still keeping a consistent platform independent API which allows efficient implementations on
@@ -90,6 +91,11 @@
 /** eventfd2() syscall not associated with io_uring but used for kicking waiters. */
 #define LNX_SYSCALL_EVENTFD2           19
 
+/** Number of slots in the fixed file table registered with the ring. */
+#define RTIOQUEUE_LNX_FIXED_FILES_MAX  64
+/** Milliseconds the kernel side SQ polling thread spins before going to sleep. */
+#define RTIOQUEUE_LNX_SQPOLL_IDLE_MS   50
+
 
 /*********************************************************************************************************************************
 *   Structures and Typedefs                                                                                                      *
@@ -252,6 +258,23 @@ typedef LNXIOURINGPARAMS *PLNXIOURINGPARAMS;
 typedef const LNXIOURINGPARAMS *PCLNXIOURINGPARAMS;
 
 
+/**
+ * Linux io_uring fixed file set update passed to io_uring_register().
+ */
+typedef struct LNXIOURINGFILESUPDATE
+{
+    /** Index of the first slot in the fixed file table to update. */
+    uint32_t                    u32Off;
+    /** Reserved. */
+    uint32_t                    u32Rsvd0;
+    /** Pointer to the array of file descriptors to put into the table, -1 clears a slot. */
+    uint64_t                    u64PtrFds;
+} LNXIOURINGFILESUPDATE;
+AssertCompileSize(LNXIOURINGFILESUPDATE, 16);
+/** Pointer to a Linux io_uring fixed file set update. */
+typedef LNXIOURINGFILESUPDATE *PLNXIOURINGFILESUPDATE;
+
+
 /**
  * @name LNXIOURINGSQE::u8Opc defined opcodes.
  * @{ */
@@ -357,6 +380,8 @@ typedef const LNXIOURINGPARAMS *PCLNXIOURINGPARAMS;
 #define LNX_IOURING_REGISTER_OPC_EVENTFD_REGISTER   4
 /** Unregisters an eventfd registered previously. */
 #define LNX_IOURING_REGISTER_OPC_EVENTFD_UNREGISTER 5
+/** Updates slots of a fixed set of files registered previously (5.5+). */
+#define LNX_IOURING_REGISTER_OPC_FILES_UPDATE       6
 /** @} */
 
 
@@ -439,6 +464,12 @@ typedef struct RTIOQUEUEPROVINT
     size_t                      cbMMapSqes;
     /** Flag whether the waiter was woken up externally. */
     volatile bool               fExtIntr;
+    /** Flag whether the kernel polls the submission queue (SQPOLL). */
+    bool                        fSqPoll;
+    /** Number of slots in the fixed file table, 0 if fixed files are not used. */
+    uint32_t                    cFixedFiles;
+    /** The fixed file table mirroring the kernel one, unused slots are -1. */
+    int32_t                     aiFdFixed[RTIOQUEUE_LNX_FIXED_FILES_MAX];
 } RTIOQUEUEPROVINT;
 /** Pointer to the internal I/O queue provider instance data. */
 typedef RTIOQUEUEPROVINT *PRTIOQUEUEPROVINT;
@@ -600,6 +631,69 @@ static void rtIoQueueLnxIoURingFileProvCqCheck(PRTIOQUEUEPROVINT pThis, PRTIOQUE
 }
 
 
+/**
+ * Looks up the fixed file table slot for the given file descriptor.
+ *
+ * @returns Slot index or UINT32_MAX if the descriptor is not in the fixed file table.
+ * @param   pThis               The provider instance.
+ * @param   iFd                 The file descriptor to look for.
+ */
+DECLINLINE(uint32_t) rtIoQueueLnxIoURingFileProvFixedFileLookup(PRTIOQUEUEPROVINT pThis, int32_t iFd)
+{
+    for (uint32_t i = 0; i < pThis->cFixedFiles; i++)
+        if (pThis->aiFdFixed[i] == iFd)
+            return i;
+
+    return UINT32_MAX;
+}
+
+
+/**
+ * Replaces the descriptor in the given fixed file table slot.
+ *
+ * @returns IPRT status code.
+ * @param   pThis               The provider instance.
+ * @param   idxSlot             The slot to update.
+ * @param   iFd                 The new descriptor, -1 to clear the slot.
+ */
+static int rtIoQueueLnxIoURingFileProvFixedFileUpdate(PRTIOQUEUEPROVINT pThis, uint32_t idxSlot, int32_t iFd)
+{
+    LNXIOURINGFILESUPDATE FilesUpdate;
+    RT_ZERO(FilesUpdate);
+
+    FilesUpdate.u32Off    = idxSlot;
+    FilesUpdate.u64PtrFds = (uint64_t)(uintptr_t)&iFd;
+    int rc = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_FILES_UPDATE,
+                                         &FilesUpdate, 1 /*cArgs*/);
+    if (RT_SUCCESS(rc))
+        pThis->aiFdFixed[idxSlot] = iFd;
+
+    return rc;
+}
+
+
+/**
+ * Registers an empty fixed file table with the ring which gets filled as handles
+ * get registered.
+ *
+ * @returns IPRT status code.
+ * @param   pThis               The provider instance.
+ */
+static int rtIoQueueLnxIoURingFileProvFixedFilesInit(PRTIOQUEUEPROVINT pThis)
+{
+    for (uint32_t i = 0; i < RT_ELEMENTS(pThis->aiFdFixed); i++)
+        pThis->aiFdFixed[i] = -1;
+
+    /* Sparse tables (-1 entries) and updates require kernel 5.5+. */
+    int rc = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_FILES_REGISTER,
+                                         &pThis->aiFdFixed[0], RT_ELEMENTS(pThis->aiFdFixed));
+    if (RT_SUCCESS(rc))
+        pThis->cFixedFiles = RT_ELEMENTS(pThis->aiFdFixed);
+
+    return rc;
+}
+
+
 /** @interface_method_impl{RTIOQUEUEPROVVTABLE,pfnIsSupported} */
 static DECLCALLBACK(bool) rtIoQueueLnxIoURingFileProv_IsSupported(void)
 {
@@ -641,7 +735,7 @@ static DECLCALLBACK(bool) rtIoQueueLnxIoURingFileProv_IsSupported(void)
 static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_QueueInit(RTIOQUEUEPROV hIoQueueProv, uint32_t fFlags,
                                                                uint32_t cSqEntries, uint32_t cCqEntries)
 {
-    RT_NOREF(fFlags, cCqEntries);
+    RT_NOREF(cCqEntries);
 
     PRTIOQUEUEPROVINT pThis = hIoQueueProv;
     LNXIOURINGPARAMS Params;
@@ -649,6 +743,14 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_QueueInit(RTIOQUEUEPROV hIo
 
     pThis->cSqesToCommit = 0;
     pThis->fExtIntr      = false;
+    pThis->fSqPoll       = RT_BOOL(fFlags & RTIOQUEUE_F_SQ_POLL);
+    pThis->cFixedFiles   = 0;
+
+    if (pThis->fSqPoll)
+    {
+        Params.u32Flags        = LNX_IOURING_SETUP_F_SQPOLL;
+        Params.u32SqPollIdleMs = RTIOQUEUE_LNX_SQPOLL_IDLE_MS;
+    }
 
     int rc = rtIoQueueLnxIoURingSetup(cSqEntries, &Params, &pThis->iFdIoCtx);
     if (RT_SUCCESS(rc))
@@ -695,7 +797,19 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_QueueInit(RTIOQUEUEPROV hIo
                                 pThis->Cq.fRingMask = *(uint32_t *)(pbTmp + Params.CqOffsets.u32OffRingMask);
                                 pThis->Cq.cEntries  = *(uint32_t *)(pbTmp + Params.CqOffsets.u32OffRingEntries);
                                 pThis->Cq.paCqes    = (PLNXIOURINGCQE)(pbTmp + Params.CqOffsets.u32OffCqes);
-                                return VINF_SUCCESS;
+
+                                /*
+                                 * Kernels before 5.11 only accept fixed files for requests when the
+                                 * submission queue is polled by the kernel, so always use them in that case.
+                                 */
+                                if (!(fFlags & (RTIOQUEUE_F_FIXED_HANDLES | RTIOQUEUE_F_SQ_POLL)))
+                                    return VINF_SUCCESS;
+
+                                rc = rtIoQueueLnxIoURingFileProvFixedFilesInit(pThis);
+                                if (RT_SUCCESS(rc))
+                                    return VINF_SUCCESS;
+
+                                munmap(pThis->pvMMapSqes, pThis->cbMMapSqes);
                             }
 
                             munmap(pThis->pvMMapCqRing, pThis->cbMMapCqRing);
@@ -704,8 +818,8 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_QueueInit(RTIOQUEUEPROV hIo
                         munmap(pThis->pvMMapSqRing, pThis->cbMMapSqRing);
                     }
 
-                    rc = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_EVENTFD_UNREGISTER, NULL, 0);
-                    AssertRC(rc);
+                    int rc2 = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_EVENTFD_UNREGISTER, NULL, 0);
+                    AssertRC(rc2);
                 }
 
                 close(pThis->iFdEvt);
@@ -733,6 +847,12 @@ static DECLCALLBACK(void) rtIoQueueLnxIoURingFileProv_QueueDestroy(RTIOQUEUEPROV
     int rc = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_EVENTFD_UNREGISTER, NULL, 0);
     AssertRC(rc);
 
+    if (pThis->cFixedFiles)
+    {
+        rc = rtIoQueueLnxIoURingRegister(pThis->iFdIoCtx, LNX_IOURING_REGISTER_OPC_FILES_UNREGISTER, NULL, 0);
+        AssertRC(rc);
+    }
+
     close(pThis->iFdEvt);
     close(pThis->iFdIoCtx);
     RTMemFree(pThis->paIoVecs);
@@ -744,17 +864,39 @@ static DECLCALLBACK(void) rtIoQueueLnxIoURingFileProv_QueueDestroy(RTIOQUEUEPROV
 /** @interface_method_impl{RTIOQUEUEPROVVTABLE,pfnHandleRegister} */
 static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_HandleRegister(RTIOQUEUEPROV hIoQueueProv, PCRTHANDLE pHandle)
 {
-    RT_NOREF(hIoQueueProv, pHandle);
-    /** @todo Add support for fixed file sets later. */
-    return VINF_SUCCESS;
+    PRTIOQUEUEPROVINT pThis = hIoQueueProv;
+
+    if (!pThis->cFixedFiles)
+        return VINF_SUCCESS;
+
+    int rc = VINF_SUCCESS;
+    uint32_t idxSlot = rtIoQueueLnxIoURingFileProvFixedFileLookup(pThis, -1);
+    if (idxSlot != UINT32_MAX)
+        rc = rtIoQueueLnxIoURingFileProvFixedFileUpdate(pThis, idxSlot, (int32_t)RTFileToNative(pHandle->u.hFile));
+    else
+        rc = VERR_OUT_OF_RESOURCES;
+
+    /* Without SQ polling the handle can still be used the ordinary way. */
+    if (   RT_FAILURE(rc)
+        && !pThis->fSqPoll)
+        rc = VINF_SUCCESS;
+
+    return rc;
 }
 
 
 /** @interface_method_impl{RTIOQUEUEPROVVTABLE,pfnHandleDeregister} */
 static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_HandleDeregister(RTIOQUEUEPROV hIoQueueProv, PCRTHANDLE pHandle)
 {
-    RT_NOREF(hIoQueueProv, pHandle);
-    /** @todo Add support for fixed file sets later. */
+    PRTIOQUEUEPROVINT pThis = hIoQueueProv;
+
+    if (!pThis->cFixedFiles)
+        return VINF_SUCCESS;
+
+    uint32_t idxSlot = rtIoQueueLnxIoURingFileProvFixedFileLookup(pThis, (int32_t)RTFileToNative(pHandle->u.hFile));
+    if (idxSlot != UINT32_MAX)
+        return rtIoQueueLnxIoURingFileProvFixedFileUpdate(pThis, idxSlot, -1);
+
     return VINF_SUCCESS;
 }
 
@@ -774,9 +916,20 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_ReqPrepare(RTIOQUEUEPROV hI
     pIoVec->iov_base = pvBuf;
     pIoVec->iov_len  = cbBuf;
 
-    pSqe->u8Flags         = 0;
+    int32_t iFd = (int32_t)RTFileToNative(pHandle->u.hFile);
+    uint32_t idxFixed = rtIoQueueLnxIoURingFileProvFixedFileLookup(pThis, iFd);
+    if (idxFixed != UINT32_MAX)
+    {
+        pSqe->u8Flags = LNX_IOURING_SQE_F_FIXED_FILE;
+        pSqe->i32Fd   = (int32_t)idxFixed;
+    }
+    else
+    {
+        pSqe->u8Flags = 0;
+        pSqe->i32Fd   = iFd;
+    }
+
     pSqe->u16IoPrio       = 0;
-    pSqe->i32Fd           = (int32_t)RTFileToNative(pHandle->u.hFile);
     pSqe->u64OffStart     = off;
     pSqe->u64AddrBufIoVec = (uint64_t)(uintptr_t)pIoVec;
     pSqe->u64User         = (uint64_t)(uintptr_t)pvUser;
@@ -816,7 +969,16 @@ static DECLCALLBACK(int) rtIoQueueLnxIoURingFileProv_Commit(RTIOQUEUEPROV hIoQue
     ASMAtomicWriteU32(pThis->Sq.pidxTail, pThis->idxSqTail);
     ASMWriteFence();
 
-    int rc = rtIoQueueLnxIoURingEnter(pThis->iFdIoCtx, pThis->cSqesToCommit, 0, 0 /*fFlags*/);
+    int rc = VINF_SUCCESS;
+    if (pThis->fSqPoll)
+    {
+        /* The kernel thread picks up the new entries on its own unless it went to sleep. */
+        ASMReadFence();
+        if (ASMAtomicReadU32(pThis->Sq.pfFlags) & LNX_IOURING_SQ_RING_F_NEED_WAKEUP)
+            rc = rtIoQueueLnxIoURingEnter(pThis->iFdIoCtx, 0, 0, LNX_IOURING_ENTER_F_SQ_WAKEUP);
+    }
+    else
+        rc = rtIoQueueLnxIoURingEnter(pThis->iFdIoCtx, pThis->cSqesToCommit, 0, 0 /*fFlags*/);
     if (RT_SUCCESS(rc))
     {
         *pcReqsCommitted = pThis->cSqesToCommit;
@@ -72,6 +72,15 @@ DECLINLINE(void) rtMemPagePosixApplyFlags(void *pv, size_t cb, uint32_t fFlags)
         NOREF(rc);
     }
 # endif
+
+# ifdef MADV_HUGEPAGE
+    if (fFlags & RTMEMPAGEALLOC_F_ADVISE_LARGE_PAGES)
+    {
+        /* Fails if transparent huge pages are disabled, which is fine. */
+        int rc = madvise(pv, cb, MADV_HUGEPAGE);
+        NOREF(rc);
+    }
+# endif
 #endif
 
     if (fFlags & RTMEMPAGEALLOC_F_ZERO)
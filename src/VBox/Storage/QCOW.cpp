@@ -30,6 +30,7 @@
 #include <iprt/alloc.h>
 #include <iprt/path.h>
 #include <iprt/list.h>
+#include <iprt/avl.h>
 #include <iprt/zip.h>
 
 #include "VDBackends.h"
@@ -43,8 +44,14 @@
  * For version 1 there is no official specification available but the format is described
  * at http://people.gnome.org/~markmc/qcow-image-format-version-1.html.
  *
+ * L2 tables are kept in a LRU cache which is sized according to the image size
+ * (enough to map the whole image up to a limit) unless the L2CacheSize config
+ * key overrides it. For v2/v3 images with 16bit reference counts the refcounts of
+ * newly allocated clusters are updated through a small write back cache of
+ * refcount blocks which gets written on flush.
+ *
  * Missing things to implement:
- *    - v2 image creation and handling of the reference count table. (Blocker to enable support for V2 images)
+ *    - v2 image creation and growing the reference count table.
  *    - cluster encryption
  *    - cluster compression
  *    - compaction
@@ -182,8 +189,8 @@ typedef QCowHeader *PQCowHeader;
  */
 typedef struct QCOWL2CACHEENTRY
 {
-    /** List node for the search list. */
-    RTLISTNODE              NodeSearch;
+    /** AVL tree node for searching, the key is the L2 table offset. */
+    AVLU64NODECORE          Core;
     /** List node for the LRU list. */
     RTLISTNODE              NodeLru;
     /** Reference counter. */
@@ -194,8 +201,35 @@ typedef struct QCOWL2CACHEENTRY
     uint64_t               *paL2Tbl;
 } QCOWL2CACHEENTRY, *PQCOWL2CACHEENTRY;
 
-/** Maximum amount of memory the cache is allowed to use. */
-#define QCOW_L2_CACHE_MEMORY_MAX (2*_1M)
+/** Minimum amount of memory the L2 cache uses if the size is determined automatically. */
+#define QCOW_L2_CACHE_MEMORY_MIN      (2*_1M)
+/** Maximum amount of memory the L2 cache uses if the size is determined automatically. */
+#define QCOW_L2_CACHE_MEMORY_AUTO_MAX (32*_1M)
+/** Maximum amount of memory the L2 cache is allowed to use when configured explicitly. */
+#define QCOW_L2_CACHE_MEMORY_MAX      (_1G)
+/** Minimum number of L2 tables the cache can hold. */
+#define QCOW_L2_CACHE_ENTRIES_MIN     (4)
+
+/**
+ * QCOW refcount block cache entry.
+ */
+typedef struct QCOWREFCOUNTBLKCACHEENTRY
+{
+    /** Index of the refcount block in the refcount table, UINT32_MAX if the entry is unused. */
+    uint32_t                idxRefcountTbl;
+    /** Flag whether the block was modified and needs to be written back. */
+    bool                    fDirty;
+    /** Last use stamp for LRU eviction. */
+    uint64_t                uLastUse;
+    /** The refcount block (in image endianess). */
+    uint16_t               *pau16Refcounts;
+} QCOWREFCOUNTBLKCACHEENTRY, *PQCOWREFCOUNTBLKCACHEENTRY;
+
+/** Number of refcount blocks cached, allocations are always at the end of the image
+ * so there is no need to keep more than a few. */
+#define QCOW_REFCOUNT_CACHE_ENTRIES   (4)
+/** The only refcount order (16bit refcounts) updated during cluster allocation. */
+#define QCOW_REFCOUNT_ORDER_DEFAULT   (4)
 
 /** QCOW default cluster size for image version 2. */
 #define QCOW2_CLUSTER_SIZE_DEFAULT (64*_1K)
@@ -273,10 +307,18 @@ typedef struct QCOWIMAGE
     uint32_t            cL2TableEntries;
     /** Memory occupied by the L2 table cache. */
     size_t              cbL2Cache;
-    /** The sorted L2 entry list used for searching. */
-    RTLISTNODE          ListSearch;
+    /** Maximum amount of memory the L2 table cache may occupy. */
+    size_t              cbL2CacheMax;
+    /** The AVL tree of cached L2 tables used for searching. */
+    AVLU64TREE          L2TblTree;
     /** The LRU L2 entry list used for eviction. */
     RTLISTNODE          ListLru;
+    /** Number of L2 table lookups served from the cache. */
+    uint64_t            cL2CacheHits;
+    /** Number of L2 table lookups which had to read the table from the image. */
+    uint64_t            cL2CacheMisses;
+    /** Number of L2 tables evicted from the cache. */
+    uint64_t            cL2CacheEvictions;
 
     /** Offset of the refcount table. */
     uint64_t            offRefcountTable;
@@ -286,6 +328,22 @@ typedef struct QCOWIMAGE
     uint32_t            cRefcountTableEntries;
     /** Pointer to the refcount table. */
     uint64_t           *paRefcountTable;
+    /** Flag whether the refcount table was modified and needs to be written back. */
+    bool                fRefcountTableDirty;
+    /** Flag whether refcounts are updated when allocating clusters. */
+    bool                fRefcountUpdate;
+    /** Number of refcount entries in a refcount block. */
+    uint32_t            cRefcountBlkEntries;
+    /** Number of bits to shift a cluster index to get the refcount table index. */
+    uint32_t            cRefcountTblShift;
+    /** Use counter for the refcount block cache LRU. */
+    uint64_t            uRefcountBlkUse;
+    /** Number of refcount block lookups served from the cache. */
+    uint64_t            cRefcountBlkHits;
+    /** Number of refcount block lookups which had to read the block from the image. */
+    uint64_t            cRefcountBlkMisses;
+    /** The refcount block cache. */
+    QCOWREFCOUNTBLKCACHEENTRY aRefcountBlks[QCOW_REFCOUNT_CACHE_ENTRIES];
 
     /** Offset mask for a cluster. */
     uint64_t            fOffsetMask;
@@ -344,6 +402,8 @@ typedef struct QCOWCLUSTERASYNCALLOC
     uint32_t                   idxL2;
     /** Start offset of the allocated cluster. */
     uint64_t                   offClusterNew;
+    /** Start offset of the user data cluster allocated together with a new L2 table. */
+    uint64_t                   offDataNew;
     /** L2 cache entry if a L2 table is allocated. */
     PQCOWL2CACHEENTRY          pL2Entry;
     /** Number of bytes to write. */
@@ -355,6 +415,13 @@ typedef struct QCOWCLUSTERASYNCALLOC
 *   Static Variables                                                                                                             *
 *********************************************************************************************************************************/
 
+/** Configuration keys, the L2 cache size is determined from the image size if not given. */
+static const VDCONFIGINFO s_aQCowConfigInfo[] =
+{
+    { "L2CacheSize",          NULL,                                      VDCFGVALUETYPE_INTEGER, VD_CFGKEY_EXPERT },
+    { NULL,                   NULL,                                      VDCFGVALUETYPE_INTEGER, 0 }
+};
+
 /** NULL-terminated array of supported file extensions. */
 static const VDFILEEXTENSION s_aQCowFileExtensions[] =
 {
@@ -529,13 +596,57 @@ static void qcowTableConvertFromHostEndianess(uint64_t *paTblImg, uint64_t *paTb
  */
 static int qcowL2TblCacheCreate(PQCOWIMAGE pImage)
 {
-    pImage->cbL2Cache = 0;
-    RTListInit(&pImage->ListSearch);
+    pImage->cbL2Cache         = 0;
+    pImage->cbL2CacheMax      = QCOW_L2_CACHE_MEMORY_MIN;
+    pImage->L2TblTree         = NULL;
+    pImage->cL2CacheHits      = 0;
+    pImage->cL2CacheMisses    = 0;
+    pImage->cL2CacheEvictions = 0;
     RTListInit(&pImage->ListLru);
 
     return VINF_SUCCESS;
 }
 
+/**
+ * Determines the maximum size of the L2 table cache once the image geometry is known.
+ *
+ * Without an explicit L2CacheSize config value the cache is made big enough to hold
+ * every L2 table of the image, clamped to QCOW_L2_CACHE_MEMORY_MIN and
+ * QCOW_L2_CACHE_MEMORY_AUTO_MAX. Big images under random I/O would otherwise
+ * read a L2 table from the image for almost every guest request.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image instance data.
+ */
+static int qcowL2TblCacheSizeInit(PQCOWIMAGE pImage)
+{
+    uint64_t cbL2CacheMax = 0;
+    int rc = VINF_SUCCESS;
+
+    PVDINTERFACECONFIG pImgCfg = VDIfConfigGet(pImage->pVDIfsImage);
+    if (pImgCfg)
+    {
+        rc = VDCFGQueryU64Def(pImgCfg, "L2CacheSize", &cbL2CacheMax, 0);
+        if (RT_FAILURE(rc))
+            return vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                             N_("QCow: Getting L2CacheSize for '%s' failed (%Rrc)"), pImage->pszFilename, rc);
+    }
+
+    uint64_t cbL2Tbls = (uint64_t)pImage->cL1TableEntries * pImage->cbL2Table;
+    if (!cbL2CacheMax)
+        cbL2CacheMax = RT_MAX(RT_MIN(cbL2Tbls, QCOW_L2_CACHE_MEMORY_AUTO_MAX), QCOW_L2_CACHE_MEMORY_MIN);
+    else
+        cbL2CacheMax = RT_MIN(cbL2CacheMax, QCOW_L2_CACHE_MEMORY_MAX);
+
+    /* Keep room for a few tables so allocations and lookups in flight don't run out of entries. */
+    cbL2CacheMax = RT_MAX(cbL2CacheMax, (uint64_t)QCOW_L2_CACHE_ENTRIES_MIN * pImage->cbL2Table);
+    pImage->cbL2CacheMax = (size_t)cbL2CacheMax;
+
+    LogFlowFunc(("L2 cache of image '%s' limited to %zu bytes (%llu bytes of L2 tables)\n",
+                 pImage->pszFilename, pImage->cbL2CacheMax, cbL2Tbls));
+    return rc;
+}
+
 /**
  * Destroys the L2 table cache.
  *
@@ -546,17 +657,17 @@ static void qcowL2TblCacheDestroy(PQCOWIMAGE pImage)
 {
     PQCOWL2CACHEENTRY pL2Entry;
     PQCOWL2CACHEENTRY pL2Next;
-    RTListForEachSafe(&pImage->ListSearch, pL2Entry, pL2Next, QCOWL2CACHEENTRY, NodeSearch)
+    RTListForEachSafe(&pImage->ListLru, pL2Entry, pL2Next, QCOWL2CACHEENTRY, NodeLru)
     {
         Assert(!pL2Entry->cRefs);
 
-        RTListNodeRemove(&pL2Entry->NodeSearch);
+        RTListNodeRemove(&pL2Entry->NodeLru);
         RTMemPageFree(pL2Entry->paL2Tbl, pImage->cbL2Table);
         RTMemFree(pL2Entry);
     }
 
     pImage->cbL2Cache       = 0;
-    RTListInit(&pImage->ListSearch);
+    pImage->L2TblTree       = NULL;
     RTListInit(&pImage->ListLru);
 }
 
@@ -576,19 +687,14 @@ static PQCOWL2CACHEENTRY qcowL2TblCacheRetain(PQCOWIMAGE pImage, uint64_t offL2T
         return pImage->pL2TblAlloc;
     }
 
-    PQCOWL2CACHEENTRY pL2Entry;
-    RTListForEach(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch)
-    {
-        if (pL2Entry->offL2Tbl == offL2Tbl)
-            break;
-    }
-
-    if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch))
+    PQCOWL2CACHEENTRY pL2Entry = (PQCOWL2CACHEENTRY)RTAvlU64Get(&pImage->L2TblTree, offL2Tbl);
+    if (pL2Entry)
     {
         /* Update LRU list. */
         RTListNodeRemove(&pL2Entry->NodeLru);
         RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
         pL2Entry->cRefs++;
+        pImage->cL2CacheHits++;
         return pL2Entry;
     }
 
@@ -617,7 +723,7 @@ static PQCOWL2CACHEENTRY qcowL2TblCacheEntryAlloc(PQCOWIMAGE pImage)
 {
     PQCOWL2CACHEENTRY pL2Entry = NULL;
 
-    if (pImage->cbL2Cache + pImage->cbL2Table <= QCOW_L2_CACHE_MEMORY_MAX)
+    if (pImage->cbL2Cache + pImage->cbL2Table <= pImage->cbL2CacheMax)
     {
         /* Add a new entry. */
         pL2Entry = (PQCOWL2CACHEENTRY)RTMemAllocZ(sizeof(QCOWL2CACHEENTRY));
@@ -647,12 +753,14 @@ static PQCOWL2CACHEENTRY qcowL2TblCacheEntryAlloc(PQCOWIMAGE pImage)
                 break;
         }
 
-        if (!RTListNodeIsDummy(&pImage->ListSearch, pL2Entry, QCOWL2CACHEENTRY, NodeSearch))
+        if (!RTListNodeIsDummy(&pImage->ListLru, pL2Entry, QCOWL2CACHEENTRY, NodeLru))
         {
-            RTListNodeRemove(&pL2Entry->NodeSearch);
+            PAVLU64NODECORE pCore = RTAvlU64Remove(&pImage->L2TblTree, pL2Entry->Core.Key);
+            Assert(pCore == &pL2Entry->Core); NOREF(pCore);
             RTListNodeRemove(&pL2Entry->NodeLru);
             pL2Entry->offL2Tbl = 0;
             pL2Entry->cRefs    = 1;
+            pImage->cL2CacheEvictions++;
         }
         else
             pL2Entry = NULL;
@@ -691,34 +799,10 @@ static void qcowL2TblCacheEntryInsert(PQCOWIMAGE pImage, PQCOWL2CACHEENTRY pL2En
     /* Insert at the top of the LRU list. */
     RTListPrepend(&pImage->ListLru, &pL2Entry->NodeLru);
 
-    if (RTListIsEmpty(&pImage->ListSearch))
-    {
-        RTListAppend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-    }
-    else
-    {
-        /* Insert into search list. */
-        PQCOWL2CACHEENTRY pIt;
-        pIt = RTListGetFirst(&pImage->ListSearch, QCOWL2CACHEENTRY, NodeSearch);
-        if (pIt->offL2Tbl > pL2Entry->offL2Tbl)
-            RTListPrepend(&pImage->ListSearch, &pL2Entry->NodeSearch);
-        else
-        {
-            bool fInserted = false;
-
-            RTListForEach(&pImage->ListSearch, pIt, QCOWL2CACHEENTRY, NodeSearch)
-            {
-                Assert(pIt->offL2Tbl != pL2Entry->offL2Tbl);
-                if (pIt->offL2Tbl < pL2Entry->offL2Tbl)
-                {
-                    RTListNodeInsertAfter(&pIt->NodeSearch, &pL2Entry->NodeSearch);
-                    fInserted = true;
-                    break;
-                }
-            }
-            Assert(fInserted);
-        }
-    }
+    /* Insert into the search tree. */
+    pL2Entry->Core.Key = pL2Entry->offL2Tbl;
+    bool fInserted = RTAvlU64Insert(&pImage->L2TblTree, &pL2Entry->Core);
+    Assert(fInserted); NOREF(fInserted);
 }
 
 /**
@@ -740,6 +824,7 @@ static int qcowL2TblCacheFetch(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint64_t offL
     PQCOWL2CACHEENTRY pL2Entry = qcowL2TblCacheRetain(pImage, offL2Tbl);
     if (!pL2Entry)
     {
+        pImage->cL2CacheMisses++;
         pL2Entry = qcowL2TblCacheEntryAlloc(pImage);
 
         if (pL2Entry)
@@ -844,20 +929,411 @@ DECLINLINE(uint64_t) qcowByte2Cluster(PQCOWIMAGE pImage, uint64_t cb)
 }
 
 /**
- * Allocates a new cluster in the image.
+ * Returns the L2 table offset from the given L1 table entry stripping any flags.
  *
- * @returns The start offset of the new cluster in the image.
+ * @returns Offset of the L2 table in the image.
  * @param   pImage    The image instance data.
- * @param   cClusters Number of clusters to allocate.
+ * @param   u64L1Ent  The L1 table entry.
+ */
+DECLINLINE(uint64_t) qcowL1EntryGetL2TblOffset(PQCOWIMAGE pImage, uint64_t u64L1Ent)
+{
+    if (pImage->uVersion == 2)
+        return u64L1Ent & QCOW_V2_TBL_OFFSET_MASK;
+    return u64L1Ent;
+}
+
+/**
+ * Returns the flags to set in L1 and L2 table entries pointing to newly allocated clusters.
+ *
+ * @returns Flags to OR into the table entry.
+ * @param   pImage    The image instance data.
+ */
+DECLINLINE(uint64_t) qcowClusterAllocGetTblFlags(PQCOWIMAGE pImage)
+{
+    /* The refcount of a new cluster is exactly 1 if refcounts are maintained. */
+    return pImage->fRefcountUpdate ? QCOW_V2_COPIED_FLAG : 0;
+}
+
+/**
+ * Returns the refcount table index covering the given image offset.
+ *
+ * @returns Refcount table index.
+ * @param   pImage    The image instance data.
+ * @param   off       The image offset.
+ */
+DECLINLINE(uint64_t) qcowRefcountTblIdx(PQCOWIMAGE pImage, uint64_t off)
+{
+    return (off >> pImage->cClusterBits) >> pImage->cRefcountTblShift;
+}
+
+/**
+ * Initializes the refcount block cache.
+ *
+ * @returns nothing.
+ * @param   pImage    The image instance data.
+ */
+static void qcowRefcountBlkCacheInit(PQCOWIMAGE pImage)
+{
+    for (unsigned i = 0; i < RT_ELEMENTS(pImage->aRefcountBlks); i++)
+    {
+        pImage->aRefcountBlks[i].idxRefcountTbl = UINT32_MAX;
+        pImage->aRefcountBlks[i].fDirty         = false;
+        pImage->aRefcountBlks[i].uLastUse       = 0;
+        pImage->aRefcountBlks[i].pau16Refcounts = NULL;
+    }
+
+    pImage->uRefcountBlkUse     = 0;
+    pImage->cRefcountBlkHits    = 0;
+    pImage->cRefcountBlkMisses  = 0;
+    pImage->fRefcountTableDirty = false;
+}
+
+/**
+ * Destroys the refcount block cache, dirty blocks must have been written already.
+ *
+ * @returns nothing.
+ * @param   pImage    The image instance data.
+ */
+static void qcowRefcountBlkCacheDestroy(PQCOWIMAGE pImage)
+{
+    for (unsigned i = 0; i < RT_ELEMENTS(pImage->aRefcountBlks); i++)
+    {
+        PQCOWREFCOUNTBLKCACHEENTRY pRefBlk = &pImage->aRefcountBlks[i];
+
+        if (pRefBlk->pau16Refcounts)
+            RTMemPageFree(pRefBlk->pau16Refcounts, pImage->cbCluster);
+        pRefBlk->pau16Refcounts = NULL;
+        pRefBlk->idxRefcountTbl = UINT32_MAX;
+        pRefBlk->fDirty         = false;
+    }
+
+    pImage->fRefcountUpdate = false;
+}
+
+/**
+ * Writes a dirty refcount block back to the image.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image instance data.
+ * @param   pIoCtx    The I/O context, NULL for a synchronous write.
+ * @param   pRefBlk   The refcount block cache entry to write.
+ */
+static int qcowRefcountBlkCacheEntryWrite(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, PQCOWREFCOUNTBLKCACHEENTRY pRefBlk)
+{
+    int rc;
+    uint64_t offRefBlk = pImage->paRefcountTable[pRefBlk->idxRefcountTbl] & QCOW_V2_TBL_OFFSET_MASK;
+
+    Assert(pRefBlk->fDirty && offRefBlk);
+    if (pIoCtx)
+        rc = vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage, offRefBlk,
+                                    pRefBlk->pau16Refcounts, pImage->cbCluster,
+                                    pIoCtx, NULL, NULL);
+    else
+        rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, offRefBlk,
+                                    pRefBlk->pau16Refcounts, pImage->cbCluster);
+    if (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+        pRefBlk->fDirty = false;
+
+    return rc;
+}
+
+/**
+ * Returns the cached refcount block for the given refcount table index or NULL
+ * if it is not cached.
+ *
+ * @returns Pointer to the refcount block cache entry or NULL.
+ * @param   pImage         The image instance data.
+ * @param   idxRefcountTbl The refcount table index.
+ */
+static PQCOWREFCOUNTBLKCACHEENTRY qcowRefcountBlkCacheLookup(PQCOWIMAGE pImage, uint32_t idxRefcountTbl)
+{
+    for (unsigned i = 0; i < RT_ELEMENTS(pImage->aRefcountBlks); i++)
+    {
+        PQCOWREFCOUNTBLKCACHEENTRY pRefBlk = &pImage->aRefcountBlks[i];
+        if (pRefBlk->idxRefcountTbl == idxRefcountTbl)
+        {
+            pRefBlk->uLastUse = ++pImage->uRefcountBlkUse;
+            return pRefBlk;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Gets an unused refcount block cache entry, evicting the least recently used one
+ * (writing it back if it is dirty) if required.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image instance data.
+ * @param   pIoCtx    The I/O context.
+ * @param   ppRefBlk  Where to store the cache entry on success.
+ */
+static int qcowRefcountBlkCacheEntryAlloc(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, PQCOWREFCOUNTBLKCACHEENTRY *ppRefBlk)
+{
+    PQCOWREFCOUNTBLKCACHEENTRY pRefBlk = NULL;
+
+    for (unsigned i = 0; i < RT_ELEMENTS(pImage->aRefcountBlks); i++)
+    {
+        PQCOWREFCOUNTBLKCACHEENTRY pIt = &pImage->aRefcountBlks[i];
+        if (pIt->idxRefcountTbl == UINT32_MAX)
+        {
+            pRefBlk = pIt;
+            break;
+        }
+
+        if (   !pRefBlk
+            || pIt->uLastUse < pRefBlk->uLastUse)
+            pRefBlk = pIt;
+    }
+
+    if (pRefBlk->fDirty)
+    {
+        int rc = qcowRefcountBlkCacheEntryWrite(pImage, pIoCtx, pRefBlk);
+        if (RT_FAILURE(rc) && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+            return rc;
+    }
+
+    pRefBlk->idxRefcountTbl = UINT32_MAX;
+    if (!pRefBlk->pau16Refcounts)
+    {
+        pRefBlk->pau16Refcounts = (uint16_t *)RTMemPageAllocZ(pImage->cbCluster);
+        if (RT_UNLIKELY(!pRefBlk->pau16Refcounts))
+            return VERR_NO_MEMORY;
+    }
+
+    *ppRefBlk = pRefBlk;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Makes sure the refcount block at the given refcount table index is in the cache,
+ * reading it from the image on a miss.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if the block is being read, the request is
+ *          restarted once it is available.
+ * @param   pImage         The image instance data.
+ * @param   pIoCtx         The I/O context, NULL for synchronous I/O.
+ * @param   idxRefcountTbl The refcount table index.
+ */
+static int qcowRefcountBlkCacheFetch(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxRefcountTbl)
+{
+    if (qcowRefcountBlkCacheLookup(pImage, idxRefcountTbl))
+    {
+        pImage->cRefcountBlkHits++;
+        return VINF_SUCCESS;
+    }
+
+    pImage->cRefcountBlkMisses++;
+
+    PQCOWREFCOUNTBLKCACHEENTRY pRefBlk = NULL;
+    int rc = qcowRefcountBlkCacheEntryAlloc(pImage, pIoCtx, &pRefBlk);
+    if (RT_SUCCESS(rc))
+    {
+        PVDMETAXFER pMetaXfer = NULL;
+
+        rc = vdIfIoIntFileReadMeta(pImage->pIfIo, pImage->pStorage,
+                                   pImage->paRefcountTable[idxRefcountTbl] & QCOW_V2_TBL_OFFSET_MASK,
+                                   pRefBlk->pau16Refcounts, pImage->cbCluster, pIoCtx,
+                                   pIoCtx ? &pMetaXfer : NULL, NULL, NULL);
+        if (RT_SUCCESS(rc))
+        {
+            if (pMetaXfer)
+                vdIfIoIntMetaXferRelease(pImage->pIfIo, pMetaXfer);
+            pRefBlk->idxRefcountTbl = idxRefcountTbl;
+            pRefBlk->uLastUse       = ++pImage->uRefcountBlkUse;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Sets the refcount of the given cluster, the refcount block covering it must be cached.
+ *
+ * @returns nothing.
+ * @param   pImage     The image instance data.
+ * @param   offCluster The image offset of the cluster.
+ * @param   u16Refcnt  The refcount to set.
+ */
+static void qcowRefcountSet(PQCOWIMAGE pImage, uint64_t offCluster, uint16_t u16Refcnt)
+{
+    uint64_t idxCluster = offCluster >> pImage->cClusterBits;
+    PQCOWREFCOUNTBLKCACHEENTRY pRefBlk = qcowRefcountBlkCacheLookup(pImage,
+                                                                    (uint32_t)qcowRefcountTblIdx(pImage, offCluster));
+    AssertReturnVoid(pRefBlk);
+
+    pRefBlk->pau16Refcounts[idxCluster & (pImage->cRefcountBlkEntries - 1)] = RT_H2BE_U16(u16Refcnt);
+    pRefBlk->fDirty = true;
+}
+
+/**
+ * Links a new, empty refcount block into the refcount table, the block is placed
+ * at the end of the image.
+ *
+ * @returns VBox status code.
+ * @param   pImage         The image instance data.
+ * @param   pIoCtx         The I/O context.
+ * @param   idxRefcountTbl The refcount table index to link the new block to.
  */
-DECLINLINE(uint64_t) qcowClusterAllocate(PQCOWIMAGE pImage, uint32_t cClusters)
+static int qcowRefcountBlkLink(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxRefcountTbl)
 {
-    uint64_t offCluster;
+    PQCOWREFCOUNTBLKCACHEENTRY pRefBlk = NULL;
+    int rc = qcowRefcountBlkCacheEntryAlloc(pImage, pIoCtx, &pRefBlk);
+    if (RT_SUCCESS(rc))
+    {
+        uint64_t offRefBlk = pImage->offNextCluster;
+
+        LogFlowFunc(("Linking new refcount block %u at offset %llu\n", idxRefcountTbl, offRefBlk));
 
-    offCluster = pImage->offNextCluster;
-    pImage->offNextCluster += cClusters*pImage->cbCluster;
+        memset(pRefBlk->pau16Refcounts, 0, pImage->cbCluster);
+        pRefBlk->idxRefcountTbl = idxRefcountTbl;
+        pRefBlk->uLastUse       = ++pImage->uRefcountBlkUse;
+        pRefBlk->fDirty         = true;
 
-    return offCluster;
+        pImage->paRefcountTable[idxRefcountTbl] = offRefBlk;
+        pImage->fRefcountTableDirty = true;
+        pImage->offNextCluster += pImage->cbCluster;
+
+        /* The block is either covered by itself or by an already cached one. */
+        qcowRefcountSet(pImage, offRefBlk, 1);
+    }
+
+    return rc;
+}
+
+/**
+ * Replaces the refcount table with a bigger one placed at the end of the image.
+ *
+ * The clusters of the old table are left allocated, qemu-img check reports them
+ * as leaked which is harmless, while freeing them would corrupt the image if the
+ * header still pointing to the old table is all that makes it to the disk.  The
+ * caller has to link in the refcount blocks covering the new table and set the
+ * refcounts of its clusters.
+ *
+ * @returns VBox status code.
+ * @param   pImage         The image instance data.
+ * @param   cEntriesNew    Number of entries in the new table.
+ * @param   cbNew          Size of the new table in bytes, cluster aligned.
+ */
+static int qcowRefcountTblGrow(PQCOWIMAGE pImage, uint32_t cEntriesNew, uint32_t cbNew)
+{
+    uint64_t *paRefcountTblNew = (uint64_t *)RTMemAllocZ(cbNew);
+    if (RT_UNLIKELY(!paRefcountTblNew))
+        return VERR_NO_MEMORY;
+
+    LogRel(("QCow: Growing the refcount table of image '%s' from %u to %u entries\n",
+            pImage->pszFilename, pImage->cRefcountTableEntries, cEntriesNew));
+
+    memcpy(paRefcountTblNew, pImage->paRefcountTable, pImage->cRefcountTableEntries * sizeof(uint64_t));
+    RTMemFree(pImage->paRefcountTable);
+    pImage->paRefcountTable       = paRefcountTblNew;
+    pImage->offRefcountTable      = pImage->offNextCluster;
+    pImage->cbRefcountTable       = cbNew;
+    pImage->cRefcountTableEntries = cEntriesNew;
+    pImage->fRefcountTableDirty   = true;
+    pImage->offNextCluster       += cbNew;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Allocates new clusters at the end of the image, updating the refcounts if enabled.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if a refcount block needs to be read first,
+ *          nothing was allocated in that case.
+ * @retval  VERR_DISK_FULL if the refcount table can't cover the new clusters.
+ * @param   pImage      The image instance data.
+ * @param   pIoCtx      The I/O context, NULL for synchronous I/O.
+ * @param   cClusters   Number of clusters to allocate.
+ * @param   poffCluster Where to store the start offset of the new clusters on success.
+ */
+static int qcowClusterAllocate(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint32_t cClusters, uint64_t *poffCluster)
+{
+    int rc = VINF_SUCCESS;
+
+    if (pImage->fRefcountUpdate)
+    {
+        /*
+         * Work out whether the refcount table has to grow to cover the new clusters, the
+         * bigger table goes to the end of the image ahead of them.
+         */
+        uint32_t cEntriesNew = pImage->cRefcountTableEntries;
+        uint64_t cbTblNew    = 0;
+        uint64_t idxFirst    = qcowRefcountTblIdx(pImage, pImage->offNextCluster);
+        uint64_t idxLast     = qcowRefcountTblIdx(pImage, pImage->offNextCluster + (uint64_t)(cClusters + 1) * pImage->cbCluster);
+        while (idxLast >= cEntriesNew)
+        {
+            uint64_t const cEntriesGrown = (uint64_t)cEntriesNew * 2;
+            cbTblNew = RT_ALIGN_64(cEntriesGrown * sizeof(uint64_t), pImage->cbCluster);
+            if (cbTblNew > UINT32_MAX)
+            {
+                LogRel(("QCow: Refcount table of image '%s' can't grow any further\n", pImage->pszFilename));
+                return VERR_DISK_FULL;
+            }
+            cEntriesNew = (uint32_t)cEntriesGrown;
+            idxLast  = qcowRefcountTblIdx(pImage, pImage->offNextCluster + cbTblNew + (uint64_t)(cClusters + 1) * pImage->cbCluster);
+        }
+
+        /*
+         * Get all existing refcount blocks covering the range into the cache before changing
+         * anything, so the request can simply be restarted if a read completes asynchronously.
+         * The range includes up to two refcount blocks which might get linked in below.
+         */
+        for (uint64_t idx = idxFirst; idx <= idxLast && idx < pImage->cRefcountTableEntries && RT_SUCCESS(rc); idx++)
+            if (pImage->paRefcountTable[idx] & QCOW_V2_TBL_OFFSET_MASK)
+                rc = qcowRefcountBlkCacheFetch(pImage, pIoCtx, (uint32_t)idx);
+        if (RT_FAILURE(rc))
+            return rc;
+
+        uint64_t offRangeStart = pImage->offNextCluster;
+        if (cbTblNew)
+        {
+            rc = qcowRefcountTblGrow(pImage, cEntriesNew, (uint32_t)cbTblNew);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+
+        /*
+         * Link in new refcount blocks for the part of the range which isn't covered yet.
+         * The block covering the end of the image goes first, new blocks are placed there
+         * and need it for their own refcount.
+         */
+        while (RT_SUCCESS(rc))
+        {
+            uint64_t idxNew = qcowRefcountTblIdx(pImage, pImage->offNextCluster);
+            if (pImage->paRefcountTable[idxNew] & QCOW_V2_TBL_OFFSET_MASK)
+            {
+                idxNew  = qcowRefcountTblIdx(pImage, offRangeStart);
+                idxLast = qcowRefcountTblIdx(pImage, pImage->offNextCluster + (uint64_t)(cClusters - 1) * pImage->cbCluster);
+                while (   idxNew <= idxLast
+                       && (pImage->paRefcountTable[idxNew] & QCOW_V2_TBL_OFFSET_MASK))
+                    idxNew++;
+                if (idxNew > idxLast)
+                    break;
+            }
+
+            rc = qcowRefcountBlkLink(pImage, pIoCtx, (uint32_t)idxNew);
+        }
+
+        if (RT_FAILURE(rc))
+            return rc;
+
+        if (cbTblNew)
+            for (uint64_t off = 0; off < cbTblNew; off += pImage->cbCluster)
+                qcowRefcountSet(pImage, pImage->offRefcountTable + off, 1);
+    }
+
+    uint64_t offCluster = pImage->offNextCluster;
+    pImage->offNextCluster += (uint64_t)cClusters * pImage->cbCluster;
+
+    if (pImage->fRefcountUpdate)
+        for (uint32_t i = 0; i < cClusters; i++)
+            qcowRefcountSet(pImage, offCluster + (uint64_t)i * pImage->cbCluster, 1);
+
+    *poffCluster = offCluster;
+    return rc;
 }
 
 /**
@@ -890,9 +1366,7 @@ static int qcowConvertToImageOffset(PQCOWIMAGE pImage, PVDIOCTX pIoCtx,
     {
         PQCOWL2CACHEENTRY pL2Entry;
 
-        uint64_t offL2Tbl = pImage->paL1Table[idxL1];
-        if (pImage->uVersion == 2)
-            offL2Tbl &= QCOW_V2_TBL_OFFSET_MASK;
+        uint64_t offL2Tbl = qcowL1EntryGetL2TblOffset(pImage, pImage->paL1Table[idxL1]);
         rc = qcowL2TblCacheFetch(pImage, pIoCtx, offL2Tbl, &pL2Entry);
         if (RT_SUCCESS(rc))
         {
@@ -994,6 +1468,61 @@ static int qcowTblWrite(PQCOWIMAGE pImage, PVDIOCTX pIoCtx, uint64_t offTbl, uin
     return rc;
 }
 
+/**
+ * Writes all dirty refcount blocks and the refcount table if it was changed.
+ *
+ * @returns VBox status code.
+ * @param   pImage    The image instance data.
+ * @param   pIoCtx    The I/O context, NULL for synchronous writes.
+ */
+static int qcowRefcountFlush(PQCOWIMAGE pImage, PVDIOCTX pIoCtx)
+{
+    int rc = VINF_SUCCESS;
+
+    for (unsigned i = 0; i < RT_ELEMENTS(pImage->aRefcountBlks); i++)
+    {
+        PQCOWREFCOUNTBLKCACHEENTRY pRefBlk = &pImage->aRefcountBlks[i];
+        if (pRefBlk->fDirty)
+        {
+            rc = qcowRefcountBlkCacheEntryWrite(pImage, pIoCtx, pRefBlk);
+            if (RT_FAILURE(rc) && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+                return rc;
+        }
+    }
+
+    if (pImage->fRefcountTableDirty)
+    {
+        if (pIoCtx)
+            rc = qcowTblWrite(pImage, pIoCtx, pImage->offRefcountTable, pImage->paRefcountTable,
+                              pImage->cbRefcountTable, pImage->cRefcountTableEntries, NULL, NULL);
+        else
+        {
+#if defined(RT_LITTLE_ENDIAN)
+            uint64_t *paRefcountTblImg = (uint64_t *)RTMemAllocZ(pImage->cbRefcountTable);
+            if (paRefcountTblImg)
+            {
+                qcowTableConvertFromHostEndianess(paRefcountTblImg, pImage->paRefcountTable,
+                                                  pImage->cRefcountTableEntries);
+                rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage,
+                                            pImage->offRefcountTable, paRefcountTblImg,
+                                            pImage->cbRefcountTable);
+                RTMemFree(paRefcountTblImg);
+            }
+            else
+                rc = VERR_NO_MEMORY;
+#else
+            rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, pImage->offRefcountTable,
+                                        pImage->paRefcountTable, pImage->cbRefcountTable);
+#endif
+        }
+
+        if (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            pImage->fRefcountTableDirty = false;
+    }
+
+    return rc;
+}
+
 /**
  * Internal. Flush image data to disk.
  */
@@ -1007,6 +1536,11 @@ static int qcowFlushImage(PQCOWIMAGE pImage)
     {
         QCowHeader Header;
 
+        /* Write the refcount updates first so the clusters referenced by the tables are accounted for. */
+        rc = qcowRefcountFlush(pImage, NULL /*pIoCtx*/);
+        if (RT_FAILURE(rc))
+            return rc;
+
 #if defined(RT_LITTLE_ENDIAN)
         uint64_t *paL1TblImg = (uint64_t *)RTMemAllocZ(pImage->cbL1Table);
         if (paL1TblImg)
@@ -1062,6 +1596,13 @@ static int qcowFreeImage(PQCOWIMAGE pImage, bool fDelete)
             pImage->pStorage = NULL;
         }
 
+        if (pImage->cL2CacheHits + pImage->cL2CacheMisses)
+            LogRel(("QCow: Image '%s' L2 cache: %llu hits, %llu misses, %llu evictions (%zu of max %zu bytes used); refcount block cache: %llu hits, %llu misses\n",
+                    pImage->pszFilename, pImage->cL2CacheHits, pImage->cL2CacheMisses, pImage->cL2CacheEvictions,
+                    pImage->cbL2Cache, pImage->cbL2CacheMax, pImage->cRefcountBlkHits, pImage->cRefcountBlkMisses));
+
+        qcowRefcountBlkCacheDestroy(pImage);
+
         if (pImage->paRefcountTable)
             RTMemFree(pImage->paRefcountTable);
         pImage->paRefcountTable = NULL;
@@ -1178,6 +1719,10 @@ static int qcowOpenImage(PQCOWIMAGE pImage, unsigned uOpenFlags)
     int rc = qcowL2TblCacheCreate(pImage);
     if (RT_SUCCESS(rc))
     {
+        uint32_t uRefcountOrder = QCOW_REFCOUNT_ORDER_DEFAULT;
+
+        qcowRefcountBlkCacheInit(pImage);
+
         /* Open the image. */
         rc = vdIfIoIntFileOpen(pImage->pIfIo, pImage->pszFilename,
                                VDOpenFlagsToFileOpenFlags(uOpenFlags,
@@ -1250,6 +1795,8 @@ static int qcowOpenImage(PQCOWIMAGE pImage, unsigned uOpenFlags)
                                 pImage->offRefcountTable      = Header.Version.v2.u64RefcountTableOffset;
                                 pImage->cbRefcountTable       = qcowCluster2Byte(pImage, Header.Version.v2.u32RefcountTableClusters);
                                 pImage->cRefcountTableEntries = pImage->cbRefcountTable / sizeof(uint64_t);
+                                /* Clusters must be aligned to the cluster size in v2 images. */
+                                pImage->offNextCluster        = RT_ALIGN_64(cbFile, pImage->cbCluster);
 
                                 /* Init the masks to extract offset and sector count from a compressed cluster descriptor. */
                                 uint32_t cBitsCompressedClusterOffset = 62 - (pImage->cClusterBits - 8);
@@ -1264,6 +1811,8 @@ static int qcowOpenImage(PQCOWIMAGE pImage, unsigned uOpenFlags)
                                                        N_("QCow: Image '%s' contains unsupported incompatible features (%llx vs %llx)"),
                                                        pImage->pszFilename, Header.Version.v2.v3.u64IncompatFeat, QCOW_V3_INCOMPAT_FEAT_SUPPORTED_MASK);
 
+                                    uRefcountOrder = Header.Version.v2.v3.u32RefCntWidth;
+
                                     /** @todo Auto clear features need to be reset as soon as write support is added. */
                                 }
                             }
@@ -1333,10 +1882,30 @@ static int qcowOpenImage(PQCOWIMAGE pImage, unsigned uOpenFlags)
                                            pImage->pszFilename);
                     }
 
+                    if (   RT_SUCCESS(rc)
+                        && pImage->paRefcountTable
+                        && !(pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY))
+                    {
+                        /* Keep the refcounts up to date when allocating clusters, only 16bit refcounts are handled. */
+                        if (uRefcountOrder == QCOW_REFCOUNT_ORDER_DEFAULT)
+                        {
+                            pImage->cRefcountBlkEntries = pImage->cbCluster / sizeof(uint16_t);
+                            pImage->cRefcountTblShift   = qcowGetPowerOfTwo(pImage->cRefcountBlkEntries);
+                            pImage->fRefcountUpdate     = true;
+                        }
+                        else
+                            LogRel(("QCow: Refcount order %u of image '%s' is not supported, refcounts of new clusters are not updated\n",
+                                    uRefcountOrder, pImage->pszFilename));
+                    }
+
                     if (RT_SUCCESS(rc))
                     {
                         qcowTableMasksInit(pImage);
+                        rc = qcowL2TblCacheSizeInit(pImage);
+                    }
 
+                    if (RT_SUCCESS(rc))
+                    {
                         /* Allocate L1 table. */
                         pImage->paL1Table = (uint64_t *)RTMemAllocZ(pImage->cbL1Table);
                         if (pImage->paL1Table)
@@ -1410,6 +1979,8 @@ static int qcowCreateImage(PQCOWIMAGE pImage, uint64_t cbSize,
         rc = qcowL2TblCacheCreate(pImage);
         if (RT_SUCCESS(rc))
         {
+            qcowRefcountBlkCacheInit(pImage);
+
             pImage->uOpenFlags   = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
             pImage->uImageFlags  = uImageFlags;
             pImage->PCHSGeometry = *pPCHSGeometry;
@@ -1443,12 +2014,15 @@ static int qcowCreateImage(PQCOWIMAGE pImage, uint64_t cbSize,
                 pImage->paL1Table = (uint64_t *)RTMemAllocZ(pImage->cbL1Table);
                 if (RT_LIKELY(pImage->paL1Table))
                 {
+                    rc = qcowL2TblCacheSizeInit(pImage);
                     if (RT_SUCCESS(rc))
+                    {
                         vdIfProgress(pIfProgress, uPercentStart + uPercentSpan * 98 / 100);
 
-                    rc = qcowFlushImage(pImage);
-                    if (RT_SUCCESS(rc))
-                        rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, pImage->offNextCluster);
+                        rc = qcowFlushImage(pImage);
+                        if (RT_SUCCESS(rc))
+                            rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, pImage->offNextCluster);
+                    }
                 }
                 else
                     rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS, N_("QCow: cannot allocate memory for L1 table of image '%s'"),
@@ -1558,7 +2132,7 @@ static DECLCALLBACK(int) qcowAsyncClusterAllocUpdate(void *pBackendData, PVDIOCT
         case QCOWCLUSTERASYNCALLOCSTATE_L2_ALLOC:
         {
             /* Update the link in the in memory L1 table now. */
-            pImage->paL1Table[pClusterAlloc->idxL1] = pClusterAlloc->pL2Entry->offL2Tbl;
+            pImage->paL1Table[pClusterAlloc->idxL1] = pClusterAlloc->pL2Entry->offL2Tbl | qcowClusterAllocGetTblFlags(pImage);
 
             /* Update the link in the on disk L1 table now. */
             pClusterAlloc->enmAllocState = QCOWCLUSTERASYNCALLOCSTATE_L2_LINK;
@@ -1578,8 +2152,8 @@ static DECLCALLBACK(int) qcowAsyncClusterAllocUpdate(void *pBackendData, PVDIOCT
         RT_FALL_THRU();
         case QCOWCLUSTERASYNCALLOCSTATE_L2_LINK:
         {
-            /* L2 link updated in L1 , save L2 entry in cache and allocate new user data cluster. */
-            uint64_t offData = qcowClusterAllocate(pImage, 1);
+            /* L2 link updated in L1 , save L2 entry in cache and write the user data cluster allocated with it. */
+            uint64_t offData = pClusterAlloc->offDataNew;
 
             pImage->pL2TblAlloc = NULL;
             qcowL2TblCacheEntryInsert(pImage, pClusterAlloc->pL2Entry);
@@ -1605,10 +2179,10 @@ static DECLCALLBACK(int) qcowAsyncClusterAllocUpdate(void *pBackendData, PVDIOCT
         case QCOWCLUSTERASYNCALLOCSTATE_USER_ALLOC:
         {
             pClusterAlloc->enmAllocState = QCOWCLUSTERASYNCALLOCSTATE_USER_LINK;
-            pClusterAlloc->pL2Entry->paL2Tbl[pClusterAlloc->idxL2] = pClusterAlloc->offClusterNew;
+            pClusterAlloc->pL2Entry->paL2Tbl[pClusterAlloc->idxL2] = pClusterAlloc->offClusterNew | qcowClusterAllocGetTblFlags(pImage);
 
             /* Link L2 table and update it. */
-            rc = qcowTblWrite(pImage, pIoCtx, pImage->paL1Table[pClusterAlloc->idxL1],
+            rc = qcowTblWrite(pImage, pIoCtx, pClusterAlloc->pL2Entry->offL2Tbl,
                               pClusterAlloc->pL2Entry->paL2Tbl,
                               pImage->cbL2Table, pImage->cL2TableEntries,
                               qcowAsyncClusterAllocUpdate, pClusterAlloc);
@@ -2010,6 +2584,12 @@ static DECLCALLBACK(int) qcowWrite(void *pBackendData, uint64_t uOffset, size_t
                         uint64_t offL2Tbl;
                         PQCOWCLUSTERASYNCALLOC pL2ClusterAlloc = NULL;
 
+                        /* Allocate the L2 table and the data cluster following it in one go. */
+                        rc = qcowClusterAllocate(pImage, pIoCtx, (uint32_t)qcowByte2Cluster(pImage, pImage->cbL2Table) + 1,
+                                                 &offL2Tbl);
+                        if (RT_FAILURE(rc))
+                            break;
+
                         /* Allocate new async cluster allocation state. */
                         pL2ClusterAlloc = (PQCOWCLUSTERASYNCALLOC)RTMemAllocZ(sizeof(QCOWCLUSTERASYNCALLOC));
                         if (RT_UNLIKELY(!pL2ClusterAlloc))
@@ -2026,13 +2606,13 @@ static DECLCALLBACK(int) qcowWrite(void *pBackendData, uint64_t uOffset, size_t
                             break;
                         }
 
-                        offL2Tbl = qcowClusterAllocate(pImage, qcowByte2Cluster(pImage, pImage->cbL2Table));
                         pL2Entry->offL2Tbl = offL2Tbl;
                         memset(pL2Entry->paL2Tbl, 0, pImage->cbL2Table);
 
                         pL2ClusterAlloc->enmAllocState     = QCOWCLUSTERASYNCALLOCSTATE_L2_ALLOC;
                         pL2ClusterAlloc->offNextClusterOld = offL2Tbl;
                         pL2ClusterAlloc->offClusterNew     = offL2Tbl;
+                        pL2ClusterAlloc->offDataNew        = offL2Tbl + pImage->cbL2Table;
                         pL2ClusterAlloc->idxL1             = idxL1;
                         pL2ClusterAlloc->idxL2             = idxL2;
                         pL2ClusterAlloc->cbToWrite         = cbToWrite;
@@ -2065,23 +2645,31 @@ static DECLCALLBACK(int) qcowWrite(void *pBackendData, uint64_t uOffset, size_t
                     {
                         LogFlowFunc(("Fetching L2 table at cluster offset %llu\n", pImage->paL1Table[idxL1]));
 
-                        rc = qcowL2TblCacheFetch(pImage, pIoCtx, pImage->paL1Table[idxL1],
+                        rc = qcowL2TblCacheFetch(pImage, pIoCtx,
+                                                 qcowL1EntryGetL2TblOffset(pImage, pImage->paL1Table[idxL1]),
                                                  &pL2Entry);
                         if (RT_SUCCESS(rc))
                         {
                             PQCOWCLUSTERASYNCALLOC pDataClusterAlloc = NULL;
 
+                            /* Allocate new cluster for the data. */
+                            uint64_t offData;
+                            rc = qcowClusterAllocate(pImage, pIoCtx, 1, &offData);
+                            if (RT_FAILURE(rc))
+                            {
+                                qcowL2TblCacheEntryRelease(pL2Entry);
+                                break;
+                            }
+
                             /* Allocate new async cluster allocation state. */
                             pDataClusterAlloc = (PQCOWCLUSTERASYNCALLOC)RTMemAllocZ(sizeof(QCOWCLUSTERASYNCALLOC));
                             if (RT_UNLIKELY(!pDataClusterAlloc))
                             {
+                                qcowL2TblCacheEntryRelease(pL2Entry);
                                 rc = VERR_NO_MEMORY;
                                 break;
                             }
 
-                            /* Allocate new cluster for the data. */
-                            uint64_t offData = qcowClusterAllocate(pImage, 1);
-
                             pDataClusterAlloc->enmAllocState     = QCOWCLUSTERASYNCALLOCSTATE_USER_ALLOC;
                             pDataClusterAlloc->offNextClusterOld = offData;
                             pDataClusterAlloc->offClusterNew     = offData;
@@ -2144,8 +2732,10 @@ static DECLCALLBACK(int) qcowFlush(void *pBackendData, PVDIOCTX pIoCtx)
     {
         QCowHeader Header;
 
-        rc = qcowTblWrite(pImage, pIoCtx, pImage->offL1Table, pImage->paL1Table,
-                          pImage->cbL1Table, pImage->cL1TableEntries, NULL, NULL);
+        rc = qcowRefcountFlush(pImage, pIoCtx);
+        if (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            rc = qcowTblWrite(pImage, pIoCtx, pImage->offL1Table, pImage->paL1Table,
+                              pImage->cbL1Table, pImage->cL1TableEntries, NULL, NULL);
         if (RT_SUCCESS(rc) || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
         {
             /* Write header. */
@@ -2383,6 +2973,11 @@ static DECLCALLBACK(void) qcowDump(void *pBackendData)
                      pImage->PCHSGeometry.cCylinders, pImage->PCHSGeometry.cHeads, pImage->PCHSGeometry.cSectors,
                      pImage->LCHSGeometry.cCylinders, pImage->LCHSGeometry.cHeads, pImage->LCHSGeometry.cSectors,
                      pImage->cbSize / 512);
+    vdIfErrorMessage(pImage->pIfError, "L2 cache: cbUsed=%zu cbMax=%zu cHits=%llu cMisses=%llu cEvictions=%llu\n",
+                     pImage->cbL2Cache, pImage->cbL2CacheMax, pImage->cL2CacheHits, pImage->cL2CacheMisses,
+                     pImage->cL2CacheEvictions);
+    vdIfErrorMessage(pImage->pIfError, "Refcount block cache: fUpdate=%RTbool cHits=%llu cMisses=%llu\n",
+                     pImage->fRefcountUpdate, pImage->cRefcountBlkHits, pImage->cRefcountBlkMisses);
 }
 
 /** @copydoc VDIMAGEBACKEND::pfnGetParentFilename */
@@ -2430,13 +3025,16 @@ static DECLCALLBACK(int) qcowSetParentFilename(void *pBackendData, const char *p
                 if (!pImage->offBackingFilename)
                 {
                     /* Allocate new cluster. */
-                    uint64_t offData = qcowClusterAllocate(pImage, 1);
-
-                    Assert((offData & UINT32_MAX) == offData);
-                    pImage->offBackingFilename = (uint32_t)offData;
-                    pImage->cbBackingFilename  = (uint32_t)strlen(pszParentFilename);
-                    rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage,
-                                              offData + pImage->cbCluster);
+                    uint64_t offData = 0;
+                    rc = qcowClusterAllocate(pImage, NULL /*pIoCtx*/, 1, &offData);
+                    if (RT_SUCCESS(rc))
+                    {
+                        Assert((offData & UINT32_MAX) == offData);
+                        pImage->offBackingFilename = (uint32_t)offData;
+                        pImage->cbBackingFilename  = (uint32_t)strlen(pszParentFilename);
+                        rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage,
+                                                  offData + pImage->cbCluster);
+                    }
                 }
 
                 if (RT_SUCCESS(rc))
@@ -2467,7 +3065,7 @@ const VDIMAGEBACKEND g_QCowBackend =
     /* paFileExtensions */
     s_aQCowFileExtensions,
     /* paConfigInfo */
-    NULL,
+    s_aQCowConfigInfo,
     /* pfnProbe */
     qcowProbe,
     /* pfnOpen */
@@ -28,6 +28,10 @@
 #include <iprt/alloc.h>
 #include <iprt/file.h>
 #include <iprt/asm.h>
+#include <iprt/avl.h>
+#include <iprt/list.h>
+#include <iprt/mem.h>
+#include <iprt/uuid.h>
 
 #include "VDBackends.h"
 
@@ -207,6 +211,15 @@ typedef uint8_t VciBlkMapEnt;
 *   Constants And Macros, Structures and Typedefs                                                                                *
 *********************************************************************************************************************************/
 
+/** Size of the block bitmap on the disk in blocks including the header for the given number of blocks. */
+#define VCI_BLKMAP_BLOCKS(a_cBlocks) \
+    (VCI_BYTE2BLOCK(RT_ALIGN_64(((a_cBlocks) + 7) / 8, VCI_BLOCK_SIZE)) + VCI_BYTE2BLOCK(sizeof(VciBlkMap)))
+
+/** Maximum number of blocks a single extent covers, keeps eviction granular. */
+#define VCI_EXTENT_BLOCKS_MAX      VCI_BYTE2BLOCK(_1M)
+/** Maximum depth of the B+-Tree accepted when loading an image. */
+#define VCI_TREE_DEPTH_MAX         8
+
 /**
  * Block range descriptor.
  */
@@ -242,94 +255,60 @@ typedef struct VCIBLKMAP
     PVCIBLKRANGEDESC pRangesHead;
     /** Pointer to the tail of the block range list. */
     PVCIBLKRANGEDESC pRangesTail;
+    /** Range to start the search for free blocks at (next fit), NULL for the head. */
+    PVCIBLKRANGEDESC pRangeRover;
 
 } VCIBLKMAP;
 /** Pointer to a block map. */
 typedef VCIBLKMAP *PVCIBLKMAP;
 
 /**
- * B+-Tree node header.
- */
-typedef struct VCITREENODE
-{
-    /** Type of the node (VCI_TREE_NODE_TYPE_*). */
-    uint8_t             u8Type;
-    /** Block address where the node is stored. */
-    uint64_t            u64BlockAddr;
-    /** Pointer to the parent. */
-    struct VCITREENODE *pParent;
-} VCITREENODE, *PVCITREENODE;
-
-/**
- * B+-Tree node pointer.
- */
-typedef struct VCITREENODEPTR
-{
-    /** Flag whether the node is in memory or still on the disk. */
-    bool         fInMemory;
-    /** Type dependent data. */
-    union
-    {
-        /** Pointer to a in memory node. */
-        PVCITREENODE pNode;
-        /** Start block address of the node. */
-        uint64_t     offAddrBlockNode;
-    } u;
-} VCITREENODEPTR, *PVCITREENODEPTR;
-
-/**
- * Internal node.
+ * A in memory cache extent.
  */
-typedef struct VCINODEINTERNAL
+typedef struct VCICACHEEXTENT
 {
-    /** First block of cached data the internal node represents. */
-    uint64_t       u64BlockOffset;
-    /** Number of blocks the internal node represents. */
-    uint32_t       u32Blocks;
-    /** Pointer to the child node. */
-    VCITREENODEPTR PtrChild;
-} VCINODEINTERNAL, *PVCINODEINTERNAL;
+    /** AVL tree core, the key range is the range of cached blocks the extent represents. */
+    AVLRU64NODECORE Core;
+    /** LRU list node, most recently used extents are at the head. */
+    RTLISTNODE      NodeLru;
+    /** First block in the image where the data is stored. */
+    uint64_t        u64BlockAddr;
+} VCICACHEEXTENT, *PVCICACHEEXTENT;
 
-/**
- * A in memory internal B+-tree node.
- */
-typedef struct VCITREENODEINT
-{
-    /** Node core. */
-    VCITREENODE     Core;
-    /** Number of used nodes. */
-    unsigned        cUsedNodes;
-    /** Array of internal nodes. */
-    VCINODEINTERNAL aIntNodes[VCI_TREE_INTERNAL_NODES_PER_NODE];
-} VCITREENODEINT, *PVCITREENODEINT;
+/** Returns the number of blocks the given extent covers. */
+#define VCI_EXTENT_BLOCKS(a_pExtent) ((a_pExtent)->Core.KeyLast - (a_pExtent)->Core.Key + 1)
 
 /**
- * A in memory cache extent.
+ * Child descriptor used while writing the B+-Tree to the image.
  */
-typedef struct VCICACHEEXTENT
+typedef struct VCITREECHILD
 {
-    /** First block of cached data the extent represents. */
+    /** First block of cached data the child represents. */
     uint64_t    u64BlockOffset;
-    /** Number of blocks the extent represents. */
-    uint32_t    u32Blocks;
-    /** First block in the image where the data is stored. */
-    uint64_t    u64BlockAddr;
-} VCICACHEEXTENT, *PVCICACHEEXTENT;
+    /** Last block of cached data the child represents. */
+    uint64_t    u64BlockLast;
+    /** Block address of the child node in the image. */
+    uint64_t    u64ChildAddr;
+} VCITREECHILD, *PVCITREECHILD;
 
 /**
- * A in memory leaf B+-tree node.
+ * State for writing the leaf nodes of the B+-Tree.
  */
-typedef struct VCITREENODELEAF
-{
-    /** Node core. */
-    VCITREENODE             Core;
-    /** Next leaf node in the list. */
-    struct VCITREENODELEAF *pNext;
-    /** Number of used nodes. */
-    unsigned                cUsedNodes;
-    /** The extents in the node. */
-    VCICACHEEXTENT          aExtents[VCI_TREE_EXTENTS_PER_NODE];
-} VCITREENODELEAF, *PVCITREENODELEAF;
+typedef struct VCITREELEAFWRITER
+{
+    /** The cache image. */
+    struct VCICACHE *pCache;
+    /** The on disk node being filled. */
+    VciTreeNode      Node;
+    /** Number of extents in the current node. */
+    unsigned         cExtents;
+    /** Array of child descriptors for the next level. */
+    PVCITREECHILD    paChildren;
+    /** Number of leaves written so far. */
+    uint32_t         cLeaves;
+    /** Array of node addresses to write the leaves to. */
+    uint64_t        *paNodeAddrs;
+} VCITREELEAFWRITER, *PVCITREELEAFWRITER;
 
 /**
  * VCI image data structure.
@@ -356,15 +335,35 @@ typedef struct VCICACHE
     unsigned          uImageFlags;
     /** Total size of the image. */
     uint64_t          cbSize;
+    /** Total size of the image in blocks. */
+    uint64_t          cBlocksCache;
+    /** UUID of the image. */
+    RTUUID            ImageUuid;
+    /** Modification UUID of the image. */
+    RTUUID            ModificationUuid;
 
-    /** Offset of the B+-Tree in the image in bytes. */
+    /** Offset of the B+-Tree root in the image in blocks. */
     uint64_t          offTreeRoot;
-    /** Pointer to the root node of the B+-Tree. */
-    PVCITREENODE      pRoot;
-    /** Offset to the block allocation bitmap in bytes. */
+    /** Offset to the block allocation bitmap in blocks. */
     uint64_t          offBlksBitmap;
+    /** Size of the block allocation bitmap in blocks. */
+    uint32_t          cBlkMap;
     /** Block map. */
     PVCIBLKMAP        pBlkMap;
+
+    /** The extent tree indexing all cached data. */
+    AVLRU64TREE       TreeExtents;
+    /** LRU list of all extents. */
+    RTLISTANCHOR      ListLru;
+    /** Number of extents in the tree. */
+    uint64_t          cExtents;
+    /** Block addresses of the B+-Tree nodes currently stored in the image. */
+    uint64_t         *paNodeAddrs;
+    /** Number of entries in paNodeAddrs. */
+    uint32_t          cNodeAddrs;
+    /** Flag whether the metadata in the image is outdated, the header is
+     * marked as unclean while this is set. */
+    bool              fMetaDirty;
 } VCICACHE, *PVCICACHE;
 
 /** No block free in bitmap error code. */
@@ -392,6 +391,8 @@ static const char *const s_apszVciFileExtensions[] =
 *   Internal Functions                                                                                                           *
 *********************************************************************************************************************************/
 
+static int vciMetaSave(PVCICACHE pCache);
+
 /**
  * Internal. Flush image data to disk.
  */
@@ -408,6 +409,94 @@ static int vciFlushImage(PVCICACHE pCache)
     return rc;
 }
 
+/**
+ * Internal. Writes the header of the image.
+ *
+ * @returns VBox status code.
+ * @param   pCache          The cache image instance.
+ * @param   fUnclean        Flag whether to mark the image as not closed cleanly.
+ */
+static int vciHdrWrite(PVCICACHE pCache, bool fUnclean)
+{
+    VciHdr Hdr;
+
+    memset(&Hdr, 0, sizeof(VciHdr));
+    Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
+    Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
+    Hdr.cBlocksCache     = RT_H2LE_U64(pCache->cBlocksCache);
+    Hdr.fUncleanShutdown = fUnclean ? VCI_HDR_UNCLEAN_SHUTDOWN : VCI_HDR_CLEAN_SHUTDOWN;
+    Hdr.u32CacheType     = pCache->uImageFlags & VD_IMAGE_FLAGS_FIXED
+                           ? RT_H2LE_U32(VCI_HDR_CACHE_TYPE_FIXED)
+                           : RT_H2LE_U32(VCI_HDR_CACHE_TYPE_DYNAMIC);
+    Hdr.offTreeRoot      = RT_H2LE_U64(pCache->offTreeRoot);
+    Hdr.offBlkMap        = RT_H2LE_U64(pCache->offBlksBitmap);
+    Hdr.cBlkMap          = RT_H2LE_U32(pCache->cBlkMap);
+    Hdr.uuidImage        = pCache->ImageUuid;
+    Hdr.uuidModification = pCache->ModificationUuid;
+
+    return vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr, sizeof(Hdr));
+}
+
+/**
+ * Internal. Marks the metadata in the image as outdated before the first
+ * modification of the cached data. The header stays marked as unclean until
+ * the metadata is written again when the image is closed.
+ *
+ * @returns VBox status code.
+ * @param   pCache          The cache image instance.
+ */
+static int vciMetaMarkDirty(PVCICACHE pCache)
+{
+    int rc = VINF_SUCCESS;
+
+    if (!pCache->fMetaDirty)
+    {
+        rc = vciHdrWrite(pCache, true /* fUnclean */);
+        if (RT_SUCCESS(rc))
+            rc = vciFlushImage(pCache);
+        if (RT_SUCCESS(rc))
+            pCache->fMetaDirty = true;
+    }
+
+    return rc;
+}
+
+/**
+ * Internal. AVL tree destruction callback freeing an extent.
+ */
+static DECLCALLBACK(int) vciExtentDestroy(PAVLRU64NODECORE pNode, void *pvUser)
+{
+    RT_NOREF1(pvUser);
+    RTMemFree(pNode);
+    return VINF_SUCCESS;
+}
+
+/**
+ * Frees a block map.
+ *
+ * @returns nothing.
+ * @param   pBlkMap         The block bitmap to destroy.
+ */
+static void vciBlkMapDestroy(PVCIBLKMAP pBlkMap)
+{
+    LogFlowFunc(("pBlkMap=%#p\n", pBlkMap));
+
+    PVCIBLKRANGEDESC pRangeCur = pBlkMap->pRangesHead;
+
+    while (pRangeCur)
+    {
+        PVCIBLKRANGEDESC pTmp = pRangeCur;
+
+        pRangeCur = pRangeCur->pNext;
+
+        RTMemFree(pTmp);
+    }
+
+    RTMemFree(pBlkMap);
+
+    LogFlowFunc(("returns\n"));
+}
+
 /**
  * Internal. Free all allocated space for representing an image except pCache,
  * and optionally delete the image from disk.
@@ -424,7 +513,11 @@ static int vciFreeImage(PVCICACHE pCache, bool fDelete)
         {
             /* No point updating the file that is deleted anyway. */
             if (!fDelete)
+            {
+                if (pCache->fMetaDirty)
+                    rc = vciMetaSave(pCache);
                 vciFlushImage(pCache);
+            }
 
             vdIfIoIntFileClose(pCache->pIfIo, pCache->pStorage);
             pCache->pStorage = NULL;
@@ -432,6 +525,25 @@ static int vciFreeImage(PVCICACHE pCache, bool fDelete)
 
         if (fDelete && pCache->pszFilename)
             vdIfIoIntFileDelete(pCache->pIfIo, pCache->pszFilename);
+
+        RTAvlrU64Destroy(&pCache->TreeExtents, vciExtentDestroy, NULL);
+        RTListInit(&pCache->ListLru);
+        pCache->cExtents = 0;
+
+        if (pCache->pBlkMap)
+        {
+            vciBlkMapDestroy(pCache->pBlkMap);
+            pCache->pBlkMap = NULL;
+        }
+
+        if (pCache->paNodeAddrs)
+        {
+            RTMemFree(pCache->paNodeAddrs);
+            pCache->paNodeAddrs = NULL;
+            pCache->cNodeAddrs  = 0;
+        }
+
+        pCache->fMetaDirty = false;
     }
 
     LogFlowFunc(("returns %Rrc\n", rc));
@@ -452,11 +564,10 @@ static int vciFreeImage(PVCICACHE pCache, bool fDelete)
 static int vciBlkMapCreate(uint64_t cBlocks, PVCIBLKMAP *ppBlkMap, uint32_t *pcBlkMap)
 {
     int rc = VINF_SUCCESS;
-    uint32_t cbBlkMap = RT_ALIGN_Z(cBlocks / sizeof(VciBlkMapEnt) / 8, VCI_BLOCK_SIZE);
     PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
     PVCIBLKRANGEDESC pFree   = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
 
-    LogFlowFunc(("cBlocks=%u ppBlkMap=%#p pcBlkMap=%#p\n", cBlocks, ppBlkMap, pcBlkMap));
+    LogFlowFunc(("cBlocks=%llu ppBlkMap=%#p pcBlkMap=%#p\n", cBlocks, ppBlkMap, pcBlkMap));
 
     if (pBlkMap && pFree)
     {
@@ -473,10 +584,10 @@ static int vciBlkMapCreate(uint64_t cBlocks, PVCIBLKMAP *ppBlkMap, uint32_t *pcB
 
         pBlkMap->pRangesHead = pFree;
         pBlkMap->pRangesTail = pFree;
+        pBlkMap->pRangeRover = NULL;
 
-        Assert(!((cbBlkMap + sizeof(VciBlkMap)) % VCI_BLOCK_SIZE));
         *ppBlkMap = pBlkMap;
-        *pcBlkMap = VCI_BYTE2BLOCK(cbBlkMap + sizeof(VciBlkMap));
+        *pcBlkMap = (uint32_t)VCI_BLKMAP_BLOCKS(cBlocks);
     }
     else
     {
@@ -488,38 +599,10 @@ static int vciBlkMapCreate(uint64_t cBlocks, PVCIBLKMAP *ppBlkMap, uint32_t *pcB
         rc = VERR_NO_MEMORY;
     }
 
-    LogFlowFunc(("returns rc=%Rrc cBlkMap=%u\n", rc, *pcBlkMap));
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
     return rc;
 }
 
-#if 0 /** @todo unsued vciBlkMapDestroy */
-/**
- * Frees a block map.
- *
- * @returns nothing.
- * @param   pBlkMap         The block bitmap to destroy.
- */
-static void vciBlkMapDestroy(PVCIBLKMAP pBlkMap)
-{
-    LogFlowFunc(("pBlkMap=%#p\n", pBlkMap));
-
-    PVCIBLKRANGEDESC pRangeCur = pBlkMap->pRangesHead;
-
-    while (pRangeCur)
-    {
-        PVCIBLKRANGEDESC pTmp = pRangeCur;
-
-        RTMemFree(pTmp);
-
-        pRangeCur = pRangeCur->pNext;
-    }
-
-    RTMemFree(pBlkMap);
-
-    LogFlowFunc(("returns\n"));
-}
-#endif
-
 /**
  * Loads the block map from the specified medium and creates all necessary
  * in memory structures to manage used and free blocks.
@@ -540,25 +623,23 @@ static int vciBlkMapLoad(PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMa
 
     if (cBlkMap >= VCI_BYTE2BLOCK(sizeof(VciBlkMap)))
     {
-        cBlkMap -= VCI_BYTE2BLOCK(sizeof(VciBlkMap));
-
-        rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage, offBlkMap,
-                                   &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
+        rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage, VCI_BLOCK2BYTE(offBlkMap),
+                                   &BlkMap, sizeof(VciBlkMap));
         if (RT_SUCCESS(rc))
         {
             offBlkMap += VCI_BYTE2BLOCK(sizeof(VciBlkMap));
 
             BlkMap.u32Magic         = RT_LE2H_U32(BlkMap.u32Magic);
             BlkMap.u32Version       = RT_LE2H_U32(BlkMap.u32Version);
-            BlkMap.cBlocks          = RT_LE2H_U32(BlkMap.cBlocks);
-            BlkMap.cBlocksFree      = RT_LE2H_U32(BlkMap.cBlocksFree);
-            BlkMap.cBlocksAllocMeta = RT_LE2H_U32(BlkMap.cBlocksAllocMeta);
-            BlkMap.cBlocksAllocData = RT_LE2H_U32(BlkMap.cBlocksAllocData);
+            BlkMap.cBlocks          = RT_LE2H_U64(BlkMap.cBlocks);
+            BlkMap.cBlocksFree      = RT_LE2H_U64(BlkMap.cBlocksFree);
+            BlkMap.cBlocksAllocMeta = RT_LE2H_U64(BlkMap.cBlocksAllocMeta);
+            BlkMap.cBlocksAllocData = RT_LE2H_U64(BlkMap.cBlocksAllocData);
 
             if (   BlkMap.u32Magic == VCI_BLKMAP_MAGIC
                 && BlkMap.u32Version == VCI_BLKMAP_VERSION
                 && BlkMap.cBlocks == BlkMap.cBlocksFree + BlkMap.cBlocksAllocMeta + BlkMap.cBlocksAllocData
-                && VCI_BYTE2BLOCK(BlkMap.cBlocks / 8) == cBlkMap)
+                && VCI_BLKMAP_BLOCKS(BlkMap.cBlocks) == cBlkMap)
             {
                 PVCIBLKMAP pBlkMap = (PVCIBLKMAP)RTMemAllocZ(sizeof(VCIBLKMAP));
                 if (pBlkMap)
@@ -569,98 +650,78 @@ static int vciBlkMapLoad(PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMa
                     pBlkMap->cBlocksAllocData = BlkMap.cBlocksAllocData;
 
                     /* Load the bitmap and construct the range list. */
-                    PVCIBLKRANGEDESC pRangeCur = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+                    uint8_t abBitmapBuffer[16 * _1K];
+                    uint64_t iBlock = 0;
+                    uint64_t cBlocksFree = 0;
+                    PVCIBLKRANGEDESC pRangeCur = NULL;
 
-                    if (pRangeCur)
+                    while (   RT_SUCCESS(rc)
+                           && iBlock < pBlkMap->cBlocks)
                     {
-                        uint8_t abBitmapBuffer[16 * _1K];
-                        uint32_t cBlocksRead = 0;
-                        uint64_t cBlocksLeft = VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8);
+                        uint32_t cBits  = (uint32_t)RT_MIN(pBlkMap->cBlocks - iBlock, sizeof(abBitmapBuffer) * 8);
+                        size_t   cbRead = RT_ALIGN_Z((cBits + 7) / 8, VCI_BLOCK_SIZE);
 
-                        cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
                         rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage,
-                                                   offBlkMap, abBitmapBuffer,
-                                                   cBlocksRead);
-
-                        if (RT_SUCCESS(rc))
-                        {
-                            pRangeCur->fFree        = !(abBitmapBuffer[0] & 0x01);
-                            pRangeCur->offAddrStart = 0;
-                            pRangeCur->cBlocks      = 0;
-                            pRangeCur->pNext        = NULL;
-                            pRangeCur->pPrev        = NULL;
-                            pBlkMap->pRangesHead = pRangeCur;
-                            pBlkMap->pRangesTail = pRangeCur;
-                        }
-                        else
-                            RTMemFree(pRangeCur);
+                                                   VCI_BLOCK2BYTE(offBlkMap), abBitmapBuffer,
+                                                   cbRead);
+                        if (RT_FAILURE(rc))
+                            break;
 
-                        while (   RT_SUCCESS(rc)
-                               && cBlocksLeft)
+                        uint32_t iBit = 0;
+                        while (iBit < cBits)
                         {
-                            int iBit = 0;
-                            uint32_t cBits = VCI_BLOCK2BYTE(cBlocksRead) * 8;
-                            uint32_t iBitPrev = 0xffffffff;
+                            bool fFree = !ASMBitTest(abBitmapBuffer, (int32_t)iBit);
+                            uint32_t iBitEnd = iBit + 1;
 
-                            while (cBits)
+                            /* Search for the end of the run, skipping whole bytes where possible. */
+                            while (iBitEnd < cBits)
                             {
-                                if (pRangeCur->fFree)
-                                {
-                                    /* Check for the first set bit. */
-                                    iBit = ASMBitNextSet(abBitmapBuffer, cBits, iBitPrev);
-                                }
+                                if (   !(iBitEnd % 8)
+                                    && iBitEnd + 8 <= cBits
+                                    && abBitmapBuffer[iBitEnd / 8] == (fFree ? 0x00 : 0xff))
+                                    iBitEnd += 8;
+                                else if (RT_BOOL(ASMBitTest(abBitmapBuffer, (int32_t)iBitEnd)) != fFree)
+                                    iBitEnd++;
                                 else
-                                {
-                                    /* Check for the first free bit. */
-                                    iBit = ASMBitNextClear(abBitmapBuffer, cBits, iBitPrev);
-                                }
+                                    break;
+                            }
 
-                                if (iBit == -1)
+                            if (   pRangeCur
+                                && pRangeCur->fFree == fFree)
+                                pRangeCur->cBlocks += iBitEnd - iBit;
+                            else
+                            {
+                                PVCIBLKRANGEDESC pRangeNew = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+                                if (!pRangeNew)
                                 {
-                                    /* No change. */
-                                    pRangeCur->cBlocks += cBits;
-                                    cBits = 0;
+                                    rc = VERR_NO_MEMORY;
+                                    break;
                                 }
-                                else
-                                {
-                                    Assert((uint32_t)iBit < cBits);
-                                    pRangeCur->cBlocks += iBit;
-
-                                    /* Create a new range descriptor. */
-                                    PVCIBLKRANGEDESC pRangeNew = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
-                                    if (!pRangeNew)
-                                    {
-                                        rc = VERR_NO_MEMORY;
-                                        break;
-                                    }
-
-                                    pRangeNew->fFree = !pRangeCur->fFree;
-                                    pRangeNew->offAddrStart = pRangeCur->offAddrStart + pRangeCur->cBlocks;
-                                    pRangeNew->cBlocks = 0;
-                                    pRangeNew->pPrev = pRangeCur;
+
+                                pRangeNew->fFree        = fFree;
+                                pRangeNew->offAddrStart = iBlock + iBit;
+                                pRangeNew->cBlocks      = iBitEnd - iBit;
+                                pRangeNew->pPrev        = pRangeCur;
+                                if (pRangeCur)
                                     pRangeCur->pNext = pRangeNew;
-                                    pBlkMap->pRangesTail = pRangeNew;
-                                    pRangeCur = pRangeNew;
-                                    cBits -= iBit;
-                                    iBitPrev = iBit;
-                                }
+                                else
+                                    pBlkMap->pRangesHead = pRangeNew;
+                                pBlkMap->pRangesTail = pRangeNew;
+                                pRangeCur = pRangeNew;
                             }
 
-                            cBlocksLeft -= cBlocksRead;
-                            offBlkMap   += cBlocksRead;
-
-                            if (   RT_SUCCESS(rc)
-                                && cBlocksLeft)
-                            {
-                                /* Read next chunk. */
-                                cBlocksRead = RT_MIN(VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)), cBlocksLeft);
-                                rc = vdIfIoIntFileReadSync(pStorage->pIfIo, pStorage->pStorage,
-                                                           offBlkMap, abBitmapBuffer, cBlocksRead);
-                            }
+                            if (fFree)
+                                cBlocksFree += iBitEnd - iBit;
+                            iBit = iBitEnd;
                         }
+
+                        iBlock    += cBits;
+                        offBlkMap += VCI_BYTE2BLOCK(cbRead);
                     }
-                    else
-                        rc = VERR_NO_MEMORY;
+
+                    if (   RT_SUCCESS(rc)
+                        && cBlocksFree != pBlkMap->cBlocksFree)
+                        rc = VERR_VD_GEN_INVALID_HEADER;
 
                     if (RT_SUCCESS(rc))
                     {
@@ -669,7 +730,7 @@ static int vciBlkMapLoad(PVCICACHE pStorage, uint64_t offBlkMap, uint32_t cBlkMa
                         return VINF_SUCCESS;
                     }
 
-                    RTMemFree(pBlkMap);
+                    vciBlkMapDestroy(pBlkMap);
                 }
                 else
                     rc = VERR_NO_MEMORY;
@@ -706,41 +767,41 @@ static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlk
                  pBlkMap, pStorage, offBlkMap, cBlkMap));
 
     /* Make sure the number of blocks allocated for us match our expectations. */
-    if (VCI_BYTE2BLOCK(pBlkMap->cBlocks / 8) + VCI_BYTE2BLOCK(sizeof(VciBlkMap)) == cBlkMap)
+    if (VCI_BLKMAP_BLOCKS(pBlkMap->cBlocks) == cBlkMap)
     {
         /* Setup the header */
         memset(&BlkMap, 0, sizeof(VciBlkMap));
 
         BlkMap.u32Magic         = RT_H2LE_U32(VCI_BLKMAP_MAGIC);
         BlkMap.u32Version       = RT_H2LE_U32(VCI_BLKMAP_VERSION);
-        BlkMap.cBlocks          = RT_H2LE_U32(pBlkMap->cBlocks);
-        BlkMap.cBlocksFree      = RT_H2LE_U32(pBlkMap->cBlocksFree);
-        BlkMap.cBlocksAllocMeta = RT_H2LE_U32(pBlkMap->cBlocksAllocMeta);
-        BlkMap.cBlocksAllocData = RT_H2LE_U32(pBlkMap->cBlocksAllocData);
+        BlkMap.cBlocks          = RT_H2LE_U64(pBlkMap->cBlocks);
+        BlkMap.cBlocksFree      = RT_H2LE_U64(pBlkMap->cBlocksFree);
+        BlkMap.cBlocksAllocMeta = RT_H2LE_U64(pBlkMap->cBlocksAllocMeta);
+        BlkMap.cBlocksAllocData = RT_H2LE_U64(pBlkMap->cBlocksAllocData);
 
-        rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage, offBlkMap,
-                                    &BlkMap, VCI_BYTE2BLOCK(sizeof(VciBlkMap)));
+        rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage, VCI_BLOCK2BYTE(offBlkMap),
+                                    &BlkMap, sizeof(VciBlkMap));
         if (RT_SUCCESS(rc))
         {
             uint8_t abBitmapBuffer[16*_1K];
-            unsigned iBit = 0;
+            uint32_t iBit = 0;
             PVCIBLKRANGEDESC pCur = pBlkMap->pRangesHead;
 
             offBlkMap += VCI_BYTE2BLOCK(sizeof(VciBlkMap));
+            memset(abBitmapBuffer, 0, sizeof(abBitmapBuffer));
 
             /* Write the descriptor ranges. */
-            while (pCur)
+            while (   pCur
+                   && RT_SUCCESS(rc))
             {
                 uint64_t cBlocks = pCur->cBlocks;
 
                 while (cBlocks)
                 {
-                    uint64_t cBlocksMax = RT_MIN(cBlocks, sizeof(abBitmapBuffer) * 8 - iBit);
+                    uint32_t cBlocksMax = (uint32_t)RT_MIN(cBlocks, sizeof(abBitmapBuffer) * 8 - iBit);
 
-                    if (pCur->fFree)
-                        ASMBitClearRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
-                    else
-                        ASMBitSetRange(abBitmapBuffer, iBit, iBit + cBlocksMax);
+                    if (!pCur->fFree)
+                        ASMBitSetRange(abBitmapBuffer, (int32_t)iBit, (int32_t)(iBit + cBlocksMax));
 
                     iBit    += cBlocksMax;
                     cBlocks -= cBlocksMax;
@@ -749,12 +810,13 @@ static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlk
                     {
                         /* Buffer is full, write to file and reset. */
                         rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage,
-                                                    offBlkMap, abBitmapBuffer,
-                                                    VCI_BYTE2BLOCK(sizeof(abBitmapBuffer)));
+                                                    VCI_BLOCK2BYTE(offBlkMap), abBitmapBuffer,
+                                                    sizeof(abBitmapBuffer));
                         if (RT_FAILURE(rc))
                             break;
 
                         offBlkMap += VCI_BYTE2BLOCK(sizeof(abBitmapBuffer));
+                        memset(abBitmapBuffer, 0, sizeof(abBitmapBuffer));
                         iBit = 0;
                     }
                 }
@@ -762,11 +824,10 @@ static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlk
                 pCur = pCur->pNext;
             }
 
-            Assert(iBit % 8 == 0);
-
             if (RT_SUCCESS(rc) && iBit)
                 rc = vdIfIoIntFileWriteSync(pStorage->pIfIo, pStorage->pStorage,
-                                            offBlkMap, abBitmapBuffer, VCI_BYTE2BLOCK(iBit / 8));
+                                            VCI_BLOCK2BYTE(offBlkMap), abBitmapBuffer,
+                                            RT_ALIGN_32((iBit + 7) / 8, VCI_BLOCK_SIZE));
         }
     }
     else
@@ -776,7 +837,6 @@ static int vciBlkMapSave(PVCIBLKMAP pBlkMap, PVCICACHE pStorage, uint64_t offBlk
     return rc;
 }
 
-#if 0 /* unused */
 /**
  * Finds the range block describing the given block address.
  *
@@ -789,16 +849,103 @@ static PVCIBLKRANGEDESC vciBlkMapFindByBlock(PVCIBLKMAP pBlkMap, uint64_t offBlo
     PVCIBLKRANGEDESC pBlk = pBlkMap->pRangesHead;
 
     while (   pBlk
-           && pBlk->offAddrStart < offBlockAddr)
+           && pBlk->offAddrStart + pBlk->cBlocks <= offBlockAddr)
         pBlk = pBlk->pNext;
 
     return pBlk;
 }
-#endif
+
+/**
+ * Splits the given range into two at the given block count.
+ *
+ * @returns Pointer to the second part or NULL if out of memory.
+ * @param   pBlkMap         The block bitmap.
+ * @param   pRange          The range to split.
+ * @param   cBlocksFirst    Number of blocks remaining in the first part.
+ */
+static PVCIBLKRANGEDESC vciBlkMapRangeSplit(PVCIBLKMAP pBlkMap, PVCIBLKRANGEDESC pRange, uint64_t cBlocksFirst)
+{
+    Assert(cBlocksFirst && cBlocksFirst < pRange->cBlocks);
+
+    PVCIBLKRANGEDESC pSecond = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+    if (pSecond)
+    {
+        pSecond->fFree        = pRange->fFree;
+        pSecond->offAddrStart = pRange->offAddrStart + cBlocksFirst;
+        pSecond->cBlocks      = pRange->cBlocks - cBlocksFirst;
+        pRange->cBlocks       = cBlocksFirst;
+
+        /* Link into the list. */
+        pSecond->pPrev = pRange;
+        pSecond->pNext = pRange->pNext;
+        if (pRange->pNext)
+            pRange->pNext->pPrev = pSecond;
+        else
+            pBlkMap->pRangesTail = pSecond;
+        pRange->pNext = pSecond;
+    }
+
+    return pSecond;
+}
+
+/**
+ * Merges the given range with its neighbours if they are in the same state.
+ *
+ * @returns Pointer to the merged range.
+ * @param   pBlkMap         The block bitmap.
+ * @param   pRange          The range to merge.
+ */
+static PVCIBLKRANGEDESC vciBlkMapRangeMerge(PVCIBLKMAP pBlkMap, PVCIBLKRANGEDESC pRange)
+{
+    /* The one to the left first. */
+    if (   pRange->pPrev
+        && pRange->pPrev->fFree == pRange->fFree)
+    {
+        PVCIBLKRANGEDESC pBlkPrev = pRange->pPrev;
+
+        Assert(pBlkPrev->offAddrStart + pBlkPrev->cBlocks == pRange->offAddrStart);
+        pBlkPrev->cBlocks += pRange->cBlocks;
+        pBlkPrev->pNext = pRange->pNext;
+        if (pRange->pNext)
+            pRange->pNext->pPrev = pBlkPrev;
+        else
+            pBlkMap->pRangesTail = pBlkPrev;
+
+        if (pBlkMap->pRangeRover == pRange)
+            pBlkMap->pRangeRover = pBlkPrev;
+        RTMemFree(pRange);
+        pRange = pBlkPrev;
+    }
+
+    /* Now the one to the right. */
+    if (   pRange->pNext
+        && pRange->pNext->fFree == pRange->fFree)
+    {
+        PVCIBLKRANGEDESC pBlkNext = pRange->pNext;
+
+        Assert(pRange->offAddrStart + pRange->cBlocks == pBlkNext->offAddrStart);
+        pRange->cBlocks += pBlkNext->cBlocks;
+        pRange->pNext = pBlkNext->pNext;
+        if (pBlkNext->pNext)
+            pBlkNext->pNext->pPrev = pRange;
+        else
+            pBlkMap->pRangesTail = pRange;
+
+        if (pBlkMap->pRangeRover == pBlkNext)
+            pBlkMap->pRangeRover = pRange;
+        RTMemFree(pBlkNext);
+    }
+
+    return pRange;
+}
 
 /**
  * Allocates the given number of blocks in the bitmap and returns the start block address.
  *
+ * The search starts where the last allocation ended (next fit) so sequentially
+ * cached data ends up contiguous in the image and the range list doesn't need
+ * to be walked from the start for every allocation.
+ *
  * @returns VBox status code.
  * @param   pBlkMap          The block bitmap to allocate the blocks from.
  * @param   cBlocks          How many blocks to allocate.
@@ -808,402 +955,734 @@ static PVCIBLKRANGEDESC vciBlkMapFindByBlock(PVCIBLKMAP pBlkMap, uint64_t offBlo
 static int vciBlkMapAllocate(PVCIBLKMAP pBlkMap, uint32_t cBlocks, uint32_t fFlags,
                              uint64_t *poffBlockAddr)
 {
-    PVCIBLKRANGEDESC pBestFit = NULL;
-    PVCIBLKRANGEDESC pCur = NULL;
+    PVCIBLKRANGEDESC pFit = NULL;
     int rc = VINF_SUCCESS;
 
     LogFlowFunc(("pBlkMap=%#p cBlocks=%u poffBlockAddr=%#p\n",
                  pBlkMap, cBlocks, poffBlockAddr));
 
-    pCur = pBlkMap->pRangesHead;
+    if (pBlkMap->cBlocksFree >= cBlocks)
+    {
+        PVCIBLKRANGEDESC pStart = pBlkMap->pRangeRover ? pBlkMap->pRangeRover : pBlkMap->pRangesHead;
+        PVCIBLKRANGEDESC pCur = pStart;
 
-    while (pCur)
+        do
+        {
+            if (   pCur->fFree
+                && pCur->cBlocks >= cBlocks)
+            {
+                pFit = pCur;
+                break;
+            }
+            pCur = pCur->pNext ? pCur->pNext : pBlkMap->pRangesHead;
+        } while (pCur != pStart);
+    }
+
+    if (pFit)
     {
-        if (   pCur->fFree
-            && pCur->cBlocks >= cBlocks)
+        Assert(pFit->fFree);
+
+        /* Split off the remaining free blocks. */
+        if (   pFit->cBlocks > cBlocks
+            && !vciBlkMapRangeSplit(pBlkMap, pFit, cBlocks))
+            rc = VERR_NO_MEMORY;
+        else
         {
-            if (   !pBestFit
-                || pCur->cBlocks < pBestFit->cBlocks)
+            *poffBlockAddr = pFit->offAddrStart;
+            pFit->fFree = false;
+
+            pFit = vciBlkMapRangeMerge(pBlkMap, pFit);
+            pBlkMap->pRangeRover = pFit->pNext;
+        }
+    }
+    else
+        rc = VERR_VCI_NO_BLOCKS_FREE;
+
+    if (RT_SUCCESS(rc))
+    {
+        if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
+            pBlkMap->cBlocksAllocData += cBlocks;
+        else
+            pBlkMap->cBlocksAllocMeta += cBlocks;
+
+        pBlkMap->cBlocksFree -= cBlocks;
+    }
+
+    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, RT_SUCCESS(rc) ? *poffBlockAddr : 0));
+    return rc;
+}
+
+#if 0 /* unused */
+/**
+ * Try to extend the space of an already allocated block.
+ *
+ * @returns VBox status code.
+ * @param   pBlkMap          The block bitmap to allocate the blocks from.
+ * @param   cBlocksNew       How many blocks the extended block should have.
+ * @param   offBlockAddrOld  The start address of the block to reallocate.
+ * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ */
+static int vciBlkMapRealloc(PVCIBLKMAP pBlkMap, uint32_t cBlocksNew, uint64_t offBlockAddrOld,
+                            uint64_t *poffBlockAddr)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pBlkMap=%#p cBlocksNew=%u offBlockAddrOld=%llu poffBlockAddr=%#p\n",
+                 pBlkMap, cBlocksNew, offBlockAddrOld, poffBlockAddr));
+
+    AssertMsgFailed(("Implement\n"));
+    RT_NOREF4(pBlkMap, cBlocksNew, offBlockAddrOld, poffBlockAddr);
+
+    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
+    return rc;
+}
+#endif /* unused */
+
+/**
+ * Frees a range of blocks.
+ *
+ * @returns VBox status code.
+ * @param   pBlkMap          The block bitmap.
+ * @param   offBlockAddr     Address of the first block to free.
+ * @param   cBlocks          How many blocks to free.
+ * @param   fFlags           Allocation flags, comgination of VCIBLKMAP_ALLOC_*.
+ */
+static int vciBlkMapFree(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr, uint32_t cBlocks,
+                         uint32_t fFlags)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pBlkMap=%#p offBlockAddr=%llu cBlocks=%u\n",
+                 pBlkMap, offBlockAddr, cBlocks));
+
+    while (cBlocks)
+    {
+        PVCIBLKRANGEDESC pBlk = vciBlkMapFindByBlock(pBlkMap, offBlockAddr);
+        AssertPtrBreakStmt(pBlk, rc = VERR_INTERNAL_ERROR);
+        AssertBreakStmt(!pBlk->fFree, rc = VERR_INTERNAL_ERROR);
+
+        /* Split off the part in front of the freed region. */
+        if (pBlk->offAddrStart < offBlockAddr)
+        {
+            pBlk = vciBlkMapRangeSplit(pBlkMap, pBlk, offBlockAddr - pBlk->offAddrStart);
+            if (!pBlk)
             {
-                pBestFit = pCur;
-                /* Stop searching if the size is matching exactly. */
-                if (pBestFit->cBlocks == cBlocks)
-                    break;
+                rc = VERR_NO_MEMORY;
+                break;
             }
         }
-        pCur = pCur->pNext;
+
+        /* Split off the part behind the freed region. */
+        if (   pBlk->cBlocks > cBlocks
+            && !vciBlkMapRangeSplit(pBlkMap, pBlk, cBlocks))
+        {
+            rc = VERR_NO_MEMORY;
+            break;
+        }
+
+        uint32_t cBlocksFreed = (uint32_t)pBlk->cBlocks;
+
+        pBlk->fFree = true;
+        vciBlkMapRangeMerge(pBlkMap, pBlk);
+
+        if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
+            pBlkMap->cBlocksAllocData -= cBlocksFreed;
+        else
+            pBlkMap->cBlocksAllocMeta -= cBlocksFreed;
+
+        pBlkMap->cBlocksFree += cBlocksFreed;
+        offBlockAddr         += cBlocksFreed;
+        cBlocks              -= cBlocksFreed;
     }
 
-    Assert(!pBestFit || pBestFit->fFree);
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Marks the given extent as the most recently used one.
+ *
+ * @returns nothing.
+ * @param   pCache         The cache image instance.
+ * @param   pExtent        The extent.
+ */
+DECLINLINE(void) vciCacheExtentTouch(PVCICACHE pCache, PVCICACHEEXTENT pExtent)
+{
+    RTListNodeRemove(&pExtent->NodeLru);
+    RTListPrepend(&pCache->ListLru, &pExtent->NodeLru);
+}
+
+/**
+ * Looks up the cache extent for the given virtual block address.
+ *
+ * @returns Pointer to the cache extent or NULL if none could be found.
+ * @param   pCache         The cache image instance.
+ * @param   offBlockOffset The block offset to search for.
+ * @param   ppNextBestFit  Where to store the pointer to the next best fit
+ *                         cache extent above offBlockOffset if existing. - Optional
+ *                         This is always filled if possible even if the function returns NULL.
+ */
+static PVCICACHEEXTENT vciCacheExtentLookup(PVCICACHE pCache, uint64_t offBlockOffset,
+                                            PVCICACHEEXTENT *ppNextBestFit)
+{
+    PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, offBlockOffset);
 
-    if (pBestFit)
+    if (ppNextBestFit)
     {
-        pBestFit->fFree = false;
+        uint64_t offNext = pExtent ? pExtent->Core.KeyLast + 1 : offBlockOffset;
+        *ppNextBestFit = offNext ? (PVCICACHEEXTENT)RTAvlrU64GetBestFit(&pCache->TreeExtents, offNext, true /*fAbove*/)
+                                 : NULL;
+    }
+
+    return pExtent;
+}
 
-        if (pBestFit->cBlocks > cBlocks)
+/**
+ * Removes the given extent from the cache, freeing the blocks it occupies.
+ *
+ * @returns nothing.
+ * @param   pCache         The cache image instance.
+ * @param   pExtent        The extent to remove.
+ */
+static void vciCacheExtentRemove(PVCICACHE pCache, PVCICACHEEXTENT pExtent)
+{
+    PAVLRU64NODECORE pRemoved = RTAvlrU64Remove(&pCache->TreeExtents, pExtent->Core.Key);
+    Assert(pRemoved == &pExtent->Core); RT_NOREF(pRemoved);
+
+    RTListNodeRemove(&pExtent->NodeLru);
+    int rc = vciBlkMapFree(pCache->pBlkMap, pExtent->u64BlockAddr, (uint32_t)VCI_EXTENT_BLOCKS(pExtent),
+                           VCIBLKMAP_ALLOC_DATA);
+    AssertRC(rc);
+    pCache->cExtents--;
+    RTMemFree(pExtent);
+}
+
+/**
+ * Adds a new extent to the cache, extending the previous one if the data
+ * is contiguous in the image too.
+ *
+ * @returns VBox status code.
+ * @param   pCache         The cache image instance.
+ * @param   offBlock       First block of cached data.
+ * @param   cBlocks        Number of blocks.
+ * @param   offBlockAddr   Start address of the data in the image.
+ */
+static int vciCacheExtentInsert(PVCICACHE pCache, uint64_t offBlock, uint32_t cBlocks, uint64_t offBlockAddr)
+{
+    PVCICACHEEXTENT pPrev = offBlock
+                          ? (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, offBlock - 1)
+                          : NULL;
+
+    if (   pPrev
+        && pPrev->u64BlockAddr + VCI_EXTENT_BLOCKS(pPrev) == offBlockAddr
+        && VCI_EXTENT_BLOCKS(pPrev) + cBlocks <= VCI_EXTENT_BLOCKS_MAX)
+    {
+        /* Nothing can be in between as the caller made sure the range isn't cached yet. */
+        pPrev->Core.KeyLast += cBlocks;
+        vciCacheExtentTouch(pCache, pPrev);
+        return VINF_SUCCESS;
+    }
+
+    PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)RTMemAllocZ(sizeof(VCICACHEEXTENT));
+    if (!pExtent)
+        return VERR_NO_MEMORY;
+
+    pExtent->Core.Key     = offBlock;
+    pExtent->Core.KeyLast = offBlock + cBlocks - 1;
+    pExtent->u64BlockAddr = offBlockAddr;
+
+    bool fInserted = RTAvlrU64Insert(&pCache->TreeExtents, &pExtent->Core);
+    AssertMsg(fInserted, ("Range %llu/%u is already cached\n", offBlock, cBlocks));
+    if (!fInserted)
+    {
+        RTMemFree(pExtent);
+        return VERR_ALREADY_EXISTS;
+    }
+
+    RTListPrepend(&pCache->ListLru, &pExtent->NodeLru);
+    pCache->cExtents++;
+    return VINF_SUCCESS;
+}
+
+/**
+ * Evicts the least recently used extent from the cache.
+ *
+ * @returns true if an extent was evicted, false if the cache is empty.
+ * @param   pCache         The cache image instance.
+ */
+static bool vciCacheEvict(PVCICACHE pCache)
+{
+    PVCICACHEEXTENT pExtent = RTListGetLast(&pCache->ListLru, VCICACHEEXTENT, NodeLru);
+
+    if (pExtent)
+    {
+        LogFlowFunc(("Evicting %llu/%llu\n", pExtent->Core.Key, VCI_EXTENT_BLOCKS(pExtent)));
+        vciCacheExtentRemove(pCache, pExtent);
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Allocates blocks for cached data, evicting the least recently used
+ * data if the cache is full.
+ *
+ * @returns VBox status code.
+ * @param   pCache         The cache image instance.
+ * @param   cBlocks        Number of blocks to allocate.
+ * @param   fFlags         Allocation flags, combination of VCIBLKMAP_ALLOC_*.
+ * @param   poffBlockAddr  Where to store the start address of the allocated region.
+ */
+static int vciCacheAllocate(PVCICACHE pCache, uint32_t cBlocks, uint32_t fFlags, uint64_t *poffBlockAddr)
+{
+    int rc;
+
+    for (;;)
+    {
+        rc = vciBlkMapAllocate(pCache->pBlkMap, cBlocks, fFlags, poffBlockAddr);
+        if (   rc != VERR_VCI_NO_BLOCKS_FREE
+            || !vciCacheEvict(pCache))
+            break;
+    }
+
+    return rc;
+}
+
+/**
+ * Removes the given range from the cache.
+ *
+ * @returns VBox status code.
+ * @param   pCache         The cache image instance.
+ * @param   offBlock       First block to invalidate.
+ * @param   cBlocks        Number of blocks to invalidate.
+ */
+static int vciCacheInvalidate(PVCICACHE pCache, uint64_t offBlock, uint64_t cBlocks)
+{
+    int rc = VINF_SUCCESS;
+    uint64_t offBlockLast = offBlock + cBlocks - 1;
+
+    while (cBlocks)
+    {
+        PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)RTAvlrU64RangeGet(&pCache->TreeExtents, offBlock);
+        if (!pExtent)
+            pExtent = (PVCICACHEEXTENT)RTAvlrU64GetBestFit(&pCache->TreeExtents, offBlock, true /*fAbove*/);
+        if (   !pExtent
+            || pExtent->Core.Key > offBlockLast)
+            break;
+
+        uint64_t offExtent     = pExtent->Core.Key;
+        uint64_t offExtentLast = pExtent->Core.KeyLast;
+
+        if (   offExtent >= offBlock
+            && offExtentLast <= offBlockLast)
+            vciCacheExtentRemove(pCache, pExtent);
+        else
         {
-            /* Create a new free block. */
-            PVCIBLKRANGEDESC pFree = (PVCIBLKRANGEDESC)RTMemAllocZ(sizeof(VCIBLKRANGEDESC));
+            /* Partial overlap, free the overlapping blocks and keep the rest. */
+            uint64_t offFree     = RT_MAX(offExtent, offBlock);
+            uint64_t offFreeLast = RT_MIN(offExtentLast, offBlockLast);
+            PVCICACHEEXTENT pTail = NULL;
+
+            if (   offExtent < offBlock
+                && offExtentLast > offBlockLast)
+            {
+                /* The range is in the middle of the extent, the tail becomes a new extent. */
+                pTail = (PVCICACHEEXTENT)RTMemAllocZ(sizeof(VCICACHEEXTENT));
+                if (!pTail)
+                {
+                    rc = VERR_NO_MEMORY;
+                    break;
+                }
+            }
 
-            if (pFree)
+            rc = vciBlkMapFree(pCache->pBlkMap, pExtent->u64BlockAddr + (offFree - offExtent),
+                               (uint32_t)(offFreeLast - offFree + 1), VCIBLKMAP_ALLOC_DATA);
+            if (RT_FAILURE(rc))
             {
-                pFree->fFree = true;
-                pFree->cBlocks = pBestFit->cBlocks - cBlocks;
-                pBestFit->cBlocks -= pFree->cBlocks;
-                pFree->offAddrStart = pBestFit->offAddrStart + cBlocks;
-
-                /* Link into the list. */
-                pFree->pNext = pBestFit->pNext;
-                pBestFit->pNext = pFree;
-                pFree->pPrev    = pBestFit;
-                if (!pFree->pNext)
-                    pBlkMap->pRangesTail = pFree;
-
-                *poffBlockAddr = pBestFit->offAddrStart;
+                RTMemFree(pTail);
+                break;
+            }
+
+            RTAvlrU64Remove(&pCache->TreeExtents, offExtent);
+            if (offExtent < offBlock)
+            {
+                pExtent->Core.KeyLast = offBlock - 1;
+                if (pTail)
+                {
+                    pTail->Core.Key     = offBlockLast + 1;
+                    pTail->Core.KeyLast = offExtentLast;
+                    pTail->u64BlockAddr = pExtent->u64BlockAddr + (offBlockLast + 1 - offExtent);
+                    RTAvlrU64Insert(&pCache->TreeExtents, &pTail->Core);
+                    RTListNodeInsertAfter(&pExtent->NodeLru, &pTail->NodeLru);
+                    pCache->cExtents++;
+                }
             }
             else
             {
-                rc = VERR_NO_MEMORY;
-                pBestFit->fFree = true;
+                pExtent->u64BlockAddr += offBlockLast + 1 - offExtent;
+                pExtent->Core.Key      = offBlockLast + 1;
             }
+            RTAvlrU64Insert(&pCache->TreeExtents, &pExtent->Core);
         }
+
+        if (offExtentLast >= offBlockLast)
+            break;
+
+        cBlocks  = offBlockLast - offExtentLast;
+        offBlock = offExtentLast + 1;
     }
-    else
-        rc = VERR_VCI_NO_BLOCKS_FREE;
 
-    if (RT_SUCCESS(rc))
-    {
-        if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
-            pBlkMap->cBlocksAllocMeta += cBlocks;
-        else
-            pBlkMap->cBlocksAllocData += cBlocks;
+    return rc;
+}
 
-        pBlkMap->cBlocksFree -= cBlocks;
+/**
+ * Returns the number of nodes required to store a B+-Tree with the given number of extents.
+ *
+ * @returns Number of tree nodes.
+ * @param   cExtents       Number of extents.
+ */
+static uint32_t vciTreeNodesRequired(uint64_t cExtents)
+{
+    uint64_t cNodesLevel = RT_MAX((cExtents + VCI_TREE_EXTENTS_PER_NODE - 1) / VCI_TREE_EXTENTS_PER_NODE, 1);
+    uint64_t cNodes      = cNodesLevel;
+
+    while (cNodesLevel > 1)
+    {
+        cNodesLevel = (cNodesLevel + VCI_TREE_INTERNAL_NODES_PER_NODE - 1) / VCI_TREE_INTERNAL_NODES_PER_NODE;
+        cNodes     += cNodesLevel;
     }
 
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
-    return rc;
+    return (uint32_t)cNodes;
 }
 
-#if 0 /* unused */
 /**
- * Try to extend the space of an already allocated block.
+ * Records the address of a tree node stored in the image.
  *
  * @returns VBox status code.
- * @param   pBlkMap          The block bitmap to allocate the blocks from.
- * @param   cBlocksNew       How many blocks the extended block should have.
- * @param   offBlockAddrOld  The start address of the block to reallocate.
- * @param   poffBlockAddr    Where to store the start address of the allocated region.
+ * @param   pCache             The cache image instance.
+ * @param   offBlockAddrNode   Block address of the node.
  */
-static int vciBlkMapRealloc(PVCIBLKMAP pBlkMap, uint32_t cBlocksNew, uint64_t offBlockAddrOld,
-                            uint64_t *poffBlockAddr)
+static int vciTreeNodeAddrAdd(PVCICACHE pCache, uint64_t offBlockAddrNode)
 {
-    int rc = VINF_SUCCESS;
-
-    LogFlowFunc(("pBlkMap=%#p cBlocksNew=%u offBlockAddrOld=%llu poffBlockAddr=%#p\n",
-                 pBlkMap, cBlocksNew, offBlockAddrOld, poffBlockAddr));
-
-    AssertMsgFailed(("Implement\n"));
-    RT_NOREF4(pBlkMap, cBlocksNew, offBlockAddrOld, poffBlockAddr);
+    if (!(pCache->cNodeAddrs % 64))
+    {
+        uint64_t *paNodeAddrsNew = (uint64_t *)RTMemRealloc(pCache->paNodeAddrs,
+                                                            (pCache->cNodeAddrs + 64) * sizeof(uint64_t));
+        if (!paNodeAddrsNew)
+            return VERR_NO_MEMORY;
+        pCache->paNodeAddrs = paNodeAddrsNew;
+    }
 
-    LogFlowFunc(("returns rc=%Rrc offBlockAddr=%llu\n", rc, *poffBlockAddr));
-    return rc;
+    pCache->paNodeAddrs[pCache->cNodeAddrs++] = offBlockAddrNode;
+    return VINF_SUCCESS;
 }
-#endif /* unused */
 
-#if 0 /* unused */
 /**
- * Frees a range of blocks.
+ * Loads the given node of the B+-Tree and everything below into the extent tree.
  *
- * @returns nothing.
- * @param   pBlkMap          The block bitmap.
- * @param   offBlockAddr     Address of the first block to free.
- * @param   cBlocks          How many blocks to free.
- * @param   fFlags           Allocation flags, comgination of VCIBLKMAP_ALLOC_*.
+ * @returns VBox status code.
+ * @param   pCache             The cache image instance.
+ * @param   offBlockAddrNode   Block address of the node.
+ * @param   cDepth             Depth of the node in the tree.
  */
-static void vciBlkMapFree(PVCIBLKMAP pBlkMap, uint64_t offBlockAddr, uint32_t cBlocks,
-                          uint32_t fFlags)
+static int vciTreeLoad(PVCICACHE pCache, uint64_t offBlockAddrNode, unsigned cDepth)
 {
-    PVCIBLKRANGEDESC pBlk;
+    if (   cDepth > VCI_TREE_DEPTH_MAX
+        || offBlockAddrNode + VCI_BYTE2BLOCK(sizeof(VciTreeNode)) > pCache->cBlocksCache)
+        return VERR_VD_GEN_INVALID_HEADER;
 
-    LogFlowFunc(("pBlkMap=%#p offBlockAddr=%llu cBlocks=%u\n",
-                 pBlkMap, offBlockAddr, cBlocks));
+    PVciTreeNode pNode = (PVciTreeNode)RTMemTmpAlloc(sizeof(VciTreeNode));
+    if (!pNode)
+        return VERR_NO_MEMORY;
 
-    while (cBlocks)
+    int rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage, VCI_BLOCK2BYTE(offBlockAddrNode),
+                                   pNode, sizeof(VciTreeNode));
+    if (RT_SUCCESS(rc))
+        rc = vciTreeNodeAddrAdd(pCache, offBlockAddrNode);
+    if (RT_SUCCESS(rc))
     {
-        pBlk = vciBlkMapFindByBlock(pBlkMap, offBlockAddr);
-        AssertPtr(pBlk);
-
-        /* Easy case, the whole block is freed. */
-        if (   pBlk->offAddrStart == offBlockAddr
-            && pBlk->cBlocks <= cBlocks)
+        if (pNode->u8Type == VCI_TREE_NODE_TYPE_LEAF)
         {
-            pBlk->fFree = true;
-            cBlocks      -= pBlk->cBlocks;
-            offBlockAddr += pBlk->cBlocks;
+            PVciCacheExtent pExtentImage = (PVciCacheExtent)&pNode->au8Data[0];
 
-            /* Check if it is possible to merge free blocks. */
-            if (   pBlk->pPrev
-                && pBlk->pPrev->fFree)
+            for (unsigned idx = 0; idx < VCI_TREE_EXTENTS_PER_NODE && RT_SUCCESS(rc); idx++, pExtentImage++)
             {
-                PVCIBLKRANGEDESC pBlkPrev = pBlk->pPrev;
+                uint64_t offBlock     = RT_LE2H_U64(pExtentImage->u64BlockOffset);
+                uint32_t cBlocks      = RT_LE2H_U32(pExtentImage->u32Blocks);
+                uint64_t offBlockAddr = RT_LE2H_U64(pExtentImage->u64BlockAddr);
 
-                Assert(pBlkPrev->offAddrStart + pBlkPrev->cBlocks == pBlk->offAddrStart);
-                pBlkPrev->cBlocks += pBlk->cBlocks;
-                pBlkPrev->pNext = pBlk->pNext;
-                if (pBlk->pNext)
-                    pBlk->pNext->pPrev = pBlkPrev;
-                else
-                    pBlkMap->pRangesTail = pBlkPrev;
+                /* Unused entries are always at the end. */
+                if (!cBlocks)
+                    break;
+
+                if (   offBlockAddr + cBlocks > pCache->cBlocksCache
+                    || offBlock + cBlocks - 1 < offBlock)
+                {
+                    rc = VERR_VD_GEN_INVALID_HEADER;
+                    break;
+                }
 
-                RTMemFree(pBlk);
-                pBlk = pBlkPrev;
+                PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)RTMemAllocZ(sizeof(VCICACHEEXTENT));
+                if (pExtent)
+                {
+                    pExtent->Core.Key     = offBlock;
+                    pExtent->Core.KeyLast = offBlock + cBlocks - 1;
+                    pExtent->u64BlockAddr = offBlockAddr;
+                    if (RTAvlrU64Insert(&pCache->TreeExtents, &pExtent->Core))
+                    {
+                        RTListAppend(&pCache->ListLru, &pExtent->NodeLru);
+                        pCache->cExtents++;
+                    }
+                    else
+                    {
+                        RTMemFree(pExtent);
+                        rc = VERR_VD_GEN_INVALID_HEADER;
+                    }
+                }
+                else
+                    rc = VERR_NO_MEMORY;
             }
+        }
+        else if (pNode->u8Type == VCI_TREE_NODE_TYPE_INTERNAL)
+        {
+            PVciTreeNodeInternal pIntImage = (PVciTreeNodeInternal)&pNode->au8Data[0];
 
-            /* Now the one to the right. */
-            if (   pBlk->pNext
-                && pBlk->pNext->fFree)
+            for (unsigned idx = 0; idx < VCI_TREE_INTERNAL_NODES_PER_NODE && RT_SUCCESS(rc); idx++, pIntImage++)
             {
-                PVCIBLKRANGEDESC pBlkNext = pBlk->pNext;
+                uint64_t offBlockAddrChild = RT_LE2H_U64(pIntImage->u64ChildAddr);
 
-                Assert(pBlk->offAddrStart + pBlk->cBlocks == pBlkNext->offAddrStart);
-                pBlk->cBlocks += pBlkNext->cBlocks;
-                pBlk->pNext = pBlkNext->pNext;
-                if (pBlkNext->pNext)
-                    pBlkNext->pNext->pPrev = pBlk;
-                else
-                    pBlkMap->pRangesTail = pBlk;
+                /* Unused entries are always at the end, block 0 is occupied by the header. */
+                if (!offBlockAddrChild)
+                    break;
 
-                RTMemFree(pBlkNext);
+                rc = vciTreeLoad(pCache, offBlockAddrChild, cDepth + 1);
             }
         }
         else
-        {
-            /* The block is intersecting. */
-            AssertMsgFailed(("TODO\n"));
-        }
+            rc = VERR_VD_GEN_INVALID_HEADER;
     }
 
-    if ((fFlags & VCIBLKMAP_ALLOC_MASK) == VCIBLKMAP_ALLOC_DATA)
-        pBlkMap->cBlocksAllocMeta -= cBlocks;
-    else
-        pBlkMap->cBlocksAllocData -= cBlocks;
-
-    pBlkMap->cBlocksFree += cBlocks;
-
-    LogFlowFunc(("returns\n"));
+    RTMemTmpFree(pNode);
+    return rc;
 }
-#endif /* unused */
 
 /**
- * Converts a tree node from the image to the in memory structure.
+ * Writes a node of the B+-Tree to the image.
  *
- * @returns Pointer to the in memory tree node.
- * @param   offBlockAddrNode    Block address of the node.
- * @param   pNodeImage          Pointer to the image representation of the node.
+ * @returns VBox status code.
+ * @param   pCache             The cache image instance.
+ * @param   offBlockAddrNode   Block address of the node.
+ * @param   pNode              The node to write.
  */
-static PVCITREENODE vciTreeNodeImage2Host(uint64_t offBlockAddrNode, PVciTreeNode pNodeImage)
+static int vciTreeNodeWrite(PVCICACHE pCache, uint64_t offBlockAddrNode, PVciTreeNode pNode)
 {
-    PVCITREENODE pNode = NULL;
+    return vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, VCI_BLOCK2BYTE(offBlockAddrNode),
+                                  pNode, sizeof(VciTreeNode));
+}
 
-    if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_LEAF)
+/**
+ * Writes the leaf node currently being filled and starts the next one.
+ *
+ * @returns VBox status code.
+ * @param   pWriter            The leaf writer state.
+ */
+static int vciTreeLeafFlush(PVCITREELEAFWRITER pWriter)
+{
+    uint64_t offBlockAddrNode = pWriter->paNodeAddrs[pWriter->cLeaves];
+    int rc = vciTreeNodeWrite(pWriter->pCache, offBlockAddrNode, &pWriter->Node);
+    if (RT_SUCCESS(rc))
     {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)RTMemAllocZ(sizeof(VCITREENODELEAF));
+        PVCITREECHILD pChild = &pWriter->paChildren[pWriter->cLeaves];
 
-        if (pLeaf)
+        pChild->u64ChildAddr = offBlockAddrNode;
+        if (pWriter->cExtents)
         {
-            PVciCacheExtent pExtent = (PVciCacheExtent)&pNodeImage->au8Data[0];
+            PVciCacheExtent pFirst = (PVciCacheExtent)&pWriter->Node.au8Data[0];
+            PVciCacheExtent pLast  = pFirst + pWriter->cExtents - 1;
 
-            pLeaf->Core.u8Type = VCI_TREE_NODE_TYPE_LEAF;
-
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pLeaf->aExtents); idx++)
-            {
-                pLeaf->aExtents[idx].u64BlockOffset = RT_LE2H_U64(pExtent->u64BlockOffset);
-                pLeaf->aExtents[idx].u32Blocks      = RT_LE2H_U32(pExtent->u32Blocks);
-                pLeaf->aExtents[idx].u64BlockAddr   = RT_LE2H_U64(pExtent->u64BlockAddr);
-                pExtent++;
-
-                if (   pLeaf->aExtents[idx].u32Blocks
-                    && pLeaf->aExtents[idx].u64BlockAddr)
-                    pLeaf->cUsedNodes++;
-            }
-
-            pNode = &pLeaf->Core;
+            pChild->u64BlockOffset = RT_LE2H_U64(pFirst->u64BlockOffset);
+            pChild->u64BlockLast   = RT_LE2H_U64(pLast->u64BlockOffset) + RT_LE2H_U32(pLast->u32Blocks) - 1;
         }
-    }
-    else if (pNodeImage->u8Type == VCI_TREE_NODE_TYPE_INTERNAL)
-    {
-        PVCITREENODEINT pInt = (PVCITREENODEINT)RTMemAllocZ(sizeof(VCITREENODEINT));
-
-        if (pInt)
+        else
         {
-            PVciTreeNodeInternal pIntImage = (PVciTreeNodeInternal)&pNodeImage->au8Data[0];
+            pChild->u64BlockOffset = 0;
+            pChild->u64BlockLast   = 0;
+        }
 
-            pInt->Core.u8Type = VCI_TREE_NODE_TYPE_INTERNAL;
+        pWriter->cLeaves++;
+        pWriter->cExtents = 0;
+        memset(&pWriter->Node, 0, sizeof(VciTreeNode));
+        pWriter->Node.u8Type = VCI_TREE_NODE_TYPE_LEAF;
+    }
 
-            for (unsigned idx = 0; idx < RT_ELEMENTS(pInt->aIntNodes); idx++)
-            {
-                pInt->aIntNodes[idx].u64BlockOffset              = RT_LE2H_U64(pIntImage->u64BlockOffset);
-                pInt->aIntNodes[idx].u32Blocks                   = RT_LE2H_U32(pIntImage->u32Blocks);
-                pInt->aIntNodes[idx].PtrChild.fInMemory          = false;
-                pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode = RT_LE2H_U64(pIntImage->u64ChildAddr);
-                pIntImage++;
-
-                if (   pInt->aIntNodes[idx].u32Blocks
-                    && pInt->aIntNodes[idx].PtrChild.u.offAddrBlockNode)
-                    pInt->cUsedNodes++;
-            }
+    return rc;
+}
 
-            pNode = &pInt->Core;
-        }
-    }
-    else
-        AssertMsgFailed(("Invalid node type %d\n", pNodeImage->u8Type));
+/**
+ * AVL tree callback adding an extent to the leaf node being filled.
+ */
+static DECLCALLBACK(int) vciTreeLeafAddExtent(PAVLRU64NODECORE pNode, void *pvUser)
+{
+    PVCITREELEAFWRITER pWriter = (PVCITREELEAFWRITER)pvUser;
+    PVCICACHEEXTENT pExtent = (PVCICACHEEXTENT)pNode;
+    PVciCacheExtent pExtentImage = (PVciCacheExtent)&pWriter->Node.au8Data[0] + pWriter->cExtents;
 
-    if (pNode)
-        pNode->u64BlockAddr = offBlockAddrNode;
+    pExtentImage->u64BlockOffset = RT_H2LE_U64(pExtent->Core.Key);
+    pExtentImage->u32Blocks      = RT_H2LE_U32((uint32_t)VCI_EXTENT_BLOCKS(pExtent));
+    pExtentImage->u64BlockAddr   = RT_H2LE_U64(pExtent->u64BlockAddr);
 
-    return pNode;
+    if (++pWriter->cExtents == VCI_TREE_EXTENTS_PER_NODE)
+        return vciTreeLeafFlush(pWriter);
+
+    return VINF_SUCCESS;
 }
 
 /**
- * Looks up the cache extent for the given virtual block address.
+ * Writes the extent tree as a new B+-Tree to the image, releasing the space
+ * occupied by the old one.
  *
- * @returns Pointer to the cache extent or NULL if none could be found.
- * @param   pCache         The cache image instance.
- * @param   offBlockOffset The block offset to search for.
- * @param   ppNextBestFit  Where to store the pointer to the next best fit
- *                         cache extent above offBlockOffset if existing. - Optional
- *                         This is always filled if possible even if the function returns NULL.
+ * @returns VBox status code.
+ * @param   pCache             The cache image instance.
  */
-static PVCICACHEEXTENT vciCacheExtentLookup(PVCICACHE pCache, uint64_t offBlockOffset,
-                                            PVCICACHEEXTENT *ppNextBestFit)
+static int vciTreeSave(PVCICACHE pCache)
 {
     int rc = VINF_SUCCESS;
-    PVCICACHEEXTENT pExtent = NULL;
-    PVCITREENODE pNodeCur = pCache->pRoot;
+
+    /* The tree is rewritten completely, release the old nodes. */
+    while (   pCache->cNodeAddrs
+           && RT_SUCCESS(rc))
+    {
+        rc = vciBlkMapFree(pCache->pBlkMap, pCache->paNodeAddrs[pCache->cNodeAddrs - 1],
+                           VCI_BYTE2BLOCK(sizeof(VciTreeNode)), VCIBLKMAP_ALLOC_META);
+        if (RT_SUCCESS(rc))
+            pCache->cNodeAddrs--;
+    }
+
+    /*
+     * Allocate space for all nodes first, this might evict cached data
+     * if the cache is full which in turn reduces the number of nodes required.
+     */
+    uint32_t cNodes = vciTreeNodesRequired(pCache->cExtents);
+    while (   RT_SUCCESS(rc)
+           && pCache->cNodeAddrs < cNodes)
+    {
+        uint64_t offBlockAddrNode = 0;
+
+        rc = vciCacheAllocate(pCache, VCI_BYTE2BLOCK(sizeof(VciTreeNode)), VCIBLKMAP_ALLOC_META, &offBlockAddrNode);
+        if (RT_SUCCESS(rc))
+            rc = vciTreeNodeAddrAdd(pCache, offBlockAddrNode);
+        cNodes = vciTreeNodesRequired(pCache->cExtents);
+    }
 
     while (   RT_SUCCESS(rc)
-           && pNodeCur
-           && pNodeCur->u8Type != VCI_TREE_NODE_TYPE_LEAF)
+           && pCache->cNodeAddrs > cNodes)
     {
-        PVCITREENODEINT pNodeInt = (PVCITREENODEINT)pNodeCur;
+        rc = vciBlkMapFree(pCache->pBlkMap, pCache->paNodeAddrs[pCache->cNodeAddrs - 1],
+                           VCI_BYTE2BLOCK(sizeof(VciTreeNode)), VCIBLKMAP_ALLOC_META);
+        if (RT_SUCCESS(rc))
+            pCache->cNodeAddrs--;
+    }
 
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_INTERNAL);
+    if (RT_FAILURE(rc))
+        return rc;
 
-        /* Search for the correct internal node. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pNodeInt->cUsedNodes;
-        unsigned idxCur = pNodeInt->cUsedNodes / 2;
+    PVCITREELEAFWRITER pWriter = (PVCITREELEAFWRITER)RTMemAllocZ(sizeof(VCITREELEAFWRITER));
+    if (!pWriter)
+        return VERR_NO_MEMORY;
 
-        while (idxMin < idxMax)
+    uint32_t cLeaves = (uint32_t)RT_MAX((pCache->cExtents + VCI_TREE_EXTENTS_PER_NODE - 1) / VCI_TREE_EXTENTS_PER_NODE, 1);
+    pWriter->pCache      = pCache;
+    pWriter->paNodeAddrs = pCache->paNodeAddrs;
+    pWriter->paChildren  = (PVCITREECHILD)RTMemAllocZ(cLeaves * sizeof(VCITREECHILD));
+    pWriter->Node.u8Type = VCI_TREE_NODE_TYPE_LEAF;
+    if (pWriter->paChildren)
+    {
+        /* Write the leaves in ascending order. */
+        rc = RTAvlrU64DoWithAll(&pCache->TreeExtents, true /*fFromLeft*/, vciTreeLeafAddExtent, pWriter);
+        if (   RT_SUCCESS(rc)
+            && (   pWriter->cExtents
+                || !pWriter->cLeaves))
+            rc = vciTreeLeafFlush(pWriter);
+        Assert(RT_FAILURE(rc) || pWriter->cLeaves == cLeaves);
+
+        /* Now build the internal levels up to the root, the parents are stored in place of their children. */
+        PVCITREECHILD paChildren = pWriter->paChildren;
+        uint32_t cChildren = pWriter->cLeaves;
+        uint32_t idxNode = cChildren;
+
+        while (   RT_SUCCESS(rc)
+               && cChildren > 1)
         {
-            PVCINODEINTERNAL pInt = &pNodeInt->aIntNodes[idxCur];
+            uint32_t cParents = 0;
 
-            /* Determine the search direction. */
-            if (offBlockOffset < pInt->u64BlockOffset)
+            for (uint32_t idxChild = 0; idxChild < cChildren && RT_SUCCESS(rc); idxChild += VCI_TREE_INTERNAL_NODES_PER_NODE)
             {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pInt->u64BlockOffset + pInt->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
-            {
-                /* The block lies in the node, stop searching. */
-                if (pInt->PtrChild.fInMemory)
-                    pNodeCur = pInt->PtrChild.u.pNode;
-                else
-                {
-                    PVCITREENODE pNodeNew;
-                    VciTreeNode NodeTree;
+                uint32_t cEntries = RT_MIN(VCI_TREE_INTERNAL_NODES_PER_NODE, cChildren - idxChild);
+                PVciTreeNodeInternal pIntImage = (PVciTreeNodeInternal)&pWriter->Node.au8Data[0];
 
-                    /* Read from disk and add to the tree. */
-                    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
-                                               VCI_BLOCK2BYTE(pInt->PtrChild.u.offAddrBlockNode),
-                                               &NodeTree, sizeof(NodeTree));
-                    AssertRC(rc);
+                memset(&pWriter->Node, 0, sizeof(VciTreeNode));
+                pWriter->Node.u8Type = VCI_TREE_NODE_TYPE_INTERNAL;
+                for (uint32_t i = 0; i < cEntries; i++, pIntImage++)
+                {
+                    PVCITREECHILD pChild = &paChildren[idxChild + i];
+                    uint64_t cBlocksChild = pChild->u64BlockLast - pChild->u64BlockOffset + 1;
 
-                    pNodeNew = vciTreeNodeImage2Host(pInt->PtrChild.u.offAddrBlockNode, &NodeTree);
-                    if (pNodeNew)
-                    {
-                        /* Link to the parent. */
-                        pInt->PtrChild.fInMemory = true;
-                        pInt->PtrChild.u.pNode = pNodeNew;
-                        pNodeNew->pParent = pNodeCur;
-                        pNodeCur = pNodeNew;
-                    }
-                    else
-                        rc = VERR_NO_MEMORY;
+                    pIntImage->u64BlockOffset = RT_H2LE_U64(pChild->u64BlockOffset);
+                    pIntImage->u32Blocks      = RT_H2LE_U32((uint32_t)RT_MIN(cBlocksChild, UINT32_MAX));
+                    pIntImage->u64ChildAddr   = RT_H2LE_U64(pChild->u64ChildAddr);
                 }
-                break;
-            }
-
-            idxCur = idxMin + (idxMax - idxMin) / 2;
-        }
-    }
 
-    if (   RT_SUCCESS(rc)
-        && pNodeCur)
-    {
-        PVCITREENODELEAF pLeaf = (PVCITREENODELEAF)pNodeCur;
-        Assert(pNodeCur->u8Type == VCI_TREE_NODE_TYPE_LEAF);
-
-        /* Search the range. */
-        unsigned idxMin = 0;
-        unsigned idxMax = pLeaf->cUsedNodes;
-        unsigned idxCur = pLeaf->cUsedNodes / 2;
-
-        while (idxMin < idxMax)
-        {
-            PVCICACHEEXTENT pExtentCur = &pLeaf->aExtents[idxCur];
+                Assert(idxNode < pCache->cNodeAddrs);
+                uint64_t offBlockAddrNode = pCache->paNodeAddrs[idxNode++];
+                rc = vciTreeNodeWrite(pCache, offBlockAddrNode, &pWriter->Node);
 
-            /* Determine the search direction. */
-            if (offBlockOffset < pExtentCur->u64BlockOffset)
-            {
-                /* Search left from the current extent. */
-                idxMax = idxCur;
-            }
-            else if (offBlockOffset >= pExtentCur->u64BlockOffset + pExtentCur->u32Blocks)
-            {
-                /* Search right from the current extent. */
-                idxMin = idxCur;
-            }
-            else
-            {
-                /* We found the extent, stop searching. */
-                pExtent = pExtentCur;
-                break;
+                uint64_t u64BlockLast = paChildren[idxChild + cEntries - 1].u64BlockLast;
+                paChildren[cParents].u64BlockOffset = paChildren[idxChild].u64BlockOffset;
+                paChildren[cParents].u64BlockLast   = u64BlockLast;
+                paChildren[cParents].u64ChildAddr   = offBlockAddrNode;
+                cParents++;
             }
 
-            idxCur = idxMin + (idxMax - idxMin) / 2;
+            cChildren = cParents;
         }
 
-        /* Get the next best fit extent if it exists. */
-        if (ppNextBestFit)
+        if (RT_SUCCESS(rc))
         {
-            if (idxCur < pLeaf->cUsedNodes - 1)
-                *ppNextBestFit = &pLeaf->aExtents[idxCur + 1];
-            else
-            {
-                /*
-                 * Go up the tree and find the best extent
-                 * in the leftmost tree of the child subtree to the right.
-                 */
-                PVCITREENODEINT pInt = (PVCITREENODEINT)pLeaf->Core.pParent;
-
-                while (pInt)
-                {
-
-                }
-            }
+            Assert(idxNode == pCache->cNodeAddrs);
+            pCache->offTreeRoot = paChildren[0].u64ChildAddr;
         }
+
+        RTMemFree(pWriter->paChildren);
     }
+    else
+        rc = VERR_NO_MEMORY;
 
-    return pExtent;
+    RTMemFree(pWriter);
+    return rc;
+}
+
+/**
+ * Writes all metadata to the image and marks it as cleanly closed.
+ *
+ * @returns VBox status code.
+ * @param   pCache             The cache image instance.
+ */
+static int vciMetaSave(PVCICACHE pCache)
+{
+    int rc = vciTreeSave(pCache);
+    if (RT_SUCCESS(rc))
+        rc = vciBlkMapSave(pCache->pBlkMap, pCache, pCache->offBlksBitmap, pCache->cBlkMap);
+    /* Everything must be on the disk before the header says so. */
+    if (RT_SUCCESS(rc))
+        rc = vciFlushImage(pCache);
+    if (RT_SUCCESS(rc))
+        rc = vciHdrWrite(pCache, false /* fUnclean */);
+    if (RT_SUCCESS(rc))
+        pCache->fMetaDirty = false;
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
 }
 
 /**
@@ -1216,6 +1695,7 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
     int rc;
 
     pCache->uOpenFlags = uOpenFlags;
+    RTListInit(&pCache->ListLru);
 
     pCache->pIfError = VDIfErrorGet(pCache->pVDIfsDisk);
     pCache->pIfIo = VDIfIoIntGet(pCache->pVDIfsImage);
@@ -1242,8 +1722,7 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
         goto out;
     }
 
-    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr,
-                               VCI_BYTE2BLOCK(sizeof(Hdr)));
+    rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage, 0, &Hdr, sizeof(Hdr));
     if (RT_FAILURE(rc))
     {
         rc = VERR_VD_GEN_INVALID_HEADER;
@@ -1261,26 +1740,37 @@ static int vciOpenImage(PVCICACHE pCache, unsigned uOpenFlags)
     if (   Hdr.u32Signature == VCI_HDR_SIGNATURE
         && Hdr.u32Version == VCI_HDR_VERSION)
     {
-        pCache->offTreeRoot   = Hdr.offTreeRoot;
-        pCache->offBlksBitmap = Hdr.offBlkMap;
+        /*
+         * Cached data might have been overwritten without updating the metadata
+         * if the image wasn't closed properly, nothing in it can be trusted then.
+         */
+        if (   Hdr.fUncleanShutdown != VCI_HDR_CLEAN_SHUTDOWN
+            && !(uOpenFlags & VD_OPEN_FLAGS_INFO))
+        {
+            rc = vdIfError(pCache->pIfError, VERR_VD_CACHE_NOT_UP_TO_DATE, RT_SRC_POS,
+                           N_("VCI: cache '%s' was not closed properly"), pCache->pszFilename);
+            goto out;
+        }
+
+        pCache->cBlocksCache     = Hdr.cBlocksCache;
+        pCache->cbSize           = VCI_BLOCK2BYTE(Hdr.cBlocksCache);
+        pCache->uImageFlags      = Hdr.u32CacheType == VCI_HDR_CACHE_TYPE_FIXED ? VD_IMAGE_FLAGS_FIXED : 0;
+        pCache->offTreeRoot      = Hdr.offTreeRoot;
+        pCache->offBlksBitmap    = Hdr.offBlkMap;
+        pCache->cBlkMap          = Hdr.cBlkMap;
+        pCache->ImageUuid        = Hdr.uuidImage;
+        pCache->ModificationUuid = Hdr.uuidModification;
 
         /* Load the block map. */
         rc = vciBlkMapLoad(pCache, pCache->offBlksBitmap, Hdr.cBlkMap, &pCache->pBlkMap);
-        if (RT_SUCCESS(rc))
-        {
-            /* Load the first tree node. */
-            VciTreeNode RootNode;
+        if (   RT_SUCCESS(rc)
+            && pCache->pBlkMap->cBlocks != pCache->cBlocksCache)
+            rc = VERR_VD_GEN_INVALID_HEADER;
 
-            rc = vdIfIoIntFileReadSync(pCache->pIfIo, pCache->pStorage,
-                                       pCache->offTreeRoot, &RootNode,
-                                       VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
-            if (RT_SUCCESS(rc))
-            {
-                pCache->pRoot = vciTreeNodeImage2Host(pCache->offTreeRoot, &RootNode);
-                if (!pCache->pRoot)
-                    rc = VERR_NO_MEMORY;
-            }
-        }
+        /* Load the B+-Tree into the extent tree. */
+        if (   RT_SUCCESS(rc)
+            && !(uOpenFlags & VD_OPEN_FLAGS_INFO))
+            rc = vciTreeLoad(pCache, pCache->offTreeRoot, 0 /* cDepth */);
     }
     else
         rc = VERR_VD_GEN_INVALID_HEADER;
@@ -1296,18 +1786,21 @@ out:
  */
 static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
                           unsigned uImageFlags, const char *pszComment,
-                          unsigned uOpenFlags, PFNVDPROGRESS pfnProgress,
-                          void *pvUser, unsigned uPercentStart,
-                          unsigned uPercentSpan)
+                          PCRTUUID pUuid, unsigned uOpenFlags,
+                          PFNVDPROGRESS pfnProgress, void *pvUser,
+                          unsigned uPercentStart, unsigned uPercentSpan)
 {
     RT_NOREF1(pszComment);
-    VciHdr Hdr;
     VciTreeNode NodeRoot;
     int rc;
     uint64_t cBlocks = cbSize / VCI_BLOCK_SIZE; /* Size of the cache in blocks. */
 
-    pCache->uImageFlags = uImageFlags;
-    pCache->uOpenFlags = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
+    pCache->uImageFlags  = uImageFlags;
+    pCache->uOpenFlags   = uOpenFlags & ~VD_OPEN_FLAGS_READONLY;
+    pCache->cBlocksCache = cBlocks;
+    pCache->ImageUuid    = *pUuid;
+    RTUuidClear(&pCache->ModificationUuid);
+    RTListInit(&pCache->ListLru);
 
     pCache->pIfError = VDIfErrorGet(pCache->pVDIfsDisk);
     pCache->pIfIo = VDIfIoIntGet(pCache->pVDIfsImage);
@@ -1319,6 +1812,17 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
         return rc;
     }
 
+    /* The metadata must fit with room for at least one extent of data. */
+    if (   cBlocks > UINT32_MAX * UINT64_C(8)
+        ||   cBlocks
+           < VCI_BYTE2BLOCK(sizeof(VciHdr)) + VCI_BLKMAP_BLOCKS(cBlocks)
+           + 2 * VCI_BYTE2BLOCK(sizeof(VciTreeNode)) + VCI_EXTENT_BLOCKS_MAX)
+    {
+        rc = vdIfError(pCache->pIfError, VERR_VD_INVALID_SIZE, RT_SRC_POS, N_("VCI: invalid cache size %llu for '%s'"),
+                       cbSize, pCache->pszFilename);
+        return rc;
+    }
+
     do
     {
         /* Create image file. */
@@ -1371,45 +1875,23 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
          */
         uint64_t offTreeRoot = 0;
         rc = vciBlkMapAllocate(pCache->pBlkMap, VCI_BYTE2BLOCK(sizeof(VciTreeNode)), VCIBLKMAP_ALLOC_META, &offTreeRoot);
+        if (RT_SUCCESS(rc))
+            rc = vciTreeNodeAddrAdd(pCache, offTreeRoot);
         if (RT_FAILURE(rc))
         {
             rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate space for block map in block map '%s'"), pCache->pszFilename);
             break;
         }
 
-        /*
-         * Allocate the in memory root node.
-         */
-        pCache->pRoot = (PVCITREENODE)RTMemAllocZ(sizeof(VCITREENODELEAF));
-        if (!pCache->pRoot)
-        {
-            rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot allocate B+-Tree root pointer '%s'"), pCache->pszFilename);
-            break;
-        }
-
-        pCache->pRoot->u8Type = VCI_TREE_NODE_TYPE_LEAF;
-        /* Rest remains 0 as the tree is still empty. */
+        pCache->offTreeRoot   = offTreeRoot;
+        pCache->offBlksBitmap = offBlkMap;
+        pCache->cBlkMap       = cBlkMap;
 
         /*
          * Now that we are here we have all the basic structures and know where to place them in the image.
          * It's time to write it now.
          */
-
-        /* Setup the header. */
-        memset(&Hdr, 0, sizeof(VciHdr));
-        Hdr.u32Signature     = RT_H2LE_U32(VCI_HDR_SIGNATURE);
-        Hdr.u32Version       = RT_H2LE_U32(VCI_HDR_VERSION);
-        Hdr.cBlocksCache     = RT_H2LE_U64(cBlocks);
-        Hdr.fUncleanShutdown = VCI_HDR_UNCLEAN_SHUTDOWN;
-        Hdr.u32CacheType     = uImageFlags & VD_IMAGE_FLAGS_FIXED
-                               ? RT_H2LE_U32(VCI_HDR_CACHE_TYPE_FIXED)
-                               : RT_H2LE_U32(VCI_HDR_CACHE_TYPE_DYNAMIC);
-        Hdr.offTreeRoot      = RT_H2LE_U64(offTreeRoot);
-        Hdr.offBlkMap        = RT_H2LE_U64(offBlkMap);
-        Hdr.cBlkMap          = RT_H2LE_U32(cBlkMap);
-
-        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, offHdr, &Hdr,
-                                    VCI_BYTE2BLOCK(sizeof(VciHdr)));
+        rc = vciHdrWrite(pCache, false /* fUnclean */);
         if (RT_FAILURE(rc))
         {
             rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write header '%s'"), pCache->pszFilename);
@@ -1427,8 +1909,7 @@ static int vciCreateImage(PVCICACHE pCache, uint64_t cbSize,
         memset(&NodeRoot, 0, sizeof(VciTreeNode));
         NodeRoot.u8Type = VCI_TREE_NODE_TYPE_LEAF;
 
-        rc = vdIfIoIntFileWriteSync(pCache->pIfIo, pCache->pStorage, offTreeRoot,
-                                    &NodeRoot, VCI_BYTE2BLOCK(sizeof(VciTreeNode)));
+        rc = vciTreeNodeWrite(pCache, offTreeRoot, &NodeRoot);
         if (RT_FAILURE(rc))
         {
             rc = vdIfError(pCache->pIfError, rc, RT_SRC_POS, N_("VCI: cannot write root node '%s'"), pCache->pszFilename);
@@ -1567,7 +2048,6 @@ static DECLCALLBACK(int) vciCreate(const char *pszFilename, uint64_t cbSize,
                                    PVDINTERFACE pVDIfsDisk, PVDINTERFACE pVDIfsImage,
                                    PVDINTERFACE pVDIfsOperation, void **ppBackendData)
 {
-    RT_NOREF1(pUuid);
     LogFlowFunc(("pszFilename=\"%s\" cbSize=%llu uImageFlags=%#x pszComment=\"%s\" Uuid=%RTuuid uOpenFlags=%#x uPercentStart=%u uPercentSpan=%u pVDIfsDisk=%#p pVDIfsImage=%#p pVDIfsOperation=%#p ppBackendData=%#p",
                  pszFilename, cbSize, uImageFlags, pszComment, pUuid, uOpenFlags, uPercentStart, uPercentSpan, pVDIfsDisk, pVDIfsImage, pVDIfsOperation, ppBackendData));
     int rc;
@@ -1608,7 +2088,7 @@ static DECLCALLBACK(int) vciCreate(const char *pszFilename, uint64_t cbSize,
     pCache->pVDIfsDisk = pVDIfsDisk;
     pCache->pVDIfsImage = pVDIfsImage;
 
-    rc = vciCreateImage(pCache, cbSize, uImageFlags, pszComment, uOpenFlags,
+    rc = vciCreateImage(pCache, cbSize, uImageFlags, pszComment, pUuid, uOpenFlags,
                         pfnProgress, pvUser, uPercentStart, uPercentSpan);
     if (RT_SUCCESS(rc))
     {
@@ -1657,6 +2137,7 @@ static DECLCALLBACK(int) vciRead(void *pBackendData, uint64_t uOffset, size_t cb
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
     PVCICACHEEXTENT pExtent;
+    PVCICACHEEXTENT pExtentNext = NULL;
     uint64_t cBlocksToRead = VCI_BYTE2BLOCK(cbToRead);
     uint64_t offBlockAddr  = VCI_BYTE2BLOCK(uOffset);
 
@@ -1664,20 +2145,22 @@ static DECLCALLBACK(int) vciRead(void *pBackendData, uint64_t uOffset, size_t cb
     Assert(uOffset % 512 == 0);
     Assert(cbToRead % 512 == 0);
 
-    pExtent = vciCacheExtentLookup(pCache, offBlockAddr, NULL);
+    pExtent = vciCacheExtentLookup(pCache, offBlockAddr, &pExtentNext);
     if (pExtent)
     {
-        uint64_t offRead = offBlockAddr - pExtent->u64BlockOffset;
-        cBlocksToRead = RT_MIN(cBlocksToRead, pExtent->u32Blocks - offRead);
+        uint64_t offRead = offBlockAddr - pExtent->Core.Key;
+        cBlocksToRead = RT_MIN(cBlocksToRead, VCI_EXTENT_BLOCKS(pExtent) - offRead);
 
         rc = vdIfIoIntFileReadUser(pCache->pIfIo, pCache->pStorage,
-                                   pExtent->u64BlockAddr + offRead,
-                                   pIoCtx, cBlocksToRead);
+                                   VCI_BLOCK2BYTE(pExtent->u64BlockAddr + offRead),
+                                   pIoCtx, VCI_BLOCK2BYTE(cBlocksToRead));
+        vciCacheExtentTouch(pCache, pExtent);
     }
     else
     {
-        /** @todo Best fit to check whether we have cached data later and set
-         * pcbActuallyRead accordingly. */
+        /* Let the caller read everything up to the next cached extent from the image. */
+        if (pExtentNext)
+            cBlocksToRead = RT_MIN(cBlocksToRead, pExtentNext->Core.Key - offBlockAddr);
         rc = VERR_VD_BLOCK_FREE;
     }
 
@@ -1692,23 +2175,67 @@ static DECLCALLBACK(int) vciRead(void *pBackendData, uint64_t uOffset, size_t cb
 static DECLCALLBACK(int) vciWrite(void *pBackendData, uint64_t uOffset, size_t cbToWrite,
                                   PVDIOCTX pIoCtx, size_t *pcbWriteProcess)
 {
-    RT_NOREF5(pBackendData, uOffset, cbToWrite, pIoCtx, pcbWriteProcess);
     LogFlowFunc(("pBackendData=%#p uOffset=%llu cbToWrite=%zu pIoCtx=%#p pcbWriteProcess=%#p\n",
                  pBackendData, uOffset, cbToWrite, pIoCtx, pcbWriteProcess));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc = VINF_SUCCESS;
+    PVCICACHEEXTENT pExtent;
+    PVCICACHEEXTENT pExtentNext = NULL;
     uint64_t cBlocksToWrite = VCI_BYTE2BLOCK(cbToWrite);
-    //uint64_t offBlockAddr  = VCI_BYTE2BLOCK(uOffset);
+    uint64_t offBlockAddr   = VCI_BYTE2BLOCK(uOffset);
 
-    AssertPtr(pCache); NOREF(pCache);
+    AssertPtr(pCache);
     Assert(uOffset % 512 == 0);
     Assert(cbToWrite % 512 == 0);
-    while (cBlocksToWrite)
+
+    if (pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        return VERR_VD_IMAGE_READ_ONLY;
+
+    /* The metadata in the image is outdated from now on until the image is closed. */
+    rc = vciMetaMarkDirty(pCache);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    pExtent = vciCacheExtentLookup(pCache, offBlockAddr, &pExtentNext);
+    if (pExtent)
+    {
+        /* Already cached, update the data in place. */
+        uint64_t offWrite = offBlockAddr - pExtent->Core.Key;
+        cBlocksToWrite = RT_MIN(cBlocksToWrite, VCI_EXTENT_BLOCKS(pExtent) - offWrite);
+
+        rc = vdIfIoIntFileWriteUser(pCache->pIfIo, pCache->pStorage,
+                                    VCI_BLOCK2BYTE(pExtent->u64BlockAddr + offWrite),
+                                    pIoCtx, VCI_BLOCK2BYTE(cBlocksToWrite), NULL, NULL);
+        vciCacheExtentTouch(pCache, pExtent);
+    }
+    else
     {
+        uint64_t offBlockAddrData = 0;
 
+        /* Don't overlap with the next cached extent. */
+        if (pExtentNext)
+            cBlocksToWrite = RT_MIN(cBlocksToWrite, pExtentNext->Core.Key - offBlockAddr);
+        cBlocksToWrite = RT_MIN(cBlocksToWrite, VCI_EXTENT_BLOCKS_MAX);
+
+        rc = vciCacheAllocate(pCache, (uint32_t)cBlocksToWrite, VCIBLKMAP_ALLOC_DATA, &offBlockAddrData);
+        if (RT_SUCCESS(rc))
+        {
+            rc = vdIfIoIntFileWriteUser(pCache->pIfIo, pCache->pStorage,
+                                        VCI_BLOCK2BYTE(offBlockAddrData),
+                                        pIoCtx, VCI_BLOCK2BYTE(cBlocksToWrite), NULL, NULL);
+            if (   RT_SUCCESS(rc)
+                || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            {
+                int rc2 = vciCacheExtentInsert(pCache, offBlockAddr, (uint32_t)cBlocksToWrite, offBlockAddrData);
+                if (RT_FAILURE(rc2))
+                    rc = rc2;
+            }
+            else
+                vciBlkMapFree(pCache->pBlkMap, offBlockAddrData, (uint32_t)cBlocksToWrite, VCIBLKMAP_ALLOC_DATA);
+        }
     }
 
-    *pcbWriteProcess = cbToWrite; /** @todo Implement. */
+    *pcbWriteProcess = VCI_BLOCK2BYTE(cBlocksToWrite);
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -1726,6 +2253,51 @@ static DECLCALLBACK(int) vciFlush(void *pBackendData, PVDIOCTX pIoCtx)
     return rc;
 }
 
+/** @copydoc VDCACHEBACKEND::pfnDiscard */
+static DECLCALLBACK(int) vciDiscard(void *pBackendData, PVDIOCTX pIoCtx,
+                                    uint64_t uOffset, size_t cbDiscard,
+                                    size_t *pcbPreAllocated, size_t *pcbPostAllocated,
+                                    size_t *pcbActuallyDiscarded, void **ppbmAllocationBitmap,
+                                    unsigned fDiscard)
+{
+    RT_NOREF2(pIoCtx, fDiscard);
+    LogFlowFunc(("pBackendData=%#p pIoCtx=%#p uOffset=%llu cbDiscard=%zu\n",
+                 pBackendData, pIoCtx, uOffset, cbDiscard));
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtr(pCache);
+
+    if (pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY)
+        return VERR_VD_IMAGE_READ_ONLY;
+
+    /* Drop every block touched by the range, the cache never holds partial blocks. */
+    uint64_t offBlock = VCI_BYTE2BLOCK(uOffset);
+    uint64_t cBlocks  = VCI_BYTE2BLOCK(RT_ALIGN_64(uOffset + cbDiscard, VCI_BLOCK_SIZE)) - offBlock;
+    PVCICACHEEXTENT pExtentNext = NULL;
+    if (   cBlocks
+        && (   vciCacheExtentLookup(pCache, offBlock, &pExtentNext)
+            || (   pExtentNext
+                && pExtentNext->Core.Key < offBlock + cBlocks)))
+    {
+        rc = vciMetaMarkDirty(pCache);
+        if (RT_SUCCESS(rc))
+            rc = vciCacheInvalidate(pCache, offBlock, cBlocks);
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        *pcbPreAllocated      = 0;
+        *pcbPostAllocated     = 0;
+        *pcbActuallyDiscarded = cbDiscard;
+        if (ppbmAllocationBitmap)
+            *ppbmAllocationBitmap = NULL;
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
 /** @copydoc VDCACHEBACKEND::pfnGetVersion */
 static DECLCALLBACK(unsigned) vciGetVersion(void *pBackendData)
 {
@@ -1889,7 +2461,6 @@ static DECLCALLBACK(int) vciSetComment(void *pBackendData, const char *pszCommen
 /** @copydoc VDCACHEBACKEND::pfnGetUuid */
 static DECLCALLBACK(int) vciGetUuid(void *pBackendData, PRTUUID pUuid)
 {
-    RT_NOREF1(pUuid);
     LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc;
@@ -1897,7 +2468,10 @@ static DECLCALLBACK(int) vciGetUuid(void *pBackendData, PRTUUID pUuid)
     AssertPtr(pCache);
 
     if (pCache)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        *pUuid = pCache->ImageUuid;
+        rc = VINF_SUCCESS;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -1908,18 +2482,19 @@ static DECLCALLBACK(int) vciGetUuid(void *pBackendData, PRTUUID pUuid)
 /** @copydoc VDCACHEBACKEND::pfnSetUuid */
 static DECLCALLBACK(int) vciSetUuid(void *pBackendData, PCRTUUID pUuid)
 {
-    RT_NOREF1(pUuid);
     LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc;
 
-    LogFlowFunc(("%RTuuid\n", pUuid));
     AssertPtr(pCache);
 
     if (pCache)
     {
         if (!(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            pCache->ImageUuid = *pUuid;
+            rc = vciHdrWrite(pCache, pCache->fMetaDirty);
+        }
         else
             rc = VERR_VD_IMAGE_READ_ONLY;
     }
@@ -1933,7 +2508,6 @@ static DECLCALLBACK(int) vciSetUuid(void *pBackendData, PCRTUUID pUuid)
 /** @copydoc VDCACHEBACKEND::pfnGetModificationUuid */
 static DECLCALLBACK(int) vciGetModificationUuid(void *pBackendData, PRTUUID pUuid)
 {
-    RT_NOREF1(pUuid);
     LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc;
@@ -1941,7 +2515,10 @@ static DECLCALLBACK(int) vciGetModificationUuid(void *pBackendData, PRTUUID pUui
     AssertPtr(pCache);
 
     if (pCache)
-        rc = VERR_NOT_SUPPORTED;
+    {
+        *pUuid = pCache->ModificationUuid;
+        rc = VINF_SUCCESS;
+    }
     else
         rc = VERR_VD_NOT_OPENED;
 
@@ -1952,7 +2529,6 @@ static DECLCALLBACK(int) vciGetModificationUuid(void *pBackendData, PRTUUID pUui
 /** @copydoc VDCACHEBACKEND::pfnSetModificationUuid */
 static DECLCALLBACK(int) vciSetModificationUuid(void *pBackendData, PCRTUUID pUuid)
 {
-    RT_NOREF1(pUuid);
     LogFlowFunc(("pBackendData=%#p Uuid=%RTuuid\n", pBackendData, pUuid));
     PVCICACHE pCache = (PVCICACHE)pBackendData;
     int rc;
@@ -1962,7 +2538,11 @@ static DECLCALLBACK(int) vciSetModificationUuid(void *pBackendData, PCRTUUID pUu
     if (pCache)
     {
         if (!(pCache->uOpenFlags & VD_OPEN_FLAGS_READONLY))
-            rc = VERR_NOT_SUPPORTED;
+        {
+            /* The modification UUID ties the cache to the state of the image it caches. */
+            pCache->ModificationUuid = *pUuid;
+            rc = vciHdrWrite(pCache, pCache->fMetaDirty);
+        }
         else
             rc = VERR_VD_IMAGE_READ_ONLY;
     }
@@ -1976,7 +2556,20 @@ static DECLCALLBACK(int) vciSetModificationUuid(void *pBackendData, PCRTUUID pUu
 /** @copydoc VDCACHEBACKEND::pfnDump */
 static DECLCALLBACK(void) vciDump(void *pBackendData)
 {
-    NOREF(pBackendData);
+    PVCICACHE pCache = (PVCICACHE)pBackendData;
+
+    AssertPtr(pCache);
+    if (!pCache)
+        return;
+
+    vdIfErrorMessage(pCache->pIfError, "Header: cBlocksCache=%llu offTreeRoot=%llu offBlkMap=%llu cBlkMap=%u\n",
+                     pCache->cBlocksCache, pCache->offTreeRoot, pCache->offBlksBitmap, pCache->cBlkMap);
+    vdIfErrorMessage(pCache->pIfError, "Header: Image UUID=%RTuuid Modification UUID=%RTuuid\n",
+                     &pCache->ImageUuid, &pCache->ModificationUuid);
+    if (pCache->pBlkMap)
+        vdIfErrorMessage(pCache->pIfError, "Blocks: free=%llu allocated data=%llu allocated meta=%llu extents=%llu\n",
+                         pCache->pBlkMap->cBlocksFree, pCache->pBlkMap->cBlocksAllocData,
+                         pCache->pBlkMap->cBlocksAllocMeta, pCache->cExtents);
 }
 
 
@@ -2007,7 +2600,7 @@ const VDCACHEBACKEND g_VciCacheBackend =
     /* pfnFlush */
     vciFlush,
     /* pfnDiscard */
-    NULL,
+    vciDiscard,
     /* pfnGetVersion */
     vciGetVersion,
     /* pfnGetSize */
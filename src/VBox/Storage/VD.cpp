@@ -35,6 +35,8 @@
 #include <iprt/path.h>
 #include <iprt/sg.h>
 #include <iprt/semaphore.h>
+#include <iprt/thread.h>
+#include <iprt/time.h>
 #include <iprt/vector.h>
 
 #include "VDInternal.h"
@@ -42,6 +44,9 @@
 /** Buffer size used for merging images. */
 #define VD_MERGE_BUFFER_SIZE    (16 * _1M)
 
+/** Number of buffers in flight when copying between disks. */
+#define VD_COPY_PIPELINE_DEPTH  3
+
 /** Maximum number of segments in one I/O task. */
 #define VD_IO_TASK_SEGMENTS_MAX 64
 
@@ -167,6 +172,12 @@ typedef struct VDIOCTX
             uint64_t             uOffsetXferOrig;
             /** Original size of the transfer - required for fitlering read requests. */
             size_t               cbXferOrig;
+            /** Start offset of the range to write into the cache when the read completes. */
+            uint64_t             uOffsetCacheFill;
+            /** Size of the range to write into the cache, 0 if nothing to fill. */
+            size_t               cbCacheFill;
+            /** Cache write generation when the first range to fill was read. */
+            uint32_t             uCacheGen;
         } Io;
         /** Discard requests. */
         struct
@@ -261,6 +272,10 @@ typedef struct VDIOCTX
  * multiple times.
  */
 #define VDIOCTX_FLAGS_WRITE_FILTER_APPLIED   RT_BIT_32(6)
+/** The write changes the content of the disk and the cache write policy applies. */
+#define VDIOCTX_FLAGS_CACHE_WRITE            RT_BIT_32(7)
+/** The cache write policy was applied already, see VDIOCTX_FLAGS_WRITE_FILTER_APPLIED. */
+#define VDIOCTX_FLAGS_CACHE_WRITE_APPLIED    RT_BIT_32(8)
 
 /** NIL I/O context pointer value. */
 #define NIL_VDIOCTX ((PVDIOCTX)0)
@@ -377,6 +392,7 @@ typedef struct VDMETAXFER
 /** Forward declaration of the async discard helper. */
 static DECLCALLBACK(int) vdDiscardHelperAsync(PVDIOCTX pIoCtx);
 static DECLCALLBACK(int) vdWriteHelperAsync(PVDIOCTX pIoCtx);
+static void vdCacheIoCtxComplete(PVDISK pDisk, PVDIOCTX pIoCtx);
 static void vdDiskProcessBlockedIoCtx(PVDISK pDisk);
 static int vdDiskUnlock(PVDISK pDisk, PVDIOCTX pIoCtxRc);
 static DECLCALLBACK(void) vdIoCtxSyncComplete(void *pvUser1, void *pvUser2, int rcReq);
@@ -439,6 +455,164 @@ DECLINLINE(int) vdThreadFinishWrite(PVDISK pDisk)
     return rc;
 }
 
+/**
+ * internal: destroy callback for the allocation index ranges.
+ */
+static DECLCALLBACK(int) vdAllocIdxRangeDestroy(PAVLRU64NODECORE pNode, void *pvUser)
+{
+    RT_NOREF1(pvUser);
+    RTMemFree(pNode);
+    return VINF_SUCCESS;
+}
+
+/**
+ * internal: drops everything from the allocation index, used whenever the
+ * image chain changes.
+ */
+static void vdAllocIdxReset(PVDISK pDisk)
+{
+    PVDALLOCINDEX pIdx = &pDisk->AllocIdx;
+
+    if (pIdx->cRanges)
+    {
+        RTAvlrU64Destroy(&pIdx->TreeRanges, vdAllocIdxRangeDestroy, NULL);
+        RTListInit(&pIdx->ListLru);
+        pIdx->cRanges = 0;
+        pIdx->pStats->cResets++;
+    }
+}
+
+/**
+ * internal: removes the given range from the allocation index.
+ */
+static void vdAllocIdxRangeRemove(PVDALLOCINDEX pIdx, PVDALLOCRANGE pRange)
+{
+    PAVLRU64NODECORE pCore = RTAvlrU64Remove(&pIdx->TreeRanges, pRange->Core.Key);
+    Assert(pCore == &pRange->Core); RT_NOREF(pCore);
+    RTListNodeRemove(&pRange->NodeLru);
+    pIdx->cRanges--;
+}
+
+/**
+ * internal: drops the given part of the disk from the allocation index,
+ * called before the range is written.
+ */
+static void vdAllocIdxInvalidate(PVDISK pDisk, uint64_t uOffset, size_t cbRange)
+{
+    PVDALLOCINDEX pIdx = &pDisk->AllocIdx;
+    uint64_t offLast = uOffset + cbRange - 1;
+    bool fInvalidated = false;
+
+    if (!pIdx->cRanges || !cbRange)
+        return;
+
+    /* Trim the range overlapping the start, splitting it if it covers the whole write. */
+    PVDALLOCRANGE pRange = (PVDALLOCRANGE)RTAvlrU64RangeGet(&pIdx->TreeRanges, uOffset);
+    if (pRange && pRange->Core.Key < uOffset)
+    {
+        if (   pRange->Core.KeyLast > offLast
+            && pIdx->cRanges < pIdx->cRangesMax)
+        {
+            PVDALLOCRANGE pTail = (PVDALLOCRANGE)RTMemAllocZ(sizeof(VDALLOCRANGE));
+            if (pTail)
+            {
+                pTail->Core.Key       = offLast + 1;
+                pTail->Core.KeyLast   = pRange->Core.KeyLast;
+                pTail->pImage         = pRange->pImage;
+                pTail->cImagesSkipped = pRange->cImagesSkipped;
+                pRange->Core.KeyLast  = uOffset - 1;
+                bool fInserted = RTAvlrU64Insert(&pIdx->TreeRanges, &pTail->Core);
+                Assert(fInserted); RT_NOREF(fInserted);
+                RTListPrepend(&pIdx->ListLru, &pTail->NodeLru);
+                pIdx->cRanges++;
+            }
+        }
+
+        /* Shrinking in place is fine, the ranges don't overlap. */
+        pRange->Core.KeyLast = uOffset - 1;
+        fInvalidated = true;
+    }
+
+    /* Drop or trim everything starting inside the written range. */
+    while (   (pRange = (PVDALLOCRANGE)RTAvlrU64GetBestFit(&pIdx->TreeRanges, uOffset, true /*fAbove*/)) != NULL
+           && pRange->Core.Key <= offLast)
+    {
+        vdAllocIdxRangeRemove(pIdx, pRange);
+        if (pRange->Core.KeyLast > offLast)
+        {
+            pRange->Core.Key = offLast + 1;
+            bool fInserted = RTAvlrU64Insert(&pIdx->TreeRanges, &pRange->Core);
+            Assert(fInserted); RT_NOREF(fInserted);
+            RTListAppend(&pIdx->ListLru, &pRange->NodeLru);
+            pIdx->cRanges++;
+        }
+        else
+            RTMemFree(pRange);
+        fInvalidated = true;
+    }
+
+    if (fInvalidated)
+        pIdx->pStats->cInvalidations++;
+}
+
+/**
+ * internal: remembers the owner of a range after a walk of the whole chain.
+ *
+ * @param   pDisk           The disk.
+ * @param   uOffset         Start of the range.
+ * @param   cbRange         Size of the range.
+ * @param   pImage          The image holding the data, NULL if no image has data.
+ * @param   cImagesSkipped  Number of images above pImage without data for the range.
+ */
+static void vdAllocIdxRecord(PVDISK pDisk, uint64_t uOffset, size_t cbRange,
+                             PVDIMAGE pImage, unsigned cImagesSkipped)
+{
+    PVDALLOCINDEX pIdx = &pDisk->AllocIdx;
+    PVDALLOCRANGE pRange;
+
+    if (!cbRange)
+        return;
+
+    /* Extend the preceding range if it has the same owner, keeps sequential reads from filling the index. */
+    if (uOffset > 0)
+    {
+        pRange = (PVDALLOCRANGE)RTAvlrU64RangeGet(&pIdx->TreeRanges, uOffset - 1);
+        if (   pRange
+            && pRange->pImage == pImage
+            && pRange->cImagesSkipped == cImagesSkipped)
+        {
+            /* The caller made sure the new range doesn't overlap the next one. */
+            pRange->Core.KeyLast = uOffset + cbRange - 1;
+            RTListNodeRemove(&pRange->NodeLru);
+            RTListPrepend(&pIdx->ListLru, &pRange->NodeLru);
+            return;
+        }
+    }
+
+    if (pIdx->cRanges >= pIdx->cRangesMax)
+    {
+        /* Reuse the least recently used range. */
+        pRange = RTListGetLast(&pIdx->ListLru, VDALLOCRANGE, NodeLru);
+        AssertPtrReturnVoid(pRange);
+        vdAllocIdxRangeRemove(pIdx, pRange);
+    }
+    else
+    {
+        pRange = (PVDALLOCRANGE)RTMemAllocZ(sizeof(VDALLOCRANGE));
+        if (!pRange)
+            return;
+    }
+
+    pRange->Core.Key       = uOffset;
+    pRange->Core.KeyLast   = uOffset + cbRange - 1;
+    pRange->pImage         = pImage;
+    pRange->cImagesSkipped = cImagesSkipped;
+    bool fInserted = RTAvlrU64Insert(&pIdx->TreeRanges, &pRange->Core);
+    Assert(fInserted); RT_NOREF(fInserted);
+    RTListPrepend(&pIdx->ListLru, &pRange->NodeLru);
+    pIdx->cRanges++;
+}
+
 /**
  * internal: add image structure to the end of images list.
  */
@@ -462,6 +636,7 @@ static void vdAddImageToList(PVDISK pDisk, PVDIMAGE pImage)
     }
 
     pDisk->cImages++;
+    vdAllocIdxReset(pDisk);
 }
 
 /**
@@ -485,6 +660,7 @@ static void vdRemoveImageFromList(PVDISK pDisk, PVDIMAGE pImage)
     pImage->pNext = NULL;
 
     pDisk->cImages--;
+    vdAllocIdxReset(pDisk);
 }
 
 /**
@@ -692,6 +868,10 @@ static int vdFilterChainApplyRead(PVDISK pDisk, uint64_t uOffset, size_t cbRead,
 
 DECLINLINE(void) vdIoCtxRootComplete(PVDISK pDisk, PVDIOCTX pIoCtx)
 {
+    /* The cache holds unfiltered data, update it before the read filters run. */
+    if (pDisk->pCache)
+        vdCacheIoCtxComplete(pDisk, pIoCtx);
+
     if (   RT_SUCCESS(pIoCtx->rcReq)
         && pIoCtx->enmTxDir == VDIOCTXTXDIR_READ)
         pIoCtx->rcReq = vdFilterChainApplyRead(pDisk, pIoCtx->Req.Io.uOffsetXferOrig,
@@ -721,6 +901,9 @@ DECLINLINE(void) vdIoCtxInit(PVDIOCTX pIoCtx, PVDISK pDisk, VDIOCTXTXDIR enmTxDi
     pIoCtx->Req.Io.pImageParentOverride = NULL;
     pIoCtx->Req.Io.uOffsetXferOrig      = uOffset;
     pIoCtx->Req.Io.cbXferOrig           = cbTransfer;
+    pIoCtx->Req.Io.uOffsetCacheFill     = 0;
+    pIoCtx->Req.Io.cbCacheFill          = 0;
+    pIoCtx->Req.Io.uCacheGen            = 0;
     pIoCtx->cDataTransfersPending = 0;
     pIoCtx->cMetaTransfersPending = 0;
     pIoCtx->fComplete             = false;
@@ -820,6 +1003,298 @@ static int vdCacheWriteHelper(PVDCACHE pCache, uint64_t uOffset, size_t cbWrite,
     return rc;
 }
 
+/**
+ * Internal: Drops the given range from the cache, disabling the cache
+ * if that fails because it can't be kept consistent with the disk then.
+ *
+ * @returns nothing.
+ * @param   pDisk      The disk the cache is attached to.
+ * @param   uOffset    Start offset of the range.
+ * @param   cbRange    Size of the range.
+ */
+static void vdCacheInvalidate(PVDISK pDisk, uint64_t uOffset, size_t cbRange)
+{
+    PVDCACHE pCache = pDisk->pCache;
+    int rc = VERR_NOT_SUPPORTED;
+
+    if (pCache->fDisabled)
+        return;
+
+    if (pCache->Backend->pfnDiscard)
+    {
+        size_t cbPreAllocated = 0;
+        size_t cbPostAllocated = 0;
+        size_t cbActuallyDiscarded = 0;
+
+        rc = pCache->Backend->pfnDiscard(pCache->pBackendData, NULL, uOffset, cbRange,
+                                         &cbPreAllocated, &cbPostAllocated,
+                                         &cbActuallyDiscarded, NULL, 0);
+    }
+
+    if (RT_SUCCESS(rc))
+        pCache->pStats->cInvalidations++;
+    else
+    {
+        LogRel(("VD: Disabling cache '%s', dropping %zu bytes at offset %llu failed with %Rrc\n",
+                pCache->pszFilename, cbRange, uOffset, rc));
+        pCache->fDisabled = true;
+    }
+}
+
+/**
+ * Internal: Writes the given buffer to the cache synchronously, dropping the
+ * range from the cache on failure.
+ *
+ * @returns VBox status code.
+ * @param   pDisk      The disk the cache is attached to.
+ * @param   uOffset    Offset of the virtual disk to write to the cache.
+ * @param   pvBuf      The data to write.
+ * @param   cbWrite    How much to write.
+ */
+static int vdCacheWriteSync(PVDISK pDisk, uint64_t uOffset, void *pvBuf, size_t cbWrite)
+{
+    RTSGSEG Segment;
+    RTSGBUF SgBuf;
+    VDIOCTX IoCtx;
+
+    Segment.pvSeg = pvBuf;
+    Segment.cbSeg = cbWrite;
+    RTSgBufInit(&SgBuf, &Segment, 1);
+    vdIoCtxInit(&IoCtx, pDisk, VDIOCTXTXDIR_WRITE, uOffset, cbWrite, NULL, &SgBuf,
+                NULL, NULL, VDIOCTX_FLAGS_SYNC | VDIOCTX_FLAGS_DONT_FREE);
+
+    int rc = vdCacheWriteHelper(pDisk->pCache, uOffset, cbWrite, &IoCtx, NULL);
+    if (RT_FAILURE(rc))
+    {
+        LogFlowFunc(("Writing %zu bytes at %llu to the cache failed with %Rrc\n", cbWrite, uOffset, rc));
+        vdCacheInvalidate(pDisk, uOffset, cbWrite);
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Copies the given range out of the I/O context and writes it to the cache.
+ *
+ * @returns VBox status code.
+ * @param   pDisk      The disk the cache is attached to.
+ * @param   pIoCtx     The root I/O context holding the data.
+ * @param   uOffset    Offset of the virtual disk to write to the cache.
+ * @param   cbWrite    How much to write.
+ */
+static int vdCacheWriteFromIoCtx(PVDISK pDisk, PVDIOCTX pIoCtx, uint64_t uOffset, size_t cbWrite)
+{
+    void *pvBuf = RTMemTmpAlloc(cbWrite);
+    if (!pvBuf)
+        return VERR_NO_MEMORY;
+
+    RTSGBUF SgBuf;
+    RTSgBufClone(&SgBuf, &pIoCtx->Req.Io.SgBuf);
+    RTSgBufReset(&SgBuf);
+    RTSgBufAdvance(&SgBuf, uOffset - pIoCtx->Req.Io.uOffsetXferOrig);
+    size_t cbCopied = RTSgBufCopyToBuf(&SgBuf, pvBuf, cbWrite);
+    Assert(cbCopied == cbWrite); RT_NOREF(cbCopied);
+
+    int rc = vdCacheWriteSync(pDisk, uOffset, pvBuf, cbWrite);
+    RTMemTmpFree(pvBuf);
+    return rc;
+}
+
+/**
+ * Internal: Checks whether a read miss of the given range is admitted to the cache.
+ *
+ * @returns true if the range should be cached, false otherwise.
+ * @param   pCache     The cache.
+ * @param   uOffset    Start offset of the range.
+ * @param   cbRange    Size of the range.
+ */
+static bool vdCacheAdmit(PVDCACHE pCache, uint64_t uOffset, size_t cbRange)
+{
+    if (pCache->Cfg.cAdmitMisses <= 1)
+        return true;
+
+    /*
+     * Only chunks missed often enough are cached, the miss counters live in a small
+     * direct mapped table so chunks which were not accessed for a while are forgotten.
+     */
+    bool fAdmit = true;
+    uint64_t uChunkLast = (uOffset + cbRange - 1) >> VD_CACHE_ADMIT_CHUNK_SHIFT;
+    for (uint64_t uChunk = uOffset >> VD_CACHE_ADMIT_CHUNK_SHIFT; uChunk <= uChunkLast; uChunk++)
+    {
+        unsigned idx = (unsigned)((uChunk * UINT64_C(0x9e3779b97f4a7c15)) >> 32) % VD_CACHE_ADMIT_GHOSTS;
+
+        if (pCache->aAdmitGhosts[idx].uChunk == uChunk + 1)
+            pCache->aAdmitGhosts[idx].cMisses++;
+        else
+        {
+            pCache->aAdmitGhosts[idx].uChunk  = uChunk + 1;
+            pCache->aAdmitGhosts[idx].cMisses = 1;
+        }
+
+        if (pCache->aAdmitGhosts[idx].cMisses < pCache->Cfg.cAdmitMisses)
+            fAdmit = false;
+    }
+
+    return fAdmit;
+}
+
+/**
+ * Internal: Records a range which was not in the cache and read from the image.
+ *
+ * @returns nothing.
+ * @param   pDisk      The disk the cache is attached to.
+ * @param   pIoCtx     The I/O context reading the range.
+ * @param   uOffset    Start offset of the range.
+ * @param   cbRead     Size of the range.
+ */
+static void vdCacheReadMiss(PVDISK pDisk, PVDIOCTX pIoCtx, uint64_t uOffset, size_t cbRead)
+{
+    PVDCACHE pCache = pDisk->pCache;
+
+    pCache->pStats->cReadMisses++;
+    pCache->pStats->cbReadMisses += cbRead;
+
+    /* Only completed root reads write to the cache, see vdCacheIoCtxComplete(). */
+    if (   !(pIoCtx->fFlags & VDIOCTX_FLAGS_READ_UPDATE_CACHE)
+        || pIoCtx->pIoCtxParent
+        || pIoCtx->enmTxDir != VDIOCTXTXDIR_READ
+        || ((uOffset | cbRead) & 511))
+        return;
+
+    if (   (   pCache->Cfg.cbAdmitMax
+            && pIoCtx->Req.Io.cbXferOrig > pCache->Cfg.cbAdmitMax)
+        || !vdCacheAdmit(pCache, uOffset, cbRead))
+    {
+        pCache->pStats->cFillsRejected++;
+        return;
+    }
+
+    if (!pIoCtx->Req.Io.cbCacheFill)
+    {
+        /* The data read might be overtaken by a write in flight, don't cache it then. */
+        if (ASMAtomicReadU32(&pCache->cWritesActive))
+        {
+            pCache->pStats->cFillsRejected++;
+            return;
+        }
+
+        pIoCtx->Req.Io.uCacheGen        = ASMAtomicReadU32(&pCache->uWriteGen);
+        pIoCtx->Req.Io.uOffsetCacheFill = uOffset;
+        pIoCtx->Req.Io.cbCacheFill      = cbRead;
+    }
+    else
+    {
+        /*
+         * Extend the range to fill, the gaps were read from the cache or the image
+         * with this request as well and rewriting cached data doesn't hurt.
+         */
+        uint64_t uOffsetStart = RT_MIN(pIoCtx->Req.Io.uOffsetCacheFill, uOffset);
+        uint64_t uOffsetEnd   = RT_MAX(pIoCtx->Req.Io.uOffsetCacheFill + pIoCtx->Req.Io.cbCacheFill,
+                                       uOffset + cbRead);
+
+        pIoCtx->Req.Io.uOffsetCacheFill = uOffsetStart;
+        pIoCtx->Req.Io.cbCacheFill      = (size_t)(uOffsetEnd - uOffsetStart);
+    }
+}
+
+/**
+ * Internal: Applies the cache write policy to a write changing the disk content.
+ *
+ * @returns nothing.
+ * @param   pDisk      The disk the cache is attached to.
+ * @param   pIoCtx     The root write I/O context, with the write filters applied.
+ */
+static void vdCacheWriteStart(PVDISK pDisk, PVDIOCTX pIoCtx)
+{
+    PVDCACHE pCache   = pDisk->pCache;
+    uint64_t uOffset  = pIoCtx->Req.Io.uOffsetXferOrig;
+    size_t   cbWrite  = pIoCtx->Req.Io.cbXferOrig;
+
+    /* Reads in flight can't fill the cache anymore, see vdCacheReadMiss(). */
+    ASMAtomicIncU32(&pCache->uWriteGen);
+    ASMAtomicIncU32(&pCache->cWritesActive);
+
+    if (pCache->fDisabled)
+        return;
+
+    if (   pCache->Cfg.enmMode == VDCACHEMODE_WRITE_THROUGH
+        && !((uOffset | cbWrite) & 511))
+    {
+        int rc = vdCacheWriteFromIoCtx(pDisk, pIoCtx, uOffset, cbWrite);
+        if (RT_SUCCESS(rc))
+        {
+            pCache->pStats->cWriteUpdates++;
+            pCache->pStats->cbWriteUpdates += cbWrite;
+        }
+        else if (rc == VERR_NO_MEMORY)
+            vdCacheInvalidate(pDisk, uOffset, cbWrite);
+    }
+    else
+        vdCacheInvalidate(pDisk, uOffset, cbWrite);
+}
+
+/**
+ * Internal: Updates the cache when a root I/O context completed.
+ *
+ * @returns nothing.
+ * @param   pDisk      The disk the cache is attached to.
+ * @param   pIoCtx     The completed I/O context.
+ */
+static void vdCacheIoCtxComplete(PVDISK pDisk, PVDIOCTX pIoCtx)
+{
+    PVDCACHE pCache = pDisk->pCache;
+
+    VD_IS_LOCKED(pDisk);
+
+    if (pIoCtx->enmTxDir == VDIOCTXTXDIR_READ)
+    {
+        size_t cbFill = pIoCtx->Req.Io.cbCacheFill;
+
+        pIoCtx->Req.Io.cbCacheFill = 0;
+        if (   !cbFill
+            || pCache->fDisabled
+            || RT_FAILURE(pIoCtx->rcReq))
+            return;
+
+        if (ASMAtomicReadU32(&pCache->uWriteGen) == pIoCtx->Req.Io.uCacheGen)
+        {
+            int rc = vdCacheWriteFromIoCtx(pDisk, pIoCtx, pIoCtx->Req.Io.uOffsetCacheFill, cbFill);
+            if (RT_SUCCESS(rc))
+            {
+                pCache->pStats->cFills++;
+                pCache->pStats->cbFills += cbFill;
+            }
+        }
+        else
+            pCache->pStats->cFillsRejected++;
+    }
+    else if (   pIoCtx->enmTxDir == VDIOCTXTXDIR_WRITE
+             && (pIoCtx->fFlags & VDIOCTX_FLAGS_CACHE_WRITE_APPLIED))
+    {
+        pIoCtx->fFlags &= ~VDIOCTX_FLAGS_CACHE_WRITE_APPLIED;
+        ASMAtomicDecU32(&pCache->cWritesActive);
+
+        /* The image content is unknown after a failed write, don't keep what was written through. */
+        if (RT_FAILURE(pIoCtx->rcReq))
+            vdCacheInvalidate(pDisk, pIoCtx->Req.Io.uOffsetXferOrig, pIoCtx->Req.Io.cbXferOrig);
+    }
+}
+
+/**
+ * Internal: Resets the configuration of a newly attached cache to the defaults.
+ *
+ * @returns nothing.
+ * @param   pCache     The cache.
+ */
+static void vdCacheInitConfig(PVDCACHE pCache)
+{
+    pCache->Cfg.enmMode      = VDCACHEMODE_WRITE_AROUND;
+    pCache->Cfg.cbAdmitMax   = 0;
+    pCache->Cfg.cAdmitMisses = 0;
+    pCache->Cfg.pStats       = NULL;
+    pCache->pStats           = &pCache->StatsInt;
+}
+
 /**
  * Creates a new empty discard state.
  *
@@ -1438,6 +1913,10 @@ static int vdDiskProcessWaitingIoCtx(PVDISK pDisk, PVDIOCTX pIoCtxRc)
         rcTmp = vdIoCtxProcessLocked(pTmp);
         if (pTmp == pIoCtxRc)
         {
+            if (   rcTmp == VINF_VD_ASYNC_IO_FINISHED
+                && pDisk->pCache)
+                vdCacheIoCtxComplete(pDisk, pTmp);
+
             if (   rcTmp == VINF_VD_ASYNC_IO_FINISHED
                 && RT_SUCCESS(pTmp->rcReq)
                 && pTmp->enmTxDir == VDIOCTXTXDIR_READ)
@@ -1681,6 +2160,80 @@ static int vdDiskReadHelper(PVDISK pDisk, PVDIMAGE pImage, PVDIMAGE pImageParent
     return rc;
 }
 
+/**
+ * Internal: Checks whether a read starting at the given image can make use of
+ * the allocation index.
+ */
+DECLINLINE(bool) vdAllocIdxIsUsable(PVDISK pDisk, PVDIMAGE pImage, PVDIMAGE pImageParentOverride,
+                                    unsigned cImagesRead)
+{
+    return    pDisk->AllocIdx.cRangesMax
+           && pDisk->cImages > 1
+           && pImage == pDisk->pLast
+           && !pImageParentOverride
+           && !cImagesRead;
+}
+
+/**
+ * Internal: Reads a given amount of data from the image chain of the disk,
+ * starting at the image the allocation index knows to hold the data.
+ **/
+static int vdAllocIdxReadHelper(PVDISK pDisk, uint64_t uOffset, size_t cbRead,
+                                PVDIOCTX pIoCtx, size_t *pcbThisRead)
+{
+    PVDALLOCINDEX pIdx = &pDisk->AllocIdx;
+    PVDIMAGE pImage = pDisk->pLast;
+    unsigned cImagesSkipped = 0;
+    size_t cbThisRead = cbRead;
+    int rc = VERR_VD_BLOCK_FREE;
+
+    *pcbThisRead = 0;
+    pIdx->pStats->cLookups++;
+
+    PVDALLOCRANGE pRange = (PVDALLOCRANGE)RTAvlrU64RangeGet(&pIdx->TreeRanges, uOffset);
+    if (pRange)
+    {
+        cbThisRead = (size_t)RT_MIN((uint64_t)cbThisRead, pRange->Core.KeyLast - uOffset + 1);
+        pImage = pRange->pImage;
+        cImagesSkipped = pRange->cImagesSkipped;
+        pIdx->pStats->cHits++;
+        pIdx->pStats->cImagesSkipped += cImagesSkipped;
+        RTListNodeRemove(&pRange->NodeLru);
+        RTListPrepend(&pIdx->ListLru, &pRange->NodeLru);
+    }
+    else
+    {
+        /* Stop at the next known range so the result can be recorded. */
+        PVDALLOCRANGE pNext = (PVDALLOCRANGE)RTAvlrU64GetBestFit(&pIdx->TreeRanges, uOffset, true /*fAbove*/);
+        if (pNext)
+            cbThisRead = (size_t)RT_MIN((uint64_t)cbThisRead, pNext->Core.Key - uOffset);
+    }
+
+    /* Walk down from the owner, a stale entry only costs the extra lookups. */
+    while (pImage && rc == VERR_VD_BLOCK_FREE)
+    {
+        rc = pImage->Backend->pfnRead(pImage->pBackendData, uOffset, cbThisRead,
+                                      pIoCtx, &cbThisRead);
+        pIdx->pStats->cImagesRead++;
+        if (rc == VERR_VD_BLOCK_FREE)
+        {
+            pImage = pImage->pPrev;
+            cImagesSkipped++;
+        }
+    }
+
+    if (   RT_SUCCESS(rc)
+        || rc == VERR_VD_BLOCK_FREE
+        || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+    {
+        if (!pRange)
+            vdAllocIdxRecord(pDisk, uOffset, cbThisRead, pImage, cImagesSkipped);
+        *pcbThisRead = cbThisRead;
+    }
+
+    return rc;
+}
+
 /**
  * internal: read the specified amount of data in whatever blocks the backend
  * will give us - async version.
@@ -1721,24 +2274,33 @@ static DECLCALLBACK(int) vdReadHelperAsync(PVDIOCTX pIoCtx)
         cbThisRead = cbToRead;
 
         if (   pDisk->pCache
+            && !pDisk->pCache->fDisabled
             && !pImageParentOverride)
         {
             rc = vdCacheReadHelper(pDisk->pCache, uOffset, cbThisRead,
                                    pIoCtx, &cbThisRead);
             if (rc == VERR_VD_BLOCK_FREE)
             {
-                rc = vdDiskReadHelper(pDisk, pCurrImage, NULL, uOffset, cbThisRead,
-                                      pIoCtx, &cbThisRead);
+                if (vdAllocIdxIsUsable(pDisk, pCurrImage, pImageParentOverride, cImagesRead))
+                    rc = vdAllocIdxReadHelper(pDisk, uOffset, cbThisRead, pIoCtx, &cbThisRead);
+                else
+                    rc = vdDiskReadHelper(pDisk, pCurrImage, NULL, uOffset, cbThisRead,
+                                          pIoCtx, &cbThisRead);
 
-                /* If the read was successful, write the data back into the cache. */
+                /* The data is written back into the cache when the read completed. */
                 if (   RT_SUCCESS(rc)
-                    && pIoCtx->fFlags & VDIOCTX_FLAGS_READ_UPDATE_CACHE)
-                {
-                    rc = vdCacheWriteHelper(pDisk->pCache, uOffset, cbThisRead,
-                                            pIoCtx, NULL);
-                }
+                    || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+                    vdCacheReadMiss(pDisk, pIoCtx, uOffset, cbThisRead);
+            }
+            else if (   RT_SUCCESS(rc)
+                     || rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            {
+                pDisk->pCache->pStats->cReadHits++;
+                pDisk->pCache->pStats->cbReadHits += cbThisRead;
             }
         }
+        else if (vdAllocIdxIsUsable(pDisk, pCurrImage, pImageParentOverride, cImagesRead))
+            rc = vdAllocIdxReadHelper(pDisk, uOffset, cbThisRead, pIoCtx, &cbThisRead);
         else
         {
             /*
@@ -2039,9 +2601,228 @@ static int vdWriteHelper(PVDISK pDisk, PVDIMAGE pImage, uint64_t uOffset,
                            fFlags, 0);
 }
 
+/**
+ * A buffer of the copy pipeline.
+ */
+typedef struct VDCOPYBUF
+{
+    /** The buffer, VD_MERGE_BUFFER_SIZE bytes big. */
+    void                *pvBuf;
+    /** Offset of the data in the disk. */
+    uint64_t            uOffset;
+    /** Amount of valid data in the buffer. */
+    size_t              cbData;
+    /** Flag whether the buffer holds data waiting to be written. */
+    volatile bool       fFull;
+} VDCOPYBUF;
+/** Pointer to a copy pipeline buffer. */
+typedef VDCOPYBUF *PVDCOPYBUF;
+
+/**
+ * Copy pipeline state, the calling thread reads from the source disk while
+ * a worker thread writes the previously read data to the destination disk.
+ */
+typedef struct VDCOPYPIPELINE
+{
+    /** The destination disk. */
+    PVDISK              pDiskTo;
+    /** Number of images of the destination disk to read for collapsed I/O. */
+    unsigned            cImagesToRead;
+    /** Flag whether the data is copied blockwise. */
+    bool                fBlockwiseCopy;
+    /** The writer thread. */
+    RTTHREAD            hThreadWriter;
+    /** Signalled by the reader when a buffer was filled or the pipeline shuts down. */
+    RTSEMEVENT          hEvtFilled;
+    /** Signalled by the writer when a buffer was written or writing failed. */
+    RTSEMEVENT          hEvtDrained;
+    /** Flag whether the writer should exit once all buffers are written. */
+    volatile bool       fShutdown;
+    /** Status of the writer. */
+    volatile int        rcWriter;
+    /** The buffers, used in a round robin fashion. */
+    VDCOPYBUF           aBufs[VD_COPY_PIPELINE_DEPTH];
+} VDCOPYPIPELINE;
+/** Pointer to a copy pipeline state. */
+typedef VDCOPYPIPELINE *PVDCOPYPIPELINE;
+
+/**
+ * Internal: Writes one chunk of copied data to the destination disk.
+ */
+static int vdCopyWriteChunk(PVDISK pDiskTo, uint64_t uOffset, const void *pvBuf, size_t cbWrite,
+                            bool fBlockwiseCopy, unsigned cImagesToRead)
+{
+    int rc2 = vdThreadStartWrite(pDiskTo);
+    AssertRC(rc2);
+
+    /* Only do collapsed I/O if we are copying the data blockwise. */
+    int rc = vdWriteHelperEx(pDiskTo, pDiskTo->pLast, NULL, uOffset, pvBuf,
+                             cbWrite, VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG /* fFlags */,
+                             fBlockwiseCopy ? cImagesToRead : 0);
+
+    rc2 = vdThreadFinishWrite(pDiskTo);
+    AssertRC(rc2);
+    return rc;
+}
+
+/**
+ * Writer thread of the copy pipeline.
+ */
+static DECLCALLBACK(int) vdCopyPipelineWriter(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PVDCOPYPIPELINE pPipeline = (PVDCOPYPIPELINE)pvUser;
+    unsigned idxBuf = 0;
+
+    RT_NOREF(hThreadSelf);
+
+    for (;;)
+    {
+        PVDCOPYBUF pBuf = &pPipeline->aBufs[idxBuf];
+
+        if (!ASMAtomicReadBool(&pBuf->fFull))
+        {
+            if (ASMAtomicReadBool(&pPipeline->fShutdown))
+                break;
+            RTSemEventWait(pPipeline->hEvtFilled, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        int rc = vdCopyWriteChunk(pPipeline->pDiskTo, pBuf->uOffset, pBuf->pvBuf, pBuf->cbData,
+                                  pPipeline->fBlockwiseCopy, pPipeline->cImagesToRead);
+        if (RT_FAILURE(rc))
+        {
+            ASMAtomicWriteS32(&pPipeline->rcWriter, rc);
+            RTSemEventSignal(pPipeline->hEvtDrained);
+            break;
+        }
+
+        ASMAtomicWriteBool(&pBuf->fFull, false);
+        RTSemEventSignal(pPipeline->hEvtDrained);
+        idxBuf = (idxBuf + 1) % RT_ELEMENTS(pPipeline->aBufs);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: Sets up the copy pipeline, allocating the buffers and starting the writer.
+ *
+ * @returns VBox status code.
+ * @param   pPipeline       The pipeline state to initialize.
+ * @param   pDiskTo         The destination disk.
+ * @param   fBlockwiseCopy  Flag whether the data is copied blockwise.
+ * @param   cImagesToRead   Number of images of the destination disk to read for collapsed I/O.
+ * @param   fWriter         Flag whether to start the writer thread, if false only
+ *                          the first buffer is allocated and data is written inline.
+ */
+static int vdCopyPipelineInit(PVDCOPYPIPELINE pPipeline, PVDISK pDiskTo, bool fBlockwiseCopy,
+                              unsigned cImagesToRead, bool fWriter)
+{
+    int rc = VINF_SUCCESS;
+
+    RT_ZERO(*pPipeline);
+    pPipeline->pDiskTo        = pDiskTo;
+    pPipeline->cImagesToRead  = cImagesToRead;
+    pPipeline->fBlockwiseCopy = fBlockwiseCopy;
+    pPipeline->hThreadWriter  = NIL_RTTHREAD;
+    pPipeline->hEvtFilled     = NIL_RTSEMEVENT;
+    pPipeline->hEvtDrained    = NIL_RTSEMEVENT;
+    pPipeline->rcWriter       = VINF_SUCCESS;
+
+    pPipeline->aBufs[0].pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
+    if (!pPipeline->aBufs[0].pvBuf)
+        return VERR_NO_MEMORY;
+
+    if (fWriter)
+    {
+        for (unsigned i = 1; i < RT_ELEMENTS(pPipeline->aBufs) && RT_SUCCESS(rc); i++)
+        {
+            pPipeline->aBufs[i].pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
+            if (!pPipeline->aBufs[i].pvBuf)
+                rc = VERR_NO_MEMORY;
+        }
+        if (RT_SUCCESS(rc))
+            rc = RTSemEventCreate(&pPipeline->hEvtFilled);
+        if (RT_SUCCESS(rc))
+            rc = RTSemEventCreate(&pPipeline->hEvtDrained);
+        if (RT_SUCCESS(rc))
+            rc = RTThreadCreate(&pPipeline->hThreadWriter, vdCopyPipelineWriter, pPipeline, 0,
+                                RTTHREADTYPE_IO, RTTHREADFLAGS_WAITABLE, "VDCopyWr");
+
+        /* Not fatal, the data is written inline then. */
+        if (RT_FAILURE(rc))
+        {
+            LogRel(("VD: Failed to set up the copy pipeline with %Rrc, copying serially\n", rc));
+            pPipeline->hThreadWriter = NIL_RTTHREAD;
+            rc = VINF_SUCCESS;
+        }
+    }
+
+    return rc;
+}
+
+/**
+ * Internal: Waits for all queued data to be written, stops the writer and frees
+ * the pipeline resources.
+ *
+ * @returns Status of the writer.
+ * @param   pPipeline       The pipeline state.
+ */
+static int vdCopyPipelineTerm(PVDCOPYPIPELINE pPipeline)
+{
+    int rc = VINF_SUCCESS;
+
+    if (pPipeline->hThreadWriter != NIL_RTTHREAD)
+    {
+        ASMAtomicWriteBool(&pPipeline->fShutdown, true);
+        RTSemEventSignal(pPipeline->hEvtFilled);
+        int rc2 = RTThreadWait(pPipeline->hThreadWriter, RT_INDEFINITE_WAIT, NULL);
+        AssertRC(rc2);
+        rc = ASMAtomicReadS32(&pPipeline->rcWriter);
+    }
+
+    if (pPipeline->hEvtFilled != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pPipeline->hEvtFilled);
+    if (pPipeline->hEvtDrained != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pPipeline->hEvtDrained);
+    for (unsigned i = 0; i < RT_ELEMENTS(pPipeline->aBufs); i++)
+        if (pPipeline->aBufs[i].pvBuf)
+            RTMemTmpFree(pPipeline->aBufs[i].pvBuf);
+
+    return rc;
+}
+
+/**
+ * Internal: Returns the next buffer to read into, waiting for the writer to drain it.
+ *
+ * @returns VBox status code, the writer status if it failed.
+ * @param   pPipeline       The pipeline state.
+ * @param   idxBuf          Index of the buffer.
+ * @param   ppBuf           Where to store the buffer.
+ */
+static int vdCopyPipelineGetBuf(PVDCOPYPIPELINE pPipeline, unsigned idxBuf, PVDCOPYBUF *ppBuf)
+{
+    PVDCOPYBUF pBuf = &pPipeline->aBufs[idxBuf];
+
+    while (ASMAtomicReadBool(&pBuf->fFull))
+    {
+        int rc = ASMAtomicReadS32(&pPipeline->rcWriter);
+        if (RT_FAILURE(rc))
+            return rc;
+        RTSemEventWait(pPipeline->hEvtDrained, RT_INDEFINITE_WAIT);
+    }
+
+    *ppBuf = pBuf;
+    return ASMAtomicReadS32(&pPipeline->rcWriter);
+}
+
 /**
  * Internal: Copies the content of one disk to another one applying optimizations
  * to speed up the copy process if possible.
+ *
+ * Ranges which are not allocated in the source are skipped without reading any
+ * data if the copy is done blockwise. If the disks differ the data is written by
+ * a separate thread so reading and writing overlap.
  */
 static int vdCopyHelper(PVDISK pDiskFrom, PVDIMAGE pImageFrom, PVDISK pDiskTo,
                         uint64_t cbSize, unsigned cImagesFromRead, unsigned cImagesToRead,
@@ -2052,11 +2833,13 @@ static int vdCopyHelper(PVDISK pDiskFrom, PVDIMAGE pImageFrom, PVDISK pDiskTo,
     int rc2;
     uint64_t uOffset = 0;
     uint64_t cbRemaining = cbSize;
-    void *pvBuf = NULL;
+    uint64_t cbCopied = 0;
     bool fLockReadFrom = false;
-    bool fLockWriteTo = false;
     bool fBlockwiseCopy = false;
     unsigned uProgressOld = 0;
+    unsigned idxBuf = 0;
+    uint64_t tsStart = RTTimeMilliTS();
+    VDCOPYPIPELINE Pipeline;
 
     LogFlowFunc(("pDiskFrom=%#p pImageFrom=%#p pDiskTo=%#p cbSize=%llu cImagesFromRead=%u cImagesToRead=%u fSuppressRedundantIo=%RTbool pIfProgress=%#p pDstIfProgress=%#p\n",
                  pDiskFrom, pImageFrom, pDiskTo, cbSize, cImagesFromRead, cImagesToRead, fSuppressRedundantIo, pDstIfProgress, pDstIfProgress));
@@ -2065,14 +2848,23 @@ static int vdCopyHelper(PVDISK pDiskFrom, PVDIMAGE pImageFrom, PVDISK pDiskTo,
         && RTListIsEmpty(&pDiskFrom->ListFilterChainRead))
         fBlockwiseCopy = true;
 
-    /* Allocate tmp buffer. */
-    pvBuf = RTMemTmpAlloc(VD_MERGE_BUFFER_SIZE);
-    if (!pvBuf)
+    /* Allocate the buffers, the writer thread is only used if the disks differ. */
+    rc = vdCopyPipelineInit(&Pipeline, pDiskTo, fBlockwiseCopy, cImagesToRead,
+                            pDiskFrom != pDiskTo /* fWriter */);
+    if (RT_FAILURE(rc))
         return rc;
 
     do
     {
         size_t cbThisRead = RT_MIN(VD_MERGE_BUFFER_SIZE, cbRemaining);
+        PVDCOPYBUF pBuf = &Pipeline.aBufs[0];
+
+        if (Pipeline.hThreadWriter != NIL_RTTHREAD)
+        {
+            rc = vdCopyPipelineGetBuf(&Pipeline, idxBuf, &pBuf);
+            if (RT_FAILURE(rc))
+                break;
+        }
 
         /* Note that we don't attempt to synchronize cross-disk accesses.
          * It wouldn't be very difficult to do, just the lock order would
@@ -2089,7 +2881,7 @@ static int vdCopyHelper(PVDISK pDiskFrom, PVDIMAGE pImageFrom, PVDISK pDiskTo,
             RTSGBUF SgBuf;
             VDIOCTX IoCtx;
 
-            SegmentBuf.pvSeg = pvBuf;
+            SegmentBuf.pvSeg = pBuf->pvBuf;
             SegmentBuf.cbSeg = VD_MERGE_BUFFER_SIZE;
             RTSgBufInit(&SgBuf, &SegmentBuf, 1);
             vdIoCtxInit(&IoCtx, pDiskFrom, VDIOCTXTXDIR_READ, 0, 0, NULL,
@@ -2120,7 +2912,7 @@ static int vdCopyHelper(PVDISK pDiskFrom, PVDIMAGE pImageFrom, PVDISK pDiskTo,
             }
         }
         else
-            rc = vdReadHelper(pDiskFrom, pImageFrom, uOffset, pvBuf, cbThisRead,
+            rc = vdReadHelper(pDiskFrom, pImageFrom, uOffset, pBuf->pvBuf, cbThisRead,
                               false /* fUpdateCache */);
 
         if (RT_FAILURE(rc) && rc != VERR_VD_BLOCK_FREE)
@@ -2132,20 +2924,24 @@ static int vdCopyHelper(PVDISK pDiskFrom, PVDIMAGE pImageFrom, PVDISK pDiskTo,
 
         if (rc != VERR_VD_BLOCK_FREE)
         {
-            rc2 = vdThreadStartWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = true;
-
-            /* Only do collapsed I/O if we are copying the data blockwise. */
-            rc = vdWriteHelperEx(pDiskTo, pDiskTo->pLast, NULL, uOffset, pvBuf,
-                                 cbThisRead, VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG /* fFlags */,
-                                 fBlockwiseCopy ? cImagesToRead : 0);
-            if (RT_FAILURE(rc))
-                break;
-
-            rc2 = vdThreadFinishWrite(pDiskTo);
-            AssertRC(rc2);
-            fLockWriteTo = false;
+            cbCopied += cbThisRead;
+            if (Pipeline.hThreadWriter != NIL_RTTHREAD)
+            {
+                /* Hand the buffer to the writer and continue reading into the next one. */
+                pBuf->uOffset = uOffset;
+                pBuf->cbData  = cbThisRead;
+                ASMAtomicWriteBool(&pBuf->fFull, true);
+                RTSemEventSignal(Pipeline.hEvtFilled);
+                idxBuf = (idxBuf + 1) % RT_ELEMENTS(Pipeline.aBufs);
+                rc = VINF_SUCCESS;
+            }
+            else
+            {
+                rc = vdCopyWriteChunk(pDiskTo, uOffset, pBuf->pvBuf, cbThisRead,
+                                      fBlockwiseCopy, cImagesToRead);
+                if (RT_FAILURE(rc))
+                    break;
+            }
         }
         else /* Don't propagate the error to the outside */
             rc = VINF_SUCCESS;
@@ -2175,18 +2971,23 @@ static int vdCopyHelper(PVDISK pDiskFrom, PVDIMAGE pImageFrom, PVDISK pDiskTo,
         }
     } while (uOffset < cbSize);
 
-    RTMemFree(pvBuf);
-
     if (fLockReadFrom)
     {
         rc2 = vdThreadFinishRead(pDiskFrom);
         AssertRC(rc2);
     }
 
-    if (fLockWriteTo)
+    /* Wait for the outstanding writes. */
+    rc2 = vdCopyPipelineTerm(&Pipeline);
+    if (RT_SUCCESS(rc))
+        rc = rc2;
+
+    if (RT_SUCCESS(rc))
     {
-        rc2 = vdThreadFinishWrite(pDiskTo);
-        AssertRC(rc2);
+        uint64_t cMsElapsed = RT_MAX(RTTimeMilliTS() - tsStart, 1);
+        LogRel(("VD: Copied %llu MB of %llu MB in %llu ms (%llu MB/s), skipped %llu MB not allocated\n",
+                cbCopied / _1M, cbSize / _1M, cMsElapsed, cbCopied / _1M * RT_MS_1SEC / cMsElapsed,
+                (uOffset - cbCopied) / _1M));
     }
 
     LogFlowFunc(("returns rc=%Rrc\n", rc));
@@ -2645,6 +3446,15 @@ static DECLCALLBACK(int) vdWriteHelperAsync(PVDIOCTX pIoCtx)
         pIoCtx->fFlags |= VDIOCTX_FLAGS_WRITE_FILTER_APPLIED;
     }
 
+    /* Keep the cache consistent with the new disk content. */
+    if (   (pIoCtx->fFlags & (VDIOCTX_FLAGS_CACHE_WRITE | VDIOCTX_FLAGS_CACHE_WRITE_APPLIED)) == VDIOCTX_FLAGS_CACHE_WRITE
+        && pDisk->pCache
+        && !pIoCtx->pIoCtxParent)
+    {
+        vdCacheWriteStart(pDisk, pIoCtx);
+        pIoCtx->fFlags |= VDIOCTX_FLAGS_CACHE_WRITE_APPLIED;
+    }
+
     if (!(pIoCtx->fFlags & VDIOCTX_FLAGS_DONT_SET_MODIFIED_FLAG))
     {
         rc = vdSetModifiedFlagAsync(pDisk, pIoCtx);
@@ -2656,6 +3466,9 @@ static DECLCALLBACK(int) vdWriteHelperAsync(PVDIOCTX pIoCtx)
     if (RT_FAILURE(rc))
         return rc;
 
+    /* The written range may now be owned by a different image. */
+    vdAllocIdxInvalidate(pDisk, uOffset, cbWrite);
+
     /* Loop until all written. */
     do
     {
@@ -3107,6 +3920,16 @@ static DECLCALLBACK(int) vdDiscardHelperAsync(PVDIOCTX pIoCtx)
             LogFlowFunc(("New range descriptor loaded (%u) offStart=%llu cbDiscard=%zu\n",
                          pIoCtx->Req.Discard.idxRange, offStart, cbDiscardLeft));
             pIoCtx->Req.Discard.idxRange++;
+
+            /* The discarded range reads back as zeros or garbage, nothing to keep in the cache. */
+            if (pDisk->pCache)
+            {
+                ASMAtomicIncU32(&pDisk->pCache->uWriteGen);
+                vdCacheInvalidate(pDisk, offStart, cbDiscardLeft);
+            }
+
+            /* Blocks of the last image may be freed, reads have to go down the chain again. */
+            vdAllocIdxInvalidate(pDisk, offStart, cbDiscardLeft);
         }
 
         /* Look for a matching block in the AVL tree first. */
@@ -5328,6 +6151,9 @@ VBOXDDU_DECL(int) VDCreate(PVDINTERFACE pVDIfsDisk, VDTYPE enmType, PVDISK *ppDi
             pDisk->hMemCacheIoTask         = NIL_RTMEMCACHE;
             RTListInit(&pDisk->ListFilterChainWrite);
             RTListInit(&pDisk->ListFilterChainRead);
+            RTListInit(&pDisk->AllocIdx.ListLru);
+            pDisk->AllocIdx.cRangesMax     = VD_ALLOC_INDEX_RANGES_DEF;
+            pDisk->AllocIdx.pStats         = &pDisk->AllocIdx.StatsInt;
 
             /* Create the I/O ctx cache */
             rc = RTMemCacheCreate(&pDisk->hMemCacheIoCtx, sizeof(VDIOCTX), 0, UINT32_MAX,
@@ -5988,6 +6814,7 @@ VBOXDDU_DECL(int) VDCacheOpen(PVDISK pDisk, const char *pszBackend,
         AssertRC(rc);
 
         pCache->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
+        vdCacheInitConfig(pCache);
         rc = pCache->Backend->pfnOpen(pCache->pszFilename,
                                       uOpenFlags & ~VD_OPEN_FLAGS_HONOR_SAME,
                                       pDisk->pVDIfsDisk,
@@ -6886,6 +7713,7 @@ VBOXDDU_DECL(int) VDCreateCache(PVDISK pDisk, const char *pszBackend,
         }
 
         pCache->uOpenFlags = uOpenFlags & VD_OPEN_FLAGS_HONOR_SAME;
+        vdCacheInitConfig(pCache);
         pCache->VDIo.fIgnoreFlush = (uOpenFlags & VD_OPEN_FLAGS_IGNORE_FLUSH) != 0;
         rc = pCache->Backend->pfnCreate(pCache->pszFilename, cbSize,
                                         uImageFlags,
@@ -7055,6 +7883,7 @@ VBOXDDU_DECL(int) VDMerge(PVDISK pDisk, unsigned nImageFrom,
             /* Merge parent state into child. This means writing all not
              * allocated blocks in the destination image which are allocated in
              * the images to be merged. */
+            unsigned uProgressOld = 0;
             uint64_t uOffset = 0;
             uint64_t cbRemaining = cbSize;
 
@@ -7129,15 +7958,19 @@ VBOXDDU_DECL(int) VDMerge(PVDISK pDisk, unsigned nImageFrom,
                 uOffset += cbThisRead;
                 cbRemaining -= cbThisRead;
 
-                if (pIfProgress && pIfProgress->pfnProgress)
+                /* Only report changes, holes make the offset advance in small steps. */
+                unsigned uProgressNew = uOffset * 99 / cbSize;
+                if (uProgressNew != uProgressOld)
                 {
-                    /** @todo r=klaus: this can update the progress to the same
-                     * percentage over and over again if the image format makes
-                     * relatively small increments. */
-                    rc = pIfProgress->pfnProgress(pIfProgress->Core.pvUser,
-                                                  uOffset * 99 / cbSize);
-                    if (RT_FAILURE(rc))
-                        break;
+                    uProgressOld = uProgressNew;
+
+                    if (pIfProgress && pIfProgress->pfnProgress)
+                    {
+                        rc = pIfProgress->pfnProgress(pIfProgress->Core.pvUser,
+                                                      uProgressOld);
+                        if (RT_FAILURE(rc))
+                            break;
+                    }
                 }
             } while (uOffset < cbSize);
         }
@@ -7892,6 +8725,8 @@ VBOXDDU_DECL(int) VDCompact(PVDISK pDisk, unsigned nImage,
                                          pDisk->pVDIfsDisk,
                                          pImage->pVDIfsImage,
                                          pVDIfsOperation);
+        /* Blocks may have been freed or moved. */
+        vdAllocIdxReset(pDisk);
     } while (0);
 
     if (RT_UNLIKELY(fLockWrite))
@@ -8030,6 +8865,7 @@ VBOXDDU_DECL(int) VDResize(PVDISK pDisk, uint64_t cbSize,
         /* Mark the image size as uninitialized so it gets recalculated the next time. */
         if (RT_SUCCESS(rc))
             pImage->cbImage = VD_IMAGE_SIZE_UNINITIALIZED;
+        vdAllocIdxReset(pDisk);
     } while (0);
 
     if (RT_UNLIKELY(fLockWrite))
@@ -8407,6 +9243,86 @@ VBOXDDU_DECL(int) VDCacheClose(PVDISK pDisk, bool fDelete)
     return rc;
 }
 
+VBOXDDU_DECL(int) VDCacheSetConfig(PVDISK pDisk, PCVDCACHECFG pCfg)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    bool fLockWrite = false;
+
+    LogFlowFunc(("pDisk=%#p pCfg=%#p\n", pDisk, pCfg));
+
+    do
+    {
+        /* sanity check */
+        AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
+        AssertMsg(pDisk->u32Signature == VDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+
+        /* Check arguments. */
+        AssertPtrBreakStmt(pCfg, rc = VERR_INVALID_POINTER);
+        AssertMsgBreakStmt(   pCfg->enmMode == VDCACHEMODE_WRITE_AROUND
+                           || pCfg->enmMode == VDCACHEMODE_WRITE_THROUGH,
+                           ("enmMode=%d\n", pCfg->enmMode),
+                           rc = VERR_INVALID_PARAMETER);
+        AssertPtrNullBreakStmt(pCfg->pStats, rc = VERR_INVALID_POINTER);
+
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+        fLockWrite = true;
+
+        PVDCACHE pCache = pDisk->pCache;
+        AssertPtrBreakStmt(pCache, rc = VERR_VD_NOT_OPENED);
+
+        pCache->Cfg    = *pCfg;
+        pCache->pStats = pCfg->pStats ? pCfg->pStats : &pCache->StatsInt;
+        RT_ZERO(pCache->aAdmitGhosts);
+    } while (0);
+
+    if (RT_LIKELY(fLockWrite))
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
+VBOXDDU_DECL(int) VDAllocIndexSetConfig(PVDISK pDisk, uint32_t cRangesMax, PVDALLOCINDEXSTATS pStats)
+{
+    int rc = VINF_SUCCESS;
+    int rc2;
+    bool fLockWrite = false;
+
+    LogFlowFunc(("pDisk=%#p cRangesMax=%u pStats=%#p\n", pDisk, cRangesMax, pStats));
+
+    do
+    {
+        /* sanity check */
+        AssertPtrBreakStmt(pDisk, rc = VERR_INVALID_PARAMETER);
+        AssertMsg(pDisk->u32Signature == VDISK_SIGNATURE, ("u32Signature=%08x\n", pDisk->u32Signature));
+
+        /* Check arguments. */
+        AssertPtrNullBreakStmt(pStats, rc = VERR_INVALID_POINTER);
+
+        rc2 = vdThreadStartWrite(pDisk);
+        AssertRC(rc2);
+        fLockWrite = true;
+
+        vdAllocIdxReset(pDisk);
+        pDisk->AllocIdx.cRangesMax = cRangesMax;
+        pDisk->AllocIdx.pStats     = pStats ? pStats : &pDisk->AllocIdx.StatsInt;
+    } while (0);
+
+    if (RT_LIKELY(fLockWrite))
+    {
+        rc2 = vdThreadFinishWrite(pDisk);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc(("returns %Rrc\n", rc));
+    return rc;
+}
+
 VBOXDDU_DECL(int) VDFilterRemove(PVDISK pDisk, uint32_t fFlags)
 {
     int rc = VINF_SUCCESS;
@@ -8689,7 +9605,7 @@ VBOXDDU_DECL(int) VDWrite(PVDISK pDisk, uint64_t uOffset, const void *pvBuf,
 
         vdSetModifiedFlag(pDisk);
         rc = vdWriteHelper(pDisk, pImage, uOffset, pvBuf, cbWrite,
-                           VDIOCTX_FLAGS_READ_UPDATE_CACHE);
+                           VDIOCTX_FLAGS_READ_UPDATE_CACHE | VDIOCTX_FLAGS_CACHE_WRITE);
         if (RT_FAILURE(rc))
             break;
 
@@ -10263,7 +11179,7 @@ VBOXDDU_DECL(int) VDAsyncRead(PVDISK pDisk, uint64_t uOffset, size_t cbRead,
                                   cbRead, pDisk->pLast, pcSgBuf,
                                   pfnComplete, pvUser1, pvUser2,
                                   NULL, vdReadHelperAsync,
-                                  VDIOCTX_FLAGS_ZERO_FREE_BLOCKS);
+                                  VDIOCTX_FLAGS_ZERO_FREE_BLOCKS | VDIOCTX_FLAGS_READ_UPDATE_CACHE);
         if (!pIoCtx)
         {
             rc = VERR_NO_MEMORY;
@@ -10334,7 +11250,7 @@ VBOXDDU_DECL(int) VDAsyncWrite(PVDISK pDisk, uint64_t uOffset, size_t cbWrite,
                                   cbWrite, pDisk->pLast, pcSgBuf,
                                   pfnComplete, pvUser1, pvUser2,
                                   NULL, vdWriteHelperAsync,
-                                  VDIOCTX_FLAGS_DEFAULT);
+                                  VDIOCTX_FLAGS_CACHE_WRITE);
         if (!pIoCtx)
         {
             rc = VERR_NO_MEMORY;
@@ -100,6 +100,11 @@ typedef struct VDIMAGE
 /** The special uninitialized size value for he image. */
 #define VD_IMAGE_SIZE_UNINITIALIZED UINT64_C(0)
 
+/** Number of entries in the cache admission table. */
+#define VD_CACHE_ADMIT_GHOSTS       1024
+/** Size of a chunk tracked by the cache admission policy. */
+#define VD_CACHE_ADMIT_CHUNK_SHIFT  16
+
 /**
  * Virtual disk cache image descriptor.
  */
@@ -122,6 +127,29 @@ typedef struct VDCACHE
     PVDINTERFACE        pVDIfsCache;
     /** I/O related things. */
     VDIO                VDIo;
+
+    /** How the cache is used. */
+    VDCACHECFG          Cfg;
+    /** Statistics, points either to the user supplied structure or to StatsInt. */
+    PVDCACHESTATS       pStats;
+    /** Internal statistics used if the user didn't provide any. */
+    VDCACHESTATS        StatsInt;
+    /** Incremented whenever a write to the disk starts, a read which completes
+     * after a write started can't be used to fill the cache. */
+    volatile uint32_t   uWriteGen;
+    /** Number of writes to the disk in flight. */
+    volatile uint32_t   cWritesActive;
+    /** Flag whether the cache was disabled after it couldn't be kept
+     * consistent with the disk. */
+    bool                fDisabled;
+    /** Miss counters for the admission policy, indexed by a hash of the chunk. */
+    struct
+    {
+        /** The chunk number + 1, 0 if unused. */
+        uint64_t        uChunk;
+        /** Number of misses seen for the chunk. */
+        uint32_t        cMisses;
+    }                   aAdmitGhosts[VD_CACHE_ADMIT_GHOSTS];
 } VDCACHE, *PVDCACHE;
 
 /**
@@ -156,6 +184,50 @@ typedef struct VDDISCARDSTATE
     RTLISTNODE          ListLru;
 } VDDISCARDSTATE, *PVDDISCARDSTATE;
 
+/** Default maximum number of ranges in the allocation index. */
+#define VD_ALLOC_INDEX_RANGES_DEF   _16K
+
+/**
+ * A range of the disk with a known owner in the image chain.
+ */
+typedef struct VDALLOCRANGE
+{
+    /** AVL core, the range is the key. */
+    AVLRU64NODECORE    Core;
+    /** LRU list node. */
+    RTLISTNODE         NodeLru;
+    /** The first image from the top of the chain with data for the range,
+     * NULL if no image has data. */
+    PVDIMAGE           pImage;
+    /** Number of images above pImage which don't have data for the range. */
+    unsigned           cImagesSkipped;
+} VDALLOCRANGE, *PVDALLOCRANGE;
+
+/**
+ * Chain wide allocation index.
+ *
+ * Remembers the result of previous chain walks so reads can start at the image
+ * holding the data. An entry only guarantees that the images above the owner have
+ * nothing allocated for the range, so a stale entry makes a read continue down the
+ * chain but never return wrong data. Writes drop the affected ranges, any change of
+ * the chain drops the whole index.
+ */
+typedef struct VDALLOCINDEX
+{
+    /** AVL tree of known ranges. */
+    AVLRU64TREE         TreeRanges;
+    /** LRU list of ranges, the least recently used is evicted when full. */
+    RTLISTANCHOR        ListLru;
+    /** Number of ranges in the index. */
+    uint32_t            cRanges;
+    /** Maximum number of ranges, 0 if the index is disabled. */
+    uint32_t            cRangesMax;
+    /** Statistics, points either to the user supplied structure or to StatsInt. */
+    PVDALLOCINDEXSTATS  pStats;
+    /** Internal statistics used if the user didn't provide any. */
+    VDALLOCINDEXSTATS   StatsInt;
+} VDALLOCINDEX, *PVDALLOCINDEX;
+
 /**
  * VD filter instance.
  */
@@ -254,6 +326,8 @@ struct VDISK
     PVDCACHE               pCache;
     /** Pointer to the discard state if any. */
     PVDDISCARDSTATE        pDiscard;
+    /** Allocation index of the image chain. */
+    VDALLOCINDEX           AllocIdx;
 
     /** Read filter chain - PVDFILTER. */
     RTLISTANCHOR           ListFilterChainRead;
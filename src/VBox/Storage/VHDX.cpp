@@ -262,6 +262,13 @@ typedef VhdxLogDataSector *PVhdxLogDataSector;
 /** Signature of a VHDX log data sector ("data"). */
 #define VHDX_LOG_DATA_SECTOR_SIGNATURE UINT32_C(0x61746164)
 
+/** Size of a log sector, also the granularity of metadata updates. */
+#define VHDX_LOG_SECTOR_SIZE           _4K
+/** Maximum size of a log entry written by this backend, the log is split into slots of this size. */
+#define VHDX_LOG_ENTRY_SIZE_MAX        _256K
+/** Maximum number of data sectors in a log entry written by this backend (one sector is the header). */
+#define VHDX_LOG_ENTRY_DATA_SECTORS_MAX (VHDX_LOG_ENTRY_SIZE_MAX / VHDX_LOG_SECTOR_SIZE - 1)
+
 /**
  * VHDX BAT entry.
  */
@@ -280,6 +287,10 @@ typedef VhdxBatEntry *PVhdxBatEntry;
 #define VHDX_BAT_ENTRY_GET_FILE_OFFSET_MB(bat) (((bat) & UINT64_C(0xfffffffffff00000)) >> 20)
 /** Get a byte offset from the BAT entry. */
 #define VHDX_BAT_ENTRY_GET_FILE_OFFSET(bat) (VHDX_BAT_ENTRY_GET_FILE_OFFSET_MB(bat) * (uint64_t)_1M)
+/** Create a BAT entry from the given byte offset (must be 1MB aligned) and state. */
+#define VHDX_BAT_ENTRY_MAKE(off, state) (((off) & UINT64_C(0xfffffffffff00000)) | (state))
+/** Number of BAT entries in a metadata sector. */
+#define VHDX_BAT_ENTRIES_PER_SECTOR (VHDX_LOG_SECTOR_SIZE / sizeof(VhdxBatEntry))
 
 /** Block not present and the data is undefined. */
 #define VHDX_BAT_ENTRY_PAYLOAD_BLOCK_NOT_PRESENT       (0)
@@ -300,6 +311,11 @@ typedef VhdxBatEntry *PVhdxBatEntry;
 /** The sector bitmap block is defined at the file location. */
 #define VHDX_BAT_ENTRY_SB_BLOCK_PRESENT                (6)
 
+/** Size of a sector bitmap block. */
+#define VHDX_SB_BLOCK_SIZE                             _1M
+/** Number of metadata sectors in a sector bitmap block. */
+#define VHDX_SB_BLOCK_SECTORS                          (VHDX_SB_BLOCK_SIZE / VHDX_LOG_SECTOR_SIZE)
+
 /**
  * VHDX Metadata tabl header.
  */
@@ -510,6 +526,29 @@ typedef struct VHDXMETADATAITEMPROPS
     VHDXMETADATAITEM     enmMetadataItem;
 } VHDXMETADATAITEMPROPS;
 
+/**
+ * State of the metadata commit.
+ */
+typedef enum VHDXCOMMITSTATE
+{
+    /** Invalid state. */
+    VHDXCOMMITSTATE_INVALID = 0,
+    /** No commit in progress. */
+    VHDXCOMMITSTATE_IDLE,
+    /** Flushing the user data written so far before metadata referencing it is logged. */
+    VHDXCOMMITSTATE_FLUSH_DATA,
+    /** Writing the next log entry. */
+    VHDXCOMMITSTATE_WRITE_LOG,
+    /** Flushing the log entry. */
+    VHDXCOMMITSTATE_FLUSH_LOG,
+    /** Writing the logged metadata sectors to their final location. */
+    VHDXCOMMITSTATE_WRITE_META,
+    /** Flushing the metadata sectors. */
+    VHDXCOMMITSTATE_FLUSH_META,
+    /** 32bit hack. */
+    VHDXCOMMITSTATE_32BIT_HACK = 0x7fffffff
+} VHDXCOMMITSTATE;
+
 /**
  * VHDX image data structure.
  */
@@ -546,14 +585,88 @@ typedef struct VHDXIMAGE
     /** Logical geometry of this image. */
     VDGEOMETRY          LCHSGeometry;
 
+    /** The current header in host endianess. */
+    VhdxHeader          HdrCur;
+    /** Offset of the current header in the file. */
+    uint64_t            offHdrCur;
+
     /** The BAT. */
     PVhdxBatEntry       paBat;
+    /** Number of entries in the BAT. */
+    uint32_t            cBatEntries;
+    /** Start offset of the BAT region. */
+    uint64_t            offBat;
     /** Chunk ratio. */
     uint32_t            uChunkRatio;
+    /** Number of chunks (sector bitmap blocks) covering the virtual disk. */
+    uint32_t            cChunks;
+    /** Sector bitmap blocks indexed by chunk, NULL if the block is not present
+     * (differencing images only). */
+    uint8_t           **papbSectorBitmap;
+
+    /** Flag whether the log was activated in the header for writing. */
+    bool                fLogActive;
+    /** Size of the file in bytes. */
+    uint64_t            cbFile;
+    /** Offset where the next block is allocated. */
+    uint64_t            offEof;
+    /** Start offset of the log region. */
+    uint64_t            offLog;
+    /** Size of the log region. */
+    uint32_t            cbLog;
+    /** Number of log entry slots in the log region. */
+    uint32_t            cLogSlots;
+    /** Slot of the next log entry. */
+    uint32_t            idxLogSlotNext;
+    /** Sequence number of the next log entry. */
+    uint64_t            uLogSeqNext;
+
+    /** Number of metadata sectors tracked, the BAT sectors come first followed by
+     * the sector bitmap sectors of all chunks for differencing images. */
+    uint32_t            cMetaSectors;
+    /** Number of BAT sectors. */
+    uint32_t            cBatSectors;
+    /** Bitmap of dirty metadata sectors. */
+    uint32_t           *pbmMetaDirty;
+    /** Number of dirty metadata sectors. */
+    uint32_t            cMetaDirty;
+
+    /** State of the metadata commit. */
+    VHDXCOMMITSTATE     enmCommitState;
+    /** Number of outstanding requests of the current commit step. */
+    uint32_t            cCommitReqsPending;
+    /** Status code of the current commit. */
+    int                 rcCommit;
+    /** Number of metadata sectors in the current log entry. */
+    uint32_t            cCommit;
+    /** Metadata sector indexes in the current log entry. */
+    uint32_t            aidxCommit[VHDX_LOG_ENTRY_DATA_SECTORS_MAX];
+    /** File offsets of the metadata sectors in the current log entry. */
+    uint64_t            aoffCommit[VHDX_LOG_ENTRY_DATA_SECTORS_MAX];
+    /** Content of the metadata sectors in the current log entry (file endianess). */
+    uint8_t            *pbCommit;
+    /** The current log entry. */
+    uint8_t            *pbLogEntry;
+    /** Size of the current log entry. */
+    uint32_t            cbLogEntry;
+    /** File offset of the current log entry. */
+    uint64_t            offLogEntry;
+
     /** The static region list. */
     VDREGIONLIST        RegionList;
 } VHDXIMAGE, *PVHDXIMAGE;
 
+/**
+ * Block allocation state passed to the completion callback.
+ */
+typedef struct VHDXBLOCKALLOC
+{
+    /** BAT index of the allocated block. */
+    uint32_t            idxBat;
+    /** File offset of the new block. */
+    uint64_t            offBlock;
+} VHDXBLOCKALLOC, *PVHDXBLOCKALLOC;
+
 /**
  * Endianess conversion direction.
  */
@@ -709,8 +822,6 @@ DECLINLINE(void) vhdxConvRegionTblEntryEndianess(VHDXECONV enmConv, PVhdxRegionT
     pRegTblEntConv->u32Flags      = SET_ENDIAN_U32(pRegTblEnt->u32Flags);
 }
 
-#if 0 /* unused */
-
 /**
  * Converts a VHDX log entry header between file and host endianness.
  *
@@ -733,6 +844,7 @@ DECLINLINE(void) vhdxConvLogEntryHdrEndianess(VHDXECONV enmConv, PVhdxLogEntryHd
     pLogEntryHdrConv->u32Reserved          = SET_ENDIAN_U32(pLogEntryHdr->u32Reserved);
     vhdxConvUuidEndianess(enmConv, &pLogEntryHdrConv->UuidLog, &pLogEntryHdr->UuidLog);
     pLogEntryHdrConv->u64FlushedFileOffset = SET_ENDIAN_U64(pLogEntryHdr->u64FlushedFileOffset);
+    pLogEntryHdrConv->u64LastFileOffset    = SET_ENDIAN_U64(pLogEntryHdr->u64LastFileOffset);
 }
 
 /**
@@ -795,8 +907,6 @@ DECLINLINE(void) vhdxConvLogDataSectorEndianess(VHDXECONV enmConv, PVhdxLogDataS
     pLogDataSectorConv->u32SequenceLow   = SET_ENDIAN_U32(pLogDataSector->u32SequenceLow);
 }
 
-#endif /* unused */
-
 /**
  * Converts a BAT between file and host endianess.
  *
@@ -941,6 +1051,7 @@ DECLINLINE(void) vhdxConvVDiskPhysSectSizeEndianess(VHDXECONV enmConv, PVhdxVDis
     pVDiskPhysSectSizeConv->u64PhysicalSectorSize = SET_ENDIAN_U64(pVDiskPhysSectSize->u64PhysicalSectorSize);
 }
 
+#endif /* unused */
 
 /**
  * Converts a VHDX parent locator header item between file and host endianness.
@@ -960,6 +1071,7 @@ DECLINLINE(void) vhdxConvParentLocatorHeaderEndianness(VHDXECONV enmConv, PVhdxP
     pParentLocatorHdrConv->u16KeyValueCount = SET_ENDIAN_U16(pParentLocatorHdr->u16KeyValueCount);
 }
 
+#if 0 /* unused */
 
 /**
  * Converts a VHDX parent locator entry between file and host endianness.
@@ -982,6 +1094,694 @@ DECLINLINE(void) vhdxConvParentLocatorEntryEndianess(VHDXECONV enmConv, PVhdxPar
 
 #endif /* unused */
 
+/**
+ * Writes a new version of the current header to the non current header location
+ * making it the current one.
+ *
+ * @returns VBox status code.
+ * @param   pImage      Image instance data.
+ * @param   fLogActive  Flag whether the image is about to be modified and a new log
+ *                      GUID should be used or the log should be marked as empty.
+ */
+static int vhdxHeaderUpdate(PVHDXIMAGE pImage, bool fLogActive)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p fLogActive=%RTbool\n", pImage, fLogActive));
+
+    PVhdxHeader pHdr = (PVhdxHeader)RTMemTmpAllocZ(sizeof(VhdxHeader));
+    if (pHdr)
+    {
+        uint64_t offHdr =   pImage->offHdrCur == VHDX_HEADER1_OFFSET
+                          ? VHDX_HEADER2_OFFSET
+                          : VHDX_HEADER1_OFFSET;
+
+        memcpy(pHdr, &pImage->HdrCur, sizeof(VhdxHeader));
+        pHdr->u64SequenceNumber++;
+        pHdr->u32Checksum = 0;
+        if (fLogActive)
+        {
+            /* Any log entries from earlier sessions become invalid with the new log GUID. */
+            RTUuidCreate(&pHdr->UuidFileWrite);
+            RTUuidCreate(&pHdr->UuidDataWrite);
+            RTUuidCreate(&pHdr->UuidLog);
+        }
+        else
+            RTUuidClear(&pHdr->UuidLog);
+
+        VhdxHeader HdrNew = *pHdr;
+        vhdxConvHeaderEndianess(VHDXECONV_H2F, pHdr, pHdr);
+        pHdr->u32Checksum = RT_H2LE_U32(RTCrc32C(pHdr, sizeof(VhdxHeader)));
+
+        rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, offHdr,
+                                    pHdr, sizeof(VhdxHeader));
+        if (RT_SUCCESS(rc))
+            rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+        if (RT_SUCCESS(rc))
+        {
+            pImage->HdrCur    = HdrNew;
+            pImage->offHdrCur = offHdr;
+        }
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Updating the header of image \'%s\' failed",
+                           pImage->pszFilename);
+
+        RTMemTmpFree(pHdr);
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Validates the log entry at the given log offset and optionally applies the
+ * updates it describes to the image.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_GEN_INVALID_HEADER if the entry is not valid.
+ * @param   pImage    Image instance data.
+ * @param   pbLog     The complete log region.
+ * @param   cbLog     Size of the log region.
+ * @param   offEntry  Offset of the entry inside the log.
+ * @param   pHdr      Where to store the entry header in host endianess.
+ * @param   pbBuf     Sector sized scratch buffer to apply the entry with,
+ *                    NULL to only validate the entry.
+ */
+static int vhdxLogEntryProcess(PVHDXIMAGE pImage, const uint8_t *pbLog, uint32_t cbLog,
+                               uint32_t offEntry, PVhdxLogEntryHdr pHdr, uint8_t *pbBuf)
+{
+    memcpy(pHdr, pbLog + offEntry, sizeof(*pHdr));
+    vhdxConvLogEntryHdrEndianess(VHDXECONV_F2H, pHdr, pHdr);
+
+    if (   pHdr->u32Signature != VHDX_LOG_ENTRY_HEADER_SIGNATURE
+        || !pHdr->u32EntryLength
+        || pHdr->u32EntryLength % VHDX_LOG_SECTOR_SIZE
+        || pHdr->u32EntryLength > cbLog
+        || pHdr->u32Tail % VHDX_LOG_SECTOR_SIZE
+        || pHdr->u32Tail >= cbLog
+        || !pHdr->u64SequenceNumber
+        || pHdr->u32DescriptorCount > cbLog / sizeof(VhdxLogDataDesc)
+        || RTUuidCompare(&pHdr->UuidLog, &pImage->HdrCur.UuidLog))
+        return VERR_VD_GEN_INVALID_HEADER;
+
+    /* Descriptors never cross a sector boundary because they evenly divide the sector size. */
+    uint32_t cSectors = pHdr->u32EntryLength / VHDX_LOG_SECTOR_SIZE;
+    uint32_t cDescSectors = (uint32_t)(  (  sizeof(VhdxLogEntryHdr)
+                                          + (uint64_t)pHdr->u32DescriptorCount * sizeof(VhdxLogDataDesc)
+                                          + VHDX_LOG_SECTOR_SIZE - 1)
+                                       / VHDX_LOG_SECTOR_SIZE);
+    if (cDescSectors > cSectors)
+        return VERR_VD_GEN_INVALID_HEADER;
+
+    /* The checksum covers the whole entry (which may wrap around) with the checksum field zeroed. */
+    uint32_t u32Zero = 0;
+    uint32_t u32ChkSum = RTCrc32CStart();
+    u32ChkSum = RTCrc32CProcess(u32ChkSum, pbLog + offEntry, RT_UOFFSETOF(VhdxLogEntryHdr, u32Checksum));
+    u32ChkSum = RTCrc32CProcess(u32ChkSum, &u32Zero, sizeof(u32Zero));
+    u32ChkSum = RTCrc32CProcess(u32ChkSum, pbLog + offEntry + RT_UOFFSET_AFTER(VhdxLogEntryHdr, u32Checksum),
+                                VHDX_LOG_SECTOR_SIZE - RT_UOFFSET_AFTER(VhdxLogEntryHdr, u32Checksum));
+    for (uint32_t i = 1; i < cSectors; i++)
+        u32ChkSum = RTCrc32CProcess(u32ChkSum, pbLog + (offEntry + (uint64_t)i * VHDX_LOG_SECTOR_SIZE) % cbLog,
+                                    VHDX_LOG_SECTOR_SIZE);
+    if (RTCrc32CFinish(u32ChkSum) != pHdr->u32Checksum)
+        return VERR_VD_GEN_INVALID_HEADER;
+
+    int rc = VINF_SUCCESS;
+    uint32_t cDataSectors = 0;
+    for (uint32_t i = 0; i < pHdr->u32DescriptorCount && RT_SUCCESS(rc); i++)
+    {
+        uint64_t offDesc = sizeof(VhdxLogEntryHdr) + (uint64_t)i * sizeof(VhdxLogDataDesc);
+        const uint8_t *pbDesc = pbLog + (offEntry + offDesc) % cbLog;
+        uint32_t u32Signature = RT_LE2H_U32(*(const uint32_t *)pbDesc);
+
+        if (u32Signature == VHDX_LOG_ZERO_DESC_SIGNATURE)
+        {
+            VhdxLogZeroDesc ZeroDesc;
+            memcpy(&ZeroDesc, pbDesc, sizeof(ZeroDesc));
+            vhdxConvLogZeroDescEndianess(VHDXECONV_F2H, &ZeroDesc, &ZeroDesc);
+
+            if (   ZeroDesc.u64SequenceNumber != pHdr->u64SequenceNumber
+                || ZeroDesc.u64ZeroLength % VHDX_LOG_SECTOR_SIZE
+                || ZeroDesc.u64FileOffset % VHDX_LOG_SECTOR_SIZE)
+                rc = VERR_VD_GEN_INVALID_HEADER;
+            else if (pbBuf)
+            {
+                memset(pbBuf, 0, VHDX_LOG_SECTOR_SIZE);
+                for (uint64_t off = 0; off < ZeroDesc.u64ZeroLength && RT_SUCCESS(rc); off += VHDX_LOG_SECTOR_SIZE)
+                    rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, ZeroDesc.u64FileOffset + off,
+                                                pbBuf, VHDX_LOG_SECTOR_SIZE);
+            }
+        }
+        else if (u32Signature == VHDX_LOG_DATA_DESC_SIGNATURE)
+        {
+            const VhdxLogDataDesc *pDataDescRaw = (const VhdxLogDataDesc *)pbDesc;
+            VhdxLogDataDesc DataDesc;
+            memcpy(&DataDesc, pbDesc, sizeof(DataDesc));
+            vhdxConvLogDataDescEndianess(VHDXECONV_F2H, &DataDesc, &DataDesc);
+
+            uint32_t idxSector = cDescSectors + cDataSectors++;
+            if (   DataDesc.u64SequenceNumber != pHdr->u64SequenceNumber
+                || DataDesc.u64FileOffset % VHDX_LOG_SECTOR_SIZE
+                || idxSector >= cSectors)
+                rc = VERR_VD_GEN_INVALID_HEADER;
+            else
+            {
+                const VhdxLogDataSector *pDataSector
+                    = (const VhdxLogDataSector *)(pbLog + (offEntry + (uint64_t)idxSector * VHDX_LOG_SECTOR_SIZE) % cbLog);
+
+                if (   RT_LE2H_U32(pDataSector->u32DataSignature) != VHDX_LOG_DATA_SECTOR_SIGNATURE
+                    || RT_LE2H_U32(pDataSector->u32SequenceHigh) != (uint32_t)(pHdr->u64SequenceNumber >> 32)
+                    || RT_LE2H_U32(pDataSector->u32SequenceLow) != (uint32_t)pHdr->u64SequenceNumber)
+                    rc = VERR_VD_GEN_INVALID_HEADER;
+                else if (pbBuf)
+                {
+                    /* Reassemble the sector, the leading and trailing bytes are stored raw in the descriptor. */
+                    memcpy(pbBuf, &pDataDescRaw->u64LeadingBytes, sizeof(uint64_t));
+                    memcpy(pbBuf + sizeof(uint64_t), &pDataSector->u8Data[0], sizeof(pDataSector->u8Data));
+                    memcpy(pbBuf + VHDX_LOG_SECTOR_SIZE - sizeof(uint32_t), &pDataDescRaw->u32TrailingBytes, sizeof(uint32_t));
+                    rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pImage->pStorage, DataDesc.u64FileOffset,
+                                                pbBuf, VHDX_LOG_SECTOR_SIZE);
+                }
+            }
+        }
+        else
+            rc = VERR_VD_GEN_INVALID_HEADER;
+    }
+
+    if (   RT_SUCCESS(rc)
+        && cDescSectors + cDataSectors != cSectors)
+        rc = VERR_VD_GEN_INVALID_HEADER;
+
+    return rc;
+}
+
+/**
+ * Walks the log sequence ending at the given head entry starting from the tail
+ * recorded in it, validating or applying all entries.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_GEN_INVALID_HEADER if the sequence is not complete.
+ * @param   pImage    Image instance data.
+ * @param   pbLog     The complete log region.
+ * @param   cbLog     Size of the log region.
+ * @param   offHead   Offset of the head entry inside the log.
+ * @param   pHdrHead  The header of the head entry in host endianess.
+ * @param   pbBuf     Sector sized scratch buffer to apply the entries with,
+ *                    NULL to only validate the sequence.
+ */
+static int vhdxLogSequenceProcess(PVHDXIMAGE pImage, const uint8_t *pbLog, uint32_t cbLog,
+                                  uint32_t offHead, PVhdxLogEntryHdr pHdrHead, uint8_t *pbBuf)
+{
+    uint32_t offEntry = pHdrHead->u32Tail;
+    uint64_t u64SeqPrev = 0;
+
+    for (uint32_t cEntries = 0; cEntries <= cbLog / VHDX_LOG_SECTOR_SIZE; cEntries++)
+    {
+        VhdxLogEntryHdr Hdr;
+        int rc = vhdxLogEntryProcess(pImage, pbLog, cbLog, offEntry, &Hdr, pbBuf);
+        if (RT_FAILURE(rc))
+            return rc;
+        if (   cEntries
+            && Hdr.u64SequenceNumber != u64SeqPrev + 1)
+            return VERR_VD_GEN_INVALID_HEADER;
+        u64SeqPrev = Hdr.u64SequenceNumber;
+
+        if (offEntry == offHead)
+            return   u64SeqPrev == pHdrHead->u64SequenceNumber
+                   ? VINF_SUCCESS
+                   : VERR_VD_GEN_INVALID_HEADER;
+
+        offEntry = (uint32_t)((offEntry + (uint64_t)Hdr.u32EntryLength) % cbLog);
+    }
+
+    return VERR_VD_GEN_INVALID_HEADER;
+}
+
+/**
+ * Replays the log of an image which was not closed properly.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int vhdxLogReplay(PVHDXIMAGE pImage)
+{
+    uint64_t offLog = pImage->HdrCur.u64LogOffset;
+    uint32_t cbLog  = pImage->HdrCur.u32LogLength;
+    uint8_t *pbLog = NULL;
+    uint8_t *pbBuf = NULL;
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p offLog=%llu cbLog=%u\n", pImage, offLog, cbLog));
+
+    if (   !cbLog
+        || cbLog % _1M
+        || offLog % _1M
+        || offLog < _1M)
+        return vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                         "VHDX: Image \'%s\' has an invalid log region",
+                         pImage->pszFilename);
+
+    pbLog = (uint8_t *)RTMemAlloc(cbLog);
+    pbBuf = (uint8_t *)RTMemTmpAlloc(VHDX_LOG_SECTOR_SIZE);
+    if (pbLog && pbBuf)
+    {
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offLog, pbLog, cbLog);
+        if (RT_SUCCESS(rc))
+        {
+            /*
+             * The head of the active sequence is the valid entry with the highest
+             * sequence number for which all entries from its tail are present.
+             */
+            VhdxLogEntryHdr HdrHead;
+            uint32_t offHead = 0;
+            bool fFound = false;
+
+            RT_ZERO(HdrHead);
+            for (uint32_t offEntry = 0; offEntry < cbLog; offEntry += VHDX_LOG_SECTOR_SIZE)
+            {
+                VhdxLogEntryHdr Hdr;
+                if (   RT_SUCCESS(vhdxLogEntryProcess(pImage, pbLog, cbLog, offEntry, &Hdr, NULL))
+                    && (   !fFound
+                        || Hdr.u64SequenceNumber > HdrHead.u64SequenceNumber)
+                    && RT_SUCCESS(vhdxLogSequenceProcess(pImage, pbLog, cbLog, offEntry, &Hdr, NULL)))
+                {
+                    HdrHead = Hdr;
+                    offHead = offEntry;
+                    fFound  = true;
+                }
+            }
+
+            if (fFound)
+            {
+                uint64_t cbFile = 0;
+
+                rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &cbFile);
+                if (   RT_SUCCESS(rc)
+                    && cbFile < HdrHead.u64FlushedFileOffset)
+                    rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                                   "VHDX: Image \'%s\' is truncated, the log can't be replayed",
+                                   pImage->pszFilename);
+                if (   RT_SUCCESS(rc)
+                    && cbFile < HdrHead.u64LastFileOffset)
+                    rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, HdrHead.u64LastFileOffset);
+                if (RT_SUCCESS(rc))
+                    rc = vhdxLogSequenceProcess(pImage, pbLog, cbLog, offHead, &HdrHead, pbBuf);
+                if (RT_SUCCESS(rc))
+                    rc = vdIfIoIntFileFlushSync(pImage->pIfIo, pImage->pStorage);
+                if (RT_SUCCESS(rc))
+                    LogRel(("VHDX: Replayed the log of image \'%s\' up to sequence number %llu\n",
+                            pImage->pszFilename, HdrHead.u64SequenceNumber));
+                else if (rc != VERR_VD_GEN_INVALID_HEADER)
+                    rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                                   "VHDX: Replaying the log of image \'%s\' failed",
+                                   pImage->pszFilename);
+            }
+        }
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Reading the log of image \'%s\' failed",
+                           pImage->pszFilename);
+    }
+    else
+        rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                       "VHDX: Out of memory allocating memory for the log of image \'%s\'",
+                       pImage->pszFilename);
+
+    if (pbLog)
+        RTMemFree(pbLog);
+    if (pbBuf)
+        RTMemTmpFree(pbBuf);
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
+/**
+ * Marks the given metadata sector as dirty.
+ *
+ * @returns nothing.
+ * @param   pImage      Image instance data.
+ * @param   idxSector   The metadata sector index.
+ */
+DECLINLINE(void) vhdxMetaSectorSetDirty(PVHDXIMAGE pImage, uint32_t idxSector)
+{
+    Assert(idxSector < pImage->cMetaSectors);
+    if (!ASMBitTestAndSet(pImage->pbmMetaDirty, (int32_t)idxSector))
+        pImage->cMetaDirty++;
+}
+
+/**
+ * Returns the file offset and current content of the given metadata sector.
+ *
+ * @returns File offset of the metadata sector.
+ * @param   pImage      Image instance data.
+ * @param   idxSector   The metadata sector index.
+ * @param   pbSector    Where to store the content of the sector in file endianess.
+ */
+static uint64_t vhdxMetaSectorGet(PVHDXIMAGE pImage, uint32_t idxSector, uint8_t *pbSector)
+{
+    if (idxSector < pImage->cBatSectors)
+    {
+        uint32_t idxBatFirst = idxSector * VHDX_BAT_ENTRIES_PER_SECTOR;
+        uint32_t cEntries = RT_MIN(VHDX_BAT_ENTRIES_PER_SECTOR, pImage->cBatEntries - idxBatFirst);
+
+        memset(pbSector, 0, VHDX_LOG_SECTOR_SIZE);
+        vhdxConvBatTableEndianess(VHDXECONV_H2F, (PVhdxBatEntry)pbSector, &pImage->paBat[idxBatFirst], cEntries);
+        return pImage->offBat + (uint64_t)idxSector * VHDX_LOG_SECTOR_SIZE;
+    }
+
+    /* Sector bitmap, the bitmaps are kept in file endianess already. */
+    uint32_t idxChunk = (idxSector - pImage->cBatSectors) / VHDX_SB_BLOCK_SECTORS;
+    uint32_t idxSbSector = (idxSector - pImage->cBatSectors) % VHDX_SB_BLOCK_SECTORS;
+    uint64_t uBatEntry = pImage->paBat[idxChunk * (pImage->uChunkRatio + 1) + pImage->uChunkRatio].u64BatEntry;
+
+    AssertPtr(pImage->papbSectorBitmap[idxChunk]);
+    memcpy(pbSector, pImage->papbSectorBitmap[idxChunk] + idxSbSector * VHDX_LOG_SECTOR_SIZE, VHDX_LOG_SECTOR_SIZE);
+    return VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + (uint64_t)idxSbSector * VHDX_LOG_SECTOR_SIZE;
+}
+
+/**
+ * Collects the next batch of dirty metadata sectors and builds the log entry for it.
+ *
+ * @returns nothing.
+ * @param   pImage      Image instance data.
+ */
+static void vhdxLogEntryBuild(PVHDXIMAGE pImage)
+{
+    uint32_t cBits = RT_ALIGN_32(pImage->cMetaSectors, 32);
+    int32_t idxSector = ASMBitFirstSet(pImage->pbmMetaDirty, cBits);
+
+    pImage->cCommit = 0;
+    while (   idxSector >= 0
+           && pImage->cCommit < VHDX_LOG_ENTRY_DATA_SECTORS_MAX)
+    {
+        uint32_t i = pImage->cCommit++;
+
+        ASMBitClear(pImage->pbmMetaDirty, idxSector);
+        pImage->cMetaDirty--;
+        pImage->aidxCommit[i] = (uint32_t)idxSector;
+        pImage->aoffCommit[i] = vhdxMetaSectorGet(pImage, (uint32_t)idxSector,
+                                                  pImage->pbCommit + i * VHDX_LOG_SECTOR_SIZE);
+        idxSector = ASMBitNextSet(pImage->pbmMetaDirty, cBits, (uint32_t)idxSector);
+    }
+
+    /*
+     * Every entry goes into its own slot and starts a new sequence (the tail points to
+     * the entry itself) because the previous entry was applied and flushed completely.
+     */
+    uint64_t u64Seq = pImage->uLogSeqNext++;
+    uint32_t offEntry = pImage->idxLogSlotNext * VHDX_LOG_ENTRY_SIZE_MAX;
+    uint8_t *pbEntry = pImage->pbLogEntry;
+    PVhdxLogEntryHdr pHdr = (PVhdxLogEntryHdr)pbEntry;
+
+    pImage->idxLogSlotNext = (pImage->idxLogSlotNext + 1) % pImage->cLogSlots;
+    pImage->cbLogEntry     = (1 + pImage->cCommit) * VHDX_LOG_SECTOR_SIZE;
+    pImage->offLogEntry    = pImage->offLog + offEntry;
+
+    memset(pbEntry, 0, VHDX_LOG_SECTOR_SIZE);
+    pHdr->u32Signature         = VHDX_LOG_ENTRY_HEADER_SIGNATURE;
+    pHdr->u32EntryLength       = pImage->cbLogEntry;
+    pHdr->u32Tail              = offEntry;
+    pHdr->u64SequenceNumber    = u64Seq;
+    pHdr->u32DescriptorCount   = pImage->cCommit;
+    pHdr->UuidLog              = pImage->HdrCur.UuidLog;
+    pHdr->u64FlushedFileOffset = pImage->cbFile;
+    pHdr->u64LastFileOffset    = pImage->cbFile;
+    vhdxConvLogEntryHdrEndianess(VHDXECONV_H2F, pHdr, pHdr);
+
+    for (uint32_t i = 0; i < pImage->cCommit; i++)
+    {
+        const uint8_t *pbSector = pImage->pbCommit + i * VHDX_LOG_SECTOR_SIZE;
+        PVhdxLogDataDesc pDataDesc = (PVhdxLogDataDesc)(pbEntry + sizeof(VhdxLogEntryHdr)) + i;
+        PVhdxLogDataSector pDataSector = (PVhdxLogDataSector)(pbEntry + (i + 1) * VHDX_LOG_SECTOR_SIZE);
+
+        pDataDesc->u32DataSignature  = VHDX_LOG_DATA_DESC_SIGNATURE;
+        pDataDesc->u32TrailingBytes  = RT_LE2H_U32(*(const uint32_t *)(pbSector + VHDX_LOG_SECTOR_SIZE - sizeof(uint32_t)));
+        pDataDesc->u64LeadingBytes   = RT_LE2H_U64(*(const uint64_t *)pbSector);
+        pDataDesc->u64FileOffset     = pImage->aoffCommit[i];
+        pDataDesc->u64SequenceNumber = u64Seq;
+        vhdxConvLogDataDescEndianess(VHDXECONV_H2F, pDataDesc, pDataDesc);
+
+        pDataSector->u32DataSignature = VHDX_LOG_DATA_SECTOR_SIGNATURE;
+        pDataSector->u32SequenceHigh  = (uint32_t)(u64Seq >> 32);
+        memcpy(&pDataSector->u8Data[0], pbSector + sizeof(uint64_t), sizeof(pDataSector->u8Data));
+        pDataSector->u32SequenceLow   = (uint32_t)u64Seq;
+        vhdxConvLogDataSectorEndianess(VHDXECONV_H2F, pDataSector, pDataSector);
+    }
+
+    pHdr->u32Checksum = RT_H2LE_U32(RTCrc32C(pbEntry, pImage->cbLogEntry));
+}
+
+/**
+ * Aborts the current commit, the metadata sectors of the current log entry
+ * are marked dirty again so they are committed with the next flush.
+ *
+ * @returns nothing.
+ * @param   pImage      Image instance data.
+ */
+static void vhdxCommitAbort(PVHDXIMAGE pImage)
+{
+    for (uint32_t i = 0; i < pImage->cCommit; i++)
+        vhdxMetaSectorSetDirty(pImage, pImage->aidxCommit[i]);
+    pImage->cCommit        = 0;
+    pImage->enmCommitState = VHDXCOMMITSTATE_IDLE;
+}
+
+static DECLCALLBACK(int) vhdxCommitComplete(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq);
+
+/**
+ * Accounts for a request issued by the current commit step.
+ *
+ * @returns VBox status code of the request, VINF_SUCCESS if it is still in progress.
+ * @param   pImage      Image instance data.
+ * @param   rcReq       Status code returned when issuing the request.
+ */
+DECLINLINE(int) vhdxCommitReqIssued(PVHDXIMAGE pImage, int rcReq)
+{
+    if (rcReq == VERR_VD_ASYNC_IO_IN_PROGRESS)
+    {
+        pImage->cCommitReqsPending++;
+        rcReq = VINF_SUCCESS;
+    }
+    return rcReq;
+}
+
+/**
+ * Advances the metadata commit as far as possible.
+ *
+ * All metadata updates go through the log: the dirty sectors are written to the
+ * log and flushed before they are written to their final location, so an
+ * interrupted update can be replayed on the next open.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if the commit continues in the completion callback.
+ * @param   pImage      Image instance data.
+ * @param   pIoCtx      The I/O context of the flush, NULL for synchronous operation.
+ */
+static int vhdxCommitProcess(PVHDXIMAGE pImage, PVDIOCTX pIoCtx)
+{
+    PFNVDXFERCOMPLETED pfnComplete = pIoCtx ? vhdxCommitComplete : NULL;
+
+    while (   RT_SUCCESS(pImage->rcCommit)
+           && pImage->enmCommitState != VHDXCOMMITSTATE_IDLE
+           && !pImage->cCommitReqsPending)
+    {
+        int rc = VINF_SUCCESS;
+
+        switch (pImage->enmCommitState)
+        {
+            case VHDXCOMMITSTATE_FLUSH_DATA:
+            {
+                pImage->enmCommitState = VHDXCOMMITSTATE_WRITE_LOG;
+                rc = vhdxCommitReqIssued(pImage, vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage,
+                                                                    pIoCtx, pfnComplete, NULL));
+                break;
+            }
+            case VHDXCOMMITSTATE_WRITE_LOG:
+            {
+                pImage->cCommit = 0;
+                if (!pImage->cMetaDirty)
+                {
+                    pImage->enmCommitState = VHDXCOMMITSTATE_IDLE;
+                    break;
+                }
+
+                vhdxLogEntryBuild(pImage);
+                pImage->enmCommitState = VHDXCOMMITSTATE_FLUSH_LOG;
+                rc = vhdxCommitReqIssued(pImage, vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
+                                                                        pImage->offLogEntry, pImage->pbLogEntry,
+                                                                        pImage->cbLogEntry, pIoCtx, pfnComplete, NULL));
+                break;
+            }
+            case VHDXCOMMITSTATE_FLUSH_LOG:
+            {
+                pImage->enmCommitState = VHDXCOMMITSTATE_WRITE_META;
+                rc = vhdxCommitReqIssued(pImage, vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage,
+                                                                    pIoCtx, pfnComplete, NULL));
+                break;
+            }
+            case VHDXCOMMITSTATE_WRITE_META:
+            {
+                pImage->enmCommitState = VHDXCOMMITSTATE_FLUSH_META;
+                for (uint32_t i = 0; i < pImage->cCommit && RT_SUCCESS(rc); i++)
+                    rc = vhdxCommitReqIssued(pImage, vdIfIoIntFileWriteMeta(pImage->pIfIo, pImage->pStorage,
+                                                                            pImage->aoffCommit[i],
+                                                                            pImage->pbCommit + i * VHDX_LOG_SECTOR_SIZE,
+                                                                            VHDX_LOG_SECTOR_SIZE, pIoCtx,
+                                                                            pfnComplete, NULL));
+                break;
+            }
+            case VHDXCOMMITSTATE_FLUSH_META:
+            {
+                pImage->enmCommitState = VHDXCOMMITSTATE_WRITE_LOG;
+                rc = vhdxCommitReqIssued(pImage, vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage,
+                                                                    pIoCtx, pfnComplete, NULL));
+                break;
+            }
+            default:
+                AssertMsgFailed(("Invalid commit state %d\n", pImage->enmCommitState));
+                rc = VERR_INTERNAL_ERROR;
+        }
+
+        if (RT_FAILURE(rc))
+            pImage->rcCommit = rc;
+    }
+
+    int rc = pImage->rcCommit;
+    if (pImage->cCommitReqsPending)
+        rc = VERR_VD_ASYNC_IO_IN_PROGRESS;
+    else if (RT_FAILURE(rc))
+        vhdxCommitAbort(pImage);
+
+    return rc;
+}
+
+/**
+ * Completion callback for the requests issued by the metadata commit.
+ */
+static DECLCALLBACK(int) vhdxCommitComplete(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    RT_NOREF1(pvUser);
+
+    Assert(pImage->cCommitReqsPending);
+    pImage->cCommitReqsPending--;
+    if (   RT_FAILURE(rcReq)
+        && RT_SUCCESS(pImage->rcCommit))
+        pImage->rcCommit = rcReq;
+
+    if (!pImage->cCommitReqsPending)
+    {
+        /*
+         * I/O errors are passed on to the flush request by the caller, failures to issue
+         * the next step can't be reported from here. The affected sectors stay dirty
+         * and are committed again with the next flush or when closing the image.
+         */
+        int rc = vhdxCommitProcess(pImage, pIoCtx);
+        if (   RT_FAILURE(rc)
+            && rc != VERR_VD_ASYNC_IO_IN_PROGRESS)
+            LogRel(("VHDX: Committing the metadata of image \'%s\' failed with %Rrc\n",
+                    pImage->pszFilename, rc));
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Starts committing all dirty metadata sectors.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_VD_ASYNC_IO_IN_PROGRESS if the commit continues in the completion callback.
+ * @param   pImage      Image instance data.
+ * @param   pIoCtx      The I/O context of the flush, NULL for synchronous operation.
+ */
+static int vhdxCommitStart(PVHDXIMAGE pImage, PVDIOCTX pIoCtx)
+{
+    AssertReturn(pImage->enmCommitState == VHDXCOMMITSTATE_IDLE, VERR_INTERNAL_ERROR_3);
+
+    pImage->enmCommitState = VHDXCOMMITSTATE_FLUSH_DATA;
+    pImage->rcCommit       = VINF_SUCCESS;
+    return vhdxCommitProcess(pImage, pIoCtx);
+}
+
+/**
+ * Sets up everything required to modify the image after it was loaded.
+ *
+ * @returns VBox status code.
+ * @param   pImage      Image instance data.
+ */
+static int vhdxPrepareWrite(PVHDXIMAGE pImage)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p\n", pImage));
+
+    pImage->offLog = pImage->HdrCur.u64LogOffset;
+    pImage->cbLog  = pImage->HdrCur.u32LogLength;
+    if (   pImage->cbLog < VHDX_LOG_ENTRY_SIZE_MAX
+        || pImage->cbLog % _1M
+        || pImage->offLog % _1M
+        || pImage->offLog < _1M)
+        return vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                         "VHDX: Image \'%s\' has an invalid log region",
+                         pImage->pszFilename);
+
+    pImage->cLogSlots      = pImage->cbLog / VHDX_LOG_ENTRY_SIZE_MAX;
+    pImage->idxLogSlotNext = 0;
+    pImage->uLogSeqNext    = 1;
+    pImage->enmCommitState = VHDXCOMMITSTATE_IDLE;
+    pImage->cBatSectors    = RT_ALIGN_32(pImage->cBatEntries, VHDX_BAT_ENTRIES_PER_SECTOR) / VHDX_BAT_ENTRIES_PER_SECTOR;
+    pImage->cMetaSectors   = pImage->cBatSectors;
+    if (pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF)
+        pImage->cMetaSectors += pImage->cChunks * VHDX_SB_BLOCK_SECTORS;
+    pImage->cMetaDirty     = 0;
+
+    pImage->pbmMetaDirty = (uint32_t *)RTMemAllocZ(RT_ALIGN_32(pImage->cMetaSectors, 32) / 8);
+    pImage->pbCommit     = (uint8_t *)RTMemAlloc(VHDX_LOG_ENTRY_DATA_SECTORS_MAX * VHDX_LOG_SECTOR_SIZE);
+    pImage->pbLogEntry   = (uint8_t *)RTMemAlloc(VHDX_LOG_ENTRY_SIZE_MAX);
+    if (   !pImage->pbmMetaDirty
+        || !pImage->pbCommit
+        || !pImage->pbLogEntry)
+        return vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                         "VHDX: Out of memory allocating the metadata tracking state for image \'%s\'",
+                         pImage->pszFilename);
+
+    rc = vdIfIoIntFileGetSize(pImage->pIfIo, pImage->pStorage, &pImage->cbFile);
+    if (RT_SUCCESS(rc))
+    {
+        /* New blocks are appended after everything which is in use right now. */
+        uint64_t offEof = pImage->cbFile;
+        for (uint32_t i = 0; i < pImage->cBatEntries; i++)
+        {
+            uint64_t uBatEntry = pImage->paBat[i].u64BatEntry;
+            uint64_t cbBlock = 0;
+
+            if ((i % (pImage->uChunkRatio + 1)) == pImage->uChunkRatio)
+            {
+                if (VHDX_BAT_ENTRY_GET_STATE(uBatEntry) == VHDX_BAT_ENTRY_SB_BLOCK_PRESENT)
+                    cbBlock = VHDX_SB_BLOCK_SIZE;
+            }
+            else if (   VHDX_BAT_ENTRY_GET_STATE(uBatEntry) == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT
+                     || VHDX_BAT_ENTRY_GET_STATE(uBatEntry) == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT)
+                cbBlock = pImage->cbBlock;
+
+            if (cbBlock)
+                offEof = RT_MAX(offEof, VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + cbBlock);
+        }
+        pImage->offEof = RT_ALIGN_64(offEof, _1M);
+
+        rc = vhdxHeaderUpdate(pImage, true /* fLogActive */);
+        if (RT_SUCCESS(rc))
+            pImage->fLogActive = true;
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
 /**
  * Internal. Free all allocated space for representing an image except pImage,
  * and optionally delete the image from disk.
@@ -996,9 +1796,22 @@ static int vhdxFreeImage(PVHDXIMAGE pImage, bool fDelete)
     {
         if (pImage->pStorage)
         {
-            rc = vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorage);
+            /* Commit all outstanding metadata updates and mark the log as empty. */
+            if (   pImage->fLogActive
+                && !fDelete)
+            {
+                if (pImage->cMetaDirty)
+                    rc = vhdxCommitStart(pImage, NULL /* pIoCtx */);
+                if (RT_SUCCESS(rc))
+                    rc = vhdxHeaderUpdate(pImage, false /* fLogActive */);
+            }
+
+            int rc2 = vdIfIoIntFileClose(pImage->pIfIo, pImage->pStorage);
+            if (RT_SUCCESS(rc))
+                rc = rc2;
             pImage->pStorage = NULL;
         }
+        pImage->fLogActive = false;
 
         if (pImage->paBat)
         {
@@ -1006,6 +1819,34 @@ static int vhdxFreeImage(PVHDXIMAGE pImage, bool fDelete)
             pImage->paBat = NULL;
         }
 
+        if (pImage->papbSectorBitmap)
+        {
+            for (uint32_t i = 0; i < pImage->cChunks; i++)
+                if (pImage->papbSectorBitmap[i])
+                    RTMemFree(pImage->papbSectorBitmap[i]);
+            RTMemFree(pImage->papbSectorBitmap);
+            pImage->papbSectorBitmap = NULL;
+        }
+
+        if (pImage->pbmMetaDirty)
+        {
+            RTMemFree(pImage->pbmMetaDirty);
+            pImage->pbmMetaDirty = NULL;
+        }
+        pImage->cMetaDirty = 0;
+
+        if (pImage->pbCommit)
+        {
+            RTMemFree(pImage->pbCommit);
+            pImage->pbCommit = NULL;
+        }
+
+        if (pImage->pbLogEntry)
+        {
+            RTMemFree(pImage->pbLogEntry);
+            pImage->pbLogEntry = NULL;
+        }
+
         if (fDelete && pImage->pszFilename)
             vdIfIoIntFileDelete(pImage->pIfIo, pImage->pszFilename);
     }
@@ -1021,27 +1862,23 @@ static int vhdxFreeImage(PVHDXIMAGE pImage, bool fDelete)
  * @returns VBox status code.
  * @param   pImage    Image instance data.
  * @param   pHdr      The header to load.
+ * @param   offHdr    Offset of the header in the file.
  */
-static int vhdxLoadHeader(PVHDXIMAGE pImage, PVhdxHeader pHdr)
+static int vhdxLoadHeader(PVHDXIMAGE pImage, PVhdxHeader pHdr, uint64_t offHdr)
 {
     int rc = VINF_SUCCESS;
 
-    LogFlowFunc(("pImage=%#p pHdr=%#p\n", pImage, pHdr));
+    LogFlowFunc(("pImage=%#p pHdr=%#p offHdr=%llu\n", pImage, pHdr, offHdr));
 
     /*
-     * Most fields in the header are not required because the backend implements
-     * readonly access only so far.
-     * We just have to check that the log is empty, we have to refuse to load the
-     * image otherwsie because replaying the log is not implemented.
+     * The header is kept as a whole because it is rewritten when the image is
+     * modified. A non empty log is replayed by the caller after the header was loaded.
      */
     if (pHdr->u16Version == VHDX_HEADER_VHDX_VERSION)
     {
-        /* Check that the log UUID is zero. */
-        pImage->uVersion = pHdr->u16Version;
-        if (!RTUuidIsNull(&pHdr->UuidLog))
-            rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
-                           "VHDX: Image \'%s\' has a non empty log which is not supported",
-                           pImage->pszFilename);
+        pImage->uVersion  = pHdr->u16Version;
+        pImage->HdrCur    = *pHdr;
+        pImage->offHdrCur = offHdr;
     }
     else
         rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
@@ -1117,7 +1954,8 @@ static int vhdxFindAndLoadCurrentHeader(PVHDXIMAGE pImage)
         if (fHdr1Valid != fHdr2Valid)
         {
             /* Only one header is valid - use it. */
-            rc = vhdxLoadHeader(pImage, fHdr1Valid ? pHdr1 : pHdr2);
+            rc = vhdxLoadHeader(pImage, fHdr1Valid ? pHdr1 : pHdr2,
+                                fHdr1Valid ? VHDX_HEADER1_OFFSET : VHDX_HEADER2_OFFSET);
         }
         else if (!fHdr1Valid && !fHdr2Valid)
         {
@@ -1129,9 +1967,9 @@ static int vhdxFindAndLoadCurrentHeader(PVHDXIMAGE pImage)
         {
             /* Both headers are valid. Use the sequence number to find the current one. */
             if (pHdr1->u64SequenceNumber > pHdr2->u64SequenceNumber)
-                rc = vhdxLoadHeader(pImage, pHdr1);
+                rc = vhdxLoadHeader(pImage, pHdr1, VHDX_HEADER1_OFFSET);
             else
-                rc = vhdxLoadHeader(pImage, pHdr2);
+                rc = vhdxLoadHeader(pImage, pHdr2, VHDX_HEADER2_OFFSET);
         }
     }
     else
@@ -1147,6 +1985,51 @@ static int vhdxFindAndLoadCurrentHeader(PVHDXIMAGE pImage)
     return rc;
 }
 
+/**
+ * Loads the sector bitmap blocks of a differencing image.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ */
+static int vhdxLoadSectorBitmaps(PVHDXIMAGE pImage)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p\n", pImage));
+
+    pImage->papbSectorBitmap = (uint8_t **)RTMemAllocZ(pImage->cChunks * sizeof(uint8_t *));
+    if (!pImage->papbSectorBitmap)
+        return vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                         "VHDX: Out of memory allocating the sector bitmap table of image \'%s\'",
+                         pImage->pszFilename);
+
+    for (uint32_t idxChunk = 0; idxChunk < pImage->cChunks && RT_SUCCESS(rc); idxChunk++)
+    {
+        uint64_t uBatEntry = pImage->paBat[idxChunk * (pImage->uChunkRatio + 1) + pImage->uChunkRatio].u64BatEntry;
+
+        if (VHDX_BAT_ENTRY_GET_STATE(uBatEntry) != VHDX_BAT_ENTRY_SB_BLOCK_PRESENT)
+            continue;
+
+        pImage->papbSectorBitmap[idxChunk] = (uint8_t *)RTMemAlloc(VHDX_SB_BLOCK_SIZE);
+        if (pImage->papbSectorBitmap[idxChunk])
+        {
+            rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry),
+                                       pImage->papbSectorBitmap[idxChunk], VHDX_SB_BLOCK_SIZE);
+            if (RT_FAILURE(rc))
+                rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                               "VHDX: Error reading the sector bitmap of chunk %u from image \'%s\'",
+                               idxChunk, pImage->pszFilename);
+        }
+        else
+            rc = vdIfError(pImage->pIfError, VERR_NO_MEMORY, RT_SRC_POS,
+                           "VHDX: Out of memory allocating the sector bitmap of chunk %u of image \'%s\'",
+                           idxChunk, pImage->pszFilename);
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
 /**
  * Loads the BAT region.
  *
@@ -1181,14 +2064,19 @@ static int vhdxLoadBatRegion(PVHDXIMAGE pImage, uint64_t offRegion,
     if (cDataBlocks % uChunkRatio)
         cSectorBitmapBlocks++;
 
-    cBatEntries = cDataBlocks + (cDataBlocks - 1)/uChunkRatio;
+    /* Differencing images have a sector bitmap entry after every chunk, including the last partial one. */
+    if (pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF)
+        cBatEntries = cSectorBitmapBlocks * (uChunkRatio + 1);
+    else
+        cBatEntries = cDataBlocks + (cDataBlocks - 1)/uChunkRatio;
     cbBatEntries = cBatEntries * sizeof(VhdxBatEntry);
 
     if (cbBatEntries <= cbRegion)
     {
         /*
          * Load the complete BAT region first, convert to host endianess and process
-         * it afterwards. The SB entries can be removed because they are not needed yet.
+         * it afterwards. The sector bitmap entries are kept to have the BAT layout
+         * match the on disk one when it is written back.
          */
         paBatEntries = (PVhdxBatEntry)RTMemAlloc(cbBatEntries);
         if (paBatEntries)
@@ -1203,25 +2091,13 @@ static int vhdxLoadBatRegion(PVHDXIMAGE pImage, uint64_t offRegion,
                 /* Go through the table and validate it. */
                 for (unsigned i = 0; i < cBatEntries; i++)
                 {
-                    if (   i != 0
-                        && (i % uChunkRatio) == 0)
+                    if ((i % (uChunkRatio + 1)) == uChunkRatio)
                     {
-/**
- * Disabled the verification because there are images out there with the sector bitmap
- * marked as present. The entry is never accessed and the image is readonly anyway,
- * so no harm done.
- */
-#if 0
-                        /* Sector bitmap block. */
-                        if (   VHDX_BAT_ENTRY_GET_STATE(paBatEntries[i].u64BatEntry)
-                            != VHDX_BAT_ENTRY_SB_BLOCK_NOT_PRESENT)
-                        {
-                            rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
-                                           "VHDX: Sector bitmap block at entry %u of image \'%s\' marked as present, violation of the specification",
-                                           i, pImage->pszFilename);
-                            break;
-                        }
-#endif
+                        /*
+                         * Sector bitmap block. There are non differencing images out there
+                         * with the sector bitmap marked as present opposed to the specification.
+                         * The entry is never accessed for those, so no harm done.
+                         */
                     }
                     else
                     {
@@ -1229,10 +2105,20 @@ static int vhdxLoadBatRegion(PVHDXIMAGE pImage, uint64_t offRegion,
                         if (   VHDX_BAT_ENTRY_GET_STATE(paBatEntries[i].u64BatEntry)
                             == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT)
                         {
-                            rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
-                                           "VHDX: Payload block at entry %u of image \'%s\' marked as partially present, violation of the specification",
-                                           i, pImage->pszFilename);
-                            break;
+                            uint32_t idxSb = (i / (uChunkRatio + 1)) * (uChunkRatio + 1) + uChunkRatio;
+
+                            if (!(pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF))
+                                rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                                               "VHDX: Payload block at entry %u of image \'%s\' marked as partially present, violation of the specification",
+                                               i, pImage->pszFilename);
+                            else if (   idxSb >= cBatEntries
+                                     ||    VHDX_BAT_ENTRY_GET_STATE(paBatEntries[idxSb].u64BatEntry)
+                                        != VHDX_BAT_ENTRY_SB_BLOCK_PRESENT)
+                                rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                                               "VHDX: Payload block at entry %u of image \'%s\' is partially present without a sector bitmap",
+                                               i, pImage->pszFilename);
+                            if (RT_FAILURE(rc))
+                                break;
                         }
                     }
                 }
@@ -1240,7 +2126,13 @@ static int vhdxLoadBatRegion(PVHDXIMAGE pImage, uint64_t offRegion,
                 if (RT_SUCCESS(rc))
                 {
                     pImage->paBat       = paBatEntries;
+                    pImage->cBatEntries = cBatEntries;
+                    pImage->offBat      = offRegion;
                     pImage->uChunkRatio = uChunkRatio;
+                    pImage->cChunks     = cSectorBitmapBlocks;
+
+                    if (pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF)
+                        rc = vhdxLoadSectorBitmaps(pImage);
                 }
             }
             else
@@ -1259,7 +2151,8 @@ static int vhdxLoadBatRegion(PVHDXIMAGE pImage, uint64_t offRegion,
                        cbBatEntries, cbRegion, pImage->pszFilename);
 
     if (   RT_FAILURE(rc)
-        && paBatEntries)
+        && paBatEntries
+        && pImage->paBat != paBatEntries)
         RTMemFree(paBatEntries);
 
     LogFlowFunc(("returns rc=%Rrc\n", rc));
@@ -1295,11 +2188,14 @@ static int vhdxLoadFileParametersMetadata(PVHDXIMAGE pImage, uint64_t offItem, s
             vhdxConvFileParamsEndianess(VHDXECONV_F2H, &FileParameters, &FileParameters);
             pImage->cbBlock = FileParameters.u32BlockSize;
 
-            /** @todo No support for differencing images yet. */
-            if (FileParameters.u32Flags & VHDX_FILE_PARAMETERS_FLAGS_HAS_PARENT)
-                rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
-                               "VHDX: Image \'%s\' is a differencing image which is not supported yet",
-                               pImage->pszFilename);
+            if (   pImage->cbBlock < _1M
+                || pImage->cbBlock > _256M
+                || !RT_IS_POWER_OF_TWO(pImage->cbBlock))
+                rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                               "VHDX: Image \'%s\' has an invalid block size (%zu)",
+                               pImage->pszFilename, pImage->cbBlock);
+            else if (FileParameters.u32Flags & VHDX_FILE_PARAMETERS_FLAGS_HAS_PARENT)
+                pImage->uImageFlags |= VD_IMAGE_FLAGS_DIFF;
         }
         else
             rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
@@ -1390,6 +2286,50 @@ static int vhdxLoadVDiskLogSectorSizeMetadata(PVHDXIMAGE pImage, uint64_t offIte
     return rc;
 }
 
+/**
+ * Load the parent locator metadata item from the file.
+ *
+ * @returns VBox status code.
+ * @param   pImage    Image instance data.
+ * @param   offItem   File offset where the data is stored.
+ * @param   cbItem    Size of the item in the file.
+ *
+ * @note The parent is opened by the upper layer, only the locator type is checked.
+ */
+static int vhdxLoadParentLocatorMetadata(PVHDXIMAGE pImage, uint64_t offItem, size_t cbItem)
+{
+    int rc = VINF_SUCCESS;
+
+    LogFlowFunc(("pImage=%#p offItem=%llu cbItem=%zu\n", pImage, offItem, cbItem));
+
+    if (cbItem < sizeof(VhdxParentLocatorHeader))
+        rc = vdIfError(pImage->pIfError, VERR_VD_GEN_INVALID_HEADER, RT_SRC_POS,
+                       "VHDX: Parent locator item size mismatch (expected at least %u got %zu) in image \'%s\'",
+                       sizeof(VhdxParentLocatorHeader), cbItem, pImage->pszFilename);
+    else
+    {
+        VhdxParentLocatorHeader ParentLocatorHdr;
+
+        rc = vdIfIoIntFileReadSync(pImage->pIfIo, pImage->pStorage, offItem,
+                                   &ParentLocatorHdr, sizeof(ParentLocatorHdr));
+        if (RT_SUCCESS(rc))
+        {
+            vhdxConvParentLocatorHeaderEndianness(VHDXECONV_F2H, &ParentLocatorHdr, &ParentLocatorHdr);
+            if (RTUuidCompareStr(&ParentLocatorHdr.UuidLocatorType, VHDX_PARENT_LOCATOR_TYPE_VHDX))
+                rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                               "VHDX: Image \'%s\' uses an unsupported parent locator type",
+                               pImage->pszFilename);
+        }
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS,
+                           "VHDX: Reading the parent locator metadata item from image \'%s\' failed",
+                           pImage->pszFilename);
+    }
+
+    LogFlowFunc(("returns rc=%Rrc\n", rc));
+    return rc;
+}
+
 /**
  * Loads the metadata region.
  *
@@ -1529,9 +2469,8 @@ static int vhdxLoadMetadataRegion(PVHDXIMAGE pImage, uint64_t offRegion,
                     }
                     case VHDXMETADATAITEM_PARENT_LOCATOR:
                     {
-                        rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
-                                       "VHDX: Image \'%s\' is a differencing image which is not supported yet",
-                                       pImage->pszFilename);
+                        rc = vhdxLoadParentLocatorMetadata(pImage, offMetadataItem,
+                                                           MetadataTblEntry.u32Length);
                         break;
                     }
                     case VHDXMETADATAITEM_UNKNOWN:
@@ -1688,6 +2627,127 @@ static int vhdxLoadRegionTable(PVHDXIMAGE pImage)
     return rc;
 }
 
+/**
+ * Returns the number of bytes starting at the given offset in a partially present
+ * block which share the same sector bitmap state.
+ *
+ * @returns Number of bytes with the same state, at most cbRange.
+ * @param   pImage      Image instance data.
+ * @param   idxBlock    The payload block index.
+ * @param   offBlock    Offset inside the block.
+ * @param   cbRange     Size of the range to check.
+ * @param   pfPresent   Where to store whether the range is present in this image.
+ */
+static size_t vhdxSbGetRange(PVHDXIMAGE pImage, uint32_t idxBlock, uint32_t offBlock, size_t cbRange,
+                             bool *pfPresent)
+{
+    const uint8_t *pbSb = pImage->papbSectorBitmap[idxBlock / pImage->uChunkRatio];
+    uint32_t cSectorsPerBlock = (uint32_t)(pImage->cbBlock / pImage->cbLogicalSector);
+    uint32_t iBitBlock = (idxBlock % pImage->uChunkRatio) * cSectorsPerBlock;
+    uint32_t iSector = offBlock / pImage->cbLogicalSector;
+    uint32_t iSectorEnd = (uint32_t)((offBlock + cbRange + pImage->cbLogicalSector - 1) / pImage->cbLogicalSector);
+    bool fPresent = ASMBitTest(pbSb, (int32_t)(iBitBlock + iSector));
+
+    AssertPtr(pbSb);
+    iSector++;
+    while (   iSector < iSectorEnd
+           && ASMBitTest(pbSb, (int32_t)(iBitBlock + iSector)) == fPresent)
+        iSector++;
+
+    *pfPresent = fPresent;
+    return RT_MIN(cbRange, (size_t)iSector * pImage->cbLogicalSector - offBlock);
+}
+
+/**
+ * Marks the given range of a partially present block as present in the sector bitmap.
+ *
+ * @returns nothing.
+ * @param   pImage      Image instance data.
+ * @param   idxBlock    The payload block index.
+ * @param   offBlock    Offset inside the block, must be aligned to the logical sector size.
+ * @param   cbRange     Size of the range, must be aligned to the logical sector size.
+ */
+static void vhdxSbSetRange(PVHDXIMAGE pImage, uint32_t idxBlock, uint32_t offBlock, size_t cbRange)
+{
+    uint32_t idxChunk = idxBlock / pImage->uChunkRatio;
+    uint32_t cSectorsPerBlock = (uint32_t)(pImage->cbBlock / pImage->cbLogicalSector);
+    uint32_t iBitFirst = (idxBlock % pImage->uChunkRatio) * cSectorsPerBlock + offBlock / pImage->cbLogicalSector;
+    uint32_t iBitEnd = iBitFirst + (uint32_t)(cbRange / pImage->cbLogicalSector);
+
+    ASMBitSetRange(pImage->papbSectorBitmap[idxChunk], (int32_t)iBitFirst, (int32_t)iBitEnd);
+
+    uint32_t idxSectorFirst = iBitFirst / 8 / VHDX_LOG_SECTOR_SIZE;
+    uint32_t idxSectorLast = (iBitEnd - 1) / 8 / VHDX_LOG_SECTOR_SIZE;
+    for (uint32_t idxSector = idxSectorFirst; idxSector <= idxSectorLast; idxSector++)
+        vhdxMetaSectorSetDirty(pImage, pImage->cBatSectors + idxChunk * VHDX_SB_BLOCK_SECTORS + idxSector);
+}
+
+/**
+ * Completion callback for the user data write to a newly allocated block,
+ * updates the BAT.
+ */
+static DECLCALLBACK(int) vhdxBlockAllocComplete(void *pBackendData, PVDIOCTX pIoCtx, void *pvUser, int rcReq)
+{
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    PVHDXBLOCKALLOC pBlockAlloc = (PVHDXBLOCKALLOC)pvUser;
+    RT_NOREF1(pIoCtx);
+
+    if (RT_SUCCESS(rcReq))
+    {
+        pImage->paBat[pBlockAlloc->idxBat].u64BatEntry
+            = VHDX_BAT_ENTRY_MAKE(pBlockAlloc->offBlock, VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT);
+        vhdxMetaSectorSetDirty(pImage, pBlockAlloc->idxBat / VHDX_BAT_ENTRIES_PER_SECTOR);
+    }
+    /* else: I/O error don't update the BAT, the block stays unused. */
+
+    RTMemFree(pBlockAlloc);
+    return VINF_SUCCESS;
+}
+
+/**
+ * Allocates a new block at the end of the image and writes the user data to it.
+ *
+ * @returns VBox status code.
+ * @param   pImage      Image instance data.
+ * @param   pIoCtx      The I/O context of the write.
+ * @param   idxBat      BAT index of the block to allocate.
+ * @param   offWrite    Offset inside the block to write to.
+ * @param   cbWrite     Number of bytes to write.
+ */
+static int vhdxBlockAlloc(PVHDXIMAGE pImage, PVDIOCTX pIoCtx, uint32_t idxBat,
+                          uint32_t offWrite, size_t cbWrite)
+{
+    int rc = VINF_SUCCESS;
+    PVHDXBLOCKALLOC pBlockAlloc = (PVHDXBLOCKALLOC)RTMemAllocZ(sizeof(VHDXBLOCKALLOC));
+
+    if (RT_UNLIKELY(!pBlockAlloc))
+        return VERR_NO_MEMORY;
+
+    /*
+     * Grow the file first so the parts of the block which are not written
+     * read as zeros.
+     */
+    uint64_t offBlock = pImage->offEof;
+    rc = vdIfIoIntFileSetSize(pImage->pIfIo, pImage->pStorage, offBlock + pImage->cbBlock);
+    if (RT_SUCCESS(rc))
+    {
+        pImage->offEof = offBlock + pImage->cbBlock;
+        pImage->cbFile = RT_MAX(pImage->cbFile, pImage->offEof);
+
+        pBlockAlloc->idxBat   = idxBat;
+        pBlockAlloc->offBlock = offBlock;
+        rc = vdIfIoIntFileWriteUser(pImage->pIfIo, pImage->pStorage, offBlock + offWrite,
+                                    pIoCtx, cbWrite, vhdxBlockAllocComplete, pBlockAlloc);
+        if (rc == VERR_VD_ASYNC_IO_IN_PROGRESS)
+            return rc;
+        else if (RT_SUCCESS(rc))
+            return vhdxBlockAllocComplete(pImage, pIoCtx, pBlockAlloc, rc);
+    }
+
+    RTMemFree(pBlockAlloc);
+    return rc;
+}
+
 /**
  * Internal: Open an image, constructing all necessary data structures.
  */
@@ -1704,10 +2764,6 @@ static int vhdxOpenImage(PVHDXIMAGE pImage, unsigned uOpenFlags)
     pImage->pIfIo = VDIfIoIntGet(pImage->pVDIfsImage);
     AssertPtrReturn(pImage->pIfIo, VERR_INVALID_PARAMETER);
 
-    /* Refuse write access, it is not implemented so far. */
-    if (!(uOpenFlags & VD_OPEN_FLAGS_READONLY))
-        return VERR_NOT_SUPPORTED;
-
     /*
      * Open the image.
      */
@@ -1736,9 +2792,25 @@ static int vhdxOpenImage(PVHDXIMAGE pImage, unsigned uOpenFlags)
                 else
                     rc = vhdxFindAndLoadCurrentHeader(pImage);
 
+                /* Replay a non empty log before any other metadata is loaded. */
+                if (   RT_SUCCESS(rc)
+                    && !RTUuidIsNull(&pImage->HdrCur.UuidLog))
+                {
+                    if (uOpenFlags & VD_OPEN_FLAGS_READONLY)
+                        rc = vdIfError(pImage->pIfError, VERR_NOT_SUPPORTED, RT_SRC_POS,
+                                       "VHDX: Image \'%s\' has a non empty log which can only be replayed when opened for writing",
+                                       pImage->pszFilename);
+                    else
+                        rc = vhdxLogReplay(pImage);
+                }
+
                 /* Load the region table. */
                 if (RT_SUCCESS(rc))
                     rc = vhdxLoadRegionTable(pImage);
+
+                if (   RT_SUCCESS(rc)
+                    && !(uOpenFlags & VD_OPEN_FLAGS_READONLY))
+                    rc = vhdxPrepareWrite(pImage);
             }
         }
         else
@@ -1959,18 +3031,25 @@ static DECLCALLBACK(int) vhdxRead(void *pBackendData, uint64_t uOffset, size_t c
         rc = VERR_INVALID_PARAMETER;
     else
     {
-        uint32_t idxBat = (uint32_t)(uOffset / pImage->cbBlock); Assert(idxBat == uOffset / pImage->cbBlock);
+        uint32_t idxBlock = (uint32_t)(uOffset / pImage->cbBlock); Assert(idxBlock == uOffset / pImage->cbBlock);
         uint32_t offRead = uOffset % pImage->cbBlock;
-        uint64_t uBatEntry;
-
-        idxBat += idxBat / pImage->uChunkRatio; /* Add interleaving sector bitmap entries. */
-        uBatEntry = pImage->paBat[idxBat].u64BatEntry;
+        uint32_t idxBat = idxBlock + idxBlock / pImage->uChunkRatio; /* Add interleaving sector bitmap entries. */
+        uint64_t uBatEntry = pImage->paBat[idxBat].u64BatEntry;
 
         cbToRead = RT_MIN(cbToRead, pImage->cbBlock - offRead);
 
         switch (VHDX_BAT_ENTRY_GET_STATE(uBatEntry))
         {
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_NOT_PRESENT:
+            {
+                /* The data comes from the parent for differencing images. */
+                if (pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF)
+                {
+                    rc = VERR_VD_BLOCK_FREE;
+                    break;
+                }
+            }
+            RT_FALL_THRU();
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNDEFINED:
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_ZERO:
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_UNMAPPED:
@@ -1986,6 +3065,20 @@ static DECLCALLBACK(int) vhdxRead(void *pBackendData, uint64_t uOffset, size_t c
                 break;
             }
             case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT:
+            {
+                bool fPresent = false;
+
+                cbToRead = vhdxSbGetRange(pImage, idxBlock, offRead, cbToRead, &fPresent);
+                if (fPresent)
+                {
+                    uint64_t offFile = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + offRead;
+                    rc = vdIfIoIntFileReadUser(pImage->pIfIo, pImage->pStorage, offFile,
+                                               pIoCtx, cbToRead);
+                }
+                else
+                    rc = VERR_VD_BLOCK_FREE;
+                break;
+            }
             default:
                 rc = VERR_INVALID_PARAMETER;
                 break;
@@ -2004,11 +3097,10 @@ static DECLCALLBACK(int) vhdxWrite(void *pBackendData, uint64_t uOffset,  size_t
                                    PVDIOCTX pIoCtx, size_t *pcbWriteProcess, size_t *pcbPreRead,
                                    size_t *pcbPostRead, unsigned fWrite)
 {
-    RT_NOREF5(pIoCtx, pcbWriteProcess, pcbPreRead, pcbPostRead, fWrite);
     LogFlowFunc(("pBackendData=%#p uOffset=%llu pIoCtx=%#p cbToWrite=%zu pcbWriteProcess=%#p pcbPreRead=%#p pcbPostRead=%#p\n",
                  pBackendData, uOffset, pIoCtx, cbToWrite, pcbWriteProcess, pcbPreRead, pcbPostRead));
     PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
-    int rc;
+    int rc = VINF_SUCCESS;
 
     AssertPtr(pImage);
     Assert(uOffset % 512 == 0);
@@ -2020,7 +3112,76 @@ static DECLCALLBACK(int) vhdxWrite(void *pBackendData, uint64_t uOffset,  size_t
              || cbToWrite == 0)
         rc = VERR_INVALID_PARAMETER;
     else
-        rc = VERR_NOT_SUPPORTED;
+    {
+        uint32_t idxBlock = (uint32_t)(uOffset / pImage->cbBlock); Assert(idxBlock == uOffset / pImage->cbBlock);
+        uint32_t offWrite = uOffset % pImage->cbBlock;
+        uint32_t idxBat = idxBlock + idxBlock / pImage->uChunkRatio; /* Add interleaving sector bitmap entries. */
+        uint64_t uBatEntry = pImage->paBat[idxBat].u64BatEntry;
+
+        cbToWrite = RT_MIN(cbToWrite, pImage->cbBlock - offWrite);
+
+        switch (VHDX_BAT_ENTRY_GET_STATE(uBatEntry))
+        {
+            case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_FULLY_PRESENT:
+            {
+                uint64_t offFile = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + offWrite;
+                rc = vdIfIoIntFileWriteUser(pImage->pIfIo, pImage->pStorage, offFile,
+                                            pIoCtx, cbToWrite, NULL, NULL);
+                break;
+            }
+            case VHDX_BAT_ENTRY_PAYLOAD_BLOCK_PARTIALLY_PRESENT:
+            {
+                bool fPresent = false;
+
+                cbToWrite = vhdxSbGetRange(pImage, idxBlock, offWrite, cbToWrite, &fPresent);
+                if (   !fPresent
+                    && (   offWrite % pImage->cbLogicalSector
+                        || cbToWrite % pImage->cbLogicalSector))
+                {
+                    /* The sectors become present as a whole, let the upper layer fill in the rest from the parent. */
+                    *pcbPreRead  = offWrite % pImage->cbLogicalSector;
+                    *pcbPostRead = RT_ALIGN_Z(offWrite + cbToWrite, pImage->cbLogicalSector) - (offWrite + cbToWrite);
+                    rc = VERR_VD_BLOCK_FREE;
+                }
+                else
+                {
+                    uint64_t offFile = VHDX_BAT_ENTRY_GET_FILE_OFFSET(uBatEntry) + offWrite;
+                    rc = vdIfIoIntFileWriteUser(pImage->pIfIo, pImage->pStorage, offFile,
+                                                pIoCtx, cbToWrite, NULL, NULL);
+                    if (   !fPresent
+                        && (   RT_SUCCESS(rc)
+                            || rc == VERR_VD_ASYNC_IO_IN_PROGRESS))
+                        vhdxSbSetRange(pImage, idxBlock, offWrite, cbToWrite);
+                }
+                break;
+            }
+            default:
+            {
+                if (   (pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF)
+                    && VHDX_BAT_ENTRY_GET_STATE(uBatEntry) == VHDX_BAT_ENTRY_PAYLOAD_BLOCK_NOT_PRESENT
+                    && cbToWrite != pImage->cbBlock)
+                {
+                    /* Partial write to a block of a differencing image, the rest comes from the parent. */
+                    *pcbPreRead  = offWrite;
+                    *pcbPostRead = pImage->cbBlock - cbToWrite - offWrite;
+                    rc = VERR_VD_BLOCK_FREE;
+                }
+                else if (fWrite & VD_WRITE_NO_ALLOC)
+                {
+                    /* Give the upper layer the chance to skip writes which don't change anything. */
+                    *pcbPreRead  = 0;
+                    *pcbPostRead = 0;
+                    rc = VERR_VD_BLOCK_FREE;
+                }
+                else
+                    rc = vhdxBlockAlloc(pImage, pIoCtx, idxBat, offWrite, cbToWrite);
+                break;
+            }
+        }
+
+        if (pcbWriteProcess)
+            *pcbWriteProcess = cbToWrite;
+    }
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -2029,15 +3190,18 @@ static DECLCALLBACK(int) vhdxWrite(void *pBackendData, uint64_t uOffset,  size_t
 /** @copydoc VDIMAGEBACKEND::pfnFlush */
 static DECLCALLBACK(int) vhdxFlush(void *pBackendData, PVDIOCTX pIoCtx)
 {
-    RT_NOREF1(pIoCtx);
     LogFlowFunc(("pBackendData=%#p pIoCtx=%#p\n", pBackendData, pIoCtx));
     PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
     int rc;
 
+    AssertPtr(pImage);
+
     if (pImage->uOpenFlags & VD_OPEN_FLAGS_READONLY)
         rc = VERR_VD_IMAGE_READ_ONLY;
+    else if (!pImage->cMetaDirty)
+        rc = vdIfIoIntFileFlush(pImage->pIfIo, pImage->pStorage, pIoCtx, NULL, NULL);
     else
-        rc = VERR_NOT_SUPPORTED;
+        rc = vhdxCommitStart(pImage, pIoCtx);
 
     LogFlowFunc(("returns %Rrc\n", rc));
     return rc;
@@ -2248,7 +3412,9 @@ static DECLCALLBACK(int) vhdxSetOpenFlags(void *pBackendData, unsigned uOpenFlag
     int rc = VINF_SUCCESS;
 
     /* Image must be opened and the new flags must be valid. */
-    if (!pImage || (uOpenFlags & ~(VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_INFO | VD_OPEN_FLAGS_SKIP_CONSISTENCY_CHECKS)))
+    if (!pImage || (uOpenFlags & ~(  VD_OPEN_FLAGS_READONLY | VD_OPEN_FLAGS_INFO
+                                   | VD_OPEN_FLAGS_ASYNC_IO | VD_OPEN_FLAGS_SHAREABLE
+                                   | VD_OPEN_FLAGS_SEQUENTIAL | VD_OPEN_FLAGS_SKIP_CONSISTENCY_CHECKS)))
         rc = VERR_INVALID_PARAMETER;
     else
     {
@@ -2281,7 +3447,27 @@ VD_BACKEND_CALLBACK_GET_UUID_DEF_NOT_SUPPORTED(vhdxGetModificationUuid);
 VD_BACKEND_CALLBACK_SET_UUID_DEF_NOT_SUPPORTED(vhdxSetModificationUuid, PVHDXIMAGE);
 
 /** @copydoc VDIMAGEBACKEND::pfnGetParentUuid */
-VD_BACKEND_CALLBACK_GET_UUID_DEF_NOT_SUPPORTED(vhdxGetParentUuid);
+static DECLCALLBACK(int) vhdxGetParentUuid(void *pBackendData, PRTUUID pUuid)
+{
+    LogFlowFunc(("pBackendData=%#p pUuid=%#p\n", pBackendData, pUuid));
+    PVHDXIMAGE pImage = (PVHDXIMAGE)pBackendData;
+    int rc = VINF_SUCCESS;
+
+    AssertPtrReturn(pImage, VERR_VD_NOT_OPENED);
+
+    /*
+     * The parent is referenced by the data write GUID of the parent image in the
+     * parent locator which has no equivalent in the VD layer, so return a null UUID
+     * for differencing images and let the caller establish the chain.
+     */
+    if (pImage->uImageFlags & VD_IMAGE_FLAGS_DIFF)
+        RTUuidClear(pUuid);
+    else
+        rc = VERR_NOT_SUPPORTED;
+
+    LogFlowFunc(("returns %Rrc (%RTuuid)\n", rc, pUuid));
+    return rc;
+}
 
 /** @copydoc VDIMAGEBACKEND::pfnSetParentUuid */
 VD_BACKEND_CALLBACK_SET_UUID_DEF_NOT_SUPPORTED(vhdxSetParentUuid, PVHDXIMAGE);
@@ -2315,7 +3501,7 @@ const VDIMAGEBACKEND g_VhdxBackend =
     /* pszBackendName */
     "VHDX",
     /* uBackendCaps */
-    VD_CAP_FILE | VD_CAP_VFS,
+    VD_CAP_FILE | VD_CAP_ASYNC | VD_CAP_VFS,
     /* paFileExtensions */
     s_aVhdxFileExtensions,
     /* paConfigInfo */
@@ -32,6 +32,9 @@
 #include <iprt/rand.h>
 #include <iprt/zip.h>
 #include <iprt/asm.h>
+#include <iprt/mp.h>
+#include <iprt/semaphore.h>
+#include <iprt/thread.h>
 
 #include "VDBackends.h"
 
@@ -281,6 +284,13 @@ typedef struct VMDKEXTENT
     uint64_t    uAppendPosition;
     /** Last grain which was accessed. Only for streamOptimized extents. */
     uint32_t    uLastGrainAccess;
+    /** Last grain which was written to the file, lags behind uLastGrainAccess
+     * while grains are compressed in the background. Only for streamOptimized extents. */
+    uint32_t    uLastGrainWritten;
+    /** Grain compression workers, only for streamOptimized extents being created. */
+    struct VMDKDEFLATEPOOL *pDeflatePool;
+    /** Flag whether creating the grain compression workers was attempted. */
+    bool        fDeflatePoolTried;
     /** Starting sector corresponding to the grain buffer. */
     uint32_t    uGrainSectorAbs;
     /** Grain number corresponding to the grain buffer. */
@@ -459,6 +469,76 @@ typedef struct VMDKCOMPRESSIO
 } VMDKCOMPRESSIO;
 
 
+/** Maximum number of grain compression worker threads. */
+#define VMDK_DEFLATE_WORKERS_MAX    8
+/** Number of grains queued per compression worker. */
+#define VMDK_DEFLATE_JOBS_PER_WORKER 4
+
+/** A grain queued for compression. */
+typedef struct VMDKDEFLATEJOB
+{
+    /** The uncompressed grain. */
+    void                *pvGrain;
+    /** The compressed grain including the marker. */
+    void                *pvCompGrain;
+    /** The sector the grain starts at. */
+    uint64_t            uSector;
+    /** The grain number. */
+    uint32_t            uGrain;
+    /** Size of the compressed grain including marker and padding. */
+    uint32_t            cbCompGrain;
+    /** Status of the compression. */
+    int                 rc;
+    /** Flag whether the compression finished. */
+    volatile bool       fDone;
+} VMDKDEFLATEJOB;
+/** Pointer to a queued grain. */
+typedef VMDKDEFLATEJOB *PVMDKDEFLATEJOB;
+
+/**
+ * Grain compression worker pool for creating streamOptimized extents.
+ *
+ * Grains are compressed by the workers in any order but written to the file by the
+ * thread doing the writes in the order they were queued, as each grain is appended
+ * right after the previous one.
+ */
+typedef struct VMDKDEFLATEPOOL
+{
+    /** Number of worker threads. */
+    unsigned            cWorkers;
+    /** Number of entries in the job ring. */
+    uint32_t            cJobs;
+    /** Number of grains queued so far, the ring index of the next grain is this modulo cJobs. */
+    volatile uint32_t   cQueued;
+    /** Number of grains claimed by the workers so far. */
+    volatile uint32_t   cClaimed;
+    /** Number of grains written to the file so far. */
+    uint32_t            cWritten;
+    /** Flag whether the workers should exit. */
+    volatile bool       fShutdown;
+    /** Flag whether a grain was queued, uGrainQueued is valid. */
+    bool                fGrainQueued;
+    /** The last grain queued. */
+    uint32_t            uGrainQueued;
+    /** Status of the first failed write out, returned for all following writes. */
+    int                 rcWriteOut;
+    /** Signalled when grains were queued or the workers should exit. */
+    RTSEMEVENT          hEvtWork;
+    /** Signalled when a worker finished a grain. */
+    RTSEMEVENT          hEvtDone;
+    /** The worker threads. */
+    RTTHREAD            ahThreads[VMDK_DEFLATE_WORKERS_MAX];
+    /** The job ring. */
+    PVMDKDEFLATEJOB     paJobs;
+    /** Size of the compressed grain buffers. */
+    size_t              cbCompGrainMax;
+    /** Size of a grain. */
+    size_t              cbGrain;
+} VMDKDEFLATEPOOL;
+/** Pointer to a grain compression worker pool. */
+typedef VMDKDEFLATEPOOL *PVMDKDEFLATEPOOL;
+
+
 /** Tracks async grain allocation. */
 typedef struct VMDKGRAINALLOCASYNC
 {
@@ -830,22 +910,21 @@ static DECLCALLBACK(int) vmdkFileDeflateHelper(void *pvUser, const void *pvBuf,
 }
 
 /**
- * Internal: deflate the uncompressed data and write to a file,
- * distinguishing between async and normal operation
+ * Internal: deflate the uncompressed data into the given buffer, prefixed with
+ * the compressed grain marker and padded to a full sector. Doesn't touch the image
+ * state and is safe to call from the compression workers.
  */
-DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
-                                    uint64_t uOffset, const void *pvBuf,
-                                    size_t cbToWrite, uint64_t uLBA,
-                                    uint32_t *pcbMarkerData)
+static int vmdkDeflateGrain(void *pvCompGrain, size_t cbCompGrain, const void *pvBuf,
+                            size_t cbToWrite, uint64_t uLBA, uint32_t *pcbMarkerData)
 {
     int rc;
     PRTZIPCOMP pZip = NULL;
     VMDKCOMPRESSIO DeflateState;
 
-    DeflateState.pImage = pImage;
+    DeflateState.pImage = NULL;
     DeflateState.iOffset = -1;
-    DeflateState.cbCompGrain = pExtent->cbCompGrain;
-    DeflateState.pvCompGrain = pExtent->pvCompGrain;
+    DeflateState.cbCompGrain = cbCompGrain;
+    DeflateState.pvCompGrain = pvCompGrain;
 
     rc = RTZipCompCreate(&pZip, &DeflateState, vmdkFileDeflateHelper,
                          RTZIPTYPE_ZLIB, RTZIPLEVEL_DEFAULT);
@@ -865,27 +944,173 @@ DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
         if (uSize % 512)
         {
             uint32_t uSizeAlign = RT_ALIGN(uSize, 512);
-            memset((uint8_t *)pExtent->pvCompGrain + uSize, '\0',
+            memset((uint8_t *)pvCompGrain + uSize, '\0',
                    uSizeAlign - uSize);
             uSize = uSizeAlign;
         }
 
-        if (pcbMarkerData)
-            *pcbMarkerData = uSize;
+        *pcbMarkerData = uSize;
 
         /* Compressed grain marker. Data follows immediately. */
-        VMDKMARKER *pMarker = (VMDKMARKER *)pExtent->pvCompGrain;
+        VMDKMARKER *pMarker = (VMDKMARKER *)pvCompGrain;
         pMarker->uSector = RT_H2LE_U64(uLBA);
         pMarker->cbSize = RT_H2LE_U32(  DeflateState.iOffset
                                       - RT_UOFFSETOF(VMDKMARKER, uType));
+    }
+    return rc;
+}
+
+/**
+ * Internal: deflate the uncompressed data and write to a file,
+ * distinguishing between async and normal operation
+ */
+DECLINLINE(int) vmdkFileDeflateSync(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
+                                    uint64_t uOffset, const void *pvBuf,
+                                    size_t cbToWrite, uint64_t uLBA,
+                                    uint32_t *pcbMarkerData)
+{
+    uint32_t cbMarkerData = 0;
+    int rc = vmdkDeflateGrain(pExtent->pvCompGrain, pExtent->cbCompGrain, pvBuf,
+                              cbToWrite, uLBA, &cbMarkerData);
+    if (RT_SUCCESS(rc))
+    {
+        if (pcbMarkerData)
+            *pcbMarkerData = cbMarkerData;
         rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pExtent->pFile->pStorage,
-                                    uOffset, pMarker, uSize);
-        if (RT_FAILURE(rc))
-            return rc;
+                                    uOffset, pExtent->pvCompGrain, cbMarkerData);
     }
     return rc;
 }
 
+/**
+ * Grain compression worker thread.
+ */
+static DECLCALLBACK(int) vmdkDeflateWorker(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PVMDKDEFLATEPOOL pPool = (PVMDKDEFLATEPOOL)pvUser;
+
+    RT_NOREF(hThreadSelf);
+
+    while (!ASMAtomicReadBool(&pPool->fShutdown))
+    {
+        uint32_t iJob = ASMAtomicReadU32(&pPool->cClaimed);
+        if (iJob == ASMAtomicReadU32(&pPool->cQueued))
+        {
+            RTSemEventWait(pPool->hEvtWork, RT_INDEFINITE_WAIT);
+            continue;
+        }
+        if (!ASMAtomicCmpXchgU32(&pPool->cClaimed, iJob + 1, iJob))
+            continue; /* Another worker was faster. */
+
+        PVMDKDEFLATEJOB pJob = &pPool->paJobs[iJob % pPool->cJobs];
+        uint32_t cbCompGrain = 0;
+        pJob->rc = vmdkDeflateGrain(pJob->pvCompGrain, pPool->cbCompGrainMax, pJob->pvGrain,
+                                    pPool->cbGrain, pJob->uSector, &cbCompGrain);
+        pJob->cbCompGrain = cbCompGrain;
+        ASMAtomicWriteBool(&pJob->fDone, true);
+        RTSemEventSignal(pPool->hEvtDone);
+    }
+
+    return VINF_SUCCESS;
+}
+
+/**
+ * Internal: stop the grain compression workers and free the pool. Grains not
+ * written out yet are dropped.
+ */
+static void vmdkDeflatePoolDestroy(PVMDKEXTENT pExtent)
+{
+    PVMDKDEFLATEPOOL pPool = pExtent->pDeflatePool;
+
+    if (!pPool)
+        return;
+
+    ASMAtomicWriteBool(&pPool->fShutdown, true);
+    for (unsigned i = 0; i < RT_ELEMENTS(pPool->ahThreads); i++)
+    {
+        if (pPool->ahThreads[i] == NIL_RTTHREAD)
+            continue;
+        /* The event wakes only one waiter, keep signalling until this one is gone. */
+        int rc;
+        do
+        {
+            RTSemEventSignal(pPool->hEvtWork);
+            rc = RTThreadWait(pPool->ahThreads[i], 10, NULL);
+        } while (rc == VERR_TIMEOUT);
+    }
+
+    if (pPool->hEvtWork != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pPool->hEvtWork);
+    if (pPool->hEvtDone != NIL_RTSEMEVENT)
+        RTSemEventDestroy(pPool->hEvtDone);
+    if (pPool->paJobs)
+    {
+        for (uint32_t i = 0; i < pPool->cJobs; i++)
+        {
+            RTMemFree(pPool->paJobs[i].pvGrain);
+            RTMemFree(pPool->paJobs[i].pvCompGrain);
+        }
+        RTMemFree(pPool->paJobs);
+    }
+    RTMemFree(pPool);
+    pExtent->pDeflatePool = NULL;
+}
+
+/**
+ * Internal: create the grain compression workers for a streamOptimized extent.
+ * Not worth it (and not done) if there is only one host CPU.
+ */
+static int vmdkDeflatePoolCreate(PVMDKEXTENT pExtent)
+{
+    int rc = VINF_SUCCESS;
+    unsigned cWorkers = RT_MIN(RTMpGetOnlineCount(), VMDK_DEFLATE_WORKERS_MAX);
+
+    if (cWorkers < 2)
+        return VERR_NOT_SUPPORTED;
+
+    PVMDKDEFLATEPOOL pPool = (PVMDKDEFLATEPOOL)RTMemAllocZ(sizeof(VMDKDEFLATEPOOL));
+    if (!pPool)
+        return VERR_NO_MEMORY;
+
+    pPool->cJobs          = cWorkers * VMDK_DEFLATE_JOBS_PER_WORKER;
+    pPool->cbGrain        = VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain);
+    pPool->cbCompGrainMax = pExtent->cbCompGrain;
+    pPool->rcWriteOut     = VINF_SUCCESS;
+    pPool->hEvtWork       = NIL_RTSEMEVENT;
+    pPool->hEvtDone       = NIL_RTSEMEVENT;
+    for (unsigned i = 0; i < RT_ELEMENTS(pPool->ahThreads); i++)
+        pPool->ahThreads[i] = NIL_RTTHREAD;
+    pExtent->pDeflatePool = pPool;
+
+    pPool->paJobs = (PVMDKDEFLATEJOB)RTMemAllocZ(pPool->cJobs * sizeof(VMDKDEFLATEJOB));
+    if (pPool->paJobs)
+    {
+        for (uint32_t i = 0; i < pPool->cJobs && RT_SUCCESS(rc); i++)
+        {
+            pPool->paJobs[i].pvGrain     = RTMemAlloc(pPool->cbGrain);
+            pPool->paJobs[i].pvCompGrain = RTMemAlloc(pPool->cbCompGrainMax);
+            if (   !pPool->paJobs[i].pvGrain
+                || !pPool->paJobs[i].pvCompGrain)
+                rc = VERR_NO_MEMORY;
+        }
+    }
+    else
+        rc = VERR_NO_MEMORY;
+
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pPool->hEvtWork);
+    if (RT_SUCCESS(rc))
+        rc = RTSemEventCreate(&pPool->hEvtDone);
+    for (unsigned i = 0; i < cWorkers && RT_SUCCESS(rc); i++)
+        rc = RTThreadCreateF(&pPool->ahThreads[i], vmdkDeflateWorker, pPool, 0, RTTHREADTYPE_DEFAULT,
+                             RTTHREADFLAGS_WAITABLE, "VMDKDefl%u", i);
+    if (RT_SUCCESS(rc))
+        pPool->cWorkers = cWorkers;
+    else
+        vmdkDeflatePoolDestroy(pExtent);
+
+    return rc;
+}
 
 /**
  * Internal: check if all files are closed, prevent leaking resources.
@@ -2905,6 +3130,7 @@ static int vmdkWriteMetaSparseExtent(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
  */
 static void vmdkFreeStreamBuffers(PVMDKEXTENT pExtent)
 {
+    vmdkDeflatePoolDestroy(pExtent);
     if (pExtent->pvCompGrain)
     {
         RTMemFree(pExtent->pvCompGrain);
@@ -4244,6 +4470,163 @@ static int vmdkStreamFlushGT(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
     return rc;
 }
 
+/**
+ * Internal. Writes a compressed grain to the end of a streamOptimized extent
+ * and enters it in the grain table, flushing the grain tables of the skipped
+ * grain directory entries first.
+ */
+static int vmdkStreamWriteGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, uint32_t uGrain,
+                                const void *pvCompGrain, uint32_t cbCompGrain)
+{
+    uint32_t uCacheLine = uGrain % pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE;
+    uint32_t uCacheEntry = uGrain % VMDK_GT_CACHELINE_SIZE;
+    uint32_t uGDEntry = uGrain / pExtent->cGTEntries;
+    uint32_t uLastGDEntry = pExtent->uLastGrainWritten / pExtent->cGTEntries;
+    int rc;
+
+    if (uGDEntry != uLastGDEntry)
+    {
+        rc = vmdkStreamFlushGT(pImage, pExtent, uLastGDEntry);
+        if (RT_FAILURE(rc))
+            return rc;
+        vmdkStreamClearGT(pImage, pExtent);
+        for (uint32_t i = uLastGDEntry + 1; i < uGDEntry; i++)
+        {
+            rc = vmdkStreamFlushGT(pImage, pExtent, i);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+    }
+
+    uint64_t uFileOffset;
+    uFileOffset = pExtent->uAppendPosition;
+    if (!uFileOffset)
+        return VERR_INTERNAL_ERROR;
+    /* Align to sector, as the previous write could have been any size. */
+    uFileOffset = RT_ALIGN_64(uFileOffset, 512);
+
+    /* Paranoia check: extent type, grain table buffer presence and
+     * grain table buffer space. Also grain table entry must be clear. */
+    if (   pExtent->enmType != VMDKETYPE_HOSTED_SPARSE
+        || !pImage->pGTCache
+        || pExtent->cGTEntries > VMDK_GT_CACHE_SIZE * VMDK_GT_CACHELINE_SIZE
+        || pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry])
+        return VERR_INTERNAL_ERROR;
+
+    /* Update grain table entry. */
+    pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry] = VMDK_BYTE2SECTOR(uFileOffset);
+
+    rc = vdIfIoIntFileWriteSync(pImage->pIfIo, pExtent->pFile->pStorage,
+                                uFileOffset, pvCompGrain, cbCompGrain);
+    if (RT_FAILURE(rc))
+    {
+        pExtent->uGrainSectorAbs = 0;
+        AssertRC(rc);
+        return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: cannot write compressed data block in '%s'"), pExtent->pszFullname);
+    }
+    pExtent->uLastGrainWritten = uGrain;
+    pExtent->uAppendPosition += cbCompGrain;
+
+    return rc;
+}
+
+/**
+ * Internal. Writes the grains compressed by the workers to the file, in the
+ * order they were queued.
+ *
+ * @returns VBox status code, the status of the first failed write out if any.
+ * @param   pImage          The image.
+ * @param   pExtent         The extent.
+ * @param   cMinWrite       Number of grains to write, waiting for the workers if
+ *                          necessary. All grains already compressed are written
+ *                          in addition.
+ */
+static int vmdkStreamDeflateWriteOut(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, uint32_t cMinWrite)
+{
+    PVMDKDEFLATEPOOL pPool = pExtent->pDeflatePool;
+    int rc = pPool->rcWriteOut;
+
+    while (   RT_SUCCESS(rc)
+           && pPool->cWritten != pPool->cQueued)
+    {
+        PVMDKDEFLATEJOB pJob = &pPool->paJobs[pPool->cWritten % pPool->cJobs];
+        if (!ASMAtomicReadBool(&pJob->fDone))
+        {
+            if (!cMinWrite)
+                break;
+            RTSemEventWait(pPool->hEvtDone, RT_INDEFINITE_WAIT);
+            continue;
+        }
+
+        rc = pJob->rc;
+        if (RT_SUCCESS(rc))
+            rc = vmdkStreamWriteGrain(pImage, pExtent, pJob->uGrain, pJob->pvCompGrain, pJob->cbCompGrain);
+        else
+            rc = vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: cannot write compressed data block in '%s'"), pExtent->pszFullname);
+        pPool->cWritten++;
+        if (cMinWrite)
+            cMinWrite--;
+    }
+
+    if (RT_FAILURE(rc))
+        pPool->rcWriteOut = rc;
+    return rc;
+}
+
+/**
+ * Internal. Writes all grains queued for compression to the file.
+ */
+static int vmdkStreamDeflateDrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent)
+{
+    PVMDKDEFLATEPOOL pPool = pExtent->pDeflatePool;
+
+    if (!pPool)
+        return VINF_SUCCESS;
+    return vmdkStreamDeflateWriteOut(pImage, pExtent, pPool->cQueued - pPool->cWritten);
+}
+
+/**
+ * Internal. Queues a grain for compression by the workers.
+ */
+static int vmdkStreamDeflateQueue(PVMDKIMAGE pImage, PVMDKEXTENT pExtent, uint32_t uGrain,
+                                  uint64_t uSector, PVDIOCTX pIoCtx, uint64_t cbWrite)
+{
+    PVMDKDEFLATEPOOL pPool = pExtent->pDeflatePool;
+    int rc = VINF_SUCCESS;
+
+    /* The grain table entry is only set on write out, catch a rewrite of the grain in flight. */
+    if (   pPool->fGrainQueued
+        && pPool->uGrainQueued == uGrain)
+        return VERR_INTERNAL_ERROR;
+
+    /* Make room by writing out the oldest grain. */
+    if (pPool->cQueued - pPool->cWritten == pPool->cJobs)
+        rc = vmdkStreamDeflateWriteOut(pImage, pExtent, 1);
+    else
+        rc = pPool->rcWriteOut;
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PVMDKDEFLATEJOB pJob = &pPool->paJobs[pPool->cQueued % pPool->cJobs];
+    vdIfIoIntIoCtxCopyFrom(pImage->pIfIo, pIoCtx, pJob->pvGrain, cbWrite);
+    if (cbWrite != pPool->cbGrain)
+        memset((char *)pJob->pvGrain + cbWrite, '\0', pPool->cbGrain - cbWrite);
+    pJob->uSector     = uSector;
+    pJob->uGrain      = uGrain;
+    pJob->cbCompGrain = 0;
+    pJob->rc          = VINF_SUCCESS;
+    ASMAtomicWriteBool(&pJob->fDone, false);
+    ASMAtomicIncU32(&pPool->cQueued);
+    RTSemEventSignal(pPool->hEvtWork);
+
+    pPool->fGrainQueued = true;
+    pPool->uGrainQueued = uGrain;
+    pExtent->uLastGrainAccess = uGrain;
+
+    /* Write whatever the workers finished in the meantime. */
+    return vmdkStreamDeflateWriteOut(pImage, pExtent, 0);
+}
+
 /**
  * Internal. Free all allocated space for representing an image, and optionally
  * delete the image from disk.
@@ -4293,7 +4676,9 @@ static int vmdkFreeImage(PVMDKIMAGE pImage, bool fDelete, bool fFlush)
                 && pImage->pExtents[0].uAppendPosition)
             {
                 PVMDKEXTENT pExtent = &pImage->pExtents[0];
-                uint32_t uLastGDEntry = pExtent->uLastGrainAccess / pExtent->cGTEntries;
+                rc = vmdkStreamDeflateDrain(pImage, pExtent);
+                AssertRC(rc);
+                uint32_t uLastGDEntry = pExtent->uLastGrainWritten / pExtent->cGTEntries;
                 rc = vmdkStreamFlushGT(pImage, pExtent, uLastGDEntry);
                 AssertRC(rc);
                 vmdkStreamClearGT(pImage, pExtent);
@@ -4416,6 +4801,12 @@ static int vmdkFlushImage(PVMDKIMAGE pImage, PVDIOCTX pIoCtx)
         for (unsigned i = 0; i < pImage->cExtents; i++)
         {
             pExtent = &pImage->pExtents[i];
+
+            /* Write out the grains still being compressed. */
+            rc = vmdkStreamDeflateDrain(pImage, pExtent);
+            if (RT_FAILURE(rc))
+                break;
+
             if (pExtent->pFile != NULL && pExtent->fMetaDirty)
             {
                 switch (pExtent->enmType)
@@ -4591,9 +4982,7 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
                                 uint64_t cbWrite)
 {
     uint32_t uGrain;
-    uint32_t uGDEntry, uLastGDEntry;
     uint32_t cbGrain = 0;
-    uint32_t uCacheLine, uCacheEntry;
     const void *pData;
     int rc;
 
@@ -4615,10 +5004,6 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
 
     /* Do not allow to go back. */
     uGrain = uSector / pExtent->cSectorsPerGrain;
-    uCacheLine = uGrain % pExtent->cGTEntries / VMDK_GT_CACHELINE_SIZE;
-    uCacheEntry = uGrain % VMDK_GT_CACHELINE_SIZE;
-    uGDEntry = uGrain / pExtent->cGTEntries;
-    uLastGDEntry = pExtent->uLastGrainAccess / pExtent->cGTEntries;
     if (uGrain < pExtent->uLastGrainAccess)
         return VERR_VD_VMDK_INVALID_WRITE;
 
@@ -4628,37 +5013,17 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
         && vdIfIoIntIoCtxIsZero(pImage->pIfIo, pIoCtx, cbWrite, true /* fAdvance */))
         return VINF_SUCCESS;
 
-    if (uGDEntry != uLastGDEntry)
+    /* Compress in the background if possible, the workers are set up on the first write. */
+    if (!pExtent->fDeflatePoolTried)
     {
-        rc = vmdkStreamFlushGT(pImage, pExtent, uLastGDEntry);
-        if (RT_FAILURE(rc))
-            return rc;
-        vmdkStreamClearGT(pImage, pExtent);
-        for (uint32_t i = uLastGDEntry + 1; i < uGDEntry; i++)
-        {
-            rc = vmdkStreamFlushGT(pImage, pExtent, i);
-            if (RT_FAILURE(rc))
-                return rc;
-        }
+        pExtent->fDeflatePoolTried = true;
+        rc = vmdkDeflatePoolCreate(pExtent);
+        if (RT_SUCCESS(rc))
+            LogRel(("VMDK: Compressing grains of '%s' with %u threads\n",
+                    pExtent->pszFullname, pExtent->pDeflatePool->cWorkers));
     }
-
-    uint64_t uFileOffset;
-    uFileOffset = pExtent->uAppendPosition;
-    if (!uFileOffset)
-        return VERR_INTERNAL_ERROR;
-    /* Align to sector, as the previous write could have been any size. */
-    uFileOffset = RT_ALIGN_64(uFileOffset, 512);
-
-    /* Paranoia check: extent type, grain table buffer presence and
-     * grain table buffer space. Also grain table entry must be clear. */
-    if (   pExtent->enmType != VMDKETYPE_HOSTED_SPARSE
-        || !pImage->pGTCache
-        || pExtent->cGTEntries > VMDK_GT_CACHE_SIZE * VMDK_GT_CACHELINE_SIZE
-        || pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry])
-        return VERR_INTERNAL_ERROR;
-
-    /* Update grain table entry. */
-    pImage->pGTCache->aGTCache[uCacheLine].aGTData[uCacheEntry] = VMDK_BYTE2SECTOR(uFileOffset);
+    if (pExtent->pDeflatePool)
+        return vmdkStreamDeflateQueue(pImage, pExtent, uGrain, uSector, pIoCtx, cbWrite);
 
     if (cbWrite != VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain))
     {
@@ -4678,17 +5043,18 @@ static int vmdkStreamAllocGrain(PVMDKIMAGE pImage, PVMDKEXTENT pExtent,
         Assert(cbSeg == VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain));
         pData = Segment.pvSeg;
     }
-    rc = vmdkFileDeflateSync(pImage, pExtent, uFileOffset, pData,
-                             VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain),
-                             uSector, &cbGrain);
+    rc = vmdkDeflateGrain(pExtent->pvCompGrain, pExtent->cbCompGrain, pData,
+                          VMDK_SECTOR2BYTE(pExtent->cSectorsPerGrain),
+                          uSector, &cbGrain);
     if (RT_FAILURE(rc))
     {
         pExtent->uGrainSectorAbs = 0;
         AssertRC(rc);
         return vdIfError(pImage->pIfError, rc, RT_SRC_POS, N_("VMDK: cannot write compressed data block in '%s'"), pExtent->pszFullname);
     }
-    pExtent->uLastGrainAccess = uGrain;
-    pExtent->uAppendPosition += cbGrain;
+    rc = vmdkStreamWriteGrain(pImage, pExtent, uGrain, pExtent->pvCompGrain, cbGrain);
+    if (RT_SUCCESS(rc))
+        pExtent->uLastGrainAccess = uGrain;
 
     return rc;
 }
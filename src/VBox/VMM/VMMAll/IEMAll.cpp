@@ -1154,7 +1154,10 @@ IEM_STATIC void iemReInitExec(PVMCPUCC pVCpu)
         pVCpu->iem.s.enmEffOpSize = enmMode;
     }
     pVCpu->iem.s.iEffSeg          = X86_SREG_DS;
-#ifndef IEM_WITH_CODE_TLB
+#ifdef IEM_WITH_CODE_TLB
+    /* Don't let the next instruction reuse the instruction buffer. */
+    pVCpu->iem.s.cbInstrBufTotal  = 0;
+#else
     /** @todo Shouldn't we be doing this in IEMTlbInvalidateAll()? */
     pVCpu->iem.s.offOpcode        = 0;
     pVCpu->iem.s.cbOpcode         = 0;
@@ -1314,7 +1317,8 @@ DECLINLINE(void) iemReInitDecoder(PVMCPUCC pVCpu)
     {
         uint64_t off = (pVCpu->iem.s.enmCpuMode == IEMMODE_64BIT ? pVCpu->cpum.GstCtx.rip : pVCpu->cpum.GstCtx.eip + (uint32_t)pVCpu->cpum.GstCtx.cs.u64Base)
                      - pVCpu->iem.s.uInstrBufPc;
-        if (off < pVCpu->iem.s.cbInstrBufTotal)
+        if (   off < pVCpu->iem.s.cbInstrBufTotal
+            && pVCpu->iem.s.uInstrBufPhysRev == pVCpu->iem.s.CodeTlb.uTlbPhysRev)
         {
             pVCpu->iem.s.offInstrNextByte = (uint32_t)off;
             pVCpu->iem.s.offCurInstrStart = (uint16_t)off;
@@ -1578,13 +1582,13 @@ VMM_INT_DECL(void) IEMTlbInvalidatePage(PVMCPUCC pVCpu, RTGCPTR GCPtr)
 VMM_INT_DECL(void) IEMTlbInvalidateAllPhysical(PVMCPUCC pVCpu)
 {
 #if defined(IEM_WITH_CODE_TLB) || defined(IEM_WITH_DATA_TLB)
-    /* Note! This probably won't end up looking exactly like this, but it give an idea... */
-
 # ifdef IEM_WITH_CODE_TLB
     pVCpu->iem.s.cbInstrBufTotal = 0;
 # endif
+    /* Note! A zero revision means IEMTlbInvalidateAllPhysicalAllCpus wrapped it
+             around and left the wiping of the entries to us. */
     uint64_t uTlbPhysRev = pVCpu->iem.s.CodeTlb.uTlbPhysRev + IEMTLB_PHYS_REV_INCR;
-    if (uTlbPhysRev != 0)
+    if (uTlbPhysRev > IEMTLB_PHYS_REV_INCR)
     {
         pVCpu->iem.s.CodeTlb.uTlbPhysRev = uTlbPhysRev;
         pVCpu->iem.s.DataTlb.uTlbPhysRev = uTlbPhysRev;
@@ -1619,17 +1623,35 @@ VMM_INT_DECL(void) IEMTlbInvalidateAllPhysical(PVMCPUCC pVCpu)
 
 
 /**
- * Invalidates the host physical aspects of the IEM TLBs.
+ * Invalidates the host physical aspects of the IEM TLBs of all CPUs.
  *
- * This is called internally as well as by PGM when moving GC mappings.
+ * This is called by PGM whenever it invalidates its page mapping TLBs, i.e.
+ * when pages are allocated, freed, remapped, aliased and such, and when
+ * access handlers catching reads are installed.
+ *
+ * Since the other EMTs may be executing code, we only bump the revision here.
+ * Should it wrap around, it is set to zero and the owning EMT will wipe the
+ * entries the next time it looks at the code TLB.
  *
  * @param   pVM         The cross context VM structure.
  *
  * @remarks Caller holds the PGM lock.
  */
-VMM_INT_DECL(void) IEMTlbInvalidateAllPhysicalAllCpus(PVM pVM)
+VMM_INT_DECL(void) IEMTlbInvalidateAllPhysicalAllCpus(PVMCC pVM)
 {
+#if defined(IEM_WITH_CODE_TLB) || defined(IEM_WITH_DATA_TLB)
+    VMCC_FOR_EACH_VMCPU(pVM)
+    {
+        uint64_t uTlbPhysRev = pVCpu->iem.s.CodeTlb.uTlbPhysRev + IEMTLB_PHYS_REV_INCR;
+        if (uTlbPhysRev <= IEMTLB_PHYS_REV_INCR)
+            uTlbPhysRev = 0;
+        ASMAtomicWriteU64(&pVCpu->iem.s.CodeTlb.uTlbPhysRev, uTlbPhysRev);
+        ASMAtomicWriteU64(&pVCpu->iem.s.DataTlb.uTlbPhysRev, uTlbPhysRev);
+    }
+    VMCC_FOR_EACH_VMCPU_END(pVM);
+#else
     RT_NOREF_PV(pVM);
+#endif
 }
 
 #ifdef IEM_WITH_CODE_TLB
@@ -1653,7 +1675,6 @@ VMM_INT_DECL(void) IEMTlbInvalidateAllPhysicalAllCpus(PVM pVM)
  */
 IEM_STATIC void iemOpcodeFetchBytesJmp(PVMCPUCC pVCpu, size_t cbDst, void *pvDst)
 {
-#ifdef IN_RING3
     for (;;)
     {
         Assert(cbDst <= 8);
@@ -1668,16 +1689,29 @@ IEM_STATIC void iemOpcodeFetchBytesJmp(PVMCPUCC pVCpu, size_t cbDst, void *pvDst
             if (offBuf < pVCpu->iem.s.cbInstrBuf)
             {
                 Assert(offBuf + cbDst > pVCpu->iem.s.cbInstrBuf);
-                uint32_t const cbCopy = pVCpu->iem.s.cbInstrBuf - pVCpu->iem.s.offInstrNextByte;
+                uint32_t const cbCopy = pVCpu->iem.s.cbInstrBuf - offBuf;
                 memcpy(pvDst, &pVCpu->iem.s.pbInstrBuf[offBuf], cbCopy);
 
                 cbDst  -= cbCopy;
                 pvDst   = (uint8_t *)pvDst + cbCopy;
                 offBuf += cbCopy;
-                pVCpu->iem.s.offInstrNextByte += offBuf;
+                pVCpu->iem.s.offInstrNextByte = offBuf;
             }
         }
 
+        /*
+         * Instructions are limited to 15 bytes.  The cbInstrBuf value only takes
+         * care of this while we stay within the same buffer, so check it here.
+         */
+        uint32_t const cbInstr = offBuf - (uint32_t)(int32_t)pVCpu->iem.s.offCurInstrStart;
+        if (RT_LIKELY(cbInstr + cbDst <= 15))
+        { /* likely */ }
+        else
+        {
+            Log(("iemOpcodeFetchBytesJmp: %#x + %#x bytes -> #GP(0)\n", cbInstr, cbDst));
+            iemRaiseGeneralProtectionFault0Jmp(pVCpu);
+        }
+
         /*
          * Check segment limit, figuring how much we're allowed to access at this point.
          *
@@ -1689,7 +1723,7 @@ IEM_STATIC void iemOpcodeFetchBytesJmp(PVMCPUCC pVCpu, size_t cbDst, void *pvDst
         uint32_t cbMaxRead;
         if (pVCpu->iem.s.enmCpuMode == IEMMODE_64BIT)
         {
-            GCPtrFirst = pVCpu->cpum.GstCtx.rip + (offBuf - (uint32_t)(int32_t)pVCpu->iem.s.offCurInstrStart);
+            GCPtrFirst = pVCpu->cpum.GstCtx.rip + cbInstr;
             if (RT_LIKELY(IEM_IS_CANONICAL(GCPtrFirst)))
             { /* likely */ }
             else
@@ -1698,7 +1732,7 @@ IEM_STATIC void iemOpcodeFetchBytesJmp(PVMCPUCC pVCpu, size_t cbDst, void *pvDst
         }
         else
         {
-            GCPtrFirst = pVCpu->cpum.GstCtx.eip + (offBuf - (uint32_t)(int32_t)pVCpu->iem.s.offCurInstrStart);
+            GCPtrFirst = pVCpu->cpum.GstCtx.eip + cbInstr;
             Assert(!(GCPtrFirst & ~(uint32_t)UINT16_MAX) || pVCpu->iem.s.enmCpuMode == IEMMODE_32BIT);
             if (RT_LIKELY((uint32_t)GCPtrFirst <= pVCpu->cpum.GstCtx.cs.u32Limit))
             { /* likely */ }
@@ -1720,6 +1754,15 @@ IEM_STATIC void iemOpcodeFetchBytesJmp(PVMCPUCC pVCpu, size_t cbDst, void *pvDst
             /** @todo testcase: unreal modes, both huge 16-bit and 32-bit. */
         }
 
+        /*
+         * A zero physical revision means IEMTlbInvalidateAllPhysicalAllCpus
+         * wrapped it around and we must wipe the entries before using them.
+         */
+        if (RT_LIKELY(pVCpu->iem.s.CodeTlb.uTlbPhysRev != 0))
+        { /* likely */ }
+        else
+            IEMTlbInvalidateAllPhysical(pVCpu);
+
         /*
          * Get the TLB entry for this piece of code.
          */
@@ -1771,113 +1814,145 @@ IEM_STATIC void iemOpcodeFetchBytesJmp(PVMCPUCC pVCpu, size_t cbDst, void *pvDst
 
         /*
          * Look up the physical page info if necessary.
+         *
+         * The TLB entries are shared by ring-3 and ring-0 and only cache ring-3
+         * mappings, so ring-0 asks PGM every time and leaves the entry alone.
          */
+        AssertCompile(PGMIEMGCPHYS2PTR_F_NO_WRITE     == IEMTLBE_F_PG_NO_WRITE);
+        AssertCompile(PGMIEMGCPHYS2PTR_F_NO_READ      == IEMTLBE_F_PG_NO_READ);
+        AssertCompile(PGMIEMGCPHYS2PTR_F_NO_MAPPINGR3 == IEMTLBE_F_NO_MAPPINGR3);
+        uint64_t        fPhys;
+        uint8_t const  *pbMapping;
+# ifdef IN_RING3
         if ((pTlbe->fFlagsAndPhysRev & IEMTLBE_F_PHYS_REV) == pVCpu->iem.s.CodeTlb.uTlbPhysRev)
         { /* not necessary */ }
         else
         {
-            AssertCompile(PGMIEMGCPHYS2PTR_F_NO_WRITE     == IEMTLBE_F_PG_NO_WRITE);
-            AssertCompile(PGMIEMGCPHYS2PTR_F_NO_READ      == IEMTLBE_F_PG_NO_READ);
-            AssertCompile(PGMIEMGCPHYS2PTR_F_NO_MAPPINGR3 == IEMTLBE_F_NO_MAPPINGR3);
             pTlbe->fFlagsAndPhysRev &= ~(  IEMTLBE_F_PHYS_REV
                                          | IEMTLBE_F_NO_MAPPINGR3 | IEMTLBE_F_PG_NO_READ | IEMTLBE_F_PG_NO_WRITE);
             int rc = PGMPhysIemGCPhys2PtrNoLock(pVCpu->CTX_SUFF(pVM), pVCpu, pTlbe->GCPhys, &pVCpu->iem.s.CodeTlb.uTlbPhysRev,
                                                 &pTlbe->pbMappingR3, &pTlbe->fFlagsAndPhysRev);
             AssertRCStmt(rc, longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), rc));
         }
+        fPhys     = pTlbe->fFlagsAndPhysRev;
+        pbMapping = pTlbe->pbMappingR3;
+# else
+        {
+#  ifdef VBOX_WITH_2X_4GB_ADDR_SPACE_IN_R0
+            R3PTRTYPE(uint8_t *)   pbTmp = NIL_RTR3PTR;
+#  else
+            R3R0PTRTYPE(uint8_t *) pbTmp = NULL;
+#  endif
+            fPhys = 0;
+            int rc = PGMPhysIemGCPhys2PtrNoLock(pVCpu->CTX_SUFF(pVM), pVCpu, pTlbe->GCPhys, &pVCpu->iem.s.CodeTlb.uTlbPhysRev,
+                                                &pbTmp, &fPhys);
+            AssertRCStmt(rc, longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), rc));
+            pbMapping = (uint8_t const *)(uintptr_t)pbTmp;
+        }
+# endif
 
 # if defined(IN_RING3) || (defined(IN_RING0) && !defined(VBOX_WITH_2X_4GB_ADDR_SPACE))
         /*
-         * Try do a direct read using the pbMappingR3 pointer.
+         * Try do a direct read using the page mapping.
          */
-        if (    (pTlbe->fFlagsAndPhysRev & (IEMTLBE_F_PHYS_REV | IEMTLBE_F_NO_MAPPINGR3 | IEMTLBE_F_PG_NO_READ))
+        if (    (fPhys & (IEMTLBE_F_PHYS_REV | IEMTLBE_F_NO_MAPPINGR3 | IEMTLBE_F_PG_NO_READ))
              == pVCpu->iem.s.CodeTlb.uTlbPhysRev)
         {
             uint32_t const offPg = (GCPtrFirst & X86_PAGE_OFFSET_MASK);
             pVCpu->iem.s.cbInstrBufTotal  = offPg + cbMaxRead;
-            if (offBuf == (uint32_t)(int32_t)pVCpu->iem.s.offCurInstrStart)
+            if (cbInstr == 0)
             {
                 pVCpu->iem.s.cbInstrBuf       = offPg + RT_MIN(15, cbMaxRead);
                 pVCpu->iem.s.offCurInstrStart = (int16_t)offPg;
             }
             else
             {
-                uint32_t const cbInstr = offBuf - (uint32_t)(int32_t)pVCpu->iem.s.offCurInstrStart;
-                Assert(cbInstr < cbMaxRead);
                 pVCpu->iem.s.cbInstrBuf       = offPg + RT_MIN(cbMaxRead + cbInstr, 15) - cbInstr;
                 pVCpu->iem.s.offCurInstrStart = (int16_t)(offPg - cbInstr);
             }
+            pVCpu->iem.s.uInstrBufPc      = GCPtrFirst & ~(RTGCPTR)X86_PAGE_OFFSET_MASK;
+            pVCpu->iem.s.uInstrBufPhysRev = fPhys & IEMTLBE_F_PHYS_REV;
             if (cbDst <= cbMaxRead)
             {
                 pVCpu->iem.s.offInstrNextByte = offPg + (uint32_t)cbDst;
-                pVCpu->iem.s.uInstrBufPc      = GCPtrFirst & ~(RTGCPTR)X86_PAGE_OFFSET_MASK;
-                pVCpu->iem.s.pbInstrBuf       = pTlbe->pbMappingR3;
-                memcpy(pvDst, &pTlbe->pbMappingR3[offPg], cbDst);
+                pVCpu->iem.s.pbInstrBuf       = pbMapping;
+                memcpy(pvDst, &pbMapping[offPg], cbDst);
                 return;
             }
             pVCpu->iem.s.pbInstrBuf = NULL;
 
-            memcpy(pvDst, &pTlbe->pbMappingR3[offPg], cbMaxRead);
+            memcpy(pvDst, &pbMapping[offPg], cbMaxRead);
             pVCpu->iem.s.offInstrNextByte = offPg + cbMaxRead;
         }
         else
+# else
+        RT_NOREF(pbMapping);
 # endif
-#if 0
-        /*
-         * If there is no special read handling, so we can read a bit more and
-         * put it in the prefetch buffer.
-         */
-        if (   cbDst < cbMaxRead
-            && (pTlbe->fFlagsAndPhysRev & (IEMTLBE_F_PHYS_REV | IEMTLBE_F_PG_NO_READ)) == pVCpu->iem.s.CodeTlb.uTlbPhysRev)
         {
-            VBOXSTRICTRC rcStrict = PGMPhysRead(pVCpu->CTX_SUFF(pVM), pTlbe->GCPhys,
-                                                &pVCpu->iem.s.abOpcode[0], cbToTryRead, PGMACCESSORIGIN_IEM);
-            if (RT_LIKELY(rcStrict == VINF_SUCCESS))
-            { /* likely */ }
-            else if (PGM_PHYS_RW_IS_SUCCESS(rcStrict))
+            /*
+             * Read the bytes thru PGM.
+             *
+             * If there is no special read handling, we read what's left of the
+             * instruction into abOpcode and decode it from there.  Otherwise (MMIO
+             * and such) only exactly what's needed is read, which is a highly
+             * unlikely scenario.
+             */
+            bool const     fPrefetch = cbDst <= cbMaxRead
+                                    &&    (fPhys & (IEMTLBE_F_PHYS_REV | IEMTLBE_F_PG_NO_READ))
+                                       == pVCpu->iem.s.CodeTlb.uTlbPhysRev;
+            uint32_t const cbToRead  = fPrefetch ? RT_MIN(cbMaxRead, 15 - cbInstr) : RT_MIN((uint32_t)cbDst, cbMaxRead);
+            void          *pvRead    = fPrefetch ? (void *)&pVCpu->iem.s.abOpcode[0] : pvDst;
+            RTGCPHYS const GCPhys    = pTlbe->GCPhys + (GCPtrFirst & X86_PAGE_OFFSET_MASK);
+            if (!fPrefetch)
+                pVCpu->iem.s.CodeTlb.cTlbSlowReadPath++;
+            if (!pVCpu->iem.s.fBypassHandlers)
             {
-                Log(("iemOpcodeFetchMoreBytes: %RGv/%RGp LB %#x - read status -  rcStrict=%Rrc\n",
-                     GCPtrNext, GCPhys, VBOXSTRICTRC_VAL(rcStrict), cbToTryRead));
-                rcStrict = iemSetPassUpStatus(pVCpu, rcStrict);
-                AssertStmt(rcStrict == VINF_SUCCESS, longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), VBOXSTRICRC_VAL(rcStrict)));
+                VBOXSTRICTRC rcStrict = PGMPhysRead(pVCpu->CTX_SUFF(pVM), GCPhys, pvRead, cbToRead, PGMACCESSORIGIN_IEM);
+                if (RT_LIKELY(rcStrict == VINF_SUCCESS))
+                { /* likely */ }
+                else if (PGM_PHYS_RW_IS_SUCCESS(rcStrict))
+                {
+                    Log(("iemOpcodeFetchMoreBytes: %RGv/%RGp LB %#x - read status -  rcStrict=%Rrc\n",
+                         GCPtrFirst, GCPhys, VBOXSTRICTRC_VAL(rcStrict), cbToRead));
+                    rcStrict = iemSetPassUpStatus(pVCpu, rcStrict);
+                    AssertStmt(rcStrict == VINF_SUCCESS, longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), VBOXSTRICTRC_VAL(rcStrict)));
+                }
+                else
+                {
+                    Log((RT_SUCCESS(rcStrict)
+                         ? "iemOpcodeFetchMoreBytes: %RGv/%RGp LB %#x - read status - rcStrict=%Rrc\n"
+                         : "iemOpcodeFetchMoreBytes: %RGv/%RGp LB %#x - read error - rcStrict=%Rrc (!!)\n",
+                         GCPtrFirst, GCPhys, VBOXSTRICTRC_VAL(rcStrict), cbToRead));
+                    longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), VBOXSTRICTRC_VAL(rcStrict));
+                }
             }
             else
             {
-                Log((RT_SUCCESS(rcStrict)
-                     ? "iemOpcodeFetchMoreBytes: %RGv/%RGp LB %#x - read status - rcStrict=%Rrc\n"
-                     : "iemOpcodeFetchMoreBytes: %RGv/%RGp LB %#x - read error - rcStrict=%Rrc (!!)\n",
-                     GCPtrNext, GCPhys, VBOXSTRICTRC_VAL(rcStrict), cbToTryRead));
-                longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), VBOXSTRICTRC_VAL(rcStrict));
-            }
-        }
-        /*
-         * Special read handling, so only read exactly what's needed.
-         * This is a highly unlikely scenario.
-         */
-        else
-#endif
-        {
-            pVCpu->iem.s.CodeTlb.cTlbSlowReadPath++;
-            uint32_t const cbToRead = RT_MIN((uint32_t)cbDst, cbMaxRead);
-            VBOXSTRICTRC rcStrict = PGMPhysRead(pVCpu->CTX_SUFF(pVM), pTlbe->GCPhys + (GCPtrFirst & X86_PAGE_OFFSET_MASK),
-                                                pvDst, cbToRead, PGMACCESSORIGIN_IEM);
-            if (RT_LIKELY(rcStrict == VINF_SUCCESS))
-            { /* likely */ }
-            else if (PGM_PHYS_RW_IS_SUCCESS(rcStrict))
-            {
-                Log(("iemOpcodeFetchMoreBytes: %RGv/%RGp LB %#x - read status -  rcStrict=%Rrc\n",
-                     GCPtrFirst, pTlbe->GCPhys + (GCPtrFirst & X86_PAGE_OFFSET_MASK), VBOXSTRICTRC_VAL(rcStrict), cbToRead));
-                rcStrict = iemSetPassUpStatus(pVCpu, rcStrict);
-                AssertStmt(rcStrict == VINF_SUCCESS, longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), VBOXSTRICTRC_VAL(rcStrict)));
+                int rc = PGMPhysSimpleReadGCPhys(pVCpu->CTX_SUFF(pVM), pvRead, GCPhys, cbToRead);
+                if (RT_SUCCESS(rc))
+                { /* likely */ }
+                else
+                {
+                    Log(("iemOpcodeFetchMoreBytes: %RGv - read error - rc=%Rrc (!!)\n", GCPtrFirst, rc));
+                    longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), rc);
+                }
             }
-            else
+
+            if (fPrefetch)
             {
-                Log((RT_SUCCESS(rcStrict)
-                     ? "iemOpcodeFetchMoreBytes: %RGv/%RGp LB %#x - read status - rcStrict=%Rrc\n"
-                     : "iemOpcodeFetchMoreBytes: %RGv/%RGp LB %#x - read error - rcStrict=%Rrc (!!)\n",
-                     GCPtrFirst, pTlbe->GCPhys + (GCPtrFirst & X86_PAGE_OFFSET_MASK), VBOXSTRICTRC_VAL(rcStrict), cbToRead));
-                longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), VBOXSTRICTRC_VAL(rcStrict));
+                /* The buffer is specific to this instruction, so cbInstrBufTotal
+                   is zero to keep iemReInitDecoder from reusing it. */
+                pVCpu->iem.s.pbInstrBuf       = &pVCpu->iem.s.abOpcode[0];
+                pVCpu->iem.s.uInstrBufPc      = GCPtrFirst;
+                pVCpu->iem.s.cbInstrBufTotal  = 0;
+                pVCpu->iem.s.cbInstrBuf       = cbToRead;
+                pVCpu->iem.s.offCurInstrStart = (int16_t)(0 - cbInstr);
+                pVCpu->iem.s.offInstrNextByte = (uint32_t)cbDst;
+                memcpy(pvDst, pvRead, cbDst);
+                return;
             }
+
+            pVCpu->iem.s.pbInstrBuf       = NULL;
             pVCpu->iem.s.offInstrNextByte = offBuf + cbToRead;
             if (cbToRead == cbDst)
                 return;
@@ -1889,12 +1964,41 @@ IEM_STATIC void iemOpcodeFetchBytesJmp(PVMCPUCC pVCpu, size_t cbDst, void *pvDst
         cbDst -= cbMaxRead;
         pvDst  = (uint8_t *)pvDst + cbMaxRead;
     }
-#else
-    RT_NOREF(pvDst, cbDst);
-    longjmp(*CTX_SUFF(pVCpu->iem.s.pJmpBuf), VERR_INTERNAL_ERROR);
-#endif
 }
 
+
+# if defined(VBOX_WITH_NESTED_HWVIRT_VMX) || defined(VBOX_WITH_NESTED_HWVIRT_SVM)
+/**
+ * Gets a byte of the current instruction given its offset from the start of it.
+ *
+ * The byte is taken from the instruction buffer when it is still there, which
+ * isn't the case for instructions crossing a page boundrary or ones fetched via
+ * the slow path, in which case it is read from guest memory again.
+ *
+ * @returns The opcode byte.
+ * @param   pVCpu               The cross context virtual CPU structure of the calling thread.
+ * @param   offInstr            The offset of the byte relative to the start of the
+ *                              current instruction.
+ */
+IEM_STATIC uint8_t iemOpcodeGetCurInstrByte(PVMCPUCC pVCpu, uint8_t offInstr)
+{
+    Assert(offInstr < IEM_GET_INSTR_LEN(pVCpu));
+    int32_t const offBuf = (int32_t)pVCpu->iem.s.offCurInstrStart + offInstr;
+    if (   pVCpu->iem.s.pbInstrBuf != NULL
+        && offBuf >= 0
+        && (uint32_t)offBuf < pVCpu->iem.s.offInstrNextByte)
+        return pVCpu->iem.s.pbInstrBuf[offBuf];
+
+    RTGCPTR const GCPtr = pVCpu->iem.s.enmCpuMode == IEMMODE_64BIT
+                        ? pVCpu->cpum.GstCtx.rip + offInstr
+                        : (uint32_t)(pVCpu->cpum.GstCtx.eip + offInstr) + (uint32_t)pVCpu->cpum.GstCtx.cs.u64Base;
+    uint8_t bRet = 0;
+    int rc = PGMPhysSimpleReadGCPtr(pVCpu, &bRet, GCPtr, sizeof(bRet));
+    AssertRC(rc);
+    return bRet;
+}
+# endif
+
 #else
 
 /**
@@ -2388,7 +2492,7 @@ DECLINLINE(uint8_t) iemOpcodeGetNextRmJmp(PVMCPUCC pVCpu)
 {
 # ifdef IEM_WITH_CODE_TLB
     uintptr_t       offBuf = pVCpu->iem.s.offInstrNextByte;
-    pVCpu->iem.s.offModRm  = offBuf;
+    pVCpu->iem.s.offModRm  = (uint8_t)(offBuf - (uint32_t)(int32_t)pVCpu->iem.s.offCurInstrStart);
     uint8_t const  *pbBuf  = pVCpu->iem.s.pbInstrBuf;
     if (RT_LIKELY(   pbBuf != NULL
                   && offBuf < pVCpu->iem.s.cbInstrBuf))
@@ -13702,6 +13806,9 @@ IEM_STATIC RTGCPTR iemOpHlpCalcRmEffAddrJmp(PVMCPUCC pVCpu, uint8_t bRm, uint8_t
  * Include the instructions
  */
 #include "IEMAllInstructions.cpp.h"
+#ifdef IEM_WITH_THREADED_EXEC
+# include "IEMAllThreaded.cpp.h"
+#endif
 
 
 
@@ -14111,6 +14218,7 @@ VMMDECL(VBOXSTRICTRC) IEMExecOneWithPrefetchedByPC(PVMCPUCC pVCpu, PCPUMCTXCORE
         pVCpu->iem.s.uInstrBufPc      = OpcodeBytesPC;
         pVCpu->iem.s.pbInstrBuf       = (uint8_t const *)pvOpcodeBytes;
         pVCpu->iem.s.cbInstrBufTotal  = (uint16_t)RT_MIN(X86_PAGE_SIZE, cbOpcodeBytes);
+        pVCpu->iem.s.cbInstrBuf       = (uint16_t)RT_MIN(15, cbOpcodeBytes);
         pVCpu->iem.s.offCurInstrStart = 0;
         pVCpu->iem.s.offInstrNextByte = 0;
 #else
@@ -14163,6 +14271,7 @@ VMMDECL(VBOXSTRICTRC) IEMExecOneBypassWithPrefetchedByPC(PVMCPUCC pVCpu, PCPUMCT
         pVCpu->iem.s.uInstrBufPc      = OpcodeBytesPC;
         pVCpu->iem.s.pbInstrBuf       = (uint8_t const *)pvOpcodeBytes;
         pVCpu->iem.s.cbInstrBufTotal  = (uint16_t)RT_MIN(X86_PAGE_SIZE, cbOpcodeBytes);
+        pVCpu->iem.s.cbInstrBuf       = (uint16_t)RT_MIN(15, cbOpcodeBytes);
         pVCpu->iem.s.offCurInstrStart = 0;
         pVCpu->iem.s.offInstrNextByte = 0;
 #else
@@ -14211,6 +14320,7 @@ VMMDECL(VBOXSTRICTRC) IEMExecOneBypassWithPrefetchedByPCWritten(PVMCPUCC pVCpu,
         pVCpu->iem.s.uInstrBufPc      = OpcodeBytesPC;
         pVCpu->iem.s.pbInstrBuf       = (uint8_t const *)pvOpcodeBytes;
         pVCpu->iem.s.cbInstrBufTotal  = (uint16_t)RT_MIN(X86_PAGE_SIZE, cbOpcodeBytes);
+        pVCpu->iem.s.cbInstrBuf       = (uint16_t)RT_MIN(15, cbOpcodeBytes);
         pVCpu->iem.s.offCurInstrStart = 0;
         pVCpu->iem.s.offInstrNextByte = 0;
 #else
@@ -14305,6 +14415,11 @@ VMMDECL(VBOXSTRICTRC) IEMExecLots(PVMCPUCC pVCpu, uint32_t cMaxInstructions, uin
              */
             uint32_t cMaxInstructionsGccStupidity = cMaxInstructions;
             PVMCC pVM = pVCpu->CTX_SUFF(pVM);
+#ifdef IEM_WITH_THREADED_EXEC
+            PIEMTBCACHE const pTbCache = pVCpu->iem.s.pTbCacheR3;
+            if (pTbCache)
+                iemTbExecStart(pTbCache);
+#endif
             for (;;)
             {
                 /*
@@ -14317,8 +14432,15 @@ VMMDECL(VBOXSTRICTRC) IEMExecLots(PVMCPUCC pVCpu, uint32_t cMaxInstructions, uin
                 /*
                  * Do the decoding and emulation.
                  */
-                uint8_t b; IEM_OPCODE_GET_NEXT_U8(&b);
-                rcStrict = FNIEMOP_CALL(g_apfnOneByteMap[b]);
+#ifdef IEM_WITH_THREADED_EXEC
+                if (pTbCache)
+                    rcStrict = iemTbExecInstr(pVCpu, pTbCache);
+                else
+#endif
+                {
+                    uint8_t b; IEM_OPCODE_GET_NEXT_U8(&b);
+                    rcStrict = FNIEMOP_CALL(g_apfnOneByteMap[b]);
+                }
                 if (RT_LIKELY(rcStrict == VINF_SUCCESS))
                 {
                     Assert(pVCpu->iem.s.cActiveMappings == 0);
@@ -917,12 +917,10 @@ IEM_STATIC VBOXSTRICTRC iemHandleSvmEventIntercept(PVMCPUCC pVCpu, uint8_t u8Vec
         {
             PSVMVMCBCTRL  pVmcbCtrl = &pVCpu->cpum.GstCtx.hwvirt.svm.CTX_SUFF(pVmcb)->ctrl;
 # ifdef IEM_WITH_CODE_TLB
-            uint8_t const *pbInstrBuf = pVCpu->iem.s.pbInstrBuf;
-            uint8_t const  cbInstrBuf = pVCpu->iem.s.cbInstrBuf;
-            pVmcbCtrl->cbInstrFetched = RT_MIN(cbInstrBuf, SVM_CTRL_GUEST_INSTR_BYTES_MAX);
-            if (   pbInstrBuf
-                && cbInstrBuf > 0)
-                memcpy(&pVmcbCtrl->abInstr[0], pbInstrBuf, pVmcbCtrl->cbInstrFetched);
+            uint8_t const cbInstr     = (uint8_t)IEM_GET_INSTR_LEN(pVCpu);
+            pVmcbCtrl->cbInstrFetched = RT_MIN(cbInstr, SVM_CTRL_GUEST_INSTR_BYTES_MAX);
+            for (uint8_t offInstr = 0; offInstr < pVmcbCtrl->cbInstrFetched; offInstr++)
+                pVmcbCtrl->abInstr[offInstr] = iemOpcodeGetCurInstrByte(pVCpu, offInstr);
 # else
             uint8_t const cbOpcode    = pVCpu->iem.s.cbOpcode;
             pVmcbCtrl->cbInstrFetched = RT_MIN(cbOpcode, SVM_CTRL_GUEST_INSTR_BYTES_MAX);
@@ -25,15 +25,61 @@
  * relative offsets.
  */
 # ifdef IEM_WITH_CODE_TLB
-#  define IEM_MODRM_GET_U8(a_pVCpu, a_bModRm, a_offModRm)         do { } while (0)
-#  define IEM_SIB_GET_U8(a_pVCpu, a_bSib, a_offSib)               do { } while (0)
-#  define IEM_DISP_GET_U16(a_pVCpu, a_u16Disp, a_offDisp)         do { } while (0)
-#  define IEM_DISP_GET_S8_SX_U16(a_pVCpu, a_u16Disp, a_offDisp)   do { } while (0)
-#  define IEM_DISP_GET_U32(a_pVCpu, a_u32Disp, a_offDisp)         do { } while (0)
-#  define IEM_DISP_GET_S8_SX_U32(a_pVCpu, a_u32Disp, a_offDisp)   do { } while (0)
-#  define IEM_DISP_GET_S32_SX_U64(a_pVCpu, a_u64Disp, a_offDisp)  do { } while (0)
-#  define IEM_DISP_GET_S8_SX_U64(a_pVCpu, a_u64Disp, a_offDisp)   do { } while (0)
-#  error "Implement me: Getting ModR/M, SIB, displacement needs to work even when instruction crosses a page boundary."
+/* Note! The instruction may cross a page boundrary, so the bytes may no longer
+         be in the instruction buffer and we have to use iemOpcodeGetCurInstrByte. */
+#  define IEM_MODRM_GET_U8(a_pVCpu, a_bModRm, a_offModRm) \
+    do \
+    { \
+        (a_bModRm) = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offModRm)); \
+    } while (0)
+
+#  define IEM_SIB_GET_U8(a_pVCpu, a_bSib, a_offSib)      IEM_MODRM_GET_U8(a_pVCpu, a_bSib, a_offSib)
+
+#  define IEM_DISP_GET_U16(a_pVCpu, a_u16Disp, a_offDisp) \
+    do \
+    { \
+        uint8_t const bTmpLo = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp)); \
+        uint8_t const bTmpHi = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp) + 1); \
+        (a_u16Disp) = RT_MAKE_U16(bTmpLo, bTmpHi); \
+    } while (0)
+
+#  define IEM_DISP_GET_S8_SX_U16(a_pVCpu, a_u16Disp, a_offDisp) \
+    do \
+    { \
+        (a_u16Disp) = (int8_t)iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp)); \
+    } while (0)
+
+#  define IEM_DISP_GET_U32(a_pVCpu, a_u32Disp, a_offDisp) \
+    do \
+    { \
+        uint8_t const bTmp0 = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp)); \
+        uint8_t const bTmp1 = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp) + 1); \
+        uint8_t const bTmp2 = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp) + 2); \
+        uint8_t const bTmp3 = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp) + 3); \
+        (a_u32Disp) = RT_MAKE_U32_FROM_U8(bTmp0, bTmp1, bTmp2, bTmp3); \
+    } while (0)
+
+#  define IEM_DISP_GET_S8_SX_U32(a_pVCpu, a_u32Disp, a_offDisp) \
+    do \
+    { \
+        (a_u32Disp) = (int8_t)iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp)); \
+    } while (0)
+
+#  define IEM_DISP_GET_S8_SX_U64(a_pVCpu, a_u64Disp, a_offDisp) \
+    do \
+    { \
+        (a_u64Disp) = (int8_t)iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp)); \
+    } while (0)
+
+#  define IEM_DISP_GET_S32_SX_U64(a_pVCpu, a_u64Disp, a_offDisp) \
+    do \
+    { \
+        uint8_t const bTmp0 = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp)); \
+        uint8_t const bTmp1 = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp) + 1); \
+        uint8_t const bTmp2 = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp) + 2); \
+        uint8_t const bTmp3 = iemOpcodeGetCurInstrByte((a_pVCpu), (a_offDisp) + 3); \
+        (a_u64Disp) = (int32_t)RT_MAKE_U32_FROM_U8(bTmp0, bTmp1, bTmp2, bTmp3); \
+    } while (0)
 # else  /* !IEM_WITH_CODE_TLB */
 #  define IEM_MODRM_GET_U8(a_pVCpu, a_bModRm, a_offModRm) \
     do \
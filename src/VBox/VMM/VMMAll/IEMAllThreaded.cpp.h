@@ -0,0 +1,987 @@
+/* $Id: IEMAllThreaded.cpp.h $ */
+/** @file
+ * IEM - Threaded Execution using Translation Blocks.
+ */
+
+/*
+ * Copyright (C) 2011-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/** @page pg_iem_threaded  IEM - Threaded Execution
+ *
+ * When IEM/ThreadedExec is enabled, IEMExecLots runs guest code thru a per-CPU
+ * cache of translation blocks (IEMTB).  A block is a run of straight-line code
+ * within one guest page, recorded while interpreting it the normal way the
+ * first time.  For each instruction the block keeps a call entry (IEMTBCALL).
+ * Register-only forms of the most common loop instructions (ALU, MOV, INC/DEC,
+ * Jcc and JMP) get a threaded function which replays the IEM_MC microcode of
+ * the instruction with the operands the decoder ended up with, everything else
+ * is decoded again from the guest page by the generic entry.
+ *
+ * Blocks are keyed by flat PC, CPU mode and CPL, and a copy of the opcode bytes
+ * is compared with the guest page every time a block is entered.  When an
+ * instruction in the block may have written guest memory the rest of the block
+ * is compared again before continuing, so self modifying code is caught.  The
+ * block executed next is remembered (chaining) to skip the hash lookup.  When
+ * the cache is full it is flushed as a whole, which keeps the chaining
+ * pointers simple.
+ *
+ * The instructions are still executed one by one by IEMExecLots, so force flag
+ * and timer polling granularity is unchanged.
+ */
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** @name IEMTBFUNC_XXX - Threaded functions (IEMTBCALL::idxFunc).
+ * @{ */
+#define IEMTBFUNC_GENERIC       0
+#define IEMTBFUNC_BIN_U8        1
+#define IEMTBFUNC_BIN_U16       2
+#define IEMTBFUNC_BIN_U32       3
+#define IEMTBFUNC_BIN_U64       4
+#define IEMTBFUNC_UNARY_U16     5
+#define IEMTBFUNC_UNARY_U32     6
+#define IEMTBFUNC_MOV_U8        7
+#define IEMTBFUNC_MOV_U16       8
+#define IEMTBFUNC_MOV_U32       9
+#define IEMTBFUNC_MOV_U64       10
+#define IEMTBFUNC_MOV_IMM_U8    11
+#define IEMTBFUNC_MOV_IMM_U16   12
+#define IEMTBFUNC_MOV_IMM_U32   13
+#define IEMTBFUNC_MOV_IMM_U64   14
+#define IEMTBFUNC_JCC_S8        15
+#define IEMTBFUNC_JCC_S16       16
+#define IEMTBFUNC_JCC_S32       17
+#define IEMTBFUNC_JMP_S8        18
+#define IEMTBFUNC_JMP_S16       19
+#define IEMTBFUNC_JMP_S32       20
+#define IEMTBFUNC_END           21
+/** @} */
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * A threaded function.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling thread.
+ * @param   pCall       The pre-decoded instruction.
+ */
+typedef VBOXSTRICTRC FNIEMTBFUNC(PVMCPUCC pVCpu, PCIEMTBCALL pCall);
+/** Pointer to a threaded function. */
+typedef FNIEMTBFUNC *PFNIEMTBFUNC;
+
+
+/*********************************************************************************************************************************
+*   Threaded Functions                                                                                                           *
+*********************************************************************************************************************************/
+
+/** ADD, OR, ADC, SBB, AND, SUB, XOR, CMP and TEST on byte registers. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_BinU8(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    PCIEMOPBINSIZES const pImpl = (PCIEMOPBINSIZES)(uintptr_t)pCall->uParam;
+    IEM_MC_BEGIN(3, 0);
+    IEM_MC_ARG(uint8_t *,  pu8Dst,  0);
+    IEM_MC_ARG(uint8_t,    u8Src,   1);
+    IEM_MC_ARG(uint32_t *, pEFlags, 2);
+
+    IEM_MC_FETCH_GREG_U8(u8Src, pCall->iReg2);
+    IEM_MC_REF_GREG_U8(pu8Dst, pCall->iReg1);
+    IEM_MC_REF_EFLAGS(pEFlags);
+    IEM_MC_CALL_VOID_AIMPL_3(pImpl->pfnNormalU8, pu8Dst, u8Src, pEFlags);
+
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** ADD, OR, ADC, SBB, AND, SUB, XOR, CMP and TEST on word registers. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_BinU16(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    PCIEMOPBINSIZES const pImpl = (PCIEMOPBINSIZES)(uintptr_t)pCall->uParam;
+    IEM_MC_BEGIN(3, 0);
+    IEM_MC_ARG(uint16_t *, pu16Dst, 0);
+    IEM_MC_ARG(uint16_t,   u16Src,  1);
+    IEM_MC_ARG(uint32_t *, pEFlags, 2);
+
+    IEM_MC_FETCH_GREG_U16(u16Src, pCall->iReg2);
+    IEM_MC_REF_GREG_U16(pu16Dst, pCall->iReg1);
+    IEM_MC_REF_EFLAGS(pEFlags);
+    IEM_MC_CALL_VOID_AIMPL_3(pImpl->pfnNormalU16, pu16Dst, u16Src, pEFlags);
+
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** ADD, OR, ADC, SBB, AND, SUB, XOR, CMP and TEST on dword registers. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_BinU32(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    PCIEMOPBINSIZES const pImpl = (PCIEMOPBINSIZES)(uintptr_t)pCall->uParam;
+    IEM_MC_BEGIN(3, 0);
+    IEM_MC_ARG(uint32_t *, pu32Dst, 0);
+    IEM_MC_ARG(uint32_t,   u32Src,  1);
+    IEM_MC_ARG(uint32_t *, pEFlags, 2);
+
+    IEM_MC_FETCH_GREG_U32(u32Src, pCall->iReg2);
+    IEM_MC_REF_GREG_U32(pu32Dst, pCall->iReg1);
+    IEM_MC_REF_EFLAGS(pEFlags);
+    IEM_MC_CALL_VOID_AIMPL_3(pImpl->pfnNormalU32, pu32Dst, u32Src, pEFlags);
+
+    if (pCall->fFlags & IEMTBCALL_F_CLEAR_HIGH)
+        IEM_MC_CLEAR_HIGH_GREG_U64_BY_REF(pu32Dst);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** ADD, OR, ADC, SBB, AND, SUB, XOR, CMP and TEST on qword registers. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_BinU64(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    PCIEMOPBINSIZES const pImpl = (PCIEMOPBINSIZES)(uintptr_t)pCall->uParam;
+    IEM_MC_BEGIN(3, 0);
+    IEM_MC_ARG(uint64_t *, pu64Dst, 0);
+    IEM_MC_ARG(uint64_t,   u64Src,  1);
+    IEM_MC_ARG(uint32_t *, pEFlags, 2);
+
+    IEM_MC_FETCH_GREG_U64(u64Src, pCall->iReg2);
+    IEM_MC_REF_GREG_U64(pu64Dst, pCall->iReg1);
+    IEM_MC_REF_EFLAGS(pEFlags);
+    IEM_MC_CALL_VOID_AIMPL_3(pImpl->pfnNormalU64, pu64Dst, u64Src, pEFlags);
+
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** INC and DEC on word registers (0x40 thru 0x4f outside 64-bit mode). */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_UnaryU16(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    PCIEMOPUNARYSIZES const pImpl = (PCIEMOPUNARYSIZES)(uintptr_t)pCall->uParam;
+    IEM_MC_BEGIN(2, 0);
+    IEM_MC_ARG(uint16_t *,  pu16Dst, 0);
+    IEM_MC_ARG(uint32_t *,  pEFlags, 1);
+    IEM_MC_REF_GREG_U16(pu16Dst, pCall->iReg1);
+    IEM_MC_REF_EFLAGS(pEFlags);
+    IEM_MC_CALL_VOID_AIMPL_2(pImpl->pfnNormalU16, pu16Dst, pEFlags);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** INC and DEC on dword registers (0x40 thru 0x4f outside 64-bit mode). */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_UnaryU32(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    PCIEMOPUNARYSIZES const pImpl = (PCIEMOPUNARYSIZES)(uintptr_t)pCall->uParam;
+    IEM_MC_BEGIN(2, 0);
+    IEM_MC_ARG(uint32_t *,  pu32Dst, 0);
+    IEM_MC_ARG(uint32_t *,  pEFlags, 1);
+    IEM_MC_REF_GREG_U32(pu32Dst, pCall->iReg1);
+    IEM_MC_REF_EFLAGS(pEFlags);
+    IEM_MC_CALL_VOID_AIMPL_2(pImpl->pfnNormalU32, pu32Dst, pEFlags);
+    IEM_MC_CLEAR_HIGH_GREG_U64_BY_REF(pu32Dst);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** MOV Eb,Gb and MOV Gb,Eb with a register operand. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_MovU8(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 1);
+    IEM_MC_LOCAL(uint8_t, u8Value);
+    IEM_MC_FETCH_GREG_U8(u8Value, pCall->iReg2);
+    IEM_MC_STORE_GREG_U8(pCall->iReg1, u8Value);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** MOV Ev,Gv and MOV Gv,Ev with a word register operand. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_MovU16(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 1);
+    IEM_MC_LOCAL(uint16_t, u16Value);
+    IEM_MC_FETCH_GREG_U16(u16Value, pCall->iReg2);
+    IEM_MC_STORE_GREG_U16(pCall->iReg1, u16Value);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** MOV Ev,Gv and MOV Gv,Ev with a dword register operand. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_MovU32(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 1);
+    IEM_MC_LOCAL(uint32_t, u32Value);
+    IEM_MC_FETCH_GREG_U32(u32Value, pCall->iReg2);
+    IEM_MC_STORE_GREG_U32(pCall->iReg1, u32Value);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** MOV Ev,Gv and MOV Gv,Ev with a qword register operand. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_MovU64(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 1);
+    IEM_MC_LOCAL(uint64_t, u64Value);
+    IEM_MC_FETCH_GREG_U64(u64Value, pCall->iReg2);
+    IEM_MC_STORE_GREG_U64(pCall->iReg1, u64Value);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** MOV r8,Ib (0xb0 thru 0xb7). */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_MovImmU8(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 1);
+    IEM_MC_LOCAL_CONST(uint8_t, u8Value,/*=*/ (uint8_t)pCall->uParam);
+    IEM_MC_STORE_GREG_U8(pCall->iReg1, u8Value);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** MOV r16,Iw (0xb8 thru 0xbf). */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_MovImmU16(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 1);
+    IEM_MC_LOCAL_CONST(uint16_t, u16Value,/*=*/ (uint16_t)pCall->uParam);
+    IEM_MC_STORE_GREG_U16(pCall->iReg1, u16Value);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** MOV r32,Id (0xb8 thru 0xbf). */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_MovImmU32(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 1);
+    IEM_MC_LOCAL_CONST(uint32_t, u32Value,/*=*/ (uint32_t)pCall->uParam);
+    IEM_MC_STORE_GREG_U32(pCall->iReg1, u32Value);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** MOV r64,Iq (0xb8 thru 0xbf). */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_MovImmU64(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 1);
+    IEM_MC_LOCAL_CONST(uint64_t, u64Value,/*=*/ pCall->uParam);
+    IEM_MC_STORE_GREG_U64(pCall->iReg1, u64Value);
+    IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Evaluates a Jcc condition (low nibble of the opcode).
+ *
+ * @returns true if the jump is taken.
+ * @param   fEfl        The guest EFLAGS.
+ * @param   bCond       The condition, 0 thru 15.
+ */
+DECLINLINE(bool) iemTbIsCondTrue(uint32_t fEfl, uint8_t bCond)
+{
+    bool fRet;
+    switch (bCond >> 1)
+    {
+        case 0:  fRet = RT_BOOL(fEfl & X86_EFL_OF); break;
+        case 1:  fRet = RT_BOOL(fEfl & X86_EFL_CF); break;
+        case 2:  fRet = RT_BOOL(fEfl & X86_EFL_ZF); break;
+        case 3:  fRet = RT_BOOL(fEfl & (X86_EFL_CF | X86_EFL_ZF)); break;
+        case 4:  fRet = RT_BOOL(fEfl & X86_EFL_SF); break;
+        case 5:  fRet = RT_BOOL(fEfl & X86_EFL_PF); break;
+        case 6:  fRet = RT_BOOL(fEfl & X86_EFL_SF) != RT_BOOL(fEfl & X86_EFL_OF); break;
+        default: fRet =    RT_BOOL(fEfl & X86_EFL_ZF)
+                        || RT_BOOL(fEfl & X86_EFL_SF) != RT_BOOL(fEfl & X86_EFL_OF); break;
+    }
+    return fRet != RT_BOOL(bCond & 1);
+}
+
+
+/** Jcc Jb (0x70 thru 0x7f). */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_JccS8(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 0);
+    if (iemTbIsCondTrue(pVCpu->cpum.GstCtx.eflags.u, pCall->iReg1))
+        IEM_MC_REL_JMP_S8((int8_t)pCall->uParam);
+    else
+        IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** Jcc Jv (0x0f 0x80 thru 0x8f) with 16-bit operand size. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_JccS16(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 0);
+    if (iemTbIsCondTrue(pVCpu->cpum.GstCtx.eflags.u, pCall->iReg1))
+        IEM_MC_REL_JMP_S16((int16_t)pCall->uParam);
+    else
+        IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** Jcc Jv (0x0f 0x80 thru 0x8f) with 32-bit or 64-bit operand size. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_JccS32(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 0);
+    if (iemTbIsCondTrue(pVCpu->cpum.GstCtx.eflags.u, pCall->iReg1))
+        IEM_MC_REL_JMP_S32((int32_t)pCall->uParam);
+    else
+        IEM_MC_ADVANCE_RIP();
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** JMP Jb (0xeb). */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_JmpS8(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 0);
+    IEM_MC_REL_JMP_S8((int8_t)pCall->uParam);
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** JMP Jv (0xe9) with 16-bit operand size. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_JmpS16(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 0);
+    IEM_MC_REL_JMP_S16((int16_t)pCall->uParam);
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** JMP Jv (0xe9) with 32-bit or 64-bit operand size. */
+IEM_STATIC VBOXSTRICTRC iemTbFunc_JmpS32(PVMCPUCC pVCpu, PCIEMTBCALL pCall)
+{
+    IEM_MC_BEGIN(0, 0);
+    IEM_MC_REL_JMP_S32((int32_t)pCall->uParam);
+    IEM_MC_END();
+    return VINF_SUCCESS;
+}
+
+
+/** The threaded functions, indexed by IEMTBFUNC_XXX. */
+static PFNIEMTBFUNC const g_apfnIemTbFuncs[IEMTBFUNC_END] =
+{
+    /* IEMTBFUNC_GENERIC     */ NULL,
+    /* IEMTBFUNC_BIN_U8      */ iemTbFunc_BinU8,
+    /* IEMTBFUNC_BIN_U16     */ iemTbFunc_BinU16,
+    /* IEMTBFUNC_BIN_U32     */ iemTbFunc_BinU32,
+    /* IEMTBFUNC_BIN_U64     */ iemTbFunc_BinU64,
+    /* IEMTBFUNC_UNARY_U16   */ iemTbFunc_UnaryU16,
+    /* IEMTBFUNC_UNARY_U32   */ iemTbFunc_UnaryU32,
+    /* IEMTBFUNC_MOV_U8      */ iemTbFunc_MovU8,
+    /* IEMTBFUNC_MOV_U16     */ iemTbFunc_MovU16,
+    /* IEMTBFUNC_MOV_U32     */ iemTbFunc_MovU32,
+    /* IEMTBFUNC_MOV_U64     */ iemTbFunc_MovU64,
+    /* IEMTBFUNC_MOV_IMM_U8  */ iemTbFunc_MovImmU8,
+    /* IEMTBFUNC_MOV_IMM_U16 */ iemTbFunc_MovImmU16,
+    /* IEMTBFUNC_MOV_IMM_U32 */ iemTbFunc_MovImmU32,
+    /* IEMTBFUNC_MOV_IMM_U64 */ iemTbFunc_MovImmU64,
+    /* IEMTBFUNC_JCC_S8      */ iemTbFunc_JccS8,
+    /* IEMTBFUNC_JCC_S16     */ iemTbFunc_JccS16,
+    /* IEMTBFUNC_JCC_S32     */ iemTbFunc_JccS32,
+    /* IEMTBFUNC_JMP_S8      */ iemTbFunc_JmpS8,
+    /* IEMTBFUNC_JMP_S16     */ iemTbFunc_JmpS16,
+    /* IEMTBFUNC_JMP_S32     */ iemTbFunc_JmpS32,
+};
+
+
+/*********************************************************************************************************************************
+*   Translation Block Recording                                                                                                  *
+*********************************************************************************************************************************/
+
+/**
+ * Reads a little endian immediate from the opcode bytes.
+ */
+DECLINLINE(uint64_t) iemTbGetImm(uint8_t const *pbImm, unsigned cbImm)
+{
+    uint64_t uImm = 0;
+    while (cbImm-- > 0)
+        uImm = (uImm << 8) | pbImm[cbImm];
+    return uImm;
+}
+
+
+/**
+ * Pre-decodes an instruction that has just been interpreted successfully.
+ *
+ * The decoder state (prefixes, REX bits, effective operand size) is still that
+ * of the instruction, so only the opcode and ModR/M bytes need looking at.
+ * Anything not handled here is left to the generic entry.
+ *
+ * @param   pVCpu       The cross context virtual CPU structure of the calling thread.
+ * @param   pCall       The call entry, offOpcode and cbInstr already set.
+ * @param   pbInstr     The instruction bytes.
+ */
+IEM_STATIC void iemTbPreDecode(PVMCPUCC pVCpu, IEMTBCALL *pCall, uint8_t const *pbInstr)
+{
+    static PCIEMOPBINSIZES const s_apBinImpls[8] =
+    {
+        &g_iemAImpl_add, &g_iemAImpl_or,  &g_iemAImpl_adc, &g_iemAImpl_sbb,
+        &g_iemAImpl_and, &g_iemAImpl_sub, &g_iemAImpl_xor, &g_iemAImpl_cmp,
+    };
+
+    pCall->uParam       = 0;
+    pCall->idxFunc      = IEMTBFUNC_GENERIC;
+    pCall->iReg1        = 0;
+    pCall->iReg2        = 0;
+    pCall->enmEffOpSize = (uint8_t)pVCpu->iem.s.enmEffOpSize;
+    pCall->fFlags       = 0;
+    pCall->fPrefixes    = pVCpu->iem.s.fPrefixes;
+    pCall->u32Padding   = 0;
+
+    /*
+     * Skip the prefixes, the decoder has already applied them.
+     */
+    unsigned const cbInstr = pCall->cbInstr;
+    unsigned       off     = 0;
+    for (; off < cbInstr; off++)
+    {
+        uint8_t const b = pbInstr[off];
+        if (   b == 0x26 || b == 0x2e || b == 0x36 || b == 0x3e || b == 0x64 || b == 0x65
+            || b == 0x66 || b == 0x67 || b == 0xf0 || b == 0xf2 || b == 0xf3)
+            continue;
+        if ((b & 0xf0) == 0x40 && pVCpu->iem.s.enmCpuMode == IEMMODE_64BIT)
+            continue;
+        break;
+    }
+    if (off >= cbInstr)
+        return;
+
+    uint8_t const   bOpcode   = pbInstr[off];
+    unsigned const  cbLeft    = cbInstr - off;
+    uint8_t const   bRm       = cbLeft >= 2 ? pbInstr[off + 1] : 0;
+    bool const      fRmReg    = cbLeft == 2 && (bRm & X86_MODRM_MOD_MASK) == (3 << X86_MODRM_MOD_SHIFT);
+    uint8_t const   iRegReg   = ((bRm >> X86_MODRM_REG_SHIFT) & X86_MODRM_REG_SMASK) | pVCpu->iem.s.uRexReg;
+    uint8_t const   iRegRm    = (bRm & X86_MODRM_RM_MASK) | pVCpu->iem.s.uRexB;
+    IEMMODE const   enmOpSize = pVCpu->iem.s.enmEffOpSize;
+
+    /* String instructions writing memory don't update cbWritten. */
+    if (   bOpcode == 0xa4 || bOpcode == 0xa5 || bOpcode == 0xaa || bOpcode == 0xab
+        || bOpcode == 0x6c || bOpcode == 0x6d)
+        pCall->fFlags |= IEMTBCALL_F_RECHECK;
+
+    /* LOCK with a register operand is #UD, but play safe. */
+    if (pVCpu->iem.s.fPrefixes & IEM_OP_PRF_LOCK)
+        return;
+
+    switch (bOpcode)
+    {
+        case 0x00: case 0x01: case 0x02: case 0x03: /* add */
+        case 0x08: case 0x09: case 0x0a: case 0x0b: /* or */
+        case 0x10: case 0x11: case 0x12: case 0x13: /* adc */
+        case 0x18: case 0x19: case 0x1a: case 0x1b: /* sbb */
+        case 0x20: case 0x21: case 0x22: case 0x23: /* and */
+        case 0x28: case 0x29: case 0x2a: case 0x2b: /* sub */
+        case 0x30: case 0x31: case 0x32: case 0x33: /* xor */
+        case 0x38: case 0x39: case 0x3a: case 0x3b: /* cmp */
+        case 0x84: case 0x85:                       /* test */
+            if (fRmReg)
+            {
+                PCIEMOPBINSIZES const pImpl = bOpcode >= 0x84 ? &g_iemAImpl_test : s_apBinImpls[bOpcode >> 3];
+                pCall->uParam = (uintptr_t)pImpl;
+                if (bOpcode & 2)
+                {
+                    /* Gb,Eb / Gv,Ev (iemOpHlpBinaryOperator_r8_rm / _rv_rm). */
+                    pCall->iReg1 = iRegReg;
+                    pCall->iReg2 = iRegRm;
+                    pCall->fFlags |= IEMTBCALL_F_CLEAR_HIGH;
+                }
+                else
+                {
+                    /* Eb,Gb / Ev,Gv (iemOpHlpBinaryOperator_rm_r8 / _rm_rv). */
+                    pCall->iReg1 = iRegRm;
+                    pCall->iReg2 = iRegReg;
+                    if (pImpl != &g_iemAImpl_test)
+                        pCall->fFlags |= IEMTBCALL_F_CLEAR_HIGH;
+                }
+                pCall->idxFunc = !(bOpcode & 1) ? IEMTBFUNC_BIN_U8 : IEMTBFUNC_BIN_U16 + (uint8_t)enmOpSize;
+            }
+            break;
+
+        case 0x88: case 0x89: case 0x8a: case 0x8b: /* mov */
+            if (fRmReg)
+            {
+                pCall->iReg1   = bOpcode & 2 ? iRegReg : iRegRm;
+                pCall->iReg2   = bOpcode & 2 ? iRegRm  : iRegReg;
+                pCall->idxFunc = !(bOpcode & 1) ? IEMTBFUNC_MOV_U8 : IEMTBFUNC_MOV_U16 + (uint8_t)enmOpSize;
+            }
+            break;
+
+        case 0xb0: case 0xb1: case 0xb2: case 0xb3: case 0xb4: case 0xb5: case 0xb6: case 0xb7:
+            if (cbLeft == 2)
+            {
+                pCall->iReg1   = (bOpcode & 7) | pVCpu->iem.s.uRexB;
+                pCall->uParam  = pbInstr[off + 1];
+                pCall->idxFunc = IEMTBFUNC_MOV_IMM_U8;
+            }
+            break;
+
+        case 0xb8: case 0xb9: case 0xba: case 0xbb: case 0xbc: case 0xbd: case 0xbe: case 0xbf:
+        {
+            unsigned const cbImm = 2U << enmOpSize;
+            if (cbLeft == 1 + cbImm)
+            {
+                pCall->iReg1   = (bOpcode & 7) | pVCpu->iem.s.uRexB;
+                pCall->uParam  = iemTbGetImm(&pbInstr[off + 1], cbImm);
+                pCall->idxFunc = IEMTBFUNC_MOV_IMM_U16 + (uint8_t)enmOpSize;
+            }
+            break;
+        }
+
+        case 0x40: case 0x41: case 0x42: case 0x43: case 0x44: case 0x45: case 0x46: case 0x47: /* inc */
+        case 0x48: case 0x49: case 0x4a: case 0x4b: case 0x4c: case 0x4d: case 0x4e: case 0x4f: /* dec */
+            if (cbLeft == 1 && enmOpSize != IEMMODE_64BIT)
+            {
+                pCall->iReg1   = bOpcode & 7;
+                pCall->uParam  = (uintptr_t)(bOpcode < 0x48 ? &g_iemAImpl_inc : &g_iemAImpl_dec);
+                pCall->idxFunc = enmOpSize == IEMMODE_16BIT ? IEMTBFUNC_UNARY_U16 : IEMTBFUNC_UNARY_U32;
+            }
+            break;
+
+        case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: case 0x77:
+        case 0x78: case 0x79: case 0x7a: case 0x7b: case 0x7c: case 0x7d: case 0x7e: case 0x7f:
+            if (cbLeft == 2)
+            {
+                pCall->iReg1   = bOpcode & 0xf;
+                pCall->uParam  = pbInstr[off + 1];
+                pCall->idxFunc = IEMTBFUNC_JCC_S8;
+            }
+            break;
+
+        case 0xeb:
+            if (cbLeft == 2)
+            {
+                pCall->uParam  = pbInstr[off + 1];
+                pCall->idxFunc = IEMTBFUNC_JMP_S8;
+            }
+            break;
+
+        case 0xe9:
+        {
+            unsigned const cbImm = enmOpSize == IEMMODE_16BIT ? 2 : 4;
+            if (cbLeft == 1 + cbImm)
+            {
+                pCall->uParam  = iemTbGetImm(&pbInstr[off + 1], cbImm);
+                pCall->idxFunc = enmOpSize == IEMMODE_16BIT ? IEMTBFUNC_JMP_S16 : IEMTBFUNC_JMP_S32;
+            }
+            break;
+        }
+
+        case 0x0f:
+        {
+            unsigned const cbImm = enmOpSize == IEMMODE_16BIT ? 2 : 4;
+            if (   cbLeft == 2 + cbImm
+                && (bRm & 0xf0) == 0x80)
+            {
+                pCall->iReg1   = bRm & 0xf;
+                pCall->uParam  = iemTbGetImm(&pbInstr[off + 2], cbImm);
+                pCall->idxFunc = enmOpSize == IEMMODE_16BIT ? IEMTBFUNC_JCC_S16 : IEMTBFUNC_JCC_S32;
+            }
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+
+/**
+ * Calculates the flat PC the same way as iemReInitDecoder.
+ */
+DECLINLINE(RTGCPTR) iemTbCalcPc(PVMCPUCC pVCpu)
+{
+    return pVCpu->iem.s.enmCpuMode == IEMMODE_64BIT
+         ? pVCpu->cpum.GstCtx.rip
+         : pVCpu->cpum.GstCtx.eip + (uint32_t)pVCpu->cpum.GstCtx.cs.u64Base;
+}
+
+
+/**
+ * Calculates the translation block key flags.
+ */
+DECLINLINE(uint32_t) iemTbCalcFlags(PVMCPUCC pVCpu)
+{
+    return (uint32_t)pVCpu->iem.s.enmCpuMode | ((uint32_t)pVCpu->iem.s.uCpl << 2);
+}
+
+
+/**
+ * Calculates the hash table index.
+ */
+DECLINLINE(uint32_t) iemTbHash(RTGCPTR GCPtrPc, uint32_t fFlags)
+{
+    return (uint32_t)(GCPtrPc ^ (GCPtrPc >> X86_PAGE_SHIFT) ^ fFlags) & (IEMTBCACHE_HASH_SIZE - 1);
+}
+
+
+/**
+ * Flushes the whole cache.
+ */
+IEM_STATIC void iemTbCacheFlush(PIEMTBCACHE pCache)
+{
+    STAM_REL_COUNTER_INC(&pCache->StatFlushes);
+    pCache->pCurTb   = NULL;
+    pCache->pPrevTb  = NULL;
+    pCache->pRecTb   = NULL;
+    pCache->cUsedTbs = 0;
+    RT_ZERO(pCache->apHash);
+}
+
+
+/**
+ * Stops recording, making the recorded instructions (if any) valid.
+ */
+IEM_STATIC void iemTbRecordEnd(PIEMTBCACHE pCache)
+{
+    PIEMTB pTb = pCache->pRecTb;
+    if (pTb)
+    {
+        pTb->cbOpcodes  = (uint16_t)pCache->cbRecOpcodes;
+        pTb->cCalls     = (uint8_t)pCache->cRecCalls;
+        pCache->pRecTb  = NULL;
+        pCache->pPrevTb = pTb->cCalls ? pTb : NULL;
+    }
+}
+
+
+/**
+ * Remembers @a pTb as a successor of @a pPrevTb.
+ */
+DECLINLINE(void) iemTbLink(PIEMTB pPrevTb, PIEMTB pTb)
+{
+    if (   pPrevTb
+        && pPrevTb->apSuccessors[0] != pTb
+        && pPrevTb->apSuccessors[1] != pTb)
+    {
+        pPrevTb->apSuccessors[pPrevTb->iNextSuccessor] = pTb;
+        pPrevTb->iNextSuccessor ^= 1;
+    }
+}
+
+
+/**
+ * Looks up a translation block, trying the successors of the previous block
+ * before the hash table.
+ */
+IEM_STATIC PIEMTB iemTbLookup(PIEMTBCACHE pCache, RTGCPTR GCPtrPc, uint32_t fFlags)
+{
+    PIEMTB pPrevTb = pCache->pPrevTb;
+    if (pPrevTb)
+        for (unsigned i = 0; i < RT_ELEMENTS(pPrevTb->apSuccessors); i++)
+        {
+            PIEMTB pTb = pPrevTb->apSuccessors[i];
+            if (   pTb
+                && pTb->GCPtrPc == GCPtrPc
+                && pTb->fFlags  == fFlags)
+            {
+                STAM_REL_COUNTER_INC(&pCache->StatChainHits);
+                return pTb;
+            }
+        }
+
+    for (PIEMTB pTb = pCache->apHash[iemTbHash(GCPtrPc, fFlags)]; pTb; pTb = pTb->pNext)
+        if (   pTb->GCPtrPc == GCPtrPc
+            && pTb->fFlags  == fFlags)
+        {
+            STAM_REL_COUNTER_INC(&pCache->StatLookupHits);
+            return pTb;
+        }
+    return NULL;
+}
+
+
+/**
+ * Allocates a new translation block and enters it into the hash table.
+ */
+IEM_STATIC PIEMTB iemTbAlloc(PIEMTBCACHE pCache, RTGCPTR GCPtrPc, uint32_t fFlags)
+{
+    if (pCache->cUsedTbs >= RT_ELEMENTS(pCache->aTbs))
+        iemTbCacheFlush(pCache);
+
+    PIEMTB pTb = &pCache->aTbs[pCache->cUsedTbs++];
+    pTb->GCPtrPc            = GCPtrPc;
+    pTb->fFlags             = fFlags;
+    pTb->cCalls             = 0;
+    pTb->cbOpcodes          = 0;
+    pTb->apSuccessors[0]    = NULL;
+    pTb->apSuccessors[1]    = NULL;
+    pTb->iNextSuccessor     = 0;
+
+    uint32_t const idxHash  = iemTbHash(GCPtrPc, fFlags);
+    pTb->pNext              = pCache->apHash[idxHash];
+    pCache->apHash[idxHash] = pTb;
+    return pTb;
+}
+
+
+/**
+ * Interprets an instruction the normal way and records it.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling thread.
+ * @param   pCache      The translation block cache.
+ * @param   b           The first opcode byte, already fetched.
+ * @param   GCPtrPc     The flat PC of the instruction.
+ */
+IEM_STATIC VBOXSTRICTRC iemTbExecRecord(PVMCPUCC pVCpu, PIEMTBCACHE pCache, uint8_t b, RTGCPTR GCPtrPc)
+{
+    uint8_t const  *pbBuf        = pVCpu->iem.s.pbInstrBuf;
+    uint64_t const  uBufPc       = pVCpu->iem.s.uInstrBufPc;
+    uint32_t const  offInstr     = (uint32_t)(int32_t)pVCpu->iem.s.offCurInstrStart;
+
+    VBOXSTRICTRC rcStrict = FNIEMOP_CALL(g_apfnOneByteMap[b]);
+
+    PIEMTB const    pTb          = pCache->pRecTb;
+    uint32_t const  cbInstr      = IEM_GET_INSTR_LEN(pVCpu);
+    uint32_t const  cbRecOpcodes = pCache->cbRecOpcodes;
+    if (   rcStrict == VINF_SUCCESS
+        && pVCpu->iem.s.rcPassUp    == VINF_SUCCESS
+        && pVCpu->iem.s.pbInstrBuf  == pbBuf
+        && pVCpu->iem.s.uInstrBufPc == uBufPc
+        && offInstr + cbInstr <= pVCpu->iem.s.cbInstrBufTotal
+        && cbRecOpcodes + cbInstr <= sizeof(pTb->abOpcodes))
+    {
+        IEMTBCALL *pCall = &pTb->aCalls[pCache->cRecCalls++];
+        pCall->offOpcode = (uint16_t)cbRecOpcodes;
+        pCall->cbInstr   = (uint8_t)cbInstr;
+        memcpy(&pTb->abOpcodes[cbRecOpcodes], &pbBuf[offInstr], cbInstr);
+        pCache->cbRecOpcodes = cbRecOpcodes + cbInstr;
+        iemTbPreDecode(pVCpu, pCall, &pTb->abOpcodes[cbRecOpcodes]);
+
+        /* The block ends with anything not continuing with the next instruction
+           (branches, exceptions, interrupted REP instructions) or when full. */
+        pCache->GCPtrRecNextPc = pVCpu->iem.s.enmCpuMode == IEMMODE_64BIT ? GCPtrPc + cbInstr : (uint32_t)(GCPtrPc + cbInstr);
+        if (   iemTbCalcPc(pVCpu) != pCache->GCPtrRecNextPc
+            || pCall->idxFunc >= IEMTBFUNC_JCC_S8
+            || pCache->cRecCalls >= RT_ELEMENTS(pTb->aCalls))
+            iemTbRecordEnd(pCache);
+    }
+    else
+        iemTbRecordEnd(pCache);
+    return rcStrict;
+}
+
+
+/*********************************************************************************************************************************
+*   Translation Block Execution                                                                                                  *
+*********************************************************************************************************************************/
+
+/**
+ * Executes one call of the current translation block.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling thread.
+ * @param   pCache      The translation block cache.
+ * @param   pTb         The current translation block.
+ * @param   iCall       The call to execute.
+ * @param   fHaveByte   Whether the first opcode byte has already been fetched.
+ * @param   b           The first opcode byte if @a fHaveByte is set.
+ */
+IEM_STATIC VBOXSTRICTRC iemTbExecCall(PVMCPUCC pVCpu, PIEMTBCACHE pCache, PIEMTB pTb, uint32_t iCall, bool fHaveByte, uint8_t b)
+{
+    PCIEMTBCALL const pCall        = &pTb->aCalls[iCall];
+    uint32_t const    cbOldWritten = pVCpu->iem.s.cbWritten;
+    VBOXSTRICTRC      rcStrict;
+    if (pCall->idxFunc != IEMTBFUNC_GENERIC)
+    {
+        STAM_REL_COUNTER_INC(&pCache->StatThreadedCalls);
+        pVCpu->iem.s.offInstrNextByte = (uint32_t)(int32_t)pVCpu->iem.s.offCurInstrStart + pCall->cbInstr;
+        pVCpu->iem.s.fPrefixes        = pCall->fPrefixes;
+        pVCpu->iem.s.enmEffOpSize     = (IEMMODE)pCall->enmEffOpSize;
+        rcStrict = g_apfnIemTbFuncs[pCall->idxFunc](pVCpu, pCall);
+    }
+    else
+    {
+        STAM_REL_COUNTER_INC(&pCache->StatGenericCalls);
+        if (!fHaveByte)
+            IEM_OPCODE_GET_NEXT_U8(&b);
+        rcStrict = FNIEMOP_CALL(g_apfnOneByteMap[b]);
+    }
+
+    if (rcStrict == VINF_SUCCESS)
+    {
+        /*
+         * If the instruction may have written to guest memory, check that the
+         * rest of the block is unchanged.
+         */
+        iCall++;
+        if (   iCall < pTb->cCalls
+            && (   pVCpu->iem.s.cbWritten != cbOldWritten
+                || (pCall->fFlags & IEMTBCALL_F_RECHECK)))
+        {
+            uint32_t const offNext = pTb->aCalls[iCall].offOpcode;
+            if (   pVCpu->iem.s.uInstrBufPhysRev != pVCpu->iem.s.CodeTlb.uTlbPhysRev
+                || memcmp(&pCache->pbValidated[pCache->offValidated + offNext], &pTb->abOpcodes[offNext],
+                          pTb->cbOpcodes - offNext) != 0)
+            {
+                STAM_REL_COUNTER_INC(&pCache->StatInvalidations);
+                iCall = pTb->cCalls;
+            }
+        }
+        pCache->iCurCall = iCall;
+    }
+    else
+        pCache->pCurTb = NULL;
+    return rcStrict;
+}
+
+
+/**
+ * Prepares the translation block cache for a IEMExecLots run.
+ *
+ * The guest state may have been changed by anyone since the last run.
+ *
+ * @param   pCache      The translation block cache.
+ */
+IEM_STATIC void iemTbExecStart(PIEMTBCACHE pCache)
+{
+    iemTbRecordEnd(pCache);
+    pCache->pCurTb  = NULL;
+    pCache->pPrevTb = NULL;
+}
+
+
+/**
+ * Executes one instruction for IEMExecLots using the translation block cache.
+ *
+ * @returns Strict VBox status code.
+ * @param   pVCpu       The cross context virtual CPU structure of the calling thread.
+ * @param   pCache      The translation block cache.
+ */
+IEM_STATIC VBOXSTRICTRC iemTbExecInstr(PVMCPUCC pVCpu, PIEMTBCACHE pCache)
+{
+    RTGCPTR const GCPtrPc = iemTbCalcPc(pVCpu);
+
+    /*
+     * Continue with the current block if this is its next instruction and the
+     * guest page it was validated against is still mapped the same way.
+     */
+    PIEMTB pTb = pCache->pCurTb;
+    if (pTb)
+    {
+        uint32_t const iCall = pCache->iCurCall;
+        if (   iCall < pTb->cCalls
+            && GCPtrPc == pTb->GCPtrPc + pTb->aCalls[iCall].offOpcode
+            && pVCpu->iem.s.pbInstrBuf  == pCache->pbValidated
+            && pVCpu->iem.s.uInstrBufPc == pCache->uValidatedBufPc
+            && pVCpu->iem.s.CodeTlb.uTlbRevision == pCache->uValidatedTlbRev)
+            return iemTbExecCall(pVCpu, pCache, pTb, iCall, false /*fHaveByte*/, 0);
+        pCache->pCurTb  = NULL;
+        pCache->pPrevTb = pTb;
+    }
+
+    /*
+     * Fetch the first opcode byte the normal way, this sets up the instruction
+     * buffer.  Code we cannot access directly isn't cached.
+     */
+    uint8_t b; IEM_OPCODE_GET_NEXT_U8(&b);
+    uint8_t const *pbBuf = pVCpu->iem.s.pbInstrBuf;
+    if (   !pbBuf
+        || !pVCpu->iem.s.cbInstrBufTotal)
+    {
+        iemTbRecordEnd(pCache);
+        pCache->pPrevTb = NULL;
+        return FNIEMOP_CALL(g_apfnOneByteMap[b]);
+    }
+
+    uint32_t const fFlags = iemTbCalcFlags(pVCpu);
+    pTb = iemTbLookup(pCache, GCPtrPc, fFlags);
+
+    /*
+     * Continue recording if this is the next instruction and not the start of
+     * another block.
+     */
+    if (pCache->pRecTb)
+    {
+        if (   !pTb
+            && GCPtrPc == pCache->GCPtrRecNextPc
+            && fFlags  == pCache->pRecTb->fFlags
+            && pVCpu->iem.s.uInstrBufPc == pCache->uRecBufPc)
+            return iemTbExecRecord(pVCpu, pCache, b, GCPtrPc);
+        iemTbRecordEnd(pCache);
+    }
+
+    /*
+     * Enter the block if the opcode bytes still match the guest page, otherwise
+     * record it again.
+     */
+    uint32_t const offInstr = (uint32_t)(int32_t)pVCpu->iem.s.offCurInstrStart;
+    if (pTb)
+    {
+        iemTbLink(pCache->pPrevTb, pTb);
+        if (   pTb->cCalls > 0
+            && pTb->u32CsLimit == pVCpu->cpum.GstCtx.cs.u32Limit
+            && offInstr + pTb->cbOpcodes <= pVCpu->iem.s.cbInstrBufTotal
+            && memcmp(&pbBuf[offInstr], pTb->abOpcodes, pTb->cbOpcodes) == 0)
+        {
+            pCache->pCurTb           = pTb;
+            pCache->iCurCall         = 0;
+            pCache->pbValidated      = pbBuf;
+            pCache->offValidated     = offInstr;
+            pCache->uValidatedBufPc  = pVCpu->iem.s.uInstrBufPc;
+            pCache->uValidatedTlbRev = pVCpu->iem.s.CodeTlb.uTlbRevision;
+            return iemTbExecCall(pVCpu, pCache, pTb, 0, true /*fHaveByte*/, b);
+        }
+        if (pTb->cCalls > 0)
+            STAM_REL_COUNTER_INC(&pCache->StatInvalidations);
+        pTb->cCalls    = 0;
+        pTb->cbOpcodes = 0;
+    }
+    else
+    {
+        STAM_REL_COUNTER_INC(&pCache->StatLookupMisses);
+        pTb = iemTbAlloc(pCache, GCPtrPc, fFlags);
+        iemTbLink(pCache->pPrevTb, pTb);
+    }
+
+    pTb->u32CsLimit        = pVCpu->cpum.GstCtx.cs.u32Limit;
+    pCache->pRecTb         = pTb;
+    pCache->cRecCalls      = 0;
+    pCache->cbRecOpcodes   = 0;
+    pCache->GCPtrRecNextPc = GCPtrPc;
+    pCache->uRecBufPc      = pVCpu->iem.s.uInstrBufPc;
+    pCache->pPrevTb        = NULL;
+    return iemTbExecRecord(pVCpu, pCache, b, GCPtrPc);
+}
@@ -28,9 +28,80 @@
 #include "PDMNetShaperInternal.h"
 
 
+/**
+ * Calculates the number of tokens a given rate produces over a period.
+ *
+ * @returns Number of bytes.
+ * @param   cNsElapsed      The period in nanoseconds.
+ * @param   cbPerSec        The rate in bytes per second.
+ */
+DECLINLINE(uint64_t) pdmNsCalcTokens(uint64_t cNsElapsed, uint64_t cbPerSec)
+{
+    /* Anything beyond a minute fills any sensibly sized bucket, and the
+       millisecond granularity for long periods keeps us clear of overflows. */
+    if (cNsElapsed < RT_NS_1SEC)
+        return cNsElapsed * cbPerSec / RT_NS_1SEC;
+    return RT_MIN(cNsElapsed, RT_NS_1MIN) / RT_NS_1MS * cbPerSec / RT_MS_1SEC;
+}
+
+
+/**
+ * Gets the root of the bandwidth group tree, the owner of the lock.
+ *
+ * @returns The root group.
+ * @param   pBwGroup        The bandwidth group.
+ */
+DECLINLINE(PPDMNSBWGROUP) pdmNsBwGroupGetRoot(PPDMNSBWGROUP pBwGroup)
+{
+    PPDMNSBWGROUP pParent;
+    while ((pParent = pBwGroup->CTX_SUFF(pParent)) != NULL)
+        pBwGroup = pParent;
+    return pBwGroup;
+}
+
+
+/**
+ * Refills the bucket of a bandwidth group.
+ *
+ * @returns Number of tokens in the bucket.
+ * @param   pBwGroup        The bandwidth group, root lock held.
+ * @param   tsNow           The current time.
+ */
+DECLINLINE(uint32_t) pdmNsBwGroupRefill(PPDMNSBWGROUP pBwGroup, uint64_t tsNow)
+{
+    uint64_t cbTokensAdded = pdmNsCalcTokens(tsNow - pBwGroup->tsUpdatedLast, pBwGroup->cbPerSecMax);
+    return (uint32_t)RT_MIN(pBwGroup->cbBucket, cbTokensAdded + pBwGroup->cbTokensLast);
+}
+
+
+/**
+ * Refills the weighted share a filter has of its group bucket.
+ *
+ * @returns Number of tokens left of the share.
+ * @param   pFilter         The filter.
+ * @param   pBwGroup        The bandwidth group of the filter, root lock held.
+ * @param   tsNow           The current time.
+ */
+DECLINLINE(uint32_t) pdmNsFilterRefillShare(PPDMNSFILTER pFilter, PPDMNSBWGROUP pBwGroup, uint64_t tsNow)
+{
+    uint32_t const uWeight       = RT_MAX(pFilter->uWeight, 1);
+    uint32_t const uWeightTotal  = RT_MAX(pBwGroup->uWeightTotal, uWeight);
+    uint64_t const cbShareBucket = RT_MAX((uint64_t)pBwGroup->cbBucket * uWeight / uWeightTotal,
+                                          PDM_NETSHAPER_MIN_BUCKET_SIZE);
+    uint64_t       cbTokensAdded = pdmNsCalcTokens(tsNow - pFilter->tsShareUpdated, pBwGroup->cbPerSecMax);
+    cbTokensAdded = RT_MIN(cbTokensAdded, pBwGroup->cbBucket) * uWeight / uWeightTotal;
+    return (uint32_t)RT_MIN(cbShareBucket, cbTokensAdded + pFilter->cbShareTokens);
+}
+
+
 /**
  * Obtain bandwidth in a bandwidth group.
  *
+ * The transfer has to fit into the buckets of the group and all its ancestors.
+ * While other filters of the group are choked, a filter is furthermore limited
+ * to its weighted share of the group bandwidth.  Otherwise it may borrow what
+ * the idle filters leave unused.
+ *
  * @returns True if bandwidth was allocated, false if not.
  * @param   pFilter         Pointer to the filter that allocates bandwidth.
  * @param   cbTransfer      Number of bytes to allocate.
@@ -42,36 +113,62 @@ VMMDECL(bool) PDMNsAllocateBandwidth(PPDMNSFILTER pFilter, size_t cbTransfer)
         return true;
 
     PPDMNSBWGROUP pBwGroup = ASMAtomicReadPtrT(&pFilter->CTX_SUFF(pBwGroup), PPDMNSBWGROUP);
-    int rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
+    PPDMNSBWGROUP pRoot    = pdmNsBwGroupGetRoot(pBwGroup);
+    int rc = PDMCritSectEnter(&pRoot->Lock, VERR_SEM_BUSY); AssertRC(rc);
     if (RT_UNLIKELY(rc == VERR_SEM_BUSY))
         return true;
 
-    bool fAllowed = true;
-    if (pBwGroup->cbPerSecMax)
-    {
-        /* Re-fill the bucket first */
-        uint64_t tsNow        = RTTimeSystemNanoTS();
-        uint32_t uTokensAdded = (tsNow - pBwGroup->tsUpdatedLast) * pBwGroup->cbPerSecMax / (1000 * 1000 * 1000);
-        uint32_t uTokens      = RT_MIN(pBwGroup->cbBucket, uTokensAdded + pBwGroup->cbTokensLast);
+    bool            fAllowed  = true;
+    bool            fBorrowed = false;
+    uint32_t        cbShare   = 0;
+    uint64_t const  tsNow     = RTTimeSystemNanoTS();
 
-        if (cbTransfer > uTokens)
+    /* The whole chain has to have room for it, disabled groups don't count. */
+    for (PPDMNSBWGROUP pCur = pBwGroup; pCur; pCur = pCur->CTX_SUFF(pParent))
+        if (   pCur->cbPerSecMax
+            && cbTransfer > pdmNsBwGroupRefill(pCur, tsNow))
         {
             fAllowed = false;
-            ASMAtomicWriteBool(&pFilter->fChoked, true);
+            break;
         }
-        else
+
+    /* Don't let a filter eat into the share of the ones waiting for bandwidth. */
+    if (fAllowed && pBwGroup->cbPerSecMax)
+    {
+        cbShare = pdmNsFilterRefillShare(pFilter, pBwGroup, tsNow);
+        if (cbTransfer > cbShare)
         {
-            pBwGroup->tsUpdatedLast = tsNow;
-            pBwGroup->cbTokensLast = uTokens - (uint32_t)cbTransfer;
+            if (pBwGroup->cFiltersChoked > (uint32_t)pFilter->fChoked)
+                fAllowed = false;
+            else
+                fBorrowed = true;
         }
-        Log2(("pdmNsAllocateBandwidth: BwGroup=%#p{%s} cbTransfer=%u uTokens=%u uTokensAdded=%u fAllowed=%RTbool\n",
-              pBwGroup, R3STRING(pBwGroup->pszNameR3), cbTransfer, uTokens, uTokensAdded, fAllowed));
     }
-    else
-        Log2(("pdmNsAllocateBandwidth: BwGroup=%#p{%s} disabled fAllowed=%RTbool\n",
-              pBwGroup, R3STRING(pBwGroup->pszNameR3), fAllowed));
 
-    rc = PDMCritSectLeave(&pBwGroup->Lock); AssertRC(rc);
+    if (fAllowed)
+    {
+        for (PPDMNSBWGROUP pCur = pBwGroup; pCur; pCur = pCur->CTX_SUFF(pParent))
+            if (pCur->cbPerSecMax)
+            {
+                pCur->cbTokensLast  = pdmNsBwGroupRefill(pCur, tsNow) - (uint32_t)cbTransfer;
+                pCur->tsUpdatedLast = tsNow;
+            }
+        pFilter->cbShareTokens  = fBorrowed ? 0 : cbShare - (uint32_t)cbTransfer;
+        pFilter->tsShareUpdated = tsNow;
+        STAM_REL_COUNTER_ADD(&pBwGroup->StatBytesTransmitted, cbTransfer);
+        if (fBorrowed)
+            STAM_REL_COUNTER_INC(&pBwGroup->StatBorrowed);
+    }
+    else if (!ASMAtomicXchgBool(&pFilter->fChoked, true))
+    {
+        pFilter->tsChoked = tsNow;
+        ASMAtomicIncU32(&pBwGroup->cFiltersChoked);
+        STAM_REL_COUNTER_INC(&pBwGroup->StatChoked);
+    }
+    Log2(("pdmNsAllocateBandwidth: BwGroup=%#p{%s} cbTransfer=%u cbShare=%u fAllowed=%RTbool fBorrowed=%RTbool\n",
+          pBwGroup, R3STRING(pBwGroup->pszNameR3), cbTransfer, cbShare, fAllowed, fBorrowed));
+
+    rc = PDMCritSectLeave(&pRoot->Lock); AssertRC(rc);
     return fAllowed;
 }
 
@@ -26,10 +26,12 @@
 # include <VBox/vmm/mm.h>
 #endif
 #include <VBox/vmm/vmcc.h>
+#include <VBox/vmm/tm.h>
 #include <iprt/errcore.h>
 #include <VBox/log.h>
 #include <iprt/asm.h>
 #include <iprt/assert.h>
+#include <iprt/time.h>
 
 
 /**
@@ -81,19 +83,20 @@ static void pdmQueueSetFF(PPDMQUEUE pQueue)
 
 
 /**
- * Queue an item.
- * The item must have been obtained using PDMQueueAlloc(). Once the item
- * have been passed to this function it must not be touched!
+ * Worker for PDMQueueInsert and PDMQueueInsertEx.
  *
+ * @returns true if the insert requested a flush by setting VM_FF_PDM_QUEUES,
+ *          false if it joined a pending batch or the queue is timer driven.
  * @param   pQueue      The queue handle.
  * @param   pItem       The item to insert.
- * @thread  Any thread.
  */
-VMMDECL(void) PDMQueueInsert(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem)
+static bool pdmQueueInsertWorker(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem)
 {
     Assert(VALID_PTR(pQueue) && pQueue->CTX_SUFF(pVM));
     Assert(VALID_PTR(pItem));
 
+    uint32_t const cPending = ASMAtomicIncU32(&pQueue->cPending);
+
 #if 0 /* the paranoid android version: */
     void *pvNext;
     do
@@ -110,10 +113,60 @@ VMMDECL(void) PDMQueueInsert(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem)
     } while (!ASMAtomicCmpXchgPtr(&pQueue->CTX_SUFF(pPending), pItem, pNext));
 #endif
 
-    if (!pQueue->pTimer)
-        pdmQueueSetFF(pQueue);
     STAM_REL_COUNTER_INC(&pQueue->StatInsert);
-    STAM_STATS({ ASMAtomicIncU32(&pQueue->cStatPending); });
+
+    /*
+     * Only the insert starting a new batch needs to get the attention of the
+     * flusher.  Inserts arriving before it gets around to the queue join that
+     * batch, so under load the items coalesce into one flush while a lone
+     * item is still flushed right away.
+     */
+    bool fSetFF = false;
+    if (!ASMAtomicXchgU32(&pQueue->fBatchPending, true))
+    {
+#ifdef VBOX_WITH_STATISTICS
+        ASMAtomicWriteU64(&pQueue->u64BatchStartNS, RTTimeNanoTS());
+#endif
+        if (!pQueue->pTimer)
+        {
+            pdmQueueSetFF(pQueue);
+            fSetFF = true;
+        }
+    }
+    else
+        STAM_REL_COUNTER_INC(&pQueue->StatInsertCoalesced);
+
+#ifdef IN_RING3
+    /*
+     * A timer driven queue filling up faster than the interval drains it is
+     * flushed early rather than letting PDMQueueAlloc run dry.
+     */
+    if (   pQueue->pTimer
+        && cPending == RT_MAX(pQueue->cItems / 2, 1))
+    {
+        STAM_REL_COUNTER_INC(&pQueue->StatFlushEarly);
+        int rc = TMTimerSetMillies(pQueue->pTimer, 0);
+        AssertRC(rc);
+    }
+#else
+    RT_NOREF(cPending);
+#endif
+    return fSetFF;
+}
+
+
+/**
+ * Queue an item.
+ * The item must have been obtained using PDMQueueAlloc(). Once the item
+ * have been passed to this function it must not be touched!
+ *
+ * @param   pQueue      The queue handle.
+ * @param   pItem       The item to insert.
+ * @thread  Any thread.
+ */
+VMMDECL(void) PDMQueueInsert(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem)
+{
+    pdmQueueInsertWorker(pQueue, pItem);
 }
 
 
@@ -131,7 +184,7 @@ VMMDECL(void) PDMQueueInsert(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem)
 VMMDECL(void) PDMQueueInsertEx(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem, uint64_t NanoMaxDelay)
 {
     NOREF(NanoMaxDelay);
-    PDMQueueInsert(pQueue, pItem);
+    bool const fFlush = pdmQueueInsertWorker(pQueue, pItem);
 #ifdef IN_RC
     PVM pVM = pQueue->CTX_SUFF(pVM);
     /** @todo figure out where to put this, the next bit should go there too.
@@ -140,10 +193,16 @@ VMMDECL(void) PDMQueueInsertEx(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem, uint64
 
     }
     else */
+    /* Only the insert starting a batch needs to go to ring-3, the others join
+       the flush which is already on its way.  (Ring-0 needs no help here as
+       VM_FF_PDM_QUEUES is part of VM_FF_HM_TO_R3_MASK.) */
+    if (fFlush)
     {
         VMCPU_FF_SET(VMMGetCpu0(pVM), VMCPU_FF_TO_R3);
         Log2(("PDMQueueInsertEx: Setting VMCPU_FF_TO_R3\n"));
     }
+#else
+    RT_NOREF(fFlush);
 #endif
 }
 
@@ -22,6 +22,7 @@
 #define LOG_GROUP LOG_GROUP_PGM
 #include <VBox/vmm/dbgf.h>
 #include <VBox/vmm/pgm.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/mm.h>
 #include <VBox/vmm/em.h>
@@ -370,6 +371,7 @@ static int pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(PVMCC pVM, PPGMPHYSHAN
      * mapping the page.
      */
     bool                    fFlushTLBs = false;
+    bool                    fFlushIem  = false;
     int                     rc         = VINF_SUCCESS;
     PPGMPHYSHANDLERTYPEINT  pCurType   = PGMPHYSHANDLER_GET_TYPE(pVM, pCur);
     const unsigned          uState     = pCurType->uState;
@@ -385,6 +387,7 @@ static int pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(PVMCC pVM, PPGMPHYSHAN
         if (PGM_PAGE_GET_HNDL_PHYS_STATE(pPage) < uState)
         {
             PGM_PAGE_SET_HNDL_PHYS_STATE(pPage, uState);
+            fFlushIem |= uState == PGM_PAGE_HNDL_PHYS_STATE_ALL;
 
             const RTGCPHYS GCPhysPage = pRam->GCPhys + (i << PAGE_SHIFT);
             int rc2 = pgmPoolTrackUpdateGCPhys(pVM, GCPhysPage, pPage,
@@ -417,6 +420,11 @@ static int pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs(PVMCC pVM, PPGMPHYSHAN
     else
         Log(("pgmHandlerPhysicalSetRamFlagsAndFlushShadowPTs: doesn't flush guest TLBs. rc=%Rrc; sync flags=%x VMCPU_FF_PGM_SYNC_CR3=%d\n", rc, VMMGetCpu(pVM)->pgm.s.fSyncFlags, VMCPU_FF_IS_SET(VMMGetCpu(pVM), VMCPU_FF_PGM_SYNC_CR3)));
 
+    /* The IEM code TLB caches page readability, so it must be told when pages
+       start catching reads.  (Write monitoring doesn't matter to it.) */
+    if (fFlushIem)
+        IEMTlbInvalidateAllPhysicalAllCpus(pVM);
+
     return rc;
 }
 
@@ -23,6 +23,7 @@
 #include <VBox/vmm/pgm.h>
 #include <VBox/vmm/trpm.h>
 #include <VBox/vmm/vmm.h>
+#include <VBox/vmm/iem.h>
 #include <VBox/vmm/iom.h>
 #include <VBox/vmm/em.h>
 #include <VBox/vmm/nem.h>
@@ -586,6 +587,7 @@ void pgmPhysInvalidatePageMapTLB(PVMCC pVM)
         pVM->pgm.s.PhysTlbR3.aEntries[i].pv = 0;
     }
 
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
     pgmUnlock(pVM);
 }
 
@@ -596,7 +598,7 @@ void pgmPhysInvalidatePageMapTLB(PVMCC pVM)
  * @param   pVM     The cross context VM structure.
  * @param   GCPhys  GCPhys entry to flush
  */
-void pgmPhysInvalidatePageMapTLBEntry(PVM pVM, RTGCPHYS GCPhys)
+void pgmPhysInvalidatePageMapTLBEntry(PVMCC pVM, RTGCPHYS GCPhys)
 {
     PGM_LOCK_ASSERT_OWNER(pVM);
 
@@ -615,6 +617,8 @@ void pgmPhysInvalidatePageMapTLBEntry(PVM pVM, RTGCPHYS GCPhys)
     pVM->pgm.s.PhysTlbR3.aEntries[idx].pPage = 0;
     pVM->pgm.s.PhysTlbR3.aEntries[idx].pMap = 0;
     pVM->pgm.s.PhysTlbR3.aEntries[idx].pv = 0;
+
+    IEMTlbInvalidateAllPhysicalAllCpus(pVM);
 }
 
 
@@ -1080,6 +1084,31 @@ void pgmPhysPageMakeWriteMonitoredWritable(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS G
 }
 
 
+/**
+ * Restores the content of a page that is pending lazy restore from the saved
+ * state file.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   pPage       The physical page tracking structure.
+ * @param   GCPhys      The address of the page.
+ *
+ * @remarks Called from within the PGM critical section.
+ */
+static int pgmPhysLazyRestorePage(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+#ifdef IN_RING3
+    return pgmR3LazyRestorePage(pVM, pPage, GCPhys);
+#else
+    int rc = VMMRZCallRing3NoCpu(pVM, VMMCALLRING3_PGM_LAZY_RESTORE_PAGE, GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK);
+    AssertRCReturn(rc, rc);
+    Assert(!PGM_PAGE_IS_LAZY_RESTORE(pPage));
+    return rc;
+#endif
+}
+
+
 /**
  * Deal with pages that are not writable, i.e. not in the ALLOCATED state.
  *
@@ -1097,6 +1126,14 @@ void pgmPhysPageMakeWriteMonitoredWritable(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS G
 int pgmPhysPageMakeWritable(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
 {
     PGM_LOCK_ASSERT_OWNER(pVM);
+    if (RT_UNLIKELY(PGM_PAGE_IS_LAZY_RESTORE(pPage)))
+    {
+        /* Restoring it makes it writable, unless it's ballooned. */
+        int rc = pgmPhysLazyRestorePage(pVM, pPage, GCPhys);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
     switch (PGM_PAGE_GET_STATE(pPage))
     {
         case PGM_PAGE_STATE_WRITE_MONITORED:
@@ -1231,6 +1268,12 @@ static int pgmPhysPageMapCommon(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS GCPhys, PPPG
 {
     PGM_LOCK_ASSERT_OWNER(pVM);
     NOREF(GCPhys);
+    if (RT_UNLIKELY(PGM_PAGE_IS_LAZY_RESTORE(pPage)))
+    {
+        int rc = pgmPhysLazyRestorePage(pVM, pPage, GCPhys);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
 
 #ifdef VBOX_WITH_2X_4GB_ADDR_SPACE_IN_R0
     /*
@@ -1500,6 +1543,17 @@ int pgmPhysPageLoadIntoTlbWithPage(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
     PGM_LOCK_ASSERT_OWNER(pVM);
     STAM_COUNTER_INC(&pVM->pgm.s.CTX_SUFF(pStats)->CTX_MID_Z(Stat,PageMapTlbMisses));
 
+    /*
+     * Pages still in the saved state file must be restored first or we'd end
+     * up mapping the zero page.
+     */
+    if (RT_UNLIKELY(PGM_PAGE_IS_LAZY_RESTORE(pPage)))
+    {
+        int rc = pgmPhysLazyRestorePage(pVM, pPage, GCPhys);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
     /*
      * Map the page.
      * Make a special case for the zero page as it is kind of special.
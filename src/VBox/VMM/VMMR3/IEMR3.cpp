@@ -22,6 +22,7 @@
 #define LOG_GROUP LOG_GROUP_EM
 #include <VBox/vmm/iem.h>
 #include <VBox/vmm/cpum.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/mm.h>
 #include "IEMInternal.h"
 #include <VBox/vmm/vm.h>
@@ -63,6 +64,26 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
     uint64_t const uInitialTlbRevision = UINT64_C(0) - (IEMTLB_REVISION_INCR * 200U);
     uint64_t const uInitialTlbPhysRev  = UINT64_C(0) - (IEMTLB_PHYS_REV_INCR * 100U);
 
+    /*
+     * Read configuration.
+     */
+    PCFGMNODE pCfgIem = CFGMR3GetChild(CFGMR3GetRoot(pVM), "IEM");
+
+    /** @cfgm{/IEM/ThreadedExec, bool, false}
+     * Whether IEMExecLots should execute guest code thru the per-CPU translation
+     * block cache, replaying pre-decoded instructions instead of decoding them
+     * every time. */
+    bool fThreadedExec = false;
+    int rc = CFGMR3QueryBoolDef(pCfgIem, "ThreadedExec", &fThreadedExec, false);
+    AssertLogRelRCReturn(rc, rc);
+#ifndef IEM_WITH_THREADED_EXEC
+    if (fThreadedExec)
+    {
+        LogRel(("IEM: ThreadedExec is not supported by this build\n"));
+        fThreadedExec = false;
+    }
+#endif
+
     for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
     {
         PVMCPU pVCpu = pVM->apCpusR3[idCpu];
@@ -111,11 +132,34 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
         STAMR3RegisterF(pVM, (void *)&pVCpu->iem.s.DataTlb.uTlbPhysRev, STAMTYPE_X64,       STAMVISIBILITY_ALWAYS, STAMUNIT_NONE,
                         "Data TLB physical revision",               "/IEM/CPU%u/DataTlb-PhysRev", idCpu);
 
+        /* Allocate the translation block cache and register its statistics. */
+        if (fThreadedExec)
+        {
+            PIEMTBCACHE pTbCache = (PIEMTBCACHE)MMR3HeapAllocZ(pVM, MM_TAG_IEM, sizeof(IEMTBCACHE));
+            AssertLogRelReturn(pTbCache, VERR_NO_MEMORY);
+            pVCpu->iem.s.pTbCacheR3 = pTbCache;
+
+            STAMR3RegisterF(pVM, &pTbCache->StatLookupHits,     STAMTYPE_COUNTER,   STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                            "Translation blocks found in the hash table",   "/IEM/CPU%u/Tb/LookupHits", idCpu);
+            STAMR3RegisterF(pVM, &pTbCache->StatChainHits,      STAMTYPE_COUNTER,   STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                            "Translation blocks found thru chaining",       "/IEM/CPU%u/Tb/ChainHits", idCpu);
+            STAMR3RegisterF(pVM, &pTbCache->StatLookupMisses,   STAMTYPE_COUNTER,   STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                            "Translation blocks recorded",                  "/IEM/CPU%u/Tb/LookupMisses", idCpu);
+            STAMR3RegisterF(pVM, &pTbCache->StatInvalidations,  STAMTYPE_COUNTER,   STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                            "Translation blocks invalidated by code changes", "/IEM/CPU%u/Tb/Invalidations", idCpu);
+            STAMR3RegisterF(pVM, &pTbCache->StatFlushes,        STAMTYPE_COUNTER,   STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                            "Translation block cache flushes",              "/IEM/CPU%u/Tb/Flushes", idCpu);
+            STAMR3RegisterF(pVM, &pTbCache->StatThreadedCalls,  STAMTYPE_COUNTER,   STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                            "Pre-decoded instructions executed",            "/IEM/CPU%u/Tb/ThreadedCalls", idCpu);
+            STAMR3RegisterF(pVM, &pTbCache->StatGenericCalls,   STAMTYPE_COUNTER,   STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,
+                            "Instructions decoded again from a block",      "/IEM/CPU%u/Tb/GenericCalls", idCpu);
+        }
+
 #if defined(VBOX_WITH_STATISTICS) && !defined(DOXYGEN_RUNNING)
         /* Allocate instruction statistics and register them. */
         pVCpu->iem.s.pStatsR3 = (PIEMINSTRSTATS)MMR3HeapAllocZ(pVM, MM_TAG_IEM, sizeof(IEMINSTRSTATS));
         AssertLogRelReturn(pVCpu->iem.s.pStatsR3, VERR_NO_MEMORY);
-        int rc = MMHyperAlloc(pVM, sizeof(IEMINSTRSTATS), sizeof(uint64_t), MM_TAG_IEM, (void **)&pVCpu->iem.s.pStatsCCR3);
+        rc = MMHyperAlloc(pVM, sizeof(IEMINSTRSTATS), sizeof(uint64_t), MM_TAG_IEM, (void **)&pVCpu->iem.s.pStatsCCR3);
         AssertLogRelRCReturn(rc, rc);
         pVCpu->iem.s.pStatsR0 = MMHyperR3ToR0(pVM, pVCpu->iem.s.pStatsCCR3);
 # define IEM_DO_INSTR_STAT(a_Name, a_szDesc) \
@@ -132,6 +176,8 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
          */
         if (idCpu == 0)
         {
+            if (fThreadedExec)
+                LogRel(("IEM: Threaded execution enabled (%u translation blocks per CPU)\n", IEMTBCACHE_TB_COUNT));
             pVCpu->iem.s.enmCpuVendor             = CPUMGetGuestCpuVendor(pVM);
             pVCpu->iem.s.enmHostCpuVendor         = CPUMGetHostCpuVendor(pVM);
 #if IEM_CFG_TARGET_CPU == IEMTARGETCPU_DYNAMIC
@@ -175,12 +221,12 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
     if (pVM->cpum.ro.GuestFeatures.fVmx)
     {
         PVMCPU pVCpu0 = pVM->apCpusR3[0];
-        int rc = PGMR3HandlerPhysicalTypeRegister(pVM, PGMPHYSHANDLERKIND_ALL, iemVmxApicAccessPageHandler,
-                                                  NULL /* pszModR0 */,
-                                                  "iemVmxApicAccessPageHandler", NULL /* pszPfHandlerR0 */,
-                                                  NULL /* pszModRC */,
-                                                  NULL /* pszHandlerRC */, NULL /* pszPfHandlerRC */,
-                                                  "VMX APIC-access page", &pVCpu0->iem.s.hVmxApicAccessPage);
+        rc = PGMR3HandlerPhysicalTypeRegister(pVM, PGMPHYSHANDLERKIND_ALL, iemVmxApicAccessPageHandler,
+                                              NULL /* pszModR0 */,
+                                              "iemVmxApicAccessPageHandler", NULL /* pszPfHandlerR0 */,
+                                              NULL /* pszModRC */,
+                                              NULL /* pszHandlerRC */, NULL /* pszPfHandlerRC */,
+                                              "VMX APIC-access page", &pVCpu0->iem.s.hVmxApicAccessPage);
         AssertLogRelRCReturn(rc, rc);
     }
 #endif
@@ -191,15 +237,16 @@ VMMR3DECL(int)      IEMR3Init(PVM pVM)
 
 VMMR3DECL(int)      IEMR3Term(PVM pVM)
 {
-    NOREF(pVM);
-#if defined(VBOX_WITH_STATISTICS) && !defined(DOXYGEN_RUNNING)
     for (VMCPUID idCpu = 0; idCpu < pVM->cCpus; idCpu++)
     {
         PVMCPU pVCpu = pVM->apCpusR3[idCpu];
+        MMR3HeapFree(pVCpu->iem.s.pTbCacheR3);
+        pVCpu->iem.s.pTbCacheR3 = NULL;
+#if defined(VBOX_WITH_STATISTICS) && !defined(DOXYGEN_RUNNING)
         MMR3HeapFree(pVCpu->iem.s.pStatsR3);
         pVCpu->iem.s.pStatsR3 = NULL;
-    }
 #endif
+    }
     return VINF_SUCCESS;
 }
 
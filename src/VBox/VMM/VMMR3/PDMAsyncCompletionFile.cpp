@@ -35,6 +35,7 @@
 #include <iprt/critsect.h>
 #include <iprt/env.h>
 #include <iprt/file.h>
+#include <iprt/ioqueue.h>
 #include <iprt/mem.h>
 #include <iprt/semaphore.h>
 #include <iprt/string.h>
@@ -201,6 +202,12 @@ static void pdmacFileAioMgrWakeup(PPDMACEPFILEMGR pAioMgr)
             int rc = RTSemEventSignal(pAioMgr->EventSem);
             AssertRC(rc);
         }
+        else if (pAioMgr->enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE)
+        {
+            /* The manager might be waiting for completions, kick it so it picks up the new requests. */
+            int rc = RTIoQueueEvtWaitWakeup(pAioMgr->hIoQueue);
+            AssertRC(rc);
+        }
     }
 }
 
@@ -213,9 +220,13 @@ static int pdmacFileAioMgrWaitForBlockingEvent(PPDMACEPFILEMGR pAioMgr, PDMACEPF
     /* Wakeup the async I/O manager */
     pdmacFileAioMgrWakeup(pAioMgr);
 
-    /* Wait for completion. */
-    int rc = RTSemEventWait(pAioMgr->EventSemBlock, RT_INDEFINITE_WAIT);
-    AssertRC(rc);
+    /* Wait for completion unless the manager thread terminated because of an error. */
+    int rc = VINF_SUCCESS;
+    if (ASMAtomicReadU32((volatile uint32_t *)&pAioMgr->enmState) != PDMACEPFILEMGRSTATE_FAULT)
+    {
+        rc = RTSemEventWait(pAioMgr->EventSemBlock, RT_INDEFINITE_WAIT);
+        AssertRC(rc);
+    }
 
     ASMAtomicXchgBool(&pAioMgr->fBlockingEventPending, false);
     ASMAtomicWriteU32((volatile uint32_t *)&pAioMgr->enmBlockingEvent, PDMACEPFILEAIOMGRBLOCKINGEVENT_INVALID);
@@ -453,25 +464,37 @@ int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILE
                 if (RT_SUCCESS(rc))
                 {
                     /* Init the rest of the manager. */
-                    if (pAioMgrNew->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
-                        rc = pdmacFileAioMgrNormalInit(pAioMgrNew);
+                    PFNRTTHREAD pfnThread;
+                    const char *pszSuff;
+                    switch (pAioMgrNew->enmMgrType)
+                    {
+                        case PDMACEPFILEMGRTYPE_SIMPLE:
+                            pfnThread = pdmacFileAioMgrFailsafe;
+                            pszSuff   = "F";
+                            break;
+                        case PDMACEPFILEMGRTYPE_IOQUEUE:
+                            rc = pdmacFileAioMgrIoQueueInit(pAioMgrNew, pEpClass);
+                            pfnThread = pdmacFileAioMgrIoQueue;
+                            pszSuff   = "Q";
+                            break;
+                        default:
+                            rc = pdmacFileAioMgrNormalInit(pAioMgrNew);
+                            pfnThread = pdmacFileAioMgrNormal;
+                            pszSuff   = "N";
+                            break;
+                    }
 
                     if (RT_SUCCESS(rc))
                     {
                         pAioMgrNew->enmState = PDMACEPFILEMGRSTATE_RUNNING;
 
                         rc = RTThreadCreateF(&pAioMgrNew->Thread,
-                                             pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_SIMPLE
-                                             ? pdmacFileAioMgrFailsafe
-                                             : pdmacFileAioMgrNormal,
+                                             pfnThread,
                                              pAioMgrNew,
                                              0,
                                              RTTHREADTYPE_IO,
                                              0,
-                                             "AioMgr%d-%s", pEpClass->cAioMgrs,
-                                             pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_SIMPLE
-                                             ? "F"
-                                             : "N");
+                                             "AioMgr%d-%s", pEpClass->cAioMgrs, pszSuff);
                         if (RT_SUCCESS(rc))
                         {
                             /* Link it into the list. */
@@ -488,7 +511,10 @@ int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILE
                             Log(("PDMAC: Successfully created new file AIO Mgr {%s}\n", RTThreadGetName(pAioMgrNew->Thread)));
                             return VINF_SUCCESS;
                         }
-                        pdmacFileAioMgrNormalDestroy(pAioMgrNew);
+                        if (pAioMgrNew->enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE)
+                            pdmacFileAioMgrIoQueueDestroy(pAioMgrNew);
+                        else if (pAioMgrNew->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+                            pdmacFileAioMgrNormalDestroy(pAioMgrNew);
                     }
                     RTCritSectDelete(&pAioMgrNew->CritSectBlockingEvent);
                 }
@@ -539,7 +565,9 @@ static void pdmacFileAioMgrDestroy(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile,
     RTCritSectDelete(&pAioMgr->CritSectBlockingEvent);
     RTSemEventDestroy(pAioMgr->EventSem);
     RTSemEventDestroy(pAioMgr->EventSemBlock);
-    if (pAioMgr->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
+    if (pAioMgr->enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE)
+        pdmacFileAioMgrIoQueueDestroy(pAioMgr);
+    else if (pAioMgr->enmMgrType != PDMACEPFILEMGRTYPE_SIMPLE)
         pdmacFileAioMgrNormalDestroy(pAioMgr);
 
     MMR3HeapFree(pAioMgr);
@@ -553,6 +581,8 @@ static int pdmacFileMgrTypeFromName(const char *pszVal, PPDMACEPFILEMGRTYPE penm
         *penmMgrType = PDMACEPFILEMGRTYPE_SIMPLE;
     else if (!RTStrCmp(pszVal, "Async"))
         *penmMgrType = PDMACEPFILEMGRTYPE_ASYNC;
+    else if (!RTStrCmp(pszVal, "IoQueue"))
+        *penmMgrType = PDMACEPFILEMGRTYPE_IOQUEUE;
     else
         rc = VERR_CFGM_CONFIG_UNKNOWN_VALUE;
 
@@ -565,6 +595,8 @@ static const char *pdmacFileMgrTypeToName(PDMACEPFILEMGRTYPE enmMgrType)
         return "Simple";
     if (enmMgrType == PDMACEPFILEMGRTYPE_ASYNC)
         return "Async";
+    if (enmMgrType == PDMACEPFILEMGRTYPE_IOQUEUE)
+        return "IoQueue";
 
     return NULL;
 }
@@ -824,6 +856,27 @@ static DECLCALLBACK(int) pdmacFileInitialize(PPDMASYNCCOMPLETIONEPCLASS pClassGl
             if (RT_FAILURE(rc))
                 return rc;
 
+            if (pEpClassFile->enmMgrTypeOverride == PDMACEPFILEMGRTYPE_IOQUEUE)
+            {
+                rc = CFGMR3QueryU32Def(pCfgNode, "IoQueueDepth", &pEpClassFile->cIoQueueDepth, 128);
+                AssertLogRelRCReturn(rc, rc);
+                rc = CFGMR3QueryBoolDef(pCfgNode, "IoQueueSqPoll", &pEpClassFile->fIoQueueSqPoll, false);
+                AssertLogRelRCReturn(rc, rc);
+                rc = CFGMR3QueryBoolDef(pCfgNode, "IoQueueFixedFiles", &pEpClassFile->fIoQueueFixedFiles, true);
+                AssertLogRelRCReturn(rc, rc);
+                AssertLogRelMsgReturn(pEpClassFile->cIoQueueDepth, ("AIOMgr: IoQueueDepth must not be 0\n"),
+                                      VERR_INVALID_PARAMETER);
+
+                pEpClassFile->pIoQueueProv = RTIoQueueProviderGetById("LnxIoURingFile");
+                if (   !pEpClassFile->pIoQueueProv
+                    || !pEpClassFile->pIoQueueProv->pfnIsSupported())
+                {
+                    LogRel(("AIOMgr: I/O queue manager not supported on this host, falling back to the async manager\n"));
+                    pEpClassFile->pIoQueueProv       = NULL;
+                    pEpClassFile->enmMgrTypeOverride = PDMACEPFILEMGRTYPE_ASYNC;
+                }
+            }
+
             LogRel(("AIOMgr: Default manager type is '%s'\n", pdmacFileMgrTypeToName(pEpClassFile->enmMgrTypeOverride)));
 
             /* Query default backend type */
@@ -959,8 +1012,12 @@ static DECLCALLBACK(int) pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndp
                 enmEpBackend = PDMACFILEEPBACKEND_BUFFERED;
 
 #ifdef RT_OS_LINUX
-                fFileFlags &= ~RTFILE_O_ASYNC_IO;
-                enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+                /* The I/O queue manager handles buffered I/O just fine. */
+                if (enmMgrType != PDMACEPFILEMGRTYPE_IOQUEUE)
+                {
+                    fFileFlags &= ~RTFILE_O_ASYNC_IO;
+                    enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+                }
 #endif
             }
             RTFileClose(hFile);
@@ -989,8 +1046,11 @@ static DECLCALLBACK(int) pdmacFileEpInitialize(PPDMASYNCCOMPLETIONENDPOINT pEndp
         enmEpBackend = PDMACFILEEPBACKEND_BUFFERED;
 
 #ifdef RT_OS_LINUX
-        fFileFlags &= ~RTFILE_O_ASYNC_IO;
-        enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        if (enmMgrType != PDMACEPFILEMGRTYPE_IOQUEUE)
+        {
+            fFileFlags &= ~RTFILE_O_ASYNC_IO;
+            enmMgrType   = PDMACEPFILEMGRTYPE_SIMPLE;
+        }
 #endif
 
         /* Open again. */
@@ -0,0 +1,1130 @@
+/* $Id: PDMAsyncCompletionFileIoQueue.cpp $ */
+/** @file
+ * PDM Async I/O - Async File I/O manager using the RTIoQueue API.
+ */
+
+/*
+ * Copyright (C) 2006-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+/** @page pg_pdm_async_completion_ioqueue   PDM Async I/O - I/O queue manager
+ *
+ * The I/O queue manager is an alternative to the normal async I/O manager which
+ * is built on top of the generic RTIoQueue API instead of RTFileAio. On Linux
+ * hosts this means io_uring where requests are put into a submission ring shared
+ * with the kernel and committed in batches, optionally with the files registered
+ * up front (fixed files) and a kernel thread polling the submission ring so the
+ * hot path gets along without any syscall at all.
+ *
+ * The manager is selected with the "IoMgr" key set to "IoQueue" in the
+ * PDM/AsyncCompletion/File CFGM node.  The following additional keys are
+ * evaluated:
+ *      - IoQueueDepth:      Maximum number of requests in flight for one manager.
+ *      - IoQueueFixedFiles: Whether to register the files with the ring.
+ *      - IoQueueSqPoll:     Whether the kernel should poll the submission ring.
+ *
+ * Unlike the normal manager there is no need to grow the context at runtime
+ * because the queue depth is fixed when the manager is created. Range locking and
+ * bounce buffering for unaligned requests on non buffered endpoints work exactly
+ * like in the normal manager.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#define LOG_GROUP LOG_GROUP_PDM_ASYNC_COMPLETION
+#include <iprt/types.h>
+#include <iprt/asm.h>
+#include <iprt/file.h>
+#include <iprt/ioqueue.h>
+#include <iprt/mem.h>
+#include <iprt/string.h>
+#include <iprt/assert.h>
+#include <VBox/log.h>
+
+#include "PDMAsyncCompletionFileInternal.h"
+
+
+/*********************************************************************************************************************************
+*   Defined Constants And Macros                                                                                                 *
+*********************************************************************************************************************************/
+/** The update period for the I/O load statistics in ms. */
+#define PDMACEPFILEMGR_LOAD_UPDATE_PERIOD   1000
+
+
+/*********************************************************************************************************************************
+*   Internal functions                                                                                                           *
+*********************************************************************************************************************************/
+static int pdmacFileAioMgrIoQueueProcessTaskList(PPDMACTASKFILE pTaskHead,
+                                                 PPDMACEPFILEMGR pAioMgr,
+                                                 PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint);
+static int pdmacFileAioMgrIoQueueCommit(PPDMACEPFILEMGR pAioMgr);
+static void pdmacFileAioMgrIoQueueReqComplete(PPDMACEPFILEMGR pAioMgr, PCRTIOQUEUECEVT pCEvt);
+
+
+int pdmacFileAioMgrIoQueueInit(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass)
+{
+    AssertPtrReturn(pEpClass->pIoQueueProv, VERR_NOT_SUPPORTED);
+
+    uint32_t fFlags = 0;
+    if (pEpClass->fIoQueueFixedFiles)
+        fFlags |= RTIOQUEUE_F_FIXED_HANDLES;
+    if (pEpClass->fIoQueueSqPoll)
+        fFlags |= RTIOQUEUE_F_SQ_POLL;
+
+    pAioMgr->cRequestsActiveMax   = pEpClass->cIoQueueDepth;
+    pAioMgr->cIoQueueReqsPrepared = 0;
+
+    int rc = RTIoQueueCreate(&pAioMgr->hIoQueue, pEpClass->pIoQueueProv, fFlags,
+                             pAioMgr->cRequestsActiveMax, pAioMgr->cRequestsActiveMax);
+    if (   RT_FAILURE(rc)
+        && fFlags)
+    {
+        /* SQ polling needs elevated privileges on older hosts and fixed files a recent kernel. */
+        LogRel(("AIOMgr: Creating I/O queue with flags %#x failed with %Rrc, retrying without\n", fFlags, rc));
+        fFlags = 0;
+        rc = RTIoQueueCreate(&pAioMgr->hIoQueue, pEpClass->pIoQueueProv, fFlags,
+                             pAioMgr->cRequestsActiveMax, pAioMgr->cRequestsActiveMax);
+    }
+
+    if (RT_SUCCESS(rc))
+    {
+        pAioMgr->paIoQueueCEvts = (PRTIOQUEUECEVT)RTMemAllocZ(pAioMgr->cRequestsActiveMax * sizeof(RTIOQUEUECEVT));
+        if (pAioMgr->paIoQueueCEvts)
+        {
+            /* Create the range lock memcache. */
+            rc = RTMemCacheCreate(&pAioMgr->hMemCacheRangeLocks, sizeof(PDMACFILERANGELOCK),
+                                  0, UINT32_MAX, NULL, NULL, NULL, 0);
+            if (RT_SUCCESS(rc))
+            {
+                LogRel(("AIOMgr: I/O queue manager using provider '%s' (depth %u, flags %#x)\n",
+                        pEpClass->pIoQueueProv->pszId, pAioMgr->cRequestsActiveMax, fFlags));
+                return VINF_SUCCESS;
+            }
+
+            RTMemFree(pAioMgr->paIoQueueCEvts);
+            pAioMgr->paIoQueueCEvts = NULL;
+        }
+        else
+            rc = VERR_NO_MEMORY;
+
+        RTIoQueueDestroy(pAioMgr->hIoQueue);
+        pAioMgr->hIoQueue = NIL_RTIOQUEUE;
+    }
+
+    return rc;
+}
+
+void pdmacFileAioMgrIoQueueDestroy(PPDMACEPFILEMGR pAioMgr)
+{
+    int rc = RTIoQueueDestroy(pAioMgr->hIoQueue);
+    AssertRC(rc);
+
+    RTMemFree(pAioMgr->paIoQueueCEvts);
+    RTMemCacheDestroy(pAioMgr->hMemCacheRangeLocks);
+    pAioMgr->hIoQueue       = NIL_RTIOQUEUE;
+    pAioMgr->paIoQueueCEvts = NULL;
+}
+
+/**
+ * Initializes the generic handle for the file of the given endpoint.
+ */
+DECLINLINE(void) pdmacFileAioMgrIoQueueEpHandleInit(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, PRTHANDLE pHandle)
+{
+    pHandle->enmType = RTHANDLETYPE_FILE;
+    pHandle->u.hFile = pEndpoint->hFile;
+}
+
+/**
+ * Releases the file of an endpoint which has no requests active anymore from the
+ * I/O queue and reopens it with the current flags so the next manager can use it.
+ *
+ * @returns nothing.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint to release.
+ */
+static void pdmacFileAioMgrIoQueueEpRelease(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    RTHANDLE Hnd;
+    pdmacFileAioMgrIoQueueEpHandleInit(pEndpoint, &Hnd);
+
+    int rc = RTIoQueueHandleDeregister(pAioMgr->hIoQueue, &Hnd);
+    AssertRC(rc);
+
+    /* Reopen the file so that the new manager gets the flags it expects. */
+    RTFileClose(pEndpoint->hFile);
+    rc = RTFileOpen(&pEndpoint->hFile, pEndpoint->Core.pszUri, pEndpoint->fFlags);
+    AssertRC(rc);
+}
+
+/**
+ * Removes an endpoint from the currently assigned manager.
+ *
+ * @returns TRUE if there are still requests pending on the current manager for this endpoint.
+ *          FALSE otherwise.
+ * @param   pEndpointRemove    The endpoint to remove.
+ */
+static bool pdmacFileAioMgrIoQueueRemoveEndpoint(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointRemove)
+{
+    PPDMASYNCCOMPLETIONENDPOINTFILE pPrev   = pEndpointRemove->AioMgr.pEndpointPrev;
+    PPDMASYNCCOMPLETIONENDPOINTFILE pNext   = pEndpointRemove->AioMgr.pEndpointNext;
+    PPDMACEPFILEMGR                 pAioMgr = pEndpointRemove->pAioMgr;
+
+    pAioMgr->cEndpoints--;
+
+    if (pPrev)
+        pPrev->AioMgr.pEndpointNext = pNext;
+    else
+        pAioMgr->pEndpointsHead = pNext;
+
+    if (pNext)
+        pNext->AioMgr.pEndpointPrev = pPrev;
+
+    /* Make sure that there is no request pending on this manager for the endpoint. */
+    if (!pEndpointRemove->AioMgr.cRequestsActive)
+    {
+        Assert(!pEndpointRemove->pFlushReq);
+        pdmacFileAioMgrIoQueueEpRelease(pAioMgr, pEndpointRemove);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Moves an endpoint whose file couldn't be registered with the I/O queue over to
+ * its own failsafe manager, leaving the other endpoints of the manager alone.
+ *
+ * This happens when the fixed file table is full while the kernel polls the
+ * submission ring, because the file can't be used unregistered then.  If no
+ * failsafe manager can be created the endpoint stays, and its requests fail
+ * individually.
+ *
+ * @returns nothing.
+ * @param   pEndpoint   The endpoint which was just added.
+ * @param   rcReg       The status code of the registration.
+ */
+static void pdmacFileAioMgrIoQueueEpRegisterFailed(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, int rcReg)
+{
+    LogRel(("AIOMgr: Registering endpoint %s with the I/O queue failed with %Rrc\n", pEndpoint->Core.pszUri, rcReg));
+    Assert(!pEndpoint->AioMgr.cRequestsActive);
+
+    PPDMACEPFILEMGR pAioMgrFailsafe;
+    int rc = pdmacFileAioMgrCreate((PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->Core.pEpClass,
+                                   &pAioMgrFailsafe, PDMACEPFILEMGRTYPE_SIMPLE);
+    if (RT_SUCCESS(rc))
+    {
+        LogRel(("AIOMgr: Migrating endpoint %s to failsafe manager\n", pEndpoint->Core.pszUri));
+
+        /* Disable direct I/O and enable the host cache. */
+        pEndpoint->fFlags &= ~(RTFILE_O_ASYNC_IO | RTFILE_O_NO_CACHE);
+
+        bool fReqsPending = pdmacFileAioMgrIoQueueRemoveEndpoint(pEndpoint);
+        Assert(!fReqsPending); NOREF(fReqsPending);
+
+        rc = pdmacFileAioMgrAddEndpoint(pAioMgrFailsafe, pEndpoint);
+        AssertRC(rc);
+    }
+    else
+        LogRel(("AIOMgr: Creating a failsafe manager for endpoint %s failed with %Rrc\n", pEndpoint->Core.pszUri, rc));
+}
+
+/**
+ * Checks if a given status code is fatal.
+ * Non fatal errors can be fixed by migrating the endpoint to a
+ * failsafe manager.
+ *
+ * @returns true If the error is fatal and migrating to a failsafe manager doesn't help
+ *          false If the error can be fixed by a migration. (image on NFS disk for example)
+ * @param   rcReq    The status code to check.
+ */
+DECLINLINE(bool) pdmacFileAioMgrIoQueueRcIsFatal(int rcReq)
+{
+    return rcReq == VERR_DEV_IO_ERROR
+        || rcReq == VERR_FILE_IO_ERROR
+        || rcReq == VERR_DISK_IO_ERROR
+        || rcReq == VERR_DISK_FULL
+        || rcReq == VERR_FILE_TOO_BIG;
+}
+
+/**
+ * Completes all tasks of the given list with the given status code.
+ *
+ * @returns nothing.
+ * @param   pEndpoint   The endpoint the tasks belong to.
+ * @param   pTaskHead   Head of the task list.
+ * @param   rc          The status code to complete the tasks with.
+ */
+static void pdmacFileAioMgrIoQueueFailTaskList(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, PPDMACTASKFILE pTaskHead, int rc)
+{
+    while (pTaskHead)
+    {
+        PPDMACTASKFILE pTask = pTaskHead;
+        pTaskHead = pTaskHead->pNext;
+
+        pTask->pNext = NULL;
+        pTask->pfnCompleted(pTask, pTask->pvUser, rc);
+        pdmacFileTaskFree(pEndpoint, pTask);
+    }
+}
+
+/**
+ * Error handler which will create the failsafe managers and destroy the failed I/O manager.
+ *
+ * Requests the I/O queue still completes are reaped first, afterwards every endpoint
+ * without active requests is migrated to its own failsafe manager. The tasks of endpoints
+ * which can't be migrated are completed with the given status code.
+ *
+ * @returns The given status code, the manager thread terminates afterwards.
+ * @param   pAioMgr     The I/O manager the error occurred on.
+ * @param   rc          The error code.
+ * @param   SRC_POS     The source location of the error (use RT_SRC_POS).
+ */
+static int pdmacFileAioMgrIoQueueErrorHandler(PPDMACEPFILEMGR pAioMgr, int rc, RT_SRC_POS_DECL)
+{
+    LogRel(("AIOMgr: I/O queue manager %#p encountered a critical error (rc=%Rrc) during operation. Falling back to failsafe mode. Expect reduced performance\n",
+            pAioMgr, rc));
+    LogRel(("AIOMgr: Error happened in %s:(%u){%s}\n", RT_SRC_POS_ARGS));
+    LogRel(("AIOMgr: Please contact the product vendor\n"));
+
+    PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint = pAioMgr->pEndpointsHead;
+    if (pEndpoint)
+    {
+        /* Don't create any new managers of this type. */
+        PPDMASYNCCOMPLETIONEPCLASSFILE pEpClassFile = (PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->Core.pEpClass;
+        ASMAtomicWriteU32((volatile uint32_t *)&pEpClassFile->enmMgrTypeOverride, PDMACEPFILEMGRTYPE_SIMPLE);
+    }
+
+    /*
+     * Reap the requests which are still active so their tasks get completed or
+     * migrated by the completion handler. Stop as soon as the I/O queue fails.
+     */
+    while (pAioMgr->cRequestsActive)
+    {
+        uint32_t cCEvts = 0;
+        int rc2 = pdmacFileAioMgrIoQueueCommit(pAioMgr);
+        if (RT_SUCCESS(rc2))
+            rc2 = RTIoQueueEvtWait(pAioMgr->hIoQueue, pAioMgr->paIoQueueCEvts, pAioMgr->cRequestsActiveMax,
+                                   1 /*cMinWait*/, &cCEvts, 0 /*fFlags*/);
+        if (RT_FAILURE(rc2) && rc2 != VERR_INTERRUPTED)
+        {
+            LogRel(("AIOMgr: Failed to reap %u active requests (rc=%Rrc)\n", pAioMgr->cRequestsActive, rc2));
+            break;
+        }
+
+        for (uint32_t i = 0; i < cCEvts; i++)
+            pdmacFileAioMgrIoQueueReqComplete(pAioMgr, &pAioMgr->paIoQueueCEvts[i]);
+    }
+
+    /* Move the endpoints over to failsafe managers or fail their tasks. */
+    pEndpoint = pAioMgr->pEndpointsHead;
+    while (pEndpoint)
+    {
+        PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointNext = pEndpoint->AioMgr.pEndpointNext;
+
+        if (   !pEndpoint->AioMgr.cRequestsActive
+            && pEndpoint->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE)
+        {
+            PPDMACEPFILEMGR pAioMgrFailsafe;
+            int rc2 = pdmacFileAioMgrCreate((PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->Core.pEpClass,
+                                            &pAioMgrFailsafe, PDMACEPFILEMGRTYPE_SIMPLE);
+            if (RT_SUCCESS(rc2))
+            {
+                LogRel(("AIOMgr: Migrating endpoint %s to failsafe manager\n", pEndpoint->Core.pszUri));
+
+                /* Disable direct I/O and enable the host cache. */
+                pEndpoint->fFlags &= ~(RTFILE_O_ASYNC_IO | RTFILE_O_NO_CACHE);
+
+                bool fReqsPending = pdmacFileAioMgrIoQueueRemoveEndpoint(pEndpoint);
+                Assert(!fReqsPending); NOREF(fReqsPending);
+
+                rc2 = pdmacFileAioMgrAddEndpoint(pAioMgrFailsafe, pEndpoint);
+                AssertRC(rc2);
+
+                pEndpoint = pEndpointNext;
+                continue;
+            }
+
+            LogRel(("AIOMgr: Creating a failsafe manager for endpoint %s failed with %Rrc\n",
+                    pEndpoint->Core.pszUri, rc2));
+        }
+
+        LogRel(("AIOMgr: Failing pending requests of endpoint %s with %Rrc\n", pEndpoint->Core.pszUri, rc));
+
+        PPDMACTASKFILE pTasksHead = pEndpoint->AioMgr.pReqsPendingHead;
+        pEndpoint->AioMgr.pReqsPendingHead = NULL;
+        pEndpoint->AioMgr.pReqsPendingTail = NULL;
+        pdmacFileAioMgrIoQueueFailTaskList(pEndpoint, pTasksHead, rc);
+        pdmacFileAioMgrIoQueueFailTaskList(pEndpoint, pdmacFileEpGetNewTasks(pEndpoint), rc);
+
+        pEndpoint = pEndpointNext;
+    }
+
+    /*
+     * The thread terminates after returning, so release anyone waiting for a
+     * blocking event to be processed (see pdmacFileAioMgrWaitForBlockingEvent()).
+     */
+    ASMAtomicWriteU32((volatile uint32_t *)&pAioMgr->enmState, PDMACEPFILEMGRSTATE_FAULT);
+    if (ASMAtomicReadBool(&pAioMgr->fBlockingEventPending))
+    {
+        int rc2 = RTSemEventSignal(pAioMgr->EventSemBlock);
+        AssertRC(rc2);
+    }
+
+    return rc;
+}
+
+/**
+ * Puts a request for the given task into the submission queue.
+ *
+ * The request gets only visible to the host after the next
+ * pdmacFileAioMgrIoQueueCommit() call.
+ *
+ * @returns VBox status code.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint the task belongs to.
+ * @param   pTask       The task the request is for.
+ * @param   enmOp       The operation to perform.
+ * @param   off         Start offset in the file.
+ * @param   pvBuf       The buffer to use.
+ * @param   cbBuf       Number of bytes to transfer.
+ */
+static int pdmacFileAioMgrIoQueueReqPrepare(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                            PPDMACTASKFILE pTask, RTIOQUEUEOP enmOp, RTFOFF off,
+                                            void *pvBuf, size_t cbBuf)
+{
+    RTHANDLE Hnd;
+    pdmacFileAioMgrIoQueueEpHandleInit(pEndpoint, &Hnd);
+
+    int rc = RTIoQueueRequestPrepare(pAioMgr->hIoQueue, &Hnd, enmOp, off, pvBuf, cbBuf,
+                                     0 /*fReqFlags*/, pTask);
+    if (RT_SUCCESS(rc))
+    {
+        pAioMgr->cIoQueueReqsPrepared++;
+        pAioMgr->cRequestsActive++;
+        pEndpoint->AioMgr.cRequestsActive++;
+    }
+
+    return rc;
+}
+
+/**
+ * Commits all prepared requests to the host.
+ *
+ * @returns VBox status code.
+ * @param   pAioMgr     The I/O manager.
+ */
+static int pdmacFileAioMgrIoQueueCommit(PPDMACEPFILEMGR pAioMgr)
+{
+    if (!pAioMgr->cIoQueueReqsPrepared)
+        return VINF_SUCCESS;
+
+    LogFlow(("Committing %u requests. I/O manager has a total of %u active requests now\n",
+             pAioMgr->cIoQueueReqsPrepared, pAioMgr->cRequestsActive));
+
+    int rc = RTIoQueueCommit(pAioMgr->hIoQueue);
+    if (RT_SUCCESS(rc))
+        pAioMgr->cIoQueueReqsPrepared = 0;
+
+    return rc;
+}
+
+/**
+ * Prepares a read or write request for the given task taking care of the
+ * alignment restrictions for non buffered endpoints.
+ *
+ * @returns VBox status code.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pEndpoint   The endpoint the task belongs to.
+ * @param   pTask       The task to prepare the request for.
+ */
+static int pdmacFileAioMgrIoQueueTaskPrepare(PPDMACEPFILEMGR pAioMgr,
+                                             PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                             PPDMACTASKFILE pTask)
+{
+    RTFOFF offStart     = pTask->Off;
+    size_t cbToTransfer = pTask->DataSeg.cbSeg;
+    bool   fAlignedReq  = true;
+
+    /*
+     * Non buffered endpoints need offset, transfer size and buffer address
+     * on a 512 byte boundary, see pdmacFileAioMgrNormalTaskPrepareNonBuffered().
+     */
+    if (pEndpoint->enmBackendType == PDMACFILEEPBACKEND_NON_BUFFERED)
+    {
+        offStart     = pTask->Off & ~(RTFOFF)(512-1);
+        cbToTransfer = RT_ALIGN_Z(pTask->DataSeg.cbSeg + (pTask->Off - offStart), 512);
+        fAlignedReq  =    cbToTransfer == pTask->DataSeg.cbSeg
+                       && offStart == pTask->Off;
+    }
+
+    AssertMsg(   pTask->enmTransferType == PDMACTASKFILETRANSFER_WRITE
+              || (uint64_t)(offStart + cbToTransfer) <= pEndpoint->cbFile,
+              ("Read exceeds file size offStart=%RTfoff cbToTransfer=%d cbFile=%llu\n",
+               offStart, cbToTransfer, pEndpoint->cbFile));
+
+    pTask->fPrefetch      = false;
+    pTask->cbBounceBuffer = 0;
+    pTask->cbTransfered   = 0;
+
+    /* Defer the task if it intersects with a locked range, see the normal manager for the details. */
+    if (pdmacFileAioMgrNormalIsRangeLocked(pEndpoint, offStart, cbToTransfer, pTask, fAlignedReq))
+    {
+        LogFlow(("Task %#p was deferred because the access range is locked\n", pTask));
+        return VINF_SUCCESS;
+    }
+
+    PPDMASYNCCOMPLETIONEPCLASSFILE  pEpClassFile    = (PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->Core.pEpClass;
+    PDMACTASKFILETRANSFER           enmTransferType = pTask->enmTransferType;
+    void                           *pvBuf           = pTask->DataSeg.pvSeg;
+
+    if (   pEndpoint->enmBackendType == PDMACFILEEPBACKEND_NON_BUFFERED
+        && (   !fAlignedReq
+            || ((pEpClassFile->uBitmaskAlignment & (RTR3UINTPTR)pvBuf) != (RTR3UINTPTR)pvBuf)))
+    {
+        LogFlow(("Using bounce buffer for task %#p cbToTransfer=%zd cbSeg=%zd offStart=%RTfoff off=%RTfoff\n",
+                 pTask, cbToTransfer, pTask->DataSeg.cbSeg, offStart, pTask->Off));
+
+        pTask->pvBounceBuffer = RTMemPageAlloc(cbToTransfer);
+        if (RT_UNLIKELY(!pTask->pvBounceBuffer))
+            return VERR_NO_MEMORY;
+
+        pTask->cbBounceBuffer  = cbToTransfer;
+        pTask->offBounceBuffer = pTask->Off - offStart;
+        pvBuf                  = pTask->pvBounceBuffer;
+
+        if (enmTransferType == PDMACTASKFILETRANSFER_WRITE)
+        {
+            if (!fAlignedReq)
+            {
+                /* We have to fill the buffer first before we can update the data. */
+                LogFlow(("Prefetching data for task %#p\n", pTask));
+                pTask->fPrefetch = true;
+                enmTransferType  = PDMACTASKFILETRANSFER_READ;
+            }
+            else
+                memcpy(pvBuf, pTask->DataSeg.pvSeg, pTask->DataSeg.cbSeg);
+        }
+    }
+
+    int rc = pdmacFileAioMgrNormalRangeLock(pAioMgr, pEndpoint, offStart, cbToTransfer, pTask, fAlignedReq);
+    if (RT_SUCCESS(rc))
+    {
+        if (enmTransferType == PDMACTASKFILETRANSFER_WRITE)
+        {
+            /* Grow the file if needed. */
+            if (RT_UNLIKELY((uint64_t)(pTask->Off + pTask->DataSeg.cbSeg) > pEndpoint->cbFile))
+            {
+                ASMAtomicWriteU64(&pEndpoint->cbFile, pTask->Off + pTask->DataSeg.cbSeg);
+                RTFileSetSize(pEndpoint->hFile, pTask->Off + pTask->DataSeg.cbSeg);
+            }
+
+            rc = pdmacFileAioMgrIoQueueReqPrepare(pAioMgr, pEndpoint, pTask, RTIOQUEUEOP_WRITE,
+                                                  offStart, pvBuf, cbToTransfer);
+        }
+        else
+            rc = pdmacFileAioMgrIoQueueReqPrepare(pAioMgr, pEndpoint, pTask, RTIOQUEUEOP_READ,
+                                                  offStart, pvBuf, cbToTransfer);
+        AssertRC(rc);
+    }
+    else if (pTask->cbBounceBuffer)
+    {
+        RTMemPageFree(pTask->pvBounceBuffer, pTask->cbBounceBuffer);
+        pTask->cbBounceBuffer = 0;
+    }
+
+    return rc;
+}
+
+static int pdmacFileAioMgrIoQueueProcessTaskList(PPDMACTASKFILE pTaskHead,
+                                                 PPDMACEPFILEMGR pAioMgr,
+                                                 PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    int rc = VINF_SUCCESS;
+
+    AssertMsg(pEndpoint->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE,
+              ("Trying to process request lists of a non active endpoint!\n"));
+
+    /* Go through the list and queue the requests until we get a flush request */
+    while (   pTaskHead
+           && !pEndpoint->pFlushReq
+           && pAioMgr->cRequestsActive < pAioMgr->cRequestsActiveMax
+           && RT_SUCCESS(rc))
+    {
+        RTMSINTERVAL msWhenNext;
+        PPDMACTASKFILE pCurr = pTaskHead;
+
+        if (!pdmacEpIsTransferAllowed(&pEndpoint->Core, (uint32_t)pCurr->DataSeg.cbSeg, &msWhenNext))
+        {
+            pAioMgr->msBwLimitExpired = RT_MIN(pAioMgr->msBwLimitExpired, msWhenNext);
+            break;
+        }
+
+        pTaskHead = pTaskHead->pNext;
+
+        pCurr->pNext = NULL;
+
+        AssertMsg(VALID_PTR(pCurr->pEndpoint) && (pCurr->pEndpoint == pEndpoint),
+                  ("Endpoints do not match\n"));
+
+        switch (pCurr->enmTransferType)
+        {
+            case PDMACTASKFILETRANSFER_FLUSH:
+            {
+                /* The flush blocks any new request until it completed. */
+                rc = pdmacFileAioMgrIoQueueReqPrepare(pAioMgr, pEndpoint, pCurr, RTIOQUEUEOP_SYNC,
+                                                      0 /*off*/, NULL /*pvBuf*/, 0 /*cbBuf*/);
+                AssertRC(rc);
+                if (RT_SUCCESS(rc))
+                {
+                    Assert(!pEndpoint->pFlushReq);
+                    pEndpoint->pFlushReq = pCurr;
+                    pEndpoint->AioMgr.cReqsProcessed++;
+                }
+                break;
+            }
+            case PDMACTASKFILETRANSFER_READ:
+            case PDMACTASKFILETRANSFER_WRITE:
+            {
+                rc = pdmacFileAioMgrIoQueueTaskPrepare(pAioMgr, pEndpoint, pCurr);
+                AssertRC(rc);
+                break;
+            }
+            default:
+                AssertMsgFailed(("Invalid transfer type %d\n", pCurr->enmTransferType));
+        } /* switch transfer type */
+    }
+
+    /* Add the rest of the tasks to the pending list */
+    if (pTaskHead)
+        pdmacFileAioMgrEpAddTaskList(pEndpoint, pTaskHead);
+
+    return rc;
+}
+
+/**
+ * Adds all pending requests for the given endpoint
+ * until a flush request is encountered or there is no
+ * request anymore.
+ *
+ * @returns VBox status code.
+ * @param   pAioMgr    The async I/O manager for the endpoint
+ * @param   pEndpoint  The endpoint to get the requests from.
+ */
+static int pdmacFileAioMgrIoQueueQueueReqs(PPDMACEPFILEMGR pAioMgr,
+                                           PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint)
+{
+    int rc = VINF_SUCCESS;
+    PPDMACTASKFILE pTasksHead = NULL;
+
+    AssertMsg(pEndpoint->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE,
+              ("Trying to process request lists of a non active endpoint!\n"));
+
+    Assert(!pEndpoint->pFlushReq);
+
+    /* Check the pending list first */
+    if (pEndpoint->AioMgr.pReqsPendingHead)
+    {
+        LogFlow(("Queuing pending requests first\n"));
+
+        pTasksHead = pEndpoint->AioMgr.pReqsPendingHead;
+        /*
+         * Clear the list as the processing routine will insert them into the list
+         * again if it gets a flush request.
+         */
+        pEndpoint->AioMgr.pReqsPendingHead = NULL;
+        pEndpoint->AioMgr.pReqsPendingTail = NULL;
+        rc = pdmacFileAioMgrIoQueueProcessTaskList(pTasksHead, pAioMgr, pEndpoint);
+    }
+
+    if (   RT_SUCCESS(rc)
+        && !pEndpoint->pFlushReq
+        && !pEndpoint->AioMgr.pReqsPendingHead)
+    {
+        /* Now the request queue. */
+        pTasksHead = pdmacFileEpGetNewTasks(pEndpoint);
+        if (pTasksHead)
+            rc = pdmacFileAioMgrIoQueueProcessTaskList(pTasksHead, pAioMgr, pEndpoint);
+    }
+
+    return rc;
+}
+
+static int pdmacFileAioMgrIoQueueProcessBlockingEvent(PPDMACEPFILEMGR pAioMgr)
+{
+    int rc = VINF_SUCCESS;
+    bool fNotifyWaiter = false;
+
+    LogFlowFunc((": Enter\n"));
+
+    Assert(pAioMgr->fBlockingEventPending);
+
+    switch (pAioMgr->enmBlockingEvent)
+    {
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_ADD_ENDPOINT:
+        {
+            PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointNew = ASMAtomicReadPtrT(&pAioMgr->BlockingEventData.AddEndpoint.pEndpoint, PPDMASYNCCOMPLETIONENDPOINTFILE);
+            AssertMsg(VALID_PTR(pEndpointNew), ("Adding endpoint event without a endpoint to add\n"));
+
+            pEndpointNew->enmState = PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE;
+
+            pEndpointNew->AioMgr.pEndpointNext = pAioMgr->pEndpointsHead;
+            pEndpointNew->AioMgr.pEndpointPrev = NULL;
+            if (pAioMgr->pEndpointsHead)
+                pAioMgr->pEndpointsHead->AioMgr.pEndpointPrev = pEndpointNew;
+            pAioMgr->pEndpointsHead = pEndpointNew;
+
+            /* Register the file with the I/O queue. */
+            RTHANDLE Hnd;
+            pdmacFileAioMgrIoQueueEpHandleInit(pEndpointNew, &Hnd);
+            fNotifyWaiter = true;
+            pAioMgr->cEndpoints++;
+            rc = RTIoQueueHandleRegister(pAioMgr->hIoQueue, &Hnd);
+            if (RT_FAILURE(rc))
+            {
+                /* Only this endpoint is affected, don't fault the whole manager. */
+                pdmacFileAioMgrIoQueueEpRegisterFailed(pEndpointNew, rc);
+                rc = VINF_SUCCESS;
+            }
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_REMOVE_ENDPOINT:
+        {
+            PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointRemove = ASMAtomicReadPtrT(&pAioMgr->BlockingEventData.RemoveEndpoint.pEndpoint, PPDMASYNCCOMPLETIONENDPOINTFILE);
+            AssertMsg(VALID_PTR(pEndpointRemove), ("Removing endpoint event without a endpoint to remove\n"));
+
+            pEndpointRemove->enmState = PDMASYNCCOMPLETIONENDPOINTFILESTATE_REMOVING;
+            fNotifyWaiter = !pdmacFileAioMgrIoQueueRemoveEndpoint(pEndpointRemove);
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_CLOSE_ENDPOINT:
+        {
+            PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointClose = ASMAtomicReadPtrT(&pAioMgr->BlockingEventData.CloseEndpoint.pEndpoint, PPDMASYNCCOMPLETIONENDPOINTFILE);
+            AssertMsg(VALID_PTR(pEndpointClose), ("Close endpoint event without a endpoint to close\n"));
+
+            if (pEndpointClose->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE)
+            {
+                LogFlowFunc((": Closing endpoint %#p{%s}\n", pEndpointClose, pEndpointClose->Core.pszUri));
+
+                /* Make sure all tasks finished. Process the queues a last time first. */
+                rc = pdmacFileAioMgrIoQueueQueueReqs(pAioMgr, pEndpointClose);
+                AssertRC(rc);
+                rc = pdmacFileAioMgrIoQueueCommit(pAioMgr);
+                AssertRC(rc);
+
+                pEndpointClose->enmState = PDMASYNCCOMPLETIONENDPOINTFILESTATE_CLOSING;
+                fNotifyWaiter = !pdmacFileAioMgrIoQueueRemoveEndpoint(pEndpointClose);
+            }
+            else if (   (pEndpointClose->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_CLOSING)
+                     && (!pEndpointClose->AioMgr.cRequestsActive))
+            {
+                pdmacFileAioMgrIoQueueEpRelease(pAioMgr, pEndpointClose);
+                fNotifyWaiter = true;
+            }
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_SHUTDOWN:
+        {
+            pAioMgr->enmState = PDMACEPFILEMGRSTATE_SHUTDOWN;
+            if (!pAioMgr->cRequestsActive)
+                fNotifyWaiter = true;
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_SUSPEND:
+        {
+            pAioMgr->enmState = PDMACEPFILEMGRSTATE_SUSPENDING;
+            break;
+        }
+        case PDMACEPFILEAIOMGRBLOCKINGEVENT_RESUME:
+        {
+            pAioMgr->enmState = PDMACEPFILEMGRSTATE_RUNNING;
+            fNotifyWaiter = true;
+            break;
+        }
+        default:
+            AssertReleaseMsgFailed(("Invalid event type %d\n", pAioMgr->enmBlockingEvent));
+    }
+
+    if (fNotifyWaiter)
+    {
+        ASMAtomicWriteBool(&pAioMgr->fBlockingEventPending, false);
+        pAioMgr->enmBlockingEvent = PDMACEPFILEAIOMGRBLOCKINGEVENT_INVALID;
+
+        /* Release the waiting thread. */
+        LogFlow(("Signalling waiter\n"));
+        int rc2 = RTSemEventSignal(pAioMgr->EventSemBlock);
+        AssertRC(rc2);
+    }
+
+    LogFlowFunc((": Leave\n"));
+    return rc;
+}
+
+/**
+ * Checks all endpoints for new requests.
+ *
+ * @returns VBox status code.
+ * @param   pAioMgr    The I/O manager handle.
+ */
+static int pdmacFileAioMgrIoQueueCheckEndpoints(PPDMACEPFILEMGR pAioMgr)
+{
+    /* Check the assigned endpoints for new tasks if there isn't a flush request active at the moment. */
+    int rc = VINF_SUCCESS;
+    PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint = pAioMgr->pEndpointsHead;
+
+    pAioMgr->msBwLimitExpired = RT_INDEFINITE_WAIT;
+
+    while (pEndpoint)
+    {
+        if (   !pEndpoint->pFlushReq
+            && pEndpoint->enmState == PDMASYNCCOMPLETIONENDPOINTFILESTATE_ACTIVE
+            && !pEndpoint->AioMgr.fMoving)
+        {
+            rc = pdmacFileAioMgrIoQueueQueueReqs(pAioMgr, pEndpoint);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+
+        pEndpoint = pEndpoint->AioMgr.pEndpointNext;
+    }
+
+    return rc;
+}
+
+/**
+ * Completes the given task and cleans up after a request finished.
+ *
+ * @returns nothing.
+ * @param   pAioMgr     The I/O manager.
+ * @param   pCEvt       The completion event.
+ */
+static void pdmacFileAioMgrIoQueueReqComplete(PPDMACEPFILEMGR pAioMgr, PCRTIOQUEUECEVT pCEvt)
+{
+    int rc = VINF_SUCCESS;
+    int rcReq = pCEvt->rcReq;
+    PPDMACTASKFILE pTask = (PPDMACTASKFILE)pCEvt->pvUser;
+    PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint = pTask->pEndpoint;
+    PPDMACTASKFILE pTasksWaiting;
+
+    LogFlowFunc(("pAioMgr=%#p pTask=%#p rcReq=%Rrc cbXfered=%zu\n", pAioMgr, pTask, rcReq, pCEvt->cbXfered));
+
+    pAioMgr->cRequestsActive--;
+    pEndpoint->AioMgr.cRequestsActive--;
+    pEndpoint->AioMgr.cReqsProcessed++;
+
+    /* A successful transfer without any progress would restart the transfer forever. */
+    if (   RT_SUCCESS(rcReq)
+        && pTask->enmTransferType != PDMACTASKFILETRANSFER_FLUSH
+        && !pCEvt->cbXfered)
+        rcReq = VERR_FILE_IO_ERROR;
+
+    if (pTask->enmTransferType == PDMACTASKFILETRANSFER_FLUSH)
+    {
+        AssertMsg(pEndpoint->pFlushReq == pTask, ("Completed flush request doesn't match active one\n"));
+        pEndpoint->pFlushReq = NULL;
+
+        /* Call completion callback */
+        LogFlow(("Flush task=%#p completed with %Rrc\n", pTask, rcReq));
+        pTask->pfnCompleted(pTask, pTask->pvUser, rcReq);
+        pdmacFileTaskFree(pEndpoint, pTask);
+    }
+    else if (RT_FAILURE(rcReq))
+    {
+        /* Free the lock and process pending tasks if necessary */
+        pTasksWaiting = pdmacFileAioMgrNormalRangeLockFree(pAioMgr, pEndpoint, pTask->pRangeLock);
+        if (pTasksWaiting)
+        {
+            rc = pdmacFileAioMgrIoQueueProcessTaskList(pTasksWaiting, pAioMgr, pEndpoint);
+            AssertRC(rc);
+        }
+
+        if (pTask->cbBounceBuffer)
+            RTMemPageFree(pTask->pvBounceBuffer, pTask->cbBounceBuffer);
+
+        /*
+         * Fatal errors are reported to the guest and non-fatal errors
+         * will cause a migration to the failsafe manager in the hope
+         * that the error disappears.
+         */
+        if (!pdmacFileAioMgrIoQueueRcIsFatal(rcReq))
+        {
+            /* Queue the request on the pending list. */
+            pTask->pNext = pEndpoint->AioMgr.pReqsPendingHead;
+            pEndpoint->AioMgr.pReqsPendingHead = pTask;
+            if (!pEndpoint->AioMgr.pReqsPendingTail)
+                pEndpoint->AioMgr.pReqsPendingTail = pTask;
+
+            /* Create a new failsafe manager if necessary. */
+            if (!pEndpoint->AioMgr.fMoving)
+            {
+                PPDMACEPFILEMGR pAioMgrFailsafe;
+
+                LogRel(("%s: Request %#p failed with rc=%Rrc, migrating endpoint %s to failsafe manager.\n",
+                        RTThreadGetName(pAioMgr->Thread), pTask, rcReq, pEndpoint->Core.pszUri));
+
+                pEndpoint->AioMgr.fMoving = true;
+
+                rc = pdmacFileAioMgrCreate((PPDMASYNCCOMPLETIONEPCLASSFILE)pEndpoint->Core.pEpClass,
+                                           &pAioMgrFailsafe, PDMACEPFILEMGRTYPE_SIMPLE);
+                AssertRC(rc);
+
+                pEndpoint->AioMgr.pAioMgrDst = pAioMgrFailsafe;
+
+                /* Update the flags to open the file with. Disable direct I/O and enable the host cache. */
+                pEndpoint->fFlags &= ~(RTFILE_O_ASYNC_IO | RTFILE_O_NO_CACHE);
+            }
+
+            /* If this was the last request for the endpoint migrate it to the new manager. */
+            if (!pEndpoint->AioMgr.cRequestsActive)
+            {
+                bool fReqsPending = pdmacFileAioMgrIoQueueRemoveEndpoint(pEndpoint);
+                Assert(!fReqsPending); NOREF(fReqsPending);
+
+                rc = pdmacFileAioMgrAddEndpoint(pEndpoint->AioMgr.pAioMgrDst, pEndpoint);
+                AssertRC(rc);
+            }
+        }
+        else
+        {
+            pTask->pfnCompleted(pTask, pTask->pvUser, rcReq);
+            pdmacFileTaskFree(pEndpoint, pTask);
+        }
+    }
+    else
+    {
+        /*
+         * Restart an incomplete transfer.
+         * This usually means that the request will return an error now
+         * but to get the cause of the error (disk full, file too big, I/O error, ...)
+         * the transfer needs to be continued.
+         */
+        pTask->cbTransfered += pCEvt->cbXfered;
+
+        if (RT_UNLIKELY(   pTask->cbTransfered < pTask->DataSeg.cbSeg
+                        || (   pTask->cbBounceBuffer
+                            && pTask->cbTransfered < pTask->cbBounceBuffer)))
+        {
+            RTFOFF offStart;
+            size_t cbToTransfer;
+            uint8_t *pbBuf = NULL;
+
+            LogFlow(("Restarting incomplete transfer %#p (%zu bytes transferred)\n",
+                     pTask, pCEvt->cbXfered));
+
+            if (pTask->cbBounceBuffer)
+            {
+                AssertPtr(pTask->pvBounceBuffer);
+                offStart     = (pTask->Off & ~((RTFOFF)512-1)) + pTask->cbTransfered;
+                cbToTransfer = pTask->cbBounceBuffer - pTask->cbTransfered;
+                pbBuf        = (uint8_t *)pTask->pvBounceBuffer + pTask->cbTransfered;
+            }
+            else
+            {
+                offStart     = pTask->Off + pTask->cbTransfered;
+                cbToTransfer = pTask->DataSeg.cbSeg - pTask->cbTransfered;
+                pbBuf        = (uint8_t *)pTask->DataSeg.pvSeg + pTask->cbTransfered;
+            }
+
+            if (pTask->fPrefetch || pTask->enmTransferType == PDMACTASKFILETRANSFER_READ)
+                rc = pdmacFileAioMgrIoQueueReqPrepare(pAioMgr, pEndpoint, pTask, RTIOQUEUEOP_READ,
+                                                      offStart, pbBuf, cbToTransfer);
+            else
+                rc = pdmacFileAioMgrIoQueueReqPrepare(pAioMgr, pEndpoint, pTask, RTIOQUEUEOP_WRITE,
+                                                      offStart, pbBuf, cbToTransfer);
+            AssertRC(rc);
+        }
+        else if (pTask->fPrefetch)
+        {
+            Assert(pTask->enmTransferType == PDMACTASKFILETRANSFER_WRITE);
+            Assert(pTask->cbBounceBuffer);
+
+            memcpy(((uint8_t *)pTask->pvBounceBuffer) + pTask->offBounceBuffer,
+                   pTask->DataSeg.pvSeg,
+                   pTask->DataSeg.cbSeg);
+
+            /* Write it now. */
+            pTask->fPrefetch    = false;
+            pTask->cbTransfered = 0;
+
+            /* Grow the file if needed. */
+            if (RT_UNLIKELY((uint64_t)(pTask->Off + pTask->DataSeg.cbSeg) > pEndpoint->cbFile))
+            {
+                ASMAtomicWriteU64(&pEndpoint->cbFile, pTask->Off + pTask->DataSeg.cbSeg);
+                RTFileSetSize(pEndpoint->hFile, pTask->Off + pTask->DataSeg.cbSeg);
+            }
+
+            rc = pdmacFileAioMgrIoQueueReqPrepare(pAioMgr, pEndpoint, pTask, RTIOQUEUEOP_WRITE,
+                                                  pTask->Off & ~(RTFOFF)(512-1), pTask->pvBounceBuffer,
+                                                  pTask->cbBounceBuffer);
+            AssertRC(rc);
+        }
+        else
+        {
+            if (pTask->cbBounceBuffer)
+            {
+                if (pTask->enmTransferType == PDMACTASKFILETRANSFER_READ)
+                    memcpy(pTask->DataSeg.pvSeg,
+                           ((uint8_t *)pTask->pvBounceBuffer) + pTask->offBounceBuffer,
+                           pTask->DataSeg.cbSeg);
+
+                RTMemPageFree(pTask->pvBounceBuffer, pTask->cbBounceBuffer);
+            }
+
+            /* Free the lock and process pending tasks if necessary */
+            pTasksWaiting = pdmacFileAioMgrNormalRangeLockFree(pAioMgr, pEndpoint, pTask->pRangeLock);
+            if (pTasksWaiting)
+            {
+                rc = pdmacFileAioMgrIoQueueProcessTaskList(pTasksWaiting, pAioMgr, pEndpoint);
+                AssertRC(rc);
+            }
+
+            /* Call completion callback */
+            LogFlow(("Task=%#p completed with %Rrc\n", pTask, rcReq));
+            pTask->pfnCompleted(pTask, pTask->pvUser, rcReq);
+            pdmacFileTaskFree(pEndpoint, pTask);
+
+            /* If the endpoint is about to be migrated do it now. */
+            if (RT_UNLIKELY(!pEndpoint->AioMgr.cRequestsActive && pEndpoint->AioMgr.fMoving))
+            {
+                bool fReqsPending = pdmacFileAioMgrIoQueueRemoveEndpoint(pEndpoint);
+                Assert(!fReqsPending); NOREF(fReqsPending);
+
+                rc = pdmacFileAioMgrAddEndpoint(pEndpoint->AioMgr.pAioMgrDst, pEndpoint);
+                AssertRC(rc);
+            }
+        }
+    }
+}
+
+/** Helper macro for checking for error codes. */
+#define CHECK_RC(pAioMgr, rc) \
+    if (RT_FAILURE(rc)) \
+    {\
+        int rc2 = pdmacFileAioMgrIoQueueErrorHandler(pAioMgr, rc, RT_SRC_POS);\
+        return rc2;\
+    }
+
+/**
+ * The I/O manager using the RTIoQueue API.
+ *
+ * @returns VBox status code.
+ * @param   hThreadSelf Handle of the thread.
+ * @param   pvUser      Opaque user data.
+ */
+DECLCALLBACK(int) pdmacFileAioMgrIoQueue(RTTHREAD hThreadSelf, void *pvUser)
+{
+    int             rc          = VINF_SUCCESS;
+    PPDMACEPFILEMGR pAioMgr     = (PPDMACEPFILEMGR)pvUser;
+    uint64_t        uMillisEnd  = RTTimeMilliTS() + PDMACEPFILEMGR_LOAD_UPDATE_PERIOD;
+    NOREF(hThreadSelf);
+
+    while (   pAioMgr->enmState == PDMACEPFILEMGRSTATE_RUNNING
+           || pAioMgr->enmState == PDMACEPFILEMGRSTATE_SUSPENDING)
+    {
+        if (!pAioMgr->cRequestsActive)
+        {
+            ASMAtomicWriteBool(&pAioMgr->fWaitingEventSem, true);
+            if (!ASMAtomicReadBool(&pAioMgr->fWokenUp))
+                rc = RTSemEventWait(pAioMgr->EventSem, pAioMgr->msBwLimitExpired);
+            ASMAtomicWriteBool(&pAioMgr->fWaitingEventSem, false);
+            Assert(RT_SUCCESS(rc) || rc == VERR_TIMEOUT);
+
+            LogFlow(("Got woken up\n"));
+        }
+
+        /* Pick up new requests posted after this point through a wakeup of the wait below. */
+        ASMAtomicWriteBool(&pAioMgr->fWokenUp, false);
+
+        /* Check for an external blocking event first. */
+        if (pAioMgr->fBlockingEventPending)
+        {
+            rc = pdmacFileAioMgrIoQueueProcessBlockingEvent(pAioMgr);
+            CHECK_RC(pAioMgr, rc);
+        }
+
+        if (RT_LIKELY(pAioMgr->enmState == PDMACEPFILEMGRSTATE_RUNNING))
+        {
+            /* We got woken up because an endpoint issued new requests. Queue them. */
+            rc = pdmacFileAioMgrIoQueueCheckEndpoints(pAioMgr);
+            CHECK_RC(pAioMgr, rc);
+
+            rc = pdmacFileAioMgrIoQueueCommit(pAioMgr);
+            CHECK_RC(pAioMgr, rc);
+
+            while (pAioMgr->cRequestsActive)
+            {
+                uint32_t cCEvts = 0;
+
+                LogFlow(("Waiting for %d of %d tasks to complete\n", 1, pAioMgr->cRequestsActive));
+
+                /*
+                 * New requests kick us out of the wait (pdmacFileAioMgrWakeup()), so they
+                 * get submitted right away instead of waiting for the next completion.
+                 */
+                rc = RTIoQueueEvtWait(pAioMgr->hIoQueue, pAioMgr->paIoQueueCEvts, pAioMgr->cRequestsActiveMax,
+                                      1 /*cMinWait*/, &cCEvts, 0 /*fFlags*/);
+                if (RT_FAILURE(rc) && (rc != VERR_INTERRUPTED))
+                    CHECK_RC(pAioMgr, rc);
+
+                ASMAtomicWriteBool(&pAioMgr->fWokenUp, false);
+
+                LogFlow(("%u tasks completed\n", cCEvts));
+
+                for (uint32_t i = 0; i < cCEvts; i++)
+                    pdmacFileAioMgrIoQueueReqComplete(pAioMgr, &pAioMgr->paIoQueueCEvts[i]);
+
+                /* Check for an external blocking event before we go to sleep again. */
+                if (pAioMgr->fBlockingEventPending)
+                {
+                    rc = pdmacFileAioMgrIoQueueProcessBlockingEvent(pAioMgr);
+                    CHECK_RC(pAioMgr, rc);
+                }
+
+                /* Update load statistics. */
+                uint64_t uMillisCurr = RTTimeMilliTS();
+                if (uMillisCurr > uMillisEnd)
+                {
+                    PPDMASYNCCOMPLETIONENDPOINTFILE pEndpointCurr = pAioMgr->pEndpointsHead;
+
+                    /* Calculate timespan. */
+                    uMillisCurr -= uMillisEnd;
+
+                    while (pEndpointCurr)
+                    {
+                        pEndpointCurr->AioMgr.cReqsPerSec    = pEndpointCurr->AioMgr.cReqsProcessed / (uMillisCurr + PDMACEPFILEMGR_LOAD_UPDATE_PERIOD);
+                        pEndpointCurr->AioMgr.cReqsProcessed = 0;
+                        pEndpointCurr = pEndpointCurr->AioMgr.pEndpointNext;
+                    }
+
+                    /* Set new update interval */
+                    uMillisEnd = RTTimeMilliTS() + PDMACEPFILEMGR_LOAD_UPDATE_PERIOD;
+                }
+
+                /* Check endpoints for new requests and submit everything in one go. */
+                if (pAioMgr->enmState == PDMACEPFILEMGRSTATE_RUNNING)
+                {
+                    rc = pdmacFileAioMgrIoQueueCheckEndpoints(pAioMgr);
+                    CHECK_RC(pAioMgr, rc);
+                }
+
+                rc = pdmacFileAioMgrIoQueueCommit(pAioMgr);
+                CHECK_RC(pAioMgr, rc);
+            } /* while requests are active. */
+        } /* if still running */
+    } /* while running */
+
+    LogFlowFunc(("rc=%Rrc\n", rc));
+    return rc;
+}
+
+#undef CHECK_RC
+
@@ -47,10 +47,6 @@ static int pdmacFileAioMgrNormalProcessTaskList(PPDMACTASKFILE pTaskHead,
                                                 PPDMACEPFILEMGR pAioMgr,
                                                 PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint);
 
-static PPDMACTASKFILE pdmacFileAioMgrNormalRangeLockFree(PPDMACEPFILEMGR pAioMgr,
-                                                         PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
-                                                         PPDMACFILERANGELOCK pRangeLock);
-
 static void pdmacFileAioMgrNormalReqCompleteRc(PPDMACEPFILEMGR pAioMgr, RTFILEAIOREQ hReq,
                                                int rc, size_t cbTransfered);
 
@@ -457,52 +453,6 @@ static int pdmacFileAioMgrNormalErrorHandler(PPDMACEPFILEMGR pAioMgr, int rc, RT
     return VINF_SUCCESS;
 }
 
-/**
- * Put a list of tasks in the pending request list of an endpoint.
- */
-DECLINLINE(void) pdmacFileAioMgrEpAddTaskList(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, PPDMACTASKFILE pTaskHead)
-{
-    /* Add the rest of the tasks to the pending list */
-    if (!pEndpoint->AioMgr.pReqsPendingHead)
-    {
-        Assert(!pEndpoint->AioMgr.pReqsPendingTail);
-        pEndpoint->AioMgr.pReqsPendingHead = pTaskHead;
-    }
-    else
-    {
-        Assert(pEndpoint->AioMgr.pReqsPendingTail);
-        pEndpoint->AioMgr.pReqsPendingTail->pNext = pTaskHead;
-    }
-
-    /* Update the tail. */
-    while (pTaskHead->pNext)
-        pTaskHead = pTaskHead->pNext;
-
-    pEndpoint->AioMgr.pReqsPendingTail = pTaskHead;
-    pTaskHead->pNext = NULL;
-}
-
-/**
- * Put one task in the pending request list of an endpoint.
- */
-DECLINLINE(void) pdmacFileAioMgrEpAddTask(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, PPDMACTASKFILE pTask)
-{
-    /* Add the rest of the tasks to the pending list */
-    if (!pEndpoint->AioMgr.pReqsPendingHead)
-    {
-        Assert(!pEndpoint->AioMgr.pReqsPendingTail);
-        pEndpoint->AioMgr.pReqsPendingHead = pTask;
-    }
-    else
-    {
-        Assert(pEndpoint->AioMgr.pReqsPendingTail);
-        pEndpoint->AioMgr.pReqsPendingTail->pNext = pTask;
-    }
-
-    pEndpoint->AioMgr.pReqsPendingTail = pTask;
-    pTask->pNext = NULL;
-}
-
 /**
  * Allocates a async I/O request.
  *
@@ -641,9 +591,9 @@ static int pdmacFileAioMgrNormalReqsEnqueue(PPDMACEPFILEMGR pAioMgr,
     return VINF_SUCCESS;
 }
 
-static bool pdmacFileAioMgrNormalIsRangeLocked(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
-                                               RTFOFF offStart, size_t cbRange,
-                                               PPDMACTASKFILE pTask, bool fAlignedReq)
+bool pdmacFileAioMgrNormalIsRangeLocked(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                        RTFOFF offStart, size_t cbRange,
+                                        PPDMACTASKFILE pTask, bool fAlignedReq)
 {
     AssertMsg(   pTask->enmTransferType == PDMACTASKFILETRANSFER_WRITE
               || pTask->enmTransferType == PDMACTASKFILETRANSFER_READ,
@@ -694,10 +644,10 @@ static bool pdmacFileAioMgrNormalIsRangeLocked(PPDMASYNCCOMPLETIONENDPOINTFILE p
     return false;
 }
 
-static int pdmacFileAioMgrNormalRangeLock(PPDMACEPFILEMGR pAioMgr,
-                                          PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
-                                          RTFOFF offStart, size_t cbRange,
-                                          PPDMACTASKFILE pTask, bool fAlignedReq)
+int pdmacFileAioMgrNormalRangeLock(PPDMACEPFILEMGR pAioMgr,
+                                   PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                   RTFOFF offStart, size_t cbRange,
+                                   PPDMACTASKFILE pTask, bool fAlignedReq)
 {
     LogFlowFunc(("pAioMgr=%#p pEndpoint=%#p offStart=%RTfoff cbRange=%zu pTask=%#p\n",
                  pAioMgr, pEndpoint, offStart, cbRange, pTask));
@@ -738,9 +688,9 @@ static int pdmacFileAioMgrNormalRangeLock(PPDMACEPFILEMGR pAioMgr,
     return VINF_SUCCESS;
 }
 
-static PPDMACTASKFILE pdmacFileAioMgrNormalRangeLockFree(PPDMACEPFILEMGR pAioMgr,
-                                                         PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
-                                                         PPDMACFILERANGELOCK pRangeLock)
+PPDMACTASKFILE pdmacFileAioMgrNormalRangeLockFree(PPDMACEPFILEMGR pAioMgr,
+                                                  PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                                  PPDMACFILERANGELOCK pRangeLock)
 {
     PPDMACTASKFILE pTasksWaitingHead;
 
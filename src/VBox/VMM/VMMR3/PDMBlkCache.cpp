@@ -17,6 +17,17 @@
 
 /** @page pg_pdm_block_cache     PDM Block Cache - The I/O cache
  * This component implements an I/O cache based on the 2Q cache algorithm.
+ *
+ * The cache is split into a power of two number of shards (CFGM key
+ * PDM/BlkCache/CacheShards), each with its own 2Q lists, byte budget and lock.
+ * The shard of an entry is selected by hashing the per user seed and the
+ * offset in 1MB granularity, so concurrent I/O on several disks or on distant
+ * regions of one disk does not contend for a single lock.  The global lock only
+ * protects the list of users and the commit state.
+ *
+ * Lock order: global lock, shard lock, per user R/W semaphore.  Operations
+ * affecting all entries of a user (release, clear) enter all shards in
+ * ascending order.
  */
 
 
@@ -27,6 +38,7 @@
 #include "PDMInternal.h"
 #include <iprt/asm.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/path.h>
 #include <iprt/string.h>
 #include <iprt/trace.h>
@@ -128,17 +140,17 @@ DECLINLINE(void) pdmBlkCacheEntryRef(PPDMBLKCACHEENTRY pEntry)
 }
 
 #ifdef VBOX_STRICT
-static void pdmBlkCacheValidate(PPDMBLKCACHEGLOBAL pCache)
+static void pdmBlkCacheValidate(PPDMBLKCACHESHARD pShard)
 {
     /* Amount of cached data should never exceed the maximum amount. */
-    AssertMsg(pCache->cbCached <= pCache->cbMax,
+    AssertMsg(pShard->cbCached <= pShard->cbMax,
               ("Current amount of cached data exceeds maximum\n"));
 
     /* The amount of cached data in the LRU and FRU list should match cbCached */
-    AssertMsg(pCache->LruRecentlyUsedIn.cbCached + pCache->LruFrequentlyUsed.cbCached == pCache->cbCached,
+    AssertMsg(pShard->LruRecentlyUsedIn.cbCached + pShard->LruFrequentlyUsed.cbCached == pShard->cbCached,
               ("Amount of cached data doesn't match\n"));
 
-    AssertMsg(pCache->LruRecentlyUsedOut.cbCached <= pCache->cbRecentlyUsedOutMax,
+    AssertMsg(pShard->LruRecentlyUsedOut.cbCached <= pShard->cbRecentlyUsedOutMax,
               ("Paged out list exceeds maximum\n"));
 }
 #endif
@@ -146,29 +158,83 @@ static void pdmBlkCacheValidate(PPDMBLKCACHEGLOBAL pCache)
 DECLINLINE(void) pdmBlkCacheLockEnter(PPDMBLKCACHEGLOBAL pCache)
 {
     RTCritSectEnter(&pCache->CritSect);
+}
+
+DECLINLINE(void) pdmBlkCacheLockLeave(PPDMBLKCACHEGLOBAL pCache)
+{
+    RTCritSectLeave(&pCache->CritSect);
+}
+
+/**
+ * Returns the shard an entry starting at the given offset is assigned to.
+ *
+ * @returns Pointer to the shard.
+ * @param   pBlkCache   The block cache the entry belongs to.
+ * @param   off         Start offset of the entry.
+ */
+DECLINLINE(PPDMBLKCACHESHARD) pdmBlkCacheShardGet(PPDMBLKCACHE pBlkCache, uint64_t off)
+{
+    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
+    uint32_t idxShard = (uint32_t)(off >> PDMBLKCACHE_SHARD_SHIFT) + pBlkCache->uShardSeed;
+
+    return &pCache->aShards[idxShard & (pCache->cShards - 1)];
+}
+
+DECLINLINE(void) pdmBlkCacheShardLockEnter(PPDMBLKCACHESHARD pShard)
+{
+    STAM_COUNTER_INC(&pShard->StatLockEnter);
+    if (RTCritSectTryEnter(&pShard->CritSect) == VERR_SEM_BUSY)
+    {
+        STAM_COUNTER_INC(&pShard->StatLockContention);
+        RTCritSectEnter(&pShard->CritSect);
+    }
 #ifdef VBOX_STRICT
-    pdmBlkCacheValidate(pCache);
+    pdmBlkCacheValidate(pShard);
 #endif
 }
 
-DECLINLINE(void) pdmBlkCacheLockLeave(PPDMBLKCACHEGLOBAL pCache)
+DECLINLINE(void) pdmBlkCacheShardLockLeave(PPDMBLKCACHESHARD pShard)
 {
 #ifdef VBOX_STRICT
-    pdmBlkCacheValidate(pCache);
+    pdmBlkCacheValidate(pShard);
 #endif
-    RTCritSectLeave(&pCache->CritSect);
+    RTCritSectLeave(&pShard->CritSect);
 }
 
-DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+/**
+ * Enters the locks of all shards in ascending order.
+ *
+ * @returns nothing.
+ * @param   pCache      The global cache data.
+ */
+static void pdmBlkCacheShardLockEnterAll(PPDMBLKCACHEGLOBAL pCache)
 {
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
-    pCache->cbCached -= cbAmount;
+    for (uint32_t i = 0; i < pCache->cShards; i++)
+        pdmBlkCacheShardLockEnter(&pCache->aShards[i]);
 }
 
-DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHEGLOBAL pCache, uint32_t cbAmount)
+/**
+ * Leaves the locks of all shards.
+ *
+ * @returns nothing.
+ * @param   pCache      The global cache data.
+ */
+static void pdmBlkCacheShardLockLeaveAll(PPDMBLKCACHEGLOBAL pCache)
 {
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
-    pCache->cbCached += cbAmount;
+    for (uint32_t i = pCache->cShards; i > 0; i--)
+        pdmBlkCacheShardLockLeave(&pCache->aShards[i - 1]);
+}
+
+DECLINLINE(void) pdmBlkCacheSub(PPDMBLKCACHESHARD pShard, uint32_t cbAmount)
+{
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    pShard->cbCached -= cbAmount;
+}
+
+DECLINLINE(void) pdmBlkCacheAdd(PPDMBLKCACHESHARD pShard, uint32_t cbAmount)
+{
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
+    pShard->cbCached += cbAmount;
 }
 
 DECLINLINE(void) pdmBlkCacheListAdd(PPDMBLKLRULIST pList, uint32_t cbAmount)
@@ -313,7 +379,7 @@ static void pdmBlkCacheEntryAddToList(PPDMBLKLRULIST pList, PPDMBLKCACHEENTRY pE
  * @returns nothing
  * @param   pList    Pointer to the LRU list to destroy.
  *
- * @note The caller must own the critical section of the cache.
+ * @note The caller must own the critical section of the shard.
  */
 static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
 {
@@ -336,7 +402,7 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
  * moving the entries to one of the given ghosts lists
  *
  * @returns Amount of data which could be freed.
- * @param    pCache           Pointer to the global cache data.
+ * @param    pShard           Pointer to the cache shard.
  * @param    cbData           The amount of the data to free.
  * @param    pListSrc         The source list to evict data from.
  * @param    pGhostListDst    Where the ghost list removed entries should be
@@ -351,17 +417,17 @@ static void pdmBlkCacheDestroyList(PPDMBLKLRULIST pList)
  *          may be marked as non evictable if they are used for I/O at the
  *          moment.
  */
-static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData,
+static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHESHARD pShard, size_t cbData,
                                         PPDMBLKLRULIST pListSrc, PPDMBLKLRULIST pGhostListDst,
                                         bool fReuseBuffer, uint8_t **ppbBuffer)
 {
     size_t cbEvicted = 0;
 
-    PDMACFILECACHE_IS_CRITSECT_OWNER(pCache);
+    PDMACFILECACHE_IS_CRITSECT_OWNER(pShard);
 
     AssertMsg(cbData > 0, ("Evicting 0 bytes not possible\n"));
     AssertMsg(   !pGhostListDst
-              || (pGhostListDst == &pCache->LruRecentlyUsedOut),
+              || (pGhostListDst == &pShard->LruRecentlyUsedOut),
               ("Destination list must be NULL or the recently used but paged out list\n"));
 
     if (fReuseBuffer)
@@ -395,7 +461,7 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
 
                 if (fReuseBuffer && pCurr->cbData == cbData)
                 {
-                    STAM_COUNTER_INC(&pCache->StatBuffersReused);
+                    STAM_COUNTER_INC(&pBlkCache->pCache->StatBuffersReused);
                     *ppbBuffer = pCurr->pbData;
                 }
                 else if (pCurr->pbData)
@@ -405,7 +471,7 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                 cbEvicted += pCurr->cbData;
 
                 pdmBlkCacheEntryRemoveFromList(pCurr);
-                pdmBlkCacheSub(pCache, pCurr->cbData);
+                pdmBlkCacheSub(pShard, pCurr->cbData);
 
                 if (pGhostListDst)
                 {
@@ -414,7 +480,7 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                     PPDMBLKCACHEENTRY pGhostEntFree = pGhostListDst->pTail;
 
                     /* We have to remove the last entries from the paged out list. */
-                    while (   pGhostListDst->cbCached + pCurr->cbData > pCache->cbRecentlyUsedOutMax
+                    while (   pGhostListDst->cbCached + pCurr->cbData > pShard->cbRecentlyUsedOutMax
                            && pGhostEntFree)
                     {
                         PPDMBLKCACHEENTRY pFree = pGhostEntFree;
@@ -428,9 +494,9 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                         {
                             pdmBlkCacheEntryRemoveFromList(pFree);
 
-                            STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
+                            STAM_PROFILE_ADV_START(&pBlkCache->pCache->StatTreeRemove, Cache);
                             RTAvlrU64Remove(pBlkCacheFree->pTree, pFree->Core.Key);
-                            STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
+                            STAM_PROFILE_ADV_STOP(&pBlkCache->pCache->StatTreeRemove, Cache);
 
                             RTMemFree(pFree);
                         }
@@ -438,12 +504,12 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                         RTSemRWReleaseWrite(pBlkCacheFree->SemRWEntries);
                     }
 
-                    if (pGhostListDst->cbCached + pCurr->cbData > pCache->cbRecentlyUsedOutMax)
+                    if (pGhostListDst->cbCached + pCurr->cbData > pShard->cbRecentlyUsedOutMax)
                     {
                         /* Couldn't remove enough entries. Delete */
-                        STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
+                        STAM_PROFILE_ADV_START(&pBlkCache->pCache->StatTreeRemove, Cache);
                         RTAvlrU64Remove(pCurr->pBlkCache->pTree, pCurr->Core.Key);
-                        STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
+                        STAM_PROFILE_ADV_STOP(&pBlkCache->pCache->StatTreeRemove, Cache);
 
                         RTMemFree(pCurr);
                     }
@@ -453,9 +519,9 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
                 else
                 {
                     /* Delete the entry from the AVL tree it is assigned to. */
-                    STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
+                    STAM_PROFILE_ADV_START(&pBlkCache->pCache->StatTreeRemove, Cache);
                     RTAvlrU64Remove(pCurr->pBlkCache->pTree, pCurr->Core.Key);
-                    STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
+                    STAM_PROFILE_ADV_STOP(&pBlkCache->pCache->StatTreeRemove, Cache);
 
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
                     RTMemFree(pCurr);
@@ -470,17 +536,17 @@ static size_t pdmBlkCacheEvictPagesFrom(PPDMBLKCACHEGLOBAL pCache, size_t cbData
     return cbEvicted;
 }
 
-static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, size_t cbData, bool fReuseBuffer, uint8_t **ppbBuffer)
+static bool pdmBlkCacheReclaim(PPDMBLKCACHESHARD pShard, size_t cbData, bool fReuseBuffer, uint8_t **ppbBuffer)
 {
     size_t cbRemoved = 0;
 
-    if ((pCache->cbCached + cbData) < pCache->cbMax)
+    if ((pShard->cbCached + cbData) < pShard->cbMax)
         return true;
-    else if ((pCache->LruRecentlyUsedIn.cbCached + cbData) > pCache->cbRecentlyUsedInMax)
+    else if ((pShard->LruRecentlyUsedIn.cbCached + cbData) > pShard->cbRecentlyUsedInMax)
     {
         /* Try to evict as many bytes as possible from A1in */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruRecentlyUsedIn,
-                                                 &pCache->LruRecentlyUsedOut, fReuseBuffer, ppbBuffer);
+        cbRemoved = pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruRecentlyUsedIn,
+                                                 &pShard->LruRecentlyUsedOut, fReuseBuffer, ppbBuffer);
 
         /*
          * If it was not possible to remove enough entries
@@ -495,17 +561,17 @@ static bool pdmBlkCacheReclaim(PPDMBLKCACHEGLOBAL pCache, size_t cbData, bool fR
              * we don't need to evict that much data
              */
             if (!cbRemoved)
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
+                cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruFrequentlyUsed,
                                                           NULL, fReuseBuffer, ppbBuffer);
             else
-                cbRemoved += pdmBlkCacheEvictPagesFrom(pCache, cbData - cbRemoved, &pCache->LruFrequentlyUsed,
+                cbRemoved += pdmBlkCacheEvictPagesFrom(pShard, cbData - cbRemoved, &pShard->LruFrequentlyUsed,
                                                           NULL, false, NULL);
         }
     }
     else
     {
         /* We have to remove entries from frequently access list. */
-        cbRemoved = pdmBlkCacheEvictPagesFrom(pCache, cbData, &pCache->LruFrequentlyUsed,
+        cbRemoved = pdmBlkCacheEvictPagesFrom(pShard, cbData, &pShard->LruFrequentlyUsed,
                                                  NULL, fReuseBuffer, ppbBuffer);
     }
 
@@ -885,8 +951,8 @@ static DECLCALLBACK(int) pdmR3BlkCacheSaveExec(PVM pVM, PSSMHANDLE pSSM)
             AssertMsg(pEntry->fFlags & PDMBLKCACHE_ENTRY_IS_DIRTY, ("Entry is not dirty\n"));
             AssertMsg(!(pEntry->fFlags & ~PDMBLKCACHE_ENTRY_IS_DIRTY), ("Invalid flags set\n"));
             AssertMsg(!pEntry->pWaitingHead && !pEntry->pWaitingTail, ("There are waiting requests\n"));
-            AssertMsg(   pEntry->pList == &pBlkCacheGlobal->LruRecentlyUsedIn
-                      || pEntry->pList == &pBlkCacheGlobal->LruFrequentlyUsed,
+            AssertMsg(   pEntry->pList == &pEntry->pShard->LruRecentlyUsedIn
+                      || pEntry->pList == &pEntry->pShard->LruFrequentlyUsed,
                       ("Invalid list\n"));
             AssertMsg(pEntry->cbData == pEntry->Core.KeyLast - pEntry->Core.Key + 1,
                       ("Size and range do not match\n"));
@@ -997,9 +1063,12 @@ static DECLCALLBACK(int) pdmR3BlkCacheLoadExec(PVM pVM, PSSMHANDLE pSSM, uint32_
             Assert(fInserted); NOREF(fInserted);
 
             /* Add to the dirty list. */
+            PPDMBLKCACHESHARD pShard = pEntry->pShard;
             pdmBlkCacheAddDirtyEntry(pBlkCache, pEntry);
-            pdmBlkCacheEntryAddToList(&pBlkCacheGlobal->LruRecentlyUsedIn, pEntry);
-            pdmBlkCacheAdd(pBlkCacheGlobal, cbEntry);
+            pdmBlkCacheShardLockEnter(pShard);
+            pdmBlkCacheEntryAddToList(&pShard->LruRecentlyUsedIn, pEntry);
+            pdmBlkCacheAdd(pShard, cbEntry);
+            pdmBlkCacheShardLockLeave(pShard);
             pdmBlkCacheEntryRelease(pEntry);
             cEntries--;
         }
@@ -1047,32 +1116,47 @@ int pdmR3BlkCacheInit(PVM pVM)
     RTListInit(&pBlkCacheGlobal->ListUsers);
     pBlkCacheGlobal->pVM = pVM;
     pBlkCacheGlobal->cRefs = 0;
-    pBlkCacheGlobal->cbCached  = 0;
     pBlkCacheGlobal->fCommitInProgress = false;
 
-    /* Initialize members */
-    pBlkCacheGlobal->LruRecentlyUsedIn.pHead    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedIn.pTail    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedIn.cbCached = 0;
-
-    pBlkCacheGlobal->LruRecentlyUsedOut.pHead    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedOut.pTail    = NULL;
-    pBlkCacheGlobal->LruRecentlyUsedOut.cbCached = 0;
-
-    pBlkCacheGlobal->LruFrequentlyUsed.pHead    = NULL;
-    pBlkCacheGlobal->LruFrequentlyUsed.pTail    = NULL;
-    pBlkCacheGlobal->LruFrequentlyUsed.cbCached = 0;
-
     do
     {
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheSize", &pBlkCacheGlobal->cbMax, 5 * _1M);
         AssertLogRelRCBreak(rc);
         LogFlowFunc(("Maximum number of bytes cached %u\n", pBlkCacheGlobal->cbMax));
 
-        pBlkCacheGlobal->cbRecentlyUsedInMax  = (pBlkCacheGlobal->cbMax / 100) * 25; /* 25% of the buffer size */
-        pBlkCacheGlobal->cbRecentlyUsedOutMax = (pBlkCacheGlobal->cbMax / 100) * 50; /* 50% of the buffer size */
-        LogFlowFunc(("cbRecentlyUsedInMax=%u cbRecentlyUsedOutMax=%u\n",
-                     pBlkCacheGlobal->cbRecentlyUsedInMax, pBlkCacheGlobal->cbRecentlyUsedOutMax));
+        /*
+         * Default to one shard per host CPU but keep the shards big enough
+         * to hold a few entries each, the budget is split evenly.
+         */
+        uint32_t cShards = 0;
+        rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheShards", &cShards,
+                               RT_MIN(RTMpGetCount(), PDMBLKCACHE_SHARDS_MAX));
+        AssertLogRelRCBreak(rc);
+        if (!cShards)
+        {
+            rc = VMSetError(pVM, VERR_INVALID_PARAMETER, RT_SRC_POS, N_("PDM/BlkCache/CacheShards must not be 0"));
+            break;
+        }
+
+        cShards = RT_MIN(cShards, PDMBLKCACHE_SHARDS_MAX);
+        while (cShards & (cShards - 1)) /* Round down to a power of two. */
+            cShards &= cShards - 1;
+        while (   cShards > 1
+               && pBlkCacheGlobal->cbMax / cShards < PDMBLKCACHE_SHARD_SIZE_MIN)
+            cShards >>= 1;
+        pBlkCacheGlobal->cShards = cShards;
+
+        for (uint32_t i = 0; i < cShards; i++)
+        {
+            PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->aShards[i];
+
+            pShard->cbMax                = pBlkCacheGlobal->cbMax / cShards;
+            pShard->cbCached             = 0;
+            pShard->cbRecentlyUsedInMax  = (pShard->cbMax / 100) * 25; /* 25% of the buffer size */
+            pShard->cbRecentlyUsedOutMax = (pShard->cbMax / 100) * 50; /* 50% of the buffer size */
+        }
+        LogFlowFunc(("cShards=%u cbRecentlyUsedInMax=%u cbRecentlyUsedOutMax=%u (per shard)\n", cShards,
+                     pBlkCacheGlobal->aShards[0].cbRecentlyUsedInMax, pBlkCacheGlobal->aShards[0].cbRecentlyUsedOutMax));
 
         /** @todo r=aeichner: Experiment to find optimal default values */
         rc = CFGMR3QueryU32Def(pCfgBlkCache, "CacheCommitIntervalMs", &pBlkCacheGlobal->u32CommitTimeoutMs, 10000 /* 10sec */);
@@ -1088,26 +1172,49 @@ int pdmR3BlkCacheInit(PVM pVM)
                        "/PDM/BlkCache/cbMax",
                        STAMUNIT_BYTES,
                        "Maximum cache size");
-        STAMR3Register(pVM, &pBlkCacheGlobal->cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCached",
-                       STAMUNIT_BYTES,
-                       "Currently used cache");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruRecentlyUsedIn.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedMruIn",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in MRU list");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruRecentlyUsedOut.cbCached,
+        STAMR3Register(pVM, &pBlkCacheGlobal->cShards,
                        STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedMruOut",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in FRU list");
-        STAMR3Register(pVM, &pBlkCacheGlobal->LruFrequentlyUsed.cbCached,
-                       STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
-                       "/PDM/BlkCache/cbCachedFru",
-                       STAMUNIT_BYTES,
-                       "Number of bytes cached in FRU ghost list");
+                       "/PDM/BlkCache/cShards",
+                       STAMUNIT_COUNT,
+                       "Number of cache shards");
+
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards; i++)
+        {
+            PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->aShards[i];
+
+            STAMR3RegisterF(pVM, &pShard->cbCached,
+                            STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                            STAMUNIT_BYTES,
+                            "Currently used cache",
+                            "/PDM/BlkCache/Shard%u/cbCached", i);
+            STAMR3RegisterF(pVM, &pShard->LruRecentlyUsedIn.cbCached,
+                            STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                            STAMUNIT_BYTES,
+                            "Number of bytes cached in MRU list",
+                            "/PDM/BlkCache/Shard%u/cbCachedMruIn", i);
+            STAMR3RegisterF(pVM, &pShard->LruRecentlyUsedOut.cbCached,
+                            STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                            STAMUNIT_BYTES,
+                            "Number of bytes cached in FRU list",
+                            "/PDM/BlkCache/Shard%u/cbCachedMruOut", i);
+            STAMR3RegisterF(pVM, &pShard->LruFrequentlyUsed.cbCached,
+                            STAMTYPE_U32, STAMVISIBILITY_ALWAYS,
+                            STAMUNIT_BYTES,
+                            "Number of bytes cached in FRU ghost list",
+                            "/PDM/BlkCache/Shard%u/cbCachedFru", i);
+#ifdef VBOX_WITH_STATISTICS
+            STAMR3RegisterF(pVM, &pShard->StatLockEnter,
+                            STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                            STAMUNIT_OCCURENCES,
+                            "Number of times the shard lock was acquired",
+                            "/PDM/BlkCache/Shard%u/LockEnter", i);
+            STAMR3RegisterF(pVM, &pShard->StatLockContention,
+                            STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS,
+                            STAMUNIT_OCCURENCES,
+                            "Number of times the shard lock was owned by another thread",
+                            "/PDM/BlkCache/Shard%u/LockContention", i);
+#endif
+        }
 
 #ifdef VBOX_WITH_STATISTICS
         STAMR3Register(pVM, &pBlkCacheGlobal->cHits,
@@ -1148,8 +1255,18 @@ int pdmR3BlkCacheInit(PVM pVM)
                        STAMUNIT_COUNT, "Number of times a buffer could be reused");
 #endif
 
-        /* Initialize the critical section */
+        /* Initialize the critical sections */
         rc = RTCritSectInit(&pBlkCacheGlobal->CritSect);
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards && RT_SUCCESS(rc); i++)
+        {
+            rc = RTCritSectInit(&pBlkCacheGlobal->aShards[i].CritSect);
+            if (RT_FAILURE(rc))
+            {
+                while (i-- > 0)
+                    RTCritSectDelete(&pBlkCacheGlobal->aShards[i].CritSect);
+                RTCritSectDelete(&pBlkCacheGlobal->CritSect);
+            }
+        }
     }
 
     if (RT_SUCCESS(rc))
@@ -1171,7 +1288,8 @@ int pdmR3BlkCacheInit(PVM pVM)
                                        NULL, pdmR3BlkCacheLoadExec, NULL);
             if (RT_SUCCESS(rc))
             {
-                LogRel(("BlkCache: Cache successfully initialized. Cache size is %u bytes\n", pBlkCacheGlobal->cbMax));
+                LogRel(("BlkCache: Cache successfully initialized. Cache size is %u bytes split into %u shards\n",
+                        pBlkCacheGlobal->cbMax, pBlkCacheGlobal->cShards));
                 LogRel(("BlkCache: Cache commit interval is %u ms\n", pBlkCacheGlobal->u32CommitTimeoutMs));
                 LogRel(("BlkCache: Cache commit threshold is %u bytes\n", pBlkCacheGlobal->cbCommitDirtyThreshold));
                 pUVM->pdm.s.pBlkCacheGlobal = pBlkCacheGlobal;
@@ -1179,6 +1297,8 @@ int pdmR3BlkCacheInit(PVM pVM)
             }
         }
 
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards; i++)
+            RTCritSectDelete(&pBlkCacheGlobal->aShards[i].CritSect);
         RTCritSectDelete(&pBlkCacheGlobal->CritSect);
     }
 
@@ -1199,9 +1319,18 @@ void pdmR3BlkCacheTerm(PVM pVM)
         pdmBlkCacheLockEnter(pBlkCacheGlobal);
 
         /* Cleanup deleting all cache entries waiting for in progress entries to finish. */
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedIn);
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruRecentlyUsedOut);
-        pdmBlkCacheDestroyList(&pBlkCacheGlobal->LruFrequentlyUsed);
+        for (uint32_t i = 0; i < pBlkCacheGlobal->cShards; i++)
+        {
+            PPDMBLKCACHESHARD pShard = &pBlkCacheGlobal->aShards[i];
+
+            pdmBlkCacheShardLockEnter(pShard);
+            pdmBlkCacheDestroyList(&pShard->LruRecentlyUsedIn);
+            pdmBlkCacheDestroyList(&pShard->LruRecentlyUsedOut);
+            pdmBlkCacheDestroyList(&pShard->LruFrequentlyUsed);
+            pShard->cbCached = 0;
+            pdmBlkCacheShardLockLeave(pShard);
+            RTCritSectDelete(&pShard->CritSect);
+        }
 
         pdmBlkCacheLockLeave(pBlkCacheGlobal);
 
@@ -1257,6 +1386,7 @@ static int pdmR3BlkCacheRetain(PVM pVM, PPPDMBLKCACHE ppBlkCache, const char *pc
             pBlkCache->fSuspended = false;
             pBlkCache->cIoXfersActive = 0;
             pBlkCache->pCache = pBlkCacheGlobal;
+            pBlkCache->uShardSeed = pBlkCacheGlobal->uShardSeedNext++;
             RTListInit(&pBlkCache->ListDirtyNotCommitted);
 
             rc = RTSpinlockCreate(&pBlkCache->LockList, RTSPINLOCK_FLAGS_INTERRUPT_UNSAFE, "pdmR3BlkCacheRetain");
@@ -1423,15 +1553,18 @@ static DECLCALLBACK(int) pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *p
 
     while (ASMAtomicReadU32(&pEntry->fFlags) & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS)
     {
-        /* Leave the locks to let the I/O thread make progress but reference the entry to prevent eviction. */
+        /* Leave the locks to let the I/O thread make progress but reference the entry to prevent eviction.
+           The completion path needs the global lock for committing dirty entries. */
         pdmBlkCacheEntryRef(pEntry);
         RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+        pdmBlkCacheShardLockLeaveAll(pCache);
         pdmBlkCacheLockLeave(pCache);
 
         RTThreadSleep(250);
 
-        /* Re-enter all locks */
+        /* Re-enter all locks in the documented order. */
         pdmBlkCacheLockEnter(pCache);
+        pdmBlkCacheShardLockEnterAll(pCache);
         RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
         pdmBlkCacheEntryRelease(pEntry);
     }
@@ -1439,13 +1572,14 @@ static DECLCALLBACK(int) pdmBlkCacheEntryDestroy(PAVLRU64NODECORE pNode, void *p
     AssertMsg(!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS),
                 ("Entry is dirty and/or still in progress fFlags=%#x\n", pEntry->fFlags));
 
-    bool fUpdateCache =    pEntry->pList == &pCache->LruFrequentlyUsed
-                        || pEntry->pList == &pCache->LruRecentlyUsedIn;
+    PPDMBLKCACHESHARD pShard = pEntry->pShard;
+    bool fUpdateCache =    pEntry->pList == &pShard->LruFrequentlyUsed
+                        || pEntry->pList == &pShard->LruRecentlyUsedIn;
 
     pdmBlkCacheEntryRemoveFromList(pEntry);
 
     if (fUpdateCache)
-        pdmBlkCacheSub(pCache, pEntry->cbData);
+        pdmBlkCacheSub(pShard, pEntry->cbData);
 
     RTMemPageFree(pEntry->pbData, pEntry->cbData);
     RTMemFree(pEntry);
@@ -1473,9 +1607,11 @@ VMMR3DECL(void) PDMR3BlkCacheRelease(PPDMBLKCACHE pBlkCache)
 
     /* Make sure nobody is accessing the cache while we delete the tree. */
     pdmBlkCacheLockEnter(pCache);
+    pdmBlkCacheShardLockEnterAll(pCache);
     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
     RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pCache);
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+    pdmBlkCacheShardLockLeaveAll(pCache);
 
     RTSpinlockDestroy(pBlkCache->LockList);
 
@@ -1660,6 +1796,7 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryAlloc(PPDMBLKCACHE pBlkCache, uint64_t
     pEntryNew->Core.Key      = off;
     pEntryNew->Core.KeyLast  = off + cbData - 1;
     pEntryNew->pBlkCache     = pBlkCache;
+    pEntryNew->pShard        = pdmBlkCacheShardGet(pBlkCache, off);
     pEntryNew->fFlags        = 0;
     pEntryNew->cRefs         = 1; /* We are using it now. */
     pEntryNew->pList         = NULL;
@@ -1856,12 +1993,12 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache, uint64_t
     *pcbData = pdmBlkCacheEntryBoundariesCalc(pBlkCache, off, (uint32_t)cb, &cbEntry);
     AssertReturn(cb <= UINT32_MAX, NULL);
 
-    PPDMBLKCACHEGLOBAL pCache = pBlkCache->pCache;
-    pdmBlkCacheLockEnter(pCache);
+    PPDMBLKCACHESHARD pShard = pdmBlkCacheShardGet(pBlkCache, off);
+    pdmBlkCacheShardLockEnter(pShard);
 
     PPDMBLKCACHEENTRY pEntryNew = NULL;
     uint8_t          *pbBuffer  = NULL;
-    bool fEnough = pdmBlkCacheReclaim(pCache, cbEntry, true, &pbBuffer);
+    bool fEnough = pdmBlkCacheReclaim(pShard, cbEntry, true, &pbBuffer);
     if (fEnough)
     {
         LogFlow(("Evicted enough bytes (%u requested). Creating new cache entry\n", cbEntry));
@@ -1869,9 +2006,10 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache, uint64_t
         pEntryNew = pdmBlkCacheEntryAlloc(pBlkCache, off, cbEntry, pbBuffer);
         if (RT_LIKELY(pEntryNew))
         {
-            pdmBlkCacheEntryAddToList(&pCache->LruRecentlyUsedIn, pEntryNew);
-            pdmBlkCacheAdd(pCache, cbEntry);
-            pdmBlkCacheLockLeave(pCache);
+            Assert(pEntryNew->pShard == pShard);
+            pdmBlkCacheEntryAddToList(&pShard->LruRecentlyUsedIn, pEntryNew);
+            pdmBlkCacheAdd(pShard, cbEntry);
+            pdmBlkCacheShardLockLeave(pShard);
 
             pdmBlkCacheInsertEntry(pBlkCache, pEntryNew);
 
@@ -1880,10 +2018,10 @@ static PPDMBLKCACHEENTRY pdmBlkCacheEntryCreate(PPDMBLKCACHE pBlkCache, uint64_t
                       ("Overflow in calculation off=%llu\n", off));
         }
         else
-            pdmBlkCacheLockLeave(pCache);
+            pdmBlkCacheShardLockLeave(pShard);
     }
     else
-        pdmBlkCacheLockLeave(pCache);
+        pdmBlkCacheShardLockLeave(pShard);
 
     return pEntryNew;
 }
@@ -2025,8 +2163,8 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
             STAM_COUNTER_ADD(&pCache->StatRead, cbToRead);
 
             /* Ghost lists contain no data. */
-            if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                || (pEntry->pList == &pCache->LruFrequentlyUsed))
+            if (   (pEntry->pList == &pEntry->pShard->LruRecentlyUsedIn)
+                || (pEntry->pList == &pEntry->pShard->LruFrequentlyUsed))
             {
                 if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
                                                               PDMBLKCACHE_ENTRY_IO_IN_PROGRESS,
@@ -2045,11 +2183,11 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                 }
 
                 /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
+                if (pEntry->pList == &pEntry->pShard->LruFrequentlyUsed)
                 {
-                    pdmBlkCacheLockEnter(pCache);
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockEnter(pEntry->pShard);
+                    pdmBlkCacheEntryAddToList(&pEntry->pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheShardLockLeave(pEntry->pShard);
                 }
                 /* Release the entry */
                 pdmBlkCacheEntryRelease(pEntry);
@@ -2060,16 +2198,16 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
 
                 LogFlow(("Fetching data for ghost entry %#p from file\n", pEntry));
 
-                pdmBlkCacheLockEnter(pCache);
+                pdmBlkCacheShardLockEnter(pEntry->pShard);
                 pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                bool fEnough = pdmBlkCacheReclaim(pEntry->pShard, pEntry->cbData, true, &pbBuffer);
 
                 /* Move the entry to Am and fetch it to the cache. */
                 if (fEnough)
                 {
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheEntryAddToList(&pEntry->pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheAdd(pEntry->pShard, pEntry->cbData);
+                    pdmBlkCacheShardLockLeave(pEntry->pShard);
 
                     if (pbBuffer)
                         pEntry->pbData = pbBuffer;
@@ -2092,7 +2230,7 @@ VMMR3DECL(int) PDMR3BlkCacheRead(PPDMBLKCACHE pBlkCache, uint64_t off,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pEntry->pShard);
 
                     RTMemFree(pEntry);
 
@@ -2226,8 +2364,8 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off, PCRTSGBU
             STAM_COUNTER_ADD(&pCache->StatWritten, cbToWrite);
 
             /* Ghost lists contain no data. */
-            if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                || (pEntry->pList == &pCache->LruFrequentlyUsed))
+            if (   (pEntry->pList == &pEntry->pShard->LruRecentlyUsedIn)
+                || (pEntry->pList == &pEntry->pShard->LruFrequentlyUsed))
             {
                 /* Check if the entry is dirty. */
                 if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
@@ -2276,11 +2414,11 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off, PCRTSGBU
                 } /* Dirty bit not set */
 
                 /* Move this entry to the top position */
-                if (pEntry->pList == &pCache->LruFrequentlyUsed)
+                if (pEntry->pList == &pEntry->pShard->LruFrequentlyUsed)
                 {
-                    pdmBlkCacheLockEnter(pCache);
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockEnter(pEntry->pShard);
+                    pdmBlkCacheEntryAddToList(&pEntry->pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheShardLockLeave(pEntry->pShard);
                 }
 
                 pdmBlkCacheEntryRelease(pEntry);
@@ -2289,16 +2427,16 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off, PCRTSGBU
             {
                 uint8_t *pbBuffer = NULL;
 
-                pdmBlkCacheLockEnter(pCache);
+                pdmBlkCacheShardLockEnter(pEntry->pShard);
                 pdmBlkCacheEntryRemoveFromList(pEntry); /* Remove it before we remove data, otherwise it may get freed when evicting data. */
-                bool fEnough = pdmBlkCacheReclaim(pCache, pEntry->cbData, true, &pbBuffer);
+                bool fEnough = pdmBlkCacheReclaim(pEntry->pShard, pEntry->cbData, true, &pbBuffer);
 
                 if (fEnough)
                 {
                     /* Move the entry to Am and fetch it to the cache. */
-                    pdmBlkCacheEntryAddToList(&pCache->LruFrequentlyUsed, pEntry);
-                    pdmBlkCacheAdd(pCache, pEntry->cbData);
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheEntryAddToList(&pEntry->pShard->LruFrequentlyUsed, pEntry);
+                    pdmBlkCacheAdd(pEntry->pShard, pEntry->cbData);
+                    pdmBlkCacheShardLockLeave(pEntry->pShard);
 
                     if (pbBuffer)
                         pEntry->pbData = pbBuffer;
@@ -2323,7 +2461,7 @@ VMMR3DECL(int) PDMR3BlkCacheWrite(PPDMBLKCACHE pBlkCache, uint64_t off, PCRTSGBU
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pEntry->pShard);
 
                     RTMemFree(pEntry);
                     pdmBlkCacheRequestPassthrough(pBlkCache, pReq,
@@ -2480,8 +2618,8 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                 cbThisDiscard = RT_MIN(pEntry->cbData - offDiff, cbLeft);
 
                 /* Ghost lists contain no data. */
-                if (   (pEntry->pList == &pCache->LruRecentlyUsedIn)
-                    || (pEntry->pList == &pCache->LruFrequentlyUsed))
+                if (   (pEntry->pList == &pEntry->pShard->LruRecentlyUsedIn)
+                    || (pEntry->pList == &pEntry->pShard->LruFrequentlyUsed))
                 {
                     /* Check if the entry is dirty. */
                     if (pdmBlkCacheEntryFlagIsSetClearAcquireLock(pBlkCache, pEntry,
@@ -2491,14 +2629,14 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                         /* If it is dirty but not yet in progress remove it. */
                         if (!(pEntry->fFlags & PDMBLKCACHE_ENTRY_IO_IN_PROGRESS))
                         {
-                            pdmBlkCacheLockEnter(pCache);
+                            pdmBlkCacheShardLockEnter(pEntry->pShard);
                             pdmBlkCacheEntryRemoveFromList(pEntry);
 
                             STAM_PROFILE_ADV_START(&pCache->StatTreeRemove, Cache);
                             RTAvlrU64Remove(pBlkCache->pTree, pEntry->Core.Key);
                             STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
 
-                            pdmBlkCacheLockLeave(pCache);
+                            pdmBlkCacheShardLockLeave(pEntry->pShard);
 
                             RTMemFree(pEntry);
                         }
@@ -2537,7 +2675,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                         }
                         else /* I/O in progress flag not set */
                         {
-                            pdmBlkCacheLockEnter(pCache);
+                            pdmBlkCacheShardLockEnter(pEntry->pShard);
                             pdmBlkCacheEntryRemoveFromList(pEntry);
 
                             RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
@@ -2546,7 +2684,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                             STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                             RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                            pdmBlkCacheLockLeave(pCache);
+                            pdmBlkCacheShardLockLeave(pEntry->pShard);
 
                             RTMemFree(pEntry);
                         }
@@ -2554,7 +2692,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                 }
                 else /* Entry is on the ghost list just remove cache entry. */
                 {
-                    pdmBlkCacheLockEnter(pCache);
+                    pdmBlkCacheShardLockEnter(pEntry->pShard);
                     pdmBlkCacheEntryRemoveFromList(pEntry);
 
                     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
@@ -2563,7 +2701,7 @@ VMMR3DECL(int) PDMR3BlkCacheDiscard(PPDMBLKCACHE pBlkCache, PCRTRANGE paRanges,
                     STAM_PROFILE_ADV_STOP(&pCache->StatTreeRemove, Cache);
                     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
 
-                    pdmBlkCacheLockLeave(pCache);
+                    pdmBlkCacheShardLockLeave(pEntry->pShard);
 
                     RTMemFree(pEntry);
                 }
@@ -2799,9 +2937,11 @@ VMMR3DECL(int) PDMR3BlkCacheClear(PPDMBLKCACHE pBlkCache)
 
     /* Make sure nobody is accessing the cache while we delete the tree. */
     pdmBlkCacheLockEnter(pCache);
+    pdmBlkCacheShardLockEnterAll(pCache);
     RTSemRWRequestWrite(pBlkCache->SemRWEntries, RT_INDEFINITE_WAIT);
     RTAvlrU64Destroy(pBlkCache->pTree, pdmBlkCacheEntryDestroy, pCache);
     RTSemRWReleaseWrite(pBlkCache->SemRWEntries);
+    pdmBlkCacheShardLockLeaveAll(pCache);
 
     pdmBlkCacheLockLeave(pCache);
     return rc;
@@ -23,6 +23,7 @@
 #include "PDMInternal.h"
 #include <VBox/vmm/pdm.h>
 #include <VBox/vmm/mm.h>
+#include <VBox/vmm/stam.h>
 #include <VBox/vmm/vm.h>
 #include <VBox/vmm/uvm.h>
 #include <VBox/err.h>
@@ -131,18 +132,33 @@ static void pdmNsBwGroupUnlink(PPDMNSBWGROUP pBwGroup)
 #endif
 
 
+/**
+ * Gets the root of the bandwidth group tree, the owner of the lock.
+ */
+DECLINLINE(PPDMNSBWGROUP) pdmNsBwGroupGetRoot(PPDMNSBWGROUP pBwGroup)
+{
+    while (pBwGroup->pParentR3)
+        pBwGroup = pBwGroup->pParentR3;
+    return pBwGroup;
+}
+
+
 static void pdmNsBwGroupSetLimit(PPDMNSBWGROUP pBwGroup, uint64_t cbPerSecMax)
 {
     pBwGroup->cbPerSecMax = cbPerSecMax;
-    pBwGroup->cbBucket    = RT_MAX(PDM_NETSHAPER_MIN_BUCKET_SIZE, cbPerSecMax * PDM_NETSHAPER_MAX_LATENCY / 1000);
+    if (pBwGroup->cbBurstCfg)
+        pBwGroup->cbBucket = RT_MAX(PDM_NETSHAPER_MIN_BUCKET_SIZE, pBwGroup->cbBurstCfg);
+    else
+        pBwGroup->cbBucket = RT_MAX(PDM_NETSHAPER_MIN_BUCKET_SIZE, cbPerSecMax * PDM_NETSHAPER_MAX_LATENCY / 1000);
     LogFlow(("pdmNsBwGroupSetLimit: New rate limit is %llu bytes per second, adjusted bucket size to %u bytes\n",
              pBwGroup->cbPerSecMax, pBwGroup->cbBucket));
 }
 
 
-static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uint64_t cbPerSecMax)
+static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uint64_t cbPerSecMax, uint32_t cbBurst)
 {
-    LogFlow(("pdmNsBwGroupCreate: pShaper=%#p pszBwGroup=%#p{%s} cbPerSecMax=%llu\n", pShaper, pszBwGroup, pszBwGroup, cbPerSecMax));
+    LogFlow(("pdmNsBwGroupCreate: pShaper=%#p pszBwGroup=%#p{%s} cbPerSecMax=%llu cbBurst=%u\n",
+             pShaper, pszBwGroup, pszBwGroup, cbPerSecMax, cbBurst));
 
     AssertPtrReturn(pShaper, VERR_INVALID_POINTER);
     AssertPtrReturn(pszBwGroup, VERR_INVALID_POINTER);
@@ -163,13 +179,30 @@ static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uin
                 if (pBwGroup->pszNameR3)
                 {
                     pBwGroup->pShaperR3             = pShaper;
+                    pBwGroup->pParentR3             = NULL;
+                    pBwGroup->pParentR0             = NIL_RTR0PTR;
                     pBwGroup->cRefs                 = 0;
+                    pBwGroup->uWeightTotal          = 0;
+                    pBwGroup->cFiltersChoked        = 0;
+                    pBwGroup->cbBurstCfg            = cbBurst;
 
                     pdmNsBwGroupSetLimit(pBwGroup, cbPerSecMax);
 
                     pBwGroup->cbTokensLast          = pBwGroup->cbBucket;
                     pBwGroup->tsUpdatedLast         = RTTimeSystemNanoTS();
 
+                    PVM pVM = pShaper->pVM;
+                    STAMR3RegisterF(pVM, &pBwGroup->StatBytesTransmitted, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_BYTES,
+                                    "Number of bytes transmitted.", "/PDM/NetShaper/%s/BytesTransmitted", pszBwGroup);
+                    STAMR3RegisterF(pVM, &pBwGroup->StatChoked, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                    "Number of times a filter got choked.", "/PDM/NetShaper/%s/Choked", pszBwGroup);
+                    STAMR3RegisterF(pVM, &pBwGroup->StatBorrowed, STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,
+                                    "Number of transfers exceeding the weighted share of the filter.",
+                                    "/PDM/NetShaper/%s/Borrowed", pszBwGroup);
+                    STAMR3RegisterF(pVM, &pBwGroup->StatChokedLatency, STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_NS_PER_OCCURENCE,
+                                    "Time from choking a filter till telling it to resume.",
+                                    "/PDM/NetShaper/%s/ChokedLatency", pszBwGroup);
+
                     LogFlowFunc(("pszBwGroup={%s} cbBucket=%u\n",
                                  pszBwGroup, pBwGroup->cbBucket));
                     pdmNsBwGroupLink(pBwGroup);
@@ -193,6 +226,7 @@ static int pdmNsBwGroupCreate(PPDMNETSHAPER pShaper, const char *pszBwGroup, uin
 static void pdmNsBwGroupTerminate(PPDMNSBWGROUP pBwGroup)
 {
     Assert(pBwGroup->cRefs == 0);
+    STAMR3DeregisterF(pBwGroup->pShaperR3->pVM->pUVM, "/PDM/NetShaper/%s/*", pBwGroup->pszNameR3);
     if (PDMCritSectIsInitialized(&pBwGroup->Lock))
         PDMR3CritSectDelete(&pBwGroup->Lock);
 }
@@ -211,6 +245,56 @@ DECLINLINE(void) pdmNsBwGroupUnref(PPDMNSBWGROUP pBwGroup)
 }
 
 
+/**
+ * Links a bandwidth group to its parent.
+ *
+ * This is only done while creating the groups, before any filters attach.
+ *
+ * @returns VBox status code.
+ * @param   pShaper         The shaper.
+ * @param   pBwGroup        The bandwidth group.
+ * @param   pszParent       The name of the parent group.
+ */
+static int pdmNsBwGroupSetParent(PPDMNETSHAPER pShaper, PPDMNSBWGROUP pBwGroup, const char *pszParent)
+{
+    PPDMNSBWGROUP pParent = pdmNsBwGroupFindById(pShaper, pszParent);
+    if (!pParent)
+    {
+        LogRel(("NetShaper: Parent group '%s' of '%s' not found\n", pszParent, pBwGroup->pszNameR3));
+        return VERR_NOT_FOUND;
+    }
+    AssertReturn(!pBwGroup->pFiltersHeadR3, VERR_WRONG_ORDER);
+
+    pdmNsBwGroupRef(pParent);
+    pBwGroup->pParentR3 = pParent;
+    pBwGroup->pParentR0 = MMHyperR3ToR0(pShaper->pVM, pParent);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Checks that the group tree isn't too deep, which also catches loops.
+ *
+ * @returns VBox status code.
+ * @param   pShaper         The shaper.
+ */
+static int pdmNsBwGroupCheckDepth(PPDMNETSHAPER pShaper)
+{
+    for (PPDMNSBWGROUP pBwGroup = pShaper->pBwGroupsHead; pBwGroup; pBwGroup = pBwGroup->pNextR3)
+    {
+        uint32_t cLevels = 1;
+        for (PPDMNSBWGROUP pCur = pBwGroup->pParentR3; pCur; pCur = pCur->pParentR3)
+            if (++cLevels > PDM_NETSHAPER_MAX_DEPTH)
+            {
+                LogRel(("NetShaper: Bandwidth group '%s' is nested deeper than %u levels or in a loop\n",
+                        pBwGroup->pszNameR3, PDM_NETSHAPER_MAX_DEPTH));
+                return VERR_OUT_OF_RANGE;
+            }
+    }
+    return VINF_SUCCESS;
+}
+
+
 static void pdmNsBwGroupXmitPending(PPDMNSBWGROUP pBwGroup)
 {
     /*
@@ -223,19 +307,25 @@ static void pdmNsBwGroupXmitPending(PPDMNSBWGROUP pBwGroup)
     Assert(RTCritSectIsOwner(&pBwGroup->pShaperR3->Lock));
     //LOCK_NETSHAPER(pShaper);
 
-    /* Check if the group is disabled. */
-    if (pBwGroup->cbPerSecMax == 0)
+    /* Check if anyone is waiting, filters of disabled groups never are. */
+    if (!ASMAtomicReadU32(&pBwGroup->cFiltersChoked))
         return;
 
-    PPDMNSFILTER pFilter = pBwGroup->pFiltersHeadR3;
+    uint64_t const tsNow   = RTTimeSystemNanoTS();
+    PPDMNSFILTER   pFilter = pBwGroup->pFiltersHeadR3;
     while (pFilter)
     {
         bool fChoked = ASMAtomicXchgBool(&pFilter->fChoked, false);
         Log3((LOG_FN_FMT ": pFilter=%#p fChoked=%RTbool\n", __PRETTY_FUNCTION__, pFilter, fChoked));
-        if (fChoked && pFilter->pIDrvNetR3)
+        if (fChoked)
         {
-            LogFlowFunc(("Calling pfnXmitPending for pFilter=%#p\n", pFilter));
-            pFilter->pIDrvNetR3->pfnXmitPending(pFilter->pIDrvNetR3);
+            ASMAtomicDecU32(&pBwGroup->cFiltersChoked);
+            STAM_REL_PROFILE_ADD_PERIOD(&pBwGroup->StatChokedLatency, tsNow - pFilter->tsChoked);
+            if (pFilter->pIDrvNetR3)
+            {
+                LogFlowFunc(("Calling pfnXmitPending for pFilter=%#p\n", pFilter));
+                pFilter->pIDrvNetR3->pfnXmitPending(pFilter->pIDrvNetR3);
+            }
         }
 
         pFilter = pFilter->pNextR3;
@@ -248,12 +338,14 @@ static void pdmNsBwGroupXmitPending(PPDMNSBWGROUP pBwGroup)
 static void pdmNsFilterLink(PPDMNSFILTER pFilter)
 {
     PPDMNSBWGROUP pBwGroup = pFilter->pBwGroupR3;
-    int rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
+    PPDMNSBWGROUP pRoot    = pdmNsBwGroupGetRoot(pBwGroup);
+    int rc = PDMCritSectEnter(&pRoot->Lock, VERR_SEM_BUSY); AssertRC(rc);
 
     pFilter->pNextR3 = pBwGroup->pFiltersHeadR3;
     pBwGroup->pFiltersHeadR3 = pFilter;
+    pBwGroup->uWeightTotal  += RT_MAX(pFilter->uWeight, 1);
 
-    rc = PDMCritSectLeave(&pBwGroup->Lock); AssertRC(rc);
+    rc = PDMCritSectLeave(&pRoot->Lock); AssertRC(rc);
 }
 
 
@@ -268,7 +360,12 @@ static void pdmNsFilterUnlink(PPDMNSFILTER pFilter)
     AssertPtr(pBwGroup);
     AssertPtr(pBwGroup->pShaperR3);
     Assert(RTCritSectIsOwner(&pBwGroup->pShaperR3->Lock));
-    int rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
+    PPDMNSBWGROUP pRoot = pdmNsBwGroupGetRoot(pBwGroup);
+    int rc = PDMCritSectEnter(&pRoot->Lock, VERR_SEM_BUSY); AssertRC(rc);
+
+    pBwGroup->uWeightTotal -= RT_MAX(pFilter->uWeight, 1);
+    if (ASMAtomicXchgBool(&pFilter->fChoked, false))
+        ASMAtomicDecU32(&pBwGroup->cFiltersChoked);
 
     if (pFilter == pBwGroup->pFiltersHeadR3)
         pBwGroup->pFiltersHeadR3 = pFilter->pNextR3;
@@ -283,7 +380,7 @@ static void pdmNsFilterUnlink(PPDMNSFILTER pFilter)
         pPrev->pNextR3 = pFilter->pNextR3;
     }
 
-    rc = PDMCritSectLeave(&pBwGroup->Lock); AssertRC(rc);
+    rc = PDMCritSectLeave(&pRoot->Lock); AssertRC(rc);
 }
 
 
@@ -382,7 +479,8 @@ VMMR3DECL(int) PDMR3NsBwGroupSetLimit(PUVM pUVM, const char *pszBwGroup, uint64_
     PPDMNSBWGROUP pBwGroup = pdmNsBwGroupFindById(pShaper, pszBwGroup);
     if (pBwGroup)
     {
-        rc = PDMCritSectEnter(&pBwGroup->Lock, VERR_SEM_BUSY); AssertRC(rc);
+        PPDMNSBWGROUP pRoot = pdmNsBwGroupGetRoot(pBwGroup);
+        rc = PDMCritSectEnter(&pRoot->Lock, VERR_SEM_BUSY); AssertRC(rc);
         if (RT_SUCCESS(rc))
         {
             pdmNsBwGroupSetLimit(pBwGroup, cbPerSecMax);
@@ -391,7 +489,7 @@ VMMR3DECL(int) PDMR3NsBwGroupSetLimit(PUVM pUVM, const char *pszBwGroup, uint64_
             if (pBwGroup->cbTokensLast > pBwGroup->cbBucket)
                 pBwGroup->cbTokensLast = pBwGroup->cbBucket;
 
-            int rc2 = PDMCritSectLeave(&pBwGroup->Lock); AssertRC(rc2);
+            int rc2 = PDMCritSectLeave(&pRoot->Lock); AssertRC(rc2);
         }
     }
     else
@@ -460,8 +558,13 @@ int pdmR3NetShaperTerm(PVM pVM)
     PPDMNETSHAPER pShaper = pUVM->pdm.s.pNetShaper;
     AssertPtrReturn(pShaper, VERR_INVALID_POINTER);
 
-    /* Destroy the bandwidth managers. */
-    PPDMNSBWGROUP pBwGroup = pShaper->pBwGroupsHead;
+    /* Destroy the bandwidth managers, dropping the child references first. */
+    PPDMNSBWGROUP pBwGroup;
+    for (pBwGroup = pShaper->pBwGroupsHead; pBwGroup; pBwGroup = pBwGroup->pNextR3)
+        if (pBwGroup->pParentR3)
+            pdmNsBwGroupUnref(pBwGroup->pParentR3);
+
+    pBwGroup = pShaper->pBwGroupsHead;
     while (pBwGroup)
     {
         PPDMNSBWGROUP pFree = pBwGroup;
@@ -517,7 +620,13 @@ int pdmR3NetShaperInit(PVM pVM)
                             uint64_t cbMax;
                             rc = CFGMR3QueryU64(pCur, "Max", &cbMax);
                             if (RT_SUCCESS(rc))
-                                rc = pdmNsBwGroupCreate(pShaper, pszBwGrpId, cbMax);
+                            {
+                                /* Optional bucket size, i.e. how much may be sent in one go after idling. */
+                                uint32_t cbBurst;
+                                rc = CFGMR3QueryU32Def(pCur, "Burst", &cbBurst, 0);
+                                if (RT_SUCCESS(rc))
+                                    rc = pdmNsBwGroupCreate(pShaper, pszBwGrpId, cbMax, cbBurst);
+                            }
                         }
                         RTMemFree(pszBwGrpId);
                     }
@@ -526,6 +635,32 @@ int pdmR3NetShaperInit(PVM pVM)
                     if (RT_FAILURE(rc))
                         break;
                 }
+
+                /* Second pass: link up the hierarchy now that all groups exist. */
+                for (PCFGMNODE pCur = CFGMR3GetFirstChild(pCfgBwGrp); pCur && RT_SUCCESS(rc); pCur = CFGMR3GetNextChild(pCur))
+                {
+                    char *pszParent = NULL;
+                    rc = CFGMR3QueryStringAlloc(pCur, "Parent", &pszParent);
+                    if (RT_SUCCESS(rc))
+                    {
+                        size_t cbName = CFGMR3GetNameLen(pCur) + 1;
+                        char *pszBwGrpId = (char *)RTMemAllocZ(cbName);
+                        if (pszBwGrpId)
+                        {
+                            rc = CFGMR3GetName(pCur, pszBwGrpId, cbName);
+                            if (RT_SUCCESS(rc))
+                                rc = pdmNsBwGroupSetParent(pShaper, pdmNsBwGroupFindById(pShaper, pszBwGrpId), pszParent);
+                            RTMemFree(pszBwGrpId);
+                        }
+                        else
+                            rc = VERR_NO_MEMORY;
+                        MMR3HeapFree(pszParent);
+                    }
+                    else if (rc == VERR_CFGM_VALUE_NOT_FOUND)
+                        rc = VINF_SUCCESS;
+                }
+                if (RT_SUCCESS(rc))
+                    rc = pdmNsBwGroupCheckDepth(pShaper);
             }
 
             if (RT_SUCCESS(rc))
@@ -31,12 +31,14 @@
 #include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/thread.h>
+#include <iprt/time.h>
 
 
 /*********************************************************************************************************************************
 *   Internal Functions                                                                                                           *
 *********************************************************************************************************************************/
 DECLINLINE(void)            pdmR3QueueFreeItem(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem);
+DECLINLINE(bool)            pdmR3QueueIsPending(PPDMQUEUE pQueue);
 static bool                 pdmR3QueueFlush(PPDMQUEUE pQueue);
 static DECLCALLBACK(void)   pdmR3QueueTimer(PVM pVM, PTMTIMER pTimer, void *pvUser);
 
@@ -175,9 +177,13 @@ static int pdmR3QueueCreate(PVM pVM, size_t cbItem, uint32_t cItems, uint32_t cM
     STAMR3RegisterF(pVM, &pQueue->StatInsert,           STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_CALLS,        "Calls to PDMQueueInsert.",         "/PDM/Queue/%s/Insert",         pQueue->pszName);
     STAMR3RegisterF(pVM, &pQueue->StatFlush,            STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_CALLS,        "Calls to pdmR3QueueFlush.",        "/PDM/Queue/%s/Flush",          pQueue->pszName);
     STAMR3RegisterF(pVM, &pQueue->StatFlushLeftovers,   STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,   "Left over items after flush.",     "/PDM/Queue/%s/FlushLeftovers", pQueue->pszName);
+    STAMR3RegisterF(pVM, &pQueue->StatInsertCoalesced,  STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_CALLS,        "Inserts joining a pending batch.", "/PDM/Queue/%s/InsertCoalesced", pQueue->pszName);
+    STAMR3RegisterF(pVM, &pQueue->StatFlushEarly,       STAMTYPE_COUNTER, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,   "Timer flushes brought forward.",   "/PDM/Queue/%s/FlushEarly",     pQueue->pszName);
+    STAMR3RegisterF(pVM, (void *)&pQueue->cPending,     STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,        "Pending items.",                   "/PDM/Queue/%s/Pending",        pQueue->pszName);
 #ifdef VBOX_WITH_STATISTICS
     STAMR3RegisterF(pVM, &pQueue->StatFlushPrf,         STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_CALLS,        "Profiling pdmR3QueueFlush.",       "/PDM/Queue/%s/FlushPrf",       pQueue->pszName);
-    STAMR3RegisterF(pVM, (void *)&pQueue->cStatPending, STAMTYPE_U32,     STAMVISIBILITY_ALWAYS, STAMUNIT_COUNT,        "Pending items.",                   "/PDM/Queue/%s/Pending",        pQueue->pszName);
+    STAMR3RegisterF(pVM, &pQueue->StatFlushBatch,       STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_OCCURENCES,   "Items taken off per flush.",       "/PDM/Queue/%s/FlushBatch",     pQueue->pszName);
+    STAMR3RegisterF(pVM, &pQueue->StatLatency,          STAMTYPE_PROFILE, STAMVISIBILITY_ALWAYS, STAMUNIT_NS_PER_CALL,  "First insert till flush.",         "/PDM/Queue/%s/Latency",        pQueue->pszName);
 #endif
 
     *ppQueue = pQueue;
@@ -650,9 +656,7 @@ VMMR3_INT_DECL(void) PDMR3QueueFlushAll(PVM pVM)
         ASMAtomicBitClear(&pVM->pdm.s.fQueueFlushing, PDM_QUEUE_FLUSH_FLAG_PENDING_BIT);
 
         for (PPDMQUEUE pCur = pVM->pUVM->pdm.s.pQueuesForced; pCur; pCur = pCur->pNext)
-            if (    pCur->pPendingR3
-                ||  pCur->pPendingR0
-                ||  pCur->pPendingRC)
+            if (pdmR3QueueIsPending(pCur))
                 pdmR3QueueFlush(pCur);
 
         ASMAtomicBitClear(&pVM->pdm.s.fQueueFlushing, PDM_QUEUE_FLUSH_FLAG_ACTIVE_BIT);
@@ -666,6 +670,26 @@ VMMR3_INT_DECL(void) PDMR3QueueFlushAll(PVM pVM)
 }
 
 
+/**
+ * Checks whether a queue has items pending, ending the current batch.
+ *
+ * The batch indicator must be cleared before looking at the lists so that an
+ * insert racing us either gets picked up by the coming flush or starts a new
+ * batch and raises the FF again.
+ *
+ * @returns true if there is something to flush, false if not.
+ * @param   pQueue  The queue.
+ */
+DECLINLINE(bool) pdmR3QueueIsPending(PPDMQUEUE pQueue)
+{
+    if (ASMAtomicXchgU32(&pQueue->fBatchPending, false))
+        STAM_PROFILE_ADD_PERIOD(&pQueue->StatLatency, RTTimeNanoTS() - ASMAtomicReadU64(&pQueue->u64BatchStartNS));
+    return pQueue->pPendingR3
+        || pQueue->pPendingR0
+        || pQueue->pPendingRC;
+}
+
+
 /**
  * Process pending items in one queue.
  *
@@ -693,6 +717,7 @@ static bool pdmR3QueueFlush(PPDMQUEUE pQueue)
     /*
      * Reverse the list (it's inserted in LIFO order to avoid semaphores, remember).
      */
+    uint32_t          cBatch = 0;
     PPDMQUEUEITEMCORE pCur = pItems;
     pItems = NULL;
     while (pCur)
@@ -701,6 +726,7 @@ static bool pdmR3QueueFlush(PPDMQUEUE pQueue)
         pCur = pCur->pNextR3;
         pInsert->pNextR3 = pItems;
         pItems = pInsert;
+        cBatch++;
     }
 
     /*
@@ -713,6 +739,7 @@ static bool pdmR3QueueFlush(PPDMQUEUE pQueue)
         pInsert->pNextRC = NIL_RTRCPTR;
         pInsert->pNextR3 = pItems;
         pItems = pInsert;
+        cBatch++;
     }
 
     /*
@@ -725,7 +752,10 @@ static bool pdmR3QueueFlush(PPDMQUEUE pQueue)
         pInsert->pNextR0 = NIL_RTR0PTR;
         pInsert->pNextR3 = pItems;
         pItems = pInsert;
+        cBatch++;
     }
+    STAM_PROFILE_ADD_PERIOD(&pQueue->StatFlushBatch, cBatch);
+    RT_NOREF(cBatch);
 
     /*
      * Feed the items to the consumer function.
@@ -850,7 +880,7 @@ DECLINLINE(void) pdmR3QueueFreeItem(PPDMQUEUE pQueue, PPDMQUEUEITEMCORE pItem)
 
     if (!ASMAtomicCmpXchgU32(&pQueue->iFreeHead, iNext, i))
         AssertMsgFailed(("huh? i=%d iNext=%d iFreeHead=%d iFreeTail=%d\n", i, iNext, pQueue->iFreeHead, pQueue->iFreeTail));
-    STAM_STATS({ ASMAtomicDecU32(&pQueue->cStatPending); });
+    ASMAtomicDecU32(&pQueue->cPending);
 }
 
 
@@ -867,9 +897,7 @@ static DECLCALLBACK(void) pdmR3QueueTimer(PVM pVM, PTMTIMER pTimer, void *pvUser
     PPDMQUEUE pQueue = (PPDMQUEUE)pvUser;
     Assert(pTimer == pQueue->pTimer); NOREF(pTimer); NOREF(pVM);
 
-    if (   pQueue->pPendingR3
-        || pQueue->pPendingR0
-        || pQueue->pPendingRC)
+    if (pdmR3QueueIsPending(pQueue))
         pdmR3QueueFlush(pQueue);
     int rc = TMTimerSetMillies(pQueue->pTimer, pQueue->cMilliesInterval);
     AssertRC(rc);
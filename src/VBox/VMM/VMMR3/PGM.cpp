@@ -977,6 +977,17 @@ VMMR3DECL(int) PGMR3Init(PVM pVM)
                                               "ROM write protection",
                                               &pVM->pgm.s.hRomPhysHandlerType);
 
+    /*
+     * Register the physical access handler for RAM pending lazy restore.
+     */
+    if (RT_SUCCESS(rc))
+        rc = PGMR3HandlerPhysicalTypeRegister(pVM, PGMPHYSHANDLERKIND_ALL,
+                                              pgmR3LazyRestoreAccessHandler,
+                                              NULL, NULL, NULL,
+                                              NULL, NULL, NULL,
+                                              "Lazy restore",
+                                              &pVM->pgm.s.hLazyRestorePhysHandlerType);
+
     /*
      * Init the paging.
      */
@@ -1276,6 +1287,9 @@ static int pgmR3InitStats(PVM pVM)
 
     STAM_REL_REG(pVM, &pPGM->StatShModCheck,                     STAMTYPE_PROFILE, "/PGM/ShMod/Check",                   STAMUNIT_TICKS_PER_CALL, "Profiles the shared module checking.");
 
+    STAM_REL_REG(pVM, &pPGM->StatLazyRestoreFaults,              STAMTYPE_COUNTER, "/PGM/LazyRestore/Faults",            STAMUNIT_PAGES,     "Pages restored lazily on first access.");
+    STAM_REL_REG(pVM, &pPGM->StatLazyRestorePrefetched,          STAMTYPE_COUNTER, "/PGM/LazyRestore/Prefetched",        STAMUNIT_PAGES,     "Pages restored lazily by the prefetch thread.");
+
     /* Live save */
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.fActive,              STAMTYPE_U8,      "/PGM/LiveSave/fActive",              STAMUNIT_COUNT,     "Active or not.");
     STAM_REL_REG_USED(pVM, &pPGM->LiveSave.cIgnoredPages,        STAMTYPE_U32,     "/PGM/LiveSave/cIgnoredPages",        STAMUNIT_COUNT,     "The number of ignored pages in the RAM ranges (i.e. MMIO, MMIO2 and ROM).");
@@ -1995,6 +2009,9 @@ VMMR3_INT_DECL(void) PGMR3Reset(PVM pVM)
     LogFlow(("PGMR3Reset:\n"));
     VM_ASSERT_EMT(pVM);
 
+    /* The RAM is about to be reset, so forget about anything pending restore. */
+    pgmR3LazyRestoreAbort(pVM);
+
     pgmLock(pVM);
 
     /*
@@ -2130,6 +2147,8 @@ VMMR3_INT_DECL(void) PGMR3ResetNoMorePhysWritesFlag(PVM pVM)
  */
 VMMR3DECL(int) PGMR3Term(PVM pVM)
 {
+    pgmR3LazyRestoreAbort(pVM);
+
     /* Must free shared pages here. */
     pgmLock(pVM);
     pgmR3PhysRamTerm(pVM);
@@ -4957,6 +4957,27 @@ VMMR3DECL(void) PGMR3PhysChunkInvalidateTLB(PVM pVM)
 }
 
 
+/**
+ * Response to VMMCALLRING3_PGM_LAZY_RESTORE_PAGE to restore a page that is
+ * still pending lazy restore from the saved state file.
+ *
+ * @returns VBox status code.
+ * @param   pVM         The cross context VM structure.
+ * @param   GCPhys      The address of the page.
+ */
+VMMR3DECL(int) PGMR3PhysLazyRestorePage(PVM pVM, RTGCPHYS GCPhys)
+{
+    pgmLock(pVM);
+    int      rc    = VINF_SUCCESS;
+    PPGMPAGE pPage = pgmPhysGetPage(pVM, GCPhys);
+    if (   pPage
+        && PGM_PAGE_IS_LAZY_RESTORE(pPage))
+        rc = pgmR3LazyRestorePage(pVM, pPage, GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK);
+    pgmUnlock(pVM);
+    return rc;
+}
+
+
 /**
  * Response to VMMCALLRING3_PGM_ALLOCATE_LARGE_HANDY_PAGE to allocate a large
  * (2MB) page for use with a nested paging PDE.
@@ -21,6 +21,7 @@
 *********************************************************************************************************************************/
 #define LOG_GROUP LOG_GROUP_PGM
 #include <VBox/vmm/pgm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/stam.h>
 #include <VBox/vmm/ssm.h>
 #include <VBox/vmm/pdmdrv.h>
@@ -35,7 +36,11 @@
 #include <iprt/asm.h>
 #include <iprt/assert.h>
 #include <iprt/crc.h>
+#include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
+#include <iprt/req.h>
+#include <iprt/semaphore.h>
 #include <iprt/sha.h>
 #include <iprt/string.h>
 #include <iprt/thread.h>
@@ -45,7 +50,11 @@
 *   Defined Constants And Macros                                                                                                 *
 *********************************************************************************************************************************/
 /** Saved state data unit version.  */
-#define PGM_SAVED_STATE_VERSION                 14
+#define PGM_SAVED_STATE_VERSION                 16
+/** Saved state data unit version before RAM block records. */
+#define PGM_SAVED_STATE_VERSION_PRE_LAZY        15
+/** Saved state data unit version before duplicate RAM page records. */
+#define PGM_SAVED_STATE_VERSION_PRE_DUP         14
 /** Saved state data unit version before the PAE PDPE registers. */
 #define PGM_SAVED_STATE_VERSION_PRE_PAE         13
 /** Saved state data unit version after this includes ballooned page flags in
@@ -86,8 +95,18 @@
 #define PGM_STATE_REC_ROM_PROT          UINT8_C(0x07)
 /** Ballooned page. No data. */
 #define PGM_STATE_REC_RAM_BALLOONED     UINT8_C(0x08)
+/** RAM page identical to one saved earlier in the stream.  The address of
+ *  that page (RTGCPHYS) is the payload. */
+#define PGM_STATE_REC_RAM_DUP           UINT8_C(0x09)
+/** Block of consecutive RAM pages.  The page count (32-bit) and a type byte
+ *  per page (PGM_STATE_REC_RAM_ZERO, PGM_STATE_REC_RAM_RAW or
+ *  PGM_STATE_REC_RAM_BALLOONED) are followed by the raw bits of the RAW pages
+ *  in a single uncompressed data record, so the pages can be read straight
+ *  from the saved state file by the lazy restore code.  The address refers to
+ *  the first page, like for the other RAM records. */
+#define PGM_STATE_REC_RAM_BLOCK         UINT8_C(0x0a)
 /** The last record type. */
-#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_BALLOONED
+#define PGM_STATE_REC_LAST              PGM_STATE_REC_RAM_BLOCK
 /** End marker. */
 #define PGM_STATE_REC_END               UINT8_C(0xff)
 /** Flag indicating that the data is preceded by the page address.
@@ -102,6 +121,24 @@
 /** The CRC-32 for a zero half page. */
 #define PGM_STATE_CRC32_ZERO_HALF_PAGE  UINT32_C(0xf1e8ba9e)
 
+/** The number of pages in each slice of a RAM range handed to a live save
+ *  scanning worker thread (64MB). */
+#define PGM_LIVE_SAVE_SCAN_SLICE_PAGES  _16K
+/** The max number of live save RAM scanning worker threads. */
+#define PGM_LIVE_SAVE_SCAN_MAX_WORKERS  16
+
+/** The min number of entries in the duplicate page index. */
+#define PGM_SAVE_DUP_IDX_MIN_ENTRIES    _4K
+/** The max number of entries in the duplicate page index (16MB). */
+#define PGM_SAVE_DUP_IDX_MAX_ENTRIES    _1M
+
+/** The max number of pages in a PGM_STATE_REC_RAM_BLOCK record (8MB). */
+#define PGM_STATE_RAM_BLOCK_MAX_PAGES   _2K
+/** The number of pages in a lazy restore prefetch batch. */
+#define PGM_LAZY_RESTORE_BATCH_PAGES    64
+/** The max number of lazy restore prefetch batches queued on the EMTs. */
+#define PGM_LAZY_RESTORE_MAX_BATCHES    4
+
 
 
 /** @name Old Page types used in older saved states.
@@ -148,6 +185,56 @@ typedef struct
 } PGMOLD;
 
 
+/**
+ * A slice of a RAM range scanned by a worker thread during live save.
+ *
+ * @see pgmR3ScanRamPagesSlice
+ */
+typedef struct PGMSCANRAMSLICE
+{
+    /** The RAM range. */
+    PPGMRAMRANGE                    pRam;
+    /** The first page of the slice. */
+    uint32_t                        iPageFirst;
+    /** The page following the end of the slice. */
+    uint32_t                        iPageEnd;
+    /** Adjustment to PGM::LiveSave.Ram.cReadyPages. */
+    int32_t                         cReadyPagesDelta;
+    /** Adjustment to PGM::LiveSave.Ram.cDirtyPages. */
+    int32_t                         cDirtyPagesDelta;
+    /** Adjustment to PGM::LiveSave.Ram.cZeroPages. */
+    int32_t                         cZeroPagesDelta;
+    /** The number of pages deferred to the PGM lock owner. */
+    uint32_t                        cDeferred;
+    /** The first deferred page (valid if cDeferred != 0). */
+    uint32_t                        iDeferredFirst;
+} PGMSCANRAMSLICE;
+/** Pointer to a live save RAM scanning slice. */
+typedef PGMSCANRAMSLICE *PPGMSCANRAMSLICE;
+
+
+/**
+ * A batch of pages read ahead by the lazy restore prefetch thread.
+ *
+ * @see pgmR3LazyRestoreBatchOnEmt
+ */
+typedef struct PGMLAZYRESTOREBATCH
+{
+    /** The lazy restore state this batch belongs to (referenced). */
+    PPGMLAZYRESTORE                 pLazy;
+    /** The number of pages in the batch. */
+    uint32_t                        cPages;
+    /** The guest physical address of each page. */
+    RTGCPHYS                        aGCPhys[PGM_LAZY_RESTORE_BATCH_PAGES];
+    /** The saved state file offset each page was read from. */
+    uint64_t                        aoffFile[PGM_LAZY_RESTORE_BATCH_PAGES];
+    /** The page content. */
+    uint8_t                         abPages[PGM_LAZY_RESTORE_BATCH_PAGES][PAGE_SIZE];
+} PGMLAZYRESTOREBATCH;
+/** Pointer to a lazy restore prefetch batch. */
+typedef PGMLAZYRESTOREBATCH *PPGMLAZYRESTOREBATCH;
+
+
 /*********************************************************************************************************************************
 *   Global Variables                                                                                                             *
 *********************************************************************************************************************************/
@@ -1128,7 +1215,8 @@ static int pgmR3PrepRamPages(PVM pVM)
                     paLSPages[iPage].fDirty                 = 1; /* everything is dirty at this time */
                     paLSPages[iPage].fWriteMonitored        = 0;
                     paLSPages[iPage].fWriteMonitoredJustNow = 0;
-                    paLSPages[iPage].u2Reserved             = 0;
+                    paLSPages[iPage].fScanDeferred          = 0;
+                    paLSPages[iPage].u1Reserved             = 0;
                     switch (PGM_PAGE_GET_TYPE(pPage))
                     {
                         case PGMPAGETYPE_RAM:
@@ -1345,250 +1433,395 @@ static void pgmR3StateVerifyCrc32ForRamPage(PVM pVM, PPGMRAMRANGE pCur, PPGMLIVE
 #endif /* PGMLIVESAVERAMPAGE_WITH_CRC32 */
 
 /**
- * Scan for RAM page modifications and reprotect them.
+ * Scans a RAM page for modifications and reprotects it.
  *
  * @param   pVM                 The cross context VM structure.
- * @param   fFinalPass          Whether this is the final pass or not.
+ * @param   pCur                The current RAM range.
+ * @param   paLSPages           The current array of live save page tracking
+ *                              structures.
+ * @param   iPage               The page index.
  */
-static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
+static void pgmR3ScanRamPage(PVM pVM, PPGMRAMRANGE pCur, PPGMLIVESAVERAMPAGE paLSPages, uint32_t iPage)
 {
-    /*
-     * The RAM.
-     */
-    RTGCPHYS GCPhysCur = 0;
-    PPGMRAMRANGE pCur;
-    pgmLock(pVM);
-    do
+    PGM_LOCK_ASSERT_OWNER(pVM);
+
+    /* Skip already ignored pages. */
+    if (paLSPages[iPage].fIgnore)
+        return;
+
+    if (RT_LIKELY(PGM_PAGE_GET_TYPE(&pCur->aPages[iPage]) == PGMPAGETYPE_RAM))
     {
-        uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
-        for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+        /*
+         * A RAM page.
+         */
+        switch (PGM_PAGE_GET_STATE(&pCur->aPages[iPage]))
         {
-            if (    pCur->GCPhysLast > GCPhysCur
-                && !PGM_RAM_RANGE_IS_AD_HOC(pCur))
-            {
-                PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
-                uint32_t         cPages    = pCur->cb >> PAGE_SHIFT;
-                uint32_t         iPage     = GCPhysCur <= pCur->GCPhys ? 0 : (GCPhysCur - pCur->GCPhys) >> PAGE_SHIFT;
-                GCPhysCur = 0;
-                for (; iPage < cPages; iPage++)
+            case PGM_PAGE_STATE_ALLOCATED:
+                /** @todo Optimize this: Don't always re-enable write
+                 * monitoring if the page is known to be very busy. */
+                if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
                 {
-                    /* Do yield first. */
-                    if (   !fFinalPass
-#ifndef PGMLIVESAVERAMPAGE_WITH_CRC32
-                        && (iPage & 0x7ff) == 0x100
-#endif
-                        && PDMR3CritSectYield(pVM, &pVM->pgm.s.CritSectX)
-                        && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
-                    {
-                        GCPhysCur = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
-                        break; /* restart */
-                    }
+                    AssertMsg(paLSPages[iPage].fWriteMonitored,
+                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
+                    PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
+                    Assert(pVM->pgm.s.cWrittenToPages > 0);
+                    pVM->pgm.s.cWrittenToPages--;
+                }
+                else
+                {
+                    AssertMsg(!paLSPages[iPage].fWriteMonitored,
+                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
+                    pVM->pgm.s.LiveSave.Ram.cMonitoredPages++;
+                }
 
-                    /* Skip already ignored pages. */
-                    if (paLSPages[iPage].fIgnore)
-                        continue;
+                if (!paLSPages[iPage].fDirty)
+                {
+                    pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+                    if (paLSPages[iPage].fZero)
+                        pVM->pgm.s.LiveSave.Ram.cZeroPages--;
+                    pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                    if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
+                        paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
+                }
 
-                    if (RT_LIKELY(PGM_PAGE_GET_TYPE(&pCur->aPages[iPage]) == PGMPAGETYPE_RAM))
-                    {
-                        /*
-                         * A RAM page.
-                         */
-                        switch (PGM_PAGE_GET_STATE(&pCur->aPages[iPage]))
-                        {
-                            case PGM_PAGE_STATE_ALLOCATED:
-                                /** @todo Optimize this: Don't always re-enable write
-                                 * monitoring if the page is known to be very busy. */
-                                if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
-                                {
-                                    AssertMsg(paLSPages[iPage].fWriteMonitored,
-                                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
-                                    PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
-                                    Assert(pVM->pgm.s.cWrittenToPages > 0);
-                                    pVM->pgm.s.cWrittenToPages--;
-                                }
-                                else
-                                {
-                                    AssertMsg(!paLSPages[iPage].fWriteMonitored,
-                                              ("%RGp %R[pgmpage]\n", pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT), &pCur->aPages[iPage]));
-                                    pVM->pgm.s.LiveSave.Ram.cMonitoredPages++;
-                                }
-
-                                if (!paLSPages[iPage].fDirty)
-                                {
-                                    pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                    if (paLSPages[iPage].fZero)
-                                        pVM->pgm.s.LiveSave.Ram.cZeroPages--;
-                                    pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                    if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
-                                        paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
-                                }
-
-                                pgmPhysPageWriteMonitor(pVM, &pCur->aPages[iPage],
-                                                        pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT));
-                                paLSPages[iPage].fWriteMonitored        = 1;
-                                paLSPages[iPage].fWriteMonitoredJustNow = 1;
-                                paLSPages[iPage].fDirty                 = 1;
-                                paLSPages[iPage].fZero                  = 0;
-                                paLSPages[iPage].fShared                = 0;
+                pgmPhysPageWriteMonitor(pVM, &pCur->aPages[iPage],
+                                        pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT));
+                paLSPages[iPage].fWriteMonitored        = 1;
+                paLSPages[iPage].fWriteMonitoredJustNow = 1;
+                paLSPages[iPage].fDirty                 = 1;
+                paLSPages[iPage].fZero                  = 0;
+                paLSPages[iPage].fShared                = 0;
 #ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
+                paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
 #endif
-                                break;
+                break;
 
-                            case PGM_PAGE_STATE_WRITE_MONITORED:
-                                Assert(paLSPages[iPage].fWriteMonitored);
-                                if (PGM_PAGE_GET_WRITE_LOCKS(&pCur->aPages[iPage]) == 0)
-                                {
+            case PGM_PAGE_STATE_WRITE_MONITORED:
+                Assert(paLSPages[iPage].fWriteMonitored);
+                if (PGM_PAGE_GET_WRITE_LOCKS(&pCur->aPages[iPage]) == 0)
+                {
 #ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    if (paLSPages[iPage].fWriteMonitoredJustNow)
-                                        pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
-                                    else
-                                        pgmR3StateVerifyCrc32ForRamPage(pVM, pCur, paLSPages, iPage, "scan");
+                    if (paLSPages[iPage].fWriteMonitoredJustNow)
+                        pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
+                    else
+                        pgmR3StateVerifyCrc32ForRamPage(pVM, pCur, paLSPages, iPage, "scan");
 #endif
-                                    paLSPages[iPage].fWriteMonitoredJustNow = 0;
-                                }
-                                else
-                                {
-                                    paLSPages[iPage].fWriteMonitoredJustNow = 1;
+                    paLSPages[iPage].fWriteMonitoredJustNow = 0;
+                }
+                else
+                {
+                    paLSPages[iPage].fWriteMonitoredJustNow = 1;
 #ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
+                    paLSPages[iPage].u32Crc                 = UINT32_MAX; /* invalid */
 #endif
-                                    if (!paLSPages[iPage].fDirty)
-                                    {
-                                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                        if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
-                                            paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
-                                    }
-                                }
-                                break;
-
-                            case PGM_PAGE_STATE_ZERO:
-                            case PGM_PAGE_STATE_BALLOONED:
-                                if (!paLSPages[iPage].fZero)
-                                {
-                                    if (!paLSPages[iPage].fDirty)
-                                    {
-                                        paLSPages[iPage].fDirty = 1;
-                                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                    }
-                                    paLSPages[iPage].fZero = 1;
-                                    paLSPages[iPage].fShared = 0;
+                    if (!paLSPages[iPage].fDirty)
+                    {
+                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                        if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
+                            paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
+                    }
+                }
+                break;
+
+            case PGM_PAGE_STATE_ZERO:
+            case PGM_PAGE_STATE_BALLOONED:
+                if (!paLSPages[iPage].fZero)
+                {
+                    if (!paLSPages[iPage].fDirty)
+                    {
+                        paLSPages[iPage].fDirty = 1;
+                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                    }
+                    paLSPages[iPage].fZero = 1;
+                    paLSPages[iPage].fShared = 0;
 #ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    paLSPages[iPage].u32Crc = PGM_STATE_CRC32_ZERO_PAGE;
+                    paLSPages[iPage].u32Crc = PGM_STATE_CRC32_ZERO_PAGE;
 #endif
-                                }
-                                break;
-
-                            case PGM_PAGE_STATE_SHARED:
-                                if (!paLSPages[iPage].fShared)
-                                {
-                                    if (!paLSPages[iPage].fDirty)
-                                    {
-                                        paLSPages[iPage].fDirty = 1;
-                                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
-                                        if (paLSPages[iPage].fZero)
-                                            pVM->pgm.s.LiveSave.Ram.cZeroPages--;
-                                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
-                                    }
-                                    paLSPages[iPage].fZero = 0;
-                                    paLSPages[iPage].fShared = 1;
+                }
+                break;
+
+            case PGM_PAGE_STATE_SHARED:
+                if (!paLSPages[iPage].fShared)
+                {
+                    if (!paLSPages[iPage].fDirty)
+                    {
+                        paLSPages[iPage].fDirty = 1;
+                        pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+                        if (paLSPages[iPage].fZero)
+                            pVM->pgm.s.LiveSave.Ram.cZeroPages--;
+                        pVM->pgm.s.LiveSave.Ram.cDirtyPages++;
+                    }
+                    paLSPages[iPage].fZero = 0;
+                    paLSPages[iPage].fShared = 1;
 #ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                                    pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
+                    pgmR3StateCalcCrc32ForRamPage(pVM, pCur, paLSPages, iPage);
 #endif
-                                }
-                                break;
+                }
+                break;
+        }
+    }
+    else
+    {
+        /*
+         * All other types => Ignore the page.
+         */
+        Assert(!paLSPages[iPage].fIgnore); /* skipped before switch */
+        paLSPages[iPage].fIgnore = 1;
+        if (paLSPages[iPage].fWriteMonitored)
+        {
+            /** @todo this doesn't hold water when we start monitoring MMIO2 and ROM shadow
+             *        pages! */
+            if (RT_UNLIKELY(PGM_PAGE_GET_STATE(&pCur->aPages[iPage]) == PGM_PAGE_STATE_WRITE_MONITORED))
+            {
+                AssertMsgFailed(("%R[pgmpage]", &pCur->aPages[iPage])); /* shouldn't happen. */
+                PGM_PAGE_SET_STATE(pVM, &pCur->aPages[iPage], PGM_PAGE_STATE_ALLOCATED);
+                Assert(pVM->pgm.s.cMonitoredPages > 0);
+                pVM->pgm.s.cMonitoredPages--;
+            }
+            if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
+            {
+                PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
+                Assert(pVM->pgm.s.cWrittenToPages > 0);
+                pVM->pgm.s.cWrittenToPages--;
+            }
+            pVM->pgm.s.LiveSave.Ram.cMonitoredPages--;
+        }
+
+        /** @todo the counting doesn't quite work out here. fix later? */
+        if (paLSPages[iPage].fDirty)
+            pVM->pgm.s.LiveSave.Ram.cDirtyPages--;
+        else
+        {
+            pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+            if (paLSPages[iPage].fZero)
+                pVM->pgm.s.LiveSave.Ram.cZeroPages--;
+        }
+        pVM->pgm.s.LiveSave.cIgnoredPages++;
+    }
+}
+
+
+/**
+ * Scans a slice of a RAM range on a worker thread.
+ *
+ * This only deals with the pages which can be handled by updating the live
+ * save tracking data of the slice.  Pages requiring changes to the PGMPAGE
+ * entries or the PGM statistics are flagged (PGMLIVESAVERAMPAGE::fScanDeferred)
+ * for pgmR3ScanRamPagesParallel to process once the workers are done.
+ *
+ * @param   pSlice              The slice to scan.
+ */
+static DECLCALLBACK(void) pgmR3ScanRamPagesSlice(PPGMSCANRAMSLICE pSlice)
+{
+    PPGMRAMRANGE const          pCur      = pSlice->pRam;
+    PPGMLIVESAVERAMPAGE const   paLSPages = pCur->paLSPages;
+    for (uint32_t iPage = pSlice->iPageFirst; iPage < pSlice->iPageEnd; iPage++)
+    {
+        if (paLSPages[iPage].fIgnore)
+            continue;
+
+        PCPGMPAGE pPage = &pCur->aPages[iPage];
+        if (RT_LIKELY(PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM))
+        {
+            switch (PGM_PAGE_GET_STATE(pPage))
+            {
+                case PGM_PAGE_STATE_WRITE_MONITORED:
+                    Assert(paLSPages[iPage].fWriteMonitored);
+                    if (PGM_PAGE_GET_WRITE_LOCKS(pPage) == 0)
+                        paLSPages[iPage].fWriteMonitoredJustNow = 0;
+                    else
+                    {
+                        paLSPages[iPage].fWriteMonitoredJustNow = 1;
+                        if (!paLSPages[iPage].fDirty)
+                        {
+                            pSlice->cReadyPagesDelta--;
+                            pSlice->cDirtyPagesDelta++;
+                            if (++paLSPages[iPage].cDirtied > PGMLIVSAVEPAGE_MAX_DIRTIED)
+                                paLSPages[iPage].cDirtied = PGMLIVSAVEPAGE_MAX_DIRTIED;
                         }
                     }
-                    else
+                    continue;
+
+                case PGM_PAGE_STATE_ZERO:
+                case PGM_PAGE_STATE_BALLOONED:
+                    if (!paLSPages[iPage].fZero)
                     {
-                        /*
-                         * All other types => Ignore the page.
-                         */
-                        Assert(!paLSPages[iPage].fIgnore); /* skipped before switch */
-                        paLSPages[iPage].fIgnore = 1;
-                        if (paLSPages[iPage].fWriteMonitored)
+                        if (!paLSPages[iPage].fDirty)
                         {
-                            /** @todo this doesn't hold water when we start monitoring MMIO2 and ROM shadow
-                             *        pages! */
-                            if (RT_UNLIKELY(PGM_PAGE_GET_STATE(&pCur->aPages[iPage]) == PGM_PAGE_STATE_WRITE_MONITORED))
-                            {
-                                AssertMsgFailed(("%R[pgmpage]", &pCur->aPages[iPage])); /* shouldn't happen. */
-                                PGM_PAGE_SET_STATE(pVM, &pCur->aPages[iPage], PGM_PAGE_STATE_ALLOCATED);
-                                Assert(pVM->pgm.s.cMonitoredPages > 0);
-                                pVM->pgm.s.cMonitoredPages--;
-                            }
-                            if (PGM_PAGE_IS_WRITTEN_TO(&pCur->aPages[iPage]))
-                            {
-                                PGM_PAGE_CLEAR_WRITTEN_TO(pVM, &pCur->aPages[iPage]);
-                                Assert(pVM->pgm.s.cWrittenToPages > 0);
-                                pVM->pgm.s.cWrittenToPages--;
-                            }
-                            pVM->pgm.s.LiveSave.Ram.cMonitoredPages--;
+                            paLSPages[iPage].fDirty = 1;
+                            pSlice->cReadyPagesDelta--;
+                            pSlice->cDirtyPagesDelta++;
                         }
+                        paLSPages[iPage].fZero = 1;
+                        paLSPages[iPage].fShared = 0;
+                    }
+                    continue;
 
-                        /** @todo the counting doesn't quite work out here. fix later? */
-                        if (paLSPages[iPage].fDirty)
-                            pVM->pgm.s.LiveSave.Ram.cDirtyPages--;
-                        else
+                case PGM_PAGE_STATE_SHARED:
+                    if (!paLSPages[iPage].fShared)
+                    {
+                        if (!paLSPages[iPage].fDirty)
                         {
-                            pVM->pgm.s.LiveSave.Ram.cReadyPages--;
+                            paLSPages[iPage].fDirty = 1;
+                            pSlice->cReadyPagesDelta--;
                             if (paLSPages[iPage].fZero)
-                                pVM->pgm.s.LiveSave.Ram.cZeroPages--;
+                                pSlice->cZeroPagesDelta--;
+                            pSlice->cDirtyPagesDelta++;
                         }
-                        pVM->pgm.s.LiveSave.cIgnoredPages++;
+                        paLSPages[iPage].fZero = 0;
+                        paLSPages[iPage].fShared = 1;
                     }
-                } /* for each page in range */
+                    continue;
 
-                if (GCPhysCur != 0)
-                    break; /* Yield + ramrange change */
-                GCPhysCur = pCur->GCPhysLast;
+                default:
+                    break;
             }
-        } /* for each range */
-    } while (pCur);
-    pgmUnlock(pVM);
+        }
+
+        /* Leave it to the lock owner. */
+        paLSPages[iPage].fScanDeferred = 1;
+        if (!pSlice->cDeferred++)
+            pSlice->iDeferredFirst = iPage;
+    }
 }
 
 
 /**
- * Save quiescent RAM pages.
+ * Scans a chunk of a RAM range with the help of the worker threads.
  *
- * @returns VBox status code.
+ * The caller owns the PGM lock and keeps it while the workers are busy, so the
+ * workers act on its behalf.  Each worker is given a slice of
+ * PGM_LIVE_SAVE_SCAN_SLICE_PAGES pages and only touches the tracking data
+ * within it, the rest is done here afterwards.
+ *
+ * @returns The index of the next page to scan.
  * @param   pVM                 The cross context VM structure.
- * @param   pSSM                The SSM handle.
- * @param   fLiveSave           Whether it's a live save or not.
- * @param   uPass               The pass number.
+ * @param   pCur                The current RAM range.
+ * @param   iPage               The first page to scan.
+ * @param   cPages              The number of pages in the range.
  */
-static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t uPass)
+static uint32_t pgmR3ScanRamPagesParallel(PVM pVM, PPGMRAMRANGE pCur, uint32_t iPage, uint32_t cPages)
 {
-    NOREF(fLiveSave);
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    uint32_t const  cSlices = RT_MIN(pVM->pgm.s.LiveSave.cScanWorkers + 1, (cPages - iPage) / PGM_LIVE_SAVE_SCAN_SLICE_PAGES);
+    Assert(cSlices > 0 && cSlices <= PGM_LIVE_SAVE_SCAN_MAX_WORKERS + 1);
 
+    PGMSCANRAMSLICE aSlices[PGM_LIVE_SAVE_SCAN_MAX_WORKERS + 1];
+    for (uint32_t i = 0; i < cSlices; i++)
+    {
+        aSlices[i].pRam             = pCur;
+        aSlices[i].iPageFirst       = iPage + i * PGM_LIVE_SAVE_SCAN_SLICE_PAGES;
+        aSlices[i].iPageEnd         = aSlices[i].iPageFirst + PGM_LIVE_SAVE_SCAN_SLICE_PAGES;
+        aSlices[i].cReadyPagesDelta = 0;
+        aSlices[i].cDirtyPagesDelta = 0;
+        aSlices[i].cZeroPagesDelta  = 0;
+        aSlices[i].cDeferred        = 0;
+        aSlices[i].iDeferredFirst   = 0;
+    }
+
+    /*
+     * Farm out all but the first slice, that one we do ourselves.
+     */
+    PRTREQ   apReqs[PGM_LIVE_SAVE_SCAN_MAX_WORKERS];
+    uint32_t cReqs = 0;
+    for (uint32_t i = 1; i < cSlices; i++)
+    {
+        PRTREQ hReq = NIL_RTREQ;
+        int rc = RTReqPoolCallEx(pVM->pgm.s.LiveSave.hScanPool, 0 /*cMillies*/, &hReq, RTREQFLAGS_VOID,
+                                 (PFNRT)pgmR3ScanRamPagesSlice, 1, &aSlices[i]);
+        if (rc == VERR_TIMEOUT || RT_SUCCESS(rc))
+            apReqs[cReqs++] = hReq;
+        else
+            pgmR3ScanRamPagesSlice(&aSlices[i]);
+    }
+    pgmR3ScanRamPagesSlice(&aSlices[0]);
+    for (uint32_t i = 0; i < cReqs; i++)
+    {
+        int rc = RTReqWait(apReqs[i], RT_INDEFINITE_WAIT);
+        AssertRC(rc);
+        RTReqRelease(apReqs[i]);
+    }
+
+    /*
+     * Merge the statistics and process the deferred pages.
+     */
+    PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
+    for (uint32_t i = 0; i < cSlices; i++)
+    {
+        pVM->pgm.s.LiveSave.Ram.cReadyPages += aSlices[i].cReadyPagesDelta;
+        pVM->pgm.s.LiveSave.Ram.cDirtyPages += aSlices[i].cDirtyPagesDelta;
+        pVM->pgm.s.LiveSave.Ram.cZeroPages  += aSlices[i].cZeroPagesDelta;
+
+        uint32_t cLeft = aSlices[i].cDeferred;
+        for (uint32_t iDeferred = aSlices[i].iDeferredFirst; cLeft > 0; iDeferred++)
+        {
+            Assert(iDeferred < aSlices[i].iPageEnd);
+            if (paLSPages[iDeferred].fScanDeferred)
+            {
+                paLSPages[iDeferred].fScanDeferred = 0;
+                pgmR3ScanRamPage(pVM, pCur, paLSPages, iDeferred);
+                cLeft--;
+            }
+        }
+    }
+
+    return iPage + cSlices * PGM_LIVE_SAVE_SCAN_SLICE_PAGES;
+}
+
+
+/**
+ * Scan for RAM page modifications and reprotect them.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   fFinalPass          Whether this is the final pass or not.
+ */
+static void pgmR3ScanRamPages(PVM pVM, bool fFinalPass)
+{
     /*
      * The RAM.
      */
-    RTGCPHYS GCPhysLast = NIL_RTGCPHYS;
     RTGCPHYS GCPhysCur = 0;
     PPGMRAMRANGE pCur;
-
     pgmLock(pVM);
     do
     {
         uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
         for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
         {
-            if (   pCur->GCPhysLast > GCPhysCur
+            if (    pCur->GCPhysLast > GCPhysCur
                 && !PGM_RAM_RANGE_IS_AD_HOC(pCur))
             {
                 PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
                 uint32_t         cPages    = pCur->cb >> PAGE_SHIFT;
                 uint32_t         iPage     = GCPhysCur <= pCur->GCPhys ? 0 : (GCPhysCur - pCur->GCPhys) >> PAGE_SHIFT;
                 GCPhysCur = 0;
-                for (; iPage < cPages; iPage++)
+                while (iPage < cPages)
                 {
+                    /*
+                     * Hand big chunks to the worker threads when we've got any,
+                     * yielding the lock between each chunk.
+                     */
+                    if (   pVM->pgm.s.LiveSave.hScanPool != NIL_RTREQPOOL
+                        && cPages - iPage >= PGM_LIVE_SAVE_SCAN_SLICE_PAGES * 2)
+                    {
+                        iPage = pgmR3ScanRamPagesParallel(pVM, pCur, iPage, cPages);
+                        if (   !fFinalPass
+                            && PDMR3CritSectYield(pVM, &pVM->pgm.s.CritSectX)
+                            && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
+                        {
+                            GCPhysCur = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+                            break; /* restart */
+                        }
+                        continue;
+                    }
+
                     /* Do yield first. */
-                    if (   uPass != SSM_PASS_FINAL
+                    if (   !fFinalPass
+#ifndef PGMLIVESAVERAMPAGE_WITH_CRC32
                         && (iPage & 0x7ff) == 0x100
+#endif
                         && PDMR3CritSectYield(pVM, &pVM->pgm.s.CritSectX)
                         && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
                     {
@@ -1596,52 +1829,285 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                         break; /* restart */
                     }
 
-                    PPGMPAGE pCurPage = &pCur->aPages[iPage];
-
-                    /*
-                     * Only save pages that haven't changed since last scan and are dirty.
-                     */
-                    if (    uPass != SSM_PASS_FINAL
-                        &&  paLSPages)
-                    {
-                        if (!paLSPages[iPage].fDirty)
-                            continue;
-                        if (paLSPages[iPage].fWriteMonitoredJustNow)
-                            continue;
-                        if (paLSPages[iPage].fIgnore)
-                            continue;
-                        if (PGM_PAGE_GET_TYPE(pCurPage) != PGMPAGETYPE_RAM) /* in case of recent remappings */
-                            continue;
-                        if (    PGM_PAGE_GET_STATE(pCurPage)
-                            !=  (  paLSPages[iPage].fZero
-                                 ? PGM_PAGE_STATE_ZERO
-                                 : paLSPages[iPage].fShared
-                                 ? PGM_PAGE_STATE_SHARED
-                                 : PGM_PAGE_STATE_WRITE_MONITORED))
-                            continue;
-                        if (PGM_PAGE_GET_WRITE_LOCKS(&pCur->aPages[iPage]) > 0)
-                            continue;
-                    }
-                    else
-                    {
-                        if (   paLSPages
-                            && !paLSPages[iPage].fDirty
-                            && !paLSPages[iPage].fIgnore)
-                        {
-#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
-                            if (PGM_PAGE_GET_TYPE(pCurPage) != PGMPAGETYPE_RAM)
-                                pgmR3StateVerifyCrc32ForRamPage(pVM, pCur, paLSPages, iPage, "save#1");
-#endif
-                            continue;
-                        }
-                        if (PGM_PAGE_GET_TYPE(pCurPage) != PGMPAGETYPE_RAM)
-                            continue;
-                    }
+                    pgmR3ScanRamPage(pVM, pCur, paLSPages, iPage);
+                    iPage++;
+                } /* for each page in range */
 
-                    /*
-                     * Do the saving outside the PGM critsect since SSM may block on I/O.
-                     */
-                    int         rc;
+                if (GCPhysCur != 0)
+                    break; /* Yield + ramrange change */
+                GCPhysCur = pCur->GCPhysLast;
+            }
+        } /* for each range */
+    } while (pCur);
+    pgmUnlock(pVM);
+}
+
+
+/**
+ * Creates the duplicate page index for a save operation.
+ *
+ * Failing to allocate it isn't fatal, we'll just save every page in full.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+static void pgmR3SaveDupIdxCreate(PVM pVM)
+{
+    Assert(!pVM->pgm.s.paSaveDupIdx);
+    pVM->pgm.s.cSaveDupPages = 0;
+
+    /** @cfgm{/PGM/SaveDupPages, bool, true}
+     * Whether to save RAM pages identical to pages already saved in the same
+     * stream as references to those. */
+    bool fEnabled = true;
+    int rc = CFGMR3QueryBoolDef(CFGMR3GetChild(CFGMR3GetRoot(pVM), "/PGM"), "SaveDupPages", &fEnabled, true);
+    AssertLogRelRC(rc);
+    if (RT_FAILURE(rc) || !fEnabled)
+        return;
+
+    uint32_t cEntries = PGM_SAVE_DUP_IDX_MIN_ENTRIES;
+    while (cEntries < pVM->pgm.s.cAllPages && cEntries < PGM_SAVE_DUP_IDX_MAX_ENTRIES)
+        cEntries <<= 1;
+    PPGMSAVEDUPENTRY paEntries = (PPGMSAVEDUPENTRY)MMR3HeapAlloc(pVM, MM_TAG_PGM, cEntries * sizeof(PGMSAVEDUPENTRY));
+    if (!paEntries)
+    {
+        LogRel(("PGM: Failed to allocate the duplicate page index (%u entries)\n", cEntries));
+        return;
+    }
+    for (uint32_t i = 0; i < cEntries; i++)
+    {
+        paEntries[i].uHash  = 0;
+        paEntries[i].GCPhys = NIL_RTGCPHYS;
+    }
+
+    pgmLock(pVM);
+    pVM->pgm.s.fSaveDupIdxMask = cEntries - 1;
+    pVM->pgm.s.paSaveDupIdx    = paEntries;
+    pgmUnlock(pVM);
+}
+
+
+/**
+ * Destroys the duplicate page index after a save operation.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+static void pgmR3SaveDupIdxDestroy(PVM pVM)
+{
+    pgmLock(pVM);
+    PPGMSAVEDUPENTRY paEntries = pVM->pgm.s.paSaveDupIdx;
+    pVM->pgm.s.paSaveDupIdx    = NULL;
+    pVM->pgm.s.fSaveDupIdxMask = 0;
+    pgmUnlock(pVM);
+
+    if (paEntries)
+    {
+        LogRel(("PGM: Saved %u duplicate RAM pages as references\n", pVM->pgm.s.cSaveDupPages));
+        MMR3HeapFree(paEntries);
+    }
+}
+
+
+/**
+ * Calculates the hash of a page for the duplicate page index.
+ *
+ * This is a simple four lane multiply and rotate hash along the lines of
+ * xxHash64.  It only has to be fast and spread well, identical pages are
+ * always confirmed by comparing the bits.
+ *
+ * @returns 64-bit hash.
+ * @param   pbPage              The page bits.
+ */
+static uint64_t pgmR3SaveDupHashPage(uint8_t const *pbPage)
+{
+    uint64_t const  uPrime1 = UINT64_C(0x9e3779b185ebca87);
+    uint64_t const  uPrime2 = UINT64_C(0xc2b2ae3d27d4eb4f);
+    uint64_t const  uPrime3 = UINT64_C(0x165667b19e3779f9);
+    uint64_t const *pu64    = (uint64_t const *)pbPage;
+    uint64_t        uLane0  = uPrime1 + uPrime2;
+    uint64_t        uLane1  = uPrime2;
+    uint64_t        uLane2  = 0;
+    uint64_t        uLane3  = 0 - uPrime1;
+    for (uint32_t i = 0; i < PAGE_SIZE / sizeof(uint64_t); i += 4)
+    {
+        uLane0 = ASMRotateLeftU64(uLane0 + pu64[i    ] * uPrime2, 31) * uPrime1;
+        uLane1 = ASMRotateLeftU64(uLane1 + pu64[i + 1] * uPrime2, 31) * uPrime1;
+        uLane2 = ASMRotateLeftU64(uLane2 + pu64[i + 2] * uPrime2, 31) * uPrime1;
+        uLane3 = ASMRotateLeftU64(uLane3 + pu64[i + 3] * uPrime2, 31) * uPrime1;
+    }
+
+    uint64_t uHash = ASMRotateLeftU64(uLane0, 1)  + ASMRotateLeftU64(uLane1, 7)
+                   + ASMRotateLeftU64(uLane2, 12) + ASMRotateLeftU64(uLane3, 18);
+    uHash ^= uHash >> 33;
+    uHash *= uPrime2;
+    uHash ^= uHash >> 29;
+    uHash *= uPrime3;
+    uHash ^= uHash >> 32;
+    return uHash;
+}
+
+
+/**
+ * Looks for an identical page saved earlier in the stream, adding the page to
+ * the duplicate page index if there isn't one.
+ *
+ * The loader copies duplicates from what it has loaded so far, so the earlier
+ * page must be unmodified since it was last saved.  During live save this
+ * means it must be clean and still write monitored, otherwise the VM isn't
+ * running.  The bits are always compared, so hash collisions are harmless.
+ *
+ * @returns The address of the identical page, NIL_RTGCPHYS if none.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pbPage              Copy of the page bits.
+ * @param   GCPhys              The address of the page.
+ */
+static RTGCPHYS pgmR3SaveRamPageFindDup(PVM pVM, uint8_t const *pbPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    if (ASMMemIsZeroPage(pbPage))
+        return NIL_RTGCPHYS;
+
+    uint64_t const          uHash     = pgmR3SaveDupHashPage(pbPage);
+    PPGMSAVEDUPENTRY const  pEntry    = &pVM->pgm.s.paSaveDupIdx[uHash & pVM->pgm.s.fSaveDupIdxMask];
+    RTGCPHYS const          GCPhysDup = pEntry->GCPhys;
+    if (   GCPhysDup != NIL_RTGCPHYS
+        && GCPhysDup != GCPhys
+        && pEntry->uHash == uHash)
+    {
+        PPGMPAGE     pDupPage;
+        PPGMRAMRANGE pDupRam;
+        int rc = pgmPhysGetPageAndRangeEx(pVM, GCPhysDup, &pDupPage, &pDupRam);
+        if (   RT_SUCCESS(rc)
+            && PGM_PAGE_GET_TYPE(pDupPage) == PGMPAGETYPE_RAM)
+        {
+            bool fUnmodified;
+            if (!pVM->pgm.s.LiveSave.fActive)
+                fUnmodified = true;
+            else if (pDupRam->paLSPages)
+            {
+                PGMLIVESAVERAMPAGE const *pLSPage = &pDupRam->paLSPages[(GCPhysDup - pDupRam->GCPhys) >> PAGE_SHIFT];
+                fUnmodified = !pLSPage->fDirty
+                           && !pLSPage->fIgnore
+                           && PGM_PAGE_GET_STATE(pDupPage) == PGM_PAGE_STATE_WRITE_MONITORED
+                           && PGM_PAGE_GET_WRITE_LOCKS(pDupPage) == 0;
+            }
+            else
+                fUnmodified = false; /* saved in full every pass while the VM is running */
+            if (fUnmodified)
+            {
+                PGMPAGEMAPLOCK  PgMpLck;
+                void const     *pvDupPage;
+                rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pDupPage, GCPhysDup, &pvDupPage, &PgMpLck);
+                if (RT_SUCCESS(rc))
+                {
+                    bool const fIdentical = memcmp(pvDupPage, pbPage, PAGE_SIZE) == 0;
+                    pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                    if (fIdentical)
+                    {
+                        pVM->pgm.s.cSaveDupPages++;
+                        return GCPhysDup;
+                    }
+                }
+            }
+        }
+    }
+
+    pEntry->uHash  = uHash;
+    pEntry->GCPhys = GCPhys;
+    return NIL_RTGCPHYS;
+}
+
+
+/**
+ * Save quiescent RAM pages.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The SSM handle.
+ * @param   fLiveSave           Whether it's a live save or not.
+ * @param   uPass               The pass number.
+ */
+static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t uPass)
+{
+    NOREF(fLiveSave);
+
+    /*
+     * The RAM.
+     */
+    RTGCPHYS GCPhysLast = NIL_RTGCPHYS;
+    RTGCPHYS GCPhysCur = 0;
+    PPGMRAMRANGE pCur;
+
+    pgmLock(pVM);
+    do
+    {
+        uint32_t const  idRamRangesGen = pVM->pgm.s.idRamRangesGen;
+        for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+        {
+            if (   pCur->GCPhysLast > GCPhysCur
+                && !PGM_RAM_RANGE_IS_AD_HOC(pCur))
+            {
+                PPGMLIVESAVERAMPAGE paLSPages = pCur->paLSPages;
+                uint32_t         cPages    = pCur->cb >> PAGE_SHIFT;
+                uint32_t         iPage     = GCPhysCur <= pCur->GCPhys ? 0 : (GCPhysCur - pCur->GCPhys) >> PAGE_SHIFT;
+                GCPhysCur = 0;
+                for (; iPage < cPages; iPage++)
+                {
+                    /* Do yield first. */
+                    if (   uPass != SSM_PASS_FINAL
+                        && (iPage & 0x7ff) == 0x100
+                        && PDMR3CritSectYield(pVM, &pVM->pgm.s.CritSectX)
+                        && pVM->pgm.s.idRamRangesGen != idRamRangesGen)
+                    {
+                        GCPhysCur = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+                        break; /* restart */
+                    }
+
+                    PPGMPAGE pCurPage = &pCur->aPages[iPage];
+
+                    /*
+                     * Only save pages that haven't changed since last scan and are dirty.
+                     */
+                    if (    uPass != SSM_PASS_FINAL
+                        &&  paLSPages)
+                    {
+                        if (!paLSPages[iPage].fDirty)
+                            continue;
+                        if (paLSPages[iPage].fWriteMonitoredJustNow)
+                            continue;
+                        if (paLSPages[iPage].fIgnore)
+                            continue;
+                        if (PGM_PAGE_GET_TYPE(pCurPage) != PGMPAGETYPE_RAM) /* in case of recent remappings */
+                            continue;
+                        if (    PGM_PAGE_GET_STATE(pCurPage)
+                            !=  (  paLSPages[iPage].fZero
+                                 ? PGM_PAGE_STATE_ZERO
+                                 : paLSPages[iPage].fShared
+                                 ? PGM_PAGE_STATE_SHARED
+                                 : PGM_PAGE_STATE_WRITE_MONITORED))
+                            continue;
+                        if (PGM_PAGE_GET_WRITE_LOCKS(&pCur->aPages[iPage]) > 0)
+                            continue;
+                    }
+                    else
+                    {
+                        if (   paLSPages
+                            && !paLSPages[iPage].fDirty
+                            && !paLSPages[iPage].fIgnore)
+                        {
+#ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
+                            if (PGM_PAGE_GET_TYPE(pCurPage) != PGMPAGETYPE_RAM)
+                                pgmR3StateVerifyCrc32ForRamPage(pVM, pCur, paLSPages, iPage, "save#1");
+#endif
+                            continue;
+                        }
+                        if (PGM_PAGE_GET_TYPE(pCurPage) != PGMPAGETYPE_RAM)
+                            continue;
+                    }
+
+                    /*
+                     * Do the saving outside the PGM critsect since SSM may block on I/O.
+                     */
+                    int         rc;
                     RTGCPHYS    GCPhys = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
                     bool        fZero  = PGM_PAGE_IS_ZERO(pCurPage);
                     bool        fBallooned = PGM_PAGE_IS_BALLOONED(pCurPage);
@@ -1656,6 +2122,7 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                         uint8_t         abPage[PAGE_SIZE];
                         PGMPAGEMAPLOCK  PgMpLck;
                         void const     *pvPage;
+                        RTGCPHYS        GCPhysDup = NIL_RTGCPHYS;
                         rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pCurPage, GCPhys, &pvPage, &PgMpLck);
                         if (RT_SUCCESS(rc))
                         {
@@ -1665,12 +2132,25 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
                                 pgmR3StateVerifyCrc32ForPage(abPage, pCur, paLSPages, iPage, "save#3");
 #endif
                             pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                            if (pVM->pgm.s.paSaveDupIdx)
+                                GCPhysDup = pgmR3SaveRamPageFindDup(pVM, abPage, GCPhys);
                         }
                         pgmUnlock(pVM);
                         AssertLogRelMsgRCReturn(rc, ("rc=%Rrc GCPhys=%RGp\n", rc, GCPhys), rc);
 
                         /* Try save some memory when restoring. */
-                        if (!ASMMemIsZeroPage(pvPage))
+                        if (GCPhysDup != NIL_RTGCPHYS)
+                        {
+                            if (GCPhys == GCPhysLast + PAGE_SIZE)
+                                SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_DUP);
+                            else
+                            {
+                                SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_DUP | PGM_STATE_REC_FLAG_ADDR);
+                                SSMR3PutGCPhys(pSSM, GCPhys);
+                            }
+                            rc = SSMR3PutGCPhys(pSSM, GCPhysDup);
+                        }
+                        else if (!ASMMemIsZeroPage(pvPage))
                         {
                             if (GCPhys == GCPhysLast + PAGE_SIZE)
                                 SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_RAW);
@@ -1749,69 +2229,887 @@ static int pgmR3SaveRamPages(PVM pVM, PSSMHANDLE pSSM, bool fLiveSave, uint32_t
 
 
 /**
- * Cleans up RAM pages after a live save.
+ * Checks whether to save the RAM in PGM_STATE_REC_RAM_BLOCK records laid out
+ * for lazy restore.
+ *
+ * @returns true / false.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The SSM handle.
+ */
+static bool pgmR3SaveQueryRamBlocks(PVM pVM, PSSMHANDLE pSSM)
+{
+    /** @cfgm{/PGM/SaveForLazyRestore, bool, false}
+     * Whether to save the RAM in uncompressed blocks at the end of the save
+     * so it can be restored lazily (see /PGM/LazyRestore).  Only applies
+     * to saving to a file and makes the saved state bigger. */
+    bool fRamBlocks = false;
+    int rc = CFGMR3QueryBoolDef(CFGMR3GetChild(CFGMR3GetRoot(pVM), "/PGM"), "SaveForLazyRestore", &fRamBlocks, false);
+    AssertLogRelRCReturn(rc, false);
+    return fRamBlocks
+        && SSMR3HandleGetFilename(pSSM) != NULL;
+}
+
+
+/**
+ * Saves all the RAM pages in PGM_STATE_REC_RAM_BLOCK records.
+ *
+ * This is only used in the final pass and puts the raw bits of the non-zero
+ * pages of each block in one uncompressed record which the lazy restore code
+ * can read straight from the saved state file.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The SSM handle.
+ */
+static int pgmR3SaveRamBlocks(PVM pVM, PSSMHANDLE pSSM)
+{
+    uint8_t *pbBits = (uint8_t *)RTMemPageAlloc(PGM_STATE_RAM_BLOCK_MAX_PAGES * PAGE_SIZE);
+    AssertReturn(pbBits, VERR_NO_PAGE_MEMORY);
+    uint8_t  abTypes[PGM_STATE_RAM_BLOCK_MAX_PAGES];
+
+    /*
+     * Since this is the final pass, the VM isn't running and the caller owns
+     * the PGM lock, so the RAM ranges won't change under our feet.
+     */
+    int      rc         = VINF_SUCCESS;
+    RTGCPHYS GCPhysLast = NIL_RTGCPHYS;
+    pgmLock(pVM);
+    for (PPGMRAMRANGE pCur = pVM->pgm.s.pRamRangesXR3; pCur && RT_SUCCESS(rc); pCur = pCur->pNextR3)
+    {
+        if (PGM_RAM_RANGE_IS_AD_HOC(pCur))
+            continue;
+
+        uint32_t const cPages = pCur->cb >> PAGE_SHIFT;
+        uint32_t       iPage  = 0;
+        while (iPage < cPages)
+        {
+            if (PGM_PAGE_GET_TYPE(&pCur->aPages[iPage]) != PGMPAGETYPE_RAM)
+            {
+                iPage++;
+                continue;
+            }
+
+            /*
+             * Collect a block of RAM pages.
+             */
+            uint32_t const iPageFirst = iPage;
+            uint32_t       cRawPages  = 0;
+            while (   iPage < cPages
+                   && iPage - iPageFirst < PGM_STATE_RAM_BLOCK_MAX_PAGES
+                   && PGM_PAGE_GET_TYPE(&pCur->aPages[iPage]) == PGMPAGETYPE_RAM)
+            {
+                PPGMPAGE pPage = &pCur->aPages[iPage];
+                uint8_t  u8Type;
+                if (PGM_PAGE_IS_BALLOONED(pPage))
+                    u8Type = PGM_STATE_REC_RAM_BALLOONED;
+                else if (PGM_PAGE_IS_ZERO(pPage))
+                    u8Type = PGM_STATE_REC_RAM_ZERO;
+                else
+                {
+                    RTGCPHYS const  GCPhys = pCur->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+                    PGMPAGEMAPLOCK  PgMpLck;
+                    void const     *pvPage;
+                    rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pPage, GCPhys, &pvPage, &PgMpLck);
+                    AssertLogRelMsgRCBreak(rc, ("rc=%Rrc GCPhys=%RGp\n", rc, GCPhys));
+                    uint8_t *pbDst = &pbBits[(size_t)cRawPages << PAGE_SHIFT];
+                    memcpy(pbDst, pvPage, PAGE_SIZE);
+                    pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                    if (ASMMemIsZeroPage(pbDst))
+                        u8Type = PGM_STATE_REC_RAM_ZERO;
+                    else
+                    {
+                        u8Type = PGM_STATE_REC_RAM_RAW;
+                        cRawPages++;
+                    }
+                }
+                abTypes[iPage - iPageFirst] = u8Type;
+                iPage++;
+            }
+            if (RT_FAILURE(rc))
+                break;
+
+            /*
+             * Save it.
+             */
+            uint32_t const cBlockPages = iPage - iPageFirst;
+            RTGCPHYS const GCPhys      = pCur->GCPhys + ((RTGCPHYS)iPageFirst << PAGE_SHIFT);
+            if (GCPhys == GCPhysLast + PAGE_SIZE)
+                SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_BLOCK);
+            else
+            {
+                SSMR3PutU8(pSSM, PGM_STATE_REC_RAM_BLOCK | PGM_STATE_REC_FLAG_ADDR);
+                SSMR3PutGCPhys(pSSM, GCPhys);
+            }
+            SSMR3PutU32(pSSM, cBlockPages);
+            rc = SSMR3PutMem(pSSM, abTypes, cBlockPages);
+            if (RT_SUCCESS(rc) && cRawPages)
+                rc = SSMR3PutMemDirect(pSSM, pbBits, (size_t)cRawPages << PAGE_SHIFT);
+            if (RT_FAILURE(rc))
+                break;
+            GCPhysLast = GCPhys + ((RTGCPHYS)(cBlockPages - 1) << PAGE_SHIFT);
+        }
+    }
+    pgmUnlock(pVM);
+
+    RTMemPageFree(pbBits, PGM_STATE_RAM_BLOCK_MAX_PAGES * PAGE_SIZE);
+    return rc;
+}
+
+
+/**
+ * Cleans up RAM pages after a live save.
+ *
+ * @param   pVM                 The cross context VM structure.
+ */
+static void pgmR3DoneRamPages(PVM pVM)
+{
+    /*
+     * Free the tracking arrays and disable write monitoring.
+     *
+     * Play nice with the PGM lock in case we're called while the VM is still
+     * running.  This means we have to delay the freeing since we wish to use
+     * paLSPages as an indicator of which RAM ranges which we need to scan for
+     * write monitored pages.
+     */
+    void *pvToFree = NULL;
+    PPGMRAMRANGE pCur;
+    uint32_t cMonitoredPages = 0;
+    pgmLock(pVM);
+    do
+    {
+        for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+        {
+            if (pCur->paLSPages)
+            {
+                if (pvToFree)
+                {
+                    uint32_t idRamRangesGen = pVM->pgm.s.idRamRangesGen;
+                    pgmUnlock(pVM);
+                    MMR3HeapFree(pvToFree);
+                    pvToFree = NULL;
+                    pgmLock(pVM);
+                    if (idRamRangesGen != pVM->pgm.s.idRamRangesGen)
+                        break;          /* start over again. */
+                }
+
+                pvToFree = pCur->paLSPages;
+                pCur->paLSPages = NULL;
+
+                uint32_t iPage = pCur->cb >> PAGE_SHIFT;
+                while (iPage--)
+                {
+                    PPGMPAGE pPage = &pCur->aPages[iPage];
+                    PGM_PAGE_CLEAR_WRITTEN_TO(pVM, pPage);
+                    if (PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_WRITE_MONITORED)
+                    {
+                        PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_ALLOCATED);
+                        cMonitoredPages++;
+                    }
+                }
+            }
+        }
+    } while (pCur);
+
+    Assert(pVM->pgm.s.cMonitoredPages >= cMonitoredPages);
+    if (pVM->pgm.s.cMonitoredPages < cMonitoredPages)
+        pVM->pgm.s.cMonitoredPages = 0;
+    else
+        pVM->pgm.s.cMonitoredPages -= cMonitoredPages;
+
+    pgmUnlock(pVM);
+
+    MMR3HeapFree(pvToFree);
+    pvToFree = NULL;
+}
+
+
+/**
+ * Looks up the lazy restore tracking of the RAM range containing a page.
+ *
+ * @returns Pointer to the tracking structure, NULL if not found.
+ * @param   pLazy               The lazy restore state.
+ * @param   GCPhys              The page address.
+ */
+static PPGMLAZYRESTORERAM pgmR3LazyRestoreLookupRam(PPGMLAZYRESTORE pLazy, RTGCPHYS GCPhys)
+{
+    for (uint32_t i = 0; i < pLazy->cRams; i++)
+        if (GCPhys - pLazy->aRams[i].GCPhys < ((RTGCPHYS)pLazy->aRams[i].cPages << PAGE_SHIFT))
+            return &pLazy->aRams[i];
+    return NULL;
+}
+
+
+/**
+ * Releases a reference to the lazy restore state, freeing it when the last
+ * reference goes away.
+ *
+ * @param   pLazy               The lazy restore state.
+ */
+static void pgmR3LazyRestoreRelease(PPGMLAZYRESTORE pLazy)
+{
+    uint32_t cRefs = ASMAtomicDecU32(&pLazy->cRefs);
+    Assert(cRefs < _1M);
+    if (cRefs == 0)
+    {
+        Assert(pLazy->hFile == NIL_RTFILE);
+        for (uint32_t i = 0; i < pLazy->cRams; i++)
+            RTMemFree(pLazy->aRams[i].paoffPages);
+        RTMemFree(pLazy->paHandlers);
+        RTSemEventDestroy(pLazy->hEvtBatchDone);
+        RTMemFree(pLazy);
+    }
+}
+
+
+/**
+ * Drops a page from the lazy restore, i.e. forgets about the saved content.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pPage               The page.
+ * @param   GCPhys              The page address.
+ */
+static void pgmR3LazyRestoreDropPage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_PAGE_CLEAR_LAZY_RESTORE(pVM, pPage);
+
+    PPGMLAZYRESTORE    pLazy    = pVM->pgm.s.pLazyRestoreR3;
+    PPGMLAZYRESTORERAM pLazyRam = pLazy ? pgmR3LazyRestoreLookupRam(pLazy, GCPhys) : NULL;
+    if (pLazyRam && pLazyRam->paoffPages)
+    {
+        uint32_t const iPage = (uint32_t)((GCPhys - pLazyRam->GCPhys) >> PAGE_SHIFT);
+        if (pLazyRam->paoffPages[iPage])
+        {
+            ASMAtomicWriteU64(&pLazyRam->paoffPages[iPage], 0);
+            pLazyRam->cPagesLeft--;
+            ASMAtomicDecU32(&pLazy->cPagesLeft);
+        }
+    }
+}
+
+
+/**
+ * Restores a page pending lazy restore using the given content.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pPage               The page.
+ * @param   GCPhys              The page address.
+ * @param   pvBits              The page content read from the saved state file.
+ */
+static int pgmR3LazyRestorePageWithBits(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys, void const *pvBits)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+
+    /* Ballooned while pending (shouldn't really happen), nothing to restore. */
+    if (PGM_PAGE_IS_BALLOONED(pPage))
+    {
+        pgmR3LazyRestoreDropPage(pVM, pPage, GCPhys);
+        return VINF_SUCCESS;
+    }
+
+    /* Clear the indicator first so we don't end up back here. */
+    PGM_PAGE_CLEAR_LAZY_RESTORE(pVM, pPage);
+    void *pvDstPage;
+    int rc = pgmPhysPageMakeWritableAndMap(pVM, pPage, GCPhys, &pvDstPage);
+    if (RT_FAILURE(rc))
+    {
+        PGM_PAGE_SET_LAZY_RESTORE(pVM, pPage);
+        return rc;
+    }
+    memcpy(pvDstPage, pvBits, PAGE_SIZE);
+    pgmR3LazyRestoreDropPage(pVM, pPage, GCPhys);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Restores a page pending lazy restore by reading it from the saved state file.
+ *
+ * This is called when something is about to access the page.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pPage               The page.
+ * @param   GCPhys              The page address.
+ */
+int pgmR3LazyRestorePage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    Assert(PGM_PAGE_IS_LAZY_RESTORE(pPage));
+    GCPhys &= ~(RTGCPHYS)PAGE_OFFSET_MASK;
+
+    PPGMLAZYRESTORE    pLazy    = pVM->pgm.s.pLazyRestoreR3;
+    PPGMLAZYRESTORERAM pLazyRam = pLazy ? pgmR3LazyRestoreLookupRam(pLazy, GCPhys) : NULL;
+    uint64_t const     offFile  = pLazyRam && pLazyRam->paoffPages
+                                ? pLazyRam->paoffPages[(GCPhys - pLazyRam->GCPhys) >> PAGE_SHIFT] : 0;
+    if (!offFile)
+    {
+        AssertMsgFailed(("GCPhys=%RGp %R[pgmpage]\n", GCPhys, pPage));
+        PGM_PAGE_CLEAR_LAZY_RESTORE(pVM, pPage);
+        return VINF_SUCCESS;
+    }
+
+    uint8_t abPage[PAGE_SIZE];
+    int rc = RTFileReadAt(pLazy->hFile, offFile, abPage, PAGE_SIZE, NULL);
+    if (RT_SUCCESS(rc))
+        rc = pgmR3LazyRestorePageWithBits(pVM, pPage, GCPhys, abPage);
+    if (RT_SUCCESS(rc))
+        STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLazyRestoreFaults);
+    else
+        LogRel(("PGM: Lazy restore of %RGp from offset %#RX64 failed: %Rrc\n", GCPhys, offFile, rc));
+    return rc;
+}
+
+
+/**
+ * Turns off the lazy restore access handler for a page that has been
+ * restored.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   GCPhys              The page address.
+ */
+static void pgmR3LazyRestoreTempOff(PVM pVM, RTGCPHYS GCPhys)
+{
+    PPGMPHYSHANDLER pHandler = pgmHandlerPhysicalLookup(pVM, GCPhys);
+    if (   pHandler
+        && pHandler->hType == pVM->pgm.s.hLazyRestorePhysHandlerType)
+    {
+        int rc = PGMHandlerPhysicalPageTempOff(pVM, pHandler->Core.Key, GCPhys);
+        AssertRC(rc);
+    }
+}
+
+
+/**
+ * @callback_method_impl{FNPGMPHYSHANDLER,
+ *      Access to RAM pending lazy restore.}
+ */
+DECLCALLBACK(VBOXSTRICTRC)
+pgmR3LazyRestoreAccessHandler(PVM pVM, PVMCPU pVCpu, RTGCPHYS GCPhys, void *pvPhys, void *pvBuf, size_t cbBuf,
+                              PGMACCESSTYPE enmAccessType, PGMACCESSORIGIN enmOrigin, void *pvUser)
+{
+    RT_NOREF(pVCpu, pvPhys, pvBuf, cbBuf, enmAccessType, enmOrigin, pvUser);
+
+    /* The page has usually been restored when it was mapped for the access. */
+    RTGCPHYS const GCPhysPage = GCPhys & ~(RTGCPHYS)PAGE_OFFSET_MASK;
+    int            rc         = VINF_SUCCESS;
+    pgmLock(pVM);
+    PPGMPAGE pPage = pgmPhysGetPage(pVM, GCPhysPage);
+    if (   pPage
+        && PGM_PAGE_IS_LAZY_RESTORE(pPage))
+        rc = pgmR3LazyRestorePage(pVM, pPage, GCPhysPage);
+    if (RT_SUCCESS(rc))
+        pgmR3LazyRestoreTempOff(pVM, GCPhysPage);
+    pgmUnlock(pVM);
+    return RT_SUCCESS(rc) ? VINF_PGM_HANDLER_DO_DEFAULT : rc;
+}
+
+
+/**
+ * Collects and reads the next batch of pages pending restore in a RAM range.
+ *
+ * This does not take the PGM lock, the page offsets are read atomically and
+ * rechecked by pgmR3LazyRestoreApplyBatch.
+ *
+ * @returns VBox status code.
+ * @param   pLazy               The lazy restore state.
+ * @param   pLazyRam            The RAM range.
+ * @param   piPage              The page to start at, updated.
+ * @param   pBatch              The batch to fill in.
+ */
+static int pgmR3LazyRestoreReadBatch(PPGMLAZYRESTORE pLazy, PPGMLAZYRESTORERAM pLazyRam, uint32_t *piPage,
+                                     PPGMLAZYRESTOREBATCH pBatch)
+{
+    uint32_t iPage  = *piPage;
+    uint32_t cPages = 0;
+    while (   iPage < pLazyRam->cPages
+           && cPages < RT_ELEMENTS(pBatch->aGCPhys))
+    {
+        uint64_t const offFile = ASMAtomicReadU64(&pLazyRam->paoffPages[iPage]);
+        if (offFile)
+        {
+            pBatch->aGCPhys[cPages]  = pLazyRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+            pBatch->aoffFile[cPages] = offFile;
+            cPages++;
+        }
+        iPage++;
+    }
+    *piPage        = iPage;
+    pBatch->pLazy  = pLazy;
+    pBatch->cPages = cPages;
+
+    /* The pages of a block are consecutive in the file, so read them in runs. */
+    for (uint32_t i = 0; i < cPages; )
+    {
+        uint32_t cRun = 1;
+        while (   i + cRun < cPages
+               && pBatch->aoffFile[i + cRun] == pBatch->aoffFile[i] + ((uint64_t)cRun << PAGE_SHIFT))
+            cRun++;
+        int rc = RTFileReadAt(pLazy->hFile, pBatch->aoffFile[i], pBatch->abPages[i], (size_t)cRun << PAGE_SHIFT, NULL);
+        if (RT_FAILURE(rc))
+            return rc;
+        i += cRun;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Restores the pages of a batch that are still pending.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pBatch              The batch.
+ */
+static int pgmR3LazyRestoreApplyBatch(PVM pVM, PPGMLAZYRESTOREBATCH pBatch)
+{
+    PGM_LOCK_ASSERT_OWNER(pVM);
+    PPGMLAZYRESTORE pLazy = pBatch->pLazy;
+    Assert(pVM->pgm.s.pLazyRestoreR3 == pLazy);
+
+    for (uint32_t i = 0; i < pBatch->cPages; i++)
+    {
+        RTGCPHYS const     GCPhys   = pBatch->aGCPhys[i];
+        PPGMLAZYRESTORERAM pLazyRam = pgmR3LazyRestoreLookupRam(pLazy, GCPhys);
+        PPGMPAGE           pPage    = pgmPhysGetPage(pVM, GCPhys);
+        if (   pLazyRam
+            && pPage
+            && PGM_PAGE_IS_LAZY_RESTORE(pPage)
+            && pLazyRam->paoffPages[(GCPhys - pLazyRam->GCPhys) >> PAGE_SHIFT] == pBatch->aoffFile[i])
+        {
+            int rc = pgmR3LazyRestorePageWithBits(pVM, pPage, GCPhys, pBatch->abPages[i]);
+            AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp rc=%Rrc\n", GCPhys, rc), rc);
+            pgmR3LazyRestoreTempOff(pVM, GCPhys);
+            STAM_REL_COUNTER_INC(&pVM->pgm.s.StatLazyRestorePrefetched);
+        }
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Ends the lazy restore, either by restoring all the pending pages or by
+ * dropping them.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pLazyOnly           Only end it if this is the current lazy
+ *                              restore state.  NULL for any.
+ * @param   fComplete           Whether to restore the pending pages (true) or
+ *                              just drop them (false).
+ * @thread  EMT
+ */
+static int pgmR3LazyRestoreEnd(PVM pVM, PPGMLAZYRESTORE pLazyOnly, bool fComplete)
+{
+    pgmLock(pVM);
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    if (   !pLazy
+        || (pLazyOnly && pLazyOnly != pLazy))
+    {
+        pgmUnlock(pVM);
+        return VINF_SUCCESS;
+    }
+
+    /*
+     * Stop the prefetch thread.  It doesn't take the PGM lock, so we can
+     * keep holding it.  Batches still queued will see that they're stale.
+     */
+    ASMAtomicWriteBool(&pLazy->fCancel, true);
+    if (pLazy->hThread != NIL_RTTHREAD)
+    {
+        RTSemEventSignal(pLazy->hEvtBatchDone);
+        int rc2 = RTThreadWait(pLazy->hThread, RT_INDEFINITE_WAIT, NULL);
+        AssertLogRelRC(rc2);
+        pLazy->hThread = NIL_RTTHREAD;
+    }
+
+    /*
+     * Restore or drop the pending pages.
+     */
+    uint32_t const cPagesLeft = pLazy->cPagesLeft;
+    int rc = VINF_SUCCESS;
+    PPGMLAZYRESTOREBATCH pBatch = NULL;
+    if (fComplete && cPagesLeft)
+    {
+        pBatch = (PPGMLAZYRESTOREBATCH)RTMemPageAlloc(sizeof(*pBatch));
+        if (!pBatch)
+            rc = VERR_NO_PAGE_MEMORY;
+    }
+    for (uint32_t iRam = 0; iRam < pLazy->cRams; iRam++)
+    {
+        PPGMLAZYRESTORERAM pLazyRam = &pLazy->aRams[iRam];
+        if (!pLazyRam->paoffPages)
+            continue;
+        uint32_t iPage = 0;
+        while (pLazyRam->cPagesLeft > 0 && iPage < pLazyRam->cPages)
+        {
+            if (pBatch && RT_SUCCESS(rc))
+            {
+                rc = pgmR3LazyRestoreReadBatch(pLazy, pLazyRam, &iPage, pBatch);
+                if (RT_SUCCESS(rc))
+                    rc = pgmR3LazyRestoreApplyBatch(pVM, pBatch);
+            }
+            else
+            {
+                if (pLazyRam->paoffPages[iPage])
+                {
+                    RTGCPHYS const GCPhys = pLazyRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT);
+                    PPGMPAGE       pPage  = pgmPhysGetPage(pVM, GCPhys);
+                    if (pPage)
+                        pgmR3LazyRestoreDropPage(pVM, pPage, GCPhys);
+                }
+                iPage++;
+            }
+        }
+    }
+    if (pBatch)
+        RTMemPageFree(pBatch, sizeof(*pBatch));
+
+    /*
+     * Remove the access handlers and forget about the state.
+     */
+    for (uint32_t i = 0; i < pLazy->cHandlers; i++)
+    {
+        int rc2 = PGMHandlerPhysicalDeregister(pVM, pLazy->paHandlers[i]);
+        AssertLogRelRC(rc2);
+    }
+    pLazy->cHandlers = 0;
+    pVM->pgm.s.pLazyRestoreR3 = NULL;
+    pgmPhysInvalidatePageMapTLB(pVM);
+    pgmUnlock(pVM);
+
+    if (RT_SUCCESS(rc))
+        LogRel(("PGM: Lazy restore %s (%u pages pending, %RU64 faulted, %RU64 prefetched)\n",
+                fComplete ? "completed" : "aborted", cPagesLeft, pVM->pgm.s.StatLazyRestoreFaults.c,
+                pVM->pgm.s.StatLazyRestorePrefetched.c));
+    else
+        LogRel(("PGM: Lazy restore failed: %Rrc\n", rc));
+
+    RTFileClose(pLazy->hFile);
+    pLazy->hFile = NIL_RTFILE;
+    pgmR3LazyRestoreRelease(pLazy);
+    return rc;
+}
+
+
+/**
+ * Aborts any lazy restore in progress, dropping the pending pages.
+ *
+ * This must be done before resetting or destroying the RAM.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @thread  EMT
+ */
+void pgmR3LazyRestoreAbort(PVM pVM)
+{
+    pgmR3LazyRestoreEnd(pVM, NULL, false /*fComplete*/);
+}
+
+
+/**
+ * Completes any lazy restore in progress by restoring all the pending pages.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @thread  EMT
+ */
+static int pgmR3LazyRestoreComplete(PVM pVM)
+{
+    return pgmR3LazyRestoreEnd(pVM, NULL, true /*fComplete*/);
+}
+
+
+/**
+ * Restores a batch of prefetched pages, called on an EMT.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pBatch              The batch.  Freed.
+ */
+static DECLCALLBACK(void) pgmR3LazyRestoreBatchOnEmt(PVM pVM, PPGMLAZYRESTOREBATCH pBatch)
+{
+    PPGMLAZYRESTORE pLazy = pBatch->pLazy;
+
+    pgmLock(pVM);
+    if (pVM->pgm.s.pLazyRestoreR3 == pLazy)
+    {
+        int rc = pgmR3LazyRestoreApplyBatch(pVM, pBatch);
+        if (RT_FAILURE(rc))
+            ASMAtomicWriteBool(&pLazy->fCancel, true); /* Leave the rest to the access handlers. */
+    }
+    pgmUnlock(pVM);
+
+    ASMAtomicDecU32(&pLazy->cBatchesQueued);
+    RTSemEventSignal(pLazy->hEvtBatchDone);
+    RTMemPageFree(pBatch, sizeof(*pBatch));
+    pgmR3LazyRestoreRelease(pLazy);
+}
+
+
+/**
+ * Ends the lazy restore after the prefetch thread is done, called on an EMT.
+ *
+ * @param   pVM                 The cross context VM structure.
+ * @param   pLazy               The lazy restore state (referenced).
+ */
+static DECLCALLBACK(void) pgmR3LazyRestoreFinishOnEmt(PVM pVM, PPGMLAZYRESTORE pLazy)
+{
+    /* Restores anything the prefetcher raced, closes the file and removes the handlers. */
+    pgmR3LazyRestoreEnd(pVM, pLazy, true /*fComplete*/);
+    pgmR3LazyRestoreRelease(pLazy);
+}
+
+
+/**
+ * @callback_method_impl{FNRTTHREAD,
+ *      The lazy restore prefetch thread.}
+ *
+ * This reads the pages pending restore in file order and hands them in batches
+ * to the EMTs, keeping at most PGM_LAZY_RESTORE_MAX_BATCHES queued.
+ */
+static DECLCALLBACK(int) pgmR3LazyRestoreThread(RTTHREAD hThreadSelf, void *pvUser)
+{
+    PPGMLAZYRESTORE      pLazy  = (PPGMLAZYRESTORE)pvUser;
+    PVM                  pVM    = pLazy->pVM;
+    PPGMLAZYRESTOREBATCH pBatch = NULL;
+    int                  rc     = VINF_SUCCESS;
+    RT_NOREF(hThreadSelf);
+
+    for (uint32_t iRam = 0; iRam < pLazy->cRams && RT_SUCCESS(rc) && !ASMAtomicReadBool(&pLazy->fCancel); iRam++)
+    {
+        PPGMLAZYRESTORERAM pLazyRam = &pLazy->aRams[iRam];
+        if (!pLazyRam->paoffPages)
+            continue;
+
+        uint32_t iPage = 0;
+        while (iPage < pLazyRam->cPages && !ASMAtomicReadBool(&pLazy->fCancel))
+        {
+            if (!pBatch)
+            {
+                pBatch = (PPGMLAZYRESTOREBATCH)RTMemPageAlloc(sizeof(*pBatch));
+                if (!pBatch)
+                {
+                    rc = VERR_NO_PAGE_MEMORY;
+                    break;
+                }
+            }
+            rc = pgmR3LazyRestoreReadBatch(pLazy, pLazyRam, &iPage, pBatch);
+            if (RT_FAILURE(rc))
+                break;
+            if (!pBatch->cPages)
+                continue;
+
+            /* Don't get too far ahead of the EMTs. */
+            while (   ASMAtomicReadU32(&pLazy->cBatchesQueued) >= PGM_LAZY_RESTORE_MAX_BATCHES
+                   && !ASMAtomicReadBool(&pLazy->fCancel))
+                RTSemEventWait(pLazy->hEvtBatchDone, 100);
+            if (ASMAtomicReadBool(&pLazy->fCancel))
+                break;
+
+            ASMAtomicIncU32(&pLazy->cRefs);
+            ASMAtomicIncU32(&pLazy->cBatchesQueued);
+            rc = VMR3ReqCallVoidNoWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3LazyRestoreBatchOnEmt, 2, pVM, pBatch);
+            if (RT_FAILURE(rc))
+            {
+                ASMAtomicDecU32(&pLazy->cBatchesQueued);
+                pgmR3LazyRestoreRelease(pLazy);
+                break;
+            }
+            pBatch = NULL;
+        }
+    }
+    if (pBatch)
+        RTMemPageFree(pBatch, sizeof(*pBatch));
+
+    /*
+     * Have an EMT wrap it up.  If we failed, the access handlers will take
+     * care of the remaining pages.
+     */
+    if (RT_SUCCESS(rc) && !ASMAtomicReadBool(&pLazy->fCancel))
+    {
+        ASMAtomicIncU32(&pLazy->cRefs);
+        rc = VMR3ReqCallVoidNoWait(pVM, VMCPUID_ANY, (PFNRT)pgmR3LazyRestoreFinishOnEmt, 2, pVM, pLazy);
+        if (RT_FAILURE(rc))
+            pgmR3LazyRestoreRelease(pLazy);
+    }
+    if (RT_FAILURE(rc))
+        LogRel(("PGM: Lazy restore prefetching failed: %Rrc\n", rc));
+    return rc;
+}
+
+
+/**
+ * Sets up lazy restore of RAM when starting to load a saved state, if
+ * configured.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The SSM handle.
+ */
+static int pgmR3LazyRestoreCreate(PVM pVM, PSSMHANDLE pSSM)
+{
+    Assert(!pVM->pgm.s.pLazyRestoreR3);
+
+    /** @cfgm{/PGM/LazyRestore, bool, false}
+     * Whether to leave the RAM saved in blocks (see /PGM/SaveForLazyRestore) in
+     * the saved state file when restoring, reading the pages on first access
+     * and in the background after the VM has been resumed. */
+    bool fLazyRestore = false;
+    int rc = CFGMR3QueryBoolDef(CFGMR3GetChild(CFGMR3GetRoot(pVM), "/PGM"), "LazyRestore", &fLazyRestore, false);
+    AssertLogRelRCReturn(rc, rc);
+    const char *pszFilename = SSMR3HandleGetFilename(pSSM);
+    if (!fLazyRestore || !pszFilename)
+        return VINF_SUCCESS;
+
+    /*
+     * Allocate the state with an entry for each RAM range.
+     */
+    pgmLock(pVM);
+    uint32_t cRams = 0;
+    for (PPGMRAMRANGE pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+        if (!PGM_RAM_RANGE_IS_AD_HOC(pCur))
+            cRams++;
+    PPGMLAZYRESTORE pLazy = (PPGMLAZYRESTORE)RTMemAllocZ(RT_UOFFSETOF_DYN(PGMLAZYRESTORE, aRams[RT_MAX(cRams, 1)]));
+    if (pLazy)
+    {
+        for (PPGMRAMRANGE pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+            if (!PGM_RAM_RANGE_IS_AD_HOC(pCur))
+            {
+                PPGMLAZYRESTORERAM pLazyRam = &pLazy->aRams[pLazy->cRams++];
+                pLazyRam->pRam   = pCur;
+                pLazyRam->GCPhys = pCur->GCPhys;
+                pLazyRam->cPages = (uint32_t)(pCur->cb >> PAGE_SHIFT);
+            }
+    }
+    pgmUnlock(pVM);
+    AssertReturn(pLazy, VERR_NO_MEMORY);
+    pLazy->cRefs         = 1;
+    pLazy->pVM           = pVM;
+    pLazy->hFile         = NIL_RTFILE;
+    pLazy->hThread       = NIL_RTTHREAD;
+    pLazy->hEvtBatchDone = NIL_RTSEMEVENT;
+
+    /*
+     * Open the file.  The saved state file is usually deleted once the VM is
+     * running again, so allow that.
+     */
+    rc = RTFileOpen(&pLazy->hFile, pszFilename,
+                    RTFILE_O_READ | RTFILE_O_OPEN | RTFILE_O_DENY_NONE | RTFILE_O_DENY_NOT_DELETE);
+    if (RT_SUCCESS(rc))
+    {
+        rc = RTSemEventCreate(&pLazy->hEvtBatchDone);
+        if (RT_SUCCESS(rc))
+        {
+            pgmLock(pVM);
+            pVM->pgm.s.pLazyRestoreR3 = pLazy;
+            pgmUnlock(pVM);
+            return VINF_SUCCESS;
+        }
+        RTFileClose(pLazy->hFile);
+        pLazy->hFile = NIL_RTFILE;
+    }
+    LogRel(("PGM: Lazy restore disabled, failed to set up for '%s': %Rrc\n", pszFilename, rc));
+    pgmR3LazyRestoreRelease(pLazy);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Starts the lazy restore after loading the saved state, protecting the
+ * pending pages with access handlers and starting the prefetch thread.
  *
+ * @returns VBox status code.
  * @param   pVM                 The cross context VM structure.
  */
-static void pgmR3DoneRamPages(PVM pVM)
+static int pgmR3LazyRestoreStart(PVM pVM)
 {
+    pgmLock(pVM);
+    PPGMLAZYRESTORE pLazy = pVM->pgm.s.pLazyRestoreR3;
+    AssertPtr(pLazy);
+    if (!pLazy->cPagesLeft)
+    {
+        pgmUnlock(pVM);
+        pgmR3LazyRestoreEnd(pVM, pLazy, false /*fComplete*/);
+        return VINF_SUCCESS;
+    }
+
     /*
-     * Free the tracking arrays and disable write monitoring.
-     *
-     * Play nice with the PGM lock in case we're called while the VM is still
-     * running.  This means we have to delay the freeing since we wish to use
-     * paLSPages as an indicator of which RAM ranges which we need to scan for
-     * write monitored pages.
+     * Cover each run of pending pages with an access handler.  Pages that
+     * already have handlers (or if we fail to register one) are restored
+     * right away.
      */
-    void *pvToFree = NULL;
-    PPGMRAMRANGE pCur;
-    uint32_t cMonitoredPages = 0;
-    pgmLock(pVM);
-    do
+    int rc = VINF_SUCCESS;
+    for (uint32_t iRam = 0; iRam < pLazy->cRams && RT_SUCCESS(rc); iRam++)
     {
-        for (pCur = pVM->pgm.s.pRamRangesXR3; pCur; pCur = pCur->pNextR3)
+        PPGMLAZYRESTORERAM pLazyRam = &pLazy->aRams[iRam];
+        PPGMRAMRANGE       pRam     = pLazyRam->pRam;
+        uint32_t           iPage    = 0;
+        while (pLazyRam->cPagesLeft > 0 && iPage < pLazyRam->cPages && RT_SUCCESS(rc))
         {
-            if (pCur->paLSPages)
+            PPGMPAGE pPage = &pRam->aPages[iPage];
+            if (!PGM_PAGE_IS_LAZY_RESTORE(pPage))
             {
-                if (pvToFree)
+                iPage++;
+                continue;
+            }
+
+            uint32_t const iPageFirst = iPage;
+            while (   iPage < pLazyRam->cPages
+                   && PGM_PAGE_IS_LAZY_RESTORE(&pRam->aPages[iPage])
+                   && PGM_PAGE_GET_HNDL_PHYS_STATE(&pRam->aPages[iPage]) == PGM_PAGE_HNDL_PHYS_STATE_NONE)
+                iPage++;
+            if (iPage > iPageFirst)
+            {
+                RTGCPHYS const GCPhysFirst = pRam->GCPhys + ((RTGCPHYS)iPageFirst << PAGE_SHIFT);
+                int rc2 = VINF_SUCCESS;
+                if (!(pLazy->cHandlers % 16))
                 {
-                    uint32_t idRamRangesGen = pVM->pgm.s.idRamRangesGen;
-                    pgmUnlock(pVM);
-                    MMR3HeapFree(pvToFree);
-                    pvToFree = NULL;
-                    pgmLock(pVM);
-                    if (idRamRangesGen != pVM->pgm.s.idRamRangesGen)
-                        break;          /* start over again. */
+                    void *pvNew = RTMemRealloc(pLazy->paHandlers, (pLazy->cHandlers + 16) * sizeof(pLazy->paHandlers[0]));
+                    if (pvNew)
+                        pLazy->paHandlers = (RTGCPHYS *)pvNew;
+                    else
+                        rc2 = VERR_NO_MEMORY;
                 }
-
-                pvToFree = pCur->paLSPages;
-                pCur->paLSPages = NULL;
-
-                uint32_t iPage = pCur->cb >> PAGE_SHIFT;
-                while (iPage--)
+                if (RT_SUCCESS(rc2))
+                    rc2 = PGMHandlerPhysicalRegister(pVM, GCPhysFirst, pRam->GCPhys + ((RTGCPHYS)iPage << PAGE_SHIFT) - 1,
+                                                     pVM->pgm.s.hLazyRestorePhysHandlerType,
+                                                     NIL_RTR3PTR, NIL_RTR0PTR, NIL_RTRCPTR, "Lazy restore");
+                if (RT_SUCCESS(rc2))
                 {
-                    PPGMPAGE pPage = &pCur->aPages[iPage];
-                    PGM_PAGE_CLEAR_WRITTEN_TO(pVM, pPage);
-                    if (PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_WRITE_MONITORED)
-                    {
-                        PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_ALLOCATED);
-                        cMonitoredPages++;
-                    }
+                    pLazy->paHandlers[pLazy->cHandlers++] = GCPhysFirst;
+                    continue;
                 }
+                LogRel(("PGM: Failed to register lazy restore handler for %RGp LB %#x pages: %Rrc\n",
+                        GCPhysFirst, iPage - iPageFirst, rc2));
             }
-        }
-    } while (pCur);
-
-    Assert(pVM->pgm.s.cMonitoredPages >= cMonitoredPages);
-    if (pVM->pgm.s.cMonitoredPages < cMonitoredPages)
-        pVM->pgm.s.cMonitoredPages = 0;
-    else
-        pVM->pgm.s.cMonitoredPages -= cMonitoredPages;
+            else
+                iPage++; /* Already got a handler. */
 
+            for (uint32_t i = iPageFirst; i < iPage && RT_SUCCESS(rc); i++)
+                if (PGM_PAGE_IS_LAZY_RESTORE(&pRam->aPages[i]))
+                    rc = pgmR3LazyRestorePage(pVM, &pRam->aPages[i], pRam->GCPhys + ((RTGCPHYS)i << PAGE_SHIFT));
+        }
+    }
+    pgmPhysInvalidatePageMapTLB(pVM);
     pgmUnlock(pVM);
+    if (RT_FAILURE(rc))
+    {
+        pgmR3LazyRestoreEnd(pVM, pLazy, false /*fComplete*/);
+        return rc;
+    }
 
-    MMR3HeapFree(pvToFree);
-    pvToFree = NULL;
+    /*
+     * Start prefetching in the background.
+     */
+    rc = RTThreadCreate(&pLazy->hThread, pgmR3LazyRestoreThread, pLazy, 0 /*cbStack*/, RTTHREADTYPE_DEFAULT,
+                        RTTHREADFLAGS_WAITABLE, "PGMLazyRst");
+    if (RT_FAILURE(rc))
+    {
+        pLazy->hThread = NIL_RTTHREAD;
+        LogRel(("PGM: Failed to create the lazy restore thread: %Rrc\n", rc));
+        return pgmR3LazyRestoreComplete(pVM);
+    }
+    LogRel(("PGM: Lazy restore of %u pages using %u access handlers\n", pLazy->cPagesLeft, pLazy->cHandlers));
+    return VINF_SUCCESS;
 }
 
 
@@ -1852,7 +3150,8 @@ static DECLCALLBACK(int) pgmR3LiveExec(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass)
      */
     pgmR3ScanRomPages(pVM);
     pgmR3ScanMmio2Pages(pVM, uPass);
-    pgmR3ScanRamPages(pVM, false /*fFinalPass*/);
+    if (!pVM->pgm.s.LiveSave.fRamBlocks)
+        pgmR3ScanRamPages(pVM, false /*fFinalPass*/);
     pgmR3PoolClearAll(pVM, true /*fFlushRemTlb*/); /** @todo this could perhaps be optimized a bit. */
 
     /*
@@ -1866,7 +3165,7 @@ static DECLCALLBACK(int) pgmR3LiveExec(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass)
         rc = pgmR3SaveShadowedRomPages(pVM, pSSM, true /*fLiveSave*/, false /*fFinalPass*/);
     if (RT_SUCCESS(rc))
         rc = pgmR3SaveMmio2Pages(      pVM, pSSM, true /*fLiveSave*/, uPass);
-    if (RT_SUCCESS(rc))
+    if (RT_SUCCESS(rc) && !pVM->pgm.s.LiveSave.fRamBlocks)
         rc = pgmR3SaveRamPages(        pVM, pSSM, true /*fLiveSave*/, uPass);
     SSMR3PutU8(pSSM, PGM_STATE_REC_END);    /* (Ignore the rc, SSM takes care of it.) */
 
@@ -1986,6 +3285,13 @@ static DECLCALLBACK(int)  pgmR3LiveVote(PVM pVM, PSSMHANDLE pSSM, uint32_t uPass
  */
 static DECLCALLBACK(int) pgmR3LivePrep(PVM pVM, PSSMHANDLE pSSM)
 {
+    /*
+     * All the RAM must be present before we can save it.
+     */
+    int rc = pgmR3LazyRestoreComplete(pVM);
+    if (RT_FAILURE(rc))
+        return rc;
+
     /*
      * Indicate that we will be using the write monitoring.
      */
@@ -2016,17 +3322,56 @@ static DECLCALLBACK(int) pgmR3LivePrep(PVM pVM, PSSMHANDLE pSSM)
     pVM->pgm.s.LiveSave.cSavedPages       = 0;
     pVM->pgm.s.LiveSave.uSaveStartNS      = RTTimeNanoTS();
     pVM->pgm.s.LiveSave.cPagesPerSecond   = 8192;
+    pVM->pgm.s.LiveSave.cScanWorkers      = 0;
+    pVM->pgm.s.LiveSave.hScanPool         = NIL_RTREQPOOL;
+    pVM->pgm.s.LiveSave.fRamBlocks        = pgmR3SaveQueryRamBlocks(pVM, pSSM);
 
     /*
-     * Per page type.
+     * Per page type.  When saving the RAM in blocks, it's all saved in the
+     * final pass and there is no need to track it.
      */
-    int rc = pgmR3PrepRomPages(pVM);
+    rc = pgmR3PrepRomPages(pVM);
     if (RT_SUCCESS(rc))
         rc = pgmR3PrepMmio2Pages(pVM);
-    if (RT_SUCCESS(rc))
+    if (RT_SUCCESS(rc) && !pVM->pgm.s.LiveSave.fRamBlocks)
         rc = pgmR3PrepRamPages(pVM);
 
-    NOREF(pSSM);
+#ifndef PGMLIVESAVERAMPAGE_WITH_CRC32
+    /*
+     * Get some help with scanning the RAM of bigger VMs.
+     */
+    if (RT_SUCCESS(rc) && !pVM->pgm.s.LiveSave.fRamBlocks)
+    {
+        /** @cfgm{/PGM/LiveSaveScanWorkers, uint32_t, \#CPUs - 1 (max 16)}
+         * The number of worker threads helping out with scanning the RAM for
+         * modifications during live save and teleportation.  Zero means the
+         * saving thread does it all by itself. */
+        uint32_t cWorkers = RTMpGetOnlineCount();
+        cWorkers = cWorkers > 1 ? RT_MIN(cWorkers - 1, PGM_LIVE_SAVE_SCAN_MAX_WORKERS) : 0;
+        rc = CFGMR3QueryU32Def(CFGMR3GetChild(CFGMR3GetRoot(pVM), "/PGM"), "LiveSaveScanWorkers", &cWorkers, cWorkers);
+        AssertLogRelRCReturn(rc, rc);
+        cWorkers = RT_MIN(cWorkers, PGM_LIVE_SAVE_SCAN_MAX_WORKERS);
+        if (   cWorkers > 0
+            && pVM->pgm.s.cAllPages >= PGM_LIVE_SAVE_SCAN_SLICE_PAGES * 2)
+        {
+            RTREQPOOL hPool = NIL_RTREQPOOL;
+            int rc2 = RTReqPoolCreate(cWorkers, RT_INDEFINITE_WAIT, UINT32_MAX /*cThreadsPushBackThreshold*/,
+                                      0 /*cMsMaxPushBack*/, "PGMScan", &hPool);
+            if (RT_SUCCESS(rc2))
+            {
+                pVM->pgm.s.LiveSave.hScanPool    = hPool;
+                pVM->pgm.s.LiveSave.cScanWorkers = cWorkers;
+                LogRel(("PGM: Using %u worker threads for scanning RAM during live save\n", cWorkers));
+            }
+            else
+                LogRel(("PGM: Failed to create the live save RAM scanning pool: %Rrc\n", rc2));
+        }
+    }
+#endif
+
+    if (RT_SUCCESS(rc) && !pVM->pgm.s.LiveSave.fRamBlocks)
+        pgmR3SaveDupIdxCreate(pVM);
+
     return rc;
 }
 
@@ -2039,6 +3384,17 @@ static DECLCALLBACK(int) pgmR3SaveExec(PVM pVM, PSSMHANDLE pSSM)
     int     rc   = VINF_SUCCESS;
     PPGM    pPGM = &pVM->pgm.s;
 
+    /* Live save did this in the prep callback. */
+    if (!pVM->pgm.s.LiveSave.fActive)
+    {
+        rc = pgmR3LazyRestoreComplete(pVM);
+        if (RT_FAILURE(rc))
+            return rc;
+        pVM->pgm.s.LiveSave.fRamBlocks = pgmR3SaveQueryRamBlocks(pVM, pSSM);
+        if (!pVM->pgm.s.LiveSave.fRamBlocks)
+            pgmR3SaveDupIdxCreate(pVM);
+    }
+
     /*
      * Lock PGM and set the no-more-writes indicator.
      */
@@ -2065,12 +3421,15 @@ static DECLCALLBACK(int) pgmR3SaveExec(PVM pVM, PSSMHANDLE pSSM)
         {
             pgmR3ScanRomPages(pVM);
             pgmR3ScanMmio2Pages(pVM, SSM_PASS_FINAL);
-            pgmR3ScanRamPages(pVM, true /*fFinalPass*/);
+            if (!pVM->pgm.s.LiveSave.fRamBlocks)
+                pgmR3ScanRamPages(pVM, true /*fFinalPass*/);
 
             rc = pgmR3SaveShadowedRomPages(    pVM, pSSM, true /*fLiveSave*/, true /*fFinalPass*/);
             if (RT_SUCCESS(rc))
                 rc = pgmR3SaveMmio2Pages(      pVM, pSSM, true /*fLiveSave*/, SSM_PASS_FINAL);
-            if (RT_SUCCESS(rc))
+            if (RT_SUCCESS(rc) && pVM->pgm.s.LiveSave.fRamBlocks)
+                rc = pgmR3SaveRamBlocks(       pVM, pSSM);
+            else if (RT_SUCCESS(rc))
                 rc = pgmR3SaveRamPages(        pVM, pSSM, true /*fLiveSave*/, SSM_PASS_FINAL);
         }
         else
@@ -2086,7 +3445,9 @@ static DECLCALLBACK(int) pgmR3SaveExec(PVM pVM, PSSMHANDLE pSSM)
                 rc = pgmR3SaveShadowedRomPages(pVM, pSSM, false /*fLiveSave*/, true /*fFinalPass*/);
             if (RT_SUCCESS(rc))
                 rc = pgmR3SaveMmio2Pages(      pVM, pSSM, false /*fLiveSave*/, SSM_PASS_FINAL);
-            if (RT_SUCCESS(rc))
+            if (RT_SUCCESS(rc) && pVM->pgm.s.LiveSave.fRamBlocks)
+                rc = pgmR3SaveRamBlocks(       pVM, pSSM);
+            else if (RT_SUCCESS(rc))
                 rc = pgmR3SaveRamPages(        pVM, pSSM, false /*fLiveSave*/, SSM_PASS_FINAL);
         }
         SSMR3PutU8(pSSM, PGM_STATE_REC_END);    /* (Ignore the rc, SSM takes of it.) */
@@ -2111,12 +3472,20 @@ static DECLCALLBACK(int) pgmR3SaveDone(PVM pVM, PSSMHANDLE pSSM)
         pgmR3DoneMmio2Pages(pVM);
         pgmR3DoneRamPages(pVM);
     }
+    pgmR3SaveDupIdxDestroy(pVM);
+    if (pVM->pgm.s.LiveSave.hScanPool != NIL_RTREQPOOL)
+    {
+        RTReqPoolRelease(pVM->pgm.s.LiveSave.hScanPool);
+        pVM->pgm.s.LiveSave.hScanPool    = NIL_RTREQPOOL;
+        pVM->pgm.s.LiveSave.cScanWorkers = 0;
+    }
 
     /*
      * Clear the live save indicator and disengage write monitoring.
      */
     pgmLock(pVM);
-    pVM->pgm.s.LiveSave.fActive = false;
+    pVM->pgm.s.LiveSave.fActive    = false;
+    pVM->pgm.s.LiveSave.fRamBlocks = false;
     /** @todo this is blindly assuming that we're the only user of write
      *        monitoring. Fix this when more users are added. */
     pVM->pgm.s.fPhysWriteMonitoringEngaged = false;
@@ -2133,12 +3502,12 @@ static DECLCALLBACK(int) pgmR3SaveDone(PVM pVM, PSSMHANDLE pSSM)
 static DECLCALLBACK(int) pgmR3LoadPrep(PVM pVM, PSSMHANDLE pSSM)
 {
     /*
-     * Call the reset function to make sure all the memory is cleared.
+     * Call the reset function to make sure all the memory is cleared.  This
+     * also aborts any lazy restore in progress.
      */
     PGMR3Reset(pVM);
     pVM->pgm.s.LiveSave.fActive = false;
-    NOREF(pSSM);
-    return VINF_SUCCESS;
+    return pgmR3LazyRestoreCreate(pVM, pSSM);
 }
 
 
@@ -2583,6 +3952,230 @@ static int pgmR3LoadMemoryOld(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion)
 }
 
 
+/**
+ * Loads a zero RAM page (PGM_STATE_REC_RAM_ZERO).
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   uVersion            The PGM saved state unit version.
+ * @param   pPage               The page.
+ * @param   GCPhys              The page address.
+ * @param   pReq                The page freeing request.
+ * @param   pcPendingPages      The number of pages pending freeing in @a pReq.
+ */
+static int pgmR3LoadRamPageZero(PVM pVM, uint32_t uVersion, PPGMPAGE pPage, RTGCPHYS GCPhys,
+                                PGMMFREEPAGESREQ pReq, uint32_t *pcPendingPages)
+{
+    if (PGM_PAGE_IS_LAZY_RESTORE(pPage))
+        pgmR3LazyRestoreDropPage(pVM, pPage, GCPhys);
+    if (PGM_PAGE_IS_ZERO(pPage))
+        return VINF_SUCCESS;
+
+    /* Ballooned pages must be unmarked (live snapshot and
+       teleportation scenarios). */
+    if (PGM_PAGE_IS_BALLOONED(pPage))
+    {
+        Assert(PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM);
+        if (uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN)
+            PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_ZERO);
+        return VINF_SUCCESS;
+    }
+
+    AssertLogRelMsgReturn(PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_ALLOCATED, ("GCPhys=%RGp %R[pgmpage]\n", GCPhys, pPage), VERR_PGM_UNEXPECTED_PAGE_STATE);
+
+    /* If this is a ROM page, we must clear it and not try to
+     * free it.  Ditto if the VM is using RamPreAlloc (see
+     * @bugref{6318}). */
+    int rc;
+    if (   PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_ROM
+        || PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_ROM_SHADOW
+        || pVM->pgm.s.fRamPreAlloc)
+    {
+        PGMPAGEMAPLOCK PgMpLck;
+        void          *pvDstPage;
+        rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+
+        ASMMemZeroPage(pvDstPage);
+        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+    }
+    /* Free it only if it's not part of a previously
+       allocated large page (no need to clear the page). */
+    else if (   PGM_PAGE_GET_PDE_TYPE(pPage) != PGM_PAGE_PDE_TYPE_PDE
+             && PGM_PAGE_GET_PDE_TYPE(pPage) != PGM_PAGE_PDE_TYPE_PDE_DISABLED)
+    {
+        rc = pgmPhysFreePage(pVM, pReq, pcPendingPages, pPage, GCPhys, (PGMPAGETYPE)PGM_PAGE_GET_TYPE(pPage));
+        AssertRCReturn(rc, rc);
+    }
+    /** @todo handle large pages (see @bugref{5545}) */
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Loads a ballooned RAM page (PGM_STATE_REC_RAM_BALLOONED).
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pPage               The page.
+ * @param   GCPhys              The page address.
+ * @param   pReq                The page freeing request.
+ * @param   pcPendingPages      The number of pages pending freeing in @a pReq.
+ */
+static int pgmR3LoadRamPageBallooned(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys, PGMMFREEPAGESREQ pReq, uint32_t *pcPendingPages)
+{
+    Assert(PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM);
+    if (PGM_PAGE_IS_LAZY_RESTORE(pPage))
+        pgmR3LazyRestoreDropPage(pVM, pPage, GCPhys);
+    if (PGM_PAGE_IS_BALLOONED(pPage))
+        return VINF_SUCCESS;
+
+    /* We don't map ballooned pages in our shadow page tables, let's
+       just free it if allocated and mark as ballooned.  See @bugref{5515}. */
+    if (PGM_PAGE_IS_ALLOCATED(pPage))
+    {
+        /** @todo handle large pages + ballooning when it works. (see @bugref{5515},
+         *        @bugref{5545}). */
+        AssertLogRelMsgReturn(   PGM_PAGE_GET_PDE_TYPE(pPage) != PGM_PAGE_PDE_TYPE_PDE
+                              && PGM_PAGE_GET_PDE_TYPE(pPage) != PGM_PAGE_PDE_TYPE_PDE_DISABLED,
+                                 ("GCPhys=%RGp %R[pgmpage]\n", GCPhys, pPage), VERR_PGM_LOAD_UNEXPECTED_PAGE_TYPE);
+
+        int rc = pgmPhysFreePage(pVM, pReq, pcPendingPages, pPage, GCPhys, (PGMPAGETYPE)PGM_PAGE_GET_TYPE(pPage));
+        AssertRCReturn(rc, rc);
+    }
+    Assert(PGM_PAGE_IS_ZERO(pPage));
+    PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_BALLOONED);
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Loads a block of RAM pages (PGM_STATE_REC_RAM_BLOCK).
+ *
+ * If a lazy restore is being set up, the raw pages are left in the saved
+ * state file and marked for restoring later.
+ *
+ * @returns VBox status code.
+ * @param   pVM                 The cross context VM structure.
+ * @param   pSSM                The SSM handle.
+ * @param   uVersion            The PGM saved state unit version.
+ * @param   GCPhys              The address of the first page.
+ * @param   pcPages             Where to return the number of pages in the block.
+ * @param   pReq                The page freeing request.
+ * @param   pcPendingPages      The number of pages pending freeing in @a pReq.
+ */
+static int pgmR3LoadRamBlock(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, RTGCPHYS GCPhys, uint32_t *pcPages,
+                             PGMMFREEPAGESREQ pReq, uint32_t *pcPendingPages)
+{
+    /*
+     * Get the page count and types and validate them.
+     */
+    uint32_t cPages;
+    int rc = SSMR3GetU32(pSSM, &cPages);
+    if (RT_FAILURE(rc))
+        return rc;
+    AssertLogRelMsgReturn(cPages > 0 && cPages <= PGM_STATE_RAM_BLOCK_MAX_PAGES, ("%#x\n", cPages),
+                          VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+    uint8_t abTypes[PGM_STATE_RAM_BLOCK_MAX_PAGES];
+    rc = SSMR3GetMem(pSSM, abTypes, cPages);
+    if (RT_FAILURE(rc))
+        return rc;
+
+    PPGMRAMRANGE pRam = pgmPhysGetRange(pVM, GCPhys);
+    AssertLogRelMsgReturn(   pRam
+                          && ((RTGCPHYS)cPages << PAGE_SHIFT) - 1 <= pRam->GCPhysLast - GCPhys,
+                          ("GCPhys=%RGp cPages=%#x\n", GCPhys, cPages), VERR_PGM_INVALID_GC_PHYSICAL_ADDRESS);
+    uint32_t const iPageFirst = (uint32_t)((GCPhys - pRam->GCPhys) >> PAGE_SHIFT);
+    uint32_t       cRawPages  = 0;
+    for (uint32_t i = 0; i < cPages; i++)
+    {
+        AssertLogRelMsgReturn(   abTypes[i] == PGM_STATE_REC_RAM_ZERO
+                              || abTypes[i] == PGM_STATE_REC_RAM_RAW
+                              || abTypes[i] == PGM_STATE_REC_RAM_BALLOONED,
+                              ("%#x\n", abTypes[i]), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+        AssertLogRelMsgReturn(PGM_PAGE_GET_TYPE(&pRam->aPages[iPageFirst + i]) == PGMPAGETYPE_RAM,
+                              ("GCPhys=%RGp %R[pgmpage]\n", GCPhys + ((RTGCPHYS)i << PAGE_SHIFT), &pRam->aPages[iPageFirst + i]),
+                              VERR_PGM_LOAD_UNEXPECTED_PAGE_TYPE);
+        if (abTypes[i] == PGM_STATE_REC_RAM_RAW)
+            cRawPages++;
+    }
+    *pcPages = cPages;
+
+    /*
+     * The zero and ballooned pages.
+     */
+    for (uint32_t i = 0; i < cPages; i++)
+    {
+        if (abTypes[i] == PGM_STATE_REC_RAM_ZERO)
+            rc = pgmR3LoadRamPageZero(pVM, uVersion, &pRam->aPages[iPageFirst + i], GCPhys + ((RTGCPHYS)i << PAGE_SHIFT),
+                                      pReq, pcPendingPages);
+        else if (abTypes[i] == PGM_STATE_REC_RAM_BALLOONED)
+            rc = pgmR3LoadRamPageBallooned(pVM, &pRam->aPages[iPageFirst + i], GCPhys + ((RTGCPHYS)i << PAGE_SHIFT),
+                                           pReq, pcPendingPages);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    if (!cRawPages)
+        return VINF_SUCCESS;
+
+    /*
+     * Try leave the raw pages in the file for the lazy restore.
+     */
+    PPGMLAZYRESTORE    pLazy    = pVM->pgm.s.pLazyRestoreR3;
+    PPGMLAZYRESTORERAM pLazyRam = pLazy ? pgmR3LazyRestoreLookupRam(pLazy, GCPhys) : NULL;
+    uint64_t           offFile  = 0;
+    if (pLazyRam && pLazyRam->pRam == pRam)
+    {
+        if (!pLazyRam->paoffPages)
+            pLazyRam->paoffPages = (uint64_t *)RTMemAllocZ(sizeof(pLazyRam->paoffPages[0]) * pLazyRam->cPages);
+        if (pLazyRam->paoffPages)
+        {
+            rc = SSMR3SkipMemDirect(pSSM, (size_t)cRawPages << PAGE_SHIFT, &offFile);
+            if (rc == VERR_NOT_SUPPORTED)
+                offFile = 0;
+            else if (RT_FAILURE(rc))
+                return rc;
+        }
+    }
+    if (offFile)
+    {
+        for (uint32_t i = 0; i < cPages; i++)
+            if (abTypes[i] == PGM_STATE_REC_RAM_RAW)
+            {
+                PPGMPAGE pPage = &pRam->aPages[iPageFirst + i];
+                if (!PGM_PAGE_IS_LAZY_RESTORE(pPage))
+                {
+                    PGM_PAGE_SET_LAZY_RESTORE(pVM, pPage);
+                    pLazyRam->cPagesLeft++;
+                    pLazy->cPagesLeft++;
+                }
+                pLazyRam->paoffPages[iPageFirst + i] = offFile;
+                offFile += PAGE_SIZE;
+            }
+        return VINF_SUCCESS;
+    }
+
+    /*
+     * Load them the normal way.
+     */
+    for (uint32_t i = 0; i < cPages; i++)
+        if (abTypes[i] == PGM_STATE_REC_RAM_RAW)
+        {
+            RTGCPHYS const GCPhysPage = GCPhys + ((RTGCPHYS)i << PAGE_SHIFT);
+            PPGMPAGE       pPage      = &pRam->aPages[iPageFirst + i];
+            PGMPAGEMAPLOCK PgMpLck;
+            void          *pvDstPage;
+            rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhysPage, &pvDstPage, &PgMpLck);
+            AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhysPage, pPage, rc), rc);
+            rc = SSMR3GetMem(pSSM, pvDstPage, PAGE_SIZE);
+            pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+            if (RT_FAILURE(rc))
+                return rc;
+        }
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Worker for pgmR3Load and pgmR3LoadLocked.
  *
@@ -2652,6 +4245,7 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
             case PGM_STATE_REC_RAM_ZERO:
             case PGM_STATE_REC_RAM_RAW:
             case PGM_STATE_REC_RAM_BALLOONED:
+            case PGM_STATE_REC_RAM_DUP:
             {
                 /*
                  * Get the address and resolve it into a page descriptor.
@@ -2676,73 +4270,16 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                 switch (u8 & ~PGM_STATE_REC_FLAG_ADDR)
                 {
                     case PGM_STATE_REC_RAM_ZERO:
-                    {
-                        if (PGM_PAGE_IS_ZERO(pPage))
-                            break;
-
-                        /* Ballooned pages must be unmarked (live snapshot and
-                           teleportation scenarios). */
-                        if (PGM_PAGE_IS_BALLOONED(pPage))
-                        {
-                            Assert(PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM);
-                            if (uVersion == PGM_SAVED_STATE_VERSION_BALLOON_BROKEN)
-                                break;
-                            PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_ZERO);
-                            break;
-                        }
-
-                        AssertLogRelMsgReturn(PGM_PAGE_GET_STATE(pPage) == PGM_PAGE_STATE_ALLOCATED, ("GCPhys=%RGp %R[pgmpage]\n", GCPhys, pPage), VERR_PGM_UNEXPECTED_PAGE_STATE);
-
-                        /* If this is a ROM page, we must clear it and not try to
-                         * free it.  Ditto if the VM is using RamPreAlloc (see
-                         * @bugref{6318}). */
-                        if (   PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_ROM
-                            || PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_ROM_SHADOW
-                            || pVM->pgm.s.fRamPreAlloc)
-                        {
-                            PGMPAGEMAPLOCK PgMpLck;
-                            void          *pvDstPage;
-                            rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
-                            AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
-
-                            ASMMemZeroPage(pvDstPage);
-                            pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
-                        }
-                        /* Free it only if it's not part of a previously
-                           allocated large page (no need to clear the page). */
-                        else if (   PGM_PAGE_GET_PDE_TYPE(pPage) != PGM_PAGE_PDE_TYPE_PDE
-                                 && PGM_PAGE_GET_PDE_TYPE(pPage) != PGM_PAGE_PDE_TYPE_PDE_DISABLED)
-                        {
-                            rc = pgmPhysFreePage(pVM, pReq, &cPendingPages, pPage, GCPhys, (PGMPAGETYPE)PGM_PAGE_GET_TYPE(pPage));
-                            AssertRCReturn(rc, rc);
-                        }
-                        /** @todo handle large pages (see @bugref{5545}) */
+                        rc = pgmR3LoadRamPageZero(pVM, uVersion, pPage, GCPhys, pReq, &cPendingPages);
+                        if (RT_FAILURE(rc))
+                            return rc;
                         break;
-                    }
 
                     case PGM_STATE_REC_RAM_BALLOONED:
-                    {
-                        Assert(PGM_PAGE_GET_TYPE(pPage) == PGMPAGETYPE_RAM);
-                        if (PGM_PAGE_IS_BALLOONED(pPage))
-                            break;
-
-                        /* We don't map ballooned pages in our shadow page tables, let's
-                           just free it if allocated and mark as ballooned.  See @bugref{5515}. */
-                        if (PGM_PAGE_IS_ALLOCATED(pPage))
-                        {
-                            /** @todo handle large pages + ballooning when it works. (see @bugref{5515},
-                             *        @bugref{5545}). */
-                            AssertLogRelMsgReturn(   PGM_PAGE_GET_PDE_TYPE(pPage) != PGM_PAGE_PDE_TYPE_PDE
-                                                  && PGM_PAGE_GET_PDE_TYPE(pPage) != PGM_PAGE_PDE_TYPE_PDE_DISABLED,
-                                                     ("GCPhys=%RGp %R[pgmpage]\n", GCPhys, pPage), VERR_PGM_LOAD_UNEXPECTED_PAGE_TYPE);
-
-                            rc = pgmPhysFreePage(pVM, pReq, &cPendingPages, pPage, GCPhys, (PGMPAGETYPE)PGM_PAGE_GET_TYPE(pPage));
-                            AssertRCReturn(rc, rc);
-                        }
-                        Assert(PGM_PAGE_IS_ZERO(pPage));
-                        PGM_PAGE_SET_STATE(pVM, pPage, PGM_PAGE_STATE_BALLOONED);
+                        rc = pgmR3LoadRamPageBallooned(pVM, pPage, GCPhys, pReq, &cPendingPages);
+                        if (RT_FAILURE(rc))
+                            return rc;
                         break;
-                    }
 
                     case PGM_STATE_REC_RAM_RAW:
                     {
@@ -2757,6 +4294,39 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                         break;
                     }
 
+                    case PGM_STATE_REC_RAM_DUP:
+                    {
+                        AssertLogRelMsgReturn(uVersion > PGM_SAVED_STATE_VERSION_PRE_DUP, ("%u\n", uVersion),
+                                              VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                        RTGCPHYS GCPhysSrc;
+                        rc = SSMR3GetGCPhys(pSSM, &GCPhysSrc);
+                        if (RT_FAILURE(rc))
+                            return rc;
+                        AssertLogRelMsgReturn(!(GCPhysSrc & PAGE_OFFSET_MASK) && GCPhysSrc != GCPhys,
+                                              ("GCPhysSrc=%RGp GCPhys=%RGp\n", GCPhysSrc, GCPhys), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                        PPGMPAGE pSrcPage;
+                        rc = pgmPhysGetPageEx(pVM, GCPhysSrc, &pSrcPage);
+                        AssertLogRelMsgRCReturn(rc, ("rc=%Rrc GCPhysSrc=%RGp\n", rc, GCPhysSrc), rc);
+                        AssertLogRelMsgReturn(PGM_PAGE_GET_TYPE(pSrcPage) == PGMPAGETYPE_RAM,
+                                              ("GCPhysSrc=%RGp %R[pgmpage]\n", GCPhysSrc, pSrcPage), VERR_PGM_LOAD_UNEXPECTED_PAGE_TYPE);
+
+                        /* Copy the page we've already loaded. */
+                        uint8_t         abPage[PAGE_SIZE];
+                        PGMPAGEMAPLOCK  PgMpLck;
+                        void const     *pvSrcPage;
+                        rc = pgmPhysGCPhys2CCPtrInternalReadOnly(pVM, pSrcPage, GCPhysSrc, &pvSrcPage, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhysSrc=%RGp %R[pgmpage] rc=%Rrc\n", GCPhysSrc, pSrcPage, rc), rc);
+                        memcpy(abPage, pvSrcPage, PAGE_SIZE);
+                        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+
+                        void *pvDstPage;
+                        rc = pgmPhysGCPhys2CCPtrInternal(pVM, pPage, GCPhys, &pvDstPage, &PgMpLck);
+                        AssertLogRelMsgRCReturn(rc, ("GCPhys=%RGp %R[pgmpage] rc=%Rrc\n", GCPhys, pPage, rc), rc);
+                        memcpy(pvDstPage, abPage, PAGE_SIZE);
+                        pgmPhysReleaseInternalPageMappingLock(pVM, &PgMpLck);
+                        break;
+                    }
+
                     default:
                         AssertMsgFailedReturn(("%#x\n", u8), VERR_PGM_SAVED_REC_TYPE);
                 }
@@ -2764,6 +4334,32 @@ static int pgmR3LoadMemory(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t
                 break;
             }
 
+            /*
+             * Block of RAM pages.
+             */
+            case PGM_STATE_REC_RAM_BLOCK:
+            {
+                AssertLogRelMsgReturn(uVersion > PGM_SAVED_STATE_VERSION_PRE_LAZY, ("%u\n", uVersion),
+                                      VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+                if (!(u8 & PGM_STATE_REC_FLAG_ADDR))
+                    GCPhys += PAGE_SIZE;
+                else
+                {
+                    rc = SSMR3GetGCPhys(pSSM, &GCPhys);
+                    if (RT_FAILURE(rc))
+                        return rc;
+                }
+                AssertLogRelMsgReturn(!(GCPhys & PAGE_OFFSET_MASK), ("%RGp\n", GCPhys), VERR_SSM_DATA_UNIT_FORMAT_CHANGED);
+
+                uint32_t cPages = 0;
+                rc = pgmR3LoadRamBlock(pVM, pSSM, uVersion, GCPhys, &cPages, pReq, &cPendingPages);
+                if (RT_FAILURE(rc))
+                    return rc;
+                GCPhys += (RTGCPHYS)(cPages - 1) << PAGE_SHIFT;
+                id = UINT8_MAX;
+                break;
+            }
+
             /*
              * MMIO2 page.
              */
@@ -3121,11 +4717,15 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
      */
     if (   (   uPass != SSM_PASS_FINAL
             && uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_LAZY
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_DUP
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
             && uVersion != PGM_SAVED_STATE_VERSION_NO_RAM_CFG)
         || (   uVersion != PGM_SAVED_STATE_VERSION
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_LAZY
+            && uVersion != PGM_SAVED_STATE_VERSION_PRE_DUP
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_PAE
             && uVersion != PGM_SAVED_STATE_VERSION_BALLOON_BROKEN
             && uVersion != PGM_SAVED_STATE_VERSION_PRE_BALLOON
@@ -3281,7 +4881,12 @@ static DECLCALLBACK(int) pgmR3Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion,
 static DECLCALLBACK(int) pgmR3LoadDone(PVM pVM, PSSMHANDLE pSSM)
 {
     pVM->pgm.s.fRestoreRomPagesOnReset = true;
-    NOREF(pSSM);
+    if (pVM->pgm.s.pLazyRestoreR3)
+    {
+        if (RT_SUCCESS(SSMR3HandleGetStatus(pSSM)))
+            return pgmR3LazyRestoreStart(pVM);
+        pgmR3LazyRestoreAbort(pVM);
+    }
     return VINF_SUCCESS;
 }
 
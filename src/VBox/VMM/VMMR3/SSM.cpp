@@ -145,6 +145,7 @@
 *********************************************************************************************************************************/
 #define LOG_GROUP LOG_GROUP_SSM
 #include <VBox/vmm/ssm.h>
+#include <VBox/vmm/cfgm.h>
 #include <VBox/vmm/dbgf.h>
 #include <VBox/vmm/pdmapi.h>
 #include <VBox/vmm/pdmcritsect.h>
@@ -161,7 +162,9 @@
 #include <iprt/crc.h>
 #include <iprt/file.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/param.h>
+#include <iprt/req.h>
 #include <iprt/thread.h>
 #include <iprt/semaphore.h>
 #include <iprt/string.h>
@@ -185,6 +188,10 @@
 #define SSMFILEHDR_MAGIC_V1_2                   "\177VirtualBox SavedState V1.2\n\0\0\0"
 /** Saved state file v2.0 magic. */
 #define SSMFILEHDR_MAGIC_V2_0                   "\177VirtualBox SavedState V2.0\n\0\0\0"
+/** Saved state file v2.1 magic.
+ * Same as v2.0 except that the stream may contain SSM_REC_TYPE_RAW_ZIP
+ * records. */
+#define SSMFILEHDR_MAGIC_V2_1                   "\177VirtualBox SavedState V2.1\n\0\0\0"
 
 /** @name SSMFILEHDR::fFlags
  * @{ */
@@ -227,10 +234,25 @@
 /** Named data items.
  * A length prefix zero terminated string (i.e. max 255) followed by the data.  */
 #define SSM_REC_TYPE_NAMED                      5
+/** Raw data compressed as a run of independent blocks.
+ * The record header is followed by a 8-bit codec identifier
+ * (SSM_REC_ZIP_CODEC_XXX), a 8-bit block count and a little endian 16-bit
+ * compressed size for each block.  The compressed blocks follow back to back,
+ * each of them decompressing to SSM_ZIP_BLOCK_SIZE bytes.  A compressed size of
+ * zero means the block is stored uncompressed.  Since the blocks do not depend
+ * on one another they can be compressed and decompressed in parallel.
+ * Only valid in v2.1 and later files (SSMFILEHDR_MAGIC_V2_1). */
+#define SSM_REC_TYPE_RAW_ZIP                    6
 /** Macro for validating the record type.
  * This can be used with the flags+type byte, no need to mask out the type first. */
 #define SSM_REC_TYPE_IS_VALID(u8Type)           (   ((u8Type) & SSM_REC_TYPE_MASK) >  SSM_REC_TYPE_INVALID \
-                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_NAMED )
+                                                 && ((u8Type) & SSM_REC_TYPE_MASK) <= SSM_REC_TYPE_RAW_ZIP )
+/** @} */
+
+/** @name SSM_REC_TYPE_RAW_ZIP codec identifiers.
+ * @{ */
+/** LZF (RTZIPTYPE_LZF). */
+#define SSM_REC_ZIP_CODEC_LZF                   UINT8_C(1)
 /** @} */
 
 /** The flag mask. */
@@ -284,6 +306,13 @@
  * Must be a multiple of 1KB.  */
 #define SSM_ZIP_BLOCK_SIZE                      _4K
 AssertCompile(SSM_ZIP_BLOCK_SIZE / _1K * _1K == SSM_ZIP_BLOCK_SIZE);
+/** The max number of blocks in a SSM_REC_TYPE_RAW_ZIP record. */
+#define SSM_ZIP_MULTI_MAX_BLOCKS                64
+AssertCompile(SSM_ZIP_MULTI_MAX_BLOCKS <= UINT8_MAX);
+/** The max number of compression worker threads. */
+#define SSM_ZIP_MAX_WORKERS                     8
+/** The size of the buffer for the data written ahead of batched blocks. */
+#define SSM_ZIP_BATCH_DATA_SIZE                 _16K
 
 
 /**
@@ -386,6 +415,61 @@ typedef struct SSMSTRMBUF
     PSSMSTRMBUF volatile    pNext;
 } SSMSTRMBUF;
 
+/**
+ * Block compression worker context.
+ *
+ * This is used for spreading the compression and decompression of
+ * SSM_REC_TYPE_RAW_ZIP records over a small pool of worker threads.  It is
+ * allocated on demand by ssmR3ZipWrkGet.
+ */
+typedef struct SSMZIPWRK
+{
+    /** The worker thread pool. */
+    RTREQPOOL               hPool;
+    /** The number of worker threads in the pool. */
+    uint32_t                cWorkers;
+    /** The number of blocks in the current job. */
+    uint32_t                cBlocks;
+    /** The uncompressed input of the current compression job. */
+    uint8_t const          *pbSrc;
+    /** The output buffer of the current decompression job. */
+    uint8_t                *pbDst;
+    /** The compressed size of each block in the current job, 0 if the block
+     * is stored uncompressed. */
+    uint16_t                acbBlocks[SSM_ZIP_MULTI_MAX_BLOCKS];
+    /** The compressed blocks. */
+    uint8_t                 abBlocks[SSM_ZIP_MULTI_MAX_BLOCKS][SSM_ZIP_BLOCK_SIZE];
+
+    /** @name Batch of single block writes, see ssmR3DataWriteBatchBlock.
+     * @{ */
+    /** The number of blocks in the batch. */
+    uint32_t                cBatchBlocks;
+    /** The number of bytes used in abBatchData. */
+    uint32_t                cbBatchData;
+    /** The number of buffered bytes written ahead of each block. */
+    uint16_t                acbBatchData[SSM_ZIP_MULTI_MAX_BLOCKS];
+    /** The buffered bytes written ahead of the blocks, back to back. */
+    uint8_t                 abBatchData[SSM_ZIP_BATCH_DATA_SIZE];
+    /** Copies of the batched blocks. */
+    uint8_t                 abBatchBlocks[SSM_ZIP_MULTI_MAX_BLOCKS][SSM_ZIP_BLOCK_SIZE];
+    /** @} */
+} SSMZIPWRK;
+/** Pointer to a block compression worker context. */
+typedef SSMZIPWRK *PSSMZIPWRK;
+
+/**
+ * Worker function processing one slice of a SSMZIPWRK job.
+ *
+ * @returns IPRT status code.
+ * @param   pZipWrk         The worker context.
+ * @param   iSlice          The slice to process.
+ * @param   cSlices         The number of slices the job is split into.
+ */
+typedef DECLCALLBACK(int) FNSSMZIPWRKSLICE(PSSMZIPWRK pZipWrk, uintptr_t iSlice, uintptr_t cSlices);
+/** Pointer to a FNSSMZIPWRKSLICE. */
+typedef FNSSMZIPWRKSLICE *PFNSSMZIPWRKSLICE;
+
+
 /**
  * SSM stream.
  *
@@ -442,6 +526,12 @@ typedef struct SSMSTRM
      * This may lag behind off as it's desirable to checksum as large blocks as
      * possible.  */
     uint32_t                offStreamCRC;
+
+    /** The block compression worker context, NULL if not (yet) created. */
+    PSSMZIPWRK              pZipWrk;
+    /** Set if ssmR3ZipWrkGet has been called, so we don't retry creating the
+     * worker context on every big read or write. */
+    bool                    fZipWrkInitialized;
 } SSMSTRM;
 /** Pointer to a SSM stream. */
 typedef SSMSTRM *PSSMSTRM;
@@ -536,6 +626,15 @@ typedef struct SSMHANDLE
             bool            fEndOfData;
             /** V2: The type and flags byte fo the current record. */
             uint8_t         u8TypeAndFlags;
+            /** V2: Number of blocks left in the current SSM_REC_TYPE_RAW_ZIP
+             * record, zero if the header of it hasn't been read yet. */
+            uint8_t         cZipBlocksLeft;
+            /** V2: The index of the next block in the current SSM_REC_TYPE_RAW_ZIP
+             * record. */
+            uint8_t         iZipBlock;
+            /** V2: The compressed block sizes of the current SSM_REC_TYPE_RAW_ZIP
+             * record. */
+            uint16_t        acbZipBlocks[SSM_ZIP_MULTI_MAX_BLOCKS];
 
             /** @name Context info for SSMR3SetLoadError.
              * @{  */
@@ -603,7 +702,7 @@ typedef struct SSMHANDLE
 typedef struct SSMFILEHDR
 {
     /** Magic string which identifies this file as a version of VBox saved state
-     *  file format (SSMFILEHDR_MAGIC_V2_0). */
+     *  file format (SSMFILEHDR_MAGIC_V2_0 or SSMFILEHDR_MAGIC_V2_1). */
     char            szMagic[32];
     /** The major version number. */
     uint16_t        u16VerMajor;
@@ -634,6 +733,7 @@ typedef struct SSMFILEHDR
 AssertCompileSize(SSMFILEHDR, 64);
 AssertCompileMemberOffset(SSMFILEHDR, u32CRC, 60);
 AssertCompileMemberSize(SSMFILEHDR, szMagic, sizeof(SSMFILEHDR_MAGIC_V2_0));
+AssertCompileMemberSize(SSMFILEHDR, szMagic, sizeof(SSMFILEHDR_MAGIC_V2_1));
 /** Pointer to a saved state file header. */
 typedef SSMFILEHDR *PSSMFILEHDR;
 /** Pointer to a const saved state file header. */
@@ -945,6 +1045,10 @@ static int ssmR3LazyInit(PVM pVM)
     if (RT_SUCCESS(rc))
     {
         STAM_REL_REG_USED(pVM, &pVM->ssm.s.uPass, STAMTYPE_U32, "/SSM/uPass", STAMUNIT_COUNT, "Current pass");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipBlocks, STAMTYPE_COUNTER, "/SSM/ZipBlocks", STAMUNIT_COUNT,
+                     "Blocks of big writes compressed into multi-block records by the worker threads.");
+        STAM_REL_REG(pVM, &pVM->ssm.s.StatZipBatchedBlocks, STAMTYPE_COUNTER, "/SSM/ZipBatchedBlocks", STAMUNIT_COUNT,
+                     "Single block writes batched up and compressed by the worker threads.");
     }
 
     pVM->ssm.s.fInitialized = RT_SUCCESS(rc);
@@ -1850,6 +1954,9 @@ static int ssmR3StrmInitInternal(PSSMSTRM pStrm, bool fChecksummed, uint32_t cBu
     pStrm->u32StreamCRC = fChecksummed ? RTCrc32Start() : 0;
     pStrm->offStreamCRC = 0;
 
+    pStrm->pZipWrk      = NULL;
+    pStrm->fZipWrkInitialized = false;
+
     /*
      * Allocate the buffers.  Page align them in case that makes the kernel
      * and/or cpu happier in some way.
@@ -1927,6 +2034,156 @@ static void ssmR3StrmDelete(PSSMSTRM pStrm)
 
     RTSemEventDestroy(pStrm->hEvtFree);
     pStrm->hEvtFree = NIL_RTSEMEVENT;
+
+    if (pStrm->pZipWrk)
+    {
+        RTReqPoolRelease(pStrm->pZipWrk->hPool);
+        RTMemPageFree(pStrm->pZipWrk, sizeof(*pStrm->pZipWrk));
+        pStrm->pZipWrk = NULL;
+    }
+}
+
+
+/**
+ * Gets the block compression worker context of a handle, creating it on the
+ * first call.
+ *
+ * @returns Pointer to the worker context, NULL if not available (single CPU
+ *          host, disabled by the configuration or out of resources).
+ * @param   pSSM            The saved state handle.
+ */
+static PSSMZIPWRK ssmR3ZipWrkGet(PSSMHANDLE pSSM)
+{
+    if (RT_LIKELY(pSSM->Strm.fZipWrkInitialized))
+        return pSSM->Strm.pZipWrk;
+    pSSM->Strm.fZipWrkInitialized = true;
+
+    uint32_t cWorkers = RTMpGetOnlineCount();
+    cWorkers = cWorkers > 1 ? RT_MIN(cWorkers - 1, SSM_ZIP_MAX_WORKERS) : 0;
+#ifndef SSM_STANDALONE
+    if (pSSM->pVM)
+    {
+        /** @cfgm{/SSM/ZipWorkers, uint32_t, #CPUs - 1 (max 8)}
+         * The number of worker threads used for compressing and decompressing
+         * big data items.  Saved states written with the workers may contain
+         * SSM_REC_TYPE_RAW_ZIP records and are therefore marked as file format
+         * v2.1, which older versions refuse to load.  Zero disables the workers
+         * and the records, producing v2.0 saved states. */
+        int rc = CFGMR3QueryU32Def(CFGMR3GetChild(CFGMR3GetRoot(pSSM->pVM), "SSM"), "ZipWorkers", &cWorkers, cWorkers);
+        AssertLogRelRCReturn(rc, NULL);
+        cWorkers = RT_MIN(cWorkers, SSM_ZIP_MAX_WORKERS);
+    }
+#endif
+    if (!cWorkers)
+        return NULL;
+
+    PSSMZIPWRK pZipWrk = (PSSMZIPWRK)RTMemPageAllocZ(sizeof(*pZipWrk));
+    if (!pZipWrk)
+        return NULL;
+    int rc = RTReqPoolCreate(cWorkers, 10000 /*cMsMinIdle*/, UINT32_MAX /*cThreadsPushBackThreshold*/, 0 /*cMsMaxPushBack*/,
+                             "SSMZip", &pZipWrk->hPool);
+    if (RT_FAILURE(rc))
+    {
+        LogRel(("SSM: Failed to create the compression worker pool: %Rrc\n", rc));
+        RTMemPageFree(pZipWrk, sizeof(*pZipWrk));
+        return NULL;
+    }
+    pZipWrk->cWorkers = cWorkers;
+    pSSM->Strm.pZipWrk = pZipWrk;
+    Log(("ssmR3ZipWrkGet: %u workers\n", cWorkers));
+    return pZipWrk;
+}
+
+
+/**
+ * Runs the current job of the worker context, splitting it into slices that
+ * are processed by the worker threads and the calling thread.
+ *
+ * @returns IPRT status code of the first failing slice.
+ * @param   pZipWrk         The worker context.
+ * @param   pfnSlice        The slice worker.
+ */
+static int ssmR3ZipWrkRun(PSSMZIPWRK pZipWrk, PFNSSMZIPWRKSLICE pfnSlice)
+{
+    uint32_t const cSlices = RT_MIN(pZipWrk->cWorkers + 1, pZipWrk->cBlocks);
+    PRTREQ         apReqs[SSM_ZIP_MAX_WORKERS];
+    uint32_t       cReqs = 0;
+    int            rc    = VINF_SUCCESS;
+    for (uint32_t iSlice = 1; iSlice < cSlices; iSlice++)
+    {
+        PRTREQ hReq = NIL_RTREQ;
+        int rc2 = RTReqPoolCallEx(pZipWrk->hPool, 0 /*cMillies*/, &hReq, RTREQFLAGS_IPRT_STATUS, (PFNRT)pfnSlice, 3,
+                                  (uintptr_t)pZipWrk, (uintptr_t)iSlice, (uintptr_t)cSlices);
+        if (rc2 == VERR_TIMEOUT || RT_SUCCESS(rc2))
+            apReqs[cReqs++] = hReq;
+        else
+        {
+            /* Couldn't submit it, do it ourselves. */
+            rc2 = pfnSlice(pZipWrk, iSlice, cSlices);
+            if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
+                rc = rc2;
+        }
+    }
+
+    int rc2 = pfnSlice(pZipWrk, 0, cSlices);
+    if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
+        rc = rc2;
+
+    for (uint32_t i = 0; i < cReqs; i++)
+    {
+        rc2 = RTReqWait(apReqs[i], RT_INDEFINITE_WAIT);
+        if (RT_SUCCESS(rc2))
+            rc2 = RTReqGetStatus(apReqs[i]);
+        RTReqRelease(apReqs[i]);
+        if (RT_FAILURE(rc2) && RT_SUCCESS(rc))
+            rc = rc2;
+    }
+    return rc;
+}
+
+
+/**
+ * @callback_method_impl{FNSSMZIPWRKSLICE, Compresses blocks.}
+ */
+static DECLCALLBACK(int) ssmR3ZipWrkCompressSlice(PSSMZIPWRK pZipWrk, uintptr_t iSlice, uintptr_t cSlices)
+{
+    uint32_t const iEnd = (uint32_t)(pZipWrk->cBlocks * (iSlice + 1) / cSlices);
+    for (uint32_t i = (uint32_t)(pZipWrk->cBlocks * iSlice / cSlices); i < iEnd; i++)
+    {
+        size_t cbCompr = SSM_ZIP_BLOCK_SIZE - (SSM_ZIP_BLOCK_SIZE / 16);
+        int rc = RTZipBlockCompress(RTZIPTYPE_LZF, RTZIPLEVEL_FAST, 0 /*fFlags*/,
+                                    &pZipWrk->pbSrc[i * SSM_ZIP_BLOCK_SIZE], SSM_ZIP_BLOCK_SIZE,
+                                    &pZipWrk->abBlocks[i][0], cbCompr, &cbCompr);
+        pZipWrk->acbBlocks[i] = RT_SUCCESS(rc) ? (uint16_t)cbCompr : 0;
+    }
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * @callback_method_impl{FNSSMZIPWRKSLICE, Decompresses blocks, skipping the
+ *                      stored ones.}
+ */
+static DECLCALLBACK(int) ssmR3ZipWrkDecompressSlice(PSSMZIPWRK pZipWrk, uintptr_t iSlice, uintptr_t cSlices)
+{
+    uint32_t const iEnd = (uint32_t)(pZipWrk->cBlocks * (iSlice + 1) / cSlices);
+    for (uint32_t i = (uint32_t)(pZipWrk->cBlocks * iSlice / cSlices); i < iEnd; i++)
+    {
+        uint32_t const cbCompr = pZipWrk->acbBlocks[i];
+        if (cbCompr)
+        {
+            size_t cbDstActual = 0;
+            int rc = RTZipBlockDecompress(RTZIPTYPE_LZF, 0 /*fFlags*/,
+                                          &pZipWrk->abBlocks[i][0], cbCompr, NULL /*pcbSrcActual*/,
+                                          &pZipWrk->pbDst[i * SSM_ZIP_BLOCK_SIZE], SSM_ZIP_BLOCK_SIZE, &cbDstActual);
+            if (RT_FAILURE(rc) || cbDstActual != SSM_ZIP_BLOCK_SIZE)
+            {
+                LogRel(("SSM: Block decompression failed: i=%u cbCompr=%#x cbDstActual=%#zx rc=%Rrc\n", i, cbCompr, cbDstActual, rc));
+                return VERR_SSM_INTEGRITY_DECOMPRESSION;
+            }
+        }
+    }
+    return VINF_SUCCESS;
 }
 
 
@@ -3170,6 +3427,72 @@ static void ssmR3StrmStopIoThread(PSSMSTRM pStrm)
     }
 }
 
+
+/**
+ * Skips ahead in a file stream by seeking rather than reading.
+ *
+ * Unlike ssmR3StrmSeek this keeps the buffers and the I/O thread, but the data
+ * skipped isn't checksummed so checksumming is disabled for the rest of the
+ * stream.
+ *
+ * @returns VBox status code.
+ * @param   pStrm       The stream handle.
+ * @param   offDst      The destination offset.
+ */
+static int ssmR3StrmSkipAheadFile(PSSMSTRM pStrm, uint64_t offDst)
+{
+    AssertReturn(!pStrm->fWrite, VERR_NOT_SUPPORTED);
+    AssertReturn(ssmR3StrmIsFile(pStrm), VERR_NOT_SUPPORTED);
+    AssertReturn(offDst >= ssmR3StrmTell(pStrm), VERR_SSM_SKIP_BACKWARDS);
+
+    /*
+     * Stop the read ahead and recycle whatever it managed to buffer.
+     */
+    bool const fIoThread = pStrm->hIoThread != NIL_RTTHREAD;
+    ssmR3StrmStopIoThread(pStrm);
+
+    if (pStrm->pCur)
+    {
+        ssmR3StrmPutFreeBuf(pStrm, pStrm->pCur);
+        pStrm->pCur = NULL;
+    }
+    PSSMSTRMBUF pBuf = pStrm->pPending;
+    pStrm->pPending = NULL;
+    while (pBuf)
+    {
+        PSSMSTRMBUF pNext = pBuf->pNext;
+        ssmR3StrmPutFreeBuf(pStrm, pBuf);
+        pBuf = pNext;
+    }
+    pBuf = ASMAtomicXchgPtrT(&pStrm->pHead, NULL, PSSMSTRMBUF);
+    while (pBuf)
+    {
+        PSSMSTRMBUF pNext = pBuf->pNext;
+        ssmR3StrmPutFreeBuf(pStrm, pBuf);
+        pBuf = pNext;
+    }
+
+    /*
+     * Reposition the file and restart the read ahead.
+     */
+    int rc = pStrm->pOps->pfnSeek(pStrm->pvUser, offDst, RTFILE_SEEK_BEGIN, NULL);
+    if (RT_SUCCESS(rc))
+    {
+        ssmR3StrmDisableChecksumming(pStrm);
+        pStrm->fNeedSeek     = false;
+        pStrm->offNeedSeekTo = UINT64_MAX;
+        pStrm->offCurStream  = offDst;
+        pStrm->off           = 0;
+        pStrm->offStreamCRC  = 0;
+    }
+    else if (ssmR3StrmSetError(pStrm, rc))
+        LogRel(("ssmR3StrmSkipAheadFile: RTFileSeek(,%#llx,) failed with rc=%Rrc\n", offDst, rc));
+
+    if (fIoThread)
+        ssmR3StrmStartIoThread(pStrm);
+    return rc;
+}
+
 #endif /* !SSM_STANDALONE */
 
 /**
@@ -3416,6 +3739,112 @@ static int ssmR3DataWriteRecHdr(PSSMHANDLE pSSM, size_t cb, uint8_t u8TypeAndFla
 }
 
 
+/**
+ * Compresses the batched blocks on the worker threads and writes them out.
+ *
+ * Each block is written as an ordinary SSM_REC_TYPE_RAW_LZF (or
+ * SSM_REC_TYPE_RAW) record, preceded by a SSM_REC_TYPE_RAW record with the
+ * buffered data written ahead of it, so the stream looks exactly like it would
+ * without batching.
+ *
+ * @returns VBox status code. Will set pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ * @param   pZipWrk         The worker context.
+ */
+static int ssmR3DataWriteBatchFlush(PSSMHANDLE pSSM, PSSMZIPWRK pZipWrk)
+{
+    uint32_t const cBlocks = pZipWrk->cBatchBlocks;
+    Assert(cBlocks > 0 && cBlocks <= SSM_ZIP_MULTI_MAX_BLOCKS);
+    pZipWrk->cBatchBlocks = 0;
+    pZipWrk->cbBatchData  = 0;
+
+    pZipWrk->pbSrc   = &pZipWrk->abBatchBlocks[0][0];
+    pZipWrk->cBlocks = cBlocks;
+    int rc = ssmR3ZipWrkRun(pZipWrk, ssmR3ZipWrkCompressSlice);
+    AssertRCReturn(rc, rc);
+    STAM_REL_COUNTER_ADD(&pSSM->pVM->ssm.s.StatZipBatchedBlocks, cBlocks);
+
+    uint8_t const *pbData = &pZipWrk->abBatchData[0];
+    for (uint32_t i = 0; i < cBlocks && RT_SUCCESS(rc); i++)
+    {
+        uint32_t const cbData = pZipWrk->acbBatchData[i];
+        if (cbData)
+        {
+            rc = ssmR3DataWriteRecHdr(pSSM, cbData, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW);
+            if (RT_SUCCESS(rc))
+                rc = ssmR3DataWriteRaw(pSSM, pbData, cbData);
+            ssmR3ProgressByByte(pSSM, cbData);
+            pbData += cbData;
+            if (RT_FAILURE(rc))
+                break;
+        }
+
+        uint16_t const cbCompr = pZipWrk->acbBlocks[i];
+        if (cbCompr)
+        {
+            static uint8_t const s_bDecomprKb = SSM_ZIP_BLOCK_SIZE / _1K;
+            rc = ssmR3DataWriteRecHdr(pSSM, 1 + cbCompr, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_LZF);
+            if (RT_SUCCESS(rc))
+                rc = ssmR3DataWriteRaw(pSSM, &s_bDecomprKb, sizeof(s_bDecomprKb));
+            if (RT_SUCCESS(rc))
+                rc = ssmR3DataWriteRaw(pSSM, &pZipWrk->abBlocks[i][0], cbCompr);
+        }
+        else
+        {
+            rc = ssmR3DataWriteRecHdr(pSSM, SSM_ZIP_BLOCK_SIZE, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW);
+            if (RT_SUCCESS(rc))
+                rc = ssmR3DataWriteRaw(pSSM, &pZipWrk->abBatchBlocks[i][0], SSM_ZIP_BLOCK_SIZE);
+        }
+        ssmR3ProgressByByte(pSSM, SSM_ZIP_BLOCK_SIZE);
+    }
+    return rc;
+}
+
+
+/**
+ * ssmR3DataWriteBig worker that adds a single non-zero block to the batch.
+ *
+ * Many callers, PGM in particular, save big things one page at a time with a
+ * few bytes of other data in between, so the multi-block path in
+ * ssmR3DataWriteBig never gets to see them.  Instead of writing such blocks
+ * right away they're collected, together with the buffered data written ahead
+ * of each of them, and compressed in one go on the worker threads when the
+ * batch is full or someone flushes the data buffer.
+ *
+ * @returns VBox status code. Will set pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ * @param   pZipWrk         The worker context.
+ * @param   pvBlock         The block, SSM_ZIP_BLOCK_SIZE bytes.
+ */
+static int ssmR3DataWriteBatchBlock(PSSMHANDLE pSSM, PSSMZIPWRK pZipWrk, const void *pvBlock)
+{
+    AssertCompile(SSM_ZIP_BATCH_DATA_SIZE >= RT_SIZEOFMEMB(SSMHANDLE, u.Write.abDataBuffer));
+    uint32_t const cbData = pSSM->u.Write.offDataBuffer;
+    if (pZipWrk->cbBatchData + cbData > sizeof(pZipWrk->abBatchData))
+    {
+        int rc = ssmR3DataWriteBatchFlush(pSSM, pZipWrk);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+    else if (RT_FAILURE(pSSM->rc))
+        return pSSM->rc;
+
+    uint32_t const iBlock = pZipWrk->cBatchBlocks;
+    memcpy(&pZipWrk->abBatchData[pZipWrk->cbBatchData], &pSSM->u.Write.abDataBuffer[0], cbData);
+    pZipWrk->cbBatchData         += cbData;
+    pZipWrk->acbBatchData[iBlock] = (uint16_t)cbData;
+    pSSM->u.Write.offDataBuffer   = 0;
+
+    memcpy(&pZipWrk->abBatchBlocks[iBlock][0], pvBlock, SSM_ZIP_BLOCK_SIZE);
+    pZipWrk->cBatchBlocks = iBlock + 1;
+    pSSM->offUnitUser    += SSM_ZIP_BLOCK_SIZE;
+
+    if (iBlock + 1 >= SSM_ZIP_MULTI_MAX_BLOCKS)
+        return ssmR3DataWriteBatchFlush(pSSM, pZipWrk);
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Worker that flushes the buffered data.
  *
@@ -3424,6 +3853,17 @@ static int ssmR3DataWriteRecHdr(PSSMHANDLE pSSM, size_t cb, uint8_t u8TypeAndFla
  */
 static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
 {
+    /*
+     * The batched blocks go first, the buffered data was written after them.
+     */
+    PSSMZIPWRK pZipWrk = pSSM->Strm.pZipWrk;
+    if (pZipWrk && pZipWrk->cBatchBlocks)
+    {
+        int rc = ssmR3DataWriteBatchFlush(pSSM, pZipWrk);
+        if (RT_FAILURE(rc))
+            return rc;
+    }
+
     /*
      * Check how much there current is in the buffer.
      */
@@ -3445,6 +3885,56 @@ static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * ssmR3DataWriteBig worker that writes a run of blocks as one
+ * SSM_REC_TYPE_RAW_ZIP record, compressing them on the worker threads.
+ *
+ * @returns VBox status code
+ * @param   pSSM            The saved state handle.
+ * @param   pZipWrk         The worker context.
+ * @param   pbBuf           The blocks to write.
+ * @param   cBlocks         The number of blocks, max SSM_ZIP_MULTI_MAX_BLOCKS.
+ */
+static int ssmR3DataWriteBigZip(PSSMHANDLE pSSM, PSSMZIPWRK pZipWrk, uint8_t const *pbBuf, uint32_t cBlocks)
+{
+    Assert(cBlocks > 0 && cBlocks <= SSM_ZIP_MULTI_MAX_BLOCKS);
+    pZipWrk->pbSrc   = pbBuf;
+    pZipWrk->cBlocks = cBlocks;
+    int rc = ssmR3ZipWrkRun(pZipWrk, ssmR3ZipWrkCompressSlice);
+    AssertRCReturn(rc, rc);
+
+    /*
+     * Assemble the codec and size table and write the record.
+     */
+    uint8_t  abHdr[2 + SSM_ZIP_MULTI_MAX_BLOCKS * 2];
+    uint32_t cbHdr = 2 + cBlocks * 2;
+    size_t   cbRec = cbHdr;
+    abHdr[0] = SSM_REC_ZIP_CODEC_LZF;
+    abHdr[1] = (uint8_t)cBlocks;
+    for (uint32_t i = 0; i < cBlocks; i++)
+    {
+        uint16_t const cbCompr = pZipWrk->acbBlocks[i];
+        abHdr[2 + i * 2]     = RT_BYTE1(cbCompr);
+        abHdr[2 + i * 2 + 1] = RT_BYTE2(cbCompr);
+        cbRec += cbCompr ? cbCompr : SSM_ZIP_BLOCK_SIZE;
+    }
+
+    rc = ssmR3DataWriteRecHdr(pSSM, cbRec, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW_ZIP);
+    if (RT_SUCCESS(rc))
+        rc = ssmR3DataWriteRaw(pSSM, &abHdr[0], cbHdr);
+    for (uint32_t i = 0; i < cBlocks && RT_SUCCESS(rc); i++)
+    {
+        uint16_t const cbCompr = pZipWrk->acbBlocks[i];
+        if (cbCompr)
+            rc = ssmR3DataWriteRaw(pSSM, &pZipWrk->abBlocks[i][0], cbCompr);
+        else
+            rc = ssmR3DataWriteRaw(pSSM, &pbBuf[i * SSM_ZIP_BLOCK_SIZE], SSM_ZIP_BLOCK_SIZE);
+    }
+    ssmR3ProgressByByte(pSSM, cBlocks * SSM_ZIP_BLOCK_SIZE);
+    return rc;
+}
+
+
 /**
  * ssmR3DataWrite worker that writes big stuff.
  *
@@ -3455,6 +3945,18 @@ static int ssmR3DataFlushBuffer(PSSMHANDLE pSSM)
  */
 static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
 {
+    /*
+     * Single non-zero blocks are batched up for the worker threads.
+     */
+    if (   cbBuf == SSM_ZIP_BLOCK_SIZE
+        && (   ((uintptr_t)pvBuf & 0xf)
+            || !ASMMemIsZeroPage(pvBuf)))
+    {
+        PSSMZIPWRK pZipWrk = ssmR3ZipWrkGet(pSSM);
+        if (pZipWrk)
+            return ssmR3DataWriteBatchBlock(pSSM, pZipWrk, pvBuf);
+    }
+
     int rc = ssmR3DataFlushBuffer(pSSM);
     if (RT_SUCCESS(rc))
     {
@@ -3471,6 +3973,36 @@ static int ssmR3DataWriteBig(PSSMHANDLE pSSM, const void *pvBuf, size_t cbBuf)
                     ||  !ASMMemIsZeroPage(pvBuf))
                )
             {
+                /*
+                 * Hand runs of non-zero blocks to the worker threads if we've got any.
+                 */
+                PSSMZIPWRK pZipWrk;
+                if (   cbBuf >= 2 * SSM_ZIP_BLOCK_SIZE
+                    && (pZipWrk = ssmR3ZipWrkGet(pSSM)) != NULL)
+                {
+                    uint8_t const *pbBuf      = (uint8_t const *)pvBuf;
+                    uint32_t const cMaxBlocks = (uint32_t)RT_MIN(cbBuf / SSM_ZIP_BLOCK_SIZE, SSM_ZIP_MULTI_MAX_BLOCKS);
+                    uint32_t       cBlocks    = 1;
+                    while (   cBlocks < cMaxBlocks
+                           && (   ((uintptr_t)pvBuf & 0xf)
+                               || !ASMMemIsZeroPage(&pbBuf[cBlocks * SSM_ZIP_BLOCK_SIZE])))
+                        cBlocks++;
+                    if (cBlocks > 1)
+                    {
+                        STAM_REL_COUNTER_ADD(&pSSM->pVM->ssm.s.StatZipBlocks, cBlocks);
+                        rc = ssmR3DataWriteBigZip(pSSM, pZipWrk, pbBuf, cBlocks);
+                        if (RT_FAILURE(rc))
+                            break;
+
+                        /* advance */
+                        if (cbBuf == cBlocks * SSM_ZIP_BLOCK_SIZE)
+                            return VINF_SUCCESS;
+                        cbBuf -= cBlocks * SSM_ZIP_BLOCK_SIZE;
+                        pvBuf = &pbBuf[cBlocks * SSM_ZIP_BLOCK_SIZE];
+                        continue;
+                    }
+                }
+
                 /*
                  * Compress it.
                  */
@@ -4358,6 +4890,37 @@ VMMR3DECL(int) SSMR3PutMem(PSSMHANDLE pSSM, const void *pv, size_t cb)
 }
 
 
+/**
+ * Saves a memory item to the current data unit as a single uncompressed
+ * record.
+ *
+ * This is for big items that the loader may want to access directly in the
+ * saved state file later, see SSMR3SkipMemDirect.
+ *
+ * @returns VBox status code.
+ * @param   pSSM            The saved state handle.
+ * @param   pv              Item to save.
+ * @param   cb              Size of the item, max 2GB.
+ */
+VMMR3DECL(int) SSMR3PutMemDirect(PSSMHANDLE pSSM, const void *pv, size_t cb)
+{
+    SSM_ASSERT_WRITEABLE_RET(pSSM);
+    SSM_CHECK_CANCELLED_RET(pSSM);
+    AssertReturn(cb > 0 && cb <= UINT32_C(0x7fffffff), VERR_OUT_OF_RANGE);
+
+    int rc = ssmR3DataFlushBuffer(pSSM);
+    if (RT_SUCCESS(rc))
+    {
+        pSSM->offUnitUser += cb;
+        rc = ssmR3DataWriteRecHdr(pSSM, cb, SSM_REC_FLAGS_FIXED | SSM_REC_FLAGS_IMPORTANT | SSM_REC_TYPE_RAW);
+        if (RT_SUCCESS(rc))
+            rc = ssmR3DataWriteRaw(pSSM, pv, cb);
+        ssmR3ProgressByByte(pSSM, cb);
+    }
+    return rc;
+}
+
+
 /**
  * Saves a zero terminated string item to the current data unit.
  *
@@ -5103,7 +5666,10 @@ static int ssmR3WriteHeaderAndClearPerUnitData(PVM pVM, PSSMHANDLE pSSM)
      * Write the header.
      */
     SSMFILEHDR FileHdr;
-    memcpy(&FileHdr.szMagic, SSMFILEHDR_MAGIC_V2_0, sizeof(FileHdr.szMagic));
+    if (ssmR3ZipWrkGet(pSSM))
+        memcpy(&FileHdr.szMagic, SSMFILEHDR_MAGIC_V2_1, sizeof(FileHdr.szMagic));
+    else
+        memcpy(&FileHdr.szMagic, SSMFILEHDR_MAGIC_V2_0, sizeof(FileHdr.szMagic));
     FileHdr.u16VerMajor  = VBOX_VERSION_MAJOR;
     FileHdr.u16VerMinor  = VBOX_VERSION_MINOR;
     FileHdr.u32VerBuild  = VBOX_VERSION_BUILD;
@@ -5943,6 +6509,8 @@ static void ssmR3DataReadBeginV2(PSSMHANDLE pSSM)
     pSSM->u.Read.offDataBuffer  = 0;
     pSSM->u.Read.fEndOfData     = false;
     pSSM->u.Read.u8TypeAndFlags = 0;
+    pSSM->u.Read.cZipBlocksLeft = 0;
+    pSSM->u.Read.iZipBlock      = 0;
 }
 
 
@@ -6048,19 +6616,19 @@ DECLINLINE(int) ssmR3DataReadV2RawLzfHdr(PSSMHANDLE pSSM, uint32_t *pcbDecompr)
 
 
 /**
- * Reads an LZF block from the stream and decompresses into the specified
- * buffer.
+ * Reads an LZF compressed block of the given size from the stream and
+ * decompresses it into the specified buffer.
  *
  * @returns VBox status code. Sets pSSM->rc on error.
  * @param   pSSM            The saved state handle.
+ * @param   cbCompr         The size of the compressed block.
  * @param   pvDst           Pointer to the output buffer.
  * @param   cbDecompr       The size of the decompressed data.
  */
-static int ssmR3DataReadV2RawLzf(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
+static int ssmR3DataReadV2LzfBlock(PSSMHANDLE pSSM, uint32_t cbCompr, void *pvDst, size_t cbDecompr)
 {
-    int         rc;
-    uint32_t    cbCompr    = pSSM->u.Read.cbRecLeft;
-    pSSM->u.Read.cbRecLeft = 0;
+    int rc;
+    Assert(cbCompr <= sizeof(pSSM->u.Read.abComprBuffer));
 
     /*
      * Try use the stream buffer directly to avoid copying things around.
@@ -6097,6 +6665,23 @@ static int ssmR3DataReadV2RawLzf(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
 }
 
 
+/**
+ * Reads an LZF block from the stream and decompresses into the specified
+ * buffer.
+ *
+ * @returns VBox status code. Sets pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ * @param   pvDst           Pointer to the output buffer.
+ * @param   cbDecompr       The size of the decompressed data.
+ */
+static int ssmR3DataReadV2RawLzf(PSSMHANDLE pSSM, void *pvDst, size_t cbDecompr)
+{
+    uint32_t cbCompr       = pSSM->u.Read.cbRecLeft;
+    pSSM->u.Read.cbRecLeft = 0;
+    return ssmR3DataReadV2LzfBlock(pSSM, cbCompr, pvDst, cbDecompr);
+}
+
+
 /**
  * Reads and checks the raw zero "header".
  *
@@ -6124,6 +6709,132 @@ DECLINLINE(int) ssmR3DataReadV2RawZeroHdr(PSSMHANDLE pSSM, uint32_t *pcbZero)
 }
 
 
+/**
+ * Reads and checks the SSM_REC_TYPE_RAW_ZIP "header", i.e. the codec and the
+ * block size table.
+ *
+ * @returns VBox status code. Sets pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ */
+static int ssmR3DataReadV2RawZipHdr(PSSMHANDLE pSSM)
+{
+    Assert(!pSSM->u.Read.cZipBlocksLeft);
+    AssertLogRelMsgReturn(pSSM->u.Read.uFmtVerMajor > 2 || pSSM->u.Read.uFmtVerMinor >= 1,
+                          ("v%u.%u\n", pSSM->u.Read.uFmtVerMajor, pSSM->u.Read.uFmtVerMinor),
+                          pSSM->rc = VERR_SSM_INTEGRITY_REC_HDR);
+    AssertLogRelMsgReturn(pSSM->u.Read.cbRecLeft > 2 + 2, ("%#x\n", pSSM->u.Read.cbRecLeft),
+                          pSSM->rc = VERR_SSM_INTEGRITY_DECOMPRESSION);
+
+    uint8_t abHdr[2 + SSM_ZIP_MULTI_MAX_BLOCKS * 2];
+    int rc = ssmR3DataReadV2Raw(pSSM, &abHdr[0], 2);
+    if (RT_FAILURE(rc))
+        return pSSM->rc = rc;
+    uint32_t const cBlocks = abHdr[1];
+    uint32_t const cbHdr   = 2 + cBlocks * 2;
+    AssertLogRelMsgReturn(abHdr[0] == SSM_REC_ZIP_CODEC_LZF, ("codec=%#x\n", abHdr[0]),
+                          pSSM->rc = VERR_SSM_INTEGRITY_DECOMPRESSION);
+    AssertLogRelMsgReturn(cBlocks > 0 && cBlocks <= SSM_ZIP_MULTI_MAX_BLOCKS && cbHdr < pSSM->u.Read.cbRecLeft,
+                          ("cBlocks=%#x cbRecLeft=%#x\n", cBlocks, pSSM->u.Read.cbRecLeft),
+                          pSSM->rc = VERR_SSM_INTEGRITY_DECOMPRESSION);
+    rc = ssmR3DataReadV2Raw(pSSM, &abHdr[2], cbHdr - 2);
+    if (RT_FAILURE(rc))
+        return pSSM->rc = rc;
+    pSSM->u.Read.cbRecLeft -= cbHdr;
+
+    uint32_t cbData = 0;
+    for (uint32_t i = 0; i < cBlocks; i++)
+    {
+        uint16_t const cbCompr = RT_MAKE_U16(abHdr[2 + i * 2], abHdr[2 + i * 2 + 1]);
+        AssertLogRelMsgReturn(cbCompr < SSM_ZIP_BLOCK_SIZE, ("i=%u cbCompr=%#x\n", i, cbCompr),
+                              pSSM->rc = VERR_SSM_INTEGRITY_DECOMPRESSION);
+        pSSM->u.Read.acbZipBlocks[i] = cbCompr;
+        cbData += cbCompr ? cbCompr : SSM_ZIP_BLOCK_SIZE;
+    }
+    AssertLogRelMsgReturn(cbData == pSSM->u.Read.cbRecLeft, ("cbData=%#x cbRecLeft=%#x\n", cbData, pSSM->u.Read.cbRecLeft),
+                          pSSM->rc = VERR_SSM_INTEGRITY_DECOMPRESSION);
+
+    pSSM->u.Read.cZipBlocksLeft = (uint8_t)cBlocks;
+    pSSM->u.Read.iZipBlock      = 0;
+    return VINF_SUCCESS;
+}
+
+
+/**
+ * Reads the next block of the current SSM_REC_TYPE_RAW_ZIP record and
+ * decompresses it into the specified buffer.
+ *
+ * @returns VBox status code. Sets pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ * @param   pvDst           Pointer to the output buffer, SSM_ZIP_BLOCK_SIZE
+ *                          bytes.
+ */
+static int ssmR3DataReadV2RawZipBlock(PSSMHANDLE pSSM, void *pvDst)
+{
+    Assert(pSSM->u.Read.cZipBlocksLeft > 0);
+    uint32_t const cbCompr = pSSM->u.Read.acbZipBlocks[pSSM->u.Read.iZipBlock];
+    pSSM->u.Read.iZipBlock++;
+    pSSM->u.Read.cZipBlocksLeft--;
+
+    if (!cbCompr)
+    {
+        pSSM->u.Read.cbRecLeft -= SSM_ZIP_BLOCK_SIZE;
+        int rc = ssmR3DataReadV2Raw(pSSM, pvDst, SSM_ZIP_BLOCK_SIZE);
+        if (RT_FAILURE(rc))
+            return pSSM->rc = rc;
+        return VINF_SUCCESS;
+    }
+
+    pSSM->u.Read.cbRecLeft -= cbCompr;
+    return ssmR3DataReadV2LzfBlock(pSSM, cbCompr, pvDst, SSM_ZIP_BLOCK_SIZE);
+}
+
+
+/**
+ * Reads the remaining blocks of the current SSM_REC_TYPE_RAW_ZIP record
+ * and has the worker threads decompress them into the specified buffer.
+ *
+ * @returns VBox status code. Sets pSSM->rc on error.
+ * @param   pSSM            The saved state handle.
+ * @param   pZipWrk         The worker context.
+ * @param   pvDst           Pointer to the output buffer, cZipBlocksLeft times
+ *                          SSM_ZIP_BLOCK_SIZE bytes.
+ */
+static int ssmR3DataReadV2RawZipMulti(PSSMHANDLE pSSM, PSSMZIPWRK pZipWrk, void *pvDst)
+{
+    uint8_t * const pbDst   = (uint8_t *)pvDst;
+    uint32_t const  cBlocks = pSSM->u.Read.cZipBlocksLeft;
+    Assert(cBlocks > 0);
+
+    /*
+     * Stored blocks go straight into the output buffer, the rest is gathered up
+     * for the workers.
+     */
+    for (uint32_t i = 0; i < cBlocks; i++)
+    {
+        uint16_t const cbCompr = pSSM->u.Read.acbZipBlocks[pSSM->u.Read.iZipBlock + i];
+        pZipWrk->acbBlocks[i] = cbCompr;
+        int rc;
+        if (cbCompr)
+            rc = ssmR3DataReadV2Raw(pSSM, &pZipWrk->abBlocks[i][0], cbCompr);
+        else
+            rc = ssmR3DataReadV2Raw(pSSM, &pbDst[i * SSM_ZIP_BLOCK_SIZE], SSM_ZIP_BLOCK_SIZE);
+        if (RT_FAILURE(rc))
+            return pSSM->rc = rc;
+        pSSM->u.Read.cbRecLeft -= cbCompr ? cbCompr : SSM_ZIP_BLOCK_SIZE;
+    }
+    pSSM->u.Read.iZipBlock     += (uint8_t)cBlocks;
+    pSSM->u.Read.cZipBlocksLeft = 0;
+    Assert(!pSSM->u.Read.cbRecLeft);
+
+    pZipWrk->pbDst   = pbDst;
+    pZipWrk->cBlocks = cBlocks;
+    int rc = ssmR3ZipWrkRun(pZipWrk, ssmR3ZipWrkDecompressSlice);
+    if (RT_FAILURE(rc))
+        return pSSM->rc = rc;
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Worker for reading the record header.
  *
@@ -6401,6 +7112,43 @@ static int ssmR3DataReadUnbufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
                 break;
             }
 
+            case SSM_REC_TYPE_RAW_ZIP:
+            {
+                int rc;
+                if (!pSSM->u.Read.cZipBlocksLeft)
+                {
+                    rc = ssmR3DataReadV2RawZipHdr(pSSM);
+                    if (RT_FAILURE(rc))
+                        return rc;
+                }
+                AssertCompile(SSM_ZIP_BLOCK_SIZE <= RT_SIZEOFMEMB(SSMHANDLE, u.Read.abDataBuffer));
+                PSSMZIPWRK pZipWrk;
+                cbToRead = pSSM->u.Read.cZipBlocksLeft * SSM_ZIP_BLOCK_SIZE;
+                if (   cbToRead <= cbBuf
+                    && pSSM->u.Read.cZipBlocksLeft > 1
+                    && (pZipWrk = ssmR3ZipWrkGet(pSSM)) != NULL)
+                    rc = ssmR3DataReadV2RawZipMulti(pSSM, pZipWrk, pvBuf);
+                else if (SSM_ZIP_BLOCK_SIZE <= cbBuf)
+                {
+                    cbToRead = SSM_ZIP_BLOCK_SIZE;
+                    rc = ssmR3DataReadV2RawZipBlock(pSSM, pvBuf);
+                }
+                else
+                {
+                    /* The output buffer is too small, use the data buffer. */
+                    rc = ssmR3DataReadV2RawZipBlock(pSSM, &pSSM->u.Read.abDataBuffer[0]);
+                    if (RT_FAILURE(rc))
+                        return rc;
+                    pSSM->u.Read.cbDataBuffer  = SSM_ZIP_BLOCK_SIZE;
+                    cbToRead = (uint32_t)cbBuf;
+                    pSSM->u.Read.offDataBuffer = cbToRead;
+                    memcpy(pvBuf, &pSSM->u.Read.abDataBuffer[0], cbToRead);
+                }
+                if (RT_FAILURE(rc))
+                    return rc;
+                break;
+            }
+
             default:
                 AssertMsgFailedReturn(("%x\n", pSSM->u.Read.u8TypeAndFlags), pSSM->rc = VERR_SSM_BAD_REC_TYPE);
         }
@@ -6504,6 +7252,23 @@ static int ssmR3DataReadBufferedV2(PSSMHANDLE pSSM, void *pvBuf, size_t cbBuf)
                 break;
             }
 
+            case SSM_REC_TYPE_RAW_ZIP:
+            {
+                int rc;
+                if (!pSSM->u.Read.cZipBlocksLeft)
+                {
+                    rc = ssmR3DataReadV2RawZipHdr(pSSM);
+                    if (RT_FAILURE(rc))
+                        return rc;
+                }
+                rc = ssmR3DataReadV2RawZipBlock(pSSM, &pSSM->u.Read.abDataBuffer[0]);
+                if (RT_FAILURE(rc))
+                    return rc;
+                cbToRead = SSM_ZIP_BLOCK_SIZE;
+                pSSM->u.Read.cbDataBuffer = cbToRead;
+                break;
+            }
+
             default:
                 AssertMsgFailedReturn(("%x\n", pSSM->u.Read.u8TypeAndFlags), pSSM->rc = VERR_SSM_BAD_REC_TYPE);
         }
@@ -7720,6 +8485,76 @@ VMMR3DECL(int) SSMR3Skip(PSSMHANDLE pSSM, size_t cb)
 }
 
 
+#ifndef SSM_STANDALONE
+/**
+ * Skips a memory item saved by SSMR3PutMemDirect without reading it, returning
+ * where it is located in the saved state file.
+ *
+ * This only works when loading from a file and when the next thing in the
+ * unit is the uncompressed record written by SSMR3PutMemDirect.  Since the
+ * skipped bits are not checksummed, this disables stream checksumming for the
+ * rest of the load.
+ *
+ * @returns VBox status code.
+ * @retval  VERR_NOT_SUPPORTED if the item cannot be skipped.  The caller must
+ *          then read it using SSMR3GetMem.
+ *
+ * @param   pSSM            The saved state handle.
+ * @param   cb              Size of the item.
+ * @param   poffFile        Where to return the file offset of the item.
+ */
+VMMR3DECL(int) SSMR3SkipMemDirect(PSSMHANDLE pSSM, size_t cb, uint64_t *poffFile)
+{
+    SSM_ASSERT_READABLE_RET(pSSM);
+    SSM_CHECK_CANCELLED_RET(pSSM);
+    AssertPtrReturn(poffFile, VERR_INVALID_POINTER);
+    *poffFile = UINT64_MAX;
+
+    /*
+     * We must be on a record boundary in a V2 file stream with nothing buffered.
+     */
+    if (   pSSM->u.Read.uFmtVerMajor < 2
+        || !ssmR3StrmIsFile(&pSSM->Strm)
+        || pSSM->u.Read.offDataBuffer != pSSM->u.Read.cbDataBuffer
+        || pSSM->u.Read.cbRecLeft
+        || pSSM->u.Read.cZipBlocksLeft
+        || pSSM->u.Read.fEndOfData)
+        return VERR_NOT_SUPPORTED;
+
+    /*
+     * Read the record header and check that it's the expected raw record.  If
+     * it isn't, the caller falls back on SSMR3GetMem which picks up the record
+     * we've just started.
+     */
+    pSSM->u.Read.cbDataBuffer  = 0;
+    pSSM->u.Read.offDataBuffer = 0;
+    int rc = ssmR3DataReadRecHdrV2(pSSM);
+    if (RT_FAILURE(rc))
+        return pSSM->rc = rc;
+    if (   pSSM->u.Read.fEndOfData
+        || (pSSM->u.Read.u8TypeAndFlags & SSM_REC_TYPE_MASK) != SSM_REC_TYPE_RAW
+        || pSSM->u.Read.cbRecLeft != cb)
+        return VERR_NOT_SUPPORTED;
+
+    /*
+     * Seek past it.
+     */
+    uint64_t const offFile = ssmR3StrmTell(&pSSM->Strm);
+    rc = ssmR3StrmSkipAheadFile(&pSSM->Strm, offFile + cb);
+    if (RT_FAILURE(rc))
+        return pSSM->rc = rc;
+    Log3(("SSMR3SkipMemDirect: %08llx|%08llx: skipped %#zx bytes\n", offFile, pSSM->offUnit, cb));
+
+    pSSM->u.Read.cbRecLeft = 0;
+    pSSM->offUnit         += cb;
+    pSSM->offUnitUser     += cb;
+    ssmR3ProgressByByte(pSSM, cb);
+    *poffFile = offFile;
+    return VINF_SUCCESS;
+}
+#endif /* !SSM_STANDALONE */
+
+
 /**
  * Skips to the end of the current data unit.
  *
@@ -7755,6 +8590,7 @@ VMMR3DECL(int) SSMR3SkipToEndOfUnit(PSSMHANDLE pSSM)
                         return pSSM->rc = rc;
                     pSSM->u.Read.cbRecLeft -= cbToRead;
                 }
+                pSSM->u.Read.cZipBlocksLeft = 0;
 
                 /* read the next header. */
                 int rc = ssmR3DataReadRecHdrV2(pSSM);
@@ -7992,6 +8828,7 @@ static int ssmR3HeaderAndValidate(PSSMHANDLE pSSM, bool fChecksumIt, bool fCheck
         unsigned    uFmtVerMinor;
     }   s_aVers[] =
     {
+        { SSMFILEHDR_MAGIC_V2_1, sizeof(SSMFILEHDR),    2, 1 },
         { SSMFILEHDR_MAGIC_V2_0, sizeof(SSMFILEHDR),    2, 0 },
         { SSMFILEHDR_MAGIC_V1_2, sizeof(SSMFILEHDRV12), 1, 2 },
         { SSMFILEHDR_MAGIC_V1_1, sizeof(SSMFILEHDRV11), 1, 1 },
@@ -8024,7 +8861,7 @@ static int ssmR3HeaderAndValidate(PSSMHANDLE pSSM, bool fChecksumIt, bool fCheck
         /*
          * Version 2.0 and later.
          */
-        if (pSSM->u.Read.uFmtVerMinor == 0)
+        if (pSSM->u.Read.uFmtVerMinor <= 1)
         {
             /* validate the header. */
             SSM_CHECK_CRC32_RET(&uHdr.v2_0, sizeof(uHdr.v2_0), ("Header CRC mismatch: %08x, correct is %08x\n", u32CRC, u32ActualCRC));
@@ -8283,6 +9120,8 @@ static int ssmR3OpenFile(PVM pVM, const char *pszFilename, PCSSMSTRMOPS pStreamO
     pSSM->u.Read.offDataBuffer  = 0;
     pSSM->u.Read.fEndOfData     = 0;
     pSSM->u.Read.u8TypeAndFlags = 0;
+    pSSM->u.Read.cZipBlocksLeft = 0;
+    pSSM->u.Read.iZipBlock      = 0;
 
     pSSM->u.Read.pCurUnit       = NULL;
     pSSM->u.Read.uCurUnitVer    = UINT32_MAX;
@@ -8777,6 +9616,8 @@ static int ssmR3LoadDirectoryAndFooter(PSSMHANDLE pSSM)
     rc = ssmR3StrmRead(&pSSM->Strm, &Footer, sizeof(Footer));
     if (RT_FAILURE(rc))
         return rc;
+    if (!pSSM->Strm.fChecksummed)
+        u32StreamCRC = Footer.u32StreamCRC; /* SSMR3SkipMemDirect */
     return ssmR3ValidateFooter(&Footer, off, DirHdr.cEntries, pSSM->u.Read.fStreamCrc32, u32StreamCRC);
 }
 
@@ -9861,6 +10702,21 @@ VMMR3DECL(const char *) SSMR3HandleHostOSAndArch(PSSMHANDLE pSSM)
 }
 
 
+/**
+ * Gets the name of the saved state file.
+ *
+ * @returns Pointer to a read only string, NULL if the operation isn't on a
+ *          file (stream based saves and restores).
+ * @param   pSSM            The saved state handle.
+ */
+VMMR3DECL(const char *) SSMR3HandleGetFilename(PSSMHANDLE pSSM)
+{
+    if (!ssmR3StrmIsFile(&pSSM->Strm))
+        return NULL;
+    return pSSM->pszFilename;
+}
+
+
 #ifdef DEBUG
 /**
  * Gets current data offset, relative to the start of the unit - only for debugging
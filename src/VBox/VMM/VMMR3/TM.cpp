@@ -1877,21 +1877,7 @@ VMMR3DECL(int) TMR3TimerDestroy(PTMTIMER pTimer)
      * Unlink from the active list.
      */
     if (fActive)
-    {
-        const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-        const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
-        if (pPrev)
-            TMTIMER_SET_NEXT(pPrev, pNext);
-        else
-        {
-            TMTIMER_SET_HEAD(pQueue, pNext);
-            pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-        }
-        if (pNext)
-            TMTIMER_SET_PREV(pNext, pPrev);
-        pTimer->offNext = 0;
-        pTimer->offPrev = 0;
-    }
+        tmTimerQueueUnlinkActiveWorker(pQueue, pTimer);
 
     /*
      * Unlink from the schedule list by running it.
@@ -2286,18 +2272,8 @@ static void tmR3TimerQueueRun(PVM pVM, PTMTIMERQUEUE pQueue)
             Assert(!pTimer->offScheduleNext); /* this can trigger falsely */
 
             /* unlink */
-            const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
-            if (pPrev)
-                TMTIMER_SET_NEXT(pPrev, pNext);
-            else
-            {
-                TMTIMER_SET_HEAD(pQueue, pNext);
-                pQueue->u64Expire = pNext ? pNext->u64Expire : INT64_MAX;
-            }
-            if (pNext)
-                TMTIMER_SET_PREV(pNext, pPrev);
-            pTimer->offNext = 0;
-            pTimer->offPrev = 0;
+            Assert(TMTIMER_GET_NEXT(pTimer) == pNext);
+            tmTimerQueueUnlinkActiveWorker(pQueue, pTimer);
 
             /* fire */
             TM_SET_STATE(pTimer, TMTIMERSTATE_EXPIRED_DELIVER);
@@ -834,6 +834,16 @@ static int vmR3InitRing3(PVM pVM, PUVM pUVM)
     STAM_REG(pVM, &pUVM->vm.s.StatReqProcessed,  STAMTYPE_COUNTER,     "/VM/Req/Processed",      STAMUNIT_OCCURENCES,        "Number of processed requests (any queue).");
     STAM_REG(pVM, &pUVM->vm.s.StatReqMoreThan1,  STAMTYPE_COUNTER,     "/VM/Req/MoreThan1",      STAMUNIT_OCCURENCES,        "Number of times there are more than one request on the queue when processing it.");
     STAM_REG(pVM, &pUVM->vm.s.StatReqPushBackRaces, STAMTYPE_COUNTER,  "/VM/Req/PushBackRaces",  STAMUNIT_OCCURENCES,        "Number of push back races.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqBatches,    STAMTYPE_COUNTER,     "/VM/Req/Batches",        STAMUNIT_OCCURENCES,        "Number of times more than one request was taken off a VCPU queue in one go.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqBatched,    STAMTYPE_COUNTER,     "/VM/Req/Batched",        STAMUNIT_OCCURENCES,        "Number of requests served from a batch without touching the VCPU queue.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqCallDirect, STAMTYPE_COUNTER,     "/VM/Req/CallDirect",     STAMUNIT_OCCURENCES,        "Number of synchronous calls made directly on the EMT without a request packet.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqLatency,    STAMTYPE_PROFILE,     "/VM/Req/Latency",        STAMUNIT_NS_PER_CALL,       "Time from queuing a request till an EMT starts processing it.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqLatencyBelow1us,    STAMTYPE_COUNTER, "/VM/Req/Latency/Below1us",    STAMUNIT_OCCURENCES, "Number of requests picked up within 1us.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqLatency1usTo10us,   STAMTYPE_COUNTER, "/VM/Req/Latency/1usTo10us",   STAMUNIT_OCCURENCES, "Number of requests picked up within 1us to 10us.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqLatency10usTo100us, STAMTYPE_COUNTER, "/VM/Req/Latency/10usTo100us", STAMUNIT_OCCURENCES, "Number of requests picked up within 10us to 100us.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqLatency100usTo1ms,  STAMTYPE_COUNTER, "/VM/Req/Latency/100usTo1ms",  STAMUNIT_OCCURENCES, "Number of requests picked up within 100us to 1ms.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqLatency1msTo10ms,   STAMTYPE_COUNTER, "/VM/Req/Latency/1msTo10ms",   STAMUNIT_OCCURENCES, "Number of requests picked up within 1ms to 10ms.");
+    STAM_REG(pVM, &pUVM->vm.s.StatReqLatencyOver10ms,    STAMTYPE_COUNTER, "/VM/Req/Latency/Over10ms",    STAMUNIT_OCCURENCES, "Number of requests waiting more than 10ms to be picked up.");
 
     /* Statistics for ring-0 components: */
     STAM_REL_REG(pVM, &pVM->R0Stats.gmm.cChunkTlbHits,   STAMTYPE_COUNTER, "/GMM/ChunkTlbHits",   STAMUNIT_OCCURENCES, "GMMR0PageIdToVirt chunk TBL hits");
@@ -2377,7 +2387,18 @@ static void vmR3DestroyUVM(PUVM pUVM, uint32_t cMilliesEMTWait)
             {
                 pReqHead = ASMAtomicXchgPtrT(&pUVCpu->vm.s.pNormalReqs, NULL, PVMREQ);
                 if (!pReqHead)
-                    break;
+                {
+                    /* The ones the EMT already took off the queues. */
+                    pReqHead = pUVCpu->vm.s.pPriorityReqsFifo;
+                    pUVCpu->vm.s.pPriorityReqsFifo = NULL;
+                    if (!pReqHead)
+                    {
+                        pReqHead = pUVCpu->vm.s.pNormalReqsFifo;
+                        pUVCpu->vm.s.pNormalReqsFifo = NULL;
+                        if (!pReqHead)
+                            break;
+                    }
+                }
             }
             AssertLogRelMsgFailed(("Requests pending! VMR3Destroy caller has to serialize this.\n"));
 
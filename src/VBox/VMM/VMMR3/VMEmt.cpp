@@ -124,7 +124,8 @@ int vmR3EmulationThreadWithId(RTTHREAD hThreadSelf, PUVMCPU pUVCpu, VMCPUID idCp
                 rc = VMR3ReqProcessU(pUVM, VMCPUID_ANY, false /*fPriorityOnly*/);
                 Log(("vmR3EmulationThread: Req rc=%Rrc, VM state %s -> %s\n", rc, VMR3GetStateName(enmBefore), pUVM->pVM ? VMR3GetStateName(pUVM->pVM->enmVMState) : "CREATING"));
             }
-            else if (pUVCpu->vm.s.pNormalReqs || pUVCpu->vm.s.pPriorityReqs)
+            else if (   pUVCpu->vm.s.pNormalReqs     || pUVCpu->vm.s.pPriorityReqs
+                     || pUVCpu->vm.s.pNormalReqsFifo || pUVCpu->vm.s.pPriorityReqsFifo)
             {
                 /*
                  * Service execute in specific EMT request.
@@ -173,7 +174,8 @@ int vmR3EmulationThreadWithId(RTTHREAD hThreadSelf, PUVMCPU pUVCpu, VMCPUID idCp
                 rc = VMR3ReqProcessU(pUVM, VMCPUID_ANY, false /*fPriorityOnly*/);
                 Log(("vmR3EmulationThread: Req rc=%Rrc, VM state %s -> %s\n", rc, VMR3GetStateName(enmBefore), VMR3GetStateName(pVM->enmVMState)));
             }
-            else if (pUVCpu->vm.s.pNormalReqs || pUVCpu->vm.s.pPriorityReqs)
+            else if (   pUVCpu->vm.s.pNormalReqs     || pUVCpu->vm.s.pPriorityReqs
+                     || pUVCpu->vm.s.pNormalReqsFifo || pUVCpu->vm.s.pPriorityReqsFifo)
             {
                 /*
                  * Service execute in specific EMT request.
@@ -900,6 +902,8 @@ static DECLCALLBACK(int) vmR3BootstrapWait(PUVMCPU pUVCpu)
             break;
         if (pUVCpu->vm.s.pNormalReqs || pUVCpu->vm.s.pPriorityReqs) /* local requests pending? */
             break;
+        if (pUVCpu->vm.s.pNormalReqsFifo || pUVCpu->vm.s.pPriorityReqsFifo) /* local batch not yet served? */
+            break;
 
         if (    pUVCpu->pVM
             &&  (   VM_FF_IS_ANY_SET(pUVCpu->pVM, VM_FF_EXTERNAL_SUSPENDED_MASK)
@@ -2423,6 +2423,15 @@ static int vmmR3ServiceCallRing3Request(PVM pVM, PVMCPU pVCpu)
             break;
         }
 
+        /*
+         * Restores a page pending lazy restore from the saved state file.
+         */
+        case VMMCALLRING3_PGM_LAZY_RESTORE_PAGE:
+        {
+            pVCpu->vmm.s.rcCallRing3 = PGMR3PhysLazyRestorePage(pVM, pVCpu->vmm.s.u64CallRing3Arg);
+            break;
+        }
+
         /*
          * Acquire the PGM lock.
          */
@@ -41,6 +41,8 @@
 *   Internal Functions                                                                                                           *
 *********************************************************************************************************************************/
 static int  vmR3ReqProcessOne(PVMREQ pReq);
+static int  vmR3ReqCallFunction(PFNRT pfn, unsigned cArgs, uintptr_t *pauArgs);
+static int  vmR3ReqCallWaitV(PUVM pUVM, VMCPUID idDstCpu, uint32_t fFlags, PFNRT pfnFunction, unsigned cArgs, va_list va);
 
 
 /**
@@ -67,15 +69,10 @@ static int  vmR3ReqProcessOne(PVMREQ pReq);
  */
 VMMR3_INT_DECL(int) VMR3ReqCallWait(PVM pVM, VMCPUID idDstCpu, PFNRT pfnFunction, unsigned cArgs, ...)
 {
-    PVMREQ pReq;
     va_list va;
     va_start(va, cArgs);
-    int rc = VMR3ReqCallVU(pVM->pUVM, idDstCpu, &pReq, RT_INDEFINITE_WAIT, VMREQFLAGS_VBOX_STATUS,
-                           pfnFunction, cArgs, va);
+    int rc = vmR3ReqCallWaitV(pVM->pUVM, idDstCpu, VMREQFLAGS_VBOX_STATUS, pfnFunction, cArgs, va);
     va_end(va);
-    if (RT_SUCCESS(rc))
-        rc = pReq->iStatus;
-    VMR3ReqFree(pReq);
     return rc;
 }
 
@@ -104,15 +101,10 @@ VMMR3_INT_DECL(int) VMR3ReqCallWait(PVM pVM, VMCPUID idDstCpu, PFNRT pfnFunction
  */
 VMMR3DECL(int) VMR3ReqCallWaitU(PUVM pUVM, VMCPUID idDstCpu, PFNRT pfnFunction, unsigned cArgs, ...)
 {
-    PVMREQ pReq;
     va_list va;
     va_start(va, cArgs);
-    int rc = VMR3ReqCallVU(pUVM, idDstCpu, &pReq, RT_INDEFINITE_WAIT, VMREQFLAGS_VBOX_STATUS,
-                           pfnFunction, cArgs, va);
+    int rc = vmR3ReqCallWaitV(pUVM, idDstCpu, VMREQFLAGS_VBOX_STATUS, pfnFunction, cArgs, va);
     va_end(va);
-    if (RT_SUCCESS(rc))
-        rc = pReq->iStatus;
-    VMR3ReqFree(pReq);
     return rc;
 }
 
@@ -197,13 +189,10 @@ VMMR3DECL(int) VMR3ReqCallNoWaitU(PUVM pUVM, VMCPUID idDstCpu, PFNRT pfnFunction
  */
 VMMR3_INT_DECL(int) VMR3ReqCallVoidWait(PVM pVM, VMCPUID idDstCpu, PFNRT pfnFunction, unsigned cArgs, ...)
 {
-    PVMREQ pReq;
     va_list va;
     va_start(va, cArgs);
-    int rc = VMR3ReqCallVU(pVM->pUVM, idDstCpu, &pReq, RT_INDEFINITE_WAIT, VMREQFLAGS_VOID,
-                           pfnFunction, cArgs, va);
+    int rc = vmR3ReqCallWaitV(pVM->pUVM, idDstCpu, VMREQFLAGS_VOID, pfnFunction, cArgs, va);
     va_end(va);
-    VMR3ReqFree(pReq);
     return rc;
 }
 
@@ -228,13 +217,10 @@ VMMR3_INT_DECL(int) VMR3ReqCallVoidWait(PVM pVM, VMCPUID idDstCpu, PFNRT pfnFunc
  */
 VMMR3DECL(int) VMR3ReqCallVoidWaitU(PUVM pUVM, VMCPUID idDstCpu, PFNRT pfnFunction, unsigned cArgs, ...)
 {
-    PVMREQ pReq;
     va_list va;
     va_start(va, cArgs);
-    int rc = VMR3ReqCallVU(pUVM, idDstCpu, &pReq, RT_INDEFINITE_WAIT, VMREQFLAGS_VOID,
-                           pfnFunction, cArgs, va);
+    int rc = vmR3ReqCallWaitV(pUVM, idDstCpu, VMREQFLAGS_VOID, pfnFunction, cArgs, va);
     va_end(va);
-    VMR3ReqFree(pReq);
     return rc;
 }
 
@@ -296,15 +282,10 @@ VMMR3DECL(int) VMR3ReqCallVoidNoWait(PVM pVM, VMCPUID idDstCpu, PFNRT pfnFunctio
  */
 VMMR3DECL(int) VMR3ReqPriorityCallWait(PVM pVM, VMCPUID idDstCpu, PFNRT pfnFunction, unsigned cArgs, ...)
 {
-    PVMREQ pReq;
     va_list va;
     va_start(va, cArgs);
-    int rc = VMR3ReqCallVU(pVM->pUVM, idDstCpu, &pReq, RT_INDEFINITE_WAIT, VMREQFLAGS_VBOX_STATUS | VMREQFLAGS_PRIORITY,
-                           pfnFunction, cArgs, va);
+    int rc = vmR3ReqCallWaitV(pVM->pUVM, idDstCpu, VMREQFLAGS_VBOX_STATUS | VMREQFLAGS_PRIORITY, pfnFunction, cArgs, va);
     va_end(va);
-    if (RT_SUCCESS(rc))
-        rc = pReq->iStatus;
-    VMR3ReqFree(pReq);
     return rc;
 }
 
@@ -333,15 +314,10 @@ VMMR3DECL(int) VMR3ReqPriorityCallWait(PVM pVM, VMCPUID idDstCpu, PFNRT pfnFunct
  */
 VMMR3DECL(int) VMR3ReqPriorityCallWaitU(PUVM pUVM, VMCPUID idDstCpu, PFNRT pfnFunction, unsigned cArgs, ...)
 {
-    PVMREQ pReq;
     va_list va;
     va_start(va, cArgs);
-    int rc = VMR3ReqCallVU(pUVM, idDstCpu, &pReq, RT_INDEFINITE_WAIT, VMREQFLAGS_VBOX_STATUS | VMREQFLAGS_PRIORITY,
-                           pfnFunction, cArgs, va);
+    int rc = vmR3ReqCallWaitV(pUVM, idDstCpu, VMREQFLAGS_VBOX_STATUS | VMREQFLAGS_PRIORITY, pfnFunction, cArgs, va);
     va_end(va);
-    if (RT_SUCCESS(rc))
-        rc = pReq->iStatus;
-    VMR3ReqFree(pReq);
     return rc;
 }
 
@@ -367,12 +343,65 @@ VMMR3DECL(int) VMR3ReqPriorityCallWaitU(PUVM pUVM, VMCPUID idDstCpu, PFNRT pfnFu
  */
 VMMR3DECL(int) VMR3ReqPriorityCallVoidWaitU(PUVM pUVM, VMCPUID idDstCpu, PFNRT pfnFunction, unsigned cArgs, ...)
 {
-    PVMREQ pReq;
     va_list va;
     va_start(va, cArgs);
-    int rc = VMR3ReqCallVU(pUVM, idDstCpu, &pReq, RT_INDEFINITE_WAIT, VMREQFLAGS_VOID | VMREQFLAGS_PRIORITY,
-                           pfnFunction, cArgs, va);
+    int rc = vmR3ReqCallWaitV(pUVM, idDstCpu, VMREQFLAGS_VOID | VMREQFLAGS_PRIORITY, pfnFunction, cArgs, va);
     va_end(va);
+    return rc;
+}
+
+
+/**
+ * Worker for the synchronous convenience wrappers.
+ *
+ * When called on the EMT the request would be executed right away, so we skip
+ * the packet allocation and queuing and just make the call.
+ *
+ * @returns VBox status code.  The status of pfnFunction for
+ *          VMREQFLAGS_VBOX_STATUS, otherwise that of VMR3ReqCallVU.
+ * @param   pUVM            Pointer to the user mode VM structure.
+ * @param   idDstCpu        The destination CPU(s).
+ * @param   fFlags          A combination of the VMREQFLAGS values, NO_WAIT
+ *                          not allowed.
+ * @param   pfnFunction     Pointer to the function to call.
+ * @param   cArgs           Number of arguments in the vector.
+ * @param   va              Argument vector.
+ */
+static int vmR3ReqCallWaitV(PUVM pUVM, VMCPUID idDstCpu, uint32_t fFlags, PFNRT pfnFunction, unsigned cArgs, va_list va)
+{
+    Assert(!(fFlags & VMREQFLAGS_NO_WAIT));
+
+    /*
+     * Same conditions as the "requester was an EMT" case in VMR3ReqQueue.
+     */
+    if (   VALID_PTR(pUVM)
+        && pUVM->u32Magic == UVM_MAGIC
+        && (idDstCpu == VMCPUID_ANY || idDstCpu < pUVM->cCpus))
+    {
+        PUVMCPU pUVCpu = (PUVMCPU)RTTlsGet(pUVM->vm.s.idxTLS);
+        if (   pUVCpu
+            && (idDstCpu == VMCPUID_ANY || idDstCpu == pUVCpu->idCpu))
+        {
+            uintptr_t auArgs[RT_ELEMENTS(((PVMREQ)NULL)->u.Internal.aArgs)];
+            AssertPtrReturn(pfnFunction, VERR_INVALID_POINTER);
+            AssertMsgReturn(cArgs <= RT_ELEMENTS(auArgs), ("cArg=%d\n", cArgs), VERR_TOO_MUCH_DATA);
+            for (unsigned iArg = 0; iArg < cArgs; iArg++)
+                auArgs[iArg] = va_arg(va, uintptr_t);
+
+            STAM_COUNTER_INC(&pUVM->vm.s.StatReqCallDirect);
+            int rc = vmR3ReqCallFunction(pfnFunction, cArgs, auArgs);
+            if ((fFlags & VMREQFLAGS_RETURN_MASK) == VMREQFLAGS_VOID)
+                rc = VINF_SUCCESS;
+            LogFlow(("vmR3ReqCallWaitV: returns %Rrc (direct)\n", rc));
+            return rc;
+        }
+    }
+
+    PVMREQ pReq;
+    int rc = VMR3ReqCallVU(pUVM, idDstCpu, &pReq, RT_INDEFINITE_WAIT, fFlags, pfnFunction, cArgs, va);
+    if (   RT_SUCCESS(rc)
+        && (fFlags & VMREQFLAGS_RETURN_MASK) == VMREQFLAGS_VBOX_STATUS)
+        rc = pReq->iStatus;
     VMR3ReqFree(pReq);
     return rc;
 }
@@ -875,6 +904,9 @@ VMMR3DECL(int) VMR3ReqQueue(PVMREQ pReq, RTMSINTERVAL cMillies)
          */
         volatile PVMREQ *ppQueueHead = pReq->fFlags & VMREQFLAGS_PRIORITY ? &pUVCpu->vm.s.pPriorityReqs : &pUVCpu->vm.s.pNormalReqs;
         pReq->enmState = VMREQSTATE_QUEUED;
+#ifdef VBOX_WITH_STATISTICS
+        pReq->u64QueuedNanoTS = RTTimeNanoTS();
+#endif
         PVMREQ pNext;
         do
         {
@@ -910,6 +942,9 @@ VMMR3DECL(int) VMR3ReqQueue(PVMREQ pReq, RTMSINTERVAL cMillies)
          */
         volatile PVMREQ *ppQueueHead = pReq->fFlags & VMREQFLAGS_PRIORITY ? &pUVM->vm.s.pPriorityReqs : &pUVM->vm.s.pNormalReqs;
         pReq->enmState = VMREQSTATE_QUEUED;
+#ifdef VBOX_WITH_STATISTICS
+        pReq->u64QueuedNanoTS = RTTimeNanoTS();
+#endif
         PVMREQ pNext;
         do
         {
@@ -1081,6 +1116,80 @@ static PVMREQ vmR3ReqProcessUTooManyHelper(PUVM pUVM, VMCPUID idDstCpu, PVMREQ p
 }
 
 
+/**
+ * VMR3ReqProcessU helper that dequeues the oldest request on one of the
+ * queues of a specific virtual CPU.
+ *
+ * The requesters push onto a LIFO list, so when there are several requests
+ * pending we take all of them in one go, reverse them into FIFO order and park
+ * them in an EMT private list that the following calls are served from.  Only
+ * the EMT of the virtual CPU consumes these queues, so unlike the shared queue
+ * (see vmR3ReqProcessUTooManyHelper) nothing has to be pushed back.
+ *
+ * @returns The oldest request, NULL if none are pending.
+ * @param   pUVM                Pointer to the user mode VM structure
+ * @param   ppReqs              Pointer to the list head.
+ * @param   ppFifo              Pointer to the EMT private FIFO list head.
+ */
+static PVMREQ vmR3ReqDequeueCpu(PUVM pUVM, PVMREQ volatile *ppReqs, PVMREQ *ppFifo)
+{
+    PVMREQ pReq = *ppFifo;
+    if (!pReq)
+    {
+        pReq = ASMAtomicXchgPtrT(ppReqs, NULL, PVMREQ);
+        if (!pReq)
+            return NULL;
+        if (RT_UNLIKELY(pReq->pNext))
+        {
+            STAM_COUNTER_INC(&pUVM->vm.s.StatReqBatches);
+            PVMREQ pFifo = NULL;
+            do
+            {
+                PVMREQ pNext = pReq->pNext;
+                pReq->pNext = pFifo;
+                pFifo = pReq;
+                pReq  = pNext;
+            } while (pReq);
+            pReq = pFifo;
+        }
+    }
+    else
+        STAM_COUNTER_INC(&pUVM->vm.s.StatReqBatched);
+    RT_NOREF(pUVM);
+
+    *ppFifo = pReq->pNext;
+    ASMAtomicWriteNullPtr(&pReq->pNext);
+    return pReq;
+}
+
+
+#ifdef VBOX_WITH_STATISTICS
+/**
+ * Records how long a request spent on the queue before being picked up.
+ *
+ * @param   pUVM                Pointer to the user mode VM structure
+ * @param   pReq                The request about to be processed.
+ */
+static void vmR3ReqRecordLatency(PUVM pUVM, PVMREQ pReq)
+{
+    uint64_t const cNsLatency = RTTimeNanoTS() - pReq->u64QueuedNanoTS;
+    STAM_PROFILE_ADD_PERIOD(&pUVM->vm.s.StatReqLatency, cNsLatency);
+    if (cNsLatency < RT_NS_1US)
+        STAM_COUNTER_INC(&pUVM->vm.s.StatReqLatencyBelow1us);
+    else if (cNsLatency < RT_NS_10US)
+        STAM_COUNTER_INC(&pUVM->vm.s.StatReqLatency1usTo10us);
+    else if (cNsLatency < RT_NS_100US)
+        STAM_COUNTER_INC(&pUVM->vm.s.StatReqLatency10usTo100us);
+    else if (cNsLatency < RT_NS_1MS)
+        STAM_COUNTER_INC(&pUVM->vm.s.StatReqLatency100usTo1ms);
+    else if (cNsLatency < RT_NS_10MS)
+        STAM_COUNTER_INC(&pUVM->vm.s.StatReqLatency1msTo10ms);
+    else
+        STAM_COUNTER_INC(&pUVM->vm.s.StatReqLatencyOver10ms);
+}
+#endif
+
+
 /**
  * Process pending request(s).
  *
@@ -1110,10 +1219,12 @@ VMMR3_INT_DECL(int) VMR3ReqProcessU(PUVM pUVM, VMCPUID idDstCpu, bool fPriorityO
      */
     PVMREQ volatile *ppNormalReqs;
     PVMREQ volatile *ppPriorityReqs;
+    PUVMCPU          pUVCpu;
     if (idDstCpu == VMCPUID_ANY)
     {
         ppPriorityReqs = &pUVM->vm.s.pPriorityReqs;
         ppNormalReqs   = !fPriorityOnly ? &pUVM->vm.s.pNormalReqs                 : ppPriorityReqs;
+        pUVCpu         = NULL;
     }
     else
     {
@@ -1121,6 +1232,7 @@ VMMR3_INT_DECL(int) VMR3ReqProcessU(PUVM pUVM, VMCPUID idDstCpu, bool fPriorityO
         Assert(pUVM->aCpus[idDstCpu].vm.s.NativeThreadEMT == RTThreadNativeSelf());
         ppPriorityReqs = &pUVM->aCpus[idDstCpu].vm.s.pPriorityReqs;
         ppNormalReqs   = !fPriorityOnly ? &pUVM->aCpus[idDstCpu].vm.s.pNormalReqs : ppPriorityReqs;
+        pUVCpu         = &pUVM->aCpus[idDstCpu];
     }
 
     /*
@@ -1135,8 +1247,9 @@ VMMR3_INT_DECL(int) VMR3ReqProcessU(PUVM pUVM, VMCPUID idDstCpu, bool fPriorityO
         /*
          * Get the pending requests.
          *
-         * If there are more than one request, unlink the oldest and put the
-         * rest back so that we're reentrant.
+         * For the shared queue, if there are more than one request, unlink the
+         * oldest and put the rest back so that we're reentrant.  The queues of
+         * a specific CPU are drained in batches, see vmR3ReqDequeueCpu.
          */
         if (RT_LIKELY(pUVM->pVM))
         {
@@ -1146,8 +1259,20 @@ VMMR3_INT_DECL(int) VMR3ReqProcessU(PUVM pUVM, VMCPUID idDstCpu, bool fPriorityO
                 VMCPU_FF_CLEAR(pUVM->pVM->apCpusR3[idDstCpu], VMCPU_FF_REQUEST);
         }
 
-        PVMREQ pReq = ASMAtomicXchgPtrT(ppPriorityReqs, NULL, PVMREQ);
-        if (pReq)
+        PVMREQ pReq;
+        if (pUVCpu)
+        {
+            pReq = vmR3ReqDequeueCpu(pUVM, ppPriorityReqs, &pUVCpu->vm.s.pPriorityReqsFifo);
+            if (!pReq)
+            {
+                if (fPriorityOnly)
+                    break;
+                pReq = vmR3ReqDequeueCpu(pUVM, ppNormalReqs, &pUVCpu->vm.s.pNormalReqsFifo);
+                if (!pReq)
+                    break;
+            }
+        }
+        else if ((pReq = ASMAtomicXchgPtrT(ppPriorityReqs, NULL, PVMREQ)) != NULL)
         {
             if (RT_UNLIKELY(pReq->pNext))
                 pReq = vmR3ReqProcessUTooManyHelper(pUVM, idDstCpu, pReq, ppPriorityReqs);
@@ -1167,6 +1292,9 @@ VMMR3_INT_DECL(int) VMR3ReqProcessU(PUVM pUVM, VMCPUID idDstCpu, bool fPriorityO
          * Process the request
          */
         STAM_COUNTER_INC(&pUVM->vm.s.StatReqProcessed);
+#ifdef VBOX_WITH_STATISTICS
+        vmR3ReqRecordLatency(pUVM, pReq);
+#endif
         int rc2 = vmR3ReqProcessOne(pReq);
         if (    rc2 >= VINF_EM_FIRST
             &&  rc2 <= VINF_EM_LAST)
@@ -1176,6 +1304,11 @@ VMMR3_INT_DECL(int) VMR3ReqProcessU(PUVM pUVM, VMCPUID idDstCpu, bool fPriorityO
         }
     }
 
+    /* Make sure we get back to what's left of the batch. */
+    if (   pUVCpu
+        && (pUVCpu->vm.s.pPriorityReqsFifo || pUVCpu->vm.s.pNormalReqsFifo))
+        vmR3ReqSetFF(pUVM, idDstCpu);
+
     LogFlow(("VMR3ReqProcess: returns %Rrc (enmVMState=%d)\n", rc, pUVM->pVM ? pUVM->pVM->enmVMState : VMSTATE_CREATING));
     return rc;
 }
@@ -1206,90 +1339,7 @@ static int  vmR3ReqProcessOne(PVMREQ pReq)
          */
         case VMREQTYPE_INTERNAL:
         {
-            uintptr_t *pauArgs = &pReq->u.Internal.aArgs[0];
-            union
-            {
-                PFNRT pfn;
-                DECLCALLBACKMEMBER(int, pfn00)(void);
-                DECLCALLBACKMEMBER(int, pfn01)(uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn02)(uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn03)(uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn04)(uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn05)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn06)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn07)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn08)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn09)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn10)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn11)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn12)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn13)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn14)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-                DECLCALLBACKMEMBER(int, pfn15)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
-            } u;
-            u.pfn = pReq->u.Internal.pfn;
-#ifdef RT_ARCH_AMD64
-            switch (pReq->u.Internal.cArgs)
-            {
-                case 0:  rcRet = u.pfn00(); break;
-                case 1:  rcRet = u.pfn01(pauArgs[0]); break;
-                case 2:  rcRet = u.pfn02(pauArgs[0], pauArgs[1]); break;
-                case 3:  rcRet = u.pfn03(pauArgs[0], pauArgs[1], pauArgs[2]); break;
-                case 4:  rcRet = u.pfn04(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3]); break;
-                case 5:  rcRet = u.pfn05(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4]); break;
-                case 6:  rcRet = u.pfn06(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5]); break;
-                case 7:  rcRet = u.pfn07(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6]); break;
-                case 8:  rcRet = u.pfn08(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7]); break;
-                case 9:  rcRet = u.pfn09(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8]); break;
-                case 10: rcRet = u.pfn10(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9]); break;
-                case 11: rcRet = u.pfn11(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10]); break;
-                case 12: rcRet = u.pfn12(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10], pauArgs[11]); break;
-                case 13: rcRet = u.pfn13(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10], pauArgs[11], pauArgs[12]); break;
-                case 14: rcRet = u.pfn14(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10], pauArgs[11], pauArgs[12], pauArgs[13]); break;
-                case 15: rcRet = u.pfn15(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10], pauArgs[11], pauArgs[12], pauArgs[13], pauArgs[14]); break;
-                default:
-                    AssertReleaseMsgFailed(("cArgs=%d\n", pReq->u.Internal.cArgs));
-                    rcRet = rcReq = VERR_VM_REQUEST_TOO_MANY_ARGS_IPE;
-                    break;
-            }
-#else /* x86: */
-            size_t cbArgs = pReq->u.Internal.cArgs * sizeof(uintptr_t);
-# ifdef __GNUC__
-            __asm__ __volatile__("movl  %%esp, %%edx\n\t"
-                                 "subl  %2, %%esp\n\t"
-                                 "andl  $0xfffffff0, %%esp\n\t"
-                                 "shrl  $2, %2\n\t"
-                                 "movl  %%esp, %%edi\n\t"
-                                 "rep movsl\n\t"
-                                 "movl  %%edx, %%edi\n\t"
-                                 "call  *%%eax\n\t"
-                                 "mov   %%edi, %%esp\n\t"
-                                 : "=a" (rcRet),
-                                   "=S" (pauArgs),
-                                   "=c" (cbArgs)
-                                 : "0" (u.pfn),
-                                   "1" (pauArgs),
-                                   "2" (cbArgs)
-                                 : "edi", "edx");
-# else
-            __asm
-            {
-                xor     edx, edx        /* just mess it up. */
-                mov     eax, u.pfn
-                mov     ecx, cbArgs
-                shr     ecx, 2
-                mov     esi, pauArgs
-                mov     ebx, esp
-                sub     esp, cbArgs
-                and     esp, 0xfffffff0
-                mov     edi, esp
-                rep movsd
-                call    eax
-                mov     esp, ebx
-                mov     rcRet, eax
-            }
-# endif
-#endif /* x86 */
+            rcRet = vmR3ReqCallFunction(pReq->u.Internal.pfn, pReq->u.Internal.cArgs, &pReq->u.Internal.aArgs[0]);
             if ((pReq->fFlags & (VMREQFLAGS_RETURN_MASK)) == VMREQFLAGS_VOID)
                 rcRet = VINF_SUCCESS;
             rcReq = rcRet;
@@ -1331,3 +1381,101 @@ static int  vmR3ReqProcessOne(PVMREQ pReq)
     return rcRet;
 }
 
+
+/**
+ * Calls a function with a packed down argument vector.
+ *
+ * @returns The status returned by the function (garbage if void).
+ * @param   pfn         The function to call.
+ * @param   cArgs       Number of arguments.
+ * @param   pauArgs     The arguments.
+ */
+static int vmR3ReqCallFunction(PFNRT pfn, unsigned cArgs, uintptr_t *pauArgs)
+{
+    int rcRet = VINF_SUCCESS;
+    union
+    {
+        PFNRT pfn;
+        DECLCALLBACKMEMBER(int, pfn00)(void);
+        DECLCALLBACKMEMBER(int, pfn01)(uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn02)(uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn03)(uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn04)(uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn05)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn06)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn07)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn08)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn09)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn10)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn11)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn12)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn13)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn14)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+        DECLCALLBACKMEMBER(int, pfn15)(uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+    } u;
+    u.pfn = pfn;
+#ifdef RT_ARCH_AMD64
+    switch (cArgs)
+    {
+        case 0:  rcRet = u.pfn00(); break;
+        case 1:  rcRet = u.pfn01(pauArgs[0]); break;
+        case 2:  rcRet = u.pfn02(pauArgs[0], pauArgs[1]); break;
+        case 3:  rcRet = u.pfn03(pauArgs[0], pauArgs[1], pauArgs[2]); break;
+        case 4:  rcRet = u.pfn04(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3]); break;
+        case 5:  rcRet = u.pfn05(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4]); break;
+        case 6:  rcRet = u.pfn06(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5]); break;
+        case 7:  rcRet = u.pfn07(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6]); break;
+        case 8:  rcRet = u.pfn08(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7]); break;
+        case 9:  rcRet = u.pfn09(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8]); break;
+        case 10: rcRet = u.pfn10(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9]); break;
+        case 11: rcRet = u.pfn11(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10]); break;
+        case 12: rcRet = u.pfn12(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10], pauArgs[11]); break;
+        case 13: rcRet = u.pfn13(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10], pauArgs[11], pauArgs[12]); break;
+        case 14: rcRet = u.pfn14(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10], pauArgs[11], pauArgs[12], pauArgs[13]); break;
+        case 15: rcRet = u.pfn15(pauArgs[0], pauArgs[1], pauArgs[2], pauArgs[3], pauArgs[4], pauArgs[5], pauArgs[6], pauArgs[7], pauArgs[8], pauArgs[9], pauArgs[10], pauArgs[11], pauArgs[12], pauArgs[13], pauArgs[14]); break;
+        default:
+            AssertReleaseMsgFailed(("cArgs=%d\n", cArgs));
+            rcRet = VERR_VM_REQUEST_TOO_MANY_ARGS_IPE;
+            break;
+    }
+#else /* x86: */
+    size_t cbArgs = cArgs * sizeof(uintptr_t);
+# ifdef __GNUC__
+    __asm__ __volatile__("movl  %%esp, %%edx\n\t"
+                         "subl  %2, %%esp\n\t"
+                         "andl  $0xfffffff0, %%esp\n\t"
+                         "shrl  $2, %2\n\t"
+                         "movl  %%esp, %%edi\n\t"
+                         "rep movsl\n\t"
+                         "movl  %%edx, %%edi\n\t"
+                         "call  *%%eax\n\t"
+                         "mov   %%edi, %%esp\n\t"
+                         : "=a" (rcRet),
+                           "=S" (pauArgs),
+                           "=c" (cbArgs)
+                         : "0" (u.pfn),
+                           "1" (pauArgs),
+                           "2" (cbArgs)
+                         : "edi", "edx");
+# else
+    __asm
+    {
+        xor     edx, edx        /* just mess it up. */
+        mov     eax, u.pfn
+        mov     ecx, cbArgs
+        shr     ecx, 2
+        mov     esi, pauArgs
+        mov     ebx, esp
+        sub     esp, cbArgs
+        and     esp, 0xfffffff0
+        mov     edi, esp
+        rep movsd
+        call    eax
+        mov     esp, ebx
+        mov     rcRet, eax
+    }
+# endif
+#endif /* x86 */
+    return rcRet;
+}
+
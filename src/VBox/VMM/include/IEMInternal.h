@@ -74,7 +74,18 @@ RT_C_DECLS_BEGIN
 #endif
 
 
-//#define IEM_WITH_CODE_TLB// - work in progress
+/** @def IEM_WITH_CODE_TLB
+ * Enables the instruction TLB and decoding directly out of the guest page
+ * mapping (IEMCPU::pbInstrBuf) instead of the abOpcode prefetch buffer. */
+#define IEM_WITH_CODE_TLB
+
+/** @def IEM_WITH_THREADED_EXEC
+ * Enables the optional ring-3 translation block cache used by IEMExecLots
+ * when the IEM/ThreadedExec config value is set.  Requires IEM_WITH_CODE_TLB
+ * as the blocks are validated against the guest page mapping. */
+#if (defined(IN_RING3) && defined(IEM_WITH_CODE_TLB)) || defined(DOXYGEN_RUNNING)
+# define IEM_WITH_THREADED_EXEC
+#endif
 
 
 #if !defined(IN_TSTVMSTRUCT) && !defined(DOXYGEN_RUNNING)
@@ -287,8 +298,8 @@ typedef IEMTLBENTRY *PIEMTLBENTRY;
 #define IEMTLBE_F_PT_NO_USER        RT_BIT_64(2) /**< Page tables: Not user accessible (supervisor only). */
 #define IEMTLBE_F_PG_NO_WRITE       RT_BIT_64(3) /**< Phys page:   Not writable (access handler, ROM, whatever). */
 #define IEMTLBE_F_PG_NO_READ        RT_BIT_64(4) /**< Phys page:   Not readable (MMIO / access handler, ROM) */
-#define IEMTLBE_F_PT_NO_DIRTY       RT_BIT_64(5) /**< Page tables: Not dirty (needs to be made dirty on write). */
-#define IEMTLBE_F_NO_MAPPINGR3      RT_BIT_64(6) /**< TLB entry:   The IEMTLBENTRY::pMappingR3 member is invalid. */
+#define IEMTLBE_F_PT_NO_DIRTY       RT_BIT_64(6) /**< Page tables: Not dirty (needs to be made dirty on write). */
+#define IEMTLBE_F_NO_MAPPINGR3      RT_BIT_64(7) /**< TLB entry:   The IEMTLBENTRY::pMappingR3 member is invalid. */
 #define IEMTLBE_F_PHYS_REV          UINT64_C(0xffffffffffffff00) /**< Physical revision mask. */
 /** @} */
 
@@ -354,6 +365,145 @@ AssertCompileSizeAlignment(IEMTLB, 64);
 #define IEMTLB_PHYS_REV_INCR    RT_BIT_64(8)
 
 
+/** Max number of calls (instructions) in a translation block. */
+#define IEMTB_MAX_CALLS             32
+/** Max number of opcode bytes in a translation block. */
+#define IEMTB_MAX_OPCODES           256
+/** Number of translation blocks in the per-CPU cache. */
+#define IEMTBCACHE_TB_COUNT         512
+/** Number of hash table buckets in the per-CPU cache (power of two). */
+#define IEMTBCACHE_HASH_SIZE        1024
+
+/**
+ * A pre-decoded instruction in a translation block.
+ *
+ * The register indexes, operand size and immediate are taken from the decoder
+ * state after the instruction was interpreted successfully the first time, so
+ * replaying it only has to run the IEM_MC microcode of the instruction.
+ */
+typedef struct IEMTBCALL
+{
+    /** Immediate, relative displacement or implementation table pointer. */
+    uint64_t                uParam;
+    /** Offset of the instruction bytes into IEMTB::abOpcodes. */
+    uint16_t                offOpcode;
+    /** The instruction length. */
+    uint8_t                 cbInstr;
+    /** The threaded function index, zero (generic) means decoding it again. */
+    uint8_t                 idxFunc;
+    /** Destination general register index, or the Jcc condition. */
+    uint8_t                 iReg1;
+    /** Source general register index. */
+    uint8_t                 iReg2;
+    /** The effective operand size (IEMMODE) the decoder ended up with. */
+    uint8_t                 enmEffOpSize;
+    /** IEMTBCALL_F_XXX. */
+    uint8_t                 fFlags;
+    /** The prefixes the decoder ended up with (IEM_OP_PRF_XXX). */
+    uint32_t                fPrefixes;
+    /** Explicit padding. */
+    uint32_t                u32Padding;
+} IEMTBCALL;
+AssertCompileSize(IEMTBCALL, 24);
+/** Pointer to a const translation block call entry. */
+typedef IEMTBCALL const *PCIEMTBCALL;
+
+/** @name IEMTBCALL_F_XXX - Translation block call flags.
+ * @{ */
+/** Clear bits 63:32 of the 32-bit destination register. */
+#define IEMTBCALL_F_CLEAR_HIGH      RT_BIT(0)
+/** The instruction may have written to guest memory, so the rest of the
+ * block must be checked against the guest page before continuing. */
+#define IEMTBCALL_F_RECHECK         RT_BIT(1)
+/** @} */
+
+/**
+ * A translation block - a run of straight-line guest code within one page.
+ */
+typedef struct IEMTB
+{
+    /** Next block in the hash bucket. */
+    struct IEMTB           *pNext;
+    /** The last blocks executed after this one (chaining). */
+    struct IEMTB           *apSuccessors[2];
+    /** The flat PC of the first instruction. */
+    RTGCPTR                 GCPtrPc;
+    /** The CPU mode and CPL the block was translated for. */
+    uint32_t                fFlags;
+    /** The CS limit the opcode fetches were checked against. */
+    uint32_t                u32CsLimit;
+    /** Number of valid entries in aCalls, zero while being (re)recorded. */
+    uint8_t                 cCalls;
+    /** Next apSuccessors entry to replace. */
+    uint8_t                 iNextSuccessor;
+    /** Number of valid bytes in abOpcodes. */
+    uint16_t                cbOpcodes;
+    /** Explicit padding. */
+    uint32_t                u32Padding;
+    /** The pre-decoded instructions. */
+    IEMTBCALL               aCalls[IEMTB_MAX_CALLS];
+    /** Copy of the opcode bytes, compared with the guest page on entry. */
+    uint8_t                 abOpcodes[IEMTB_MAX_OPCODES];
+} IEMTB;
+/** Pointer to a translation block. */
+typedef IEMTB *PIEMTB;
+
+/**
+ * The per-CPU translation block cache (ring-3 only, see
+ * IEM_WITH_THREADED_EXEC).
+ */
+typedef struct IEMTBCACHE
+{
+    /** The block being executed, NULL if none. */
+    PIEMTB                  pCurTb;
+    /** The next call to execute in pCurTb. */
+    uint32_t                iCurCall;
+    /** Offset of pCurTb into the pbValidated buffer. */
+    uint32_t                offValidated;
+    /** The instruction buffer pCurTb was validated against. */
+    uint8_t const          *pbValidated;
+    /** IEMCPU::uInstrBufPc of pbValidated. */
+    uint64_t                uValidatedBufPc;
+    /** The code TLB revision when pCurTb was validated. */
+    uint64_t                uValidatedTlbRev;
+    /** The previously executed block, for chaining. */
+    PIEMTB                  pPrevTb;
+
+    /** The block being recorded, NULL if none. */
+    PIEMTB                  pRecTb;
+    /** The flat PC of the next instruction to record. */
+    RTGCPTR                 GCPtrRecNextPc;
+    /** IEMCPU::uInstrBufPc of the page being recorded. */
+    uint64_t                uRecBufPc;
+    /** Number of calls recorded so far. */
+    uint32_t                cRecCalls;
+    /** Number of opcode bytes recorded so far. */
+    uint32_t                cbRecOpcodes;
+
+    /** Number of blocks handed out from aTbs. */
+    uint32_t                cUsedTbs;
+    uint32_t                u32Padding;
+    /** The hash table. */
+    PIEMTB                  apHash[IEMTBCACHE_HASH_SIZE];
+
+    /** @name Statistics
+     * @{ */
+    STAMCOUNTER             StatLookupHits;
+    STAMCOUNTER             StatChainHits;
+    STAMCOUNTER             StatLookupMisses;
+    STAMCOUNTER             StatInvalidations;
+    STAMCOUNTER             StatFlushes;
+    STAMCOUNTER             StatThreadedCalls;
+    STAMCOUNTER             StatGenericCalls;
+    /** @} */
+
+    /** The blocks. */
+    IEMTB                   aTbs[IEMTBCACHE_TB_COUNT];
+} IEMTBCACHE;
+/** Pointer to a translation block cache. */
+typedef IEMTBCACHE *PIEMTBCACHE;
+
+
 /**
  * The per-CPU IEM state.
  */
@@ -605,7 +755,11 @@ typedef struct IEMCPU
     /** Counts WRMSR \#GP(0) LogRel(). */
     uint8_t                 cLogRelWrMsr;
     /** Alignment padding. */
-    uint8_t                 abAlignment8[50];
+    uint8_t                 abAlignment8[42];
+    /** The CodeTlb.uTlbPhysRev value pbInstrBuf was set up with.
+     * The buffer is only reused by the next instruction when this still matches,
+     * so that PGM changes to the page (handlers, remapping, freeing) are caught. */
+    uint64_t                uInstrBufPhysRev;
 
     /** Data TLB.
      * @remarks Must be 64-byte aligned. */
@@ -620,6 +774,8 @@ typedef struct IEMCPU
     R3PTRTYPE(PIEMINSTRSTATS) pStatsCCR3;
     /** Pointer to instruction statistics for ring-3 context. */
     R3PTRTYPE(PIEMINSTRSTATS) pStatsR3;
+    /** The translation block cache, NULL if threaded execution is disabled. */
+    R3PTRTYPE(PIEMTBCACHE)  pTbCacheR3;
 } IEMCPU;
 AssertCompileMemberOffset(IEMCPU, fCurXcpt, 0x48);
 AssertCompileMemberAlignment(IEMCPU, DataTlb, 64);
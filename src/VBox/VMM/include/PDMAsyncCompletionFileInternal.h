@@ -26,6 +26,7 @@
 #include <VBox/vmm/tm.h>
 #include <iprt/types.h>
 #include <iprt/file.h>
+#include <iprt/ioqueue.h>
 #include <iprt/thread.h>
 #include <iprt/semaphore.h>
 #include <iprt/critsect.h>
@@ -100,6 +101,8 @@ typedef enum PDMACEPFILEMGRTYPE
     PDMACEPFILEMGRTYPE_SIMPLE = 0,
     /** Async I/O with host cache enabled. */
     PDMACEPFILEMGRTYPE_ASYNC,
+    /** Async I/O using the RTIoQueue API (io_uring on Linux). */
+    PDMACEPFILEMGRTYPE_IOQUEUE,
     /** 32bit hack */
     PDMACEPFILEMGRTYPE_32BIT_HACK = 0x7fffffff
 } PDMACEPFILEMGRTYPE;
@@ -176,6 +179,12 @@ typedef struct PDMACEPFILEMGR
     unsigned                               cReqEntries;
     /** Memory cache for file range locks. */
     RTMEMCACHE                             hMemCacheRangeLocks;
+    /** The I/O queue for this manager (PDMACEPFILEMGRTYPE_IOQUEUE only). */
+    RTIOQUEUE                              hIoQueue;
+    /** Completion event array, cRequestsActiveMax entries (PDMACEPFILEMGRTYPE_IOQUEUE only). */
+    PRTIOQUEUECEVT                         paIoQueueCEvts;
+    /** Number of prepared requests waiting to be committed (PDMACEPFILEMGRTYPE_IOQUEUE only). */
+    uint32_t                               cIoQueueReqsPrepared;
     /** Number of milliseconds to wait until the bandwidth is refreshed for at least
      * one endpoint and it is possible to process more requests. */
     RTMSINTERVAL                           msBwLimitExpired;
@@ -274,6 +283,14 @@ typedef struct PDMASYNCCOMPLETIONEPCLASSFILE
     RTR3UINTPTR                         uBitmaskAlignment;
     /** Flag whether the out of resources warning was printed already. */
     bool                                fOutOfResourcesWarningPrinted;
+    /** Flag whether the I/O queue managers should use the kernel submission queue polling. */
+    bool                                fIoQueueSqPoll;
+    /** Flag whether the I/O queue managers should register the files up front. */
+    bool                                fIoQueueFixedFiles;
+    /** Maximum number of requests an I/O queue manager has in flight. */
+    uint32_t                            cIoQueueDepth;
+    /** The I/O queue provider used for PDMACEPFILEMGRTYPE_IOQUEUE managers. */
+    PCRTIOQUEUEPROVVTABLE               pIoQueueProv;
 #ifdef PDM_ASYNC_COMPLETION_FILE_WITH_DELAY
     /** Timer for delayed request completion. */
     PTMTIMERR3                          pTimer;
@@ -530,11 +547,67 @@ typedef struct PDMASYNCCOMPLETIONTASKFILE
 #endif
 } PDMASYNCCOMPLETIONTASKFILE;
 
+/**
+ * Put a list of tasks in the pending request list of an endpoint.
+ */
+DECLINLINE(void) pdmacFileAioMgrEpAddTaskList(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, PPDMACTASKFILE pTaskHead)
+{
+    /* Add the rest of the tasks to the pending list */
+    if (!pEndpoint->AioMgr.pReqsPendingHead)
+    {
+        Assert(!pEndpoint->AioMgr.pReqsPendingTail);
+        pEndpoint->AioMgr.pReqsPendingHead = pTaskHead;
+    }
+    else
+    {
+        Assert(pEndpoint->AioMgr.pReqsPendingTail);
+        pEndpoint->AioMgr.pReqsPendingTail->pNext = pTaskHead;
+    }
+
+    /* Update the tail. */
+    while (pTaskHead->pNext)
+        pTaskHead = pTaskHead->pNext;
+
+    pEndpoint->AioMgr.pReqsPendingTail = pTaskHead;
+    pTaskHead->pNext = NULL;
+}
+
+/**
+ * Put one task in the pending request list of an endpoint.
+ */
+DECLINLINE(void) pdmacFileAioMgrEpAddTask(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, PPDMACTASKFILE pTask)
+{
+    /* Add the rest of the tasks to the pending list */
+    if (!pEndpoint->AioMgr.pReqsPendingHead)
+    {
+        Assert(!pEndpoint->AioMgr.pReqsPendingTail);
+        pEndpoint->AioMgr.pReqsPendingHead = pTask;
+    }
+    else
+    {
+        Assert(pEndpoint->AioMgr.pReqsPendingTail);
+        pEndpoint->AioMgr.pReqsPendingTail->pNext = pTask;
+    }
+
+    pEndpoint->AioMgr.pReqsPendingTail = pTask;
+    pTask->pNext = NULL;
+}
+
 DECLCALLBACK(int) pdmacFileAioMgrFailsafe(RTTHREAD hThreadSelf, void *pvUser);
 DECLCALLBACK(int) pdmacFileAioMgrNormal(RTTHREAD hThreadSelf, void *pvUser);
+DECLCALLBACK(int) pdmacFileAioMgrIoQueue(RTTHREAD hThreadSelf, void *pvUser);
 
 int pdmacFileAioMgrNormalInit(PPDMACEPFILEMGR pAioMgr);
 void pdmacFileAioMgrNormalDestroy(PPDMACEPFILEMGR pAioMgr);
+bool pdmacFileAioMgrNormalIsRangeLocked(PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint, RTFOFF offStart, size_t cbRange,
+                                        PPDMACTASKFILE pTask, bool fAlignedReq);
+int pdmacFileAioMgrNormalRangeLock(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                   RTFOFF offStart, size_t cbRange, PPDMACTASKFILE pTask, bool fAlignedReq);
+PPDMACTASKFILE pdmacFileAioMgrNormalRangeLockFree(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONENDPOINTFILE pEndpoint,
+                                                  PPDMACFILERANGELOCK pRangeLock);
+
+int pdmacFileAioMgrIoQueueInit(PPDMACEPFILEMGR pAioMgr, PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass);
+void pdmacFileAioMgrIoQueueDestroy(PPDMACEPFILEMGR pAioMgr);
 
 int pdmacFileAioMgrCreate(PPDMASYNCCOMPLETIONEPCLASSFILE pEpClass, PPPDMACEPFILEMGR ppAioMgr, PDMACEPFILEMGRTYPE enmMgrType);
 
@@ -44,6 +44,8 @@ RT_C_DECLS_BEGIN
 typedef struct PDMBLKLRULIST *PPDMBLKLRULIST;
 /** Pointer to the global cache structure. */
 typedef struct PDMBLKCACHEGLOBAL *PPDMBLKCACHEGLOBAL;
+/** Pointer to a cache shard. */
+typedef struct PDMBLKCACHESHARD *PPDMBLKCACHESHARD;
 /** Pointer to a cache entry waiter structure. */
 typedef struct PDMBLKCACHEWAITER *PPDMBLKCACHEWAITER;
 
@@ -62,6 +64,8 @@ typedef struct PDMBLKCACHEENTRY
     PPDMBLKLRULIST                  pList;
     /** Cache the entry belongs to. */
     PPDMBLKCACHE                    pBlkCache;
+    /** The shard whose LRU lists the entry lives in, fixed for the lifetime of the entry. */
+    PPDMBLKCACHESHARD               pShard;
     /** Flags for this entry. Combinations of PDMACFILECACHE_* \#defines */
     volatile uint32_t               fFlags;
     /** Reference counter. Prevents eviction of the entry if > 0. */
@@ -99,19 +103,29 @@ typedef struct PDMBLKLRULIST
     uint32_t          cbCached;
 } PDMBLKLRULIST;
 
+/** Maximum number of shards the cache can be split into. */
+#define PDMBLKCACHE_SHARDS_MAX          16
+/** Minimum number of bytes a shard should be able to cache. */
+#define PDMBLKCACHE_SHARD_SIZE_MIN      _1M
+/** Log2 of the granularity the medium is distributed over the shards. */
+#define PDMBLKCACHE_SHARD_SHIFT         20
+
 /**
- * Global cache data.
+ * A cache shard.
+ *
+ * Every shard manages its own set of 2Q lists with a fraction of the global
+ * byte budget under its own lock. Entries are assigned to a shard based on the
+ * endpoint and the offset so that concurrent I/O to different disks or
+ * different regions of the same disk don't contend for a single lock.
  */
-typedef struct PDMBLKCACHEGLOBAL
+typedef struct PDMBLKCACHESHARD
 {
-    /** Pointer to the owning VM instance. */
-    PVM                 pVM;
-    /** Maximum size of the cache in bytes. */
+    /** Critical section protecting the lists of this shard. */
+    RTCRITSECT          CritSect;
+    /** Maximum size of the shard in bytes. */
     uint32_t            cbMax;
-    /** Current size of the cache in bytes. */
+    /** Current size of the shard in bytes. */
     uint32_t            cbCached;
-    /** Critical section protecting the cache. */
-    RTCRITSECT          CritSect;
     /** Maximum number of bytes cached. */
     uint32_t            cbRecentlyUsedInMax;
     /** Maximum number of bytes in the paged out list .*/
@@ -122,6 +136,34 @@ typedef struct PDMBLKCACHEGLOBAL
     PDMBLKLRULIST       LruRecentlyUsedOut;
     /** List of frequently used cache entries */
     PDMBLKLRULIST       LruFrequentlyUsed;
+#ifdef VBOX_WITH_STATISTICS
+    /** Number of times the shard lock was acquired. */
+    STAMCOUNTER         StatLockEnter;
+    /** Number of times the shard lock was already owned by another thread. */
+    STAMCOUNTER         StatLockContention;
+#endif
+} PDMBLKCACHESHARD;
+#ifdef VBOX_WITH_STATISTICS
+AssertCompileMemberAlignment(PDMBLKCACHESHARD, StatLockEnter, sizeof(uint64_t));
+#endif
+
+/**
+ * Global cache data.
+ */
+typedef struct PDMBLKCACHEGLOBAL
+{
+    /** Pointer to the owning VM instance. */
+    PVM                 pVM;
+    /** Maximum size of the cache in bytes. */
+    uint32_t            cbMax;
+    /** Number of shards in use, power of two. */
+    uint32_t            cShards;
+    /** Critical section protecting the list of users and the commit state. */
+    RTCRITSECT          CritSect;
+    /** The shards holding the cached data. */
+    PDMBLKCACHESHARD    aShards[PDMBLKCACHE_SHARDS_MAX];
+    /** Seed handed to the next user for spreading its entries over the shards. */
+    uint32_t            uShardSeedNext;
     /** Commit timeout in milli seconds */
     uint32_t            u32CommitTimeoutMs;
     /** Number of dirty bytes needed to start a commit of the data to the disk. */
@@ -191,6 +233,8 @@ typedef struct PDMBLKCACHE
     RTSEMRW                       SemRWEntries;
     /** Pointer to the gobal cache data */
     PPDMBLKCACHEGLOBAL            pCache;
+    /** Seed for selecting the shard of an entry. */
+    uint32_t                      uShardSeed;
     /** Lock protecting the dirty entries list. */
     RTSPINLOCK                    LockList;
     /** List of dirty but not committed entries for this endpoint. */
@@ -932,6 +932,12 @@ typedef struct PDMQUEUE
     uint32_t volatile               iFreeHead;
     /** Index to the free tail (where we remove). */
     uint32_t volatile               iFreeTail;
+    /** Set by the insert starting a new batch of pending items and cleared when
+     * the queue is checked for flushing.  Only that insert raises
+     * VM_FF_PDM_QUEUES, the following ones coalesce with it. */
+    uint32_t volatile               fBatchPending;
+    /** Number of items inserted but not yet consumed. */
+    uint32_t volatile               cPending;
 
     /** Unique queue name. */
     R3PTRTYPE(const char *)         pszName;
@@ -946,12 +952,19 @@ typedef struct PDMQUEUE
     STAMCOUNTER                     StatFlush;
     /** Stat: Queue flushes with pending items left over. */
     STAMCOUNTER                     StatFlushLeftovers;
+    /** Stat: Inserts joining an already pending batch (no FF raised). */
+    STAMCOUNTER                     StatInsertCoalesced;
+    /** Stat: Timer driven flushes brought forward because the queue filled up. */
+    STAMCOUNTER                     StatFlushEarly;
 #ifdef VBOX_WITH_STATISTICS
     /** State: Profiling the flushing. */
     STAMPROFILE                     StatFlushPrf;
-    /** State: Pending items. */
-    uint32_t volatile               cStatPending;
-    uint32_t volatile               cAlignment;
+    /** Stat: Number of items taken off the queue per flush. */
+    STAMPROFILE                     StatFlushBatch;
+    /** Stat: Time from the first insert of a batch till the flusher gets to it. */
+    STAMPROFILE                     StatLatency;
+    /** RTTimeNanoTS of the first insert of the current batch. */
+    uint64_t volatile               u64BatchStartNS;
 #endif
 
     /** Array of pointers to free items. Variable size. */
@@ -23,6 +23,11 @@
 
 /**
  * Bandwidth group instance data
+ *
+ * Groups can be nested (e.g. host -> tenant -> VM -> NIC) by naming a parent
+ * group in the configuration.  A transfer must fit into the token bucket of
+ * the group and every one of its ancestors.  All groups in a tree are
+ * serialized by the critical section of the root group.
  */
 typedef struct PDMNSBWGROUP
 {
@@ -30,8 +35,13 @@ typedef struct PDMNSBWGROUP
     R3PTRTYPE(struct PDMNSBWGROUP *)            pNextR3;
     /** Pointer to the shared UVM structure. */
     R3PTRTYPE(struct PDMNETSHAPER *)            pShaperR3;
-    /** Critical section protecting all members below. */
+    /** Critical section protecting all members below, of this group and all
+     * its descendants.  Only used for root groups. */
     PDMCRITSECT                                 Lock;
+    /** Pointer to the parent group, NULL for root groups (ring-3). */
+    R3PTRTYPE(struct PDMNSBWGROUP *)            pParentR3;
+    /** Pointer to the parent group, NIL for root groups (ring-0). */
+    R0PTRTYPE(struct PDMNSBWGROUP *)            pParentR0;
     /** Pointer to the first filter attached to this group. */
     R3PTRTYPE(struct PDMNSFILTER *)             pFiltersHeadR3;
     /** Bandwidth group name. */
@@ -44,8 +54,25 @@ typedef struct PDMNSBWGROUP
     volatile uint32_t                           cbTokensLast;
     /** Timestamp of the last update */
     volatile uint64_t                           tsUpdatedLast;
-    /** Reference counter - How many filters are associated with this group. */
+    /** The configured burst size in bytes, 0 if the bucket size should be
+     * derived from cbPerSecMax. */
+    uint32_t                                    cbBurstCfg;
+    /** Sum of the weights of the filters attached to this group. */
+    volatile uint32_t                           uWeightTotal;
+    /** Number of attached filters currently choked. */
+    volatile uint32_t                           cFiltersChoked;
+    /** Reference counter - How many filters and child groups are associated
+     * with this group. */
     volatile uint32_t                           cRefs;
+    /** Number of bytes transmitted by filters attached to this group. */
+    STAMCOUNTER                                 StatBytesTransmitted;
+    /** Number of times a filter of this group was choked. */
+    STAMCOUNTER                                 StatChoked;
+    /** Number of transfers which went beyond the weighted share of the filter,
+     * borrowing bandwidth unused by the other filters. */
+    STAMCOUNTER                                 StatBorrowed;
+    /** How long filters stay choked before being told to resume. */
+    STAMPROFILE                                 StatChokedLatency;
 } PDMNSBWGROUP;
 /** Pointer to a bandwidth group. */
 typedef PDMNSBWGROUP *PPDMNSBWGROUP;
@@ -676,8 +676,9 @@ typedef union PGMPAGE
         /** 3:2   - Paging structure needed to map the page
          * (PGM_PAGE_PDE_TYPE_*). */
         uint64_t    u2PDETypeY          : 2;
-        /** 4     - Unused (was used by FTE for dirty tracking). */
-        uint64_t    fUnused1            : 1;
+        /** 4     - Flag indicating that the page content is still in the saved
+         *  state file and must be restored before the page is accessed. */
+        uint64_t    fLazyRestoreY       : 1;
         /** 5     - Flag indicating that a write monitored page was written to
          *  when set. */
         uint64_t    fWrittenToY         : 1;
@@ -1018,6 +1019,29 @@ typedef PPGMPAGE *PPPGMPAGE;
  */
 #define PGM_PAGE_IS_WRITTEN_TO(a_pPage)         ( (a_pPage)->s.fWrittenToY )
 
+/**
+ * Marks the page as pending lazy restore from the saved state file.
+ * @param   a_pVM       The VM handle, only used for lock ownership assertions.
+ * @param   a_pPage     Pointer to the physical guest page tracking structure.
+ */
+#define PGM_PAGE_SET_LAZY_RESTORE(a_pVM, a_pPage) \
+    do { (a_pPage)->s.fLazyRestoreY = 1; PGM_PAGE_ASSERT_LOCK(a_pVM); } while (0)
+
+/**
+ * Clears the lazy restore indicator.
+ * @param   a_pVM       The VM handle, only used for lock ownership assertions.
+ * @param   a_pPage     Pointer to the physical guest page tracking structure.
+ */
+#define PGM_PAGE_CLEAR_LAZY_RESTORE(a_pVM, a_pPage) \
+    do { (a_pPage)->s.fLazyRestoreY = 0; PGM_PAGE_ASSERT_LOCK(a_pVM); } while (0)
+
+/**
+ * Checks if the page content is still pending lazy restore.
+ * @returns true/false.
+ * @param   a_pPage     Pointer to the physical guest page tracking structure.
+ */
+#define PGM_PAGE_IS_LAZY_RESTORE(a_pPage)       ( (a_pPage)->s.fLazyRestoreY )
+
 
 /** @name PT usage values (PGMPAGE::u2PDEType).
  *
@@ -1238,8 +1262,11 @@ typedef struct PGMLIVESAVERAMPAGE
     uint32_t    fWriteMonitored : 1;
     /** Whether the page is/was write monitored earlier in this pass. */
     uint32_t    fWriteMonitoredJustNow : 1;
+    /** Set by the RAM scanning workers when the page needs to be processed by
+     * the PGM lock owner (pgmR3ScanRamPages). */
+    uint32_t    fScanDeferred : 1;
     /** Bits reserved for future use. */
-    uint32_t    u2Reserved : 2;
+    uint32_t    u1Reserved : 1;
 #ifdef PGMLIVESAVERAMPAGE_WITH_CRC32
     /** CRC-32 for the page. This is for internal consistency checks. */
     uint32_t    u32Crc;
@@ -1257,6 +1284,83 @@ typedef PGMLIVESAVERAMPAGE *PPGMLIVESAVERAMPAGE;
 #define PGMLIVSAVEPAGE_MAX_DIRTIED 0x00fffff0
 
 
+/**
+ * Entry in the saved state duplicate page index (PGM::paSaveDupIdx).
+ */
+typedef struct PGMSAVEDUPENTRY
+{
+    /** The hash of the page content. */
+    uint64_t    uHash;
+    /** The guest physical address of the page last saved with this hash,
+     * NIL_RTGCPHYS if the entry is unused. */
+    RTGCPHYS    GCPhys;
+} PGMSAVEDUPENTRY;
+/** Pointer to a saved state duplicate page index entry. */
+typedef PGMSAVEDUPENTRY *PPGMSAVEDUPENTRY;
+
+
+/**
+ * Lazy restore tracking for one RAM range.
+ */
+typedef struct PGMLAZYRESTORERAM
+{
+    /** The RAM range (only used for identification). */
+    R3PTRTYPE(struct PGMRAMRANGE *) pRam;
+    /** The start address of the RAM range. */
+    RTGCPHYS                        GCPhys;
+    /** The number of pages in the RAM range. */
+    uint32_t                        cPages;
+    /** The number of pages in the range pending restore. */
+    uint32_t                        cPagesLeft;
+    /** The saved state file offset of each page, 0 if not pending.
+     * Allocated on demand. */
+    R3PTRTYPE(uint64_t *)           paoffPages;
+} PGMLAZYRESTORERAM;
+/** Pointer to the lazy restore tracking of a RAM range. */
+typedef PGMLAZYRESTORERAM *PPGMLAZYRESTORERAM;
+
+/**
+ * Lazy (post-copy) restore of RAM from a saved state file.
+ *
+ * The RAM pages are left in the saved state file when loading and are read
+ * in when first accessed, or by a prefetch thread in the background.  The
+ * pages pending restore are marked by PGM_PAGE_IS_LAZY_RESTORE and covered by
+ * physical access handlers so the guest cannot get at them directly.
+ *
+ * This is referenced by the PGM::pLazyRestoreR3 and by each batch queued by
+ * the prefetch thread, and freed when the last reference goes away.
+ */
+typedef struct PGMLAZYRESTORE
+{
+    /** Reference counter. */
+    uint32_t volatile               cRefs;
+    /** The cross context VM structure (for the prefetch thread). */
+    PVMR3                           pVM;
+    /** Set when the prefetch thread should quit. */
+    bool volatile                   fCancel;
+    /** The saved state file. */
+    RTFILE                          hFile;
+    /** The prefetch thread, NIL_RTTHREAD if not running. */
+    RTTHREAD                        hThread;
+    /** Signalled when a prefetch batch has been processed. */
+    RTSEMEVENT                      hEvtBatchDone;
+    /** The number of prefetch batches queued on the EMTs. */
+    uint32_t volatile               cBatchesQueued;
+    /** The total number of pages pending restore. */
+    uint32_t volatile               cPagesLeft;
+    /** The number of access handlers in paHandlers. */
+    uint32_t                        cHandlers;
+    /** The start addresses of the registered access handlers. */
+    R3PTRTYPE(RTGCPHYS *)           paHandlers;
+    /** The number of entries in aRams. */
+    uint32_t                        cRams;
+    /** Per RAM range tracking (variable size). */
+    PGMLAZYRESTORERAM               aRams[1];
+} PGMLAZYRESTORE;
+/** Pointer to the lazy restore state. */
+typedef PGMLAZYRESTORE *PPGMLAZYRESTORE;
+
+
 /**
  * RAM range for GC Phys to HC Phys conversion.
  *
@@ -3155,8 +3259,8 @@ typedef struct PGM
 
     /** Physical access handler type for ROM protection. */
     PGMPHYSHANDLERTYPE              hRomPhysHandlerType;
-    /** Alignment padding.   */
-    uint32_t                        u32Padding;
+    /** Physical access handler type for RAM pending lazy restore. */
+    PGMPHYSHANDLERTYPE              hLazyRestorePhysHandlerType;
 
     /** 4 MB page mask; 32 or 36 bits depending on PSE-36 (identical for all VCPUs) */
     RTGCPHYS                        GCPhys4MBPSEMask;
@@ -3394,8 +3498,11 @@ typedef struct PGM
         uint32_t                    cIgnoredPages;
         /** Indicates that a live save operation is active. */
         bool                        fActive;
+        /** Indicates that the final RAM pages are saved in blocks laid out for
+         * lazy restore (PGM_STATE_REC_RAM_BLOCK). */
+        bool                        fRamBlocks;
         /** Padding. */
-        bool                        afReserved[2];
+        bool                        afReserved[1];
         /** The next history index. */
         uint8_t                     iDirtyPagesHistory;
         /** History of the total amount of dirty pages. */
@@ -3413,9 +3520,24 @@ typedef struct PGM
         uint64_t                    uSaveStartNS;
         /** Pages per second (for statistics). */
         uint32_t                    cPagesPerSecond;
-        uint32_t                    cAlignment;
+        /** The number of RAM scanning worker threads in hScanPool. */
+        uint32_t                    cScanWorkers;
+        /** Worker thread pool for scanning RAM pages, NIL_RTREQPOOL if the
+         * scanning is done on the calling thread only. */
+        R3PTRTYPE(struct RTREQPOOLINT *) hScanPool;
     } LiveSave;
 
+    /** Duplicate page index used while saving RAM pages, NULL if not saving or
+     * disabled.  This is direct mapped by the page hash. */
+    R3PTRTYPE(PPGMSAVEDUPENTRY)     paSaveDupIdx;
+    /** The index mask for paSaveDupIdx. */
+    uint32_t                        fSaveDupIdxMask;
+    /** The number of pages saved as duplicates of other pages. */
+    uint32_t                        cSaveDupPages;
+
+    /** Lazy restore of RAM from the saved state file, NULL if not active. */
+    R3PTRTYPE(PPGMLAZYRESTORE)      pLazyRestoreR3;
+
     /** @name   Error injection.
      * @{ */
     /** Inject handy page allocation errors pretending we're completely out of
@@ -3452,6 +3574,9 @@ typedef struct PGM
     STAMCOUNTER                     StatLargePageRecheck;   /**< The number of times we rechecked a disabled large page.*/
 
     STAMPROFILE                     StatShModCheck;         /**< Profiles shared module checks. */
+
+    STAMCOUNTER                     StatLazyRestoreFaults;     /**< Pages restored lazily on access. */
+    STAMCOUNTER                     StatLazyRestorePrefetched; /**< Pages restored lazily by the prefetcher. */
     /** @} */
 
 #ifdef VBOX_WITH_STATISTICS
@@ -3945,6 +4070,9 @@ bool            pgmHandlerPhysicalIsAll(PVMCC pVM, RTGCPHYS GCPhys);
 void            pgmHandlerPhysicalResetAliasedPage(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS GCPhysPage, bool fDoAccounting);
 DECLCALLBACK(void) pgmR3InfoHandlers(PVM pVM, PCDBGFINFOHLP pHlp, const char *pszArgs);
 int             pgmR3InitSavedState(PVM pVM, uint64_t cbRam);
+int             pgmR3LazyRestorePage(PVM pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
+void            pgmR3LazyRestoreAbort(PVM pVM);
+FNPGMPHYSHANDLER pgmR3LazyRestoreAccessHandler;
 
 int             pgmPhysAllocPage(PVMCC pVM, PPGMPAGE pPage, RTGCPHYS GCPhys);
 int             pgmPhysAllocLargePage(PVMCC pVM, RTGCPHYS GCPhys);
@@ -3973,7 +4101,7 @@ int             pgmPhysFreePage(PVM pVM, PGMMFREEPAGESREQ pReq, uint32_t *pcPend
                                 PGMPAGETYPE enmNewType);
 void            pgmPhysInvalidRamRangeTlbs(PVMCC pVM);
 void            pgmPhysInvalidatePageMapTLB(PVMCC pVM);
-void            pgmPhysInvalidatePageMapTLBEntry(PVM pVM, RTGCPHYS GCPhys);
+void            pgmPhysInvalidatePageMapTLBEntry(PVMCC pVM, RTGCPHYS GCPhys);
 PPGMRAMRANGE    pgmPhysGetRangeSlow(PVM pVM, RTGCPHYS GCPhys);
 PPGMRAMRANGE    pgmPhysGetRangeAtOrAboveSlow(PVM pVM, RTGCPHYS GCPhys);
 PPGMPAGE        pgmPhysGetPageSlow(PVM pVM, RTGCPHYS GCPhys);
@@ -24,6 +24,7 @@
 #include <VBox/cdefs.h>
 #include <VBox/types.h>
 #include <VBox/vmm/ssm.h>
+#include <VBox/vmm/stam.h>
 #include <iprt/critsect.h>
 
 RT_C_DECLS_BEGIN
@@ -317,6 +318,10 @@ typedef struct SSM
     /** Current pass (for STAM). */
     uint32_t                uPass;
     uint32_t                u32Alignment;
+    /** Number of blocks compressed into SSM_REC_TYPE_RAW_ZIP records. */
+    STAMCOUNTER             StatZipBlocks;
+    /** Number of single block writes batched up for the compression workers. */
+    STAMCOUNTER             StatZipBatchedBlocks;
 } SSM;
 /** Pointer to SSM VM instance data. */
 typedef SSM *PSSM;
@@ -23,21 +23,149 @@
 
 
 /**
- * Used to unlink a timer from the active list.
+ * Picks the number of skip list levels for a timer about to be linked.
  *
+ * @returns Level count, 0 to TM_SKIPLIST_LEVELS.
  * @param   pQueue      The timer queue.
- * @param   pTimer      The timer that needs linking.
  *
  * @remarks Called while owning the relevant queue lock.
  */
-DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+DECL_FORCE_INLINE(uint32_t) tmTimerQueuePickSkipLevels(PTMTIMERQUEUE pQueue)
 {
-#ifdef VBOX_STRICT
-    TMTIMERSTATE const enmState = pTimer->enmState;
-    Assert(  pTimer->enmClock == TMCLOCK_VIRTUAL_SYNC
-           ? enmState == TMTIMERSTATE_ACTIVE
-           : enmState == TMTIMERSTATE_PENDING_SCHEDULE || enmState == TMTIMERSTATE_PENDING_STOP_SCHEDULE);
-#endif
+    /* xorshift32, the seed must never be zero. */
+    uint32_t uSeed = pQueue->uSkipSeed;
+    if (RT_UNLIKELY(!uSeed))
+        uSeed = UINT32_C(0x9e3779b9) ^ (uint32_t)pQueue->enmClock;
+    uSeed ^= uSeed << 13;
+    uSeed ^= uSeed >> 17;
+    uSeed ^= uSeed << 5;
+    pQueue->uSkipSeed = uSeed;
+
+    /* Promote with a probability of 1/4 per level. */
+    uint32_t cLevels = 0;
+    while (cLevels < TM_SKIPLIST_LEVELS && !(uSeed & 3))
+    {
+        cLevels++;
+        uSeed >>= 2;
+    }
+    return cLevels;
+}
+
+
+/**
+ * Links a timer into the active list of a timer queue.
+ *
+ * The skip list levels are used to locate the insertion point, the new timer
+ * goes after any timers with the same expire time.
+ *
+ * @param   pQueue          The queue.
+ * @param   pTimer          The timer.
+ * @param   u64Expire       The timer expiration time.
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECL_FORCE_INLINE(void) tmTimerQueueLinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer, uint64_t u64Expire)
+{
+    Assert(!pTimer->offNext);
+    Assert(!pTimer->offPrev);
+    Assert(!pTimer->cSkipLevels);
+    Assert(pTimer->enmState == TMTIMERSTATE_ACTIVE || pTimer->enmClock != TMCLOCK_VIRTUAL_SYNC); /* (active is not a stable state) */
+
+    /*
+     * Descend the skip list levels recording the last timer not expiring
+     * after us on each of them.  A timer on one level is also on all the
+     * levels below it, so each level continues where the previous left off.
+     */
+    PTMTIMER apSkipPrev[TM_SKIPLIST_LEVELS];
+    PTMTIMER pPrev = NULL;
+    unsigned iLvl  = TM_SKIPLIST_LEVELS;
+    while (iLvl-- > 0)
+    {
+        PTMTIMER pCur = pPrev ? TMTIMER_GET_SKIP_NEXT(pPrev, iLvl) : TMTIMER_GET_SKIP_HEAD(pQueue, iLvl);
+        while (pCur && pCur->u64Expire <= u64Expire)
+        {
+            pPrev = pCur;
+            pCur  = TMTIMER_GET_SKIP_NEXT(pCur, iLvl);
+        }
+        apSkipPrev[iLvl] = pPrev;
+    }
+
+    /*
+     * Finish off on the active list itself.
+     */
+    PTMTIMER pCur = pPrev ? TMTIMER_GET_NEXT(pPrev) : TMTIMER_GET_HEAD(pQueue);
+    while (pCur && pCur->u64Expire <= u64Expire)
+    {
+        pPrev = pCur;
+        pCur  = TMTIMER_GET_NEXT(pCur);
+    }
+
+    TMTIMER_SET_NEXT(pTimer, pCur);
+    TMTIMER_SET_PREV(pTimer, pPrev);
+    if (pCur)
+        TMTIMER_SET_PREV(pCur, pTimer);
+    if (pPrev)
+    {
+        TMTIMER_SET_NEXT(pPrev, pTimer);
+        if (!pCur)
+            DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, "tmTimerQueueLinkActive tail", R3STRING(pTimer->pszDesc));
+    }
+    else
+    {
+        TMTIMER_SET_HEAD(pQueue, pTimer);
+        ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
+        DBGFTRACE_U64_TAG2(pTimer->CTX_SUFF(pVM), u64Expire, pCur ? "tmTimerQueueLinkActive head" : "tmTimerQueueLinkActive empty",
+                           R3STRING(pTimer->pszDesc));
+    }
+
+    /*
+     * Link it into the skip list levels it was promoted to.
+     */
+    uint32_t const cLevels = tmTimerQueuePickSkipLevels(pQueue);
+    for (iLvl = 0; iLvl < cLevels; iLvl++)
+    {
+        PTMTIMER const pSkipPrev = apSkipPrev[iLvl];
+        PTMTIMER const pSkipNext = pSkipPrev ? TMTIMER_GET_SKIP_NEXT(pSkipPrev, iLvl) : TMTIMER_GET_SKIP_HEAD(pQueue, iLvl);
+        TMTIMER_SET_SKIP_NEXT(pTimer, iLvl, pSkipNext);
+        TMTIMER_SET_SKIP_PREV(pTimer, iLvl, pSkipPrev);
+        if (pSkipNext)
+            TMTIMER_SET_SKIP_PREV(pSkipNext, iLvl, pTimer);
+        if (pSkipPrev)
+            TMTIMER_SET_SKIP_NEXT(pSkipPrev, iLvl, pTimer);
+        else
+            TMTIMER_SET_SKIP_HEAD(pQueue, iLvl, pTimer);
+    }
+    pTimer->cSkipLevels = cLevels;
+}
+
+
+/**
+ * Unlinks a timer from the active list and its skip list levels without
+ * checking the timer state.
+ *
+ * @param   pQueue      The timer queue.
+ * @param   pTimer      The timer that needs unlinking.
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActiveWorker(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+{
+    uint32_t const cLevels = pTimer->cSkipLevels;
+    Assert(cLevels <= TM_SKIPLIST_LEVELS);
+    for (uint32_t iLvl = 0; iLvl < cLevels; iLvl++)
+    {
+        const PTMTIMER pSkipPrev = TMTIMER_GET_SKIP_PREV(pTimer, iLvl);
+        const PTMTIMER pSkipNext = TMTIMER_GET_SKIP_NEXT(pTimer, iLvl);
+        if (pSkipPrev)
+            TMTIMER_SET_SKIP_NEXT(pSkipPrev, iLvl, pSkipNext);
+        else
+            TMTIMER_SET_SKIP_HEAD(pQueue, iLvl, pSkipNext);
+        if (pSkipNext)
+            TMTIMER_SET_SKIP_PREV(pSkipNext, iLvl, pSkipPrev);
+        pTimer->aoffSkipNext[iLvl] = 0;
+        pTimer->aoffSkipPrev[iLvl] = 0;
+    }
+    pTimer->cSkipLevels = 0;
 
     const PTMTIMER pPrev = TMTIMER_GET_PREV(pTimer);
     const PTMTIMER pNext = TMTIMER_GET_NEXT(pTimer);
@@ -55,5 +183,25 @@ DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActive(PTMTIMERQUEUE pQueue, PTMTIMER
     pTimer->offPrev = 0;
 }
 
+
+/**
+ * Used to unlink a timer from the active list.
+ *
+ * @param   pQueue      The timer queue.
+ * @param   pTimer      The timer that needs linking.
+ *
+ * @remarks Called while owning the relevant queue lock.
+ */
+DECL_FORCE_INLINE(void) tmTimerQueueUnlinkActive(PTMTIMERQUEUE pQueue, PTMTIMER pTimer)
+{
+#ifdef VBOX_STRICT
+    TMTIMERSTATE const enmState = pTimer->enmState;
+    Assert(  pTimer->enmClock == TMCLOCK_VIRTUAL_SYNC
+           ? enmState == TMTIMERSTATE_ACTIVE
+           : enmState == TMTIMERSTATE_PENDING_SCHEDULE || enmState == TMTIMERSTATE_PENDING_STOP_SCHEDULE);
+#endif
+    tmTimerQueueUnlinkActiveWorker(pQueue, pTimer);
+}
+
 #endif /* !VMM_INCLUDED_SRC_include_TMInline_h */
 
@@ -106,6 +106,11 @@ typedef enum TMTIMERSTATE
      && (enmState) >= TMTIMERSTATE_PENDING_SCHEDULE_SET_EXPIRE)
 
 
+/** Number of skip list levels kept on top of the active timer lists.
+ * Each level holds roughly a quarter of the timers of the level below, so
+ * four levels keep insertion logarithmic up to about a thousand timers. */
+#define TM_SKIPLIST_LEVELS          4
+
 /**
  * Internal representation of a timer.
  *
@@ -181,6 +186,15 @@ typedef struct TMTIMER
     int32_t                 offNext;
     /** Timer relative offset to the previous timer in the chain. */
     int32_t                 offPrev;
+    /** Number of skip list levels above the active list this timer is linked into
+     * (0 to TM_SKIPLIST_LEVELS).  Only valid while in the active list. */
+    uint32_t                cSkipLevels;
+    /** Explicit alignment padding. */
+    uint32_t                u32SkipPadding;
+    /** Timer relative offsets to the next timer on each skip list level. */
+    int32_t                 aoffSkipNext[TM_SKIPLIST_LEVELS];
+    /** Timer relative offsets to the previous timer on each skip list level. */
+    int32_t                 aoffSkipPrev[TM_SKIPLIST_LEVELS];
 
     /** Pointer to the VM the timer belongs to - R3 Ptr. */
     PVMR3                   pVMR3;
@@ -254,6 +268,18 @@ AssertCompileMemberSize(TMTIMER, enmState, sizeof(uint32_t));
 #define TMTIMER_SET_PREV(pTimer, pPrev) ((pTimer)->offPrev = (pPrev) ? (intptr_t)(pPrev) - (intptr_t)(pTimer) : 0)
 /** Set the next timer link. */
 #define TMTIMER_SET_NEXT(pTimer, pNext) ((pTimer)->offNext = (pNext) ? (intptr_t)(pNext) - (intptr_t)(pTimer) : 0)
+/** Get the previous timer on skip list level @a iLvl. */
+#define TMTIMER_GET_SKIP_PREV(pTimer, iLvl) \
+    ((PTMTIMER)((pTimer)->aoffSkipPrev[iLvl] ? (intptr_t)(pTimer) + (pTimer)->aoffSkipPrev[iLvl] : 0))
+/** Get the next timer on skip list level @a iLvl. */
+#define TMTIMER_GET_SKIP_NEXT(pTimer, iLvl) \
+    ((PTMTIMER)((pTimer)->aoffSkipNext[iLvl] ? (intptr_t)(pTimer) + (pTimer)->aoffSkipNext[iLvl] : 0))
+/** Set the previous timer link on skip list level @a iLvl. */
+#define TMTIMER_SET_SKIP_PREV(pTimer, iLvl, pPrev) \
+    ((pTimer)->aoffSkipPrev[iLvl] = (pPrev) ? (intptr_t)(pPrev) - (intptr_t)(pTimer) : 0)
+/** Set the next timer link on skip list level @a iLvl. */
+#define TMTIMER_SET_SKIP_NEXT(pTimer, iLvl, pNext) \
+    ((pTimer)->aoffSkipNext[iLvl] = (pNext) ? (intptr_t)(pNext) - (intptr_t)(pTimer) : 0)
 
 
 /**
@@ -286,9 +312,22 @@ typedef struct TMTIMERQUEUE
     int32_t volatile        offSchedule;
     /** The clock for this queue. */
     TMCLOCK                 enmClock;
-    /** Pad the structure up to 32 bytes. */
-    uint32_t                au32Padding[3];
+    /** Random state for picking the skip list levels of newly linked timers.
+     * Lazily seeded, only accessed while owning the queue lock. */
+    uint32_t                uSkipSeed;
+    /** Heads of the skip list levels on top of the active list.
+     *
+     * Each level is an ordered subset of the level below it (level 0 being a
+     * subset of offActive), letting tmTimerQueueLinkActive find the insertion
+     * point without walking the whole active list.  The list itself is left
+     * intact so the timer runners and info handlers can still walk it in order.
+     *
+     * The offsets are relative to the queue structure. */
+    int32_t                 aoffSkipHeads[TM_SKIPLIST_LEVELS];
+    /** Pad the structure up to 48 bytes. */
+    uint32_t                au32Padding[2];
 } TMTIMERQUEUE;
+AssertCompileSizeAlignment(TMTIMERQUEUE, 16);
 
 /** Pointer to a timer queue. */
 typedef TMTIMERQUEUE *PTMTIMERQUEUE;
@@ -297,6 +336,12 @@ typedef TMTIMERQUEUE *PTMTIMERQUEUE;
 #define TMTIMER_GET_HEAD(pQueue)        ((PTMTIMER)((pQueue)->offActive ? (intptr_t)(pQueue) + (pQueue)->offActive : 0))
 /** Set the head of the active timer list. */
 #define TMTIMER_SET_HEAD(pQueue, pHead) ((pQueue)->offActive = pHead ? (intptr_t)pHead - (intptr_t)(pQueue) : 0)
+/** Get the head of skip list level @a iLvl. */
+#define TMTIMER_GET_SKIP_HEAD(pQueue, iLvl) \
+    ((PTMTIMER)((pQueue)->aoffSkipHeads[iLvl] ? (intptr_t)(pQueue) + (pQueue)->aoffSkipHeads[iLvl] : 0))
+/** Set the head of skip list level @a iLvl. */
+#define TMTIMER_SET_SKIP_HEAD(pQueue, iLvl, pHead) \
+    ((pQueue)->aoffSkipHeads[iLvl] = (pHead) ? (intptr_t)(pHead) - (intptr_t)(pQueue) : 0)
 
 
 /**
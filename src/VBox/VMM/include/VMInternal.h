@@ -225,6 +225,24 @@ typedef struct VMINTUSERPERVM
     /** Number of times we've raced someone when pushing the other requests back
      * onto the list. */
     STAMCOUNTER                     StatReqPushBackRaces;
+    /** Number of times more than one request was taken off a virtual CPU queue
+     * and reversed into FIFO order. */
+    STAMCOUNTER                     StatReqBatches;
+    /** Number of requests served from such a batch without touching the queue. */
+    STAMCOUNTER                     StatReqBatched;
+    /** Number of synchronous calls made directly on the EMT without a packet. */
+    STAMCOUNTER                     StatReqCallDirect;
+    /** Time from queuing a request till an EMT starts processing it. */
+    STAMPROFILE                     StatReqLatency;
+    /** @name Request latency histogram.
+     * @{ */
+    STAMCOUNTER                     StatReqLatencyBelow1us;
+    STAMCOUNTER                     StatReqLatency1usTo10us;
+    STAMCOUNTER                     StatReqLatency10usTo100us;
+    STAMCOUNTER                     StatReqLatency100usTo1ms;
+    STAMCOUNTER                     StatReqLatency1msTo10ms;
+    STAMCOUNTER                     StatReqLatencyOver10ms;
+    /** @} */
 # endif
 
     /** Pointer to the support library session.
@@ -347,6 +365,12 @@ typedef struct VMINTUSERPERVMCPU
     volatile PVMREQ                 pNormalReqs;
     /** Head of the priority request queue. Atomic. */
     volatile PVMREQ                 pPriorityReqs;
+    /** Normal requests taken off pNormalReqs in one batch, oldest first.
+     * Only accessed by the EMT. */
+    PVMREQ                          pNormalReqsFifo;
+    /** Priority requests taken off pPriorityReqs in one batch, oldest first.
+     * Only accessed by the EMT. */
+    PVMREQ                          pPriorityReqsFifo;
 
     /** The handle to the EMT thread. */
     RTTHREAD                        ThreadEMT;
@@ -34,6 +34,7 @@
 #include <iprt/file.h>
 #include <iprt/initterm.h>
 #include <iprt/mem.h>
+#include <iprt/mp.h>
 #include <iprt/stream.h>
 #include <iprt/string.h>
 #include <iprt/time.h>
@@ -52,6 +53,13 @@
 # define TSTSSM_ITEM_SIZE    (5*_1M)
 #endif
 
+/** The size of the chunks the 6th item saves with SSMR3PutMemDirect. */
+#define TSTSSM_ITEM06_CHUNK_SIZE    _64K
+/** The number of chunks the 6th item saves. */
+#define TSTSSM_ITEM06_CHUNKS        8
+/** The value the 6th item saves after the chunks. */
+#define TSTSSM_ITEM06_TRAILER       UINT32_C(0x19660606)
+
 
 /*********************************************************************************************************************************
 *   Global Variables                                                                                                             *
@@ -63,6 +71,8 @@ uint8_t         gabBigMem[_1M];
 #else
 uint8_t         gabBigMem[8*_1M];
 #endif
+/** The file offsets of the chunks Item06Load skipped, UINT64_MAX if read. */
+uint64_t        gaoffItem06Chunks[TSTSSM_ITEM06_CHUNKS];
 
 
 /** initializes gabBigMem with some non zero stuff. */
@@ -619,6 +629,199 @@ DECLCALLBACK(int) Item04Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32
 }
 
 
+/**
+ * Execute state save operation.
+ *
+ * Saves gabBigMem page by page with a few bytes of other data ahead of each
+ * page, the way PGM saves RAM.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM handle.
+ * @param   pSSM            SSM operation handle.
+ */
+DECLCALLBACK(int) Item05Save(PVM pVM, PSSMHANDLE pSSM)
+{
+    NOREF(pVM);
+    uint64_t u64Start = RTTimeNanoTS();
+
+    for (uint32_t off = 0; off < sizeof(gabBigMem); off += PAGE_SIZE)
+    {
+        int rc = SSMR3PutU8(pSSM, (uint8_t)(off >> PAGE_SHIFT));
+        if (RT_SUCCESS(rc))
+            rc = SSMR3PutU64(pSSM, off);
+        if (RT_SUCCESS(rc))
+            rc = SSMR3PutMem(pSSM, &gabBigMem[off], PAGE_SIZE);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("Item05: Put page at %#x -> %Rrc\n", off, rc);
+            return rc;
+        }
+    }
+
+    uint64_t u64Elapsed = RTTimeNanoTS() - u64Start;
+    RTPrintf("tstSSM: Saved 5th item in %'RI64 ns\n", u64Elapsed);
+    return 0;
+}
+
+/**
+ * Prepare state load operation.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM handle.
+ * @param   pSSM            SSM operation handle.
+ * @param   uVersion        The data layout version.
+ * @param   uPass           The data pass.
+ */
+DECLCALLBACK(int) Item05Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    NOREF(pVM); NOREF(uPass);
+    if (uVersion != 5)
+    {
+        RTPrintf("Item05: uVersion=%#x, expected 5\n", uVersion);
+        return VERR_GENERAL_FAILURE;
+    }
+
+    for (uint32_t off = 0; off < sizeof(gabBigMem); off += PAGE_SIZE)
+    {
+        uint8_t  u8;
+        uint64_t u64;
+        char     achPage[PAGE_SIZE];
+        int rc = SSMR3GetU8(pSSM, &u8);
+        if (RT_SUCCESS(rc))
+            rc = SSMR3GetU64(pSSM, &u64);
+        if (RT_SUCCESS(rc))
+            rc = SSMR3GetMem(pSSM, &achPage[0], PAGE_SIZE);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("Item05: Get page at %#x -> %Rrc\n", off, rc);
+            return rc;
+        }
+        if (u8 != (uint8_t)(off >> PAGE_SHIFT) || u64 != off)
+        {
+            RTPrintf("Item05: header mismatch at %#x: u8=%#x u64=%#RX64\n", off, u8, u64);
+            return VERR_GENERAL_FAILURE;
+        }
+        if (memcmp(achPage, &gabBigMem[off], PAGE_SIZE))
+        {
+            RTPrintf("Item05: compare failed. mem offset=%#x\n", off);
+            return VERR_GENERAL_FAILURE;
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Execute state save operation.
+ *
+ * Saves the first part of gabBigMem as chunks using SSMR3PutMemDirect, each
+ * preceded by its index, the way PGM saves RAM for lazy restoring.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM handle.
+ * @param   pSSM            SSM operation handle.
+ */
+DECLCALLBACK(int) Item06Save(PVM pVM, PSSMHANDLE pSSM)
+{
+    NOREF(pVM);
+    for (uint32_t i = 0; i < TSTSSM_ITEM06_CHUNKS; i++)
+    {
+        int rc = SSMR3PutU32(pSSM, i);
+        if (RT_SUCCESS(rc))
+            rc = SSMR3PutMemDirect(pSSM, &gabBigMem[i * TSTSSM_ITEM06_CHUNK_SIZE], TSTSSM_ITEM06_CHUNK_SIZE);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("Item06: Put chunk #%u -> %Rrc\n", i, rc);
+            return rc;
+        }
+    }
+    return SSMR3PutU32(pSSM, TSTSSM_ITEM06_TRAILER);
+}
+
+/**
+ * Prepare state load operation.
+ *
+ * Skips the even chunks using SSMR3SkipMemDirect, recording their file offsets
+ * in gaoffItem06Chunks, and reads the odd ones.
+ *
+ * @returns VBox status code.
+ * @param   pVM             The cross context VM handle.
+ * @param   pSSM            SSM operation handle.
+ * @param   uVersion        The data layout version.
+ * @param   uPass           The data pass.
+ */
+DECLCALLBACK(int) Item06Load(PVM pVM, PSSMHANDLE pSSM, uint32_t uVersion, uint32_t uPass)
+{
+    NOREF(pVM); NOREF(uPass);
+    if (uVersion != 6)
+    {
+        RTPrintf("Item06: uVersion=%#x, expected 6\n", uVersion);
+        return VERR_GENERAL_FAILURE;
+    }
+
+    for (uint32_t i = 0; i < TSTSSM_ITEM06_CHUNKS; i++)
+    {
+        uint32_t u32 = UINT32_MAX;
+        int rc = SSMR3GetU32(pSSM, &u32);
+        if (RT_FAILURE(rc) || u32 != i)
+        {
+            RTPrintf("Item06: chunk #%u: index %#x rc=%Rrc\n", i, u32, rc);
+            return RT_FAILURE(rc) ? rc : VERR_GENERAL_FAILURE;
+        }
+
+        gaoffItem06Chunks[i] = UINT64_MAX;
+        if (!(i & 1))
+        {
+            rc = SSMR3SkipMemDirect(pSSM, TSTSSM_ITEM06_CHUNK_SIZE, &gaoffItem06Chunks[i]);
+            if (RT_FAILURE(rc))
+            {
+                RTPrintf("Item06: SSMR3SkipMemDirect chunk #%u -> %Rrc\n", i, rc);
+                return rc;
+            }
+        }
+        else
+        {
+            static uint8_t s_abChunk[TSTSSM_ITEM06_CHUNK_SIZE];
+            rc = SSMR3GetMem(pSSM, s_abChunk, sizeof(s_abChunk));
+            if (RT_FAILURE(rc))
+            {
+                RTPrintf("Item06: SSMR3GetMem chunk #%u -> %Rrc\n", i, rc);
+                return rc;
+            }
+            if (memcmp(s_abChunk, &gabBigMem[i * TSTSSM_ITEM06_CHUNK_SIZE], sizeof(s_abChunk)))
+            {
+                RTPrintf("Item06: compare failed. chunk #%u\n", i);
+                return VERR_GENERAL_FAILURE;
+            }
+        }
+    }
+
+    /* Make sure skipping left the stream at the right place. */
+    uint32_t u32 = 0;
+    int rc = SSMR3GetU32(pSSM, &u32);
+    if (RT_FAILURE(rc) || u32 != TSTSSM_ITEM06_TRAILER)
+    {
+        RTPrintf("Item06: trailer %#x rc=%Rrc\n", u32, rc);
+        return RT_FAILURE(rc) ? rc : VERR_GENERAL_FAILURE;
+    }
+    return 0;
+}
+
+
+/**
+ * STAMR3Enum callback for getting the value of a counter.
+ */
+static DECLCALLBACK(int) tstSSMQueryCounter(const char *pszName, STAMTYPE enmType, void *pvSample, STAMUNIT enmUnit,
+                                            STAMVISIBILITY enmVisiblity, const char *pszDesc, void *pvUser)
+{
+    NOREF(pszName); NOREF(enmUnit); NOREF(enmVisiblity); NOREF(pszDesc);
+    if (enmType == STAMTYPE_COUNTER)
+        *(uint64_t *)pvUser = ((PSTAMCOUNTER)pvSample)->c;
+    return VINF_SUCCESS;
+}
+
+
 /**
  * Creates a mockup VM structure for testing SSM.
  *
@@ -764,6 +967,27 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    rc = SSMR3RegisterInternal(pVM, "SSM Testcase Data Item no.5 (mem page by page)", 0, 5, sizeof(gabBigMem) * 2,
+                               NULL, NULL, NULL,
+                               NULL, Item05Save, NULL,
+                               NULL, Item05Load, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3Register #5 -> %Rrc\n", rc);
+        return 1;
+    }
+
+    rc = SSMR3RegisterInternal(pVM, "SSM Testcase Data Item no.6 (direct mem)", 0, 6,
+                               TSTSSM_ITEM06_CHUNKS * (TSTSSM_ITEM06_CHUNK_SIZE + sizeof(uint32_t)),
+                               NULL, NULL, NULL,
+                               NULL, Item06Save, NULL,
+                               NULL, Item06Load, NULL);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("SSMR3Register #6 -> %Rrc\n", rc);
+        return 1;
+    }
+
     /*
      * Attempt a save.
      */
@@ -786,6 +1010,24 @@ int main(int argc, char **argv)
     }
     RTPrintf("tstSSM: file size %'RI64 bytes\n", Info.cbObject);
 
+    /*
+     * The page sized writes of the 5th item should've been batched up for the
+     * compression workers, which exist when there is more than one CPU.
+     */
+    uint64_t cBatchedBlocks = 0;
+    rc = STAMR3Enum(pVM->pUVM, "/SSM/ZipBatchedBlocks", tstSSMQueryCounter, &cBatchedBlocks);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstSSM: STAMR3Enum -> %Rrc\n", rc);
+        return 1;
+    }
+    RTPrintf("tstSSM: %'RU64 batched blocks\n", cBatchedBlocks);
+    if (RTMpGetOnlineCount() > 1 && cBatchedBlocks == 0)
+    {
+        RTPrintf("tstSSM: the page sized writes didn't take the parallel compression path\n");
+        return 1;
+    }
+
     /*
      * Attempt a load.
      */
@@ -800,6 +1042,34 @@ int main(int argc, char **argv)
     u64Elapsed = RTTimeNanoTS() - u64Start;
     RTPrintf("tstSSM: Loaded in %'RI64 ns\n", u64Elapsed);
 
+    /*
+     * The chunks of the 6th item skipped during the load must be found at the
+     * returned file offsets.
+     */
+    RTFILE hFile;
+    rc = RTFileOpen(&hFile, pszFilename, RTFILE_O_READ | RTFILE_O_OPEN | RTFILE_O_DENY_NONE);
+    if (RT_FAILURE(rc))
+    {
+        RTPrintf("tstSSM: RTFileOpen -> %Rrc\n", rc);
+        return 1;
+    }
+    for (uint32_t i = 0; i < TSTSSM_ITEM06_CHUNKS; i += 2)
+    {
+        static uint8_t s_abChunk[TSTSSM_ITEM06_CHUNK_SIZE];
+        rc = RTFileReadAt(hFile, gaoffItem06Chunks[i], s_abChunk, sizeof(s_abChunk), NULL);
+        if (RT_FAILURE(rc))
+        {
+            RTPrintf("tstSSM: RTFileReadAt(,%#RX64,,) for item 6 chunk #%u -> %Rrc\n", gaoffItem06Chunks[i], i, rc);
+            return 1;
+        }
+        if (memcmp(s_abChunk, &gabBigMem[i * TSTSSM_ITEM06_CHUNK_SIZE], sizeof(s_abChunk)))
+        {
+            RTPrintf("tstSSM: item 6 chunk #%u at %#RX64 doesn't match\n", i, gaoffItem06Chunks[i]);
+            return 1;
+        }
+    }
+    RTFileClose(hFile);
+
     /*
      * Validate it.
      */
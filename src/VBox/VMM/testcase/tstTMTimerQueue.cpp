@@ -0,0 +1,214 @@
+/* $Id: tstTMTimerQueue.cpp $ */
+/** @file
+ * Timer queue micro benchmark, comparing the plain sorted active list with
+ * the skip list indexed one.
+ */
+
+/*
+ * Copyright (C) 2006-2020 Oracle Corporation
+ *
+ * This file is part of VirtualBox Open Source Edition (OSE), as
+ * available from http://www.virtualbox.org. This file is free software;
+ * you can redistribute it and/or modify it under the terms of the GNU
+ * General Public License (GPL) as published by the Free Software
+ * Foundation, in version 2 as it comes in the "COPYING" file of the
+ * VirtualBox OSE distribution. VirtualBox OSE is distributed in the
+ * hope that it will be useful, but WITHOUT ANY WARRANTY of any kind.
+ */
+
+
+/*********************************************************************************************************************************
+*   Header Files                                                                                                                 *
+*********************************************************************************************************************************/
+#include <VBox/vmm/tm.h>
+#include <VBox/vmm/dbgftrace.h>
+#include "TMInternal.h"
+
+#include <iprt/asm.h>
+#include <iprt/mem.h>
+#include <iprt/rand.h>
+#include <iprt/test.h>
+#include <iprt/time.h>
+
+#include "TMInline.h"
+
+
+/*********************************************************************************************************************************
+*   Structures and Typedefs                                                                                                      *
+*********************************************************************************************************************************/
+/**
+ * The queue and its timers.
+ *
+ * Allocated as one block since all the links are 32-bit relative offsets.
+ */
+typedef struct TSTTMQUEUE
+{
+    TMTIMERQUEUE    Queue;
+    TMTIMER         aTimers[1];
+} TSTTMQUEUE;
+typedef TSTTMQUEUE *PTSTTMQUEUE;
+
+/** One operation of the benchmark: rearm a timer with a new expire time. */
+typedef struct TSTTMOP
+{
+    uint32_t        iTimer;
+    uint64_t        u64Expire;
+} TSTTMOP;
+
+
+/*********************************************************************************************************************************
+*   Global Variables                                                                                                             *
+*********************************************************************************************************************************/
+/** The number of set/stop/poll rounds per configuration. */
+static uint32_t const g_cOps = 200000;
+
+
+/**
+ * The active list insertion as it was done before the skip list levels, used
+ * as the baseline.
+ */
+static void tstLinkActiveLinear(PTMTIMERQUEUE pQueue, PTMTIMER pTimer, uint64_t u64Expire)
+{
+    PTMTIMER pPrev = NULL;
+    PTMTIMER pCur  = TMTIMER_GET_HEAD(pQueue);
+    while (pCur && pCur->u64Expire <= u64Expire)
+    {
+        pPrev = pCur;
+        pCur  = TMTIMER_GET_NEXT(pCur);
+    }
+    TMTIMER_SET_NEXT(pTimer, pCur);
+    TMTIMER_SET_PREV(pTimer, pPrev);
+    if (pCur)
+        TMTIMER_SET_PREV(pCur, pTimer);
+    if (pPrev)
+        TMTIMER_SET_NEXT(pPrev, pTimer);
+    else
+    {
+        TMTIMER_SET_HEAD(pQueue, pTimer);
+        ASMAtomicWriteU64(&pQueue->u64Expire, u64Expire);
+    }
+}
+
+
+/**
+ * Checks that the active list and skip list levels are sorted and consistent.
+ */
+static void tstCheckQueue(PTMTIMERQUEUE pQueue, uint32_t cTimers)
+{
+    uint32_t cActive = 0;
+    PTMTIMER pPrev   = NULL;
+    for (PTMTIMER pCur = TMTIMER_GET_HEAD(pQueue); pCur; pPrev = pCur, pCur = TMTIMER_GET_NEXT(pCur), cActive++)
+    {
+        RTTESTI_CHECK_RETV(TMTIMER_GET_PREV(pCur) == pPrev);
+        RTTESTI_CHECK_RETV(!pPrev || pPrev->u64Expire <= pCur->u64Expire);
+    }
+    RTTESTI_CHECK(cActive == cTimers);
+    RTTESTI_CHECK(pQueue->u64Expire == (pQueue->offActive ? TMTIMER_GET_HEAD(pQueue)->u64Expire : (uint64_t)INT64_MAX));
+
+    for (unsigned iLvl = 0; iLvl < TM_SKIPLIST_LEVELS; iLvl++)
+    {
+        pPrev = NULL;
+        for (PTMTIMER pCur = TMTIMER_GET_SKIP_HEAD(pQueue, iLvl); pCur; pPrev = pCur, pCur = TMTIMER_GET_SKIP_NEXT(pCur, iLvl))
+        {
+            RTTESTI_CHECK_RETV(pCur->cSkipLevels > iLvl);
+            RTTESTI_CHECK_RETV(TMTIMER_GET_SKIP_PREV(pCur, iLvl) == pPrev);
+            RTTESTI_CHECK_RETV(!pPrev || pPrev->u64Expire <= pCur->u64Expire);
+        }
+    }
+}
+
+
+/**
+ * Runs one configuration.
+ *
+ * @param   cTimers     Number of active timers in the queue.
+ * @param   fSkipList   Whether to use the skip list or the plain list insertion.
+ * @param   paOps       The operations to perform, g_cOps entries.
+ */
+static void tstBenchmark(uint32_t cTimers, bool fSkipList, TSTTMOP const *paOps)
+{
+    PTSTTMQUEUE pThis = (PTSTTMQUEUE)RTMemAllocZ(RT_UOFFSETOF_DYN(TSTTMQUEUE, aTimers[cTimers]));
+    RTTESTI_CHECK_RETV(pThis);
+    PTMTIMERQUEUE pQueue = &pThis->Queue;
+    pQueue->enmClock  = TMCLOCK_VIRTUAL;
+    pQueue->u64Expire = INT64_MAX;
+
+    for (uint32_t i = 0; i < cTimers; i++)
+    {
+        PTMTIMER pTimer  = &pThis->aTimers[i];
+        pTimer->enmClock = TMCLOCK_VIRTUAL;
+        pTimer->enmState = TMTIMERSTATE_ACTIVE;
+        pTimer->u64Expire = RTRandU64Ex(0, _1T);
+        if (fSkipList)
+            tmTimerQueueLinkActive(pQueue, pTimer, pTimer->u64Expire);
+        else
+            tstLinkActiveLinear(pQueue, pTimer, pTimer->u64Expire);
+    }
+
+    uint64_t       nsSet  = 0;
+    uint64_t       nsStop = 0;
+    uint64_t       nsPoll = 0;
+    uint64_t       uSum   = 0;
+    for (uint32_t iOp = 0; iOp < g_cOps; iOp++)
+    {
+        PTMTIMER pTimer = &pThis->aTimers[paOps[iOp].iTimer % cTimers];
+
+        uint64_t nsStart = RTTimeNanoTS();
+        tmTimerQueueUnlinkActiveWorker(pQueue, pTimer);
+        uint64_t nsNow = RTTimeNanoTS();
+        nsStop += nsNow - nsStart;
+
+        nsStart = nsNow;
+        pTimer->u64Expire = paOps[iOp].u64Expire;
+        if (fSkipList)
+            tmTimerQueueLinkActive(pQueue, pTimer, pTimer->u64Expire);
+        else
+            tstLinkActiveLinear(pQueue, pTimer, pTimer->u64Expire);
+        nsNow = RTTimeNanoTS();
+        nsSet += nsNow - nsStart;
+
+        nsStart = nsNow;
+        uSum += ASMAtomicReadU64(&pQueue->u64Expire);
+        uSum += (uintptr_t)TMTIMER_GET_HEAD(pQueue);
+        nsPoll += RTTimeNanoTS() - nsStart;
+    }
+    NOREF(uSum);
+
+    tstCheckQueue(pQueue, cTimers);
+
+    const char *pszKind = fSkipList ? "skip list" : "list";
+    RTTestIValueF(nsSet  / g_cOps, RTTESTUNIT_NS_PER_CALL, "%u timers, %s: set", cTimers, pszKind);
+    RTTestIValueF(nsStop / g_cOps, RTTESTUNIT_NS_PER_CALL, "%u timers, %s: stop", cTimers, pszKind);
+    RTTestIValueF(nsPoll / g_cOps, RTTESTUNIT_NS_PER_CALL, "%u timers, %s: poll", cTimers, pszKind);
+
+    RTMemFree(pThis);
+}
+
+
+int main()
+{
+    RTTEST hTest;
+    RTEXITCODE rcExit = RTTestInitAndCreate("tstTMTimerQueue", &hTest);
+    if (rcExit != RTEXITCODE_SUCCESS)
+        return rcExit;
+    RTTestBanner(hTest);
+
+    TSTTMOP *paOps = (TSTTMOP *)RTMemAlloc(sizeof(paOps[0]) * g_cOps);
+    RTTESTI_CHECK_RET(paOps, RTTestSummaryAndDestroy(hTest));
+    for (uint32_t i = 0; i < g_cOps; i++)
+    {
+        paOps[i].iTimer    = RTRandU32();
+        paOps[i].u64Expire = RTRandU64Ex(0, _1T);
+    }
+
+    static uint32_t const s_acTimers[] = { 4, 16, 64, 256, 1024, 4096 };
+    for (unsigned i = 0; i < RT_ELEMENTS(s_acTimers); i++)
+    {
+        RTTestISubF("%u timers", s_acTimers[i]);
+        tstBenchmark(s_acTimers[i], false /*fSkipList*/, paOps);
+        tstBenchmark(s_acTimers[i], true  /*fSkipList*/, paOps);
+    }
+
+    RTMemFree(paOps);
+    return RTTestSummaryAndDestroy(hTest);
+}
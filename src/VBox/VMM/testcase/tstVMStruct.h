@@ -1168,6 +1168,9 @@
     GEN_CHECK_OFF(TMTIMER, offScheduleNext);
     GEN_CHECK_OFF(TMTIMER, offNext);
     GEN_CHECK_OFF(TMTIMER, offPrev);
+    GEN_CHECK_OFF(TMTIMER, cSkipLevels);
+    GEN_CHECK_OFF(TMTIMER, aoffSkipNext);
+    GEN_CHECK_OFF(TMTIMER, aoffSkipPrev);
     GEN_CHECK_OFF(TMTIMER, pVMR0);
     GEN_CHECK_OFF(TMTIMER, pVMR3);
     GEN_CHECK_OFF(TMTIMER, pVMRC);
@@ -1181,6 +1184,8 @@
     GEN_CHECK_OFF(TMTIMERQUEUE, offActive);
     GEN_CHECK_OFF(TMTIMERQUEUE, offSchedule);
     GEN_CHECK_OFF(TMTIMERQUEUE, enmClock);
+    GEN_CHECK_OFF(TMTIMERQUEUE, uSkipSeed);
+    GEN_CHECK_OFF(TMTIMERQUEUE, aoffSkipHeads);
 
     GEN_CHECK_SIZE(TRPM);
     GEN_CHECK_SIZE(TRPMCPU);